@@ -114,15 +114,26 @@ class Qwen3ASRConverter:
         (r"thinker\.model\.layers\.(\d+)\.mlp\.down_proj\.weight", "blk.{}.ffn_down.weight"),
     ]
 
+    # Projections that read the same input, fused by --fuse into one tensor
+    # whose rows are the parts in this order (the graph builders split it
+    # with views): fused name -> part names
+    FUSED_PROJECTIONS = {
+        "attn_qkv": ["attn_q", "attn_k", "attn_v"],
+        "ffn_gate_up": ["ffn_gate", "ffn_up"],
+    }
+    FUSED_PART_PATTERN = r"^(.*blk\.\d+\.)(attn_q|attn_k|attn_v|ffn_gate|ffn_up)\.(weight|bias)$"
+
     def __init__(
         self,
         input_dir: Path,
         output_path: Path,
         output_type: str = "f16",
+        fuse: bool = False,
     ):
         self.input_dir = input_dir
         self.output_path = output_path
         self.output_type = output_type
+        self.fuse = fuse
 
         # Load config
         self.config = self._load_config()
@@ -223,6 +234,46 @@ class Qwen3ASRConverter:
                 for name in f.keys():
                     yield name, f.get_tensor(name)
 
+    def _fuse_projections(self, tensors: list[tuple[str, torch.Tensor]]) -> list[tuple[str, torch.Tensor]]:
+        """Concatenate the Q/K/V and gate/up weights of each layer along the output rows.
+
+        A group is fused only when every part has a weight (the encoder FFN
+        has no gate, so its ffn_up stays as it is). Missing biases of a fused
+        group (the encoder k_proj has none) become zeros.
+        """
+        groups: dict[tuple[str, str], dict[str, dict[str, torch.Tensor]]] = {}
+        out = []
+        for name, tensor in tensors:
+            match = re.match(self.FUSED_PART_PATTERN, name)
+            if not match:
+                out.append((name, tensor))
+                continue
+            prefix, part, kind = match.groups()
+            fused = next(f for f, parts in self.FUSED_PROJECTIONS.items() if part in parts)
+            groups.setdefault((prefix, fused), {}).setdefault(kind, {})[part] = tensor
+
+        n_fused = 0
+        for (prefix, fused), kinds in groups.items():
+            parts = self.FUSED_PROJECTIONS[fused]
+            weights = kinds.get("weight", {})
+            if any(p not in weights for p in parts):
+                for kind, by_part in kinds.items():
+                    out.extend((f"{prefix}{p}.{kind}", t) for p, t in by_part.items())
+                continue
+
+            out.append((f"{prefix}{fused}.weight", torch.cat([weights[p] for p in parts], dim=0)))
+            biases = kinds.get("bias")
+            if biases:
+                dtype = next(iter(biases.values())).dtype
+                out.append((f"{prefix}{fused}.bias", torch.cat([
+                    biases[p] if p in biases else torch.zeros(weights[p].shape[0], dtype=dtype)
+                    for p in parts
+                ])))
+            n_fused += 1
+
+        logger.info(f"Fused {n_fused} projection groups")
+        return out
+
     def _should_quantize(self, tensor_name: str) -> bool:
         """Determine if a tensor should be quantized (Q8_0) or kept in F16.
         
@@ -372,7 +423,8 @@ class Qwen3ASRConverter:
         skipped_count = 0
 
         logger.info("Processing tensors...")
-        for hf_name, tensor in tqdm(list(self._get_tensors()), desc="Converting"):
+        tensors = []
+        for hf_name, tensor in self._get_tensors():
             ggml_name = self._map_tensor_name(hf_name)
 
             if ggml_name is None:
@@ -380,6 +432,13 @@ class Qwen3ASRConverter:
                 skipped_count += 1
                 continue
 
+            logger.debug(f"  {hf_name} -> {ggml_name}")
+            tensors.append((ggml_name, tensor))
+
+        if self.fuse:
+            tensors = self._fuse_projections(tensors)
+
+        for ggml_name, tensor in tqdm(tensors, desc="Converting"):
             # Convert tensor
             data, dtype = self._convert_dtype(tensor, ggml_name)
 
@@ -387,7 +446,7 @@ class Qwen3ASRConverter:
             writer.add_tensor(ggml_name, data, raw_dtype=dtype)
             tensor_count += 1
 
-            logger.debug(f"  {hf_name} -> {ggml_name} [{dtype.name}] {data.shape}")
+            logger.debug(f"  {ggml_name} [{dtype.name}] {data.shape}")
 
         logger.info(f"Converted {tensor_count} tensors, skipped {skipped_count}")
 
@@ -529,6 +588,11 @@ def main():
         default="f16",
         help="Output data type (default: f16). q8_0 provides ~50%% size reduction with minimal quality loss."
     )
+    parser.add_argument(
+        "--fuse",
+        action="store_true",
+        help="Fuse each layer's Q/K/V weights into attn_qkv and gate/up into ffn_gate_up (one matmul each)"
+    )
     parser.add_argument(
         "--verbose", "-v",
         action="store_true",
@@ -544,6 +608,7 @@ def main():
         input_dir=args.input,
         output_path=args.output,
         output_type=args.type,
+        fuse=args.fuse,
     )
     converter.convert()
 
@@ -1,12 +1,30 @@
 #include "audio_encoder.h"
+#include "layer_ops.h"
 #include "timing.h"
+#include "weight_repack.h"
 
+#include <cfloat>
 #include <cmath>
 #include <cstring>
 #include <algorithm>
+#include <thread>
 
 #define QWEN3_ASR_MAX_NODES 4096
 
+// Maximum number of 100-frame mel chunks run through one conv graph.
+// Bounds the conv/im2col compute buffer (~20 MB per chunk) for long audio.
+#define QWEN3_ASR_CONV_BATCH 32
+
+// Mel frames computed per GPU mel graph (30 s). The framed samples and the
+// DFT outputs take ~4 KB per frame in the compute buffer.
+#define QWEN3_ASR_MEL_BLOCK 3000
+
+// Frame granularity of encode_to_device output slots (~4 s of audio)
+#define QWEN3_ASR_OUTPUT_PAD 64
+
+// Smallest pinned staging buffer (1 MiB)
+#define QWEN3_ASR_PINNED_MIN (1u << 20)
+
 namespace qwen3_asr {
 
 static void compute_sinusoidal_pe(float * pe, int n_ctx, int d_model) {
@@ -21,9 +39,131 @@ static void compute_sinusoidal_pe(float * pe, int n_ctx, int d_model) {
     }
 }
 
+static qkv_weights encoder_qkv_weights(const encoder_layer & layer) {
+    qkv_weights w;
+    w.qkv_w = layer.attn_qkv_w;
+    w.qkv_b = layer.attn_qkv_b;
+    w.q_w = layer.attn_q_w;
+    w.q_b = layer.attn_q_b;
+    w.k_w = layer.attn_k_w;
+    w.k_b = layer.attn_k_b;
+    w.v_w = layer.attn_v_w;
+    w.v_b = layer.attn_v_b;
+    return w;
+}
+
+// Windowed self-attention over [head_dim, n_head, n_ctx] projections (see
+// build_qkv; token rows may be strided).
+// The sequence is split into consecutive windows of `window` frames (the last
+// one may be shorter) and every window only attends to itself. Full windows
+// are stacked on the batch dimension of a single ggml_flash_attn_ext call and
+// the tail window gets its own call, so no [n_ctx, n_ctx] mask or KQ matrix is
+// ever materialized and memory grows linearly with n_ctx.
+static struct ggml_tensor * build_windowed_attn(struct ggml_context * ctx0,
+                                                struct ggml_tensor * Qcur,
+                                                struct ggml_tensor * Kcur,
+                                                struct ggml_tensor * Vcur,
+                                                int n_state_head, int n_head,
+                                                int n_ctx, int window, float KQscale) {
+    const int n_state = n_state_head * n_head;
+    const int n_full = n_ctx / window;
+    const int n_tail = n_ctx - n_full * window;
+    
+    auto attend = [&](int start, int len, int n_seq) -> struct ggml_tensor * {
+        // Token rows are x->nb[2] apart (a fused QKV row for fused weights)
+        auto split = [&](struct ggml_tensor * x) -> struct ggml_tensor * {
+            x = ggml_view_4d(ctx0, x, n_state_head, n_head, len, n_seq,
+                             x->nb[1], x->nb[2], x->nb[2] * len, (size_t)start * x->nb[2]);
+            return ggml_permute(ctx0, x, 0, 2, 1, 3);  // [head_dim, len, n_head, n_seq]
+        };
+        
+        struct ggml_tensor * Q = split(Qcur);
+        struct ggml_tensor * K = ggml_cast(ctx0, split(Kcur), GGML_TYPE_F16);
+        struct ggml_tensor * V = ggml_cast(ctx0, split(Vcur), GGML_TYPE_F16);
+        
+        struct ggml_tensor * out = ggml_flash_attn_ext(ctx0, Q, K, V, nullptr, KQscale, 0.0f, 0.0f);
+        ggml_flash_attn_ext_set_prec(out, GGML_PREC_F32);
+        
+        // [head_dim, n_head, len, n_seq] -> [n_state, len * n_seq]
+        return ggml_reshape_2d(ctx0, out, n_state, (int64_t)len * n_seq);
+    };
+    
+    struct ggml_tensor * cur = nullptr;
+    if (n_full > 0) {
+        cur = attend(0, window, n_full);
+    }
+    if (n_tail > 0) {
+        struct ggml_tensor * tail = attend(n_full * window, n_tail, 1);
+        cur = cur ? ggml_concat(ctx0, cur, tail, 1) : tail;
+    }
+    return cur;
+}
+
 AudioEncoder::AudioEncoder() = default;
 
+static int compute_chunk_output_length(int chunk_len) {
+    int len = chunk_len;
+    len = (len - 1) / 2 + 1;
+    len = (len - 1) / 2 + 1;
+    len = (len - 1) / 2 + 1;
+    return len;
+}
+
 AudioEncoder::~AudioEncoder() {
+    for (auto & slot : state_.output_slots) {
+        if (slot.buffer) {
+            ggml_backend_buffer_free(slot.buffer);
+        }
+        if (slot.ctx) {
+            ggml_free(slot.ctx);
+        }
+    }
+    state_.output_slots.clear();
+    for (auto & worker : state_.workers) {
+        if (worker.sched) {
+            ggml_backend_sched_free(worker.sched);
+        }
+        if (worker.backend) {
+            ggml_backend_free(worker.backend);
+        }
+        free_cpu_threadpool(worker.threadpool);
+    }
+    state_.workers.clear();
+    if (state_.buf_pinned) {
+        ggml_backend_buffer_free(state_.buf_pinned);
+        state_.buf_pinned = nullptr;
+    }
+    if (state_.buf_mel_work) {
+        ggml_backend_buffer_free(state_.buf_mel_work);
+        state_.buf_mel_work = nullptr;
+    }
+    if (state_.ctx_mel_work) {
+        ggml_free(state_.ctx_mel_work);
+        state_.ctx_mel_work = nullptr;
+    }
+    if (state_.buf_mel) {
+        ggml_backend_buffer_free(state_.buf_mel);
+        state_.buf_mel = nullptr;
+    }
+    if (state_.ctx_mel) {
+        ggml_free(state_.ctx_mel);
+        state_.ctx_mel = nullptr;
+    }
+    if (state_.buf_const) {
+        ggml_backend_buffer_free(state_.buf_const);
+        state_.buf_const = nullptr;
+    }
+    if (state_.ctx_const) {
+        ggml_free(state_.ctx_const);
+        state_.ctx_const = nullptr;
+    }
+    if (state_.arena) {
+        // Backends and scheduler belong to the arena
+        state_.sched = nullptr;
+        state_.backend_gpu = nullptr;
+        state_.backend_cpu = nullptr;
+        state_.arena.reset();
+    }
     if (state_.sched) {
         ggml_backend_sched_free(state_.sched);
         state_.sched = nullptr;
@@ -36,60 +176,315 @@ AudioEncoder::~AudioEncoder() {
         ggml_backend_free(state_.backend_cpu);
         state_.backend_cpu = nullptr;
     }
+    free_cpu_threadpool(state_.threadpool);
     free_model(model_);
 }
 
-bool AudioEncoder::load_model(const std::string & model_path) {
+bool AudioEncoder::load_model(const std::string & model_path,
+                              const cpu_backend_params & cpu_params,
+                              const std::shared_ptr<ComputeArena> & arena) {
+    auto file = std::make_shared<ModelFile>();
+    if (!file->open(model_path)) {
+        error_msg_ = file->get_error();
+        return false;
+    }
+    const bool ok = load_model(file, cpu_params, arena);
+    file->release_metadata();
+    return ok;
+}
+
+bool AudioEncoder::load_model(const std::shared_ptr<ModelFile> & file,
+                              const cpu_backend_params & cpu_params,
+                              const std::shared_ptr<ComputeArena> & arena) {
+    ggml_backend_dev_t gpu_dev = nullptr;
+    if (!select_gpu_device(cpu_params, gpu_dev, error_msg_)) {
+        return false;
+    }
+    
     GGUFLoader loader;
-    if (!loader.load(model_path, model_)) {
+    if (!loader.load(file, model_, gpu_dev)) {
         error_msg_ = loader.get_error();
         return false;
     }
     
-    state_.backend_cpu = ggml_backend_init_by_type(GGML_BACKEND_DEVICE_TYPE_CPU, nullptr);
-    if (!state_.backend_cpu) {
-        error_msg_ = "Failed to initialize CPU backend";
+    // Repacked data cannot be read back, so hash the weights first
+    state_.fingerprint = compute_fingerprint();
+    if (cpu_params.repack_weights && !gpu_dev && !repack_weights(file->get_path(), cpu_params.repack_cache)) {
         return false;
     }
+    
+    if (arena && arena->matches(cpu_params, QWEN3_ASR_MAX_NODES)) {
+        state_.arena = arena;
+        state_.backend_cpu = arena->get_backend_cpu();
+        state_.backend_gpu = arena->get_backend_gpu();
+        state_.sched = arena->get_sched();
+    } else {
+        if (!init_cpu_backend(cpu_params, state_.backend_cpu, state_.threadpool, error_msg_)) {
+            return false;
+        }
 
-    state_.backend_gpu = ggml_backend_init_by_type(GGML_BACKEND_DEVICE_TYPE_GPU, nullptr);
+        // No CPU fallback here: the weights may already be in device memory
+        if (gpu_dev) {
+            state_.backend_gpu = ggml_backend_dev_init(gpu_dev, nullptr);
+            if (!state_.backend_gpu) {
+                error_msg_ = std::string("Failed to initialize backend for ") + ggml_backend_dev_name(gpu_dev);
+                return false;
+            }
+        }
 
-    std::vector<ggml_backend_t> backends;
-    std::vector<ggml_backend_buffer_type_t> backend_bufts;
+        std::vector<ggml_backend_t> backends;
+        std::vector<ggml_backend_buffer_type_t> backend_bufts;
+        sched_backends(state_.backend_gpu, state_.backend_cpu, backends, backend_bufts);
 
-    if (state_.backend_gpu) {
-        backends.push_back(state_.backend_gpu);
-        backend_bufts.push_back(ggml_backend_get_default_buffer_type(state_.backend_gpu));
+        state_.sched = ggml_backend_sched_new(backends.data(), backend_bufts.data(), backends.size(), QWEN3_ASR_MAX_NODES, false, true);
+        if (!state_.sched) {
+            error_msg_ = "Failed to create backend scheduler";
+            return false;
+        }
+        
+        state_.compute_meta.resize(ggml_tensor_overhead() * QWEN3_ASR_MAX_NODES + ggml_graph_overhead());
+    }
+    
+    if (!init_const_tensors(QWEN3_ASR_CONV_CHUNK)) {
+        return false;
     }
+    
+    if (!gpu_dev && cpu_params.encoder_workers > 1 && !init_workers(cpu_params)) {
+        return false;
+    }
+    
+    return true;
+}
 
-    backends.push_back(state_.backend_cpu);
-    ggml_backend_buffer_type_t cpu_buft = ggml_backend_get_default_buffer_type(state_.backend_cpu);
-    if (state_.backend_gpu) {
-        ggml_backend_dev_t gpu_dev = ggml_backend_get_device(state_.backend_gpu);
-        ggml_backend_buffer_type_t host_buft = ggml_backend_dev_host_buffer_type(gpu_dev);
-        if (host_buft) cpu_buft = host_buft;
+bool AudioEncoder::init_workers(const cpu_backend_params & cpu_params) {
+    const int32_t n_threads = resolve_n_threads(cpu_params.n_threads);
+    int32_t n_workers = std::min(cpu_params.encoder_workers, n_threads);
+    if (!cpu_params.cpu_ids.empty()) {
+        n_workers = std::min(n_workers, (int32_t)cpu_params.cpu_ids.size());
     }
-    backend_bufts.push_back(cpu_buft);
+    if (n_workers <= 1) {
+        return true;
+    }
+    
+    state_.workers.resize(n_workers);
+    for (int32_t i = 0; i < n_workers; ++i) {
+        encoder_worker & worker = state_.workers[i];
+        
+        // Threads and CPUs in contiguous, equal shares
+        cpu_backend_params params = cpu_params;
+        params.n_threads = n_threads * (i + 1) / n_workers - n_threads * i / n_workers;
+        if (!cpu_params.cpu_ids.empty()) {
+            const size_t n_ids = cpu_params.cpu_ids.size();
+            params.cpu_ids.assign(cpu_params.cpu_ids.begin() + n_ids * i / n_workers,
+                                  cpu_params.cpu_ids.begin() + n_ids * (i + 1) / n_workers);
+        }
+        if (!init_cpu_backend(params, worker.backend, worker.threadpool, error_msg_)) {
+            return false;
+        }
+        
+        std::vector<ggml_backend_t> backends;
+        std::vector<ggml_backend_buffer_type_t> backend_bufts;
+        sched_backends(nullptr, worker.backend, backends, backend_bufts);
+        worker.sched = ggml_backend_sched_new(backends.data(), backend_bufts.data(), backends.size(), QWEN3_ASR_MAX_NODES, false, true);
+        if (!worker.sched) {
+            error_msg_ = "Failed to create encoder worker scheduler";
+            return false;
+        }
+        worker.compute_meta.resize(ggml_tensor_overhead() * QWEN3_ASR_MAX_NODES + ggml_graph_overhead());
+    }
+    
+    return true;
+}
 
-    state_.sched = ggml_backend_sched_new(backends.data(), backend_bufts.data(), backends.size(), QWEN3_ASR_MAX_NODES, false, true);
-    if (!state_.sched) {
-        error_msg_ = "Failed to create backend scheduler";
+bool AudioEncoder::reserve_compute(int n_mel_frames) {
+    if (!model_.ctx) {
+        error_msg_ = "Model not loaded";
         return false;
     }
     
-    state_.compute_meta.resize(ggml_tensor_overhead() * QWEN3_ASR_MAX_NODES + ggml_graph_overhead());
+    auto lock = lock_arena(state_.arena);
+    
+    const int chunk_size = QWEN3_ASR_CONV_CHUNK;
+    const int n_chunks = (n_mel_frames + chunk_size - 1) / chunk_size;
+    if (n_chunks <= 0) {
+        return true;
+    }
+    
+    const int batch_chunks = std::min(QWEN3_ASR_CONV_BATCH, n_chunks);
+    if (!ggml_backend_sched_reserve(state_.sched, build_graph_conv_batch(batch_chunks, chunk_size, batch_chunks * chunk_size))) {
+        error_msg_ = "Failed to reserve conv graph";
+        return false;
+    }
+    
+    const int n_ctx = n_chunks * compute_chunk_output_length(chunk_size);
+    struct ggml_cgraph * gf_enc = build_graph_transformer(n_ctx, -1);
+    if (!gf_enc || !ggml_backend_sched_reserve(state_.sched, gf_enc)) {
+        error_msg_ = "Failed to reserve encoder graph";
+        return false;
+    }
+    
+    // The first group is the largest
+    const auto groups = worker_groups(n_ctx);
+    if (!groups.empty()) {
+        const int n_group = groups[0].second - groups[0].first;
+        for (auto & worker : state_.workers) {
+            gf_enc = build_graph_transformer(n_group, -1, &worker.compute_meta);
+            if (!gf_enc || !ggml_backend_sched_reserve(worker.sched, gf_enc)) {
+                error_msg_ = "Failed to reserve encoder worker graph";
+                return false;
+            }
+        }
+    }
     
     return true;
 }
 
+memory_usage AudioEncoder::get_memory_usage() const {
+    memory_usage mem;
+    mem.weights = ctx_tensor_bytes(model_.ctx);
+    mem.buffers = buffer_bytes(state_.buf_const) + buffer_bytes(state_.buf_mel) +
+                  buffer_bytes(state_.buf_mel_work) + buffer_bytes(state_.buf_pinned);
+    for (const auto & slot : state_.output_slots) {
+        mem.buffers += buffer_bytes(slot.buffer);
+    }
+    if (!state_.arena) {
+        add_sched_bytes(state_.sched, mem);
+    }
+    for (const auto & worker : state_.workers) {
+        add_sched_bytes(worker.sched, mem);
+    }
+    return mem;
+}
+
+bool AudioEncoder::init_const_tensors(int chunk_len) {
+    const int n_state = model_.hparams.d_model;
+    const int n_pos = compute_chunk_output_length(chunk_len);
+    
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ ggml_tensor_overhead() * 4,
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+    
+    state_.ctx_const = ggml_init(params);
+    if (!state_.ctx_const) {
+        error_msg_ = "Failed to create constant tensor context";
+        return false;
+    }
+    
+    state_.pos_emb = ggml_new_tensor_2d(state_.ctx_const, GGML_TYPE_F32, n_state, n_pos);
+    ggml_set_name(state_.pos_emb, "pos_emb");
+    
+    ggml_backend_t backend = state_.backend_gpu ? state_.backend_gpu : state_.backend_cpu;
+    state_.buf_const = ggml_backend_alloc_ctx_tensors(state_.ctx_const, backend);
+    if (!state_.buf_const) {
+        error_msg_ = "Failed to allocate constant tensors";
+        return false;
+    }
+    
+    std::vector<float> pe(n_pos * n_state);
+    compute_sinusoidal_pe(pe.data(), n_pos, n_state);
+    ggml_backend_tensor_set(state_.pos_emb, pe.data(), 0, pe.size() * sizeof(float));
+    
+    return true;
+}
+
+struct ggml_cgraph * AudioEncoder::build_graph_conv_batch(int n_chunks, int chunk_len, int n_frames,
+                                                          struct ggml_tensor * mel_src,
+                                                          int frame_start, int n_mel_frames) {
+    const auto & hp = model_.hparams;
+    const int n_mel = hp.n_mel_bins;
+    const int n_state = hp.d_model;
+    const int conv_ch = hp.conv_channels;
+    
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ compute_meta().size(),
+        /*.mem_buffer =*/ compute_meta().data(),
+        /*.no_alloc   =*/ true,
+    };
+    
+    struct ggml_context * ctx0 = ggml_init(params);
+    struct ggml_cgraph * gf = ggml_new_graph(ctx0);
+    
+    struct ggml_tensor * mel = nullptr;
+    if (mel_src) {
+        mel = ggml_view_2d(ctx0, mel_src, n_frames, n_mel, (size_t)n_mel_frames * sizeof(float),
+                           (size_t)frame_start * sizeof(float));
+        mel = ggml_cont(ctx0, mel);
+    } else {
+        mel = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_frames, n_mel);
+        ggml_set_name(mel, "mel");
+        ggml_set_input(mel);
+    }
+    
+    // [n_frames, n_mel] -> zero-pad -> [chunk_len, n_chunks, n_mel] -> [chunk_len, n_mel, 1, n_chunks]
+    struct ggml_tensor * cur = mel;
+    const int n_padded = n_chunks * chunk_len;
+    if (n_padded > n_frames) {
+        cur = ggml_pad(ctx0, cur, n_padded - n_frames, 0, 0, 0);
+    }
+    cur = ggml_reshape_3d(ctx0, cur, chunk_len, n_chunks, n_mel);
+    cur = ggml_cont(ctx0, ggml_permute(ctx0, cur, 0, 2, 1, 3));
+    cur = ggml_reshape_4d(ctx0, cur, chunk_len, n_mel, 1, n_chunks);
+    
+    cur = ggml_conv_2d(ctx0, model_.conv2d1_w, cur, 2, 2, 1, 1, 1, 1);
+    if (model_.conv2d1_b) {
+        struct ggml_tensor * bias = ggml_reshape_4d(ctx0, model_.conv2d1_b, 1, 1, conv_ch, 1);
+        cur = ggml_add(ctx0, cur, bias);
+    }
+    cur = ggml_gelu(ctx0, cur);
+    
+    cur = ggml_conv_2d(ctx0, model_.conv2d2_w, cur, 2, 2, 1, 1, 1, 1);
+    if (model_.conv2d2_b) {
+        struct ggml_tensor * bias = ggml_reshape_4d(ctx0, model_.conv2d2_b, 1, 1, conv_ch, 1);
+        cur = ggml_add(ctx0, cur, bias);
+    }
+    cur = ggml_gelu(ctx0, cur);
+    
+    cur = ggml_conv_2d(ctx0, model_.conv2d3_w, cur, 2, 2, 1, 1, 1, 1);
+    if (model_.conv2d3_b) {
+        struct ggml_tensor * bias = ggml_reshape_4d(ctx0, model_.conv2d3_b, 1, 1, conv_ch, 1);
+        cur = ggml_add(ctx0, cur, bias);
+    }
+    cur = ggml_gelu(ctx0, cur);
+    
+    // [out_w, out_h, out_c, n_chunks] -> [out_c * out_h, out_w * n_chunks]
+    int64_t out_w = cur->ne[0];
+    int64_t out_h = cur->ne[1];
+    int64_t out_c = cur->ne[2];
+    int64_t feat_dim = out_c * out_h;
+    
+    cur = ggml_reshape_3d(ctx0, cur, out_w, feat_dim, n_chunks);
+    cur = ggml_cont(ctx0, ggml_permute(ctx0, cur, 1, 0, 2, 3));
+    cur = ggml_reshape_2d(ctx0, cur, feat_dim, out_w * n_chunks);
+    
+    if (model_.conv_out_w) {
+        cur = ggml_mul_mat(ctx0, model_.conv_out_w, cur);
+    }
+    
+    // Positional embedding restarts at every chunk: broadcast [n_state, out_w] over chunks
+    cur = ggml_reshape_3d(ctx0, cur, n_state, out_w, n_chunks);
+    cur = ggml_add(ctx0, cur, state_.pos_emb);
+    cur = ggml_reshape_2d(ctx0, cur, n_state, out_w * n_chunks);
+    
+    ggml_set_name(cur, "embd_conv");
+    ggml_set_output(cur);
+    
+    ggml_build_forward_expand(gf, cur);
+    
+    ggml_free(ctx0);
+    
+    return gf;
+}
+
 struct ggml_cgraph * AudioEncoder::build_graph_conv(int n_frames) {
     const auto & hp = model_.hparams;
     const int n_mel = hp.n_mel_bins;
     const int conv_ch = hp.conv_channels;
     
     struct ggml_init_params params = {
-        /*.mem_size   =*/ state_.compute_meta.size(),
-        /*.mem_buffer =*/ state_.compute_meta.data(),
+        /*.mem_size   =*/ compute_meta().size(),
+        /*.mem_buffer =*/ compute_meta().data(),
         /*.no_alloc   =*/ true,
     };
     
@@ -168,8 +563,8 @@ struct ggml_cgraph * AudioEncoder::build_graph_encoder(int n_ctx) {
     const float eps = hp.layer_norm_eps;
     
     struct ggml_init_params params = {
-        /*.mem_size   =*/ state_.compute_meta.size(),
-        /*.mem_buffer =*/ state_.compute_meta.data(),
+        /*.mem_size   =*/ compute_meta().size(),
+        /*.mem_buffer =*/ compute_meta().data(),
         /*.no_alloc   =*/ true,
     };
     
@@ -196,36 +591,20 @@ struct ggml_cgraph * AudioEncoder::build_graph_encoder(int n_ctx) {
         }
         
         {
-            struct ggml_tensor * Qcur = ggml_mul_mat(ctx0, layer.attn_q_w, cur);
-            if (layer.attn_q_b) {
-                Qcur = ggml_add(ctx0, Qcur, layer.attn_q_b);
-            }
+            const qkv_proj qkv = build_qkv(ctx0, cur, encoder_qkv_weights(layer), n_state_head, n_head, n_head);
+            struct ggml_tensor * Qcur = qkv.q;
+            struct ggml_tensor * Kcur = qkv.k;
+            struct ggml_tensor * Vcur = qkv.v;
             
-            struct ggml_tensor * Kcur = ggml_mul_mat(ctx0, layer.attn_k_w, cur);
-            if (layer.attn_k_b) {
-                Kcur = ggml_add(ctx0, Kcur, layer.attn_k_b);
-            }
-            
-            struct ggml_tensor * Vcur = ggml_mul_mat(ctx0, layer.attn_v_w, cur);
-            if (layer.attn_v_b) {
-                Vcur = ggml_add(ctx0, Vcur, layer.attn_v_b);
-            }
+            struct ggml_tensor * Q = ggml_permute(ctx0, Qcur, 0, 2, 1, 3);
             
-            struct ggml_tensor * Q = ggml_permute(ctx0,
-                ggml_reshape_3d(ctx0, Qcur, n_state_head, n_head, n_ctx),
-                0, 2, 1, 3);
-            
-            struct ggml_tensor * K = ggml_permute(ctx0,
-                ggml_reshape_3d(ctx0, Kcur, n_state_head, n_head, n_ctx),
-                0, 2, 1, 3);
+            struct ggml_tensor * K = ggml_permute(ctx0, Kcur, 0, 2, 1, 3);
             
             struct ggml_tensor * KQ = ggml_mul_mat(ctx0, K, Q);
             
             struct ggml_tensor * KQ_soft_max = ggml_soft_max_ext(ctx0, KQ, nullptr, KQscale, 0.0f);
             
-            struct ggml_tensor * V = ggml_cont(ctx0, ggml_permute(ctx0,
-                ggml_reshape_3d(ctx0, Vcur, n_state_head, n_head, n_ctx),
-                1, 2, 0, 3));
+            struct ggml_tensor * V = ggml_cont(ctx0, ggml_permute(ctx0, Vcur, 1, 2, 0, 3));
             
             struct ggml_tensor * KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
             
@@ -272,149 +651,654 @@ struct ggml_cgraph * AudioEncoder::build_graph_encoder(int n_ctx) {
         inpL = ggml_add(ctx0, cur, inpFF);
     }
     
-    cur = inpL;
+    cur = inpL;
+    
+    ggml_set_name(cur, "embd_enc");
+    ggml_set_output(cur);
+    state_.embd_enc = cur;
+    
+    ggml_build_forward_expand(gf, cur);
+    
+    ggml_free(ctx0);
+    
+    return gf;
+}
+
+bool AudioEncoder::compute_graph(struct ggml_cgraph * graph) {
+    if (!ggml_backend_sched_alloc_graph(state_.sched, graph)) {
+        error_msg_ = "Failed to allocate graph";
+        return false;
+    }
+    
+    if (sched_graph_compute(state_.sched, graph) != GGML_STATUS_SUCCESS) {
+        error_msg_ = "Failed to compute graph";
+        ggml_backend_sched_reset(state_.sched);
+        return false;
+    }
+    
+    ggml_backend_sched_reset(state_.sched);
+    return true;
+}
+
+bool AudioEncoder::encode(const float * mel_data, int n_mel, int n_frames, 
+                          std::vector<float> & output) {
+    QWEN3_TIMER("audio_encoding.total");
+    
+    std::vector<float> conv_features;
+    if (!encode_conv(mel_data, n_mel, n_frames, conv_features)) {
+        return false;
+    }
+    
+    const int n_ctx = (int)(conv_features.size() / model_.hparams.d_model);
+    return encode_transformer(conv_features.data(), n_ctx, output);
+}
+
+int AudioEncoder::get_chunk_output_length() const {
+    return compute_chunk_output_length(QWEN3_ASR_CONV_CHUNK);
+}
+
+int AudioEncoder::get_attn_window() const {
+    const int n_window_infer = model_.hparams.n_window_infer;
+    if (n_window_infer < QWEN3_ASR_CONV_CHUNK) {
+        return 0;
+    }
+    return get_chunk_output_length() * (n_window_infer / QWEN3_ASR_CONV_CHUNK);
+}
+
+uint64_t AudioEncoder::weight_fingerprint() const {
+    return state_.fingerprint;
+}
+
+uint64_t AudioEncoder::compute_fingerprint() const {
+    const auto & hp = model_.hparams;
+    encoder_fingerprint_params params;
+    params.n_layers = hp.n_encoder_layers;
+    params.d_model = hp.d_model;
+    params.n_head = hp.n_attention_heads;
+    params.n_window_infer = hp.n_window_infer;
+    params.n_mel_bins = hp.n_mel_bins;
+    
+    std::vector<const struct ggml_tensor *> layout = {
+        model_.conv2d1_w, model_.conv2d1_b, model_.conv2d2_w, model_.conv2d2_b, model_.conv2d3_w, model_.conv2d3_b,
+        model_.conv_out_w, model_.ln_post_w, model_.ln_post_b,
+        model_.proj1_w, model_.proj1_b, model_.proj2_w, model_.proj2_b,
+    };
+    std::vector<const struct ggml_tensor *> data = layout;
+    for (const auto & layer : model_.layers) {
+        append_encoder_layer_tensors(layer, layout);
+        data.push_back(layer.attn_norm_w);
+        data.push_back(layer.ffn_norm_w);
+    }
+    if (!model_.layers.empty()) {
+        const auto & first = model_.layers.front();
+        data.push_back(first.attn_qkv_w ? first.attn_qkv_w : first.attn_q_w);
+        data.push_back(model_.layers.back().ffn_down_w);
+    }
+    return encoder_fingerprint(params, layout, data);
+}
+
+bool AudioEncoder::repack_weights(const std::string & model_path, bool use_cache) {
+    std::vector<struct ggml_tensor *> tensors = { model_.conv_out_w, model_.proj1_w, model_.proj2_w };
+    for (const auto & layer : model_.layers) {
+        for (struct ggml_tensor * t : { layer.attn_q_w, layer.attn_k_w, layer.attn_v_w, layer.attn_qkv_w,
+                                        layer.attn_out_w, layer.ffn_up_w, layer.ffn_down_w }) {
+            tensors.push_back(t);
+        }
+    }
+    
+    repack_stats stats;
+    const std::string cache_path = use_cache ? repack_cache_path(model_path, "encoder") : std::string();
+    if (!repack_cpu_weights(tensors, model_path, cache_path, model_.repack_buffers, stats, error_msg_)) {
+        return false;
+    }
+    if (stats.n_tensors > 0) {
+        fprintf(stderr, "Encoder: %zu weights (%.1f MiB) repacked for the CPU%s\n", stats.n_tensors,
+                stats.bytes / (1024.0 * 1024.0), stats.from_cache ? " (cached)" : "");
+    }
+    return true;
+}
+
+bool AudioEncoder::encode_conv(const float * mel_data, int n_mel, int n_frames,
+                               std::vector<float> & output) {
+    if (!model_.ctx) {
+        error_msg_ = "Model not loaded";
+        return false;
+    }
+    
+    if (n_mel != model_.hparams.n_mel_bins) {
+        error_msg_ = "Mel bins mismatch: expected " + std::to_string(model_.hparams.n_mel_bins) + 
+                     ", got " + std::to_string(n_mel);
+        return false;
+    }
+    
+    return encode_conv_frames(mel_data, n_frames, output);
+}
+
+bool AudioEncoder::encode_conv_frames(const float * mel_data, int n_frames,
+                                      std::vector<float> & output) {
+    auto lock = lock_arena(state_.arena);
+    
+    const int n_mel = model_.hparams.n_mel_bins;
+    const int chunk_size = QWEN3_ASR_CONV_CHUNK;
+    const int n_state = model_.hparams.d_model;
+    
+    int n_chunks = (n_frames + chunk_size - 1) / chunk_size;
+    
+    std::vector<int> chunk_lengths(n_chunks);
+    std::vector<int> chunk_output_lengths(n_chunks);
+    int total_output_frames = 0;
+    
+    for (int i = 0; i < n_chunks; ++i) {
+        int start = i * chunk_size;
+        int end = std::min(start + chunk_size, n_frames);
+        chunk_lengths[i] = end - start;
+        chunk_output_lengths[i] = compute_chunk_output_length(chunk_lengths[i]);
+        total_output_frames += chunk_output_lengths[i];
+    }
+    
+    const int out_w = compute_chunk_output_length(chunk_size);
+    
+    output.resize((size_t)total_output_frames * n_state);
+    int64_t out_offset = 0;
+    
+    // Conv frontend: QWEN3_ASR_CONV_BATCH chunks per graph. Only the last chunk
+    // can be short and it is zero-padded at the end, so the valid output frames
+    // of each batch are a contiguous prefix of embd_conv.
+    for (int batch_start = 0; batch_start < n_chunks; batch_start += QWEN3_ASR_CONV_BATCH) {
+        QWEN3_TIMER("audio_encoding.conv_batch");
+        const int batch_chunks = std::min(QWEN3_ASR_CONV_BATCH, n_chunks - batch_start);
+        const int frame_start = batch_start * chunk_size;
+        const int batch_frames = std::min(batch_chunks * chunk_size, n_frames - frame_start);
+        
+        int batch_out_len = 0;
+        for (int c = batch_start; c < batch_start + batch_chunks; ++c) {
+            batch_out_len += chunk_output_lengths[c];
+        }
+        
+        struct ggml_cgraph * gf_conv = mel_data
+            ? build_graph_conv_batch(batch_chunks, chunk_size, batch_frames)
+            : build_graph_conv_batch(batch_chunks, chunk_size, batch_frames, state_.mel_out, frame_start, n_frames);
+        
+        if (!ggml_backend_sched_alloc_graph(state_.sched, gf_conv)) {
+            error_msg_ = "Failed to allocate conv graph for chunks " + std::to_string(batch_start) +
+                         "-" + std::to_string(batch_start + batch_chunks - 1);
+            return false;
+        }
+        
+        if (mel_data) {
+            struct ggml_tensor * mel_tensor = ggml_graph_get_tensor(gf_conv, "mel");
+            if (!mel_tensor) {
+                error_msg_ = "Failed to find mel tensor";
+                ggml_backend_sched_reset(state_.sched);
+                return false;
+            }
+            
+            // mel_data rows are contiguous per mel bin: gather the batch's frame range
+            upload(mel_tensor, (size_t)n_mel * batch_frames, [&](float * dst) {
+                for (int m = 0; m < n_mel; ++m) {
+                    memcpy(dst + (size_t)m * batch_frames, mel_data + (size_t)m * n_frames + frame_start,
+                           (size_t)batch_frames * sizeof(float));
+                }
+            });
+        }
+        
+        if (sched_graph_compute(state_.sched, gf_conv) != GGML_STATUS_SUCCESS) {
+            error_msg_ = "Failed to compute conv graph for chunks " + std::to_string(batch_start) +
+                         "-" + std::to_string(batch_start + batch_chunks - 1);
+            ggml_backend_sched_reset(state_.sched);
+            return false;
+        }
+        
+        struct ggml_tensor * embd_conv = ggml_graph_get_tensor(gf_conv, "embd_conv");
+        if (!embd_conv) {
+            error_msg_ = "Failed to find embd_conv tensor";
+            ggml_backend_sched_reset(state_.sched);
+            return false;
+        }
+        
+        if (embd_conv->ne[1] != (int64_t)out_w * batch_chunks) {
+            fprintf(stderr, "WARNING: Expected %d output frames, got %lld\n",
+                    out_w * batch_chunks, (long long)embd_conv->ne[1]);
+        }
+        
+        ggml_backend_tensor_get(embd_conv, output.data() + out_offset * n_state, 0,
+                                (size_t)batch_out_len * n_state * sizeof(float));
+        out_offset += batch_out_len;
+        
+        ggml_backend_sched_reset(state_.sched);
+    }
+    
+    return true;
+}
+
+bool AudioEncoder::init_mel_frontend(const MelFilters & filters) {
+    if (!state_.backend_gpu) {
+        error_msg_ = "Mel front end needs a GPU backend";
+        return false;
+    }
+    if (filters.n_mel != model_.hparams.n_mel_bins || filters.n_fft != QWEN_N_FFT_BINS) {
+        error_msg_ = "Mel filterbank does not match the encoder";
+        return false;
+    }
+    
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ ggml_tensor_overhead() * 4,
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+    
+    state_.ctx_mel = ggml_init(params);
+    if (!state_.ctx_mel) {
+        error_msg_ = "Failed to create mel front end context";
+        return false;
+    }
+    
+    state_.mel_cos = ggml_new_tensor_2d(state_.ctx_mel, GGML_TYPE_F32, QWEN_N_FFT, QWEN_N_FFT_BINS);
+    state_.mel_sin = ggml_new_tensor_2d(state_.ctx_mel, GGML_TYPE_F32, QWEN_N_FFT, QWEN_N_FFT_BINS);
+    state_.mel_filters = ggml_new_tensor_2d(state_.ctx_mel, GGML_TYPE_F32, QWEN_N_FFT_BINS, filters.n_mel);
+    state_.mel_consts = ggml_new_tensor_1d(state_.ctx_mel, GGML_TYPE_F32, 2);
+    ggml_set_name(state_.mel_cos, "mel_cos");
+    ggml_set_name(state_.mel_sin, "mel_sin");
+    ggml_set_name(state_.mel_filters, "mel_filters");
+    ggml_set_name(state_.mel_consts, "mel_consts");
+    
+    state_.buf_mel = ggml_backend_alloc_ctx_tensors(state_.ctx_mel, state_.backend_gpu);
+    if (!state_.buf_mel) {
+        error_msg_ = "Failed to allocate mel front end tensors";
+        state_.mel_cos = nullptr;
+        return false;
+    }
+    
+    std::vector<float> cos_basis, sin_basis;
+    windowed_dft_basis(cos_basis, sin_basis);
+    const float consts[2] = {-8.0f, -4.0f};
+    ggml_backend_tensor_set(state_.mel_cos, cos_basis.data(), 0, cos_basis.size() * sizeof(float));
+    ggml_backend_tensor_set(state_.mel_sin, sin_basis.data(), 0, sin_basis.size() * sizeof(float));
+    ggml_backend_tensor_set(state_.mel_filters, filters.data.data(), 0, filters.data.size() * sizeof(float));
+    ggml_backend_tensor_set(state_.mel_consts, consts, 0, sizeof(consts));
+    
+    return true;
+}
+
+bool AudioEncoder::reserve_mel_work(int n_samples, int n_frames, int n_blocks) {
+    const int n_mel = model_.hparams.n_mel_bins;
+    const int64_t n_pcm = n_samples + QWEN_N_FFT;
+    if (state_.mel_pcm && state_.mel_pcm->ne[0] >= n_pcm &&
+        state_.mel_out->ne[0] >= (int64_t)n_frames * n_mel && state_.mel_max->ne[0] >= n_blocks) {
+        return true;
+    }
+    
+    if (state_.buf_mel_work) {
+        ggml_backend_buffer_free(state_.buf_mel_work);
+        state_.buf_mel_work = nullptr;
+    }
+    if (state_.ctx_mel_work) {
+        ggml_free(state_.ctx_mel_work);
+        state_.ctx_mel_work = nullptr;
+    }
+    state_.mel_pcm = nullptr;
+    
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ ggml_tensor_overhead() * 3,
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+    
+    state_.ctx_mel_work = ggml_init(params);
+    if (!state_.ctx_mel_work) {
+        error_msg_ = "Failed to create mel work context";
+        return false;
+    }
+    
+    struct ggml_tensor * pcm = ggml_new_tensor_1d(state_.ctx_mel_work, GGML_TYPE_F32, n_pcm);
+    state_.mel_out = ggml_new_tensor_1d(state_.ctx_mel_work, GGML_TYPE_F32, (int64_t)n_frames * n_mel);
+    state_.mel_max = ggml_new_tensor_1d(state_.ctx_mel_work, GGML_TYPE_F32, n_blocks);
+    
+    state_.buf_mel_work = ggml_backend_alloc_ctx_tensors(state_.ctx_mel_work, state_.backend_gpu);
+    if (!state_.buf_mel_work) {
+        error_msg_ = "Failed to allocate " + std::to_string(n_frames) + " mel frames on the device";
+        return false;
+    }
+    state_.mel_pcm = pcm;
+    
+    return true;
+}
+
+struct ggml_cgraph * AudioEncoder::build_graph_mel_pad(int n_samples) {
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ compute_meta().size(),
+        /*.mem_buffer =*/ compute_meta().data(),
+        /*.no_alloc   =*/ true,
+    };
+    
+    struct ggml_context * ctx0 = ggml_init(params);
+    struct ggml_cgraph * gf = ggml_new_graph(ctx0);
+    
+    struct ggml_tensor * pcm = ggml_new_tensor_1d(ctx0, GGML_TYPE_F32, n_samples);
+    ggml_set_name(pcm, "pcm");
+    ggml_set_input(pcm);
     
-    ggml_set_name(cur, "embd_enc");
-    ggml_set_output(cur);
-    state_.embd_enc = cur;
+    // Center padding of n_fft / 2 on each side, as in log_mel_spectrogram()
+    struct ggml_tensor * cur = ggml_pad_reflect_1d(ctx0, pcm, QWEN_N_FFT / 2, QWEN_N_FFT / 2);
+    struct ggml_tensor * dst = ggml_view_1d(ctx0, state_.mel_pcm, n_samples + QWEN_N_FFT, 0);
+    ggml_build_forward_expand(gf, ggml_cpy(ctx0, cur, dst));
     
-    ggml_build_forward_expand(gf, cur);
+    ggml_free(ctx0);
+    
+    return gf;
+}
+
+struct ggml_cgraph * AudioEncoder::build_graph_mel_block(int frame_start, int n_frames, int n_mel_frames, int block) {
+    const int n_mel = model_.hparams.n_mel_bins;
+    
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ compute_meta().size(),
+        /*.mem_buffer =*/ compute_meta().data(),
+        /*.no_alloc   =*/ true,
+    };
+    
+    struct ggml_context * ctx0 = ggml_init(params);
+    struct ggml_cgraph * gf = ggml_new_graph(ctx0);
+    
+    // Overlapping QWEN_N_FFT-sample frames at a QWEN_HOP_LENGTH stride -> [n_fft, n_frames]
+    struct ggml_tensor * frames = ggml_view_2d(ctx0, state_.mel_pcm, QWEN_N_FFT, n_frames,
+                                               QWEN_HOP_LENGTH * sizeof(float),
+                                               (size_t)frame_start * QWEN_HOP_LENGTH * sizeof(float));
+    frames = ggml_cont(ctx0, frames);
+    
+    // Windowed DFT as two matmuls against the basis -> power [n_bins, n_frames]
+    struct ggml_tensor * re = ggml_mul_mat(ctx0, state_.mel_cos, frames);
+    struct ggml_tensor * im = ggml_mul_mat(ctx0, state_.mel_sin, frames);
+    struct ggml_tensor * power = ggml_add(ctx0, ggml_sqr(ctx0, re), ggml_sqr(ctx0, im));
+    
+    // Mel projection -> [n_frames, n_mel], the layout encode() takes
+    struct ggml_tensor * cur = ggml_mul_mat(ctx0, power, state_.mel_filters);
+    cur = ggml_clamp(ctx0, cur, 1e-10f, FLT_MAX);
+    cur = ggml_scale(ctx0, ggml_log(ctx0, cur), 1.0f / logf(10.0f));
+    
+    struct ggml_tensor * dst = ggml_view_2d(ctx0, state_.mel_out, n_frames, n_mel,
+                                            (size_t)n_mel_frames * sizeof(float),
+                                            (size_t)frame_start * sizeof(float));
+    ggml_build_forward_expand(gf, ggml_cpy(ctx0, cur, dst));
+    
+    struct ggml_tensor * block_max = ggml_pool_2d(ctx0, cur, GGML_OP_POOL_MAX, n_frames, n_mel,
+                                                  n_frames, n_mel, 0, 0);
+    dst = ggml_view_1d(ctx0, state_.mel_max, 1, (size_t)block * sizeof(float));
+    ggml_build_forward_expand(gf, ggml_cpy(ctx0, block_max, dst));
     
     ggml_free(ctx0);
     
     return gf;
 }
 
-bool AudioEncoder::compute_graph(struct ggml_cgraph * graph) {
-    if (!ggml_backend_sched_alloc_graph(state_.sched, graph)) {
-        error_msg_ = "Failed to allocate graph";
+struct ggml_cgraph * AudioEncoder::build_graph_mel_clamp(int n_mel_frames, int n_blocks) {
+    const int n_mel = model_.hparams.n_mel_bins;
+    
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ compute_meta().size(),
+        /*.mem_buffer =*/ compute_meta().data(),
+        /*.no_alloc   =*/ true,
+    };
+    
+    struct ggml_context * ctx0 = ggml_init(params);
+    struct ggml_cgraph * gf = ggml_new_graph(ctx0);
+    
+    struct ggml_tensor * maxes = ggml_view_2d(ctx0, state_.mel_max, n_blocks, 1, n_blocks * sizeof(float), 0);
+    struct ggml_tensor * mmax = ggml_pool_2d(ctx0, maxes, GGML_OP_POOL_MAX, n_blocks, 1, n_blocks, 1, 0, 0);
+    struct ggml_tensor * neg8 = ggml_view_1d(ctx0, state_.mel_consts, 1, 0);
+    struct ggml_tensor * neg4 = ggml_view_1d(ctx0, state_.mel_consts, 1, sizeof(float));
+    
+    // (max(v, mmax - 8) + 4) / 4 == (relu(v - (mmax - 8)) + mmax - 4) / 4
+    struct ggml_tensor * mel = ggml_view_2d(ctx0, state_.mel_out, n_mel_frames, n_mel,
+                                            (size_t)n_mel_frames * sizeof(float), 0);
+    struct ggml_tensor * mel_floor = ggml_add(ctx0, mmax, neg8);
+    struct ggml_tensor * cur = ggml_relu(ctx0, ggml_sub(ctx0, mel, mel_floor));
+    cur = ggml_add(ctx0, cur, ggml_add(ctx0, mmax, neg4));
+    cur = ggml_scale(ctx0, cur, 0.25f);
+    ggml_build_forward_expand(gf, ggml_cpy(ctx0, cur, mel));
+    
+    ggml_free(ctx0);
+    
+    return gf;
+}
+
+bool AudioEncoder::encode_pcm(const float * samples, int n_samples,
+                              std::vector<float> & output, int32_t & n_mel_frames) {
+    QWEN3_TIMER("audio_encoding.total");
+    
+    // Same frame count as log_mel_spectrogram(): the last frame is dropped
+    const int n_frames = n_samples / QWEN_HOP_LENGTH;
+    if (!compute_mel(samples, n_samples, n_frames)) {
         return false;
     }
+    n_mel_frames = n_frames;
     
-    if (ggml_backend_sched_graph_compute(state_.sched, graph) != GGML_STATUS_SUCCESS) {
-        error_msg_ = "Failed to compute graph";
-        ggml_backend_sched_reset(state_.sched);
+    std::vector<float> conv_features;
+    if (!encode_conv_frames(nullptr, n_frames, conv_features)) {
         return false;
     }
     
-    ggml_backend_sched_reset(state_.sched);
-    return true;
-}
-
-static int compute_chunk_output_length(int chunk_len) {
-    int len = chunk_len;
-    len = (len - 1) / 2 + 1;
-    len = (len - 1) / 2 + 1;
-    len = (len - 1) / 2 + 1;
-    return len;
+    const int n_ctx = (int)(conv_features.size() / model_.hparams.d_model);
+    return encode_transformer(conv_features.data(), n_ctx, output);
 }
 
-bool AudioEncoder::encode(const float * mel_data, int n_mel, int n_frames, 
-                          std::vector<float> & output) {
+bool AudioEncoder::encode_pcm_to_device(const float * samples, int n_samples, int slot,
+                                        device_features & output, int32_t & n_mel_frames) {
     QWEN3_TIMER("audio_encoding.total");
     
-    if (!model_.ctx) {
-        error_msg_ = "Model not loaded";
+    const int n_frames = n_samples / QWEN_HOP_LENGTH;
+    if (!compute_mel(samples, n_samples, n_frames)) {
         return false;
     }
+    n_mel_frames = n_frames;
     
-    if (n_mel != model_.hparams.n_mel_bins) {
-        error_msg_ = "Mel bins mismatch: expected " + std::to_string(model_.hparams.n_mel_bins) + 
-                     ", got " + std::to_string(n_mel);
+    std::vector<float> conv_features;
+    if (!encode_conv_frames(nullptr, n_frames, conv_features)) {
         return false;
     }
     
-    const int n_window = 50;
-    const int chunk_size = n_window * 2;
-    const int n_state = model_.hparams.d_model;
-    
-    int n_chunks = (n_frames + chunk_size - 1) / chunk_size;
-    
-    std::vector<int> chunk_lengths(n_chunks);
-    std::vector<int> chunk_output_lengths(n_chunks);
-    int total_output_frames = 0;
+    std::vector<float> unused;
+    const int n_ctx = (int)(conv_features.size() / model_.hparams.d_model);
+    return run_transformer(conv_features.data(), n_ctx, unused, slot, &output);
+}
+
+bool AudioEncoder::compute_mel(const float * samples, int n_samples, int n_frames) {
+    auto lock = lock_arena(state_.arena);
     
-    for (int i = 0; i < n_chunks; ++i) {
-        int start = i * chunk_size;
-        int end = std::min(start + chunk_size, n_frames);
-        chunk_lengths[i] = end - start;
-        chunk_output_lengths[i] = compute_chunk_output_length(chunk_lengths[i]);
-        total_output_frames += chunk_output_lengths[i];
+    if (!model_.ctx) {
+        error_msg_ = "Model not loaded";
+        return false;
+    }
+    if (!has_mel_frontend()) {
+        error_msg_ = "Mel front end not initialized";
+        return false;
+    }
+    if (n_samples <= QWEN_N_FFT / 2) {
+        error_msg_ = "Too few samples for the GPU mel front end: " + std::to_string(n_samples);
+        return false;
     }
     
-    std::vector<float> all_conv_outputs;
-    all_conv_outputs.reserve(total_output_frames * n_state);
+    const int n_blocks = (n_frames + QWEN3_ASR_MEL_BLOCK - 1) / QWEN3_ASR_MEL_BLOCK;
+    if (!reserve_mel_work(n_samples, n_frames, n_blocks)) {
+        return false;
+    }
     
-    for (int chunk_idx = 0; chunk_idx < n_chunks; ++chunk_idx) {
-        QWEN3_TIMER("audio_encoding.conv_chunk");
-        int chunk_start = chunk_idx * chunk_size;
-        int chunk_len = chunk_lengths[chunk_idx];
-        int chunk_out_len = chunk_output_lengths[chunk_idx];
-        
-        struct ggml_cgraph * gf_conv = build_graph_conv(chunk_len);
-        
-        if (!ggml_backend_sched_alloc_graph(state_.sched, gf_conv)) {
-            error_msg_ = "Failed to allocate conv graph for chunk " + std::to_string(chunk_idx);
+    {
+        QWEN3_TIMER("audio_encoding.mel");
+        struct ggml_cgraph * gf = build_graph_mel_pad(n_samples);
+        if (!ggml_backend_sched_alloc_graph(state_.sched, gf)) {
+            error_msg_ = "Failed to allocate mel padding graph";
             return false;
         }
-        
-        struct ggml_tensor * mel_tensor = ggml_graph_get_tensor(gf_conv, "mel");
-        if (!mel_tensor) {
-            error_msg_ = "Failed to find mel tensor";
+        upload(ggml_graph_get_tensor(gf, "pcm"), n_samples, [&](float * dst) {
+            memcpy(dst, samples, (size_t)n_samples * sizeof(float));
+        });
+        if (sched_graph_compute(state_.sched, gf) != GGML_STATUS_SUCCESS) {
+            error_msg_ = "Failed to compute mel padding graph";
             ggml_backend_sched_reset(state_.sched);
             return false;
         }
+        ggml_backend_sched_reset(state_.sched);
         
-        std::vector<float> chunk_mel(n_mel * chunk_len);
-        for (int m = 0; m < n_mel; ++m) {
-            for (int f = 0; f < chunk_len; ++f) {
-                chunk_mel[f + m * chunk_len] = mel_data[m * n_frames + chunk_start + f];
+        for (int b = 0; b < n_blocks; ++b) {
+            const int frame_start = b * QWEN3_ASR_MEL_BLOCK;
+            const int block_frames = std::min(QWEN3_ASR_MEL_BLOCK, n_frames - frame_start);
+            if (!compute_graph(build_graph_mel_block(frame_start, block_frames, n_frames, b))) {
+                error_msg_ = "Failed to compute mel frames " + std::to_string(frame_start) + ": " + error_msg_;
+                return false;
             }
         }
         
-        ggml_backend_tensor_set(mel_tensor, chunk_mel.data(), 0, n_mel * chunk_len * sizeof(float));
-        
-        if (ggml_backend_sched_graph_compute(state_.sched, gf_conv) != GGML_STATUS_SUCCESS) {
-            error_msg_ = "Failed to compute conv graph for chunk " + std::to_string(chunk_idx);
-            ggml_backend_sched_reset(state_.sched);
+        if (!compute_graph(build_graph_mel_clamp(n_frames, n_blocks))) {
             return false;
         }
-        
-        struct ggml_tensor * embd_conv = ggml_graph_get_tensor(gf_conv, "embd_conv");
-        if (!embd_conv) {
-            error_msg_ = "Failed to find embd_conv tensor";
-            ggml_backend_sched_reset(state_.sched);
-            return false;
+    }
+    
+    return true;
+}
+
+bool AudioEncoder::encode_to_device(const float * mel_data, int n_mel, int n_frames, int slot,
+                                    device_features & output) {
+    QWEN3_TIMER("audio_encoding.total");
+    
+    std::vector<float> conv_features;
+    if (!encode_conv(mel_data, n_mel, n_frames, conv_features)) {
+        return false;
+    }
+    
+    std::vector<float> unused;
+    const int n_ctx = (int)(conv_features.size() / model_.hparams.d_model);
+    return run_transformer(conv_features.data(), n_ctx, unused, slot, &output);
+}
+
+bool AudioEncoder::read_device_features(const device_features & features, std::vector<float> & output) {
+    if (!features.tensor) {
+        error_msg_ = "No device features";
+        return false;
+    }
+    output.resize((size_t)features.n_frames * features.tensor->ne[0]);
+    ggml_backend_tensor_get(features.tensor, output.data(), 0, output.size() * sizeof(float));
+    return true;
+}
+
+ggml_backend_buffer_type_t AudioEncoder::get_output_buffer_type() const {
+    return state_.backend_gpu ? ggml_backend_get_default_buffer_type(state_.backend_gpu) : nullptr;
+}
+
+bool AudioEncoder::reserve_output_slot(int slot, int n_frames) {
+    if (!state_.backend_gpu) {
+        error_msg_ = "Device output needs a GPU backend";
+        return false;
+    }
+    if (slot >= (int)state_.output_slots.size()) {
+        state_.output_slots.resize(slot + 1);
+    }
+    
+    encoder_output_slot & out = state_.output_slots[slot];
+    const int64_t n_state = model_.text_hparams.hidden_size;
+    if (out.tensor && out.tensor->ne[1] >= n_frames) {
+        return true;
+    }
+    
+    if (out.buffer) {
+        ggml_backend_buffer_free(out.buffer);
+        out.buffer = nullptr;
+    }
+    if (out.ctx) {
+        ggml_free(out.ctx);
+        out.ctx = nullptr;
+    }
+    out.tensor = nullptr;
+    
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ ggml_tensor_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+    
+    out.ctx = ggml_init(params);
+    if (!out.ctx) {
+        error_msg_ = "Failed to create encoder output context";
+        return false;
+    }
+    
+    // Padded so that clips of similar length reuse the slot
+    struct ggml_tensor * t = ggml_new_tensor_2d(out.ctx, GGML_TYPE_F32, n_state,
+                                                GGML_PAD(n_frames, QWEN3_ASR_OUTPUT_PAD));
+    out.buffer = ggml_backend_alloc_ctx_tensors(out.ctx, state_.backend_gpu);
+    if (!out.buffer) {
+        error_msg_ = "Failed to allocate " + std::to_string(n_frames) + " encoder output frames on the device";
+        return false;
+    }
+    out.tensor = t;
+    
+    return true;
+}
+
+float * AudioEncoder::pinned_staging(size_t n) {
+    if (!state_.backend_gpu) {
+        return nullptr;
+    }
+    
+    // The previous async upload may still read the staging memory
+    ggml_backend_synchronize(state_.backend_gpu);
+    
+    const size_t size = n * sizeof(float);
+    if (!state_.buf_pinned || ggml_backend_buffer_get_size(state_.buf_pinned) < size) {
+        ggml_backend_buffer_type_t host_buft =
+            ggml_backend_dev_host_buffer_type(ggml_backend_get_device(state_.backend_gpu));
+        if (!host_buft) {
+            return nullptr;
         }
-        
-        int64_t out_ctx = embd_conv->ne[1];
-        int64_t out_state = embd_conv->ne[0];
-        
-        if (out_ctx != chunk_out_len) {
-            fprintf(stderr, "WARNING: Expected %d output frames, got %lld\n", chunk_out_len, (long long)out_ctx);
+        if (state_.buf_pinned) {
+            ggml_backend_buffer_free(state_.buf_pinned);
         }
-        
-        std::vector<float> chunk_output(out_ctx * out_state);
-        ggml_backend_tensor_get(embd_conv, chunk_output.data(), 0, out_ctx * out_state * sizeof(float));
-        
-        std::vector<float> chunk_pe(out_ctx * out_state);
-        compute_sinusoidal_pe(chunk_pe.data(), out_ctx, out_state);
-        for (int64_t i = 0; i < out_ctx * out_state; ++i) {
-            chunk_output[i] += chunk_pe[i];
+        state_.buf_pinned = ggml_backend_buft_alloc_buffer(host_buft, std::max(size, (size_t)QWEN3_ASR_PINNED_MIN));
+        if (!state_.buf_pinned) {
+            return nullptr;
         }
-        
-        all_conv_outputs.insert(all_conv_outputs.end(), chunk_output.begin(), chunk_output.end());
-        
-        ggml_backend_sched_reset(state_.sched);
+    }
+    return static_cast<float *>(ggml_backend_buffer_get_base(state_.buf_pinned));
+}
+
+template <typename Fill>
+void AudioEncoder::upload(struct ggml_tensor * tensor, size_t n, Fill fill) {
+    // Graph inputs usually land in the scheduler's host buffer (pinned with
+    // a GPU), which it copies to the device itself: fill it in place
+    if (tensor->buffer && ggml_backend_buffer_is_host(tensor->buffer) && ggml_is_contiguous(tensor)) {
+        fill(static_cast<float *>(tensor->data));
+        return;
     }
     
-    int64_t n_ctx = total_output_frames;
+    const bool on_gpu = state_.backend_gpu && tensor->buffer &&
+        ggml_backend_buffer_get_type(tensor->buffer) == ggml_backend_get_default_buffer_type(state_.backend_gpu);
+    float * staging = on_gpu ? pinned_staging(n) : nullptr;
+    if (staging) {
+        fill(staging);
+        ggml_backend_tensor_set_async(state_.backend_gpu, tensor, staging, 0, n * sizeof(float));
+        return;
+    }
     
-    state_.compute_meta.resize(ggml_tensor_overhead() * QWEN3_ASR_MAX_NODES + ggml_graph_overhead());
+    std::vector<float> tmp(n);
+    fill(tmp.data());
+    ggml_backend_tensor_set(tensor, tmp.data(), 0, n * sizeof(float));
+}
+
+bool AudioEncoder::encode_transformer(const float * conv_features, int n_ctx,
+                                      std::vector<float> & output) {
+    return run_transformer(conv_features, n_ctx, output, -1, nullptr);
+}
+
+struct ggml_cgraph * AudioEncoder::build_graph_transformer(int n_ctx, int device_slot,
+                                                           std::vector<uint8_t> * meta) {
+    const int chunk_size = QWEN3_ASR_CONV_CHUNK;
+    const int n_state = model_.hparams.d_model;
+    const int out_w = compute_chunk_output_length(chunk_size);
     
+    std::vector<uint8_t> & buf = meta ? *meta : compute_meta();
     struct ggml_init_params enc_params = {
-        /*.mem_size   =*/ state_.compute_meta.size(),
-        /*.mem_buffer =*/ state_.compute_meta.data(),
+        /*.mem_size   =*/ buf.size(),
+        /*.mem_buffer =*/ buf.data(),
         /*.no_alloc   =*/ true,
     };
     
@@ -428,6 +1312,14 @@ bool AudioEncoder::encode(const float * mel_data, int n_mel, int n_frames,
     const float eps = hp.layer_norm_eps;
     const float KQscale = 1.0f / sqrtf(float(n_state_head));
     
+    // Windowed attention as in the reference encoder:
+    // window_aftercnn = chunk_out_len * (n_window_infer / chunk_size), e.g. 13 * 8 = 104.
+    // n_window_infer <= 0 selects full attention over the whole input.
+    int attn_window = (int)n_ctx;
+    if (hp.n_window_infer >= chunk_size) {
+        attn_window = std::min((int)n_ctx, out_w * (hp.n_window_infer / chunk_size));
+    }
+    
     struct ggml_tensor * inpL = ggml_new_tensor_2d(enc_ctx, GGML_TYPE_F32, n_state, n_ctx);
     ggml_set_name(inpL, "enc_input");
     ggml_set_input(inpL);
@@ -448,42 +1340,13 @@ bool AudioEncoder::encode(const float * mel_data, int n_mel, int n_frames,
         }
         
         {
-            struct ggml_tensor * Qcur = ggml_mul_mat(enc_ctx, layer.attn_q_w, cur);
-            if (layer.attn_q_b) {
-                Qcur = ggml_add(enc_ctx, Qcur, layer.attn_q_b);
-            }
-            
-            struct ggml_tensor * Kcur = ggml_mul_mat(enc_ctx, layer.attn_k_w, cur);
-            if (layer.attn_k_b) {
-                Kcur = ggml_add(enc_ctx, Kcur, layer.attn_k_b);
-            }
-            
-            struct ggml_tensor * Vcur = ggml_mul_mat(enc_ctx, layer.attn_v_w, cur);
-            if (layer.attn_v_b) {
-                Vcur = ggml_add(enc_ctx, Vcur, layer.attn_v_b);
-            }
-            
-            struct ggml_tensor * Q = ggml_permute(enc_ctx,
-                ggml_reshape_3d(enc_ctx, Qcur, n_state_head, n_head, n_ctx),
-                0, 2, 1, 3);
-            
-            struct ggml_tensor * K = ggml_permute(enc_ctx,
-                ggml_reshape_3d(enc_ctx, Kcur, n_state_head, n_head, n_ctx),
-                0, 2, 1, 3);
-            
-            struct ggml_tensor * KQ = ggml_mul_mat(enc_ctx, K, Q);
-            
-            struct ggml_tensor * KQ_soft_max = ggml_soft_max_ext(enc_ctx, KQ, nullptr, KQscale, 0.0f);
-            
-            struct ggml_tensor * V = ggml_cont(enc_ctx, ggml_permute(enc_ctx,
-                ggml_reshape_3d(enc_ctx, Vcur, n_state_head, n_head, n_ctx),
-                1, 2, 0, 3));
-            
-            struct ggml_tensor * KQV = ggml_mul_mat(enc_ctx, V, KQ_soft_max);
+            const qkv_proj qkv = build_qkv(enc_ctx, cur, encoder_qkv_weights(layer), n_state_head, n_head, n_head);
+            struct ggml_tensor * Qcur = qkv.q;
+            struct ggml_tensor * Kcur = qkv.k;
+            struct ggml_tensor * Vcur = qkv.v;
             
-            struct ggml_tensor * KQV_merged = ggml_permute(enc_ctx, KQV, 0, 2, 1, 3);
-            
-            cur = ggml_cont_2d(enc_ctx, KQV_merged, n_state, n_ctx);
+            cur = build_windowed_attn(enc_ctx, Qcur, Kcur, Vcur, n_state_head, n_head,
+                                      n_ctx, attn_window, KQscale);
         }
         
         {
@@ -554,9 +1417,48 @@ bool AudioEncoder::encode(const float * mel_data, int n_mel, int n_frames,
     
     ggml_build_forward_expand(gf_enc, cur);
     
+    // Device output: the graph writes straight into the slot
+    if (device_slot >= 0) {
+        if (!reserve_output_slot(device_slot, (int)cur->ne[1])) {
+            ggml_free(enc_ctx);
+            return nullptr;
+        }
+        struct ggml_tensor * dst = state_.output_slots[device_slot].tensor;
+        ggml_build_forward_expand(gf_enc, ggml_cpy(enc_ctx, cur,
+            ggml_view_2d(enc_ctx, dst, cur->ne[0], cur->ne[1], dst->nb[1], 0)));
+    }
+    
+    ggml_free(enc_ctx);
+    
+    return gf_enc;
+}
+
+bool AudioEncoder::run_transformer(const float * conv_features, int n_ctx, std::vector<float> & output,
+                                   int device_slot, device_features * device_output) {
+    if (!model_.ctx) {
+        error_msg_ = "Model not loaded";
+        return false;
+    }
+    
+    if (n_ctx <= 0) {
+        error_msg_ = "Encoder input is empty";
+        return false;
+    }
+    
+    if (!device_output && worker_groups(n_ctx).size() > 1) {
+        return run_transformer_parallel(conv_features, n_ctx, output);
+    }
+    
+    auto lock = lock_arena(state_.arena);
+    
+    const int n_state = model_.hparams.d_model;
+    struct ggml_cgraph * gf_enc = build_graph_transformer(n_ctx, device_slot);
+    if (!gf_enc) {
+        return false;
+    }
+    
     if (!ggml_backend_sched_alloc_graph(state_.sched, gf_enc)) {
         error_msg_ = "Failed to allocate encoder graph";
-        ggml_free(enc_ctx);
         return false;
     }
     
@@ -564,18 +1466,18 @@ bool AudioEncoder::encode(const float * mel_data, int n_mel, int n_frames,
     if (!enc_input) {
         error_msg_ = "Failed to find enc_input tensor";
         ggml_backend_sched_reset(state_.sched);
-        ggml_free(enc_ctx);
         return false;
     }
     
-    ggml_backend_tensor_set(enc_input, all_conv_outputs.data(), 0, n_ctx * n_state * sizeof(float));
+    upload(enc_input, (size_t)n_ctx * n_state, [&](float * dst) {
+        memcpy(dst, conv_features, (size_t)n_ctx * n_state * sizeof(float));
+    });
     
     {
         QWEN3_TIMER("audio_encoding.transformer");
-        if (ggml_backend_sched_graph_compute(state_.sched, gf_enc) != GGML_STATUS_SUCCESS) {
+        if (sched_graph_compute(state_.sched, gf_enc) != GGML_STATUS_SUCCESS) {
             error_msg_ = "Failed to compute encoder graph";
             ggml_backend_sched_reset(state_.sched);
-            ggml_free(enc_ctx);
             return false;
         }
     }
@@ -584,24 +1486,132 @@ bool AudioEncoder::encode(const float * mel_data, int n_mel, int n_frames,
     if (!embd_enc) {
         error_msg_ = "Failed to find embd_enc tensor";
         ggml_backend_sched_reset(state_.sched);
-        ggml_free(enc_ctx);
         return false;
     }
     
     int64_t out_n_ctx = embd_enc->ne[1];
     int64_t out_n_state = embd_enc->ne[0];
     
-    output.resize(out_n_ctx * out_n_state);
-    ggml_backend_tensor_get(embd_enc, output.data(), 0, out_n_ctx * out_n_state * sizeof(float));
+    if (device_output) {
+        device_output->tensor = state_.output_slots[device_slot].tensor;
+        device_output->n_frames = (int32_t)out_n_ctx;
+    } else {
+        output.resize(out_n_ctx * out_n_state);
+        ggml_backend_tensor_get(embd_enc, output.data(), 0, out_n_ctx * out_n_state * sizeof(float));
+    }
     
     ggml_backend_sched_reset(state_.sched);
-    ggml_free(enc_ctx);
     
     return true;
 }
 
+std::vector<std::pair<int, int>> AudioEncoder::worker_groups(int n_ctx) const {
+    std::vector<std::pair<int, int>> groups;
+    const int window = get_attn_window();
+    if (state_.workers.empty() || window <= 0 || n_ctx <= window) {
+        return groups;
+    }
+    
+    // Whole windows, as evenly as possible, larger groups first
+    const int n_windows = (n_ctx + window - 1) / window;
+    const int n_groups = std::min((int)state_.workers.size(), n_windows);
+    int start = 0;
+    for (int g = 0; g < n_groups; ++g) {
+        const int n = n_windows / n_groups + (g < n_windows % n_groups ? 1 : 0);
+        const int end = std::min(start + n * window, n_ctx);
+        groups.emplace_back(start, end);
+        start = end;
+    }
+    return groups;
+}
+
+bool AudioEncoder::run_transformer_parallel(const float * conv_features, int n_ctx,
+                                            std::vector<float> & output) {
+    QWEN3_TIMER("audio_encoding.transformer");
+    
+    const int n_state = model_.hparams.d_model;
+    const auto groups = worker_groups(n_ctx);
+    std::vector<std::vector<float>> results(groups.size());
+    std::vector<char> ok(groups.size(), 0);
+    
+    auto run_group = [&](size_t g) {
+        ok[g] = run_worker(state_.workers[g], conv_features + (size_t)groups[g].first * n_state,
+                           groups[g].second - groups[g].first, results[g]);
+    };
+    
+    // Graph observers and per-node trace events are not thread-safe, so the
+    // groups then run one after another
+    if (TimingProfiler::graph_events() || graph_observer::instance().callback) {
+        for (size_t g = 0; g < groups.size(); ++g) {
+            run_group(g);
+        }
+    } else {
+        // Group 0 on the calling thread
+        std::vector<std::thread> threads;
+        for (size_t g = 1; g < groups.size(); ++g) {
+            threads.emplace_back(run_group, g);
+        }
+        run_group(0);
+        for (auto & t : threads) {
+            t.join();
+        }
+    }
+    
+    size_t total = 0;
+    for (size_t g = 0; g < groups.size(); ++g) {
+        if (!ok[g]) {
+            error_msg_ = "Encoder frames " + std::to_string(groups[g].first) + ": " + state_.workers[g].error;
+            return false;
+        }
+        total += results[g].size();
+    }
+    
+    output.resize(total);
+    size_t offset = 0;
+    for (const auto & r : results) {
+        memcpy(output.data() + offset, r.data(), r.size() * sizeof(float));
+        offset += r.size();
+    }
+    
+    return true;
+}
+
+bool AudioEncoder::run_worker(encoder_worker & worker, const float * conv_features, int n_ctx,
+                              std::vector<float> & output) {
+    const int n_state = model_.hparams.d_model;
+    struct ggml_cgraph * gf_enc = build_graph_transformer(n_ctx, -1, &worker.compute_meta);
+    if (!gf_enc || !ggml_backend_sched_alloc_graph(worker.sched, gf_enc)) {
+        worker.error = "Failed to allocate encoder graph";
+        return false;
+    }
+    
+    struct ggml_tensor * enc_input = ggml_graph_get_tensor(gf_enc, "enc_input");
+    struct ggml_tensor * embd_enc = ggml_graph_get_tensor(gf_enc, "embd_enc");
+    if (!enc_input || !embd_enc) {
+        worker.error = "Failed to find encoder graph tensors";
+        ggml_backend_sched_reset(worker.sched);
+        return false;
+    }
+    
+    ggml_backend_tensor_set(enc_input, conv_features, 0, (size_t)n_ctx * n_state * sizeof(float));
+    
+    if (sched_graph_compute(worker.sched, gf_enc) != GGML_STATUS_SUCCESS) {
+        worker.error = "Failed to compute encoder graph";
+        ggml_backend_sched_reset(worker.sched);
+        return false;
+    }
+    
+    output.resize((size_t)embd_enc->ne[0] * embd_enc->ne[1]);
+    ggml_backend_tensor_get(embd_enc, output.data(), 0, output.size() * sizeof(float));
+    
+    ggml_backend_sched_reset(worker.sched);
+    return true;
+}
+
 bool AudioEncoder::encode_no_chunk(const float * mel_data, int n_mel, int n_frames,
                                     std::vector<float> & output) {
+    auto lock = lock_arena(state_.arena);
+    
     if (!model_.ctx) {
         error_msg_ = "Model not loaded";
         return false;
@@ -637,7 +1647,7 @@ bool AudioEncoder::encode_no_chunk(const float * mel_data, int n_mel, int n_fram
     
     ggml_backend_tensor_set(mel_tensor, transposed_mel.data(), 0, n_mel * n_frames * sizeof(float));
     
-    if (ggml_backend_sched_graph_compute(state_.sched, gf_conv) != GGML_STATUS_SUCCESS) {
+    if (sched_graph_compute(state_.sched, gf_conv) != GGML_STATUS_SUCCESS) {
         error_msg_ = "Failed to compute conv graph";
         ggml_backend_sched_reset(state_.sched);
         return false;
@@ -664,11 +1674,9 @@ bool AudioEncoder::encode_no_chunk(const float * mel_data, int n_mel, int n_fram
         conv_output[i] += pos_emb[i];
     }
     
-    state_.compute_meta.resize(ggml_tensor_overhead() * QWEN3_ASR_MAX_NODES + ggml_graph_overhead());
-    
     struct ggml_init_params enc_params = {
-        state_.compute_meta.size(),
-        state_.compute_meta.data(),
+        compute_meta().size(),
+        compute_meta().data(),
         true,
     };
     
@@ -702,36 +1710,20 @@ bool AudioEncoder::encode_no_chunk(const float * mel_data, int n_mel, int n_fram
         }
         
         {
-            struct ggml_tensor * Qcur = ggml_mul_mat(enc_ctx, layer.attn_q_w, cur);
-            if (layer.attn_q_b) {
-                Qcur = ggml_add(enc_ctx, Qcur, layer.attn_q_b);
-            }
-            
-            struct ggml_tensor * Kcur = ggml_mul_mat(enc_ctx, layer.attn_k_w, cur);
-            if (layer.attn_k_b) {
-                Kcur = ggml_add(enc_ctx, Kcur, layer.attn_k_b);
-            }
-            
-            struct ggml_tensor * Vcur = ggml_mul_mat(enc_ctx, layer.attn_v_w, cur);
-            if (layer.attn_v_b) {
-                Vcur = ggml_add(enc_ctx, Vcur, layer.attn_v_b);
-            }
+            const qkv_proj qkv = build_qkv(enc_ctx, cur, encoder_qkv_weights(layer), n_state_head, n_head, n_head);
+            struct ggml_tensor * Qcur = qkv.q;
+            struct ggml_tensor * Kcur = qkv.k;
+            struct ggml_tensor * Vcur = qkv.v;
             
-            struct ggml_tensor * Q = ggml_permute(enc_ctx,
-                ggml_reshape_3d(enc_ctx, Qcur, n_state_head, n_head, out_ctx),
-                0, 2, 1, 3);
+            struct ggml_tensor * Q = ggml_permute(enc_ctx, Qcur, 0, 2, 1, 3);
             
-            struct ggml_tensor * K = ggml_permute(enc_ctx,
-                ggml_reshape_3d(enc_ctx, Kcur, n_state_head, n_head, out_ctx),
-                0, 2, 1, 3);
+            struct ggml_tensor * K = ggml_permute(enc_ctx, Kcur, 0, 2, 1, 3);
             
             struct ggml_tensor * KQ = ggml_mul_mat(enc_ctx, K, Q);
             
             struct ggml_tensor * KQ_soft_max = ggml_soft_max_ext(enc_ctx, KQ, nullptr, KQscale, 0.0f);
             
-            struct ggml_tensor * V = ggml_cont(enc_ctx, ggml_permute(enc_ctx,
-                ggml_reshape_3d(enc_ctx, Vcur, n_state_head, n_head, out_ctx),
-                1, 2, 0, 3));
+            struct ggml_tensor * V = ggml_cont(enc_ctx, ggml_permute(enc_ctx, Vcur, 1, 2, 0, 3));
             
             struct ggml_tensor * KQV = ggml_mul_mat(enc_ctx, V, KQ_soft_max);
             
@@ -824,7 +1816,7 @@ bool AudioEncoder::encode_no_chunk(const float * mel_data, int n_mel, int n_fram
     
     ggml_backend_tensor_set(enc_input, conv_output.data(), 0, out_ctx * n_state * sizeof(float));
     
-    if (ggml_backend_sched_graph_compute(state_.sched, gf_enc) != GGML_STATUS_SUCCESS) {
+    if (sched_graph_compute(state_.sched, gf_enc) != GGML_STATUS_SUCCESS) {
         error_msg_ = "Failed to compute encoder graph";
         ggml_backend_sched_reset(state_.sched);
         ggml_free(enc_ctx);
@@ -853,6 +1845,8 @@ bool AudioEncoder::encode_no_chunk(const float * mel_data, int n_mel, int n_fram
 
 bool AudioEncoder::encode_conv_only(const float * mel_data, int n_mel, int n_frames,
                                      std::vector<float> & output) {
+    auto lock = lock_arena(state_.arena);
+    
     if (!model_.ctx) {
         error_msg_ = "Model not loaded";
         return false;
@@ -888,7 +1882,7 @@ bool AudioEncoder::encode_conv_only(const float * mel_data, int n_mel, int n_fra
     
     ggml_backend_tensor_set(mel_tensor, transposed_mel.data(), 0, n_mel * n_frames * sizeof(float));
     
-    if (ggml_backend_sched_graph_compute(state_.sched, gf_conv) != GGML_STATUS_SUCCESS) {
+    if (sched_graph_compute(state_.sched, gf_conv) != GGML_STATUS_SUCCESS) {
         error_msg_ = "Failed to compute conv graph";
         ggml_backend_sched_reset(state_.sched);
         return false;
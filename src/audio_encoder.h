@@ -1,18 +1,88 @@
 #pragma once
 
 #include "gguf_loader.h"
+#include "cpu_backend.h"
+#include "compute_arena.h"
+#include "mel_spectrogram.h"
 
+#include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
+// Mel frames per conv chunk (2 * n_window)
+#define QWEN3_ASR_CONV_CHUNK 100
+
 namespace qwen3_asr {
 
+// Encoder output left on the encoder's GPU (AudioEncoder::encode_to_device)
+struct device_features {
+    struct ggml_tensor * tensor = nullptr;  // [hidden_size, capacity], columns [0, n_frames) valid
+    int32_t n_frames = 0;
+};
+
+// Device buffer holding one device_features output, grown on demand
+struct encoder_output_slot {
+    struct ggml_context * ctx = nullptr;
+    ggml_backend_buffer_t buffer = nullptr;
+    struct ggml_tensor * tensor = nullptr;
+};
+
+// One backend set of the window-parallel transformer (encoder_workers)
+struct encoder_worker {
+    ggml_backend_t backend = nullptr;
+    ggml_threadpool_t threadpool = nullptr;
+    ggml_backend_sched_t sched = nullptr;
+    std::vector<uint8_t> compute_meta;
+    std::string error;
+};
+
 struct audio_encoder_state {
     ggml_backend_t backend_cpu = nullptr;
     ggml_backend_t backend_gpu = nullptr;
+    ggml_threadpool_t threadpool = nullptr;
     ggml_backend_sched_t sched = nullptr;
     
+    // Set when the backends and scheduler above belong to a shared arena
+    std::shared_ptr<ComputeArena> arena;
+    
     std::vector<uint8_t> compute_meta;
     
+    // weight_fingerprint(), taken at load before any repacking
+    uint64_t fingerprint = 0;
+    
+    // Constant tensors uploaded once at load time
+    struct ggml_context * ctx_const = nullptr;
+    ggml_backend_buffer_t buf_const = nullptr;
+    struct ggml_tensor * pos_emb = nullptr;  // [d_model, chunk_out_len] sinusoidal PE
+    
+    // Mel front end constants (init_mel_frontend), on the GPU backend
+    struct ggml_context * ctx_mel = nullptr;
+    ggml_backend_buffer_t buf_mel = nullptr;
+    struct ggml_tensor * mel_cos = nullptr;      // [n_fft, n_bins] windowed DFT basis
+    struct ggml_tensor * mel_sin = nullptr;      // [n_fft, n_bins]
+    struct ggml_tensor * mel_filters = nullptr;  // [n_bins, n_mel]
+    struct ggml_tensor * mel_consts = nullptr;   // {-8, -4} for the log-mel floor
+    
+    // Device-resident working set of encode_pcm, grown on demand: padded
+    // samples, the log-mel [n_frames, n_mel] and one maximum per mel block
+    struct ggml_context * ctx_mel_work = nullptr;
+    ggml_backend_buffer_t buf_mel_work = nullptr;
+    struct ggml_tensor * mel_pcm = nullptr;
+    struct ggml_tensor * mel_out = nullptr;
+    struct ggml_tensor * mel_max = nullptr;
+    
+    // encode_to_device outputs, indexed by slot
+    std::vector<encoder_output_slot> output_slots;
+    
+    // Workers of run_transformer_parallel; empty unless encoder_workers > 1
+    // on the CPU
+    std::vector<encoder_worker> workers;
+    
+    // Pinned host staging for uploads to the GPU backend (mel, samples);
+    // null when the device has no pinned host buffer type
+    ggml_backend_buffer_t buf_pinned = nullptr;
+    
     struct ggml_tensor * embd_conv = nullptr;
     struct ggml_tensor * embd_enc = nullptr;
 };
@@ -22,11 +92,80 @@ public:
     AudioEncoder();
     ~AudioEncoder();
     
-    bool load_model(const std::string & model_path);
+    // arena: run on its backends and scheduler when it matches cpu_params
+    // (see ComputeArena); otherwise the encoder creates its own
+    bool load_model(const std::string & model_path,
+                    const cpu_backend_params & cpu_params = cpu_backend_params(),
+                    const std::shared_ptr<ComputeArena> & arena = nullptr);
+    
+    // Load from an opened file (see ModelFile), e.g. one shared with the decoder
+    bool load_model(const std::shared_ptr<ModelFile> & file,
+                    const cpu_backend_params & cpu_params = cpu_backend_params(),
+                    const std::shared_ptr<ComputeArena> & arena = nullptr);
     
-    bool encode(const float * mel_data, int n_mel, int n_frames, 
+    // Size the compute buffers for n_mel_frames of audio by reserving the
+    // largest conv graph and the transformer graph, without running them
+    bool reserve_compute(int n_mel_frames);
+    
+    // Weights, constants and output buffers, plus the compute buffers
+    // unless they belong to a shared arena
+    memory_usage get_memory_usage() const;
+    
+    bool encode(const float * mel_data, int n_mel, int n_frames,
                 std::vector<float> & output);
+
+    // The two halves of encode(), for callers that feed audio incrementally.
+    // encode_conv: conv frontend + PE over [n_mel, n_frames] mel; chunks are
+    //   independent, so it may be called on any QWEN3_ASR_CONV_CHUNK-aligned
+    //   slice. Output is [n_frames_out, d_model] row-major.
+    // encode_transformer: transformer + projection over n_ctx conv frames.
+    //   Attention is windowed from frame 0 of the input, so slices starting on
+    //   a get_attn_window() boundary give the same result as a full encode.
+    bool encode_conv(const float * mel_data, int n_mel, int n_frames,
+                     std::vector<float> & output);
+    bool encode_transformer(const float * conv_features, int n_ctx,
+                            std::vector<float> & output);
+
+    // GPU mel front end: upload the DFT basis and mel filterbank once; only
+    // valid when the encoder runs on a GPU backend
+    bool has_gpu() const { return state_.backend_gpu != nullptr; }
+    bool init_mel_frontend(const MelFilters & filters);
+    bool has_mel_frontend() const { return state_.mel_cos != nullptr; }
+
+    // encode() from raw 16 kHz samples (more than QWEN_N_FFT / 2 of them):
+    // the samples are uploaded once and the log-mel, computed as ggml ops
+    // to match log_mel_spectrogram(), stays on the device through the conv
+    // frontend. n_mel_frames receives the mel length.
+    bool encode_pcm(const float * samples, int n_samples,
+                    std::vector<float> & output, int32_t & n_mel_frames);
+
+    // Device-resident output (GPU encoders only): encode() / encode_pcm()
+    // writing into output slot `slot` instead of host memory, so a decoder
+    // on the same device can read the features in place (see
+    // TextDecoder::forward_with_audio_device). A slot is overwritten by the
+    // next encode into it; callers own the slot numbering.
+    bool encode_to_device(const float * mel_data, int n_mel, int n_frames, int slot,
+                          device_features & output);
+    bool encode_pcm_to_device(const float * samples, int n_samples, int slot,
+                              device_features & output, int32_t & n_mel_frames);
+    
+    // Copy a device output to host memory, [n_frames, hidden_size] row-major
+    bool read_device_features(const device_features & features, std::vector<float> & output);
+    
+    // Buffer type of the output slots, null without a GPU backend
+    ggml_backend_buffer_type_t get_output_buffer_type() const;
+
+    // Conv output frames per full QWEN3_ASR_CONV_CHUNK mel chunk (13)
+    int get_chunk_output_length() const;
+
+    // Attention window in conv output frames (104), 0 for full attention
+    int get_attn_window() const;
     
+    // Hash of the encoder hparams, layout and sampled weights (see
+    // encoder_fingerprint); equal values mean another model's encoder can be
+    // replaced by this one's output
+    uint64_t weight_fingerprint() const;
+
     bool encode_conv_only(const float * mel_data, int n_mel, int n_frames,
                           std::vector<float> & output);
     
@@ -41,15 +180,81 @@ public:
     
 private:
     struct ggml_cgraph * build_graph_conv(int n_frames);
+    
+    // Conv frontend for n_chunks stacked mel chunks of chunk_len frames each
+    // (last chunk zero-padded), with the positional embedding added.
+    // Input "mel" is [n_frames, n_mel]; output "embd_conv" is
+    // [d_model, chunk_out_len * n_chunks].
+    // With mel_src set, the input is instead frames [frame_start, frame_start
+    // + n_frames) of the device-resident [n_mel_frames, n_mel] mel_src.
+    struct ggml_cgraph * build_graph_conv_batch(int n_chunks, int chunk_len, int n_frames,
+                                                struct ggml_tensor * mel_src = nullptr,
+                                                int frame_start = 0, int n_mel_frames = 0);
+    
+    // encode_conv over host mel_data or, when mel_data is null, state_.mel_out
+    bool encode_conv_frames(const float * mel_data, int n_frames, std::vector<float> & output);
+    
+    // Mel front end graphs: reflect-pad "pcm" into mel_pcm; log10 mel of
+    // n_frames frames from frame_start into mel_out and their maximum into
+    // mel_max[block]; the max-8 floor and scaling of mel_out in place
+    bool reserve_mel_work(int n_samples, int n_frames, int n_blocks);
+    struct ggml_cgraph * build_graph_mel_pad(int n_samples);
+    struct ggml_cgraph * build_graph_mel_block(int frame_start, int n_frames, int n_mel_frames, int block);
+    struct ggml_cgraph * build_graph_mel_clamp(int n_mel_frames, int n_blocks);
+    
+    // encode_transformer into output_slots[device_slot] (when >= 0) instead
+    // of output
+    bool run_transformer(const float * conv_features, int n_ctx, std::vector<float> & output,
+                         int device_slot, device_features * device_output);
+    
+    // Host-output run_transformer split at attention window boundaries into
+    // one group of windows per worker, computed concurrently and gathered in
+    // order. run_worker: one group on one worker, errors in worker.error
+    bool run_transformer_parallel(const float * conv_features, int n_ctx, std::vector<float> & output);
+    bool run_worker(encoder_worker & worker, const float * conv_features, int n_ctx,
+                    std::vector<float> & output);
+    
+    // Frame ranges of the worker groups for n_ctx frames, as [start, end)
+    std::vector<std::pair<int, int>> worker_groups(int n_ctx) const;
+    
+    bool init_workers(const cpu_backend_params & cpu_params);
+    bool reserve_output_slot(int slot, int n_frames);
+    
+    // Log-mel front end of encode_pcm into state_.mel_out
+    bool compute_mel(const float * samples, int n_samples, int n_frames);
+    
+    // Pinned staging of at least n floats (waits for the previous upload)
+    float * pinned_staging(size_t n);
+    
+    // Upload n floats produced by fill(dst) into tensor: written in place
+    // when the tensor is in host memory, otherwise through pinned staging
+    // with an async copy on the GPU stream the graph then runs on, or with
+    // a plain blocking copy without pinned memory
+    template <typename Fill>
+    void upload(struct ggml_tensor * tensor, size_t n, Fill fill);
+    
+    bool init_const_tensors(int chunk_len);
     struct ggml_cgraph * build_graph_encoder(int n_ctx);
     
+    // Hash of the weights as mapped from the file, see weight_fingerprint()
+    uint64_t compute_fingerprint() const;
+    
+    // Move the matmul weights into repacked CPU layouts (repack_cpu_weights)
+    bool repack_weights(const std::string & model_path, bool use_cache);
+    
+    // Transformer graph of run_transformer over "enc_input" [d_model, n_ctx],
+    // built in meta (compute_meta() when null)
+    struct ggml_cgraph * build_graph_transformer(int n_ctx, int device_slot,
+                                                 std::vector<uint8_t> * meta = nullptr);
+    
+    // Graph meta buffer: the arena's when shared
+    std::vector<uint8_t> & compute_meta() { return state_.arena ? state_.arena->get_meta() : state_.compute_meta; }
+    
     bool compute_graph(struct ggml_cgraph * graph);
     
     audio_encoder_model model_;
     audio_encoder_state state_;
     std::string error_msg_;
-    
-    int n_threads_ = 4;
 };
 
 } // namespace qwen3_asr
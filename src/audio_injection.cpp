@@ -71,6 +71,54 @@ bool inject_audio_embeddings(
     return true;
 }
 
+bool make_injection_layout(
+    const int32_t * input_ids,
+    int32_t n_tokens,
+    const std::vector<int32_t> & audio_positions,
+    injection_layout & layout) {
+    
+    layout.text_ids.clear();
+    layout.text_rows.clear();
+    layout.audio_rows.clear();
+    
+    std::vector<char> is_audio(n_tokens > 0 ? n_tokens : 0, 0);
+    for (int32_t pos : audio_positions) {
+        if (pos < 0 || pos >= n_tokens) {
+            return false;
+        }
+        is_audio[pos] = 1;
+        layout.audio_rows.push_back(pos);
+    }
+    
+    for (int32_t i = 0; i < n_tokens; ++i) {
+        if (!is_audio[i]) {
+            layout.text_ids.push_back(input_ids[i]);
+            layout.text_rows.push_back(i);
+        }
+    }
+    
+    return true;
+}
+
+bool make_injection_layout(
+    const int32_t * input_ids,
+    int32_t n_tokens,
+    int32_t audio_start_pos,
+    int32_t n_audio_frames,
+    injection_layout & layout) {
+    
+    if (n_audio_frames > 0 && (audio_start_pos < 0 || audio_start_pos + n_audio_frames > n_tokens)) {
+        return false;
+    }
+    
+    std::vector<int32_t> positions(n_audio_frames > 0 ? n_audio_frames : 0);
+    for (size_t i = 0; i < positions.size(); ++i) {
+        positions[i] = audio_start_pos + (int32_t)i;
+    }
+    
+    return make_injection_layout(input_ids, n_tokens, positions, layout);
+}
+
 injection_result inject_audio(
     const int32_t * input_ids,
     int32_t n_tokens,
@@ -104,17 +152,30 @@ injection_result inject_audio(
         }
     }
     
-    result.embeddings.resize(n_tokens * ctx.hidden_size);
+    // Without audio the placeholders are embedded like any other token
+    if (!audio_features || n_audio_frames <= 0) {
+        audio_positions.clear();
+    }
     
-    embed_tokens(input_ids, n_tokens, ctx.token_embd, 
-                 ctx.vocab_size, ctx.hidden_size, result.embeddings.data());
+    injection_layout layout;
+    if (!make_injection_layout(input_ids, n_tokens, audio_positions, layout)) {
+        result.error_msg = "Failed to inject audio embeddings";
+        return result;
+    }
     
-    if (audio_features && n_audio_frames > 0 && !audio_positions.empty()) {
-        if (!inject_audio_embeddings(result.embeddings.data(), n_tokens, ctx.hidden_size,
-                                     audio_features, n_audio_frames, audio_positions)) {
-            result.error_msg = "Failed to inject audio embeddings";
-            return result;
-        }
+    const size_t row_bytes = ctx.hidden_size * sizeof(float);
+    result.embeddings.resize(n_tokens * ctx.hidden_size);
+    
+    std::vector<float> text_embd(layout.text_ids.size() * ctx.hidden_size);
+    embed_tokens(layout.text_ids.data(), (int32_t)layout.text_ids.size(), ctx.token_embd,
+                 ctx.vocab_size, ctx.hidden_size, text_embd.data());
+    for (size_t i = 0; i < layout.text_rows.size(); ++i) {
+        std::memcpy(result.embeddings.data() + layout.text_rows[i] * ctx.hidden_size,
+                    text_embd.data() + i * ctx.hidden_size, row_bytes);
+    }
+    for (size_t i = 0; i < layout.audio_rows.size(); ++i) {
+        std::memcpy(result.embeddings.data() + layout.audio_rows[i] * ctx.hidden_size,
+                    audio_features + i * ctx.hidden_size, row_bytes);
     }
     
     result.success = true;
@@ -33,6 +33,33 @@ struct audio_injection_context {
     audio_token_ids tokens;
 };
 
+// Where each sequence position of a prompt gets its embedding from: text
+// positions look up their token ID, audio positions take the next audio
+// frame. Audio placeholders are never embedded. Shared by inject_audio()
+// and the decoder graphs, which scatter both kinds of rows with set_rows.
+struct injection_layout {
+    std::vector<int32_t> text_ids;      // token IDs of the text positions
+    std::vector<int64_t> text_rows;     // sequence position of each text ID
+    std::vector<int64_t> audio_rows;    // sequence position of audio frame i
+};
+
+// Layout with n_audio_frames frames at positions listed in audio_positions
+// (masked_scatter order). Returns false if a position is out of range.
+bool make_injection_layout(
+    const int32_t * input_ids,
+    int32_t n_tokens,
+    const std::vector<int32_t> & audio_positions,
+    injection_layout & layout);
+
+// Layout with n_audio_frames consecutive frames from audio_start_pos.
+// Returns false if the span does not fit in n_tokens.
+bool make_injection_layout(
+    const int32_t * input_ids,
+    int32_t n_tokens,
+    int32_t audio_start_pos,
+    int32_t n_audio_frames,
+    injection_layout & layout);
+
 // Find positions of audio_pad tokens in input_ids
 // Returns vector of positions where input_ids[i] == audio_pad_token_id
 std::vector<int32_t> find_audio_positions(
@@ -0,0 +1,474 @@
+#include "audio_reader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Sinc zero crossings on each side of the centre tap, at the lower rate
+#define QWEN3_ASR_RESAMPLE_ZEROS 16
+
+// Cutoff relative to the lower Nyquist frequency, and the Kaiser beta
+#define QWEN3_ASR_RESAMPLE_ROLLOFF 0.945
+#define QWEN3_ASR_RESAMPLE_BETA 8.6
+
+// 16 kHz samples requested per AudioFileReader::read() in load_audio_file
+#define QWEN3_ASR_WAV_BLOCK 16384
+
+#define WAVE_FORMAT_PCM        0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+namespace qwen3_asr {
+
+static uint16_t read_le16(const uint8_t * p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t read_le32(const uint8_t * p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Modified Bessel function of the first kind, order 0 (series expansion)
+static double bessel_i0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 64; ++k) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+static inline float dot_f32(const float * a, const float * b, int n) {
+    int i = 0;
+    float sum = 0.0f;
+#if defined(__AVX2__)
+    __m256 acc = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+#if defined(__FMA__)
+        acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc);
+#else
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+#endif
+    }
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    sum = _mm_cvtss_f32(s);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (; i + 4 <= n; i += 4) {
+        acc = vfmaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    sum = vaddvq_f32(acc);
+#endif
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// ============================================================================
+// WavReader
+// ============================================================================
+
+WavReader::~WavReader() {
+    close();
+}
+
+void WavReader::close() {
+    if (file_) {
+        fclose(file_);
+        file_ = nullptr;
+    }
+}
+
+bool WavReader::open(const std::string & path) {
+    close();
+    n_frames_ = -1;
+    frames_left_ = -1;
+
+    file_ = fopen(path.c_str(), "rb");
+    if (!file_) {
+        error_msg_ = "Cannot open WAV file: " + path;
+        return false;
+    }
+    return read_header(path);
+}
+
+bool WavReader::open_memory(const void * data, size_t size) {
+    close();
+    n_frames_ = -1;
+    frames_left_ = -1;
+
+    if (size == 0) {
+        error_msg_ = "Empty WAV data";
+        return false;
+    }
+    file_ = fmemopen(const_cast<void *>(data), size, "rb");
+    if (!file_) {
+        error_msg_ = "Cannot read WAV data from memory";
+        return false;
+    }
+    return read_header("<memory>");
+}
+
+bool WavReader::read_header(const std::string & path) {
+    uint8_t header[12];
+    if (fread(header, 1, 12, file_) != 12 ||
+        memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+        error_msg_ = "Not a valid WAV file (missing RIFF/WAVE header): " + path;
+        close();
+        return false;
+    }
+
+    uint16_t format = 0;
+    bool have_fmt = false;
+    uint8_t chunk[8];
+    while (fread(chunk, 1, 8, file_) == 8) {
+        const uint32_t size = read_le32(chunk + 4);
+
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            uint8_t fmt[40] = {0};
+            const uint32_t n_read = std::min<uint32_t>(size, sizeof(fmt));
+            if (size < 16 || fread(fmt, 1, n_read, file_) != n_read) {
+                error_msg_ = "Truncated fmt chunk in WAV file: " + path;
+                close();
+                return false;
+            }
+            format = read_le16(fmt);
+            channels_ = read_le16(fmt + 2);
+            sample_rate_ = (int)read_le32(fmt + 4);
+            block_align_ = read_le16(fmt + 12);
+            bits_ = read_le16(fmt + 14);
+            if (format == WAVE_FORMAT_EXTENSIBLE && n_read >= 26) {
+                // The first two bytes of the SubFormat GUID are the format code
+                format = read_le16(fmt + 24);
+            }
+            const long skip = (long)(size - n_read) + (size & 1);
+            if (skip > 0) {
+                fseek(file_, skip, SEEK_CUR);
+            }
+            have_fmt = true;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!have_fmt) {
+                error_msg_ = "WAV data chunk before fmt chunk: " + path;
+                close();
+                return false;
+            }
+            const bool pcm_ok = format == WAVE_FORMAT_PCM &&
+                                (bits_ == 8 || bits_ == 16 || bits_ == 24 || bits_ == 32);
+            const bool float_ok = format == WAVE_FORMAT_IEEE_FLOAT && (bits_ == 32 || bits_ == 64);
+            if (!pcm_ok && !float_ok) {
+                error_msg_ = "Unsupported WAV encoding (format " + std::to_string(format) +
+                             ", " + std::to_string(bits_) + " bits): " + path;
+                close();
+                return false;
+            }
+            if (channels_ <= 0 || sample_rate_ <= 0) {
+                error_msg_ = "Invalid WAV format header: " + path;
+                close();
+                return false;
+            }
+            is_float_ = float_ok;
+            block_align_ = channels_ * (bits_ / 8);
+            // 0 and 0xFFFFFFFF are written by encoders that stream the file
+            if (size != 0 && size != 0xFFFFFFFFu) {
+                n_frames_ = size / block_align_;
+                frames_left_ = n_frames_;
+            }
+            return true;
+        } else {
+            fseek(file_, (long)size + (size & 1), SEEK_CUR);
+        }
+    }
+
+    error_msg_ = "No data chunk found in WAV file: " + path;
+    close();
+    return false;
+}
+
+int WavReader::read(float * out, int max_frames) {
+    if (!file_) {
+        return -1;
+    }
+    int64_t n = max_frames;
+    if (frames_left_ >= 0) {
+        n = std::min(n, frames_left_);
+    }
+    if (n <= 0) {
+        return 0;
+    }
+
+    raw_.resize((size_t)n * block_align_);
+    const size_t got = fread(raw_.data(), block_align_, (size_t)n, file_);
+    if (got == 0) {
+        if (ferror(file_)) {
+            error_msg_ = "Read error in WAV data";
+            return -1;
+        }
+        return 0;
+    }
+
+    const int nc = channels_;
+    const float inv_nc = 1.0f / nc;
+    const uint8_t * p = raw_.data();
+    const size_t n_values = got * nc;
+    raw_float_.resize(n_values);
+
+    // Convert every sample, then average each frame's channels
+    switch (is_float_ ? -bits_ : bits_) {
+        case 8:
+            for (size_t i = 0; i < n_values; ++i) {
+                raw_float_[i] = (p[i] - 128) / 128.0f;
+            }
+            break;
+        case 16:
+            for (size_t i = 0; i < n_values; ++i) {
+                raw_float_[i] = (int16_t)read_le16(p + 2 * i) / 32768.0f;
+            }
+            break;
+        case 24:
+            for (size_t i = 0; i < n_values; ++i) {
+                const uint8_t * q = p + 3 * i;
+                const int32_t v = (int32_t)(((uint32_t)q[0] << 8) | ((uint32_t)q[1] << 16) | ((uint32_t)q[2] << 24)) >> 8;
+                raw_float_[i] = v / 8388608.0f;
+            }
+            break;
+        case 32:
+            for (size_t i = 0; i < n_values; ++i) {
+                raw_float_[i] = (float)((int32_t)read_le32(p + 4 * i) / 2147483648.0);
+            }
+            break;
+        case -32:
+            for (size_t i = 0; i < n_values; ++i) {
+                const uint32_t bits = read_le32(p + 4 * i);
+                memcpy(&raw_float_[i], &bits, 4);
+            }
+            break;
+        case -64:
+            for (size_t i = 0; i < n_values; ++i) {
+                uint64_t bits = (uint64_t)read_le32(p + 8 * i) | ((uint64_t)read_le32(p + 8 * i + 4) << 32);
+                double v;
+                memcpy(&v, &bits, 8);
+                raw_float_[i] = (float)v;
+            }
+            break;
+    }
+
+    if (nc == 1) {
+        memcpy(out, raw_float_.data(), got * sizeof(float));
+    } else {
+        for (size_t i = 0; i < got; ++i) {
+            float sum = 0.0f;
+            for (int c = 0; c < nc; ++c) {
+                sum += raw_float_[i * nc + c];
+            }
+            out[i] = sum * inv_nc;
+        }
+    }
+
+    if (frames_left_ >= 0) {
+        frames_left_ -= (int64_t)got;
+    }
+    return (int)got;
+}
+
+// ============================================================================
+// Resampler
+// ============================================================================
+
+Resampler::Resampler(int in_rate, int out_rate) {
+    const int g = std::gcd(in_rate, out_rate);
+    up_ = out_rate / g;
+    down_ = in_rate / g;
+    if (passthrough()) {
+        return;
+    }
+
+    // Low-pass at the lower of the two Nyquist frequencies, in input samples
+    const double scale = std::min(1.0, (double)up_ / down_) * QWEN3_ASR_RESAMPLE_ROLLOFF;
+    const double half_width = QWEN3_ASR_RESAMPLE_ZEROS / scale;
+    const int half = (int)std::ceil(half_width);
+    n_taps_ = 2 * half;
+
+    // Phase p filters output samples at fractional position p / up_ past
+    // an input sample; tap k is input sample (k - half + 1) from there
+    const double i0_beta = bessel_i0(QWEN3_ASR_RESAMPLE_BETA);
+    coeffs_.resize((size_t)up_ * n_taps_);
+    for (int p = 0; p < up_; ++p) {
+        float * c = &coeffs_[(size_t)p * n_taps_];
+        double sum = 0.0;
+        for (int k = 0; k < n_taps_; ++k) {
+            const double d = (k - half + 1) - (double)p / up_;
+            const double x = d / half_width;
+            double v = 0.0;
+            if (std::abs(x) < 1.0) {
+                const double w = bessel_i0(QWEN3_ASR_RESAMPLE_BETA * std::sqrt(1.0 - x * x)) / i0_beta;
+                const double t = M_PI * scale * d;
+                v = (d == 0.0 ? 1.0 : std::sin(t) / t) * w;
+            }
+            c[k] = (float)v;
+            sum += v;
+        }
+        // Unit DC gain for every phase
+        for (int k = 0; k < n_taps_; ++k) {
+            c[k] = (float)(c[k] / sum);
+        }
+    }
+
+    reset();
+}
+
+void Resampler::reset() {
+    const int half = n_taps_ / 2;
+    hist_.assign(std::max(0, half - 1), 0.0f);
+    hist_start_ = -(int64_t)hist_.size();
+    n_in_ = 0;
+    n_out_ = 0;
+}
+
+void Resampler::push(const float * in, int n, std::vector<float> & out) {
+    if (passthrough()) {
+        out.insert(out.end(), in, in + n);
+        return;
+    }
+    hist_.insert(hist_.end(), in, in + n);
+    n_in_ += n;
+    produce(false, out);
+}
+
+void Resampler::finish(std::vector<float> & out) {
+    if (passthrough()) {
+        return;
+    }
+    produce(true, out);
+}
+
+void Resampler::produce(bool flush, std::vector<float> & out) {
+    const int half = n_taps_ / 2;
+    const int64_t n_total = flush ? (n_in_ * up_ + down_ - 1) / down_ : INT64_MAX;
+
+    while (n_out_ < n_total) {
+        const int64_t pos = n_out_ * down_;
+        const int64_t i0 = pos / up_;
+        const int p = (int)(pos % up_);
+        const int64_t last = i0 + half;
+        if (last >= n_in_) {
+            if (!flush) {
+                break;
+            }
+            while (hist_start_ + (int64_t)hist_.size() <= last) {
+                hist_.push_back(0.0f);
+            }
+        }
+        out.push_back(dot_f32(&hist_[i0 - half + 1 - hist_start_], &coeffs_[(size_t)p * n_taps_], n_taps_));
+        n_out_++;
+    }
+
+    // Drop input that no later output needs, in large steps
+    const int64_t keep_from = (n_out_ * down_) / up_ - half + 1;
+    const int64_t drop = keep_from - hist_start_;
+    if (drop > 4096) {
+        hist_.erase(hist_.begin(), hist_.begin() + drop);
+        hist_start_ += drop;
+    }
+}
+
+// ============================================================================
+// AudioFileReader
+// ============================================================================
+
+bool AudioFileReader::open(const std::string & path) {
+    done_ = false;
+    if (!wav_.open(path)) {
+        error_msg_ = wav_.get_error();
+        return false;
+    }
+    resampler_.reset(new Resampler(wav_.sample_rate(), QWEN_SAMPLE_RATE));
+    return true;
+}
+
+bool AudioFileReader::open_memory(const void * data, size_t size) {
+    done_ = false;
+    if (!wav_.open_memory(data, size)) {
+        error_msg_ = wav_.get_error();
+        return false;
+    }
+    resampler_.reset(new Resampler(wav_.sample_rate(), QWEN_SAMPLE_RATE));
+    return true;
+}
+
+bool AudioFileReader::read(std::vector<float> & out, int max_samples) {
+    if (done_) {
+        return true;
+    }
+    const int n_block = std::max(1, (int)((int64_t)max_samples * wav_.sample_rate() / QWEN_SAMPLE_RATE));
+    block_.resize(n_block);
+    const int got = wav_.read(block_.data(), n_block);
+    if (got < 0) {
+        error_msg_ = wav_.get_error();
+        return false;
+    }
+    if (got == 0) {
+        resampler_->finish(out);
+        wav_.close();
+        done_ = true;
+        return true;
+    }
+    resampler_->push(block_.data(), got, out);
+    return true;
+}
+
+bool load_audio_file(const std::string & path, std::vector<float> & samples, int & sample_rate) {
+    AudioFileReader reader;
+    if (!reader.open(path)) {
+        fprintf(stderr, "Error: %s\n", reader.get_error().c_str());
+        return false;
+    }
+    sample_rate = reader.source_rate();
+
+    samples.clear();
+    while (!reader.done()) {
+        if (!reader.read(samples, QWEN3_ASR_WAV_BLOCK)) {
+            fprintf(stderr, "Error: %s\n", reader.get_error().c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool load_audio_memory(const void * data, size_t size, std::vector<float> & samples,
+                       int & sample_rate, std::string & error) {
+    AudioFileReader reader;
+    if (!reader.open_memory(data, size)) {
+        error = reader.get_error();
+        return false;
+    }
+    sample_rate = reader.source_rate();
+
+    samples.clear();
+    while (!reader.done()) {
+        if (!reader.read(samples, QWEN3_ASR_WAV_BLOCK)) {
+            error = reader.get_error();
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace qwen3_asr
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "mel_spectrogram.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace qwen3_asr {
+
+// Block-wise WAV reader: PCM 8/16/24/32-bit, IEEE float 32/64-bit and
+// WAVE_FORMAT_EXTENSIBLE. Only one block of the file is held in memory;
+// read() returns mono samples in [-1, 1] (channels are averaged).
+class WavReader {
+public:
+    WavReader() = default;
+    ~WavReader();
+
+    WavReader(const WavReader &) = delete;
+    WavReader & operator=(const WavReader &) = delete;
+
+    bool open(const std::string & path);
+
+    // Read a WAV image held in memory; data must stay valid until close()
+    bool open_memory(const void * data, size_t size);
+
+    void close();
+
+    // Read up to max_frames frames; returns the number read, 0 at the end
+    // of the data and -1 on a read error
+    int read(float * out, int max_frames);
+
+    int sample_rate() const { return sample_rate_; }
+    int channels() const { return channels_; }
+    int bits_per_sample() const { return bits_; }
+
+    // Total frames in the data chunk (-1 when the header leaves it open)
+    int64_t n_frames() const { return n_frames_; }
+
+    const std::string & get_error() const { return error_msg_; }
+
+private:
+    bool read_header(const std::string & name);
+
+    FILE * file_ = nullptr;
+    int sample_rate_ = 0;
+    int channels_ = 0;
+    int bits_ = 0;
+    bool is_float_ = false;
+    int block_align_ = 0;
+    int64_t n_frames_ = -1;
+    int64_t frames_left_ = -1;
+    std::vector<uint8_t> raw_;
+    std::vector<float> raw_float_;  // interleaved, before the downmix
+    std::string error_msg_;
+};
+
+// Polyphase windowed-sinc (Kaiser) resampler between integer rates, for
+// input given in blocks of any size. The output of push()+finish() over a
+// signal does not depend on how it was split into blocks, and has
+// ceil(n_in * out_rate / in_rate) samples aligned with the input.
+class Resampler {
+public:
+    Resampler(int in_rate, int out_rate);
+
+    // Append the samples that are complete after adding n input samples
+    void push(const float * in, int n, std::vector<float> & out);
+
+    // Append the remaining samples (the input is treated as zero beyond
+    // its end); push() may be called again after reset()
+    void finish(std::vector<float> & out);
+
+    void reset();
+
+    bool passthrough() const { return up_ == down_; }
+
+private:
+    void produce(bool flush, std::vector<float> & out);
+
+    int up_ = 1;                // output rate / gcd
+    int down_ = 1;              // input rate / gcd
+    int n_taps_ = 0;            // per phase
+    std::vector<float> coeffs_; // [up_][n_taps_]
+
+    std::vector<float> hist_;   // input from absolute index hist_start_
+    int64_t hist_start_ = 0;
+    int64_t n_in_ = 0;
+    int64_t n_out_ = 0;
+};
+
+// WAV file as 16 kHz mono blocks: WavReader + downmix + Resampler
+class AudioFileReader {
+public:
+    bool open(const std::string & path);
+    bool open_memory(const void * data, size_t size);
+
+    // Append up to about max_samples 16 kHz samples to out; returns false
+    // on error, and sets done() once the file is exhausted
+    bool read(std::vector<float> & out, int max_samples);
+
+    bool done() const { return done_; }
+    int source_rate() const { return wav_.sample_rate(); }
+    int source_channels() const { return wav_.channels(); }
+    const std::string & get_error() const { return error_msg_; }
+
+private:
+    WavReader wav_;
+    std::unique_ptr<Resampler> resampler_;
+    std::vector<float> block_;
+    bool done_ = false;
+    std::string error_msg_;
+};
+
+// Load a whole WAV file as 16 kHz mono, resampling and downmixing as
+// needed; sample_rate is set to the rate of the file before resampling
+bool load_audio_file(const std::string & path, std::vector<float> & samples, int & sample_rate);
+
+// Same for a WAV image in memory (e.g. an upload); on failure the reason is
+// stored in error instead of being printed
+bool load_audio_memory(const void * data, size_t size, std::vector<float> & samples,
+                       int & sample_rate, std::string & error);
+
+} // namespace qwen3_asr
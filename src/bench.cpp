@@ -0,0 +1,439 @@
+#include "qwen3_asr.h"
+#include "ggml-backend.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#else
+#include <unistd.h>
+#endif
+
+// Benchmark sweep: every model x backend x thread count is loaded once, and
+// every KV cache type x audio length is transcribed warmup + runs times on it.
+struct bench_params {
+    std::vector<std::string> model_paths;
+    std::string audio_path = "";
+    std::string output_path = "";
+    std::vector<int32_t> lengths_sec;               // empty: the file as is
+    std::vector<int32_t> threads = {4};
+    std::vector<std::string> backends = {"cpu"};
+    std::vector<enum ggml_type> kv_types = {GGML_TYPE_F16};
+    int32_t max_tokens = 1024;
+    int32_t n_warmup = 1;
+    int32_t n_runs = 5;
+    std::string language = "";
+};
+
+// Per-stage medians of one configuration
+struct bench_result {
+    std::string model;
+    std::string backend;
+    int32_t n_threads = 0;
+    enum ggml_type kv_type = GGML_TYPE_F16;
+    float audio_sec = 0.0f;
+    int32_t n_runs = 0;
+    
+    double total_median_ms = 0.0;
+    double total_p95_ms = 0.0;
+    double total_min_ms = 0.0;
+    double mel_ms = 0.0;
+    double encode_ms = 0.0;
+    double prefill_ms = 0.0;
+    double decode_ms = 0.0;            // generation only, prefill excluded
+    
+    int32_t n_prompt_tokens = 0;
+    int32_t n_tokens = 0;
+    double rtf = 0.0;
+    double prefill_tok_s = 0.0;
+    double decode_tok_s = 0.0;
+    
+    double kv_cache_mb = 0.0;          // decoder KV cache after the runs
+    double rss_mb = 0.0;               // largest resident set seen after a run
+    double rss_delta_mb = 0.0;         // rss_mb above the pre-load baseline
+    double peak_vram_mb = 0.0;
+};
+
+static void print_usage(const char * prog) {
+    fprintf(stderr, "Usage: %s [options]\n", prog);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -m, --model <path>     GGUF model; repeat to compare quantization types [required]\n");
+    fprintf(stderr, "  -f, --audio <path>     Audio file (WAV; resampled to 16kHz mono) [required]\n");
+    fprintf(stderr, "  -o, --output <path>    Write the JSON report to <path> (default: stdout)\n");
+    fprintf(stderr, "  --lengths <list>       Audio lengths in seconds, e.g. 5,30,120 (audio is cut or repeated;\n");
+    fprintf(stderr, "                         default: the file as is)\n");
+    fprintf(stderr, "  -t, --threads <list>   CPU thread counts, e.g. 1,4,8 (default: 4)\n");
+    fprintf(stderr, "  --backends <list>      cpu, gpu or both, e.g. cpu,gpu (default: cpu)\n");
+    fprintf(stderr, "  --kv-type <list>       Decoder KV cache types: f16, q8_0, q4_0, e.g. f16,q8_0 (default: f16)\n");
+    fprintf(stderr, "  --max-tokens <n>       Maximum tokens to generate (default: 1024)\n");
+    fprintf(stderr, "  -l, --language <code>  Language code passed to the transcriber\n");
+    fprintf(stderr, "  --warmup <n>           Untimed runs per configuration (default: 1)\n");
+    fprintf(stderr, "  --runs <n>             Timed runs per configuration (default: 5)\n");
+    fprintf(stderr, "  -h, --help             Show this help message\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Example:\n");
+    fprintf(stderr, "  %s -m models/qwen3-asr-0.6b-f16.gguf -m models/qwen3-asr-0.6b-q8_0.gguf \\\n", prog);
+    fprintf(stderr, "      -f sample.wav --lengths 5,30,120 -t 4,8 --backends cpu,gpu -o bench.json\n");
+}
+
+static bool parse_int_list(const char * str, std::vector<int32_t> & values) {
+    values.clear();
+    const char * p = str;
+    while (*p) {
+        char * end = nullptr;
+        long v = std::strtol(p, &end, 10);
+        if (end == p || v <= 0) return false;
+        values.push_back((int32_t)v);
+        p = end;
+        if (*p == ',') {
+            ++p;
+        } else if (*p != '\0') {
+            return false;
+        }
+    }
+    return !values.empty();
+}
+
+static std::vector<std::string> split_list(const char * str) {
+    std::vector<std::string> items;
+    std::string cur;
+    for (const char * p = str; ; ++p) {
+        if (*p == ',' || *p == '\0') {
+            if (!cur.empty()) items.push_back(cur);
+            cur.clear();
+            if (*p == '\0') break;
+        } else {
+            cur += *p;
+        }
+    }
+    return items;
+}
+
+static bool parse_args(int argc, char ** argv, bench_params & params) {
+    for (int i = 1; i < argc; ++i) {
+        const char * arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            print_usage(argv[0]);
+            exit(0);
+        }
+        if (!has_value) {
+            fprintf(stderr, "Error: %s requires an argument\n", arg);
+            return false;
+        }
+        const char * value = argv[++i];
+        
+        if (strcmp(arg, "-m") == 0 || strcmp(arg, "--model") == 0) {
+            params.model_paths.push_back(value);
+        } else if (strcmp(arg, "-f") == 0 || strcmp(arg, "--audio") == 0) {
+            params.audio_path = value;
+        } else if (strcmp(arg, "-o") == 0 || strcmp(arg, "--output") == 0) {
+            params.output_path = value;
+        } else if (strcmp(arg, "--lengths") == 0) {
+            if (!parse_int_list(value, params.lengths_sec)) {
+                fprintf(stderr, "Error: Invalid length list: %s\n", value);
+                return false;
+            }
+        } else if (strcmp(arg, "-t") == 0 || strcmp(arg, "--threads") == 0) {
+            if (!parse_int_list(value, params.threads)) {
+                fprintf(stderr, "Error: Invalid thread list: %s\n", value);
+                return false;
+            }
+        } else if (strcmp(arg, "--backends") == 0) {
+            params.backends = split_list(value);
+            for (const auto & b : params.backends) {
+                if (b != "cpu" && b != "gpu") {
+                    fprintf(stderr, "Error: Unknown backend: %s\n", b.c_str());
+                    return false;
+                }
+            }
+        } else if (strcmp(arg, "--kv-type") == 0) {
+            params.kv_types.clear();
+            for (const auto & t : split_list(value)) {
+                if (t == "f16") {
+                    params.kv_types.push_back(GGML_TYPE_F16);
+                } else if (t == "q8_0") {
+                    params.kv_types.push_back(GGML_TYPE_Q8_0);
+                } else if (t == "q4_0") {
+                    params.kv_types.push_back(GGML_TYPE_Q4_0);
+                } else {
+                    fprintf(stderr, "Error: Unknown KV cache type: %s\n", t.c_str());
+                    return false;
+                }
+            }
+            if (params.kv_types.empty()) {
+                fprintf(stderr, "Error: Invalid KV cache type list: %s\n", value);
+                return false;
+            }
+        } else if (strcmp(arg, "--max-tokens") == 0) {
+            params.max_tokens = std::atoi(value);
+        } else if (strcmp(arg, "-l") == 0 || strcmp(arg, "--language") == 0) {
+            params.language = value;
+        } else if (strcmp(arg, "--warmup") == 0) {
+            params.n_warmup = std::max(0, std::atoi(value));
+        } else if (strcmp(arg, "--runs") == 0) {
+            params.n_runs = std::max(1, std::atoi(value));
+        } else {
+            fprintf(stderr, "Error: Unknown argument: %s\n", arg);
+            return false;
+        }
+    }
+    
+    if (params.model_paths.empty() || params.audio_path.empty()) {
+        fprintf(stderr, "Error: --model and --audio are required\n");
+        return false;
+    }
+    return true;
+}
+
+static std::string escape_json_string(const std::string & s) {
+    std::string result;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned char>(c));
+            result += buf;
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
+
+static std::string basename_of(const std::string & path) {
+    size_t pos = path.find_last_of("/\\");
+    return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+// Current resident set size of the process (not the lifetime peak, so
+// every configuration is measured on its own)
+static double current_rss_mb() {
+#ifdef __APPLE__
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+        return 0.0;
+    }
+    return info.resident_size / (1024.0 * 1024.0);
+#else
+    FILE * f = fopen("/proc/self/statm", "r");
+    if (!f) {
+        return 0.0;
+    }
+    unsigned long size = 0, resident = 0;
+    const bool ok = fscanf(f, "%lu %lu", &size, &resident) == 2;
+    fclose(f);
+    return ok ? (double)resident * sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0) : 0.0;
+#endif
+}
+
+// GPU memory in use, as reported by the device (0 without a GPU)
+static double gpu_used_mb() {
+    ggml_backend_dev_t dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_GPU);
+    if (!dev) {
+        return 0.0;
+    }
+    size_t free = 0, total = 0;
+    ggml_backend_dev_memory(dev, &free, &total);
+    return total > free ? (total - free) / (1024.0 * 1024.0) : 0.0;
+}
+
+// q-th quantile (0..1) with linear interpolation
+static double quantile(std::vector<double> v, double q) {
+    std::sort(v.begin(), v.end());
+    const double pos = q * (v.size() - 1);
+    const size_t lo = (size_t)pos;
+    const size_t hi = std::min(lo + 1, v.size() - 1);
+    return v[lo] + (pos - lo) * (v[hi] - v[lo]);
+}
+
+// Cut or repeat samples to n_target samples
+static std::vector<float> fit_length(const std::vector<float> & samples, size_t n_target) {
+    std::vector<float> out(n_target);
+    for (size_t i = 0; i < n_target; ++i) {
+        out[i] = samples[i % samples.size()];
+    }
+    return out;
+}
+
+static bool run_config(qwen3_asr::Qwen3ASR & asr, const bench_params & params,
+                       const std::vector<float> & samples, double rss_base_mb, double vram_base_mb,
+                       bench_result & res) {
+    qwen3_asr::transcribe_params tp;
+    tp.max_tokens = params.max_tokens;
+    tp.language = params.language;
+    tp.n_threads = res.n_threads;
+    tp.kv_type = res.kv_type;
+    tp.print_progress = false;
+    tp.print_timing = false;
+    
+    std::vector<double> total, mel, encode, prefill, decode;
+    double vram_peak = 0.0;
+    double rss_peak = 0.0;
+    
+    for (int run = 0; run < params.n_warmup + params.n_runs; ++run) {
+        qwen3_asr::transcribe_result r = asr.transcribe(samples.data(), (int)samples.size(), tp);
+        if (!r.success) {
+            fprintf(stderr, "Error: %s\n", r.error_msg.c_str());
+            return false;
+        }
+        vram_peak = std::max(vram_peak, gpu_used_mb() - vram_base_mb);
+        rss_peak = std::max(rss_peak, current_rss_mb());
+        if (run < params.n_warmup) {
+            continue;
+        }
+        total.push_back(r.t_total_ms);
+        mel.push_back(r.t_mel_ms);
+        encode.push_back(r.t_encode_ms);
+        prefill.push_back(r.t_prefill_ms);
+        decode.push_back(r.t_decode_ms - r.t_prefill_ms);
+        res.n_prompt_tokens = r.n_prompt_tokens;
+        res.n_tokens = (int32_t)r.tokens.size();
+    }
+    
+    res.audio_sec = (float)samples.size() / QWEN_SAMPLE_RATE;
+    res.n_runs = params.n_runs;
+    res.total_median_ms = quantile(total, 0.5);
+    res.total_p95_ms = quantile(total, 0.95);
+    res.total_min_ms = quantile(total, 0.0);
+    res.mel_ms = quantile(mel, 0.5);
+    res.encode_ms = quantile(encode, 0.5);
+    res.prefill_ms = quantile(prefill, 0.5);
+    res.decode_ms = quantile(decode, 0.5);
+    res.rtf = res.total_median_ms / (1000.0 * res.audio_sec);
+    res.prefill_tok_s = res.prefill_ms > 0 ? 1000.0 * res.n_prompt_tokens / res.prefill_ms : 0.0;
+    // The first generated token comes from the prefill pass
+    res.decode_tok_s = res.decode_ms > 0 ? 1000.0 * std::max(0, res.n_tokens - 1) / res.decode_ms : 0.0;
+    res.kv_cache_mb = asr.get_memory_usage().decoder.kv_cache / (1024.0 * 1024.0);
+    res.rss_mb = rss_peak;
+    res.rss_delta_mb = std::max(0.0, rss_peak - rss_base_mb);
+    res.peak_vram_mb = std::max(0.0, vram_peak);
+    
+    return true;
+}
+
+static void write_json(FILE * out, const std::vector<bench_result> & results) {
+    ggml_backend_dev_t gpu = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_GPU);
+    fprintf(out, "{\n");
+    fprintf(out, "  \"system\": {\"hardware_threads\": %u, \"gpu\": \"%s\"},\n",
+            std::thread::hardware_concurrency(),
+            gpu ? escape_json_string(ggml_backend_dev_description(gpu)).c_str() : "");
+    fprintf(out, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const bench_result & r = results[i];
+        fprintf(out, "    {\"model\": \"%s\", \"backend\": \"%s\", \"threads\": %d, \"kv_type\": \"%s\", "
+                "\"audio_sec\": %.3f, \"runs\": %d,\n",
+                escape_json_string(r.model).c_str(), r.backend.c_str(), r.n_threads, ggml_type_name(r.kv_type),
+                r.audio_sec, r.n_runs);
+        fprintf(out, "     \"latency_ms\": {\"median\": %.1f, \"p95\": %.1f, \"min\": %.1f},\n",
+                r.total_median_ms, r.total_p95_ms, r.total_min_ms);
+        fprintf(out, "     \"stages_ms\": {\"mel\": %.1f, \"encode\": %.1f, \"prefill\": %.1f, \"decode\": %.1f},\n",
+                r.mel_ms, r.encode_ms, r.prefill_ms, r.decode_ms);
+        fprintf(out, "     \"rtf\": %.4f, \"prompt_tokens\": %d, \"generated_tokens\": %d, "
+                "\"prefill_tok_s\": %.1f, \"decode_tok_s\": %.1f,\n",
+                r.rtf, r.n_prompt_tokens, r.n_tokens, r.prefill_tok_s, r.decode_tok_s);
+        fprintf(out, "     \"kv_cache_mb\": %.1f, \"rss_mb\": %.1f, \"rss_delta_mb\": %.1f, \"peak_vram_mb\": %.1f}%s\n",
+                r.kv_cache_mb, r.rss_mb, r.rss_delta_mb, r.peak_vram_mb, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n");
+    fprintf(out, "}\n");
+}
+
+int main(int argc, char ** argv) {
+    bench_params params;
+    if (!parse_args(argc, argv, params)) {
+        fprintf(stderr, "\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    std::vector<float> audio;
+    int sample_rate = 0;
+    if (!qwen3_asr::load_audio_file(params.audio_path, audio, sample_rate) || audio.empty()) {
+        fprintf(stderr, "Error: Failed to load audio file: %s\n", params.audio_path.c_str());
+        return 1;
+    }
+    
+    std::vector<std::vector<float>> inputs;
+    if (params.lengths_sec.empty()) {
+        inputs.push_back(audio);
+    } else {
+        for (int32_t sec : params.lengths_sec) {
+            inputs.push_back(fit_length(audio, (size_t)sec * QWEN_SAMPLE_RATE));
+        }
+    }
+    
+    const bool has_gpu = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_GPU) != nullptr;
+    
+    fprintf(stderr, "%-28s %-4s %3s %-4s %8s %9s %9s %7s %9s %9s %7s %8s\n",
+            "model", "bk", "thr", "kv", "audio_s", "median_ms", "p95_ms", "rtf", "pf_tok/s", "dec_tok/s",
+            "kv_mb", "+rss_mb");
+    
+    std::vector<bench_result> results;
+    for (const auto & model_path : params.model_paths) {
+        for (const auto & backend : params.backends) {
+            if (backend == "gpu" && !has_gpu) {
+                fprintf(stderr, "Skipping gpu backend: no GPU device available\n");
+                continue;
+            }
+            for (int32_t n_threads : params.threads) {
+                const double rss_base = current_rss_mb();
+                const double vram_base = gpu_used_mb();
+                
+                qwen3_asr::cpu_backend_params cp;
+                cp.n_threads = n_threads;
+                cp.use_gpu = backend == "gpu";
+                
+                qwen3_asr::Qwen3ASR asr;
+                if (!asr.load_model(model_path, cp)) {
+                    fprintf(stderr, "Error: %s\n", asr.get_error().c_str());
+                    return 1;
+                }
+                
+                for (enum ggml_type kv_type : params.kv_types) {
+                    for (const auto & samples : inputs) {
+                        bench_result res;
+                        res.model = basename_of(model_path);
+                        res.backend = backend;
+                        res.n_threads = n_threads;
+                        res.kv_type = kv_type;
+                        if (!run_config(asr, params, samples, rss_base, vram_base, res)) {
+                            return 1;
+                        }
+                        fprintf(stderr, "%-28s %-4s %3d %-4s %8.1f %9.1f %9.1f %7.4f %9.1f %9.1f %7.1f %8.1f\n",
+                                res.model.c_str(), res.backend.c_str(), res.n_threads, ggml_type_name(res.kv_type),
+                                res.audio_sec, res.total_median_ms, res.total_p95_ms, res.rtf,
+                                res.prefill_tok_s, res.decode_tok_s, res.kv_cache_mb, res.rss_delta_mb);
+                        results.push_back(res);
+                    }
+                }
+            }
+        }
+    }
+    
+    FILE * out = stdout;
+    if (!params.output_path.empty()) {
+        out = fopen(params.output_path.c_str(), "w");
+        if (!out) {
+            fprintf(stderr, "Error: Failed to open output file: %s\n", params.output_path.c_str());
+            return 1;
+        }
+    }
+    write_json(out, results);
+    if (out != stdout) {
+        fclose(out);
+        fprintf(stderr, "Report written to: %s\n", params.output_path.c_str());
+    }
+    
+    return 0;
+}
@@ -0,0 +1,379 @@
+#include "bpe_tokenizer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+
+#define QWEN3_BPE_CACHE_SIZE 8192
+#define QWEN3_BPE_CACHE_MAX_WORD 64
+
+namespace qwen3_asr {
+
+// GPT-2 byte-to-unicode: printable bytes map to themselves, all others to
+// codepoints 256+n, so every byte has a visible single-symbol token
+static std::string byte_to_unicode(int byte) {
+    int n = 0;
+    int cp = byte;
+    const bool printable = (byte >= 0x21 && byte <= 0x7E) || (byte >= 0xA1 && byte <= 0xAC) ||
+                           (byte >= 0xAE && byte <= 0xFF);
+    if (!printable) {
+        for (int b = 0; b < byte; ++b) {
+            if (!((b >= 0x21 && b <= 0x7E) || (b >= 0xA1 && b <= 0xAC) || (b >= 0xAE && b <= 0xFF))) {
+                ++n;
+            }
+        }
+        cp = 256 + n;
+    }
+
+    std::string s;
+    if (cp < 0x80) {
+        s += static_cast<char>(cp);
+    } else {
+        s += static_cast<char>(0xC0 | (cp >> 6));
+        s += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+    return s;
+}
+
+bool BpeTokenizer::build(const std::vector<std::string> & vocab,
+                         const std::vector<std::string> & merges) {
+    vocab_ = vocab;
+    n_vocab_ = (int32_t)vocab_.size();
+    token_to_id_.clear();
+    token_to_id_.reserve(vocab_.size());
+    for (int32_t i = 0; i < n_vocab_; ++i) {
+        token_to_id_.emplace(vocab_[i], i);
+    }
+
+    for (int b = 0; b < 256; ++b) {
+        byte_token_[b] = token_id(byte_to_unicode(b));
+    }
+
+    size_t capacity = 16;
+    while (capacity < merges.size() * 2) {
+        capacity *= 2;
+    }
+    merges_.assign(capacity, merge_slot{EMPTY_KEY, 0, -1});
+    merge_mask_ = capacity - 1;
+
+    n_merges_ = 0;
+    std::string joined;
+    for (size_t r = 0; r < merges.size(); ++r) {
+        const std::string & m = merges[r];
+        const size_t sp = m.find(' ');
+        if (sp == std::string::npos || sp == 0 || sp + 1 >= m.size()) {
+            continue;
+        }
+        const std::string_view first(m.data(), sp);
+        const std::string_view second(m.data() + sp + 1, m.size() - sp - 1);
+        joined.assign(first);
+        joined.append(second);
+        const int32_t left = token_id(first);
+        const int32_t right = token_id(second);
+        const int32_t merged = token_id(joined);
+        if (left < 0 || right < 0 || merged < 0) {
+            continue;
+        }
+
+        const uint64_t key = pair_key(left, right);
+        uint64_t h = (key * 0x9E3779B97F4A7C15ull) >> 17;
+        while (true) {
+            merge_slot & slot = merges_[h & merge_mask_];
+            if (slot.key == EMPTY_KEY) {
+                slot = merge_slot{key, (int32_t)r, merged};
+                ++n_merges_;
+                break;
+            }
+            if (slot.key == key) {
+                break;  // keep the higher-priority rule
+            }
+            ++h;
+        }
+    }
+
+    lru_.clear();
+    cache_.clear();
+    cache_.reserve(QWEN3_BPE_CACHE_SIZE);
+    cache_hits_ = 0;
+    cache_misses_ = 0;
+    return n_vocab_ > 0;
+}
+
+int32_t BpeTokenizer::token_id(std::string_view token) const {
+    auto it = token_to_id_.find(token);
+    return it == token_to_id_.end() ? -1 : it->second;
+}
+
+const BpeTokenizer::merge_slot * BpeTokenizer::find_merge(int32_t left, int32_t right) const {
+    const uint64_t key = pair_key(left, right);
+    uint64_t h = (key * 0x9E3779B97F4A7C15ull) >> 17;
+    while (true) {
+        const merge_slot & slot = merges_[h & merge_mask_];
+        if (slot.key == key) {
+            return &slot;
+        }
+        if (slot.key == EMPTY_KEY) {
+            return nullptr;
+        }
+        ++h;
+    }
+}
+
+void BpeTokenizer::bpe(std::string_view word, std::vector<int32_t> & out) {
+    symbols_.clear();
+    for (unsigned char c : word) {
+        const int32_t id = byte_token_[c];
+        if (id >= 0) {
+            symbols_.push_back(id);
+        } else {
+            fprintf(stderr, "BPE tokenizer: no token for byte 0x%02X\n", c);
+        }
+    }
+
+    // Repeatedly merge the adjacent pair with the lowest rank; words are
+    // short, so a linear scan per merge beats maintaining a heap
+    while (symbols_.size() > 1 && !merges_.empty()) {
+        int32_t best_rank = INT32_MAX;
+        size_t best_pos = 0;
+        int32_t best_merged = -1;
+        for (size_t i = 0; i + 1 < symbols_.size(); ++i) {
+            const merge_slot * m = find_merge(symbols_[i], symbols_[i + 1]);
+            if (m && m->rank < best_rank) {
+                best_rank = m->rank;
+                best_pos = i;
+                best_merged = m->merged;
+            }
+        }
+        if (best_merged < 0) {
+            break;
+        }
+        symbols_[best_pos] = best_merged;
+        symbols_.erase(symbols_.begin() + best_pos + 1);
+    }
+
+    out.insert(out.end(), symbols_.begin(), symbols_.end());
+}
+
+void BpeTokenizer::encode_word(std::string_view word, std::vector<int32_t> & out) {
+    if (word.empty()) {
+        return;
+    }
+    if (word.size() > QWEN3_BPE_CACHE_MAX_WORD) {
+        bpe(word, out);
+        return;
+    }
+
+    auto it = cache_.find(word);
+    if (it != cache_.end()) {
+        ++cache_hits_;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        const std::vector<int32_t> & tokens = it->second->tokens;
+        out.insert(out.end(), tokens.begin(), tokens.end());
+        return;
+    }
+    ++cache_misses_;
+
+    // Recycle the least recently used entry once the cache is full, keeping
+    // its string and vector capacity
+    if (cache_.size() >= QWEN3_BPE_CACHE_SIZE) {
+        auto last = std::prev(lru_.end());
+        cache_.erase(std::string_view(last->word));
+        lru_.splice(lru_.begin(), lru_, last);
+    } else {
+        lru_.emplace_front();
+    }
+    cache_entry & e = lru_.front();
+    e.word.assign(word);
+    e.tokens.clear();
+    bpe(e.word, e.tokens);
+    cache_.emplace(std::string_view(e.word), lru_.begin());
+    out.insert(out.end(), e.tokens.begin(), e.tokens.end());
+}
+
+// Character classes of the pre-tokenizer regex: \p{L}, \p{N}, \s, other
+enum char_class : uint8_t {
+    CHAR_LETTER,
+    CHAR_NUMBER,
+    CHAR_SPACE,
+    CHAR_OTHER,
+};
+
+struct char_range {
+    uint32_t lo;
+    uint32_t hi;
+    char_class cls;
+};
+
+// Non-ASCII codepoints that are not letters, sorted: Latin-1 and general
+// punctuation, symbols, CJK radicals, CJK and full-width punctuation,
+// common non-ASCII digits, Unicode spaces and emoji. Codepoints outside
+// these ranges count as letters, which also keeps combining marks with
+// their letters where \p{L} would split them off.
+static const char_range k_char_ranges[] = {
+    {0x0080, 0x0084, CHAR_OTHER},   {0x0085, 0x0085, CHAR_SPACE},   {0x0086, 0x009F, CHAR_OTHER},
+    {0x00A0, 0x00A0, CHAR_SPACE},   {0x00A1, 0x00A9, CHAR_OTHER},   {0x00AB, 0x00B1, CHAR_OTHER},
+    {0x00B2, 0x00B3, CHAR_NUMBER},  {0x00B4, 0x00B4, CHAR_OTHER},   {0x00B6, 0x00B8, CHAR_OTHER},
+    {0x00B9, 0x00B9, CHAR_NUMBER},  {0x00BB, 0x00BB, CHAR_OTHER},   {0x00BC, 0x00BE, CHAR_NUMBER},
+    {0x00BF, 0x00BF, CHAR_OTHER},   {0x00D7, 0x00D7, CHAR_OTHER},   {0x00F7, 0x00F7, CHAR_OTHER},
+    {0x02C2, 0x02C5, CHAR_OTHER},   {0x02D2, 0x02DF, CHAR_OTHER},   {0x02E5, 0x02EB, CHAR_OTHER},
+    {0x02ED, 0x02ED, CHAR_OTHER},   {0x02EF, 0x02FF, CHAR_OTHER},   {0x037E, 0x037E, CHAR_OTHER},
+    {0x0387, 0x0387, CHAR_OTHER},   {0x055A, 0x055F, CHAR_OTHER},   {0x0589, 0x058A, CHAR_OTHER},
+    {0x0600, 0x060F, CHAR_OTHER},   {0x061B, 0x061B, CHAR_OTHER},   {0x061D, 0x061F, CHAR_OTHER},
+    {0x0660, 0x0669, CHAR_NUMBER},  {0x066A, 0x066D, CHAR_OTHER},   {0x06D4, 0x06D4, CHAR_OTHER},
+    {0x06F0, 0x06F9, CHAR_NUMBER},  {0x0964, 0x0965, CHAR_OTHER},   {0x0966, 0x096F, CHAR_NUMBER},
+    {0x0970, 0x0970, CHAR_OTHER},   {0x0E3F, 0x0E3F, CHAR_OTHER},   {0x0E4F, 0x0E4F, CHAR_OTHER},
+    {0x0E50, 0x0E59, CHAR_NUMBER},  {0x0E5A, 0x0E5B, CHAR_OTHER},   {0x1680, 0x1680, CHAR_SPACE},
+    {0x2000, 0x200A, CHAR_SPACE},   {0x200B, 0x2027, CHAR_OTHER},   {0x2028, 0x2029, CHAR_SPACE},
+    {0x202A, 0x202E, CHAR_OTHER},   {0x202F, 0x202F, CHAR_SPACE},   {0x2030, 0x205E, CHAR_OTHER},
+    {0x205F, 0x205F, CHAR_SPACE},   {0x2060, 0x206F, CHAR_OTHER},   {0x2070, 0x2070, CHAR_NUMBER},
+    {0x2074, 0x2079, CHAR_NUMBER},  {0x207A, 0x207E, CHAR_OTHER},   {0x2080, 0x2089, CHAR_NUMBER},
+    {0x208A, 0x208E, CHAR_OTHER},   {0x20A0, 0x20FF, CHAR_OTHER},   {0x2100, 0x2101, CHAR_OTHER},
+    {0x2103, 0x2106, CHAR_OTHER},   {0x2108, 0x2109, CHAR_OTHER},   {0x2114, 0x2114, CHAR_OTHER},
+    {0x2116, 0x2118, CHAR_OTHER},   {0x211E, 0x2123, CHAR_OTHER},   {0x2125, 0x2125, CHAR_OTHER},
+    {0x2127, 0x2127, CHAR_OTHER},   {0x2129, 0x2129, CHAR_OTHER},   {0x212E, 0x212E, CHAR_OTHER},
+    {0x213A, 0x213B, CHAR_OTHER},   {0x2140, 0x2144, CHAR_OTHER},   {0x214A, 0x214D, CHAR_OTHER},
+    {0x214F, 0x214F, CHAR_OTHER},   {0x2150, 0x2182, CHAR_NUMBER},  {0x2185, 0x2189, CHAR_NUMBER},
+    {0x218A, 0x245F, CHAR_OTHER},   {0x2460, 0x249B, CHAR_NUMBER},  {0x249C, 0x24E9, CHAR_OTHER},
+    {0x24EA, 0x24FF, CHAR_NUMBER},  {0x2500, 0x2775, CHAR_OTHER},   {0x2776, 0x2793, CHAR_NUMBER},
+    {0x2794, 0x2BFF, CHAR_OTHER},   {0x2E00, 0x2E2E, CHAR_OTHER},   {0x2E30, 0x2FFF, CHAR_OTHER},
+    {0x3000, 0x3000, CHAR_SPACE},   {0x3001, 0x3004, CHAR_OTHER},   {0x3007, 0x3007, CHAR_NUMBER},
+    {0x3008, 0x3020, CHAR_OTHER},   {0x3021, 0x3029, CHAR_NUMBER},  {0x302A, 0x3030, CHAR_OTHER},
+    {0x3036, 0x3037, CHAR_OTHER},   {0x3038, 0x303A, CHAR_NUMBER},  {0x303D, 0x303F, CHAR_OTHER},
+    {0x3099, 0x309C, CHAR_OTHER},   {0x30A0, 0x30A0, CHAR_OTHER},   {0x30FB, 0x30FB, CHAR_OTHER},
+    {0x3190, 0x3191, CHAR_OTHER},   {0x3192, 0x3195, CHAR_NUMBER},  {0x3196, 0x319F, CHAR_OTHER},
+    {0x31C0, 0x31E3, CHAR_OTHER},   {0x3200, 0x321E, CHAR_OTHER},   {0x3220, 0x3229, CHAR_NUMBER},
+    {0x322A, 0x3247, CHAR_OTHER},   {0x3248, 0x324F, CHAR_NUMBER},  {0x3250, 0x3250, CHAR_OTHER},
+    {0x3251, 0x325F, CHAR_NUMBER},  {0x3260, 0x327F, CHAR_OTHER},   {0x3280, 0x3289, CHAR_NUMBER},
+    {0x328A, 0x32B0, CHAR_OTHER},   {0x32B1, 0x32BF, CHAR_NUMBER},  {0x32C0, 0x33FF, CHAR_OTHER},
+    {0x4DC0, 0x4DFF, CHAR_OTHER},   {0xFD3E, 0xFD3F, CHAR_OTHER},   {0xFE00, 0xFE19, CHAR_OTHER},
+    {0xFE20, 0xFE6F, CHAR_OTHER},   {0xFEFF, 0xFEFF, CHAR_OTHER},   {0xFF01, 0xFF0F, CHAR_OTHER},
+    {0xFF10, 0xFF19, CHAR_NUMBER},  {0xFF1A, 0xFF20, CHAR_OTHER},   {0xFF3B, 0xFF40, CHAR_OTHER},
+    {0xFF5B, 0xFF65, CHAR_OTHER},   {0xFFE0, 0xFFEE, CHAR_OTHER},   {0xFFF9, 0xFFFD, CHAR_OTHER},
+    {0x1F000, 0x1F0FF, CHAR_OTHER}, {0x1F100, 0x1F10C, CHAR_NUMBER}, {0x1F10D, 0x1FAFF, CHAR_OTHER},
+};
+
+static char_class codepoint_class(uint32_t cp) {
+    if (cp < 0x80) {
+        if ((cp >= 'a' && cp <= 'z') || (cp >= 'A' && cp <= 'Z')) {
+            return CHAR_LETTER;
+        }
+        if (cp >= '0' && cp <= '9') {
+            return CHAR_NUMBER;
+        }
+        if (cp == ' ' || (cp >= '\t' && cp <= '\r')) {
+            return CHAR_SPACE;
+        }
+        return CHAR_OTHER;
+    }
+    const char_range * end = k_char_ranges + sizeof(k_char_ranges) / sizeof(k_char_ranges[0]);
+    const char_range * it = std::upper_bound(k_char_ranges, end, cp,
+        [](uint32_t v, const char_range & r) { return v < r.lo; });
+    if (it != k_char_ranges && cp <= (it - 1)->hi) {
+        return (it - 1)->cls;
+    }
+    return CHAR_LETTER;
+}
+
+// Class of the UTF-8 character at pos and its length in bytes. A malformed
+// sequence counts as one byte of punctuation.
+static char_class char_at(std::string_view s, size_t pos, size_t & len) {
+    const unsigned char c = s[pos];
+    uint32_t cp = c;
+    len = 1;
+    if (c >= 0x80) {
+        const size_t n = c >= 0xF8 ? 0 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 0;
+        if (n == 0 || pos + n > s.size()) {
+            return CHAR_OTHER;
+        }
+        cp = c & (0x7F >> n);
+        for (size_t k = 1; k < n; ++k) {
+            const unsigned char cc = s[pos + k];
+            if ((cc & 0xC0) != 0x80) {
+                return CHAR_OTHER;
+            }
+            cp = (cp << 6) | (cc & 0x3F);
+        }
+        len = n;
+    }
+    return codepoint_class(cp);
+}
+
+static char_class char_at(std::string_view s, size_t pos) {
+    size_t len;
+    return char_at(s, pos, len);
+}
+
+static bool is_newline(unsigned char c) {
+    return c == '\n' || c == '\r';
+}
+
+// Length of an English contraction suffix ('s 't 're 've 'm 'll 'd) at pos
+static size_t contraction_len(std::string_view s, size_t pos) {
+    if (s[pos] != '\'' || pos + 1 >= s.size()) {
+        return 0;
+    }
+    auto lower = [&](size_t i) -> char {
+        return i < s.size() ? (char)(s[i] | 0x20) : '\0';
+    };
+    const char a = lower(pos + 1);
+    const char b = lower(pos + 2);
+    if ((a == 'r' && b == 'e') || (a == 'v' && b == 'e') || (a == 'l' && b == 'l')) {
+        return 3;
+    }
+    if (a == 's' || a == 't' || a == 'm' || a == 'd') {
+        return 2;
+    }
+    return 0;
+}
+
+void BpeTokenizer::encode(std::string_view text, std::vector<int32_t> & out) {
+    const size_t n = text.size();
+    size_t i = 0;
+    while (i < n) {
+        const unsigned char c = text[i];
+        size_t len;
+        const char_class cls = char_at(text, i, len);
+        size_t j = i;
+
+        if (size_t clen = contraction_len(text, i)) {
+            j = i + clen;
+        } else if (cls == CHAR_LETTER ||
+                   (cls != CHAR_NUMBER && !is_newline(c) && i + len < n && char_at(text, i + len) == CHAR_LETTER)) {
+            // [^\r\n\p{L}\p{N}]?\p{L}+
+            j = i + len;
+            while (j < n && char_at(text, j, len) == CHAR_LETTER) j += len;
+        } else if (cls == CHAR_NUMBER) {
+            j = i + len;
+        } else if (cls != CHAR_SPACE || (c == ' ' && i + 1 < n && char_at(text, i + 1) == CHAR_OTHER)) {
+            // " ?[^\s\p{L}\p{N}]+[\r\n]*"
+            j = c == ' ' ? i + 1 : i;
+            while (j < n && char_at(text, j, len) == CHAR_OTHER) j += len;
+            while (j < n && is_newline(text[j])) ++j;
+        } else {
+            // Whitespace: up to and including the last newline of the run,
+            // otherwise all but a last space that belongs to the next word
+            size_t k = i;
+            size_t last = i;
+            size_t last_nl = 0;
+            size_t n_space = 0;
+            while (k < n && char_at(text, k, len) == CHAR_SPACE) {
+                if (is_newline(text[k])) last_nl = k + 1;
+                last = k;
+                k += len;
+                ++n_space;
+            }
+            if (last_nl > 0) {
+                j = last_nl;
+            } else if (k < n && n_space > 1) {
+                j = last;
+            } else {
+                j = k;
+            }
+        }
+
+        encode_word(text.substr(i, j - i), out);
+        i = j;
+    }
+}
+
+} // namespace qwen3_asr
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace qwen3_asr {
+
+// GPT-2 style byte-level BPE encoder over the Qwen vocabulary.
+//
+// All string work happens once in build(): every byte is mapped to its
+// single-byte token and every merge "a b" to the token-ID pair (id(a), id(b))
+// with its rank and merged token ID, stored in a flat open-addressing table.
+// Encoding a word then only walks int32 symbols in reused scratch buffers,
+// and recently seen words are served from an LRU cache.
+//
+// encode() mutates the cache and scratch state, so an instance must not be
+// shared across threads without external locking.
+class BpeTokenizer {
+public:
+    BpeTokenizer() = default;
+
+    // Lookup tables hold views into the owned strings: movable, not copyable
+    BpeTokenizer(const BpeTokenizer &) = delete;
+    BpeTokenizer & operator=(const BpeTokenizer &) = delete;
+    BpeTokenizer(BpeTokenizer &&) = default;
+    BpeTokenizer & operator=(BpeTokenizer &&) = default;
+
+    // vocab: token strings in byte-to-unicode form, indexed by token ID
+    // merges: "first second" merge rules, in priority order
+    bool build(const std::vector<std::string> & vocab, const std::vector<std::string> & merges);
+
+    bool empty() const { return n_vocab_ == 0; }
+    int32_t n_merges() const { return n_merges_; }
+
+    // Encode a pre-split word (including any leading space) and append its
+    // token IDs to out
+    void encode_word(std::string_view word, std::vector<int32_t> & out);
+
+    // Encode running text: split into words the way the Qwen pre-tokenizer
+    // does for plain text (letter runs with an optional leading space,
+    // single digits, punctuation runs and whitespace), then encode each word
+    void encode(std::string_view text, std::vector<int32_t> & out);
+
+    // Token ID of an exact vocabulary string, or -1
+    int32_t token_id(std::string_view token) const;
+
+    size_t cache_hits() const { return cache_hits_; }
+    size_t cache_misses() const { return cache_misses_; }
+
+private:
+    struct merge_slot {
+        uint64_t key;     // (left << 32) | right, or EMPTY_KEY
+        int32_t rank;
+        int32_t merged;
+    };
+
+    struct cache_entry {
+        std::string word;
+        std::vector<int32_t> tokens;
+    };
+
+    static constexpr uint64_t EMPTY_KEY = ~0ull;
+
+    static uint64_t pair_key(int32_t left, int32_t right) {
+        return ((uint64_t)(uint32_t)left << 32) | (uint32_t)right;
+    }
+
+    const merge_slot * find_merge(int32_t left, int32_t right) const;
+    void bpe(std::string_view word, std::vector<int32_t> & out);
+
+    int32_t n_vocab_ = 0;
+    int32_t n_merges_ = 0;
+    int32_t byte_token_[256] = {};
+    std::vector<merge_slot> merges_;   // power-of-two capacity
+    uint64_t merge_mask_ = 0;
+
+    // Owns the vocabulary strings the lookup view points into
+    std::vector<std::string> vocab_;
+    std::unordered_map<std::string_view, int32_t> token_to_id_;
+
+    // Most recently used entry first; keys view into the entries' strings
+    std::list<cache_entry> lru_;
+    std::unordered_map<std::string_view, std::list<cache_entry>::iterator> cache_;
+    size_t cache_hits_ = 0;
+    size_t cache_misses_ = 0;
+
+    std::vector<int32_t> symbols_;
+};
+
+} // namespace qwen3_asr
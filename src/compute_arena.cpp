@@ -0,0 +1,130 @@
+#include "compute_arena.h"
+
+namespace qwen3_asr {
+
+void add_sched_bytes(ggml_backend_sched_t sched, memory_usage & mem) {
+    if (!sched) {
+        return;
+    }
+    for (int i = 0; i < ggml_backend_sched_get_n_backends(sched); ++i) {
+        ggml_backend_t backend = ggml_backend_sched_get_backend(sched, i);
+        const size_t bytes = ggml_backend_sched_get_buffer_size(sched, backend);
+        if (ggml_backend_dev_type(ggml_backend_get_device(backend)) == GGML_BACKEND_DEVICE_TYPE_CPU) {
+            mem.compute_host += bytes;
+        } else {
+            mem.compute_device += bytes;
+        }
+    }
+}
+
+size_t ctx_tensor_bytes(const struct ggml_context * ctx) {
+    size_t bytes = 0;
+    if (!ctx) {
+        return bytes;
+    }
+    for (struct ggml_tensor * t = ggml_get_first_tensor(ctx); t; t = ggml_get_next_tensor(ctx, t)) {
+        bytes += ggml_nbytes(t);
+    }
+    return bytes;
+}
+
+void sched_backends(ggml_backend_t gpu, ggml_backend_t cpu,
+                    std::vector<ggml_backend_t> & backends,
+                    std::vector<ggml_backend_buffer_type_t> & bufts) {
+    backends.clear();
+    bufts.clear();
+    if (gpu) {
+        backends.push_back(gpu);
+        bufts.push_back(ggml_backend_get_default_buffer_type(gpu));
+    }
+
+    backends.push_back(cpu);
+    ggml_backend_buffer_type_t cpu_buft = ggml_backend_get_default_buffer_type(cpu);
+    if (gpu) {
+        ggml_backend_buffer_type_t host_buft = ggml_backend_dev_host_buffer_type(ggml_backend_get_device(gpu));
+        if (host_buft) cpu_buft = host_buft;
+    }
+    bufts.push_back(cpu_buft);
+}
+
+ComputeArena::~ComputeArena() {
+    if (sched_) {
+        ggml_backend_sched_free(sched_);
+        sched_ = nullptr;
+    }
+    if (backend_gpu_) {
+        ggml_backend_free(backend_gpu_);
+        backend_gpu_ = nullptr;
+    }
+    if (backend_cpu_) {
+        ggml_backend_free(backend_cpu_);
+        backend_cpu_ = nullptr;
+    }
+    free_cpu_threadpool(threadpool_);
+}
+
+bool ComputeArena::init(const cpu_backend_params & params, int32_t max_nodes) {
+    params_ = params;
+    max_nodes_ = max_nodes;
+
+    if (!select_gpu_device(params, gpu_dev_, error_msg_)) {
+        return false;
+    }
+
+    if (!init_cpu_backend(params, backend_cpu_, threadpool_, error_msg_)) {
+        return false;
+    }
+
+    if (gpu_dev_) {
+        backend_gpu_ = ggml_backend_dev_init(gpu_dev_, nullptr);
+        if (!backend_gpu_) {
+            error_msg_ = std::string("Failed to initialize backend for ") + ggml_backend_dev_name(gpu_dev_);
+            return false;
+        }
+    }
+
+    std::vector<ggml_backend_t> backends;
+    std::vector<ggml_backend_buffer_type_t> bufts;
+    sched_backends(backend_gpu_, backend_cpu_, backends, bufts);
+
+    sched_ = ggml_backend_sched_new(backends.data(), bufts.data(), backends.size(), max_nodes, false, true);
+    if (!sched_) {
+        error_msg_ = "Failed to create backend scheduler";
+        return false;
+    }
+
+    meta_.resize(ggml_tensor_overhead() * max_nodes + ggml_graph_overhead_custom(max_nodes, false));
+
+    return true;
+}
+
+bool ComputeArena::can_share(const cpu_backend_params & a, const cpu_backend_params & b) {
+    if (!a.share_compute || !b.share_compute || !a.gpu_split.empty() || !b.gpu_split.empty()) {
+        return false;
+    }
+
+    std::string error;
+    ggml_backend_dev_t dev_a = nullptr;
+    ggml_backend_dev_t dev_b = nullptr;
+    if (!select_gpu_device(a, dev_a, error) || !select_gpu_device(b, dev_b, error)) {
+        return false;
+    }
+
+    const bool pool_a = a.use_threadpool || !a.cpu_ids.empty();
+    const bool pool_b = b.use_threadpool || !b.cpu_ids.empty();
+    return dev_a == dev_b &&
+           resolve_n_threads(a.n_threads) == resolve_n_threads(b.n_threads) &&
+           pool_a == pool_b && a.cpu_ids == b.cpu_ids && (!pool_a || a.poll == b.poll);
+}
+
+bool ComputeArena::matches(const cpu_backend_params & params, int32_t max_nodes) const {
+    return sched_ && max_nodes <= max_nodes_ && can_share(params_, params);
+}
+
+memory_usage ComputeArena::get_memory_usage() const {
+    memory_usage mem;
+    add_sched_bytes(sched_, mem);
+    return mem;
+}
+
+} // namespace qwen3_asr
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "ggml.h"
+#include "ggml-backend.h"
+#include "cpu_backend.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace qwen3_asr {
+
+// Memory held by one component, in bytes
+struct memory_usage {
+    size_t weights = 0;         // model tensors (device memory or the mapped file)
+    size_t kv_cache = 0;        // decoder KV cache and saved prompt prefixes
+    size_t buffers = 0;         // other persistent buffers: constants, output slots, staging
+    size_t compute_device = 0;  // scheduler compute buffers on GPU devices
+    size_t compute_host = 0;    // scheduler compute buffers in host memory
+
+    size_t total() const { return weights + kv_cache + buffers + compute_device + compute_host; }
+
+    memory_usage & operator+=(const memory_usage & o) {
+        weights += o.weights;
+        kv_cache += o.kv_cache;
+        buffers += o.buffers;
+        compute_device += o.compute_device;
+        compute_host += o.compute_host;
+        return *this;
+    }
+};
+
+// Compute buffers sched holds, split into GPU devices and host memory
+void add_sched_bytes(ggml_backend_sched_t sched, memory_usage & mem);
+
+// Bytes of all tensors of ctx
+size_t ctx_tensor_bytes(const struct ggml_context * ctx);
+
+// Buffer size, 0 for a null buffer
+inline size_t buffer_bytes(ggml_backend_buffer_t buffer) {
+    return buffer ? ggml_backend_buffer_get_size(buffer) : 0;
+}
+
+// One CPU backend, at most one GPU backend and one scheduler, shared by the
+// components (AudioEncoder, TextDecoder, ForcedAligner) that run on the same
+// device with the same CPU settings. The scheduler's compute buffers grow to
+// the largest graph of any user, so peak memory is the maximum of the stages
+// instead of their sum. Users reserve their largest graphs at load time so
+// the buffers are sized once.
+//
+// Users hold lock() while they build, compute and read back a graph (the
+// graph meta buffer is shared too), so graphs of different users, possibly
+// on different threads, run one at a time. The lock is recursive.
+class ComputeArena {
+public:
+    ComputeArena() = default;
+    ~ComputeArena();
+
+    ComputeArena(const ComputeArena &) = delete;
+    ComputeArena & operator=(const ComputeArena &) = delete;
+
+    // Create the backends params selects and a scheduler for graphs of up
+    // to max_nodes nodes
+    bool init(const cpu_backend_params & params, int32_t max_nodes);
+
+    // True when components loaded with a and b would run on the same devices
+    // with the same CPU threads (no decoder layer split) and both allow
+    // share_compute, so they can share an arena
+    static bool can_share(const cpu_backend_params & a, const cpu_backend_params & b);
+
+    // can_share() with the params this arena was created from, and graphs of
+    // max_nodes fit its scheduler
+    bool matches(const cpu_backend_params & params, int32_t max_nodes) const;
+
+    std::unique_lock<std::recursive_mutex> lock() { return std::unique_lock<std::recursive_mutex>(mutex_); }
+
+    ggml_backend_t get_backend_cpu() const { return backend_cpu_; }
+    ggml_backend_t get_backend_gpu() const { return backend_gpu_; }
+    ggml_backend_dev_t get_gpu_device() const { return gpu_dev_; }
+    ggml_backend_sched_t get_sched() const { return sched_; }
+    std::vector<uint8_t> & get_meta() { return meta_; }
+
+    // Compute buffer bytes held by the scheduler
+    memory_usage get_memory_usage() const;
+
+    const std::string & get_error() const { return error_msg_; }
+
+private:
+    cpu_backend_params params_;
+    int32_t max_nodes_ = 0;
+
+    ggml_backend_dev_t gpu_dev_ = nullptr;
+    ggml_backend_t backend_cpu_ = nullptr;
+    ggml_backend_t backend_gpu_ = nullptr;
+    ggml_threadpool_t threadpool_ = nullptr;
+    ggml_backend_sched_t sched_ = nullptr;
+    std::vector<uint8_t> meta_;
+
+    std::recursive_mutex mutex_;
+    std::string error_msg_;
+};
+
+// Lock of a shared arena; an empty lock when the caller owns its scheduler
+inline std::unique_lock<std::recursive_mutex> lock_arena(const std::shared_ptr<ComputeArena> & arena) {
+    return arena ? arena->lock() : std::unique_lock<std::recursive_mutex>();
+}
+
+// Backend list and buffer types of a scheduler over gpu (may be null) and
+// cpu: the GPU first, and pinned host memory for the CPU when the GPU device
+// has a host buffer type
+void sched_backends(ggml_backend_t gpu, ggml_backend_t cpu,
+                    std::vector<ggml_backend_t> & backends,
+                    std::vector<ggml_backend_buffer_type_t> & bufts);
+
+} // namespace qwen3_asr
@@ -0,0 +1,259 @@
+#pragma once
+
+#include "ggml.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace qwen3_asr {
+
+// CPU backend configuration shared by the encoder, decoder and aligner.
+// Every model instance owns its own CPU backend (and threadpool, if enabled),
+// so separate instances can run with disjoint thread counts and CPU sets,
+// e.g. one 8-thread instance pinned to each NUMA node. Within an instance the
+// components share one set of backends when share_compute allows it.
+struct cpu_backend_params {
+    // Number of compute threads for the ggml CPU backend (<= 0: all cores)
+    int32_t n_threads = 4;
+
+    // Run graphs on a persistent ggml threadpool instead of spawning compute
+    // threads per graph. Implied when cpu_ids is non-empty.
+    bool use_threadpool = false;
+
+    // CPUs to pin the threadpool workers to (empty = no affinity)
+    std::vector<int32_t> cpu_ids;
+
+    // Threadpool polling level (0 = sleep between graphs, 100 = busy-wait).
+    // Qwen3ASR::load_model drops it to 0 when the encoder and decoder get
+    // separate threadpools on overlapping CPUs (threadpools_overlap)
+    uint32_t poll = 50;
+
+    // Use the GPU backend (and map weights into GPU-visible memory) when one
+    // is available; false runs everything on the CPU backend
+    bool use_gpu = true;
+
+    // GPU to run on, counting devices of type GPU in registry order
+    // (-1 = the first one, if any). An index that does not exist is an error.
+    int32_t gpu_device = -1;
+
+    // Text decoder only: split the transformer layers in contiguous, equal
+    // ranges over these GPU indices, e.g. {0, 1}; repeating an index gives
+    // that GPU a larger share ({0, 0, 1} puts 2/3 of the layers on GPU 0).
+    // Embeddings and LM head go to the first listed GPU. Empty = gpu_device.
+    std::vector<int32_t> gpu_split;
+
+    // Audio encoder on the CPU only: run the transformer of inputs longer
+    // than one attention window as up to this many graphs over contiguous
+    // groups of windows, in parallel, each on its own CPU backend and
+    // scheduler with an equal share of n_threads (and of cpu_ids). 1 = one
+    // graph over the whole input on the encoder's backend.
+    int32_t encoder_workers = 1;
+
+    // Let components with identical settings (same device, same CPU
+    // threads, no gpu_split) share one backend set and scheduler
+    // (ComputeArena), so their compute buffers are sized to the largest
+    // graph instead of adding up. Their graphs then run one at a time,
+    // which takes away the encoder/decoder overlap of transcribe_batch;
+    // turn it off for batch pipelines and servers.
+    bool share_compute = true;
+
+    // Move the quantized matmul weights of a component that runs on the
+    // CPU into the CPU backend's repacked layouts at load (see
+    // repack_cpu_weights). Costs a copy of those weights and load time.
+    bool repack_weights = false;
+
+    // With repack_weights: keep the repacked weights in a file next to the
+    // model and load them from there while model and CPU still match
+    bool repack_cache = false;
+};
+
+inline int32_t resolve_n_threads(int32_t n_threads) {
+    if (n_threads > 0) {
+        return n_threads;
+    }
+    const unsigned hw = std::thread::hardware_concurrency();
+    return hw > 0 ? (int32_t)hw : GGML_DEFAULT_N_THREADS;
+}
+
+// Whether the threadpools of a and b (when both create one) may put their
+// workers on the same CPUs: either has no affinity list, or the lists share
+// a CPU. Overlapping pools that poll spin against each other whenever both
+// compute at once, e.g. the encoder and decoder stages of transcribe_batch.
+inline bool threadpools_overlap(const cpu_backend_params & a, const cpu_backend_params & b) {
+    const bool pool_a = a.use_threadpool || !a.cpu_ids.empty();
+    const bool pool_b = b.use_threadpool || !b.cpu_ids.empty();
+    if (!pool_a || !pool_b) {
+        return false;
+    }
+    if (a.cpu_ids.empty() || b.cpu_ids.empty()) {
+        return true;
+    }
+    for (int32_t id : a.cpu_ids) {
+        if (std::find(b.cpu_ids.begin(), b.cpu_ids.end(), id) != b.cpu_ids.end()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Create a CPU backend configured from params.
+// On success backend is set and, when a threadpool was requested, threadpool
+// is set as well; the caller frees the backend first, then the threadpool.
+inline bool init_cpu_backend(const cpu_backend_params & params,
+                             ggml_backend_t & backend,
+                             ggml_threadpool_t & threadpool,
+                             std::string & error_msg) {
+    const int32_t n_threads = resolve_n_threads(params.n_threads);
+
+    for (int32_t id : params.cpu_ids) {
+        if (id < 0 || id >= GGML_MAX_N_THREADS) {
+            error_msg = "Invalid CPU id in affinity list: " + std::to_string(id);
+            return false;
+        }
+    }
+
+    backend = ggml_backend_init_by_type(GGML_BACKEND_DEVICE_TYPE_CPU, nullptr);
+    if (!backend) {
+        error_msg = "Failed to initialize CPU backend";
+        return false;
+    }
+
+    ggml_backend_cpu_set_n_threads(backend, n_threads);
+
+    if (params.use_threadpool || !params.cpu_ids.empty()) {
+        struct ggml_threadpool_params tpp = ggml_threadpool_params_default(n_threads);
+        tpp.poll = params.poll;
+        if (!params.cpu_ids.empty()) {
+            for (int32_t id : params.cpu_ids) {
+                tpp.cpumask[id] = true;
+            }
+            tpp.strict_cpu = true;
+        }
+
+        threadpool = ggml_threadpool_new(&tpp);
+        if (!threadpool) {
+            ggml_backend_free(backend);
+            backend = nullptr;
+            error_msg = "Failed to create CPU threadpool with " + std::to_string(n_threads) + " threads";
+            return false;
+        }
+        ggml_backend_cpu_set_threadpool(backend, threadpool);
+    }
+
+    return true;
+}
+
+// GPU number index (-1 = the first), counting devices of type GPU in
+// registry order; nullptr if there is no such device
+inline ggml_backend_dev_t find_gpu_device(int32_t index) {
+    int32_t n = 0;
+    for (size_t i = 0; i < ggml_backend_dev_count(); ++i) {
+        ggml_backend_dev_t dev = ggml_backend_dev_get(i);
+        if (ggml_backend_dev_type(dev) != GGML_BACKEND_DEVICE_TYPE_GPU) {
+            continue;
+        }
+        if (index < 0 || n == index) {
+            return dev;
+        }
+        ++n;
+    }
+    return nullptr;
+}
+
+// The GPU device params select, or nullptr to run on the CPU (use_gpu off,
+// or no GPU present and none asked for by index)
+inline bool select_gpu_device(const cpu_backend_params & params,
+                              ggml_backend_dev_t & dev,
+                              std::string & error_msg) {
+    dev = nullptr;
+    if (!params.use_gpu) {
+        return true;
+    }
+    dev = find_gpu_device(params.gpu_device);
+    if (!dev && params.gpu_device >= 0) {
+        error_msg = "GPU device " + std::to_string(params.gpu_device) + " not found";
+        return false;
+    }
+    return true;
+}
+
+// Allocate one buffer of buft for tensors that have no data yet and place
+// each tensor in it; nullptr if the allocation fails
+inline ggml_backend_buffer_t alloc_tensor_buffer(ggml_backend_buffer_type_t buft,
+                                                 const std::vector<struct ggml_tensor *> & tensors) {
+    const size_t alignment = ggml_backend_buft_get_alignment(buft);
+    size_t size = 0;
+    for (struct ggml_tensor * t : tensors) {
+        size += GGML_PAD(ggml_backend_buft_get_alloc_size(buft, t), alignment);
+    }
+
+    ggml_backend_buffer_t buffer = ggml_backend_buft_alloc_buffer(buft, size > 0 ? size : alignment);
+    if (!buffer) {
+        return nullptr;
+    }
+
+    uint8_t * base = (uint8_t *)ggml_backend_buffer_get_base(buffer);
+    size_t offset = 0;
+    for (struct ggml_tensor * t : tensors) {
+        if (ggml_backend_tensor_alloc(buffer, t, base + offset) != GGML_STATUS_SUCCESS) {
+            ggml_backend_buffer_free(buffer);
+            return nullptr;
+        }
+        offset += GGML_PAD(ggml_backend_buft_get_alloc_size(buft, t), alignment);
+    }
+    return buffer;
+}
+
+// Back weight tensors read from a mapped file with memory dev can use
+// (nullptr = CPU). data_base/size is the mapped tensor data and offsets[i]
+// the position of tensors[i] in it. The mapping itself is used on the CPU
+// and on devices that can address host memory (zero-copy on Apple Silicon
+// unified memory); other devices get a buffer the weights are copied into.
+// Falls back to the mapping when the device buffer cannot be allocated.
+inline ggml_backend_buffer_t map_weights(ggml_backend_dev_t dev,
+                                         uint8_t * data_base, size_t size, size_t max_tensor_size,
+                                         const std::vector<struct ggml_tensor *> & tensors,
+                                         const std::vector<size_t> & offsets) {
+    ggml_backend_buffer_t buffer = nullptr;
+    if (dev) {
+        buffer = ggml_backend_dev_buffer_from_host_ptr(dev, data_base, size, max_tensor_size);
+        if (!buffer) {
+            buffer = alloc_tensor_buffer(ggml_backend_dev_buffer_type(dev), tensors);
+            if (buffer) {
+                ggml_backend_buffer_set_usage(buffer, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+                for (size_t i = 0; i < tensors.size(); ++i) {
+                    ggml_backend_tensor_set(tensors[i], data_base + offsets[i], 0, ggml_nbytes(tensors[i]));
+                }
+                return buffer;
+            }
+            fprintf(stderr, "Warning: not enough memory on %s, keeping weights in host memory\n",
+                    ggml_backend_dev_name(dev));
+        }
+    }
+    if (!buffer) {
+        buffer = ggml_backend_cpu_buffer_from_ptr(data_base, size);
+    }
+    if (!buffer) {
+        return nullptr;
+    }
+    for (size_t i = 0; i < tensors.size(); ++i) {
+        tensors[i]->buffer = buffer;
+        tensors[i]->data = data_base + offsets[i];
+    }
+    return buffer;
+}
+
+inline void free_cpu_threadpool(ggml_threadpool_t & threadpool) {
+    if (threadpool) {
+        ggml_threadpool_free(threadpool);
+        threadpool = nullptr;
+    }
+}
+
+} // namespace qwen3_asr
@@ -0,0 +1,224 @@
+#include "feature_cache.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define QWEN3_FEATURE_CACHE_MAGIC "QFC1"
+
+namespace qwen3_asr {
+
+namespace {
+
+// On-disk entry: this header, then audio_features and mel as raw floats
+struct file_header {
+    char magic[4];
+    uint32_t header_size;
+    uint64_t key;
+    uint64_t n_features;
+    uint64_t n_mel_values;
+    int32_t n_mel_frames;
+    int32_t n_mel;
+};
+
+inline uint64_t mix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+size_t entry_bytes(const cached_features & e) {
+    return (e.audio_features.size() + e.mel.size()) * sizeof(float) + sizeof(cached_features);
+}
+
+} // namespace
+
+uint64_t hash_samples(const float * samples, size_t n_samples, uint64_t seed) {
+    const uint64_t prime = 0x9e3779b97f4a7c15ULL;
+    const uint8_t * p = reinterpret_cast<const uint8_t *>(samples);
+    const size_t n_bytes = n_samples * sizeof(float);
+
+    uint64_t lanes[4] = {seed, seed ^ prime, seed + prime, ~seed};
+    size_t i = 0;
+    for (; i + 32 <= n_bytes; i += 32) {
+        for (int l = 0; l < 4; ++l) {
+            uint64_t w;
+            memcpy(&w, p + i + 8 * l, 8);
+            lanes[l] = (lanes[l] ^ w) * prime;
+            lanes[l] ^= lanes[l] >> 29;
+        }
+    }
+    uint64_t h = mix64(lanes[0]) ^ (mix64(lanes[1]) * 3) ^ (mix64(lanes[2]) * 5) ^ (mix64(lanes[3]) * 7);
+    for (; i < n_bytes; ++i) {
+        h = (h ^ p[i]) * prime;
+    }
+    return mix64(h ^ n_bytes);
+}
+
+FeatureCache::FeatureCache(const feature_cache_params & params) : params_(params) {
+}
+
+size_t FeatureCache::memory_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return memory_bytes_;
+}
+
+size_t FeatureCache::hits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hits_;
+}
+
+size_t FeatureCache::misses() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return misses_;
+}
+
+bool FeatureCache::lookup(uint64_t key, cached_features & out) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second);
+            out = *it->second->value;
+            ++hits_;
+            return true;
+        }
+    }
+
+    // Disk reads run unlocked; a concurrent insert of the same key is
+    // harmless since both hold the same data
+    auto value = std::make_shared<cached_features>();
+    const bool found = !params_.dir.empty() && read_file(key, *value);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!found) {
+        ++misses_;
+        return false;
+    }
+    ++hits_;
+    out = *value;
+    insert_memory(key, std::move(value));
+    return true;
+}
+
+void FeatureCache::insert(uint64_t key, const cached_features & entry) {
+    auto value = std::make_shared<cached_features>(entry);
+    if (!params_.keep_mel) {
+        value->mel.clear();
+        value->n_mel = 0;
+    }
+
+    if (!params_.dir.empty() && !write_file(key, *value)) {
+        fprintf(stderr, "Warning: could not write feature cache entry %s\n", entry_path(key).c_str());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    insert_memory(key, std::move(value));
+}
+
+// Caller holds mutex_
+void FeatureCache::insert_memory(uint64_t key, std::shared_ptr<const cached_features> value) {
+    const size_t bytes = entry_bytes(*value);
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        memory_bytes_ -= it->second->bytes;
+        lru_.erase(it->second);
+        index_.erase(it);
+    }
+    if (bytes > params_.max_memory_bytes) {
+        return;
+    }
+
+    lru_.push_front(lru_entry{key, std::move(value), bytes});
+    index_[key] = lru_.begin();
+    memory_bytes_ += bytes;
+
+    while (memory_bytes_ > params_.max_memory_bytes) {
+        const lru_entry & last = lru_.back();
+        memory_bytes_ -= last.bytes;
+        index_.erase(last.key);
+        lru_.pop_back();
+    }
+}
+
+std::string FeatureCache::entry_path(uint64_t key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.qfc", (unsigned long long)key);
+    return params_.dir + "/" + name;
+}
+
+bool FeatureCache::read_file(uint64_t key, cached_features & out) const {
+    const std::string path = entry_path(key);
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(file_header)) {
+        close(fd);
+        return false;
+    }
+
+    void * addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    file_header hdr;
+    memcpy(&hdr, addr, sizeof(hdr));
+    const size_t expected = sizeof(hdr) + (hdr.n_features + hdr.n_mel_values) * sizeof(float);
+    const bool valid = memcmp(hdr.magic, QWEN3_FEATURE_CACHE_MAGIC, 4) == 0 &&
+                       hdr.header_size == sizeof(hdr) && hdr.key == key &&
+                       (size_t)st.st_size == expected;
+    if (valid) {
+        const float * data = reinterpret_cast<const float *>(static_cast<const uint8_t *>(addr) + sizeof(hdr));
+        out.audio_features.assign(data, data + hdr.n_features);
+        out.mel.assign(data + hdr.n_features, data + hdr.n_features + hdr.n_mel_values);
+        out.n_mel_frames = hdr.n_mel_frames;
+        out.n_mel = hdr.n_mel;
+    }
+    munmap(addr, st.st_size);
+    return valid;
+}
+
+bool FeatureCache::write_file(uint64_t key, const cached_features & entry) const {
+    const std::string path = entry_path(key);
+    const std::string tmp = path + ".tmp." + std::to_string((long)getpid());
+
+    FILE * f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+
+    file_header hdr = {};
+    memcpy(hdr.magic, QWEN3_FEATURE_CACHE_MAGIC, 4);
+    hdr.header_size = sizeof(hdr);
+    hdr.key = key;
+    hdr.n_features = entry.audio_features.size();
+    hdr.n_mel_values = entry.mel.size();
+    hdr.n_mel_frames = entry.n_mel_frames;
+    hdr.n_mel = entry.n_mel;
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    ok = ok && fwrite(entry.audio_features.data(), sizeof(float), entry.audio_features.size(), f) ==
+               entry.audio_features.size();
+    ok = ok && fwrite(entry.mel.data(), sizeof(float), entry.mel.size(), f) == entry.mel.size();
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace qwen3_asr
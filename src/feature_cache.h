@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace qwen3_asr {
+
+struct feature_cache_params {
+    // In-memory LRU budget for cached entries; 0 keeps nothing in memory
+    size_t max_memory_bytes = 256u << 20;
+
+    // Directory of the on-disk store (one file per entry, read through
+    // mmap); empty keeps the cache in memory only. Must exist.
+    std::string dir = "";
+
+    // Also store the log-mel next to the encoder output
+    bool keep_mel = false;
+};
+
+// Encoder output of one audio input
+struct cached_features {
+    std::vector<float> audio_features;  // [n_audio_frames, hidden_size]
+    int32_t n_mel_frames = 0;
+
+    // Log-mel [n_mel x n_mel_frames], empty unless stored with keep_mel
+    std::vector<float> mel;
+    int32_t n_mel = 0;
+};
+
+// Fast 64-bit hash of raw samples (four interleaved multiply-xor lanes over
+// 64-bit words). seed carries the model identity, so keys of different
+// models never collide.
+uint64_t hash_samples(const float * samples, size_t n_samples, uint64_t seed);
+
+// Content-addressed cache of encoder outputs, so repeated audio (retries,
+// prompt or language experiments) skips the mel and the encoder.
+//
+// Lookups try the in-memory LRU first and then the on-disk store; disk hits
+// are promoted into memory. Inserts go to both; disk files are written to a
+// temporary name and renamed, so concurrent readers never see a partial
+// entry. All methods are thread-safe.
+class FeatureCache {
+public:
+    explicit FeatureCache(const feature_cache_params & params);
+
+    FeatureCache(const FeatureCache &) = delete;
+    FeatureCache & operator=(const FeatureCache &) = delete;
+
+    bool lookup(uint64_t key, cached_features & out);
+    void insert(uint64_t key, const cached_features & entry);
+
+    const feature_cache_params & get_params() const { return params_; }
+
+    size_t memory_bytes() const;
+    size_t hits() const;
+    size_t misses() const;
+
+private:
+    struct lru_entry {
+        uint64_t key;
+        std::shared_ptr<const cached_features> value;
+        size_t bytes;
+    };
+
+    std::string entry_path(uint64_t key) const;
+    bool read_file(uint64_t key, cached_features & out) const;
+    bool write_file(uint64_t key, const cached_features & entry) const;
+    void insert_memory(uint64_t key, std::shared_ptr<const cached_features> value);
+
+    feature_cache_params params_;
+
+    mutable std::mutex mutex_;
+    std::list<lru_entry> lru_;   // most recently used first
+    std::unordered_map<uint64_t, std::list<lru_entry>::iterator> index_;
+    size_t memory_bytes_ = 0;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+};
+
+} // namespace qwen3_asr
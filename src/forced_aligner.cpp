@@ -1,5 +1,11 @@
 #include "forced_aligner.h"
 #include "mel_spectrogram.h"
+#include "audio_reader.h"
+#include "gguf_loader.h"
+#include "text_decoder.h"
+#include "audio_injection.h"
+#include "layer_ops.h"
+#include "timing.h"
 
 #include <cctype>
 #include <cstdio>
@@ -10,13 +16,27 @@
 #include <algorithm>
 #include <fstream>
 #include <sstream>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <unistd.h>
 
 #define QWEN3_FA_MAX_NODES 16384
 
+// Encoder attention window in mel frames (audio.n_window_infer of the ASR
+// model); the aligner's GGUF does not store it
+#define QWEN3_FA_N_WINDOW_INFER 800
+
+// Longest stretch of audio aligned in one pass; decoder (and encoder)
+// attention memory grows with the square of it
+#define QWEN3_FA_WINDOW_SEC 60
+
+// Words ending in the last seconds of a window are aligned again by the
+// next window, which sees the audio that follows them
+#define QWEN3_FA_WINDOW_OVERLAP_SEC 4
+
+// Text given to a window, relative to its share at the average speaking rate
+#define QWEN3_FA_WINDOW_TEXT_MARGIN 1.25f
+
+// Audio added on each side of an align_segments() stretch, in mel frames
+#define QWEN3_FA_SEGMENT_PAD_FRAMES 20
+
 namespace qwen3_asr {
 
 static int64_t get_time_ms() {
@@ -36,10 +56,38 @@ static void compute_sinusoidal_pe(float * pe, int n_ctx, int d_model) {
     }
 }
 
+static qkv_weights encoder_qkv_weights(const fa_encoder_layer & layer) {
+    qkv_weights w;
+    w.qkv_w = layer.attn_qkv_w;
+    w.qkv_b = layer.attn_qkv_b;
+    w.q_w = layer.attn_q_w;
+    w.q_b = layer.attn_q_b;
+    w.k_w = layer.attn_k_w;
+    w.k_b = layer.attn_k_b;
+    w.v_w = layer.attn_v_w;
+    w.v_b = layer.attn_v_b;
+    return w;
+}
+
+static qkv_weights decoder_qkv_weights(const fa_decoder_layer & layer) {
+    qkv_weights w;
+    w.qkv_w = layer.attn_qkv;
+    w.q_w = layer.attn_q;
+    w.k_w = layer.attn_k;
+    w.v_w = layer.attn_v;
+    return w;
+}
+
 ForcedAligner::ForcedAligner() = default;
 
 ForcedAligner::~ForcedAligner() {
-    free_kv_cache();
+    if (state_.arena) {
+        // Backends and scheduler belong to the arena
+        state_.sched = nullptr;
+        state_.backend_gpu = nullptr;
+        state_.backend_cpu = nullptr;
+        state_.arena.reset();
+    }
     if (state_.sched) {
         ggml_backend_sched_free(state_.sched);
         state_.sched = nullptr;
@@ -52,88 +100,100 @@ ForcedAligner::~ForcedAligner() {
         ggml_backend_free(state_.backend_cpu);
         state_.backend_cpu = nullptr;
     }
+    free_cpu_threadpool(state_.threadpool);
     free_forced_aligner_model(model_);
 }
 
-bool ForcedAligner::load_model(const std::string & model_path) {
-    struct ggml_context * meta_ctx = nullptr;
-    struct gguf_init_params params = {
-        /*.no_alloc =*/ true,
-        /*.ctx      =*/ &meta_ctx,
-    };
+bool ForcedAligner::load_model(const std::string & model_path,
+                               const cpu_backend_params & cpu_params,
+                               const std::shared_ptr<ComputeArena> & arena) {
+    auto file = std::make_shared<ModelFile>();
+    if (!file->open(model_path)) {
+        error_msg_ = file->get_error();
+        return false;
+    }
+    return load_model(file, cpu_params, arena);
+}
+
+bool ForcedAligner::load_model(const std::shared_ptr<ModelFile> & file,
+                               const cpu_backend_params & cpu_params,
+                               const std::shared_ptr<ComputeArena> & arena) {
+    ggml_backend_dev_t gpu_dev = nullptr;
+    if (!select_gpu_device(cpu_params, gpu_dev, error_msg_)) {
+        return false;
+    }
     
-    struct gguf_context * ctx = gguf_init_from_file(model_path.c_str(), params);
+    struct gguf_context * ctx = file->get_gguf();
     if (!ctx) {
-        error_msg_ = "Failed to open GGUF file: " + model_path;
+        error_msg_ = "GGUF metadata already released: " + file->get_path();
         return false;
     }
     
     if (!parse_hparams(ctx)) {
-        gguf_free(ctx);
-        if (meta_ctx) ggml_free(meta_ctx);
         return false;
     }
     
     if (!create_tensors(ctx)) {
-        gguf_free(ctx);
-        if (meta_ctx) ggml_free(meta_ctx);
         return false;
     }
     
-    if (!load_tensor_data(model_path, ctx)) {
+    if (!load_tensor_data(file, ctx, gpu_dev)) {
         free_forced_aligner_model(model_);
-        gguf_free(ctx);
-        if (meta_ctx) ggml_free(meta_ctx);
         return false;
     }
     
     if (!load_vocab(ctx)) {
         free_forced_aligner_model(model_);
-        gguf_free(ctx);
-        if (meta_ctx) ggml_free(meta_ctx);
         return false;
     }
     
-    gguf_free(ctx);
-    if (meta_ctx) ggml_free(meta_ctx);
+    // Nothing else of this file needs its metadata
+    file->release_metadata();
     
-    state_.backend_cpu = ggml_backend_init_by_type(GGML_BACKEND_DEVICE_TYPE_CPU, nullptr);
-    if (!state_.backend_cpu) {
-        error_msg_ = "Failed to initialize CPU backend";
-        return false;
-    }
-
-    state_.backend_gpu = ggml_backend_init_by_type(GGML_BACKEND_DEVICE_TYPE_GPU, nullptr);
-
-    std::vector<ggml_backend_t> backends;
-    std::vector<ggml_backend_buffer_type_t> backend_bufts;
+    if (arena && arena->matches(cpu_params, QWEN3_FA_MAX_NODES)) {
+        state_.arena = arena;
+        state_.backend_cpu = arena->get_backend_cpu();
+        state_.backend_gpu = arena->get_backend_gpu();
+        state_.sched = arena->get_sched();
+    } else {
+        if (!init_cpu_backend(cpu_params, state_.backend_cpu, state_.threadpool, error_msg_)) {
+            return false;
+        }
 
-    if (state_.backend_gpu) {
-        backends.push_back(state_.backend_gpu);
-        backend_bufts.push_back(ggml_backend_get_default_buffer_type(state_.backend_gpu));
-    }
+        if (gpu_dev) {
+            state_.backend_gpu = ggml_backend_dev_init(gpu_dev, nullptr);
+            if (!state_.backend_gpu) {
+                error_msg_ = std::string("Failed to initialize backend for ") + ggml_backend_dev_name(gpu_dev);
+                return false;
+            }
+        }
 
-    backends.push_back(state_.backend_cpu);
-    ggml_backend_buffer_type_t cpu_buft = ggml_backend_get_default_buffer_type(state_.backend_cpu);
-    if (state_.backend_gpu) {
-        ggml_backend_dev_t gpu_dev = ggml_backend_get_device(state_.backend_gpu);
-        ggml_backend_buffer_type_t host_buft = ggml_backend_dev_host_buffer_type(gpu_dev);
-        if (host_buft) cpu_buft = host_buft;
-    }
-    backend_bufts.push_back(cpu_buft);
+        std::vector<ggml_backend_t> backends;
+        std::vector<ggml_backend_buffer_type_t> backend_bufts;
+        sched_backends(state_.backend_gpu, state_.backend_cpu, backends, backend_bufts);
 
-    state_.sched = ggml_backend_sched_new(backends.data(), backend_bufts.data(), backends.size(), QWEN3_FA_MAX_NODES, false, true);
-    if (!state_.sched) {
-        error_msg_ = "Failed to create backend scheduler";
-        return false;
+        state_.sched = ggml_backend_sched_new(backends.data(), backend_bufts.data(), backends.size(), QWEN3_FA_MAX_NODES, false, true);
+        if (!state_.sched) {
+            error_msg_ = "Failed to create backend scheduler";
+            return false;
+        }
+        
+        state_.compute_meta.resize(ggml_tensor_overhead() * QWEN3_FA_MAX_NODES + ggml_graph_overhead());
     }
     
-    state_.compute_meta.resize(ggml_tensor_overhead() * QWEN3_FA_MAX_NODES + ggml_graph_overhead());
-    
     model_loaded_ = true;
     return true;
 }
 
+memory_usage ForcedAligner::get_memory_usage() const {
+    memory_usage mem;
+    mem.weights = ctx_tensor_bytes(model_.ctx);
+    if (!state_.arena) {
+        add_sched_bytes(state_.sched, mem);
+    }
+    return mem;
+}
+
 bool ForcedAligner::parse_hparams(struct gguf_context * ctx) {
     auto get_u32 = [&](const char * key, int32_t default_val) -> int32_t {
         int64_t idx = gguf_find_key(ctx, key);
@@ -226,6 +286,13 @@ bool ForcedAligner::create_tensors(struct gguf_context * ctx) {
                     ne[0] = hp.audio_d_model;
                     ne[1] = hp.audio_d_model;
                     n_dims = 2;
+                } else if (strstr(name, "attn_qkv.weight")) {
+                    ne[0] = hp.audio_d_model;
+                    ne[1] = 3 * hp.audio_d_model;
+                    n_dims = 2;
+                } else if (strstr(name, "attn_qkv.bias")) {
+                    ne[0] = 3 * hp.audio_d_model;
+                    n_dims = 1;
                 } else if (strstr(name, "attn_q.bias") || strstr(name, "attn_k.bias") || 
                            strstr(name, "attn_v.bias") || strstr(name, "attn_out.bias") ||
                            strstr(name, "attn_norm.weight") || strstr(name, "attn_norm.bias")) {
@@ -299,6 +366,10 @@ bool ForcedAligner::create_tensors(struct gguf_context * ctx) {
                     ne[0] = hp.text_hidden_size;
                     ne[1] = hp.text_kv_heads * hp.text_head_dim;
                     n_dims = 2;
+                } else if (strstr(name, "attn_qkv.weight")) {
+                    ne[0] = hp.text_hidden_size;
+                    ne[1] = (hp.text_attention_heads + 2 * hp.text_kv_heads) * hp.text_head_dim;
+                    n_dims = 2;
                 } else if (strstr(name, "attn_output.weight")) {
                     ne[0] = hp.text_attention_heads * hp.text_head_dim;
                     ne[1] = hp.text_hidden_size;
@@ -310,6 +381,10 @@ bool ForcedAligner::create_tensors(struct gguf_context * ctx) {
                     ne[0] = hp.text_hidden_size;
                     ne[1] = hp.text_intermediate_size;
                     n_dims = 2;
+                } else if (strstr(name, "ffn_gate_up.weight")) {
+                    ne[0] = hp.text_hidden_size;
+                    ne[1] = 2 * hp.text_intermediate_size;
+                    n_dims = 2;
                 } else if (strstr(name, "ffn_down.weight")) {
                     ne[0] = hp.text_intermediate_size;
                     ne[1] = hp.text_hidden_size;
@@ -368,6 +443,8 @@ bool ForcedAligner::create_tensors(struct gguf_context * ctx) {
                 else if (strstr(name, "attn_k.bias")) layer.attn_k_b = tensor;
                 else if (strstr(name, "attn_v.weight")) layer.attn_v_w = tensor;
                 else if (strstr(name, "attn_v.bias")) layer.attn_v_b = tensor;
+                else if (strstr(name, "attn_qkv.weight")) layer.attn_qkv_w = tensor;
+                else if (strstr(name, "attn_qkv.bias")) layer.attn_qkv_b = tensor;
                 else if (strstr(name, "attn_out.weight")) layer.attn_out_w = tensor;
                 else if (strstr(name, "attn_out.bias")) layer.attn_out_b = tensor;
                 else if (strstr(name, "attn_norm.weight")) layer.attn_norm_w = tensor;
@@ -397,10 +474,12 @@ bool ForcedAligner::create_tensors(struct gguf_context * ctx) {
                 else if (strstr(name, "attn_q.weight")) layer.attn_q = tensor;
                 else if (strstr(name, "attn_k.weight")) layer.attn_k = tensor;
                 else if (strstr(name, "attn_v.weight")) layer.attn_v = tensor;
+                else if (strstr(name, "attn_qkv.weight")) layer.attn_qkv = tensor;
                 else if (strstr(name, "attn_output.weight")) layer.attn_output = tensor;
                 else if (strstr(name, "ffn_norm.weight")) layer.ffn_norm = tensor;
                 else if (strstr(name, "ffn_gate.weight")) layer.ffn_gate = tensor;
                 else if (strstr(name, "ffn_up.weight")) layer.ffn_up = tensor;
+                else if (strstr(name, "ffn_gate_up.weight")) layer.ffn_gate_up = tensor;
                 else if (strstr(name, "ffn_down.weight")) layer.ffn_down = tensor;
             }
         }
@@ -409,68 +488,27 @@ bool ForcedAligner::create_tensors(struct gguf_context * ctx) {
     return true;
 }
 
-bool ForcedAligner::load_tensor_data(const std::string & path, struct gguf_context * ctx) {
-    int fd = open(path.c_str(), O_RDONLY);
-    if (fd < 0) {
-        error_msg_ = "Failed to open file for mmap: " + path;
-        return false;
-    }
-    
-    struct stat st;
-    if (fstat(fd, &st) != 0) {
-        error_msg_ = "Failed to stat file: " + path;
-        close(fd);
-        return false;
-    }
-    
-    void * mmap_addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
-    
-    if (mmap_addr == MAP_FAILED) {
-        error_msg_ = "Failed to mmap file: " + path;
-        return false;
-    }
-    
-    model_.mmap_addr = mmap_addr;
-    model_.mmap_size = st.st_size;
-    
-    const size_t data_offset = gguf_get_data_offset(ctx);
-    const size_t total_size = st.st_size - data_offset;
-    uint8_t * data_base = (uint8_t *)mmap_addr + data_offset;
-    
+bool ForcedAligner::load_tensor_data(const std::shared_ptr<ModelFile> & file, struct gguf_context * ctx,
+                                     ggml_backend_dev_t gpu_dev) {
     const int64_t n_tensors = gguf_get_n_tensors(ctx);
-    size_t max_tensor_size = 0;
+    
+    std::vector<struct ggml_tensor *> tensors;
+    std::vector<size_t> offsets;
     for (int64_t i = 0; i < n_tensors; ++i) {
-        size_t sz = gguf_get_tensor_size(ctx, i);
-        if (sz > max_tensor_size) max_tensor_size = sz;
-    }
-
-    ggml_backend_dev_t gpu_dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_GPU);
-    if (gpu_dev) {
-        model_.buffer = ggml_backend_dev_buffer_from_host_ptr(gpu_dev, data_base, total_size, max_tensor_size);
-    }
-    if (!model_.buffer) {
-        model_.buffer = ggml_backend_cpu_buffer_from_ptr(data_base, total_size);
+        auto it = model_.tensors.find(gguf_get_tensor_name(ctx, i));
+        if (it == model_.tensors.end()) continue;
+        
+        tensors.push_back(it->second);
+        offsets.push_back(gguf_get_tensor_offset(ctx, i));
     }
+    
+    model_.buffer = map_weights(gpu_dev, file->get_data(), file->get_data_size(), file->get_max_tensor_size(),
+                                tensors, offsets);
     if (!model_.buffer) {
         error_msg_ = "Failed to create buffer from mmap";
-        munmap(mmap_addr, st.st_size);
-        model_.mmap_addr = nullptr;
-        model_.mmap_size = 0;
         return false;
     }
-    
-    for (int64_t i = 0; i < n_tensors; ++i) {
-        const char * name = gguf_get_tensor_name(ctx, i);
-        size_t offset = gguf_get_tensor_offset(ctx, i);
-        
-        auto it = model_.tensors.find(name);
-        if (it == model_.tensors.end()) continue;
-        
-        struct ggml_tensor * tensor = it->second;
-        tensor->buffer = model_.buffer;
-        tensor->data = data_base + offset;
-    }
+    model_.file = file;
     
     return true;
 }
@@ -493,92 +531,24 @@ bool ForcedAligner::load_vocab(struct gguf_context * ctx) {
         model_.vocab[i] = gguf_get_arr_str(ctx, tokens_idx, i);
     }
     
-    for (int64_t i = 0; i < n_vocab; ++i) {
-        model_.token_to_id[model_.vocab[i]] = static_cast<int32_t>(i);
-    }
-    
+    std::vector<std::string> merges;
     int64_t merges_idx = gguf_find_key(ctx, "tokenizer.ggml.merges");
     if (merges_idx >= 0) {
         int64_t n_merges = gguf_get_arr_n(ctx, merges_idx);
+        merges.reserve(n_merges);
         for (int64_t i = 0; i < n_merges; ++i) {
-            std::string merge = gguf_get_arr_str(ctx, merges_idx, i);
-            model_.bpe_ranks[merge] = static_cast<int>(i);
+            merges.push_back(gguf_get_arr_str(ctx, merges_idx, i));
         }
     }
     
-    return true;
-}
-
-bool ForcedAligner::init_kv_cache(int32_t n_ctx) {
-    const auto & hp = model_.hparams;
-    
-    free_kv_cache();
-    
-    state_.cache.n_ctx = n_ctx;
-    state_.cache.n_used = 0;
-    state_.cache.head_dim = hp.text_head_dim;
-    state_.cache.n_kv_heads = hp.text_kv_heads;
-    state_.cache.n_layers = hp.text_decoder_layers;
-    
-    const size_t n_tensors = hp.text_decoder_layers * 2;
-    const size_t ctx_size = n_tensors * ggml_tensor_overhead();
-    
-    struct ggml_init_params params = {
-        /*.mem_size   =*/ ctx_size,
-        /*.mem_buffer =*/ nullptr,
-        /*.no_alloc   =*/ true,
-    };
-    
-    state_.cache.ctx = ggml_init(params);
-    if (!state_.cache.ctx) {
-        error_msg_ = "Failed to create KV cache context";
-        return false;
-    }
-    
-    state_.cache.k_cache.resize(hp.text_decoder_layers);
-    state_.cache.v_cache.resize(hp.text_decoder_layers);
-    
-    for (int il = 0; il < hp.text_decoder_layers; ++il) {
-        state_.cache.k_cache[il] = ggml_new_tensor_3d(
-            state_.cache.ctx, GGML_TYPE_F16,
-            hp.text_head_dim, hp.text_kv_heads, n_ctx);
-        ggml_format_name(state_.cache.k_cache[il], "k_cache_%d", il);
-        
-        state_.cache.v_cache[il] = ggml_new_tensor_3d(
-            state_.cache.ctx, GGML_TYPE_F16,
-            hp.text_head_dim, hp.text_kv_heads, n_ctx);
-        ggml_format_name(state_.cache.v_cache[il], "v_cache_%d", il);
-    }
-    
-    ggml_backend_t kv_backend = state_.backend_gpu ? state_.backend_gpu : state_.backend_cpu;
-    state_.cache.buffer = ggml_backend_alloc_ctx_tensors(state_.cache.ctx, kv_backend);
-    if (!state_.cache.buffer) {
-        error_msg_ = "Failed to allocate KV cache buffer";
+    if (!model_.tokenizer.build(model_.vocab, merges)) {
+        error_msg_ = "Failed to build BPE tokenizer";
         return false;
     }
     
     return true;
 }
 
-void ForcedAligner::clear_kv_cache() {
-    state_.cache.n_used = 0;
-}
-
-void ForcedAligner::free_kv_cache() {
-    if (state_.cache.buffer) {
-        ggml_backend_buffer_free(state_.cache.buffer);
-        state_.cache.buffer = nullptr;
-    }
-    if (state_.cache.ctx) {
-        ggml_free(state_.cache.ctx);
-        state_.cache.ctx = nullptr;
-    }
-    state_.cache.k_cache.clear();
-    state_.cache.v_cache.clear();
-    state_.cache.n_ctx = 0;
-    state_.cache.n_used = 0;
-}
-
 // Conv2d output size: floor((input + 2*pad - kernel) / stride) + 1
 // With pad=1, kernel=3, stride=2: (input - 1) / 2 + 1
 static int32_t chunk_output_len(int32_t chunk_frames) {
@@ -601,7 +571,7 @@ bool ForcedAligner::encode_audio(const float * mel_data, int n_mel, int n_frames
 
     const int32_t n_window = 50;
     const int32_t chunk_mel_size = n_window * 2;
-    const int32_t n_window_infer = 800;
+    const int32_t n_window_infer = QWEN3_FA_N_WINDOW_INFER;
     const int32_t n_chunks = (n_frames + chunk_mel_size - 1) / chunk_mel_size;
 
     std::vector<int32_t> chunk_lengths(n_chunks);
@@ -622,9 +592,11 @@ bool ForcedAligner::encode_audio(const float * mel_data, int n_mel, int n_frames
 
     const int32_t max_out_w = chunk_output_len(max_chunk_len);
 
+    auto lock = lock_arena(state_.arena);
+
     struct ggml_init_params params = {
-        /*.mem_size   =*/ state_.compute_meta.size(),
-        /*.mem_buffer =*/ state_.compute_meta.data(),
+        /*.mem_size   =*/ compute_meta().size(),
+        /*.mem_buffer =*/ compute_meta().data(),
         /*.no_alloc   =*/ true,
     };
 
@@ -702,7 +674,7 @@ bool ForcedAligner::encode_audio(const float * mel_data, int n_mel, int n_frames
         ggml_backend_tensor_set(mel_t, mel_batch_data.data(), 0, batch_size * sizeof(float));
     }
 
-    if (ggml_backend_sched_graph_compute(state_.sched, gf) != GGML_STATUS_SUCCESS) {
+    if (sched_graph_compute(state_.sched, gf) != GGML_STATUS_SUCCESS) {
         error_msg_ = "Failed to compute conv graph";
         ggml_backend_sched_reset(state_.sched);
         ggml_free(ctx0);
@@ -790,30 +762,17 @@ bool ForcedAligner::encode_audio(const float * mel_data, int n_mel, int n_frames
             cur = ggml_add(ctx0, cur, layer.attn_norm_b);
         }
 
-        struct ggml_tensor * Qcur = ggml_mul_mat(ctx0, layer.attn_q_w, cur);
-        if (layer.attn_q_b) Qcur = ggml_add(ctx0, Qcur, layer.attn_q_b);
+        const qkv_proj qkv = build_qkv(ctx0, cur, encoder_qkv_weights(layer), n_state_head, n_head, n_head);
 
-        struct ggml_tensor * Kcur = ggml_mul_mat(ctx0, layer.attn_k_w, cur);
-        if (layer.attn_k_b) Kcur = ggml_add(ctx0, Kcur, layer.attn_k_b);
+        struct ggml_tensor * Q = ggml_permute(ctx0, qkv.q, 0, 2, 1, 3);
 
-        struct ggml_tensor * Vcur = ggml_mul_mat(ctx0, layer.attn_v_w, cur);
-        if (layer.attn_v_b) Vcur = ggml_add(ctx0, Vcur, layer.attn_v_b);
-
-        struct ggml_tensor * Q = ggml_permute(ctx0,
-            ggml_reshape_3d(ctx0, Qcur, n_state_head, n_head, n_ctx),
-            0, 2, 1, 3);
-
-        struct ggml_tensor * K = ggml_permute(ctx0,
-            ggml_reshape_3d(ctx0, Kcur, n_state_head, n_head, n_ctx),
-            0, 2, 1, 3);
+        struct ggml_tensor * K = ggml_permute(ctx0, qkv.k, 0, 2, 1, 3);
 
         struct ggml_tensor * KQ = ggml_mul_mat(ctx0, K, Q);
 
         struct ggml_tensor * KQ_soft_max = ggml_soft_max_ext(ctx0, KQ, mask_tensor, KQscale, 0.0f);
 
-        struct ggml_tensor * V = ggml_cont(ctx0, ggml_permute(ctx0,
-            ggml_reshape_3d(ctx0, Vcur, n_state_head, n_head, n_ctx),
-            1, 2, 0, 3));
+        struct ggml_tensor * V = ggml_cont(ctx0, ggml_permute(ctx0, qkv.v, 1, 2, 0, 3));
 
         struct ggml_tensor * KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
 
@@ -897,7 +856,7 @@ bool ForcedAligner::encode_audio(const float * mel_data, int n_mel, int n_frames
     ggml_backend_tensor_set(mask_t, attn_mask.data(), 0,
                             n_ctx * n_ctx * sizeof(float));
 
-    if (ggml_backend_sched_graph_compute(state_.sched, gf) != GGML_STATUS_SUCCESS) {
+    if (sched_graph_compute(state_.sched, gf) != GGML_STATUS_SUCCESS) {
         error_msg_ = "Failed to compute transformer graph";
         ggml_backend_sched_reset(state_.sched);
         ggml_free(ctx0);
@@ -924,10 +883,7 @@ bool ForcedAligner::encode_audio(const float * mel_data, int n_mel, int n_frames
     return true;
 }
 
-struct ggml_cgraph * ForcedAligner::build_decoder_graph(
-    const int32_t * tokens, int32_t n_tokens,
-    const float * audio_embd, int32_t n_audio,
-    int32_t audio_start_pos) {
+struct ggml_cgraph * ForcedAligner::build_decoder_graph(int32_t n_tokens, int32_t n_audio) {
     
     const auto & hp = model_.hparams;
     const int n_head = hp.text_attention_heads;
@@ -939,57 +895,29 @@ struct ggml_cgraph * ForcedAligner::build_decoder_graph(
     const int n_layer = hp.text_decoder_layers;
     
     struct ggml_init_params params = {
-        /*.mem_size   =*/ state_.compute_meta.size(),
-        /*.mem_buffer =*/ state_.compute_meta.data(),
+        /*.mem_size   =*/ compute_meta().size(),
+        /*.mem_buffer =*/ compute_meta().data(),
         /*.no_alloc   =*/ true,
     };
     
     struct ggml_context * ctx0 = ggml_init(params);
     struct ggml_cgraph * gf = ggml_new_graph_custom(ctx0, QWEN3_FA_MAX_NODES, false);
     
-    struct ggml_tensor * inp_tokens = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
-    ggml_set_name(inp_tokens, "inp_tokens");
-    ggml_set_input(inp_tokens);
-    
     struct ggml_tensor * inp_pos = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
     ggml_set_name(inp_pos, "inp_pos");
     ggml_set_input(inp_pos);
     
-    struct ggml_tensor * inp_audio = nullptr;
-    if (audio_embd && n_audio > 0) {
-        inp_audio = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, hidden_size, n_audio);
+    struct ggml_tensor * cur = nullptr;
+    if (n_audio > 0) {
+        struct ggml_tensor * inp_audio = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, hidden_size, n_audio);
         ggml_set_name(inp_audio, "inp_audio");
         ggml_set_input(inp_audio);
-    }
-    
-    struct ggml_tensor * cur = ggml_get_rows(ctx0, model_.token_embd, inp_tokens);
-    
-    if (inp_audio && n_audio > 0 && audio_start_pos >= 0 && audio_start_pos + n_audio <= n_tokens) {
-        struct ggml_tensor * embd_before = nullptr;
-        struct ggml_tensor * embd_after = nullptr;
-        
-        if (audio_start_pos > 0) {
-            embd_before = ggml_view_2d(ctx0, cur, hidden_size, audio_start_pos,
-                                       cur->nb[1], 0);
-        }
-        
-        if (audio_start_pos + n_audio < n_tokens) {
-            int after_start = audio_start_pos + n_audio;
-            int after_len = n_tokens - after_start;
-            embd_after = ggml_view_2d(ctx0, cur, hidden_size, after_len,
-                                      cur->nb[1], after_start * cur->nb[1]);
-        }
-        
-        if (embd_before && embd_after) {
-            struct ggml_tensor * tmp = ggml_concat(ctx0, embd_before, inp_audio, 1);
-            cur = ggml_concat(ctx0, tmp, embd_after, 1);
-        } else if (embd_before) {
-            cur = ggml_concat(ctx0, embd_before, inp_audio, 1);
-        } else if (embd_after) {
-            cur = ggml_concat(ctx0, inp_audio, embd_after, 1);
-        } else {
-            cur = inp_audio;
-        }
+        cur = build_injected_embeddings(ctx0, model_.token_embd, inp_audio, n_tokens, n_tokens - n_audio);
+    } else {
+        struct ggml_tensor * inp_tokens = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
+        ggml_set_name(inp_tokens, "inp_tokens");
+        ggml_set_input(inp_tokens);
+        cur = ggml_get_rows(ctx0, model_.token_embd, inp_tokens);
     }
     
     struct ggml_tensor * inpL = cur;
@@ -1003,9 +931,9 @@ struct ggml_cgraph * ForcedAligner::build_decoder_graph(
     for (int il = 0; il < n_layer; ++il) {
         const auto & layer = model_.decoder_layers[il];
         
-        if (!layer.attn_norm || !layer.attn_q || !layer.attn_k || !layer.attn_v || 
-            !layer.attn_output || !layer.ffn_norm || !layer.ffn_gate || 
-            !layer.ffn_up || !layer.ffn_down) {
+        const qkv_weights qkv_w = decoder_qkv_weights(layer);
+        if (!layer.attn_norm || !qkv_w.complete() || !layer.attn_output || !layer.ffn_norm ||
+            !(layer.ffn_gate_up || (layer.ffn_gate && layer.ffn_up)) || !layer.ffn_down) {
             ggml_free(ctx0);
             return nullptr;
         }
@@ -1013,13 +941,10 @@ struct ggml_cgraph * ForcedAligner::build_decoder_graph(
         cur = ggml_rms_norm(ctx0, inpL, eps);
         cur = ggml_mul(ctx0, cur, layer.attn_norm);
         
-        struct ggml_tensor * Qcur = ggml_mul_mat(ctx0, layer.attn_q, cur);
-        struct ggml_tensor * Kcur = ggml_mul_mat(ctx0, layer.attn_k, cur);
-        struct ggml_tensor * Vcur = ggml_mul_mat(ctx0, layer.attn_v, cur);
-        
-        Qcur = ggml_reshape_3d(ctx0, Qcur, head_dim, n_head, n_tokens);
-        Kcur = ggml_reshape_3d(ctx0, Kcur, head_dim, n_kv_head, n_tokens);
-        Vcur = ggml_reshape_3d(ctx0, Vcur, head_dim, n_kv_head, n_tokens);
+        const qkv_proj qkv = build_qkv(ctx0, cur, qkv_w, head_dim, n_head, n_kv_head);
+        struct ggml_tensor * Qcur = qkv.q;
+        struct ggml_tensor * Kcur = qkv.k;
+        struct ggml_tensor * Vcur = qkv.v;
         
         if (layer.attn_q_norm) {
             Qcur = ggml_rms_norm(ctx0, Qcur, eps);
@@ -1054,12 +979,7 @@ struct ggml_cgraph * ForcedAligner::build_decoder_graph(
         cur = ggml_rms_norm(ctx0, inpFF, eps);
         cur = ggml_mul(ctx0, cur, layer.ffn_norm);
         
-        struct ggml_tensor * gate = ggml_mul_mat(ctx0, layer.ffn_gate, cur);
-        struct ggml_tensor * up = ggml_mul_mat(ctx0, layer.ffn_up, cur);
-        
-        gate = ggml_silu(ctx0, gate);
-        
-        cur = ggml_mul(ctx0, gate, up);
+        cur = build_swiglu_in(ctx0, cur, layer.ffn_gate_up, layer.ffn_gate, layer.ffn_up);
         
         cur = ggml_mul_mat(ctx0, layer.ffn_down, cur);
         
@@ -1097,8 +1017,16 @@ bool ForcedAligner::forward_decoder(
         return false;
     }
     
-    struct ggml_cgraph * gf = build_decoder_graph(tokens, n_tokens,
-                                                   audio_embd, n_audio, audio_start_pos);
+    const bool has_audio = audio_embd && n_audio > 0;
+    injection_layout layout;
+    if (has_audio && !make_injection_layout(tokens, n_tokens, audio_start_pos, n_audio, layout)) {
+        error_msg_ = "Audio span does not fit in the prompt";
+        return false;
+    }
+    
+    auto lock = lock_arena(state_.arena);
+    
+    struct ggml_cgraph * gf = build_decoder_graph(n_tokens, has_audio ? n_audio : 0);
     if (!gf) {
         error_msg_ = "Failed to build decoder graph";
         return false;
@@ -1109,13 +1037,18 @@ bool ForcedAligner::forward_decoder(
         return false;
     }
     
-    struct ggml_tensor * inp_tokens = ggml_graph_get_tensor(gf, "inp_tokens");
-    if (!inp_tokens) {
-        error_msg_ = "Failed to find inp_tokens tensor";
-        ggml_backend_sched_reset(state_.sched);
-        return false;
+    if (has_audio) {
+        set_injection_inputs(gf, layout);
+        set_audio_input(ggml_graph_get_tensor(gf, "inp_audio"), audio_embd, n_audio);
+    } else {
+        struct ggml_tensor * inp_tokens = ggml_graph_get_tensor(gf, "inp_tokens");
+        if (!inp_tokens) {
+            error_msg_ = "Failed to find inp_tokens tensor";
+            ggml_backend_sched_reset(state_.sched);
+            return false;
+        }
+        ggml_backend_tensor_set(inp_tokens, tokens, 0, n_tokens * sizeof(int32_t));
     }
-    ggml_backend_tensor_set(inp_tokens, tokens, 0, n_tokens * sizeof(int32_t));
     
     struct ggml_tensor * inp_pos = ggml_graph_get_tensor(gf, "inp_pos");
     if (inp_pos) {
@@ -1139,15 +1072,7 @@ bool ForcedAligner::forward_decoder(
         ggml_backend_tensor_set(mask_t, mask_data.data(), 0, mask_data.size() * sizeof(ggml_fp16_t));
     }
     
-    if (audio_embd && n_audio > 0) {
-        struct ggml_tensor * inp_audio = ggml_graph_get_tensor(gf, "inp_audio");
-        if (inp_audio) {
-            ggml_backend_tensor_set(inp_audio, audio_embd, 0, 
-                                    n_audio * model_.hparams.text_hidden_size * sizeof(float));
-        }
-    }
-    
-    if (ggml_backend_sched_graph_compute(state_.sched, gf) != GGML_STATUS_SUCCESS) {
+    if (sched_graph_compute(state_.sched, gf) != GGML_STATUS_SUCCESS) {
         error_msg_ = "Failed to compute graph";
         ggml_backend_sched_reset(state_.sched);
         return false;
@@ -1413,45 +1338,6 @@ static std::vector<std::string> split_utf8_chars(const std::string & s) {
     return chars;
 }
 
-static std::vector<std::string> bpe_encode_word(
-    const std::string & word_bpe,
-    const std::unordered_map<std::string, int> & bpe_ranks) {
-
-    std::vector<std::string> symbols = split_utf8_chars(word_bpe);
-    if (symbols.size() <= 1) return symbols;
-
-    while (true) {
-        int best_rank = INT_MAX;
-        size_t best_pos = 0;
-
-        for (size_t i = 0; i + 1 < symbols.size(); ++i) {
-            std::string key = symbols[i] + " " + symbols[i + 1];
-            auto it = bpe_ranks.find(key);
-            if (it != bpe_ranks.end() && it->second < best_rank) {
-                best_rank = it->second;
-                best_pos = i;
-            }
-        }
-
-        if (best_rank == INT_MAX) break;
-
-        std::string merged = symbols[best_pos] + symbols[best_pos + 1];
-        std::vector<std::string> new_symbols;
-        new_symbols.reserve(symbols.size() - 1);
-        for (size_t i = 0; i < symbols.size(); ++i) {
-            if (i == best_pos) {
-                new_symbols.push_back(merged);
-                ++i;
-            } else {
-                new_symbols.push_back(symbols[i]);
-            }
-        }
-        symbols = std::move(new_symbols);
-        if (symbols.size() == 1) break;
-    }
-
-    return symbols;
-}
 
 static size_t utf8_char_len(unsigned char c) {
     if ((c & 0x80) == 0) return 1;
@@ -1585,14 +1471,8 @@ static std::string strip_word_punctuation(const std::string & word) {
     return word.substr(start, end - start);
 }
 
-std::vector<int32_t> ForcedAligner::tokenize_with_timestamps(
-    const std::string & text,
-    std::vector<std::string> & words,
-    const std::string & language) {
-
-    words.clear();
-    std::vector<int32_t> tokens;
-
+std::vector<std::string> ForcedAligner::split_words(const std::string & text,
+                                                    const std::string & language) {
     std::vector<std::string> raw_words;
 
     if (language == "korean" && !model_.ko_dict.empty()) {
@@ -1610,6 +1490,14 @@ std::vector<int32_t> ForcedAligner::tokenize_with_timestamps(
         }
     }
 
+    return raw_words;
+}
+
+std::vector<int32_t> ForcedAligner::tokenize_words(const std::vector<std::string> & raw_words,
+                                                   std::vector<std::string> & words) {
+    words.clear();
+    std::vector<int32_t> tokens;
+
     bool first_word = true;
     for (size_t w = 0; w < raw_words.size(); ++w) {
         // Strip leading/trailing punctuation for BPE encoding; punctuation has
@@ -1625,23 +1513,13 @@ std::vector<int32_t> ForcedAligner::tokenize_with_timestamps(
         words.push_back(raw_words[w]);
 
         // Non-first words in running text are stored in the Qwen vocabulary
-        // with a leading space (encoded as 'Ġ' by bytes_to_bpe_string).
+        // with a leading space (the byte-level symbol 'Ġ').
         // Omitting the space prefix produces the wrong token IDs and can cause
         // silent token drops when the no-space form is absent from the vocab.
         std::string to_encode = first_word ? clean : (" " + clean);
         first_word = false;
 
-        std::string bpe_str = bytes_to_bpe_string(to_encode);
-        std::vector<std::string> subwords = bpe_encode_word(bpe_str, model_.bpe_ranks);
-
-        for (const auto & sw : subwords) {
-            auto it = model_.token_to_id.find(sw);
-            if (it != model_.token_to_id.end()) {
-                tokens.push_back(it->second);
-            } else {
-                fprintf(stderr, "BPE tokenizer: unknown subword token '%s'\n", sw.c_str());
-            }
-        }
+        model_.tokenizer.encode_word(to_encode, tokens);
 
         tokens.push_back(model_.hparams.timestamp_token_id);
         tokens.push_back(model_.hparams.timestamp_token_id);
@@ -1650,8 +1528,16 @@ std::vector<int32_t> ForcedAligner::tokenize_with_timestamps(
     return tokens;
 }
 
+std::vector<int32_t> ForcedAligner::tokenize_with_timestamps(
+    const std::string & text,
+    std::vector<std::string> & words,
+    const std::string & language) {
+    return tokenize_words(split_words(text, language), words);
+}
+
 alignment_result ForcedAligner::align(const std::string & audio_path, const std::string & text,
                                        const std::string & language) {
+    QWEN3_TRACE_REQUEST();
     alignment_result result;
     
     if (!model_loaded_) {
@@ -1662,21 +1548,17 @@ alignment_result ForcedAligner::align(const std::string & audio_path, const std:
     std::vector<float> samples;
     int sample_rate;
     
-    if (!load_wav(audio_path, samples, sample_rate)) {
+    if (!qwen3_asr::load_audio_file(audio_path, samples, sample_rate)) {
         result.error_msg = "Failed to load audio file: " + audio_path;
         return result;
     }
     
-    if (sample_rate != QWEN_SAMPLE_RATE) {
-        result.error_msg = "Audio must be 16kHz, got " + std::to_string(sample_rate) + " Hz";
-        return result;
-    }
-    
     return align(samples.data(), samples.size(), text, language);
 }
 
 alignment_result ForcedAligner::align(const float * samples, int n_samples, const std::string & text,
                                        const std::string & language) {
+    QWEN3_TRACE_REQUEST();
     alignment_result result;
     int64_t t_total_start = get_time_ms();
     
@@ -1685,34 +1567,266 @@ alignment_result ForcedAligner::align(const float * samples, int n_samples, cons
         return result;
     }
     
-    float audio_duration = static_cast<float>(n_samples) / QWEN_SAMPLE_RATE;
-    
     int64_t t_mel_start = get_time_ms();
     MelFilters mel_filters;
     generate_mel_filters(mel_filters, QWEN_N_MELS, QWEN_N_FFT, QWEN_SAMPLE_RATE);
     
     MelSpectrogram mel;
-    if (!log_mel_spectrogram(samples, n_samples, mel_filters, mel, 4)) {
-        result.error_msg = "Failed to compute mel spectrogram";
+    {
+        QWEN3_TIMER("align.mel");
+        if (!log_mel_spectrogram(samples, n_samples, mel_filters, mel, 4)) {
+            result.error_msg = "Failed to compute mel spectrogram";
+            return result;
+        }
+    }
+    int64_t t_mel_ms = get_time_ms() - t_mel_start;
+    
+    result = align(mel, n_samples, text, language);
+    result.t_mel_ms = t_mel_ms;
+    result.t_total_ms = get_time_ms() - t_total_start;
+    
+    return result;
+}
+
+alignment_result ForcedAligner::align(const MelSpectrogram & mel, int n_samples, const std::string & text,
+                                       const std::string & language) {
+    QWEN3_TRACE_REQUEST();
+    alignment_result result;
+    int64_t t_total_start = get_time_ms();
+    
+    if (!model_loaded_) {
+        result.error_msg = "Model not loaded";
         return result;
     }
-    result.t_mel_ms = get_time_ms() - t_mel_start;
     
-    int64_t t_encode_start = get_time_ms();
-    std::vector<float> audio_features;
-    if (!encode_audio(mel.data.data(), mel.n_mel, mel.n_len, audio_features)) {
-        result.error_msg = "Failed to encode audio: " + error_msg_;
+    float audio_duration = static_cast<float>(n_samples) / QWEN_SAMPLE_RATE;
+    
+    if (!align_mel_range(mel, 0, mel.n_len, audio_duration, split_words(text, language),
+                         result.words, result.t_encode_ms, result.t_decode_ms)) {
+        result.error_msg = error_msg_;
+        result.words.clear();
         return result;
     }
-    result.t_encode_ms = get_time_ms() - t_encode_start;
     
-    int32_t n_audio_frames = audio_features.size() / model_.hparams.text_hidden_size;
+    result.success = true;
+    result.t_total_ms = get_time_ms() - t_total_start;
+    
+    return result;
+}
+
+alignment_result ForcedAligner::align_segments(const MelSpectrogram & mel, int n_samples,
+                                               const std::vector<align_segment> & segments,
+                                               const std::string & language) {
+    QWEN3_TRACE_REQUEST();
+    alignment_result result;
+    int64_t t_total_start = get_time_ms();
+    
+    if (!model_loaded_) {
+        result.error_msg = "Model not loaded";
+        return result;
+    }
+    
+    const float frames_per_sec = (float) QWEN_SAMPLE_RATE / QWEN_HOP_LENGTH;
+    const float audio_duration = static_cast<float>(n_samples) / QWEN_SAMPLE_RATE;
+    
+    for (const auto & seg : segments) {
+        const int32_t frame0 = std::max(0, (int32_t) (seg.start * frames_per_sec) - QWEN3_FA_SEGMENT_PAD_FRAMES);
+        const int32_t frame1 = std::min(mel.n_len, (int32_t) std::ceil(seg.end * frames_per_sec) + QWEN3_FA_SEGMENT_PAD_FRAMES);
+        std::vector<std::string> raw_words = split_words(seg.text, language);
+        if (frame1 <= frame0 || raw_words.empty()) {
+            continue;
+        }
+        const float seg_duration = std::min(audio_duration, frame1 / frames_per_sec) - frame0 / frames_per_sec;
+        if (!align_mel_range(mel, frame0, frame1, seg_duration, raw_words,
+                             result.words, result.t_encode_ms, result.t_decode_ms)) {
+            result.error_msg = error_msg_;
+            result.words.clear();
+            return result;
+        }
+    }
+    
+    result.success = true;
+    result.t_total_ms = get_time_ms() - t_total_start;
+    
+    return result;
+}
+
+alignment_result ForcedAligner::align_encoded(const float * audio_features, int32_t n_audio_frames,
+                                               int32_t n_mel_frames, float audio_duration,
+                                               const std::string & text, const std::string & language) {
+    QWEN3_TRACE_REQUEST();
+    alignment_result result;
+    int64_t t_total_start = get_time_ms();
+    
+    if (!model_loaded_) {
+        result.error_msg = "Model not loaded";
+        return result;
+    }
+    
+    // Windows start on 100-frame chunk boundaries, where the encoder's
+    // output is exactly 13 frames per chunk
+    const int32_t hidden = model_.hparams.text_hidden_size;
+    auto get_features = [&](int32_t frame0, int32_t frame1, std::vector<float> & features) {
+        const int32_t a0 = std::min(n_audio_frames, frame0 / 100 * 13);
+        const int32_t a1 = frame1 >= n_mel_frames ? n_audio_frames : std::min(n_audio_frames, frame1 / 100 * 13);
+        features.assign(audio_features + (size_t) a0 * hidden, audio_features + (size_t) a1 * hidden);
+        return true;
+    };
+    
+    if (!align_windows(get_features, n_mel_frames, audio_duration, 0.0f, split_words(text, language),
+                       result.words, result.t_decode_ms)) {
+        result.error_msg = error_msg_;
+        result.words.clear();
+        return result;
+    }
+    
+    result.success = true;
+    result.t_total_ms = get_time_ms() - t_total_start;
+    
+    return result;
+}
+
+bool ForcedAligner::align_mel_range(const MelSpectrogram & mel, int32_t frame0, int32_t frame1,
+                                    float audio_duration, const std::vector<std::string> & raw_words,
+                                    std::vector<aligned_word> & words, int64_t & t_encode_ms, int64_t & t_decode_ms) {
+    std::vector<float> mel_window;
+    auto get_features = [&](int32_t f0, int32_t f1, std::vector<float> & features) {
+        QWEN3_TIMER("align.encode");
+        const int64_t t_start = get_time_ms();
+        const float * mel_data = mel.data.data();
+        const int32_t n_frames = f1 - f0;
+        if (frame0 + f0 != 0 || n_frames != mel.n_len) {
+            mel_window.resize((size_t) mel.n_mel * n_frames);
+            for (int m = 0; m < mel.n_mel; ++m) {
+                memcpy(&mel_window[(size_t) m * n_frames], &mel.data[(size_t) m * mel.n_len + frame0 + f0],
+                       n_frames * sizeof(float));
+            }
+            mel_data = mel_window.data();
+        }
+        const bool ok = encode_audio(mel_data, mel.n_mel, n_frames, features);
+        if (!ok) {
+            error_msg_ = "Failed to encode audio: " + error_msg_;
+        }
+        t_encode_ms += get_time_ms() - t_start;
+        return ok;
+    };
+    
+    const float t_offset = (float) frame0 * QWEN_HOP_LENGTH / QWEN_SAMPLE_RATE;
+    return align_windows(get_features, frame1 - frame0, audio_duration, t_offset, raw_words, words, t_decode_ms);
+}
+
+bool ForcedAligner::align_windows(const window_features_fn & get_features, int32_t n_mel_frames,
+                                  float audio_duration, float t_offset,
+                                  const std::vector<std::string> & raw_words,
+                                  std::vector<aligned_word> & words, int64_t & t_decode_ms) {
+    const int32_t frames_per_sec = QWEN_SAMPLE_RATE / QWEN_HOP_LENGTH;
+    const int32_t window_frames = QWEN3_FA_WINDOW_SEC * frames_per_sec;
+    
+    // Pure-punctuation words are not aligned; without them every window
+    // word yields exactly one aligned word
+    std::vector<std::string> text_words;
+    for (const auto & w : raw_words) {
+        if (!strip_word_punctuation(w).empty()) {
+            text_words.push_back(w);
+        }
+    }
+    const int32_t n_words = (int32_t) text_words.size();
+    if (n_words == 0) {
+        return true;
+    }
+    
+    std::vector<size_t> chars_after(n_words + 1, 0);  // text length from word i on
+    for (int32_t i = n_words - 1; i >= 0; --i) {
+        chars_after[i] = chars_after[i + 1] + text_words[i].size() + 1;
+    }
+    
+    std::vector<float> features;
+    std::vector<aligned_word> window_words;
+    int32_t frame0 = 0;
+    int32_t w0 = 0;
+    do {
+        const int32_t frame1 = std::min(n_mel_frames, frame0 + window_frames);
+        const bool last = frame1 == n_mel_frames;
+        
+        // The last window takes the rest of the text; others their share at
+        // the average rate of the remaining text, plus a margin
+        int32_t w1 = n_words;
+        if (!last) {
+            const float budget = (float) chars_after[w0] * (frame1 - frame0) / (n_mel_frames - frame0) *
+                                 QWEN3_FA_WINDOW_TEXT_MARGIN;
+            w1 = w0 + 1;
+            while (w1 < n_words && (float) (chars_after[w0] - chars_after[w1 + 1]) <= budget) {
+                ++w1;
+            }
+        }
+        
+        if (!get_features(frame0, frame1, features)) {
+            return false;
+        }
+        const int32_t n_audio_frames = (int32_t) (features.size() / model_.hparams.text_hidden_size);
+        const float window_start = (float) frame0 / frames_per_sec;
+        const float window_duration = last ? audio_duration - window_start : (float) (frame1 - frame0) / frames_per_sec;
+        
+        std::vector<std::string> window_text(text_words.begin() + w0, text_words.begin() + w1);
+        if (!align_words(features.data(), n_audio_frames, frame1 - frame0, window_duration,
+                         window_text, window_words, t_decode_ms)) {
+            return false;
+        }
+        
+        // Words ending inside the overlap margin may belong further on
+        size_t n_keep = window_words.size();
+        if (!last) {
+            const float cut = window_duration - QWEN3_FA_WINDOW_OVERLAP_SEC;
+            n_keep = 0;
+            while (n_keep < window_words.size() && window_words[n_keep].end <= cut) {
+                ++n_keep;
+            }
+            n_keep = std::max<size_t>(n_keep, std::min<size_t>(1, window_words.size()));
+        }
+        
+        for (size_t i = 0; i < n_keep; ++i) {
+            aligned_word aw = window_words[i];
+            aw.start += t_offset + window_start;
+            aw.end += t_offset + window_start;
+            if (!words.empty()) {
+                aw.start = std::max(aw.start, words.back().end);
+            }
+            aw.end = std::max(aw.end, aw.start);
+            words.push_back(aw);
+        }
+        
+        w0 += (int32_t) n_keep;
+        
+        if (last) {
+            break;
+        }
+        
+        // Next window from the whole second the last kept word ends in, or
+        // after this window when it aligned nothing
+        if (n_keep == 0) {
+            frame0 = frame1;
+            continue;
+        }
+        frame0 += std::max(0, (int32_t) window_words[n_keep - 1].end) * frames_per_sec;
+    } while (w0 < n_words);
+    
+    return true;
+}
+
+bool ForcedAligner::align_words(const float * audio_features, int32_t n_audio_frames, int32_t n_mel_frames,
+                                float audio_duration, const std::vector<std::string> & raw_words,
+                                std::vector<aligned_word> & words_out, int64_t & t_decode_ms) {
+    QWEN3_TIMER("align.decode");
+    words_out.clear();
     
     // Compute pad count using HF's _get_feat_extract_output_lengths formula
-    int32_t n_audio_pads = get_feat_extract_output_lengths(mel.n_len);
+    int32_t n_audio_pads = get_feat_extract_output_lengths(n_mel_frames);
     
     std::vector<std::string> words;
-    std::vector<int32_t> text_tokens = tokenize_with_timestamps(text, words, language);
+    std::vector<int32_t> text_tokens = tokenize_words(raw_words, words);
+    if (words.empty()) {
+        return true;
+    }
     
     std::vector<int32_t> input_tokens = build_input_tokens(text_tokens, n_audio_pads);
     
@@ -1721,12 +1835,12 @@ alignment_result ForcedAligner::align(const float * samples, int n_samples, cons
     int64_t t_decode_start = get_time_ms();
     std::vector<float> logits;
     if (!forward_decoder(input_tokens.data(), input_tokens.size(),
-                         audio_features.data(), n_audio_frames,
+                         audio_features, n_audio_frames,
                          audio_start_pos, logits)) {
-        result.error_msg = "Decoder forward pass failed: " + error_msg_;
-        return result;
+        error_msg_ = "Decoder forward pass failed: " + error_msg_;
+        return false;
     }
-    result.t_decode_ms = get_time_ms() - t_decode_start;
+    t_decode_ms += get_time_ms() - t_decode_start;
     
     std::vector<int32_t> timestamp_classes = extract_timestamp_classes(
         logits, input_tokens, model_.hparams.timestamp_token_id);
@@ -1752,13 +1866,39 @@ alignment_result ForcedAligner::align(const float * samples, int n_samples, cons
         aw.start = (start_idx < timestamps.size()) ? timestamps[start_idx] : 0.0f;
         aw.end = (end_idx < timestamps.size()) ? timestamps[end_idx] : audio_duration;
         
-        result.words.push_back(aw);
+        words_out.push_back(aw);
     }
     
-    result.success = true;
-    result.t_total_ms = get_time_ms() - t_total_start;
-    
-    return result;
+    return true;
+}
+
+uint64_t ForcedAligner::encoder_fingerprint() const {
+    const auto & hp = model_.hparams;
+    encoder_fingerprint_params params;
+    params.n_layers = hp.audio_encoder_layers;
+    params.d_model = hp.audio_d_model;
+    params.n_head = hp.audio_attention_heads;
+    params.n_window_infer = QWEN3_FA_N_WINDOW_INFER;
+    params.n_mel_bins = hp.audio_num_mel_bins;
+    
+    // Same tensors in the same order as AudioEncoder::compute_fingerprint
+    std::vector<const struct ggml_tensor *> layout = {
+        model_.conv2d1_w, model_.conv2d1_b, model_.conv2d2_w, model_.conv2d2_b, model_.conv2d3_w, model_.conv2d3_b,
+        model_.conv_out_w, model_.ln_post_w, model_.ln_post_b,
+        model_.proj1_w, model_.proj1_b, model_.proj2_w, model_.proj2_b,
+    };
+    std::vector<const struct ggml_tensor *> data = layout;
+    for (const auto & layer : model_.encoder_layers) {
+        append_encoder_layer_tensors(layer, layout);
+        data.push_back(layer.attn_norm_w);
+        data.push_back(layer.ffn_norm_w);
+    }
+    if (!model_.encoder_layers.empty()) {
+        const auto & first = model_.encoder_layers.front();
+        data.push_back(first.attn_qkv_w ? first.attn_qkv_w : first.attn_q_w);
+        data.push_back(model_.encoder_layers.back().ffn_down_w);
+    }
+    return qwen3_asr::encoder_fingerprint(params, layout, data);
 }
 
 void free_forced_aligner_model(forced_aligner_model & model) {
@@ -1770,11 +1910,7 @@ void free_forced_aligner_model(forced_aligner_model & model) {
         ggml_free(model.ctx);
         model.ctx = nullptr;
     }
-    if (model.mmap_addr) {
-        munmap(model.mmap_addr, model.mmap_size);
-        model.mmap_addr = nullptr;
-        model.mmap_size = 0;
-    }
+    model.file.reset();
     model.tensors.clear();
     model.encoder_layers.clear();
     model.decoder_layers.clear();
@@ -1802,8 +1938,7 @@ std::vector<int32_t> simple_tokenize(const std::string & text,
         std::string to_encode = first ? word : (" " + word);
         first = false;
         std::string bpe_str = bytes_to_bpe_string(to_encode);
-        std::vector<std::string> subwords = bpe_encode_word(bpe_str, {});
-        for (const auto & sw : subwords) {
+        for (const auto & sw : split_utf8_chars(bpe_str)) {
             auto it = tok_map.find(sw);
             if (it != tok_map.end()) {
                 tokens.push_back(it->second);
@@ -3,9 +3,16 @@
 #include "ggml.h"
 #include "ggml-backend.h"
 #include "gguf.h"
+#include "cpu_backend.h"
+#include "compute_arena.h"
+#include "mel_spectrogram.h"
+#include "bpe_tokenizer.h"
+#include "model_file.h"
 
+#include <functional>
 #include <string>
 #include <map>
+#include <memory>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -19,6 +26,13 @@ struct aligned_word {
     float end;    // End time in seconds
 };
 
+// Stretch of the audio with its transcript, e.g. an ASR/VAD segment
+struct align_segment {
+    float start;  // Start time in seconds
+    float end;    // End time in seconds
+    std::string text;
+};
+
 // Alignment result
 struct alignment_result {
     std::vector<aligned_word> words;
@@ -77,6 +91,8 @@ struct fa_encoder_layer {
     struct ggml_tensor * attn_k_b = nullptr;
     struct ggml_tensor * attn_v_w = nullptr;
     struct ggml_tensor * attn_v_b = nullptr;
+    struct ggml_tensor * attn_qkv_w = nullptr;  // fused Q/K/V rows, replaces the three
+    struct ggml_tensor * attn_qkv_b = nullptr;
     struct ggml_tensor * attn_out_w = nullptr;
     struct ggml_tensor * attn_out_b = nullptr;
     
@@ -99,6 +115,7 @@ struct fa_decoder_layer {
     struct ggml_tensor * attn_q = nullptr;
     struct ggml_tensor * attn_k = nullptr;
     struct ggml_tensor * attn_v = nullptr;
+    struct ggml_tensor * attn_qkv = nullptr;     // fused Q/K/V rows, replaces the three
     struct ggml_tensor * attn_output = nullptr;
     struct ggml_tensor * attn_q_norm = nullptr;
     struct ggml_tensor * attn_k_norm = nullptr;
@@ -106,6 +123,7 @@ struct fa_decoder_layer {
     struct ggml_tensor * ffn_norm = nullptr;
     struct ggml_tensor * ffn_gate = nullptr;
     struct ggml_tensor * ffn_up = nullptr;
+    struct ggml_tensor * ffn_gate_up = nullptr;  // fused gate/up rows, replaces the two
     struct ggml_tensor * ffn_down = nullptr;
 };
 
@@ -150,9 +168,8 @@ struct forced_aligner_model {
     struct ggml_context * ctx = nullptr;
     ggml_backend_buffer_t buffer = nullptr;
     
-    // mmap state — must outlive all tensors backed by this mapping
-    void * mmap_addr = nullptr;
-    size_t mmap_size = 0;
+    // Mapped file — must outlive all tensors backed by its mapping
+    std::shared_ptr<ModelFile> file;
     
     // Tensor name mapping
     std::map<std::string, struct ggml_tensor *> tensors;
@@ -160,39 +177,24 @@ struct forced_aligner_model {
     // Vocabulary
     std::vector<std::string> vocab;
     
-    // BPE merge ranks: "first second" -> priority (lower = merge first)
-    std::unordered_map<std::string, int> bpe_ranks;
-    // Forward mapping: vocab token string -> token ID
-    std::unordered_map<std::string, int32_t> token_to_id;
+    // Byte-level BPE encoder over vocab and the merge rules
+    BpeTokenizer tokenizer;
     
     // Korean dictionary for LTokenizer-style word splitting
     std::unordered_set<std::string> ko_dict;
 };
 
-// KV cache for decoder
-struct fa_kv_cache {
-    std::vector<struct ggml_tensor *> k_cache;
-    std::vector<struct ggml_tensor *> v_cache;
-    
-    struct ggml_context * ctx = nullptr;
-    ggml_backend_buffer_t buffer = nullptr;
-    
-    int32_t n_ctx = 0;
-    int32_t n_used = 0;
-    int32_t head_dim = 128;
-    int32_t n_kv_heads = 8;
-    int32_t n_layers = 28;
-};
-
 // ForcedAligner state
 struct forced_aligner_state {
     ggml_backend_t backend_cpu = nullptr;
     ggml_backend_t backend_gpu = nullptr;
+    ggml_threadpool_t threadpool = nullptr;
     ggml_backend_sched_t sched = nullptr;
     
     std::vector<uint8_t> compute_meta;
     
-    fa_kv_cache cache;
+    // Shared backends and scheduler, or null when this aligner owns them
+    std::shared_ptr<ComputeArena> arena;
 };
 
 // ForcedAligner class
@@ -202,7 +204,21 @@ public:
     ~ForcedAligner();
     
     // Load model from GGUF file
-    bool load_model(const std::string & model_path);
+    // cpu_params: thread count / threadpool / affinity for the CPU backend
+    // arena: backends and scheduler to share, used when it matches cpu_params
+    bool load_model(const std::string & model_path,
+                    const cpu_backend_params & cpu_params = cpu_backend_params(),
+                    const std::shared_ptr<ComputeArena> & arena = nullptr);
+    
+    // Load from an opened file (see ModelFile); its metadata is released
+    // afterwards, as nothing else loads from an aligner model
+    bool load_model(const std::shared_ptr<ModelFile> & file,
+                    const cpu_backend_params & cpu_params = cpu_backend_params(),
+                    const std::shared_ptr<ComputeArena> & arena = nullptr);
+    
+    // Weights, plus the compute buffers unless they belong to
+    // a shared arena
+    memory_usage get_memory_usage() const;
     
     alignment_result align(const std::string & audio_path, const std::string & text,
                            const std::string & language = "");
@@ -210,6 +226,29 @@ public:
     alignment_result align(const float * samples, int n_samples, const std::string & text,
                            const std::string & language = "");
     
+    // Align using a mel spectrogram already computed for the same audio
+    // (e.g. the one used for transcription); n_samples sets the duration
+    alignment_result align(const MelSpectrogram & mel, int n_samples, const std::string & text,
+                           const std::string & language = "");
+    
+    // Align using audio encoder output computed elsewhere, skipping this
+    // model's encoder. Only valid when that encoder has identical weights
+    // (same encoder_fingerprint()); n_mel_frames is its mel input length.
+    alignment_result align_encoded(const float * audio_features, int32_t n_audio_frames,
+                                   int32_t n_mel_frames, float audio_duration,
+                                   const std::string & text, const std::string & language = "");
+    
+    // Hash of the audio encoder hparams, layout and sampled weights,
+    // comparable with AudioEncoder::weight_fingerprint()
+    uint64_t encoder_fingerprint() const;
+    
+    // Align each segment's text within its own stretch of the audio (padded
+    // slightly) and merge the words into one monotonic timeline. Segments
+    // longer than the alignment window are split further, like align().
+    alignment_result align_segments(const MelSpectrogram & mel, int n_samples,
+                                    const std::vector<align_segment> & segments,
+                                    const std::string & language = "");
+    
     // Get error message
     const std::string & get_error() const { return error_msg_; }
     
@@ -226,26 +265,52 @@ public:
     bool load_korean_dict(const std::string & dict_path);
     
 private:
+    // Encoder output for mel frames [frame0, frame1) of the range being aligned
+    using window_features_fn = std::function<bool(int32_t frame0, int32_t frame1, std::vector<float> & features)>;
+    
+    // Words of the text as aligned (Korean dictionary splitting, else whitespace)
+    std::vector<std::string> split_words(const std::string & text, const std::string & language);
+    
+    // BPE tokens with two timestamp tokens per word; words receives the kept
+    // raw words (pure punctuation is dropped)
+    std::vector<int32_t> tokenize_words(const std::vector<std::string> & raw_words,
+                                        std::vector<std::string> & words);
+    
+    // One decoder pass: align raw_words against encoder output covering
+    // n_mel_frames mel frames; times are relative to the first frame
+    bool align_words(const float * audio_features, int32_t n_audio_frames, int32_t n_mel_frames,
+                     float audio_duration, const std::vector<std::string> & raw_words,
+                     std::vector<aligned_word> & words, int64_t & t_decode_ms);
+    
+    // Align raw_words over n_mel_frames frames in windows of at most
+    // QWEN3_FA_WINDOW_SEC: each window gets the words expected to fit (by
+    // speaking rate), keeps those ending before its overlap margin, and the
+    // next window starts at the last kept word. Appends to words, offset by
+    // t_offset seconds.
+    bool align_windows(const window_features_fn & get_features, int32_t n_mel_frames,
+                       float audio_duration, float t_offset,
+                       const std::vector<std::string> & raw_words,
+                       std::vector<aligned_word> & words, int64_t & t_decode_ms);
+    
+    // align_windows over mel frames [frame0, frame1), encoding each window
+    bool align_mel_range(const MelSpectrogram & mel, int32_t frame0, int32_t frame1,
+                         float audio_duration, const std::vector<std::string> & raw_words,
+                         std::vector<aligned_word> & words, int64_t & t_encode_ms, int64_t & t_decode_ms);
+
     // Load model components
     bool parse_hparams(struct gguf_context * ctx);
     bool create_tensors(struct gguf_context * ctx);
-    bool load_tensor_data(const std::string & path, struct gguf_context * ctx);
+    bool load_tensor_data(const std::shared_ptr<ModelFile> & file, struct gguf_context * ctx, ggml_backend_dev_t gpu_dev);
     bool load_vocab(struct gguf_context * ctx);
     
-    // Initialize KV cache
-    bool init_kv_cache(int32_t n_ctx);
-    void clear_kv_cache();
-    void free_kv_cache();
     
     // Audio encoding
     bool encode_audio(const float * mel_data, int n_mel, int n_frames,
                       std::vector<float> & output);
     
-    // Build computation graph for decoder forward pass
-    struct ggml_cgraph * build_decoder_graph(
-        const int32_t * tokens, int32_t n_tokens,
-        const float * audio_embd, int32_t n_audio,
-        int32_t audio_start_pos);
+    // Build computation graph for decoder forward pass; with n_audio > 0
+    // the prompt embeddings come from build_injected_embeddings()
+    struct ggml_cgraph * build_decoder_graph(int32_t n_tokens, int32_t n_audio);
     
     // Forward pass through decoder
     bool forward_decoder(
@@ -273,6 +338,9 @@ private:
     // Find audio start position in token sequence
     int32_t find_audio_start_pos(const std::vector<int32_t> & tokens);
     
+    // Graph meta buffer: the arena's when shared
+    std::vector<uint8_t> & compute_meta() { return state_.arena ? state_.arena->get_meta() : state_.compute_meta; }
+    
     // Model and state
     forced_aligner_model model_;
     forced_aligner_state state_;
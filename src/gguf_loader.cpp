@@ -1,12 +1,9 @@
 #include "gguf_loader.h"
+#include "cpu_backend.h"
 
 #include <cstdio>
 #include <cstring>
 #include <fstream>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <unistd.h>
 
 namespace qwen3_asr {
 
@@ -14,41 +11,36 @@ GGUFLoader::GGUFLoader() = default;
 
 GGUFLoader::~GGUFLoader() = default;
 
-bool GGUFLoader::load(const std::string & path, audio_encoder_model & model) {
-    struct ggml_context * meta_ctx = nullptr;
-    struct gguf_init_params params = {
-        /*.no_alloc =*/ true,
-        /*.ctx      =*/ &meta_ctx,
-    };
-    
-    struct gguf_context * ctx = gguf_init_from_file(path.c_str(), params);
+bool GGUFLoader::load(const std::string & path, audio_encoder_model & model, ggml_backend_dev_t gpu_dev) {
+    auto file = std::make_shared<ModelFile>();
+    if (!file->open(path)) {
+        error_msg_ = file->get_error();
+        return false;
+    }
+    return load(file, model, gpu_dev);
+}
+
+bool GGUFLoader::load(const std::shared_ptr<ModelFile> & file, audio_encoder_model & model,
+                      ggml_backend_dev_t gpu_dev) {
+    struct gguf_context * ctx = file->get_gguf();
     if (!ctx) {
-        error_msg_ = "Failed to open GGUF file: " + path;
+        error_msg_ = "GGUF metadata already released: " + file->get_path();
         return false;
     }
     
     if (!parse_hparams(ctx, model)) {
-        gguf_free(ctx);
-        if (meta_ctx) ggml_free(meta_ctx);
         return false;
     }
     
     if (!create_tensors(ctx, model)) {
-        gguf_free(ctx);
-        if (meta_ctx) ggml_free(meta_ctx);
         return false;
     }
     
-    if (!load_tensor_data(path, ctx, model)) {
+    if (!load_tensor_data(file, ctx, model, gpu_dev)) {
         free_model(model);
-        gguf_free(ctx);
-        if (meta_ctx) ggml_free(meta_ctx);
         return false;
     }
     
-    gguf_free(ctx);
-    if (meta_ctx) ggml_free(meta_ctx);
-    
     return true;
 }
 
@@ -146,6 +138,13 @@ bool GGUFLoader::create_tensors(struct gguf_context * ctx, audio_encoder_model &
             ne[0] = model.hparams.d_model;
             ne[1] = model.hparams.d_model;
             n_dims = 2;
+        } else if (strstr(name, "attn_qkv.weight")) {
+            ne[0] = model.hparams.d_model;
+            ne[1] = 3 * model.hparams.d_model;
+            n_dims = 2;
+        } else if (strstr(name, "attn_qkv.bias")) {
+            ne[0] = 3 * model.hparams.d_model;
+            n_dims = 1;
         } else if (strstr(name, "attn_q.bias") || strstr(name, "attn_k.bias") || 
                    strstr(name, "attn_v.bias") || strstr(name, "attn_out.bias") ||
                    strstr(name, "attn_norm.weight") || strstr(name, "attn_norm.bias")) {
@@ -235,6 +234,8 @@ bool GGUFLoader::create_tensors(struct gguf_context * ctx, audio_encoder_model &
                 else if (strstr(name, "attn_k.bias")) layer.attn_k_b = tensor;
                 else if (strstr(name, "attn_v.weight")) layer.attn_v_w = tensor;
                 else if (strstr(name, "attn_v.bias")) layer.attn_v_b = tensor;
+                else if (strstr(name, "attn_qkv.weight")) layer.attn_qkv_w = tensor;
+                else if (strstr(name, "attn_qkv.bias")) layer.attn_qkv_b = tensor;
                 else if (strstr(name, "attn_out.weight")) layer.attn_out_w = tensor;
                 else if (strstr(name, "attn_out.bias")) layer.attn_out_b = tensor;
                 else if (strstr(name, "attn_norm.weight")) layer.attn_norm_w = tensor;
@@ -252,71 +253,26 @@ bool GGUFLoader::create_tensors(struct gguf_context * ctx, audio_encoder_model &
     return true;
 }
 
-bool GGUFLoader::load_tensor_data(const std::string & path, struct gguf_context * ctx, 
-                                   audio_encoder_model & model) {
-    int fd = open(path.c_str(), O_RDONLY);
-    if (fd < 0) {
-        error_msg_ = "Failed to open file for mmap: " + path;
-        return false;
-    }
-    
-    struct stat st;
-    if (fstat(fd, &st) != 0) {
-        error_msg_ = "Failed to stat file: " + path;
-        close(fd);
-        return false;
-    }
-    
-    void * mmap_addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
-    
-    if (mmap_addr == MAP_FAILED) {
-        error_msg_ = "Failed to mmap file: " + path;
-        return false;
-    }
-    
-    model.mmap_addr = mmap_addr;
-    model.mmap_size = st.st_size;
-    
-    const size_t data_offset = gguf_get_data_offset(ctx);
-    const size_t total_size = st.st_size - data_offset;
-    uint8_t * data_base = (uint8_t *)mmap_addr + data_offset;
-    
-    // Find largest tensor for max_tensor_size hint
+bool GGUFLoader::load_tensor_data(const std::shared_ptr<ModelFile> & file, struct gguf_context * ctx,
+                                   audio_encoder_model & model, ggml_backend_dev_t gpu_dev) {
     const int64_t n_tensors = gguf_get_n_tensors(ctx);
-    size_t max_tensor_size = 0;
+    std::vector<struct ggml_tensor *> tensors;
+    std::vector<size_t> offsets;
     for (int64_t i = 0; i < n_tensors; ++i) {
-        size_t sz = gguf_get_tensor_size(ctx, i);
-        if (sz > max_tensor_size) max_tensor_size = sz;
-    }
-
-    // Try GPU device buffer (zero-copy on Apple Silicon unified memory)
-    ggml_backend_dev_t gpu_dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_GPU);
-    if (gpu_dev) {
-        model.buffer = ggml_backend_dev_buffer_from_host_ptr(gpu_dev, data_base, total_size, max_tensor_size);
-    }
-    if (!model.buffer) {
-        model.buffer = ggml_backend_cpu_buffer_from_ptr(data_base, total_size);
+        auto it = model.tensors.find(gguf_get_tensor_name(ctx, i));
+        if (it == model.tensors.end()) continue;
+        
+        tensors.push_back(it->second);
+        offsets.push_back(gguf_get_tensor_offset(ctx, i));
     }
+    
+    model.buffer = map_weights(gpu_dev, file->get_data(), file->get_data_size(), file->get_max_tensor_size(),
+                               tensors, offsets);
     if (!model.buffer) {
         error_msg_ = "Failed to create buffer from mmap";
-        munmap(mmap_addr, st.st_size);
-        model.mmap_addr = nullptr;
-        model.mmap_size = 0;
         return false;
     }
-    
-    for (int64_t i = 0; i < n_tensors; ++i) {
-        const char * name = gguf_get_tensor_name(ctx, i);
-        size_t offset = gguf_get_tensor_offset(ctx, i);
-        
-        auto it = model.tensors.find(name);
-        if (it == model.tensors.end()) continue;
-        
-        struct ggml_tensor * tensor = it->second;
-        tensor->buffer = model.buffer;
-        tensor->data = data_base + offset;
-    }
+    model.file = file;
     
     return true;
 }
@@ -326,17 +282,60 @@ void free_model(audio_encoder_model & model) {
         ggml_backend_buffer_free(model.buffer);
         model.buffer = nullptr;
     }
+    for (ggml_backend_buffer_t buffer : model.repack_buffers) {
+        ggml_backend_buffer_free(buffer);
+    }
+    model.repack_buffers.clear();
     if (model.ctx) {
         ggml_free(model.ctx);
         model.ctx = nullptr;
     }
-    if (model.mmap_addr) {
-        munmap(model.mmap_addr, model.mmap_size);
-        model.mmap_addr = nullptr;
-        model.mmap_size = 0;
-    }
+    model.file.reset();
     model.tensors.clear();
     model.layers.clear();
 }
 
+uint64_t encoder_fingerprint(const encoder_fingerprint_params & params,
+                             const std::vector<const struct ggml_tensor *> & layout,
+                             const std::vector<const struct ggml_tensor *> & data) {
+    uint64_t h = 14695981039346656037ULL;
+    auto mix = [&h](const void * bytes, size_t n) {
+        const uint8_t * p = static_cast<const uint8_t *>(bytes);
+        for (size_t i = 0; i < n; ++i) {
+            h ^= p[i];
+            h *= 1099511628211ULL;
+        }
+    };
+    // Type and shape; false for a null or unloaded tensor
+    auto mix_shape = [&mix](const struct ggml_tensor * t) {
+        if (!t || !t->buffer) {
+            const uint8_t marker = 0xff;
+            mix(&marker, 1);
+            return false;
+        }
+        const int32_t type = t->type;
+        mix(&type, sizeof(type));
+        mix(t->ne, sizeof(t->ne));
+        return true;
+    };
+    
+    for (int32_t v : { params.n_layers, params.d_model, params.n_head, params.n_window_infer, params.n_mel_bins }) {
+        mix(&v, sizeof(v));
+    }
+    for (const struct ggml_tensor * t : layout) {
+        mix_shape(t);
+    }
+    
+    std::vector<uint8_t> buf;
+    for (const struct ggml_tensor * t : data) {
+        if (!mix_shape(t)) {
+            continue;
+        }
+        buf.resize(ggml_nbytes(t));
+        ggml_backend_tensor_get(t, buf.data(), 0, buf.size());
+        mix(buf.data(), buf.size());
+    }
+    return h;
+}
+
 } // namespace qwen3_asr
@@ -3,6 +3,7 @@
 #include "ggml.h"
 #include "ggml-backend.h"
 #include "gguf.h"
+#include "model_file.h"
 
 #include <string>
 #include <map>
@@ -43,6 +44,8 @@ struct encoder_layer {
     struct ggml_tensor * attn_k_b = nullptr;
     struct ggml_tensor * attn_v_w = nullptr;
     struct ggml_tensor * attn_v_b = nullptr;
+    struct ggml_tensor * attn_qkv_w = nullptr;  // fused Q/K/V rows, replaces the three
+    struct ggml_tensor * attn_qkv_b = nullptr;
     struct ggml_tensor * attn_out_w = nullptr;
     struct ggml_tensor * attn_out_b = nullptr;
     
@@ -93,9 +96,11 @@ struct audio_encoder_model {
     // Backend buffer for weights
     ggml_backend_buffer_t buffer = nullptr;
     
-    // mmap state — must outlive all tensors backed by this mapping
-    void * mmap_addr = nullptr;
-    size_t mmap_size = 0;
+    // Weights moved into repacked CPU layouts (cpu_backend_params::repack_weights)
+    std::vector<ggml_backend_buffer_t> repack_buffers;
+    
+    // Mapped file — must outlive all tensors backed by its mapping
+    std::shared_ptr<ModelFile> file;
     
     // Tensor name to tensor mapping
     std::map<std::string, struct ggml_tensor *> tensors;
@@ -107,8 +112,13 @@ public:
     GGUFLoader();
     ~GGUFLoader();
     
-    // Load model from GGUF file
-    bool load(const std::string & path, audio_encoder_model & model);
+    // Load model from GGUF file; the weights are placed for gpu_dev
+    // (nullptr = CPU), see map_weights()
+    bool load(const std::string & path, audio_encoder_model & model, ggml_backend_dev_t gpu_dev = nullptr);
+    
+    // Load from an opened file, e.g. the one the text decoder loads from too
+    bool load(const std::shared_ptr<ModelFile> & file, audio_encoder_model & model,
+              ggml_backend_dev_t gpu_dev = nullptr);
     
     // Get error message if load failed
     const std::string & get_error() const { return error_msg_; }
@@ -120,9 +130,9 @@ private:
     // Create tensor structures
     bool create_tensors(struct gguf_context * ctx, audio_encoder_model & model);
     
-    // Load tensor data from file
-    bool load_tensor_data(const std::string & path, struct gguf_context * ctx, 
-                          audio_encoder_model & model);
+    // Point the tensors at their data in the file's mapping
+    bool load_tensor_data(const std::shared_ptr<ModelFile> & file, struct gguf_context * ctx,
+                          audio_encoder_model & model, ggml_backend_dev_t gpu_dev);
     
     std::string error_msg_;
 };
@@ -130,4 +140,36 @@ private:
 // Free model resources
 void free_model(audio_encoder_model & model);
 
+// Hyperparameters an audio encoder's output depends on, hashed by
+// encoder_fingerprint; the ASR encoder and the forced aligner fill them
+// from their own hparams
+struct encoder_fingerprint_params {
+    int32_t n_layers = 0;
+    int32_t d_model = 0;
+    int32_t n_head = 0;
+    int32_t n_window_infer = 0;
+    int32_t n_mel_bins = 0;
+};
+
+// Weights of one encoder layer (encoder_layer or fa_encoder_layer), in a
+// fixed order for encoder_fingerprint
+template <typename Layer>
+void append_encoder_layer_tensors(const Layer & layer, std::vector<const struct ggml_tensor *> & tensors) {
+    tensors.insert(tensors.end(), {
+        layer.attn_q_w, layer.attn_q_b, layer.attn_k_w, layer.attn_k_b, layer.attn_v_w, layer.attn_v_b,
+        layer.attn_qkv_w, layer.attn_qkv_b, layer.attn_out_w, layer.attn_out_b,
+        layer.attn_norm_w, layer.attn_norm_b, layer.ffn_up_w, layer.ffn_up_b,
+        layer.ffn_down_w, layer.ffn_down_b, layer.ffn_norm_w, layer.ffn_norm_b,
+    });
+}
+
+// FNV-1a hash over the hyperparameters, the type and shape of every tensor
+// in layout, and the type, shape and data of each tensor in data (null
+// entries hash as a marker). Used to detect two models whose encoders
+// compute the same function: the layout pins down the whole architecture,
+// while only a sample of the weights is read back, to keep it cheap.
+uint64_t encoder_fingerprint(const encoder_fingerprint_params & params,
+                             const std::vector<const struct ggml_tensor *> & layout,
+                             const std::vector<const struct ggml_tensor *> & data);
+
 } // namespace qwen3_asr
@@ -0,0 +1,182 @@
+#include "imatrix.h"
+#include "timing.h"
+
+#include "ggml-backend.h"
+
+#include <cstdio>
+
+namespace qwen3_asr {
+
+ImatrixCollector::~ImatrixCollector() {
+    stop();
+}
+
+void ImatrixCollector::start() {
+    graph_observer & obs = graph_observer::instance();
+    obs.callback = eval_callback;
+    obs.user_data = this;
+    active_ = true;
+}
+
+void ImatrixCollector::stop() {
+    if (!active_) {
+        return;
+    }
+    graph_observer & obs = graph_observer::instance();
+    if (obs.user_data == this) {
+        obs.callback = nullptr;
+        obs.user_data = nullptr;
+    }
+    active_ = false;
+}
+
+size_t ImatrixCollector::n_entries() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_.size();
+}
+
+// Weights are named leaf tensors; views of KV caches and activations are not
+static bool is_weight_matmul(const struct ggml_tensor * t) {
+    if (t->op != GGML_OP_MUL_MAT) {
+        return false;
+    }
+    const struct ggml_tensor * w = t->src[0];
+    const struct ggml_tensor * x = t->src[1];
+    return w->op == GGML_OP_NONE && w->name[0] != '\0' && x->type == GGML_TYPE_F32 &&
+           x->ne[0] == w->ne[0];
+}
+
+bool ImatrixCollector::eval_callback(struct ggml_tensor * t, bool ask, void * user_data) {
+    if (!is_weight_matmul(t)) {
+        return false;
+    }
+    if (!ask) {
+        static_cast<ImatrixCollector *>(user_data)->accumulate(t->src[0], t->src[1]);
+    }
+    return true;
+}
+
+void ImatrixCollector::accumulate(const struct ggml_tensor * weight, const struct ggml_tensor * act) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    const int64_t n_cols = act->ne[0];
+    const uint8_t * base = nullptr;
+    if (act->buffer && !ggml_backend_buffer_is_host(act->buffer)) {
+        if (!ggml_is_contiguous(act)) {
+            return;
+        }
+        host_buf_.resize(ggml_nelements(act));
+        ggml_backend_tensor_get(act, host_buf_.data(), 0, ggml_nbytes(act));
+        base = reinterpret_cast<const uint8_t *>(host_buf_.data());
+    } else {
+        base = static_cast<const uint8_t *>(act->data);
+    }
+    if (!base) {
+        return;
+    }
+    const bool packed = base != static_cast<const uint8_t *>(act->data);
+
+    entry & e = stats_[weight->name];
+    if (e.sum_sq.empty()) {
+        e.sum_sq.assign(n_cols, 0.0);
+    } else if ((int64_t)e.sum_sq.size() != n_cols) {
+        return;
+    }
+
+    for (int64_t i3 = 0; i3 < act->ne[3]; ++i3) {
+        for (int64_t i2 = 0; i2 < act->ne[2]; ++i2) {
+            for (int64_t i1 = 0; i1 < act->ne[1]; ++i1) {
+                const float * row = packed
+                    ? reinterpret_cast<const float *>(base) + ((i3 * act->ne[2] + i2) * act->ne[1] + i1) * n_cols
+                    : reinterpret_cast<const float *>(base + i1 * act->nb[1] + i2 * act->nb[2] + i3 * act->nb[3]);
+                for (int64_t j = 0; j < n_cols; ++j) {
+                    e.sum_sq[j] += (double)row[j] * row[j];
+                }
+            }
+        }
+    }
+    e.n_rows += act->ne[1] * act->ne[2] * act->ne[3];
+    e.n_calls += 1;
+}
+
+bool ImatrixCollector::save(const std::string & path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    FILE * out = fopen(path.c_str(), "wb");
+    if (!out) {
+        error_msg_ = "Cannot open imatrix file for writing: " + path;
+        return false;
+    }
+
+    // Values are stored pre-multiplied by the call count, which readers
+    // divide out again
+    const int32_t n_entries = (int32_t)stats_.size();
+    fwrite(&n_entries, sizeof(n_entries), 1, out);
+    std::vector<float> values;
+    for (const auto & kv : stats_) {
+        const entry & e = kv.second;
+        const int32_t len = (int32_t)kv.first.size();
+        const int32_t n_val = (int32_t)e.sum_sq.size();
+        fwrite(&len, sizeof(len), 1, out);
+        fwrite(kv.first.data(), 1, len, out);
+        fwrite(&e.n_calls, sizeof(e.n_calls), 1, out);
+        fwrite(&n_val, sizeof(n_val), 1, out);
+        values.resize(n_val);
+        for (int32_t j = 0; j < n_val; ++j) {
+            values[j] = e.n_rows > 0 ? (float)(e.sum_sq[j] / e.n_rows * e.n_calls) : 0.0f;
+        }
+        fwrite(values.data(), sizeof(float), n_val, out);
+    }
+
+    const bool ok = ferror(out) == 0;
+    fclose(out);
+    if (!ok) {
+        error_msg_ = "Failed to write imatrix file: " + path;
+    }
+    return ok;
+}
+
+bool load_imatrix(const std::string & path, imatrix_data & imatrix) {
+    FILE * in = fopen(path.c_str(), "rb");
+    if (!in) {
+        fprintf(stderr, "Error: Cannot open imatrix file: %s\n", path.c_str());
+        return false;
+    }
+
+    imatrix.clear();
+    int32_t n_entries = 0;
+    bool ok = fread(&n_entries, sizeof(n_entries), 1, in) == 1 && n_entries >= 0;
+    for (int32_t i = 0; ok && i < n_entries; ++i) {
+        int32_t len = 0;
+        int32_t n_calls = 0;
+        int32_t n_val = 0;
+        std::string name;
+        ok = fread(&len, sizeof(len), 1, in) == 1 && len > 0 && len < 4096;
+        if (ok) {
+            name.resize(len);
+            ok = fread(&name[0], 1, len, in) == (size_t)len &&
+                 fread(&n_calls, sizeof(n_calls), 1, in) == 1 &&
+                 fread(&n_val, sizeof(n_val), 1, in) == 1 && n_val > 0;
+        }
+        if (ok) {
+            std::vector<float> & values = imatrix[name];
+            values.resize(n_val);
+            ok = fread(values.data(), sizeof(float), n_val, in) == (size_t)n_val;
+            if (n_calls > 0) {
+                for (float & v : values) {
+                    v /= n_calls;
+                }
+            }
+        }
+    }
+    fclose(in);
+
+    if (!ok) {
+        fprintf(stderr, "Error: Malformed imatrix file: %s\n", path.c_str());
+        imatrix.clear();
+        return false;
+    }
+    return true;
+}
+
+} // namespace qwen3_asr
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "ggml.h"
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace qwen3_asr {
+
+// Importance matrix: per weight tensor, the mean of the squared input
+// activations of each column (ne[0] values), as used by ggml_quantize_chunk
+using imatrix_data = std::map<std::string, std::vector<float>>;
+
+// Collects an importance matrix over real inference. While started, every
+// ggml_mul_mat whose first operand is a named weight tensor is observed
+// through sched_graph_compute, and the squares of its input activations are
+// accumulated per column. Collection splits graphs at every matmul, so it
+// runs markedly slower than plain inference.
+class ImatrixCollector {
+public:
+    ImatrixCollector() = default;
+    ~ImatrixCollector();
+
+    ImatrixCollector(const ImatrixCollector &) = delete;
+    ImatrixCollector & operator=(const ImatrixCollector &) = delete;
+
+    void start();
+    void stop();
+
+    // Write the llama.cpp imatrix .dat format (readable by its tools)
+    bool save(const std::string & path);
+
+    size_t n_entries() const;
+
+    const std::string & get_error() const { return error_msg_; }
+
+private:
+    static bool eval_callback(struct ggml_tensor * t, bool ask, void * user_data);
+    void accumulate(const struct ggml_tensor * weight, const struct ggml_tensor * act);
+
+    struct entry {
+        std::vector<double> sum_sq;  // [ne[0]]
+        int64_t n_rows = 0;
+        int32_t n_calls = 0;
+    };
+
+    std::map<std::string, entry> stats_;
+    std::vector<float> host_buf_;
+    mutable std::mutex mutex_;
+    bool active_ = false;
+    std::string error_msg_;
+};
+
+// Load an imatrix .dat file (as written by ImatrixCollector::save or
+// llama.cpp's llama-imatrix); values are normalized per call
+bool load_imatrix(const std::string & path, imatrix_data & imatrix);
+
+} // namespace qwen3_asr
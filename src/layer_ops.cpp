@@ -0,0 +1,41 @@
+#include "layer_ops.h"
+
+namespace qwen3_asr {
+
+static struct ggml_tensor * add_bias(struct ggml_context * ctx, struct ggml_tensor * x,
+                                     struct ggml_tensor * b) {
+    return b ? ggml_add(ctx, x, b) : x;
+}
+
+qkv_proj build_qkv(struct ggml_context * ctx, struct ggml_tensor * cur, const qkv_weights & w,
+                   int64_t head_dim, int64_t n_head, int64_t n_kv_head) {
+    const int64_t n_tokens = cur->ne[1];
+    qkv_proj p;
+    
+    if (!w.qkv_w) {
+        p.q = ggml_reshape_3d(ctx, add_bias(ctx, ggml_mul_mat(ctx, w.q_w, cur), w.q_b), head_dim, n_head, n_tokens);
+        p.k = ggml_reshape_3d(ctx, add_bias(ctx, ggml_mul_mat(ctx, w.k_w, cur), w.k_b), head_dim, n_kv_head, n_tokens);
+        p.v = ggml_reshape_3d(ctx, add_bias(ctx, ggml_mul_mat(ctx, w.v_w, cur), w.v_b), head_dim, n_kv_head, n_tokens);
+        return p;
+    }
+    
+    struct ggml_tensor * qkv = add_bias(ctx, ggml_mul_mat(ctx, w.qkv_w, cur), w.qkv_b);
+    const size_t nb_head = head_dim * ggml_element_size(qkv);
+    p.q = ggml_view_3d(ctx, qkv, head_dim, n_head, n_tokens, nb_head, qkv->nb[1], 0);
+    p.k = ggml_view_3d(ctx, qkv, head_dim, n_kv_head, n_tokens, nb_head, qkv->nb[1],
+                       nb_head * n_head);
+    p.v = ggml_view_3d(ctx, qkv, head_dim, n_kv_head, n_tokens, nb_head, qkv->nb[1],
+                       nb_head * (n_head + n_kv_head));
+    return p;
+}
+
+struct ggml_tensor * build_swiglu_in(struct ggml_context * ctx, struct ggml_tensor * cur,
+                                     struct ggml_tensor * gate_up, struct ggml_tensor * gate,
+                                     struct ggml_tensor * up) {
+    if (gate_up) {
+        return ggml_swiglu(ctx, ggml_mul_mat(ctx, gate_up, cur));
+    }
+    return ggml_mul(ctx, ggml_silu(ctx, ggml_mul_mat(ctx, gate, cur)), ggml_mul_mat(ctx, up, cur));
+}
+
+} // namespace qwen3_asr
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "ggml.h"
+
+#include <cstdint>
+
+namespace qwen3_asr {
+
+// Attention input projection weights of one layer: the fused attn_qkv
+// tensor (rows Q, then K, then V) written by convert_hf_to_gguf.py --fuse
+// or general-quantize --fuse, or the three separate ones. Biases are
+// optional; a fused bias has zeros where a part had none.
+struct qkv_weights {
+    struct ggml_tensor * qkv_w = nullptr;
+    struct ggml_tensor * qkv_b = nullptr;
+    struct ggml_tensor * q_w = nullptr;
+    struct ggml_tensor * q_b = nullptr;
+    struct ggml_tensor * k_w = nullptr;
+    struct ggml_tensor * k_b = nullptr;
+    struct ggml_tensor * v_w = nullptr;
+    struct ggml_tensor * v_b = nullptr;
+    
+    bool complete() const { return qkv_w || (q_w && k_w && v_w); }
+};
+
+// Q [head_dim, n_head, n_tokens] and K, V [head_dim, n_kv_head, n_tokens]
+struct qkv_proj {
+    struct ggml_tensor * q = nullptr;
+    struct ggml_tensor * k = nullptr;
+    struct ggml_tensor * v = nullptr;
+};
+
+// Q, K and V of cur [n_embd, n_tokens]. A fused weight takes one matmul
+// and one bias add, and the results are views into it whose token rows
+// are a fused row apart (not contiguous); otherwise three projections,
+// reshaped. Consumers index them through nb[], never by reshape.
+qkv_proj build_qkv(struct ggml_context * ctx, struct ggml_tensor * cur, const qkv_weights & w,
+                   int64_t head_dim, int64_t n_head, int64_t n_kv_head);
+
+// silu(gate(cur)) * up(cur): one matmul and ggml_swiglu over a fused
+// ffn_gate_up weight (rows gate, then up), else the two weights
+struct ggml_tensor * build_swiglu_in(struct ggml_context * ctx, struct ggml_tensor * cur,
+                                     struct ggml_tensor * gate_up, struct ggml_tensor * gate,
+                                     struct ggml_tensor * up);
+
+} // namespace qwen3_asr
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Repetition loops: a period of up to MAX_PERIOD tokens repeated at least
+// MIN_REPEATS times over at least MIN_TOKENS tokens, or a WINDOW of recent
+// tokens with more than MAX_RATIO trigrams per distinct trigram
+#define QWEN3_ASR_LOOP_MAX_PERIOD 32
+#define QWEN3_ASR_LOOP_MIN_REPEATS 3
+#define QWEN3_ASR_LOOP_MIN_TOKENS 32
+#define QWEN3_ASR_LOOP_WINDOW 96
+#define QWEN3_ASR_LOOP_MAX_RATIO 3.0f
+
+namespace qwen3_asr {
+
+// Runaway-generation check, fed one token at a time. run_[p] counts the
+// trailing tokens equal to the token p positions earlier, so an exact loop
+// of period p is found in O(MAX_PERIOD) per token; near-loops that vary a
+// little are caught by the distinct-trigram ratio of the recent window (a
+// cheap stand-in for a compression-ratio test).
+class loop_detector {
+public:
+    // tokens[0, n) is the output so far, tokens[n - 1] the newest token;
+    // true when the output has turned into a loop
+    bool push(const int32_t * tokens, int32_t n) {
+        const int32_t tok = tokens[n - 1];
+        for (int32_t p = 1; p <= QWEN3_ASR_LOOP_MAX_PERIOD; ++p) {
+            run_[p] = (n - 1 - p >= 0 && tokens[n - 1 - p] == tok) ? run_[p] + 1 : 0;
+            const int32_t span = run_[p] + p;
+            if (span >= QWEN3_ASR_LOOP_MIN_TOKENS && span >= QWEN3_ASR_LOOP_MIN_REPEATS * p) {
+                n_trim_ = run_[p];
+                return true;
+            }
+        }
+        
+        if (n >= QWEN3_ASR_LOOP_WINDOW && n % 16 == 0) {
+            trigrams_.clear();
+            for (int32_t i = n - QWEN3_ASR_LOOP_WINDOW; i + 2 < n; ++i) {
+                trigrams_.push_back(((uint64_t)(uint32_t)tokens[i] << 42) ^
+                                    ((uint64_t)(uint32_t)tokens[i + 1] << 21) ^ (uint32_t)tokens[i + 2]);
+            }
+            std::sort(trigrams_.begin(), trigrams_.end());
+            const size_t n_distinct = std::unique(trigrams_.begin(), trigrams_.end()) - trigrams_.begin();
+            if ((float)(QWEN3_ASR_LOOP_WINDOW - 2) > QWEN3_ASR_LOOP_MAX_RATIO * n_distinct) {
+                n_trim_ = 0;
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // Tokens to drop from the end so that one copy of the repeated unit is left
+    int32_t n_trim() const { return n_trim_; }
+    
+private:
+    int32_t run_[QWEN3_ASR_LOOP_MAX_PERIOD + 1] = {};
+    int32_t n_trim_ = 0;
+    std::vector<uint64_t> trigrams_;
+};
+
+} // namespace qwen3_asr
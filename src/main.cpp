@@ -1,6 +1,8 @@
 #include "qwen3_asr.h"
 #include "forced_aligner.h"
 #include "timing.h"
+#include "imatrix.h"
+#include "server.h"
 #include "ggml.h"
 
 #include <cstdio>
@@ -8,8 +10,20 @@
 #include <cstring>
 #include <algorithm>
 #include <cctype>
+#include <climits>
 #include <string>
 #include <fstream>
+#include <vector>
+#include <chrono>
+#include <glob.h>
+#include <memory>
+#include <csignal>
+
+// Where one component runs: the CPU, or a GPU by index (-1 = the first)
+struct device_choice {
+    bool use_gpu = true;
+    int32_t gpu_index = -1;
+};
 
 struct cli_params {
     std::string model_path = "models/qwen3-asr-0.6b-f16.gguf";
@@ -19,13 +33,54 @@ struct cli_params {
     std::string language = "";
     std::string align_text = "";
     int32_t max_tokens = 1024;
+    float max_tokens_per_sec = 15.0f;
+    bool stop_loops = true;
     int32_t n_threads = 4;
+    std::vector<int32_t> cpu_ids;
+    bool use_threadpool = false;
+    device_choice encoder_device;
+    device_choice decoder_device;
+    device_choice aligner_device;
+    std::vector<int32_t> decoder_split;
+    int32_t decoder_threads = 0;
+    int32_t encoder_workers = 1;
+    int32_t share_compute = -1;  // -1: unless pipelined (see make_cpu_params)
+    bool repack_weights = false;
+    bool repack_cache = false;
+    qwen3_asr::model_file_params file_params;
+    bool print_memory = false;
     bool print_progress = false;
     bool print_timing = true;
     bool print_tokens = false;
     bool align_mode = false;
     bool transcribe_align_mode = false;
     bool profile = false;
+    int32_t stream_step_ms = 0;
+    bool detect_language = false;
+    float lid_sec = 15.0f;
+    int32_t lid_candidates = 5;
+    std::string file_list = "";
+    int32_t n_workers = 2;
+    int32_t n_decode_batch = 1;
+    enum ggml_type kv_type = GGML_TYPE_F16;
+    bool f16_audio = false;
+    int32_t n_draft = 0;
+    int32_t n_beams = 1;
+    float length_penalty = 1.0f;
+    bool use_vad = false;
+    bool gpu_mel = false;
+    std::string feature_cache_dir = "";
+    int32_t feature_cache_mb = 0;
+    std::string trace_path = "";
+    bool trace_graph = false;
+    std::string imatrix_out_path = "";
+    bool server_mode = false;
+    std::string server_host = "127.0.0.1";
+    int32_t server_port = 8080;
+    std::string server_socket = "";
+    int32_t server_http_threads = 4;
+    int32_t server_max_queue = 64;
+    int32_t server_max_batch = 8;
 };
 
 static void print_usage(const char * prog) {
@@ -33,15 +88,71 @@ static void print_usage(const char * prog) {
     fprintf(stderr, "\n");
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -m, --model <path>     Path to GGUF model (default: models/qwen3-asr-0.6b-f16.gguf)\n");
-    fprintf(stderr, "  -f, --audio <path>     Path to audio file (WAV, 16kHz mono) [required]\n");
+    fprintf(stderr, "  -f, --audio <path>     Path to audio file (WAV; resampled to 16kHz mono) [required]\n");
     fprintf(stderr, "  -o, --output <path>    Output file path (default: stdout)\n");
     fprintf(stderr, "  -l, --language <code>  Language code (optional, e.g. 'korean' for Korean word splitting)\n");
     fprintf(stderr, "  -t, --threads <n>      Number of threads (default: 4)\n");
+    fprintf(stderr, "  --threadpool           Run ggml compute on a persistent threadpool\n");
+    fprintf(stderr, "  --cpu-list <list>      Pin compute threads to CPUs, e.g. 0-7,16 (implies --threadpool)\n");
+    fprintf(stderr, "  --encoder-device <dev> Device for the audio encoder: cpu, gpu or gpuN (default: gpu if available)\n");
+    fprintf(stderr, "  --decoder-device <dev> Device for the text decoder: cpu, gpu or gpuN (default: gpu if available)\n");
+    fprintf(stderr, "  --decoder-split <list> Split the decoder layers evenly over GPUs, e.g. 0,1\n");
+    fprintf(stderr, "  --decoder-threads <n>  CPU threads for the text decoder (default: --threads)\n");
+    fprintf(stderr, "  --encoder-workers <n>  Split long audio over n parallel CPU encoder graphs (default: 1)\n");
+    fprintf(stderr, "  --aligner-device <dev> Device for the forced aligner: cpu, gpu or gpuN (default: gpu if available)\n");
+    fprintf(stderr, "  --share-compute        One compute buffer pool for the encoder, decoder and aligner\n");
+    fprintf(stderr, "                         (default: on, off in batch and server mode)\n");
+    fprintf(stderr, "  --no-share-compute     Give the encoder, decoder and aligner separate compute buffers\n");
+    fprintf(stderr, "  --repack               Repack quantized encoder/decoder weights for the CPU kernels at load\n");
+    fprintf(stderr, "  --repack-cache         Like --repack, and keep the repacked weights in files next to the model\n");
+    fprintf(stderr, "  --prefetch             Ask the kernel to read the whole model file ahead at load\n");
+    fprintf(stderr, "  --prefault             Fault in the model pages from a background thread after load\n");
+    fprintf(stderr, "  --hugepages            Back the model mapping with transparent hugepages where supported\n");
+    fprintf(stderr, "  --mlock                Lock the model in memory (needs RLIMIT_MEMLOCK)\n");
+    fprintf(stderr, "  --print-memory         Print the memory used by weights, KV cache and compute buffers\n");
+    fprintf(stderr, "  --list-devices         List the available ggml devices and exit\n");
     fprintf(stderr, "  --max-tokens <n>       Maximum tokens to generate (default: 1024)\n");
+    fprintf(stderr, "  --max-tokens-per-sec <r> Also cap tokens at r per second of audio (default: 15, 0 = off)\n");
+    fprintf(stderr, "  --no-loop-stop         Keep generating through repetition loops\n");
+    fprintf(stderr, "  --kv-type <type>       Decoder KV cache type: f16, q8_0, q4_0 (default: f16)\n");
+    fprintf(stderr, "  --f16-audio            Pass audio embeddings to the decoder as F16\n");
+    fprintf(stderr, "  --draft <n>            Speculative decoding with up to n n-gram drafted tokens per step (default: 0 = off)\n");
+    fprintf(stderr, "  --beams <n>            Beam search with n beams (default: 1 = greedy)\n");
+    fprintf(stderr, "  --length-penalty <a>   Beam score = log-prob / length^a (default: 1.0)\n");
+    fprintf(stderr, "  --vad                  Transcribe only speech segments (split at silences, <= 30 s each)\n");
+    fprintf(stderr, "  --gpu-mel              Compute the mel spectrogram on the encoder's GPU (ignored with --vad)\n");
+    fprintf(stderr, "  --feature-cache <dir>  Reuse encoder outputs of audio seen before, stored in <dir>\n");
+    fprintf(stderr, "  --feature-cache-mb <n> In-memory feature cache budget in MiB (default: 256)\n");
     fprintf(stderr, "  --progress             Print progress during transcription\n");
     fprintf(stderr, "  --no-timing            Don't print timing information\n");
     fprintf(stderr, "  --tokens               Print token IDs\n");
-    fprintf(stderr, "  --profile              Print detailed timing profile (requires QWEN3_ASR_TIMING build)\n");
+    fprintf(stderr, "  --profile              Print detailed timing profile\n");
+    fprintf(stderr, "  --trace <path>         Write a Chrome/Perfetto trace (JSON) of the run to <path>\n");
+    fprintf(stderr, "  --trace-graph          Include one trace event per ggml graph node (slow)\n");
+    fprintf(stderr, "  --imatrix-out <path>   Collect an importance matrix over this run for general-quantize\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Batch Transcription (one JSON line per file):\n");
+    fprintf(stderr, "  -f \"<glob>\"            Transcribe every file matching a quoted glob, e.g. \"clips/*.wav\"\n");
+    fprintf(stderr, "  --file-list <path>     Transcribe the files listed in <path>, one per line\n");
+    fprintf(stderr, "  --workers <n>          WAV/mel worker threads (default: 2)\n");
+    fprintf(stderr, "  --decode-batch <n>     Clips (or --vad segments) decoded together per step (default: 1)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  --stream <ms>          Feed the audio to a streaming session in <ms> blocks, printing partials\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Language Identification (one \"<language> <prob>\" line per candidate):\n");
+    fprintf(stderr, "  --detect-language      Print the ranked spoken languages instead of a transcript\n");
+    fprintf(stderr, "  --lid-sec <s>          Audio from the start used for it, 0 = all (default: 15)\n");
+    fprintf(stderr, "  --lid-candidates <n>   Languages ranked (default: 5)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Server (OpenAI-style POST /v1/audio/transcriptions, GET /health, GET /metrics):\n");
+    fprintf(stderr, "  --server               Keep the model loaded and serve transcription requests over HTTP\n");
+    fprintf(stderr, "  --host <addr>          Listen address (default: 127.0.0.1)\n");
+    fprintf(stderr, "  --port <n>             Listen port (default: 8080)\n");
+    fprintf(stderr, "  --socket <path>        Listen on a Unix domain socket instead of TCP\n");
+    fprintf(stderr, "  --http-threads <n>     Threads reading requests and decoding audio (default: 4)\n");
+    fprintf(stderr, "  --max-queue <n>        Requests queued or running before 503 is returned (default: 64)\n");
+    fprintf(stderr, "  --max-batch <n>        Queued requests transcribed in one batch (default: 8)\n");
+    fprintf(stderr, "  (--workers and --decode-batch apply to each batch)\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Forced Alignment:\n");
     fprintf(stderr, "  --align                Enable forced alignment mode\n");
@@ -64,6 +175,133 @@ static void print_usage(const char * prog) {
     fprintf(stderr, "    %s -m models/qwen3-asr-0.6b-f16.gguf --aligner-model models/qwen3-forced-aligner-0.6b-f16.gguf -f sample.wav --transcribe-align\n", prog);
 }
 
+// Parse a CPU list such as "0-7,16,18-19"
+static bool parse_cpu_list(const char * str, std::vector<int32_t> & cpu_ids) {
+    cpu_ids.clear();
+    const char * p = str;
+    while (*p) {
+        char * end = nullptr;
+        long first = std::strtol(p, &end, 10);
+        if (end == p || first < 0) return false;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            ++p;
+            last = std::strtol(p, &end, 10);
+            if (end == p || last < first) return false;
+            p = end;
+        }
+        for (long id = first; id <= last; ++id) {
+            cpu_ids.push_back((int32_t)id);
+        }
+        if (*p == ',') {
+            ++p;
+        } else if (*p != '\0') {
+            return false;
+        }
+    }
+    return !cpu_ids.empty();
+}
+
+// "cpu", "gpu" (the first GPU) or "gpuN"
+static bool parse_device(const char * str, device_choice & device) {
+    if (strcmp(str, "cpu") == 0) {
+        device.use_gpu = false;
+        return true;
+    }
+    if (strncmp(str, "gpu", 3) != 0) {
+        return false;
+    }
+    device.use_gpu = true;
+    device.gpu_index = -1;
+    if (str[3] != '\0') {
+        char * end = nullptr;
+        const long index = strtol(str + 3, &end, 10);
+        if (*end != '\0' || index < 0) {
+            return false;
+        }
+        device.gpu_index = (int32_t)index;
+    }
+    return true;
+}
+
+static void list_devices() {
+    int32_t n_gpu = 0;
+    for (size_t i = 0; i < ggml_backend_dev_count(); ++i) {
+        ggml_backend_dev_t dev = ggml_backend_dev_get(i);
+        size_t free = 0, total = 0;
+        ggml_backend_dev_memory(dev, &free, &total);
+        const char * kind = "cpu";
+        std::string label;
+        if (ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_GPU) {
+            kind = "gpu";
+            label = "gpu" + std::to_string(n_gpu++);
+        } else if (ggml_backend_dev_type(dev) != GGML_BACKEND_DEVICE_TYPE_CPU) {
+            kind = "other";
+        }
+        printf("%-6s %-5s %-12s %s (%zu / %zu MiB free)\n", label.c_str(), kind,
+               ggml_backend_dev_name(dev), ggml_backend_dev_description(dev),
+               free >> 20, total >> 20);
+    }
+}
+
+static bool is_glob_pattern(const std::string & s) {
+    return s.find_first_of("*?[") != std::string::npos;
+}
+
+// Batch and server mode overlap the encoder with the decoder
+// (transcribe_batch), which a shared compute arena would serialize
+static bool runs_pipeline(const cli_params & params) {
+    return params.server_mode || !params.file_list.empty() || is_glob_pattern(params.audio_path);
+}
+
+static qwen3_asr::cpu_backend_params make_cpu_params(const cli_params & params,
+                                                     const device_choice & device = device_choice()) {
+    qwen3_asr::cpu_backend_params cp;
+    cp.n_threads = params.n_threads;
+    cp.use_threadpool = params.use_threadpool;
+    cp.cpu_ids = params.cpu_ids;
+    cp.use_gpu = device.use_gpu;
+    cp.gpu_device = device.gpu_index;
+    cp.share_compute = params.share_compute < 0 ? !runs_pipeline(params) : params.share_compute != 0;
+    cp.encoder_workers = params.encoder_workers;
+    cp.repack_weights = params.repack_weights || params.repack_cache;
+    cp.repack_cache = params.repack_cache;
+    return cp;
+}
+
+static qwen3_asr::cpu_backend_params make_decoder_params(const cli_params & params) {
+    qwen3_asr::cpu_backend_params cp = make_cpu_params(params, params.decoder_device);
+    if (params.decoder_threads > 0) {
+        cp.n_threads = params.decoder_threads;
+    }
+    cp.gpu_split = params.decoder_split;
+    return cp;
+}
+
+// The aligner's model file, mapped as --prefetch/--prefault/--hugepages/--mlock ask
+static std::shared_ptr<qwen3_asr::ModelFile> open_model_file(const std::string & path, const cli_params & params) {
+    auto file = std::make_shared<qwen3_asr::ModelFile>();
+    if (!file->open(path, params.file_params)) {
+        fprintf(stderr, "Error: %s\n", file->get_error().c_str());
+        return nullptr;
+    }
+    return file;
+}
+
+// Enable the encoder output cache if --feature-cache or --feature-cache-mb was given
+static void apply_feature_cache(const cli_params & params, qwen3_asr::Qwen3ASR & asr) {
+    if (params.feature_cache_dir.empty() && params.feature_cache_mb <= 0) {
+        return;
+    }
+    qwen3_asr::feature_cache_params fp;
+    fp.dir = params.feature_cache_dir;
+    if (params.feature_cache_mb > 0) {
+        fp.max_memory_bytes = (size_t)params.feature_cache_mb << 20;
+    }
+    asr.set_feature_cache(fp);
+}
+
 static bool parse_args(int argc, char ** argv, cli_params & params) {
     for (int i = 1; i < argc; ++i) {
         const char * arg = argv[i];
@@ -98,12 +336,144 @@ static bool parse_args(int argc, char ** argv, cli_params & params) {
                 return false;
             }
             params.n_threads = std::atoi(argv[++i]);
+        } else if (strcmp(arg, "--threadpool") == 0) {
+            params.use_threadpool = true;
+        } else if (strcmp(arg, "--cpu-list") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            if (!parse_cpu_list(argv[++i], params.cpu_ids)) {
+                fprintf(stderr, "Error: Invalid CPU list: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(arg, "--encoder-device") == 0 || strcmp(arg, "--decoder-device") == 0 ||
+                   strcmp(arg, "--aligner-device") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            device_choice & device = strcmp(arg, "--encoder-device") == 0 ? params.encoder_device :
+                                     strcmp(arg, "--decoder-device") == 0 ? params.decoder_device :
+                                                                            params.aligner_device;
+            if (!parse_device(argv[++i], device)) {
+                fprintf(stderr, "Error: Invalid device: %s (use cpu, gpu or gpuN)\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(arg, "--decoder-split") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            if (!parse_cpu_list(argv[++i], params.decoder_split)) {
+                fprintf(stderr, "Error: Invalid GPU list: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(arg, "--decoder-threads") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.decoder_threads = std::atoi(argv[++i]);
+        } else if (strcmp(arg, "--encoder-workers") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.encoder_workers = std::atoi(argv[++i]);
+        } else if (strcmp(arg, "--share-compute") == 0) {
+            params.share_compute = 1;
+        } else if (strcmp(arg, "--no-share-compute") == 0) {
+            params.share_compute = 0;
+        } else if (strcmp(arg, "--repack") == 0) {
+            params.repack_weights = true;
+        } else if (strcmp(arg, "--repack-cache") == 0) {
+            params.repack_cache = true;
+        } else if (strcmp(arg, "--prefetch") == 0) {
+            params.file_params.willneed = true;
+        } else if (strcmp(arg, "--prefault") == 0) {
+            params.file_params.prefault = true;
+        } else if (strcmp(arg, "--hugepages") == 0) {
+            params.file_params.hugepages = true;
+        } else if (strcmp(arg, "--mlock") == 0) {
+            params.file_params.lock = true;
+        } else if (strcmp(arg, "--print-memory") == 0) {
+            params.print_memory = true;
+        } else if (strcmp(arg, "--list-devices") == 0) {
+            list_devices();
+            exit(0);
         } else if (strcmp(arg, "--max-tokens") == 0) {
             if (i + 1 >= argc) {
                 fprintf(stderr, "Error: %s requires an argument\n", arg);
                 return false;
             }
             params.max_tokens = std::atoi(argv[++i]);
+        } else if (strcmp(arg, "--max-tokens-per-sec") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.max_tokens_per_sec = std::atof(argv[++i]);
+        } else if (strcmp(arg, "--no-loop-stop") == 0) {
+            params.stop_loops = false;
+        } else if (strcmp(arg, "--kv-type") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            const char * type = argv[++i];
+            if (strcmp(type, "f16") == 0) {
+                params.kv_type = GGML_TYPE_F16;
+            } else if (strcmp(type, "q8_0") == 0) {
+                params.kv_type = GGML_TYPE_Q8_0;
+            } else if (strcmp(type, "q4_0") == 0) {
+                params.kv_type = GGML_TYPE_Q4_0;
+            } else {
+                fprintf(stderr, "Error: Unknown KV cache type: %s\n", type);
+                return false;
+            }
+        } else if (strcmp(arg, "--f16-audio") == 0) {
+            params.f16_audio = true;
+        } else if (strcmp(arg, "--draft") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            char * end = nullptr;
+            const long n_draft = std::strtol(argv[++i], &end, 10);
+            if (end == argv[i] || *end != '\0' || n_draft < 0 || n_draft > INT32_MAX) {
+                fprintf(stderr, "Error: %s expects a non-negative integer, got '%s'\n", arg, argv[i]);
+                return false;
+            }
+            params.n_draft = (int32_t)n_draft;
+        } else if (strcmp(arg, "--beams") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.n_beams = std::max(1, std::atoi(argv[++i]));
+        } else if (strcmp(arg, "--length-penalty") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.length_penalty = std::atof(argv[++i]);
+        } else if (strcmp(arg, "--vad") == 0) {
+            params.use_vad = true;
+        } else if (strcmp(arg, "--gpu-mel") == 0) {
+            params.gpu_mel = true;
+        } else if (strcmp(arg, "--feature-cache") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.feature_cache_dir = argv[++i];
+        } else if (strcmp(arg, "--feature-cache-mb") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.feature_cache_mb = std::atoi(argv[++i]);
         } else if (strcmp(arg, "--progress") == 0) {
             params.print_progress = true;
         } else if (strcmp(arg, "--no-timing") == 0) {
@@ -112,6 +482,100 @@ static bool parse_args(int argc, char ** argv, cli_params & params) {
             params.print_tokens = true;
         } else if (strcmp(arg, "--profile") == 0) {
             params.profile = true;
+        } else if (strcmp(arg, "--trace") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.trace_path = argv[++i];
+        } else if (strcmp(arg, "--trace-graph") == 0) {
+            params.trace_graph = true;
+        } else if (strcmp(arg, "--imatrix-out") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.imatrix_out_path = argv[++i];
+        } else if (strcmp(arg, "--file-list") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.file_list = argv[++i];
+        } else if (strcmp(arg, "--workers") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.n_workers = std::atoi(argv[++i]);
+        } else if (strcmp(arg, "--decode-batch") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.n_decode_batch = std::atoi(argv[++i]);
+        } else if (strcmp(arg, "--stream") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.stream_step_ms = std::atoi(argv[++i]);
+            if (params.stream_step_ms <= 0) {
+                fprintf(stderr, "Error: --stream requires a positive block size in ms\n");
+                return false;
+            }
+        } else if (strcmp(arg, "--detect-language") == 0) {
+            params.detect_language = true;
+        } else if (strcmp(arg, "--lid-sec") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.lid_sec = std::atof(argv[++i]);
+        } else if (strcmp(arg, "--lid-candidates") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.lid_candidates = std::atoi(argv[++i]);
+        } else if (strcmp(arg, "--server") == 0) {
+            params.server_mode = true;
+        } else if (strcmp(arg, "--host") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.server_host = argv[++i];
+        } else if (strcmp(arg, "--port") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.server_port = std::atoi(argv[++i]);
+        } else if (strcmp(arg, "--socket") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.server_socket = argv[++i];
+        } else if (strcmp(arg, "--http-threads") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.server_http_threads = std::atoi(argv[++i]);
+        } else if (strcmp(arg, "--max-queue") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.server_max_queue = std::atoi(argv[++i]);
+        } else if (strcmp(arg, "--max-batch") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", arg);
+                return false;
+            }
+            params.server_max_batch = std::atoi(argv[++i]);
         } else if (strcmp(arg, "--align") == 0) {
             params.align_mode = true;
         } else if (strcmp(arg, "-a") == 0 || strcmp(arg, "--transcribe-align") == 0) {
@@ -137,7 +601,15 @@ static bool parse_args(int argc, char ** argv, cli_params & params) {
         }
     }
     
-    if (params.audio_path.empty()) {
+    if (params.server_mode) {
+        if (params.align_mode || params.transcribe_align_mode) {
+            fprintf(stderr, "Error: --server cannot be combined with alignment modes\n");
+            return false;
+        }
+        return true;
+    }
+    
+    if (params.audio_path.empty() && params.file_list.empty()) {
         fprintf(stderr, "Error: Audio file path is required (-f/--audio)\n");
         return false;
     }
@@ -152,6 +624,12 @@ static bool parse_args(int argc, char ** argv, cli_params & params) {
         return false;
     }
 
+    if (params.detect_language && (params.align_mode || params.transcribe_align_mode ||
+                                   !params.file_list.empty() || is_glob_pattern(params.audio_path))) {
+        fprintf(stderr, "Error: --detect-language takes one audio file and no alignment mode\n");
+        return false;
+    }
+
     if (params.transcribe_align_mode && params.aligner_model_path.empty()) {
         fprintf(stderr, "Error: --aligner-model is required for --transcribe-align\n");
         return false;
@@ -236,7 +714,11 @@ static int run_alignment(const cli_params & params) {
     
     qwen3_asr::ForcedAligner aligner;
     
-    if (!aligner.load_model(params.model_path)) {
+    std::shared_ptr<qwen3_asr::ModelFile> file = open_model_file(params.model_path, params);
+    if (!file) {
+        return 1;
+    }
+    if (!aligner.load_model(file, make_cpu_params(params, params.aligner_device))) {
         fprintf(stderr, "Error: %s\n", aligner.get_error().c_str());
         return 1;
     }
@@ -300,15 +782,31 @@ static int run_transcription(const cli_params & params) {
     
     qwen3_asr::Qwen3ASR asr;
     
-    if (!asr.load_model(params.model_path)) {
+    asr.set_model_file_params(params.file_params);
+    if (!asr.load_model(params.model_path, make_cpu_params(params, params.encoder_device), make_decoder_params(params))) {
         fprintf(stderr, "Error: %s\n", asr.get_error().c_str());
         return 1;
     }
+    if (params.print_memory) {
+        asr.print_memory_usage();
+    }
+    apply_feature_cache(params, asr);
     
     qwen3_asr::transcribe_params tp;
     tp.max_tokens = params.max_tokens;
+    tp.max_tokens_per_sec = params.max_tokens_per_sec;
+    tp.stop_loops = params.stop_loops;
     tp.language = params.language;
     tp.n_threads = params.n_threads;
+    tp.kv_type = params.kv_type;
+    tp.f16_audio = params.f16_audio;
+    tp.n_draft = params.n_draft;
+    tp.n_beams = params.n_beams;
+    tp.length_penalty = params.length_penalty;
+    tp.use_vad = params.use_vad;
+    tp.gpu_mel = params.gpu_mel;
+    tp.n_decode_batch = params.n_decode_batch;
+    tp.n_workers = params.n_workers;
     tp.print_progress = params.print_progress;
     tp.print_timing = params.print_timing;
     
@@ -319,6 +817,13 @@ static int run_transcription(const cli_params & params) {
         return 1;
     }
     
+    if (params.use_vad) {
+        fprintf(stderr, "\nSegments (%zu):\n", result.segments.size());
+        for (const auto & seg : result.segments) {
+            fprintf(stderr, "  [%8.2f - %8.2f] %s\n", seg.start_sec, seg.end_sec, seg.text.c_str());
+        }
+    }
+    
     if (params.print_tokens) {
         fprintf(stderr, "\nTokens (%zu):\n", result.tokens.size());
         for (size_t i = 0; i < result.tokens.size(); ++i) {
@@ -346,6 +851,271 @@ static int run_transcription(const cli_params & params) {
     return 0;
 }
 
+static int run_language_id(const cli_params & params) {
+    fprintf(stderr, "qwen3-asr-cli (language identification)\n");
+    fprintf(stderr, "  Model: %s\n", params.model_path.c_str());
+    fprintf(stderr, "  Audio: %s\n", params.audio_path.c_str());
+    fprintf(stderr, "\n");
+    
+    qwen3_asr::Qwen3ASR asr;
+    
+    asr.set_model_file_params(params.file_params);
+    if (!asr.load_model(params.model_path, make_cpu_params(params, params.encoder_device), make_decoder_params(params))) {
+        fprintf(stderr, "Error: %s\n", asr.get_error().c_str());
+        return 1;
+    }
+    if (params.print_memory) {
+        asr.print_memory_usage();
+    }
+    
+    qwen3_asr::language_params lp;
+    lp.max_audio_sec = params.lid_sec;
+    lp.n_candidates = params.lid_candidates;
+    lp.n_threads = params.n_threads;
+    lp.kv_type = params.kv_type;
+    
+    auto result = asr.detect_language(params.audio_path, lp);
+    if (!result.success) {
+        fprintf(stderr, "Error: %s\n", result.error_msg.c_str());
+        return 1;
+    }
+    
+    for (const auto & l : result.languages) {
+        printf("%s %.4f\n", l.language.c_str(), l.prob);
+    }
+    
+    if (params.print_timing) {
+        fprintf(stderr, "\nTiming (%.1f s of audio):\n", result.audio_sec);
+        fprintf(stderr, "  Mel spectrogram: %lld ms\n", (long long)result.t_mel_ms);
+        fprintf(stderr, "  Audio encoding:  %lld ms\n", (long long)result.t_encode_ms);
+        fprintf(stderr, "  Text decoding:   %lld ms\n", (long long)result.t_decode_ms);
+        fprintf(stderr, "  Total:           %lld ms\n", (long long)result.t_total_ms);
+    }
+    
+    if (params.profile) {
+        QWEN3_TIMER_REPORT();
+    }
+    
+    return 0;
+}
+
+// Files for batch mode: the lines of --file-list, then the matches of -f
+static bool collect_batch_files(const cli_params & params, std::vector<std::string> & files) {
+    if (!params.file_list.empty()) {
+        std::ifstream in(params.file_list);
+        if (!in) {
+            fprintf(stderr, "Error: Failed to open file list: %s\n", params.file_list.c_str());
+            return false;
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            while (!line.empty() && isspace((unsigned char)line.back())) {
+                line.pop_back();
+            }
+            if (!line.empty() && line[0] != '#') {
+                files.push_back(line);
+            }
+        }
+    }
+    
+    if (!params.audio_path.empty()) {
+        if (is_glob_pattern(params.audio_path)) {
+            glob_t g;
+            if (glob(params.audio_path.c_str(), 0, nullptr, &g) == 0) {
+                for (size_t i = 0; i < g.gl_pathc; ++i) {
+                    files.push_back(g.gl_pathv[i]);
+                }
+            }
+            globfree(&g);
+        } else {
+            files.push_back(params.audio_path);
+        }
+    }
+    
+    if (files.empty()) {
+        fprintf(stderr, "Error: No input files\n");
+        return false;
+    }
+    return true;
+}
+
+static int run_batch(const cli_params & params) {
+    std::vector<std::string> files;
+    if (!collect_batch_files(params, files)) {
+        return 1;
+    }
+    
+    fprintf(stderr, "qwen3-asr-cli (batch)\n");
+    fprintf(stderr, "  Model: %s\n", params.model_path.c_str());
+    fprintf(stderr, "  Files: %zu\n", files.size());
+    fprintf(stderr, "  Workers: %d, decode batch: %d\n", params.n_workers, params.n_decode_batch);
+    fprintf(stderr, "\n");
+    
+    qwen3_asr::Qwen3ASR asr;
+    
+    asr.set_model_file_params(params.file_params);
+    if (!asr.load_model(params.model_path, make_cpu_params(params, params.encoder_device), make_decoder_params(params))) {
+        fprintf(stderr, "Error: %s\n", asr.get_error().c_str());
+        return 1;
+    }
+    if (params.print_memory) {
+        asr.print_memory_usage();
+    }
+    
+    FILE * out = stdout;
+    if (!params.output_path.empty()) {
+        out = fopen(params.output_path.c_str(), "w");
+        if (!out) {
+            fprintf(stderr, "Error: Failed to open output file: %s\n", params.output_path.c_str());
+            return 1;
+        }
+    }
+    
+    std::vector<qwen3_asr::audio_clip> clips(files.size());
+    for (size_t i = 0; i < files.size(); ++i) {
+        clips[i].path = files[i];
+    }
+    
+    qwen3_asr::transcribe_params tp;
+    tp.max_tokens = params.max_tokens;
+    tp.max_tokens_per_sec = params.max_tokens_per_sec;
+    tp.stop_loops = params.stop_loops;
+    tp.language = params.language;
+    tp.n_threads = params.n_threads;
+    tp.kv_type = params.kv_type;
+    tp.f16_audio = params.f16_audio;
+    tp.n_draft = params.n_draft;
+    tp.print_timing = false;
+    tp.n_workers = params.n_workers;
+    tp.n_decode_batch = params.n_decode_batch;
+    
+    double total_audio_sec = 0.0;
+    size_t n_failed = 0;
+    
+    auto t_start = std::chrono::steady_clock::now();
+    
+    asr.transcribe_batch(clips, tp, [&](size_t index, const qwen3_asr::transcribe_result & r) {
+        total_audio_sec += r.audio_sec;
+        if (r.success) {
+            fprintf(out, "{\"file\": \"%s\", \"language\": \"%s\", \"text\": \"%s\", \"audio_sec\": %.3f, \"time_ms\": %lld}\n",
+                    escape_json_string(files[index]).c_str(),
+                    escape_json_string(r.language).c_str(),
+                    escape_json_string(r.text).c_str(),
+                    r.audio_sec, (long long)r.t_total_ms);
+        } else {
+            n_failed++;
+            fprintf(out, "{\"file\": \"%s\", \"error\": \"%s\"}\n",
+                    escape_json_string(files[index]).c_str(),
+                    escape_json_string(r.error_msg).c_str());
+        }
+        fflush(out);
+    });
+    
+    const double wall_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    
+    if (out != stdout) {
+        fclose(out);
+        fprintf(stderr, "Output written to: %s\n", params.output_path.c_str());
+    }
+    
+    if (params.print_timing) {
+        fprintf(stderr, "\nBatch summary:\n");
+        fprintf(stderr, "  Files:      %zu (%zu failed)\n", files.size(), n_failed);
+        fprintf(stderr, "  Audio:      %.1f s\n", total_audio_sec);
+        fprintf(stderr, "  Wall time:  %.1f s\n", wall_sec);
+        fprintf(stderr, "  RTF:        %.4f\n", total_audio_sec > 0.0 ? wall_sec / total_audio_sec : 0.0);
+    }
+    
+    if (params.profile) {
+        QWEN3_TIMER_REPORT();
+    }
+    
+    return n_failed == 0 ? 0 : 1;
+}
+
+static int run_streaming(const cli_params & params) {
+    fprintf(stderr, "qwen3-asr-cli (streaming, %d ms blocks)\n", params.stream_step_ms);
+    fprintf(stderr, "  Model: %s\n", params.model_path.c_str());
+    fprintf(stderr, "  Audio: %s\n", params.audio_path.c_str());
+    fprintf(stderr, "\n");
+    
+    qwen3_asr::Qwen3ASR asr;
+    
+    asr.set_model_file_params(params.file_params);
+    if (!asr.load_model(params.model_path, make_cpu_params(params, params.encoder_device), make_decoder_params(params))) {
+        fprintf(stderr, "Error: %s\n", asr.get_error().c_str());
+        return 1;
+    }
+    if (params.print_memory) {
+        asr.print_memory_usage();
+    }
+    
+    // The file is read, downmixed and resampled one block at a time
+    qwen3_asr::AudioFileReader reader;
+    if (!reader.open(params.audio_path)) {
+        fprintf(stderr, "Error: %s\n", reader.get_error().c_str());
+        return 1;
+    }
+    
+    qwen3_asr::stream_params sp;
+    sp.max_tokens = params.max_tokens;
+    sp.language = params.language;
+    sp.n_threads = params.n_threads;
+    sp.kv_type = params.kv_type;
+    sp.f16_audio = params.f16_audio;
+    sp.stop_loops = params.stop_loops;
+    
+    auto session = asr.create_session(sp);
+    session->set_partial_callback([](const qwen3_asr::transcribe_result & partial, float audio_sec) {
+        fprintf(stderr, "[%6.2f s] %s\n", audio_sec, partial.text.c_str());
+    });
+    
+    const int step = QWEN_SAMPLE_RATE * params.stream_step_ms / 1000;
+    std::vector<float> block;
+    while (!reader.done()) {
+        block.clear();
+        if (!reader.read(block, step)) {
+            fprintf(stderr, "Error: %s\n", reader.get_error().c_str());
+            return 1;
+        }
+        if (!block.empty() && !session->push_audio(block.data(), (int)block.size())) {
+            fprintf(stderr, "Error: %s\n", session->get_error().c_str());
+            return 1;
+        }
+    }
+    
+    auto result = session->finalize();
+    if (!result.success) {
+        fprintf(stderr, "Error: %s\n", result.error_msg.c_str());
+        return 1;
+    }
+    
+    if (params.print_timing) {
+        fprintf(stderr, "\nTiming (cumulative):\n");
+        fprintf(stderr, "  Mel spectrogram: %lld ms\n", (long long)result.t_mel_ms);
+        fprintf(stderr, "  Audio encoding:  %lld ms\n", (long long)result.t_encode_ms);
+        fprintf(stderr, "  Final decoding:  %lld ms\n", (long long)result.t_decode_ms);
+    }
+    
+    if (params.output_path.empty()) {
+        printf("%s\n", result.text.c_str());
+    } else {
+        std::ofstream out(params.output_path);
+        if (!out) {
+            fprintf(stderr, "Error: Failed to open output file: %s\n", params.output_path.c_str());
+            return 1;
+        }
+        out << result.text << "\n";
+        fprintf(stderr, "Output written to: %s\n", params.output_path.c_str());
+    }
+    
+    if (params.profile) {
+        QWEN3_TIMER_REPORT();
+    }
+    
+    return 0;
+}
+
 static int run_transcribe_and_align(const cli_params & params) {
     fprintf(stderr, "qwen3-asr-cli (Transcribe + Align Mode)\n");
     fprintf(stderr, "  ASR Model: %s\n", params.model_path.c_str());
@@ -354,26 +1124,72 @@ static int run_transcribe_and_align(const cli_params & params) {
     fprintf(stderr, "  Threads: %d\n", params.n_threads);
     fprintf(stderr, "\n");
 
+    // The WAV is read and the mel computed once; both models consume it
+    std::vector<float> samples;
+    int sample_rate;
+    if (!qwen3_asr::load_audio_file(params.audio_path, samples, sample_rate)) {
+        fprintf(stderr, "Error: Failed to load audio file: %s\n", params.audio_path.c_str());
+        return 1;
+    }
+    
+    auto t_mel_start = std::chrono::steady_clock::now();
+    MelFilters mel_filters;
+    generate_mel_filters(mel_filters, QWEN_N_MELS, QWEN_N_FFT, QWEN_SAMPLE_RATE);
+    MelSpectrogram mel;
+    if (!log_mel_spectrogram(samples.data(), (int) samples.size(), mel_filters, mel, params.n_threads)) {
+        fprintf(stderr, "Error: Failed to compute mel spectrogram\n");
+        return 1;
+    }
+    const int64_t t_mel_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - t_mel_start).count();
+    
     fprintf(stderr, "--- Phase 1: Transcription ---\n");
-    qwen3_asr::Qwen3ASR asr;
-    if (!asr.load_model(params.model_path)) {
-        fprintf(stderr, "Error (ASR): %s\n", asr.get_error().c_str());
+    auto asr = std::make_unique<qwen3_asr::Qwen3ASR>();
+    asr->set_model_file_params(params.file_params);
+    if (!asr->load_model(params.model_path, make_cpu_params(params, params.encoder_device), make_decoder_params(params))) {
+        fprintf(stderr, "Error (ASR): %s\n", asr->get_error().c_str());
         return 1;
     }
+    if (params.print_memory) {
+        asr->print_memory_usage();
+    }
+    apply_feature_cache(params, *asr);
 
     qwen3_asr::transcribe_params tp;
     tp.max_tokens = params.max_tokens;
+    tp.max_tokens_per_sec = params.max_tokens_per_sec;
+    tp.stop_loops = params.stop_loops;
     tp.language = params.language;
     tp.n_threads = params.n_threads;
+    tp.kv_type = params.kv_type;
+    tp.f16_audio = params.f16_audio;
+    tp.n_draft = params.n_draft;
+    tp.n_beams = params.n_beams;
+    tp.length_penalty = params.length_penalty;
     tp.print_progress = params.print_progress;
     tp.print_timing = params.print_timing;
+    tp.keep_audio_features = !params.use_vad;
+    tp.use_vad = params.use_vad;
+    tp.gpu_mel = params.gpu_mel;
+    tp.n_decode_batch = params.n_decode_batch;
 
-    auto asr_result = asr.transcribe(params.audio_path, tp);
+    // VAD segmentation runs on the samples; its segments then guide the
+    // aligner, one stretch of audio and text at a time
+    auto asr_result = params.use_vad
+        ? asr->transcribe(samples.data(), (int) samples.size(), tp)
+        : asr->transcribe(mel, (int) samples.size(), tp);
     if (!asr_result.success) {
         fprintf(stderr, "Error (ASR): %s\n", asr_result.error_msg.c_str());
         return 1;
     }
 
+    // Only the encoder fingerprint is needed from here on; release the ASR
+    // weights so the two models are never resident at the same time. The
+    // compute arena outlives the ASR, so the aligner reuses its buffers.
+    const uint64_t asr_encoder_fp = asr->encoder_fingerprint();
+    const std::shared_ptr<qwen3_asr::ComputeArena> arena = asr->get_compute_arena();
+    asr.reset();
+
     std::string detected_lang = asr_result.language;
     std::string align_lang = params.language.empty() ? detected_lang : params.language;
     std::string transcript = asr_result.text;
@@ -387,7 +1203,11 @@ static int run_transcribe_and_align(const cli_params & params) {
 
     fprintf(stderr, "\n--- Phase 2: Forced Alignment ---\n");
     qwen3_asr::ForcedAligner aligner;
-    if (!aligner.load_model(params.aligner_model_path)) {
+    std::shared_ptr<qwen3_asr::ModelFile> aligner_file = open_model_file(params.aligner_model_path, params);
+    if (!aligner_file) {
+        return 1;
+    }
+    if (!aligner.load_model(aligner_file, make_cpu_params(params, params.aligner_device), arena)) {
         fprintf(stderr, "Error (Aligner): %s\n", aligner.get_error().c_str());
         return 1;
     }
@@ -401,7 +1221,29 @@ static int run_transcribe_and_align(const cli_params & params) {
         }
     }
 
-    auto align_result = aligner.align(params.audio_path, transcript, align_lang);
+    // An aligner GGUF carrying the ASR encoder weights can take the ASR
+    // encoder output directly instead of encoding the audio again
+    const int32_t hidden = aligner.get_hparams().text_hidden_size;
+    const bool shared_encoder = aligner.encoder_fingerprint() == asr_encoder_fp &&
+                                !asr_result.audio_features.empty() &&
+                                asr_result.audio_features.size() % hidden == 0;
+    if (shared_encoder) {
+        fprintf(stderr, "  Encoder weights match the ASR model, reusing its output\n");
+    }
+
+    std::vector<qwen3_asr::align_segment> segments;
+    for (const auto & seg : asr_result.segments) {
+        segments.push_back({seg.start_sec, seg.end_sec, seg.text});
+    }
+    
+    auto align_result = !segments.empty()
+        ? aligner.align_segments(mel, (int) samples.size(), segments, align_lang)
+        : shared_encoder
+        ? aligner.align_encoded(asr_result.audio_features.data(),
+                                (int32_t) (asr_result.audio_features.size() / hidden),
+                                asr_result.n_mel_frames, asr_result.audio_sec,
+                                transcript, align_lang)
+        : aligner.align(mel, (int) samples.size(), transcript, align_lang);
     if (!align_result.success) {
         fprintf(stderr, "Error (Aligner): %s\n", align_result.error_msg.c_str());
         return 1;
@@ -409,9 +1251,12 @@ static int run_transcribe_and_align(const cli_params & params) {
 
     if (params.print_timing) {
         fprintf(stderr, "\nCombined Timing:\n");
+        fprintf(stderr, "  Mel (shared):  %lld ms\n", (long long) t_mel_ms);
         fprintf(stderr, "  ASR:           %lld ms\n", (long long) asr_result.t_total_ms);
-        fprintf(stderr, "  Alignment:     %lld ms\n", (long long) align_result.t_total_ms);
-        fprintf(stderr, "  Total:         %lld ms\n", (long long) (asr_result.t_total_ms + align_result.t_total_ms));
+        fprintf(stderr, "  Alignment:     %lld ms%s\n", (long long) align_result.t_total_ms,
+                shared_encoder ? " (shared encoder)" : "");
+        fprintf(stderr, "  Total:         %lld ms\n",
+                (long long) (t_mel_ms + asr_result.t_total_ms + align_result.t_total_ms));
         fprintf(stderr, "  Words aligned: %zu\n", align_result.words.size());
     }
 
@@ -436,6 +1281,77 @@ static int run_transcribe_and_align(const cli_params & params) {
     return 0;
 }
 
+static qwen3_asr::AsrServer * g_server = nullptr;
+
+static void on_stop_signal(int) {
+    if (g_server) {
+        g_server->request_stop();
+    }
+}
+
+static int run_server(const cli_params & params) {
+    fprintf(stderr, "qwen3-asr-cli (server)\n");
+    fprintf(stderr, "  Model: %s\n", params.model_path.c_str());
+    
+    qwen3_asr::Qwen3ASR asr;
+    
+    asr.set_model_file_params(params.file_params);
+    if (!asr.load_model(params.model_path, make_cpu_params(params, params.encoder_device), make_decoder_params(params))) {
+        fprintf(stderr, "Error: %s\n", asr.get_error().c_str());
+        return 1;
+    }
+    if (params.print_memory) {
+        asr.print_memory_usage();
+    }
+    
+    qwen3_asr::server_params sp;
+    sp.host = params.server_host;
+    sp.port = params.server_port;
+    sp.unix_socket = params.server_socket;
+    sp.n_http_threads = params.server_http_threads;
+    sp.max_queue = params.server_max_queue;
+    sp.max_batch = params.server_max_batch;
+    sp.transcribe.max_tokens = params.max_tokens;
+    sp.transcribe.max_tokens_per_sec = params.max_tokens_per_sec;
+    sp.transcribe.stop_loops = params.stop_loops;
+    sp.transcribe.language = params.language;
+    sp.transcribe.n_threads = params.n_threads;
+    sp.transcribe.kv_type = params.kv_type;
+    sp.transcribe.f16_audio = params.f16_audio;
+    sp.transcribe.n_draft = params.n_draft;
+    sp.transcribe.n_workers = params.n_workers;
+    sp.transcribe.n_decode_batch = params.n_decode_batch;
+    
+    qwen3_asr::AsrServer server(asr, sp);
+    if (!server.start()) {
+        fprintf(stderr, "Error: %s\n", server.get_error().c_str());
+        return 1;
+    }
+    
+    g_server = &server;
+    signal(SIGINT, on_stop_signal);
+    signal(SIGTERM, on_stop_signal);
+    
+    if (sp.unix_socket.empty()) {
+        fprintf(stderr, "Listening on http://%s:%d\n", sp.host.c_str(), sp.port);
+    } else {
+        fprintf(stderr, "Listening on unix:%s\n", sp.unix_socket.c_str());
+    }
+    fprintf(stderr, "  HTTP threads: %d, max queue: %d, max batch: %d, decode batch: %d\n",
+            sp.n_http_threads, sp.max_queue, sp.max_batch, sp.transcribe.n_decode_batch);
+    
+    server.wait();
+    fprintf(stderr, "Shutting down, finishing admitted requests...\n");
+    server.stop();
+    g_server = nullptr;
+    
+    if (params.profile) {
+        QWEN3_TIMER_REPORT();
+    }
+    
+    return 0;
+}
+
 static void ggml_log_callback_quiet(enum ggml_log_level level, const char * text, void * user_data) {
     (void)user_data;
     if (level >= GGML_LOG_LEVEL_WARN) {
@@ -454,13 +1370,50 @@ int main(int argc, char ** argv) {
         return 1;
     }
     
-    if (params.transcribe_align_mode) {
-        return run_transcribe_and_align(params);
+    if (params.profile || !params.trace_path.empty()) {
+        qwen3_asr::TimingProfiler::set_enabled(true);
+        qwen3_asr::TimingProfiler::set_graph_events(params.trace_graph);
     }
-
-    if (params.align_mode) {
-        return run_alignment(params);
+    
+    qwen3_asr::ImatrixCollector imatrix;
+    if (!params.imatrix_out_path.empty()) {
+        imatrix.start();
+    }
+    
+    int ret;
+    if (params.server_mode) {
+        ret = run_server(params);
+    } else if (params.transcribe_align_mode) {
+        ret = run_transcribe_and_align(params);
+    } else if (params.align_mode) {
+        ret = run_alignment(params);
+    } else if (!params.file_list.empty() || is_glob_pattern(params.audio_path)) {
+        ret = run_batch(params);
+    } else if (params.detect_language) {
+        ret = run_language_id(params);
+    } else if (params.stream_step_ms > 0) {
+        ret = run_streaming(params);
     } else {
-        return run_transcription(params);
+        ret = run_transcription(params);
+    }
+    
+    if (!params.imatrix_out_path.empty()) {
+        imatrix.stop();
+        if (imatrix.save(params.imatrix_out_path)) {
+            fprintf(stderr, "Importance matrix (%zu tensors) written to: %s\n",
+                    imatrix.n_entries(), params.imatrix_out_path.c_str());
+        } else {
+            fprintf(stderr, "Error: %s\n", imatrix.get_error().c_str());
+        }
     }
+    
+    if (!params.trace_path.empty()) {
+        if (qwen3_asr::TimingProfiler::instance().export_chrome_trace(params.trace_path)) {
+            fprintf(stderr, "Trace written to: %s\n", params.trace_path.c_str());
+        } else {
+            fprintf(stderr, "Error: Failed to write trace: %s\n", params.trace_path.c_str());
+        }
+    }
+    
+    return ret;
 }
@@ -1,4 +1,5 @@
 #include "mel_spectrogram.h"
+#include "audio_reader.h"
 
 #include <algorithm>
 #include <cassert>
@@ -12,6 +13,10 @@
 #ifdef __APPLE__
 #define ACCELERATE_NEW_LAPACK
 #include <Accelerate/Accelerate.h>
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
 #endif
 
 #ifndef M_PI
@@ -19,32 +24,33 @@
 #endif
 
 // ============================================================================
-// FFT Implementation (ported from whisper.cpp)
+// Window tables
 // ============================================================================
 
-// Precomputed sin/cos table for FFT - must match FFT size exactly
-constexpr int SIN_COS_N_COUNT = QWEN_N_FFT;
-
 struct GlobalCache {
-    float sin_vals[SIN_COS_N_COUNT];
-    float cos_vals[SIN_COS_N_COUNT];
     double hann_window[QWEN_N_FFT];
     float hann_window_f[QWEN_N_FFT];
+#ifdef __APPLE__
+    // DFT rows [bin][sample] for the cblas_sgemv path, built once rather
+    // than on every call (MelStream computes a few frames per push)
+    float dft_cos[QWEN_N_FFT_BINS * QWEN_N_FFT];
+    float dft_sin[QWEN_N_FFT_BINS * QWEN_N_FFT];
+#endif
 
     GlobalCache() {
-        fill_sin_cos_table();
         fill_hann_window(QWEN_N_FFT, true, hann_window);
         for (int i = 0; i < QWEN_N_FFT; i++) {
             hann_window_f[i] = static_cast<float>(hann_window[i]);
         }
-    }
-
-    void fill_sin_cos_table() {
-        for (int i = 0; i < SIN_COS_N_COUNT; i++) {
-            double theta = (2.0 * M_PI * i) / SIN_COS_N_COUNT;
-            sin_vals[i] = sinf(static_cast<float>(theta));
-            cos_vals[i] = cosf(static_cast<float>(theta));
+#ifdef __APPLE__
+        for (int k = 0; k < QWEN_N_FFT_BINS; k++) {
+            for (int n = 0; n < QWEN_N_FFT; n++) {
+                float angle = static_cast<float>(2.0 * M_PI * k * n / QWEN_N_FFT);
+                dft_cos[k * QWEN_N_FFT + n] = cosf(angle);
+                dft_sin[k * QWEN_N_FFT + n] = sinf(angle);
+            }
         }
+#endif
     }
 
     void fill_hann_window(int length, bool periodic, double* output) {
@@ -57,167 +63,337 @@ struct GlobalCache {
 
 static GlobalCache global_cache;
 
-// Naive DFT for non-power-of-2 sizes
-static void dft(const float* in, int N, float* out) {
-    const int sin_cos_step = SIN_COS_N_COUNT / N;
+#ifndef __APPLE__
+// ============================================================================
+// Real FFT for N = QWEN_N_FFT (mixed radix 2/5, double precision)
+// ============================================================================
+//
+// The 400-point real FFT is computed as a 200-point complex FFT of the packed
+// sequence z[n] = x[2n] + i*x[2n+1] (Stockham autosort, 200 = 2*2*2*5*5),
+// followed by the usual split step to recover the 201 positive bins.
+// Frames are processed in batches of FFT_LANES, one frame per SIMD lane, so
+// every butterfly is plain vertical arithmetic and no shuffles are needed.
+
+#if defined(__AVX2__)
+constexpr int FFT_LANES = 4;
+typedef __m256d fft_vec;
+static inline fft_vec fv_load(const double * p)        { return _mm256_loadu_pd(p); }
+static inline void    fv_store(double * p, fft_vec v)  { _mm256_storeu_pd(p, v); }
+static inline fft_vec fv_set1(double x)                { return _mm256_set1_pd(x); }
+static inline fft_vec fv_add(fft_vec a, fft_vec b)     { return _mm256_add_pd(a, b); }
+static inline fft_vec fv_sub(fft_vec a, fft_vec b)     { return _mm256_sub_pd(a, b); }
+static inline fft_vec fv_mul(fft_vec a, fft_vec b)     { return _mm256_mul_pd(a, b); }
+#if defined(__FMA__)
+static inline fft_vec fv_madd(fft_vec a, fft_vec b, fft_vec c) { return _mm256_fmadd_pd(a, b, c); }
+#else
+static inline fft_vec fv_madd(fft_vec a, fft_vec b, fft_vec c) { return _mm256_add_pd(_mm256_mul_pd(a, b), c); }
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+constexpr int FFT_LANES = 2;
+typedef float64x2_t fft_vec;
+static inline fft_vec fv_load(const double * p)        { return vld1q_f64(p); }
+static inline void    fv_store(double * p, fft_vec v)  { vst1q_f64(p, v); }
+static inline fft_vec fv_set1(double x)                { return vdupq_n_f64(x); }
+static inline fft_vec fv_add(fft_vec a, fft_vec b)     { return vaddq_f64(a, b); }
+static inline fft_vec fv_sub(fft_vec a, fft_vec b)     { return vsubq_f64(a, b); }
+static inline fft_vec fv_mul(fft_vec a, fft_vec b)     { return vmulq_f64(a, b); }
+static inline fft_vec fv_madd(fft_vec a, fft_vec b, fft_vec c) { return vfmaq_f64(c, a, b); }
+#else
+constexpr int FFT_LANES = 1;
+typedef double fft_vec;
+static inline fft_vec fv_load(const double * p)        { return *p; }
+static inline void    fv_store(double * p, fft_vec v)  { *p = v; }
+static inline fft_vec fv_set1(double x)                { return x; }
+static inline fft_vec fv_add(fft_vec a, fft_vec b)     { return a + b; }
+static inline fft_vec fv_sub(fft_vec a, fft_vec b)     { return a - b; }
+static inline fft_vec fv_mul(fft_vec a, fft_vec b)     { return a * b; }
+static inline fft_vec fv_madd(fft_vec a, fft_vec b, fft_vec c) { return a * b + c; }
+#endif
 
-    for (int k = 0; k < N; k++) {
-        float re = 0;
-        float im = 0;
+constexpr int RFFT_N = QWEN_N_FFT;
+constexpr int RFFT_M = RFFT_N / 2;  // length of the packed complex FFT
+
+struct RealFFTPlan {
+    struct stage {
+        int n;  // sub-transform length at this stage
+        int p;  // radix (2 or 5)
+        int s;  // stride (number of interleaved sub-transforms)
+        std::vector<double> tw_re;  // w_n^(q*r), indexed [q * p + r]
+        std::vector<double> tw_im;
+    };
+
+    std::vector<stage> stages;
+
+    // Split-step twiddles e^(-2*pi*i*k/N) for k in [0, M]
+    double split_re[RFFT_M + 1];
+    double split_im[RFFT_M + 1];
+
+    RealFFTPlan() {
+        int n = RFFT_M;
+        int s = 1;
+        while (n > 1) {
+            const int p = (n % 5 == 0) ? 5 : 2;
+            assert(n % p == 0);
+
+            stage st;
+            st.n = n;
+            st.p = p;
+            st.s = s;
+            const int m = n / p;
+            st.tw_re.resize(m * p);
+            st.tw_im.resize(m * p);
+            for (int q = 0; q < m; q++) {
+                for (int r = 0; r < p; r++) {
+                    double theta = -2.0 * M_PI * q * r / n;
+                    st.tw_re[q * p + r] = cos(theta);
+                    st.tw_im[q * p + r] = sin(theta);
+                }
+            }
+            stages.push_back(std::move(st));
 
-        for (int n = 0; n < N; n++) {
-            int idx = (k * n * sin_cos_step) % SIN_COS_N_COUNT;
-            re += in[n] * global_cache.cos_vals[idx];
-            im -= in[n] * global_cache.sin_vals[idx];
+            n /= p;
+            s *= p;
         }
 
-        out[k * 2 + 0] = re;
-        out[k * 2 + 1] = im;
+        for (int k = 0; k <= RFFT_M; k++) {
+            double theta = -2.0 * M_PI * k / RFFT_N;
+            split_re[k] = cos(theta);
+            split_im[k] = sin(theta);
+        }
     }
-}
+};
 
-// Cooley-Tukey FFT (recursive, in-place)
-static void fft(float* in, int N, float* out) {
-    if (N == 1) {
-        out[0] = in[0];
-        out[1] = 0;
+static RealFFTPlan rfft_plan;
+
+// One Stockham radix-p pass: x -> y
+static void rfft_stage(const RealFFTPlan::stage & st,
+                       const double * xr, const double * xi,
+                       double * yr, double * yi) {
+    const int L = FFT_LANES;
+    const int p = st.p;
+    const int s = st.s;
+    const int m = st.n / p;
+
+    if (p == 2) {
+        for (int q = 0; q < m; q++) {
+            const fft_vec w1r = fv_set1(st.tw_re[q * 2 + 1]);
+            const fft_vec w1i = fv_set1(st.tw_im[q * 2 + 1]);
+            for (int t = 0; t < s; t++) {
+                const int i0 = (t + s * q) * L;
+                const int i1 = (t + s * (q + m)) * L;
+                const int o0 = (t + s * (2 * q)) * L;
+                const int o1 = (t + s * (2 * q + 1)) * L;
+
+                fft_vec ar = fv_load(xr + i0), ai = fv_load(xi + i0);
+                fft_vec br = fv_load(xr + i1), bi = fv_load(xi + i1);
+
+                fv_store(yr + o0, fv_add(ar, br));
+                fv_store(yi + o0, fv_add(ai, bi));
+
+                fft_vec dr = fv_sub(ar, br);
+                fft_vec di = fv_sub(ai, bi);
+                fv_store(yr + o1, fv_sub(fv_mul(dr, w1r), fv_mul(di, w1i)));
+                fv_store(yi + o1, fv_madd(dr, w1i, fv_mul(di, w1r)));
+            }
+        }
         return;
     }
 
-    const int half_N = N / 2;
-    if (N - half_N * 2 == 1) {
-        // N is odd, fall back to DFT
-        dft(in, N, out);
-        return;
+    // Radix 5
+    const double c1 =  0.30901699437494742410;  // cos(2*pi/5)
+    const double c2 = -0.80901699437494742410;  // cos(4*pi/5)
+    const double s1 =  0.95105651629515357212;  // sin(2*pi/5)
+    const double s2 =  0.58778525229247312917;  // sin(4*pi/5)
+    const fft_vec vc1 = fv_set1(c1), vc2 = fv_set1(c2);
+    const fft_vec vs1 = fv_set1(s1), vs2 = fv_set1(s2);
+
+    for (int q = 0; q < m; q++) {
+        for (int t = 0; t < s; t++) {
+            fft_vec ar[5], ai[5];
+            for (int j = 0; j < 5; j++) {
+                const int idx = (t + s * (q + m * j)) * L;
+                ar[j] = fv_load(xr + idx);
+                ai[j] = fv_load(xi + idx);
+            }
+
+            fft_vec t1r = fv_add(ar[1], ar[4]), t1i = fv_add(ai[1], ai[4]);
+            fft_vec t2r = fv_add(ar[2], ar[3]), t2i = fv_add(ai[2], ai[3]);
+            fft_vec t3r = fv_sub(ar[1], ar[4]), t3i = fv_sub(ai[1], ai[4]);
+            fft_vec t4r = fv_sub(ar[2], ar[3]), t4i = fv_sub(ai[2], ai[3]);
+
+            // b1 = a0 + c1*t1 + c2*t2, b2 = a0 + c2*t1 + c1*t2
+            fft_vec b1r = fv_madd(vc2, t2r, fv_madd(vc1, t1r, ar[0]));
+            fft_vec b1i = fv_madd(vc2, t2i, fv_madd(vc1, t1i, ai[0]));
+            fft_vec b2r = fv_madd(vc1, t2r, fv_madd(vc2, t1r, ar[0]));
+            fft_vec b2i = fv_madd(vc1, t2i, fv_madd(vc2, t1i, ai[0]));
+
+            // d1 = s1*t3 + s2*t4, d2 = s2*t3 - s1*t4
+            fft_vec d1r = fv_madd(vs2, t4r, fv_mul(vs1, t3r));
+            fft_vec d1i = fv_madd(vs2, t4i, fv_mul(vs1, t3i));
+            fft_vec d2r = fv_sub(fv_mul(vs2, t3r), fv_mul(vs1, t4r));
+            fft_vec d2i = fv_sub(fv_mul(vs2, t3i), fv_mul(vs1, t4i));
+
+            // y0 = sum, y1 = b1 - i*d1, y4 = b1 + i*d1, y2 = b2 - i*d2, y3 = b2 + i*d2
+            fft_vec yr_[5], yi_[5];
+            yr_[0] = fv_add(ar[0], fv_add(t1r, t2r));
+            yi_[0] = fv_add(ai[0], fv_add(t1i, t2i));
+            yr_[1] = fv_add(b1r, d1i);  yi_[1] = fv_sub(b1i, d1r);
+            yr_[4] = fv_sub(b1r, d1i);  yi_[4] = fv_add(b1i, d1r);
+            yr_[2] = fv_add(b2r, d2i);  yi_[2] = fv_sub(b2i, d2r);
+            yr_[3] = fv_sub(b2r, d2i);  yi_[3] = fv_add(b2i, d2r);
+
+            const int obase = t + s * (5 * q);
+            fv_store(yr + obase * L, yr_[0]);
+            fv_store(yi + obase * L, yi_[0]);
+            for (int r = 1; r < 5; r++) {
+                const fft_vec wr = fv_set1(st.tw_re[q * 5 + r]);
+                const fft_vec wi = fv_set1(st.tw_im[q * 5 + r]);
+                const int o = (obase + s * r) * L;
+                fv_store(yr + o, fv_sub(fv_mul(yr_[r], wr), fv_mul(yi_[r], wi)));
+                fv_store(yi + o, fv_madd(yr_[r], wi, fv_mul(yi_[r], wr)));
+            }
+        }
     }
+}
+
+// Power spectrum |X[k]|^2, k in [0, N/2], for FFT_LANES windowed frames.
+// in:    [N * FFT_LANES] lane-interleaved windowed samples
+// power: [(N/2 + 1) * FFT_LANES] lane-interleaved output
+// work:  scratch of at least 4 * M * FFT_LANES doubles
+static void rfft_power(const double * in, double * power, double * work) {
+    const int L = FFT_LANES;
+    double * xr = work;
+    double * xi = xr + RFFT_M * L;
+    double * yr = xi + RFFT_M * L;
+    double * yi = yr + RFFT_M * L;
 
-    // Split into even and odd
-    float* even = in + N;
-    for (int i = 0; i < half_N; ++i) {
-        even[i] = in[2 * i];
+    // Pack even/odd samples as real/imag
+    for (int n = 0; n < RFFT_M; n++) {
+        fv_store(xr + n * L, fv_load(in + (2 * n + 0) * L));
+        fv_store(xi + n * L, fv_load(in + (2 * n + 1) * L));
     }
-    float* even_fft = out + 2 * N;
-    fft(even, half_N, even_fft);
 
-    float* odd = even;
-    for (int i = 0; i < half_N; ++i) {
-        odd[i] = in[2 * i + 1];
+    for (const auto & st : rfft_plan.stages) {
+        rfft_stage(st, xr, xi, yr, yi);
+        std::swap(xr, yr);
+        std::swap(xi, yi);
     }
-    float* odd_fft = even_fft + N;
-    fft(odd, half_N, odd_fft);
 
-    const int sin_cos_step = SIN_COS_N_COUNT / N;
-    for (int k = 0; k < half_N; k++) {
-        int idx = k * sin_cos_step;
-        float re = global_cache.cos_vals[idx];
-        float im = -global_cache.sin_vals[idx];
+    // Split step: X[k] = E[k] + W^k * O[k]
+    //   E[k] = (Z[k] + conj(Z[M-k])) / 2
+    //   O[k] = (Z[k] - conj(Z[M-k])) / 2i
+    const fft_vec half = fv_set1(0.5);
+    for (int k = 0; k <= RFFT_M; k++) {
+        const int ka = k % RFFT_M;
+        const int kb = (RFFT_M - k) % RFFT_M;
 
-        float re_odd = odd_fft[2 * k + 0];
-        float im_odd = odd_fft[2 * k + 1];
+        fft_vec a = fv_load(xr + ka * L), b = fv_load(xi + ka * L);
+        fft_vec c = fv_load(xr + kb * L), d = fv_load(xi + kb * L);
 
-        out[2 * k + 0] = even_fft[2 * k + 0] + re * re_odd - im * im_odd;
-        out[2 * k + 1] = even_fft[2 * k + 1] + re * im_odd + im * re_odd;
+        fft_vec er = fv_mul(half, fv_add(a, c));
+        fft_vec ei = fv_mul(half, fv_sub(b, d));
+        fft_vec or_ = fv_mul(half, fv_add(b, d));
+        fft_vec oi = fv_mul(half, fv_sub(c, a));
 
-        out[2 * (k + half_N) + 0] = even_fft[2 * k + 0] - re * re_odd + im * im_odd;
-        out[2 * (k + half_N) + 1] = even_fft[2 * k + 1] - re * im_odd - im * re_odd;
+        const fft_vec wr = fv_set1(rfft_plan.split_re[k]);
+        const fft_vec wi = fv_set1(rfft_plan.split_im[k]);
+
+        fft_vec re = fv_add(er, fv_sub(fv_mul(wr, or_), fv_mul(wi, oi)));
+        fft_vec im = fv_add(ei, fv_madd(wr, oi, fv_mul(wi, or_)));
+
+        fv_store(power + k * L, fv_madd(re, re, fv_mul(im, im)));
     }
 }
 
+// Frames are split across threads in batches of FFT_LANES (batch b goes to
+// thread b % n_threads). For each batch the power spectrum stays in cache
+// while every mel band is reduced over its few bins, so power -> mel -> log10
+// is a single pass; results go to out[j * mel_stride + i * frame_stride] and
+// the largest value to *mmax.
+static void log_mel_spectrogram_fft_worker(int ith, int n_threads,
+                                           const float * samples_padded,
+                                           int compute_frames, int frame_step,
+                                           const MelFilters & filters,
+                                           float * out, size_t mel_stride, size_t frame_stride,
+                                           float * mmax) {
+    const int L = FFT_LANES;
+    const int n_mel = filters.n_mel;
+    const double * hann = global_cache.hann_window;
+
+    std::vector<double> frames(RFFT_N * L);
+    std::vector<double> power((RFFT_M + 1) * L);
+    std::vector<double> work(4 * RFFT_M * L);
+    double sums[FFT_LANES];
+    float vmax = -1e20f;
+
+    const int n_batches = (compute_frames + L - 1) / L;
+    for (int b = ith; b < n_batches; b += n_threads) {
+        const int i0 = b * L;
+        const int n_valid = std::min(L, compute_frames - i0);
+
+        for (int l = 0; l < L; l++) {
+            if (l < n_valid) {
+                const float * src = samples_padded + (i0 + l) * frame_step;
+                for (int n = 0; n < RFFT_N; n++) {
+                    frames[n * L + l] = hann[n] * static_cast<double>(src[n]);
+                }
+            } else {
+                for (int n = 0; n < RFFT_N; n++) {
+                    frames[n * L + l] = 0.0;
+                }
+            }
+        }
+
+        rfft_power(frames.data(), power.data(), work.data());
+
+        for (int j = 0; j < n_mel; j++) {
+            const MelBand & band = filters.bands[j];
+            const float * w = filters.band_weights.data() + band.offset;
+            const double * pw = power.data() + (size_t)band.start * L;
+            fft_vec acc = fv_set1(0.0);
+            for (int k = 0; k < band.len; k++) {
+                acc = fv_madd(fv_load(pw + k * L), fv_set1(static_cast<double>(w[k])), acc);
+            }
+            fv_store(sums, acc);
+            float * dst = out + j * mel_stride + i0 * frame_stride;
+            for (int l = 0; l < n_valid; l++) {
+                const float v = static_cast<float>(log10(std::max(sums[l], 1e-10)));
+                dst[l * frame_stride] = v;
+                vmax = std::max(vmax, v);
+            }
+        }
+    }
+
+    *mmax = vmax;
+}
+#endif // !__APPLE__
+
 // ============================================================================
 // WAV Loading (using dr_wav-style parsing, minimal implementation)
 // ============================================================================
 
 bool load_wav(const std::string& path, std::vector<float>& samples, int& sample_rate) {
-    std::ifstream file(path, std::ios::binary);
-    if (!file.is_open()) {
-        fprintf(stderr, "Error: Cannot open WAV file: %s\n", path.c_str());
+    qwen3_asr::WavReader reader;
+    if (!reader.open(path)) {
+        fprintf(stderr, "Error: %s\n", reader.get_error().c_str());
         return false;
     }
+    sample_rate = reader.sample_rate();
 
-    // Read RIFF header
-    char riff[4];
-    file.read(riff, 4);
-    if (strncmp(riff, "RIFF", 4) != 0) {
-        fprintf(stderr, "Error: Not a valid WAV file (missing RIFF header)\n");
-        return false;
+    samples.clear();
+    if (reader.n_frames() > 0) {
+        samples.reserve((size_t)reader.n_frames());
     }
-
-    uint32_t file_size;
-    file.read(reinterpret_cast<char*>(&file_size), 4);
-
-    char wave[4];
-    file.read(wave, 4);
-    if (strncmp(wave, "WAVE", 4) != 0) {
-        fprintf(stderr, "Error: Not a valid WAV file (missing WAVE header)\n");
-        return false;
+    std::vector<float> block(16384);
+    int got;
+    while ((got = reader.read(block.data(), (int)block.size())) > 0) {
+        samples.insert(samples.end(), block.begin(), block.begin() + got);
     }
-
-    // Find fmt chunk
-    uint16_t audio_format = 0;
-    uint16_t num_channels = 0;
-    uint32_t sr = 0;
-    uint16_t bits_per_sample = 0;
-
-    while (file.good()) {
-        char chunk_id[4];
-        uint32_t chunk_size;
-        file.read(chunk_id, 4);
-        file.read(reinterpret_cast<char*>(&chunk_size), 4);
-
-        if (strncmp(chunk_id, "fmt ", 4) == 0) {
-            file.read(reinterpret_cast<char*>(&audio_format), 2);
-            file.read(reinterpret_cast<char*>(&num_channels), 2);
-            file.read(reinterpret_cast<char*>(&sr), 4);
-            uint32_t byte_rate;
-            file.read(reinterpret_cast<char*>(&byte_rate), 4);
-            uint16_t block_align;
-            file.read(reinterpret_cast<char*>(&block_align), 2);
-            file.read(reinterpret_cast<char*>(&bits_per_sample), 2);
-            
-            // Skip any extra format bytes
-            if (chunk_size > 16) {
-                file.seekg(chunk_size - 16, std::ios::cur);
-            }
-        } else if (strncmp(chunk_id, "data", 4) == 0) {
-            // Found data chunk
-            if (audio_format != 1) {
-                fprintf(stderr, "Error: Only PCM format supported (got format %d)\n", audio_format);
-                return false;
-            }
-            if (bits_per_sample != 16) {
-                fprintf(stderr, "Error: Only 16-bit samples supported (got %d bits)\n", bits_per_sample);
-                return false;
-            }
-
-            sample_rate = static_cast<int>(sr);
-            int num_samples = chunk_size / (bits_per_sample / 8) / num_channels;
-            samples.resize(num_samples);
-
-            std::vector<int16_t> raw_samples(num_samples * num_channels);
-            file.read(reinterpret_cast<char*>(raw_samples.data()), chunk_size);
-
-            // Convert to float and handle stereo->mono if needed
-            for (int i = 0; i < num_samples; i++) {
-                if (num_channels == 1) {
-                    samples[i] = raw_samples[i] / 32768.0f;
-                } else {
-                    // Average channels for stereo
-                    float sum = 0;
-                    for (int c = 0; c < num_channels; c++) {
-                        sum += raw_samples[i * num_channels + c];
-                    }
-                    samples[i] = (sum / num_channels) / 32768.0f;
-                }
-            }
-            return true;
-        } else {
-            // Skip unknown chunk
-            file.seekg(chunk_size, std::ios::cur);
-        }
+    if (got < 0) {
+        fprintf(stderr, "Error: %s\n", reader.get_error().c_str());
+        return false;
     }
-
-    fprintf(stderr, "Error: No data chunk found in WAV file\n");
-    return false;
+    return true;
 }
 
 // ============================================================================
@@ -343,6 +519,7 @@ bool load_mel_filters_npy(const std::string& path, MelFilters& filters) {
         return false;
     }
 
+    build_mel_bands(filters);
     return true;
 }
 
@@ -412,78 +589,152 @@ void generate_mel_filters(MelFilters& filters, int n_mels, int n_fft, int sample
             filters.data[m * n_fft_bins + k] *= enorm;
         }
     }
+
+    build_mel_bands(filters);
+}
+
+void build_mel_bands(MelFilters& filters) {
+    const int n_fft = filters.n_fft;
+
+    filters.bands.resize(filters.n_mel);
+    filters.band_weights.clear();
+    for (int m = 0; m < filters.n_mel; m++) {
+        const float * row = &filters.data[(size_t)m * n_fft];
+        int first = 0;
+        int last = n_fft - 1;
+        while (first < n_fft && row[first] == 0.0f) {
+            first++;
+        }
+        while (last >= first && row[last] == 0.0f) {
+            last--;
+        }
+
+        MelBand & band = filters.bands[m];
+        band.start = first < n_fft ? first : 0;
+        band.len = last - first + 1;
+        band.offset = static_cast<int32_t>(filters.band_weights.size());
+        filters.band_weights.insert(filters.band_weights.end(), row + band.start, row + band.start + band.len);
+    }
+}
+
+void windowed_dft_basis(std::vector<float>& cos_basis, std::vector<float>& sin_basis) {
+    cos_basis.resize(QWEN_N_FFT_BINS * QWEN_N_FFT);
+    sin_basis.resize(QWEN_N_FFT_BINS * QWEN_N_FFT);
+    for (int k = 0; k < QWEN_N_FFT_BINS; k++) {
+        for (int n = 0; n < QWEN_N_FFT; n++) {
+            // k * n reduced mod N keeps the angle exact for the high bins
+            const double angle = 2.0 * M_PI * ((k * n) % QWEN_N_FFT) / QWEN_N_FFT;
+            cos_basis[k * QWEN_N_FFT + n] = static_cast<float>(global_cache.hann_window[n] * cos(angle));
+            sin_basis[k * QWEN_N_FFT + n] = static_cast<float>(global_cache.hann_window[n] * sin(angle));
+        }
+    }
 }
 
 // ============================================================================
 // Log Mel Spectrogram Computation
 // ============================================================================
 
-static void log_mel_spectrogram_worker(int ith, const float* hann, 
-                                        const std::vector<float>& samples,
-                                        int n_samples, int frame_size, int frame_step,
-                                        int n_threads, const MelFilters& filters,
-                                        MelSpectrogram& mel) {
-    std::vector<float> fft_in(frame_size * 2, 0.0f);
-    std::vector<float> fft_out(frame_size * 2 * 2 * 2);
+// log10 mel energies of compute_frames frames read from samples_padded at a
+// QWEN_HOP_LENGTH stride, written to out[j * mel_stride + i * frame_stride]
+// (mel-major with frame_stride = 1, frame-major with mel_stride = 1).
+// Returns the largest value written.
+static float compute_log_mel_frames(const float * samples_padded, int compute_frames,
+                                    const MelFilters & filters,
+                                    float * out, size_t mel_stride, size_t frame_stride,
+                                    int n_threads) {
+    const int frame_size = QWEN_N_FFT;
+    const int frame_step = QWEN_HOP_LENGTH;
+    const int n_fft = filters.n_fft;
+    const int n_mel = filters.n_mel;
 
-    int n_fft = filters.n_fft;
-    int i = ith;
+    // Filters filled by hand without build_mel_bands()
+    MelFilters banded;
+    if ((int)filters.bands.size() != n_mel) {
+        banded = filters;
+        build_mel_bands(banded);
+    }
+    const MelFilters & f = (int)filters.bands.size() == n_mel ? filters : banded;
 
-    // Calculate FFT only when fft_in are not all zero
-    for (; i < std::min(n_samples / frame_step + 1, mel.n_len); i += n_threads) {
+#ifdef __APPLE__
+    // The cached DFT tables cover QWEN_N_FFT_BINS bins of QWEN_N_FFT samples
+    assert(frame_size == QWEN_N_FFT && n_fft == QWEN_N_FFT_BINS);
+    const float* hann_f = global_cache.hann_window_f;
+    const float* W_cos = global_cache.dft_cos;
+    const float* W_sin = global_cache.dft_sin;
+
+    std::vector<float> windowed(frame_size);
+    std::vector<float> dft_re(n_fft);
+    std::vector<float> dft_im(n_fft);
+    std::vector<float> power(n_fft);
+    float mmax = -1e20f;
+
+    for (int i = 0; i < compute_frames; i++) {
         const int offset = i * frame_step;
 
-        // Apply Hann window
-        for (int j = 0; j < std::min(frame_size, n_samples - offset); j++) {
-            fft_in[j] = hann[j] * samples[offset + j];
-        }
+        vDSP_vmul(hann_f, 1, samples_padded + offset, 1, windowed.data(), 1, frame_size);
 
-        // Fill the rest with zeros
-        if (n_samples - offset < frame_size) {
-            std::fill(fft_in.begin() + (n_samples - offset), fft_in.end(), 0.0f);
-        }
+        cblas_sgemv(CblasRowMajor, CblasNoTrans, n_fft, frame_size,
+                    1.0f, W_cos, frame_size, windowed.data(), 1,
+                    0.0f, dft_re.data(), 1);
+        cblas_sgemv(CblasRowMajor, CblasNoTrans, n_fft, frame_size,
+                    -1.0f, W_sin, frame_size, windowed.data(), 1,
+                    0.0f, dft_im.data(), 1);
 
-        // FFT
-        fft(fft_in.data(), frame_size, fft_out.data());
+        DSPSplitComplex split = { dft_re.data(), dft_im.data() };
+        vDSP_zvmags(&split, 1, power.data(), 1, n_fft);
 
-        // Calculate modulus^2 of complex numbers
-        for (int j = 0; j < n_fft; j++) {
-            fft_out[j] = fft_out[2 * j + 0] * fft_out[2 * j + 0] + 
-                         fft_out[2 * j + 1] * fft_out[2 * j + 1];
+        for (int j = 0; j < n_mel; j++) {
+            const MelBand & band = f.bands[j];
+            float dot = 0.0f;
+            vDSP_dotpr(power.data() + band.start, 1, f.band_weights.data() + band.offset, 1, &dot, band.len);
+            const float v = static_cast<float>(log10(std::max(static_cast<double>(dot), 1e-10)));
+            out[j * mel_stride + i * frame_stride] = v;
+            mmax = std::max(mmax, v);
         }
+    }
 
-        // Mel spectrogram
-        for (int j = 0; j < mel.n_mel; j++) {
-            double sum = 0.0;
-            // Unrolled loop for performance
-            int k = 0;
-            for (k = 0; k < n_fft - 3; k += 4) {
-                sum += fft_out[k + 0] * filters.data[j * n_fft + k + 0] +
-                       fft_out[k + 1] * filters.data[j * n_fft + k + 1] +
-                       fft_out[k + 2] * filters.data[j * n_fft + k + 2] +
-                       fft_out[k + 3] * filters.data[j * n_fft + k + 3];
-            }
-            // Handle remainder
-            for (; k < n_fft; k++) {
-                sum += fft_out[k] * filters.data[j * n_fft + k];
-            }
-            sum = log10(std::max(sum, 1e-10));
-            mel.data[j * mel.n_len + i] = static_cast<float>(sum);
+    return mmax;
+#else
+    // Only the FFT path below handles N = QWEN_N_FFT with 201 output bins
+    assert(frame_size == RFFT_N && n_fft == RFFT_M + 1);
+    (void)n_fft;
+
+    const int n_batches = (compute_frames + FFT_LANES - 1) / FFT_LANES;
+    n_threads = std::max(1, std::min(n_threads, n_batches));
+
+    std::vector<float> maxes(n_threads, -1e20f);
+    {
+        std::vector<std::thread> workers(n_threads - 1);
+        for (int iw = 0; iw < n_threads - 1; ++iw) {
+            workers[iw] = std::thread(
+                log_mel_spectrogram_fft_worker, iw + 1, n_threads,
+                samples_padded, compute_frames, frame_step,
+                std::cref(f), out, mel_stride, frame_stride, &maxes[iw + 1]);
         }
-    }
 
-    // Fill remaining frames with log10(1e-10)
-    double sum = log10(1e-10);
-    for (; i < mel.n_len; i += n_threads) {
-        for (int j = 0; j < mel.n_mel; j++) {
-            mel.data[j * mel.n_len + i] = static_cast<float>(sum);
+        // main thread
+        log_mel_spectrogram_fft_worker(0, n_threads, samples_padded,
+                                       compute_frames, frame_step, f,
+                                       out, mel_stride, frame_stride, &maxes[0]);
+
+        for (int iw = 0; iw < n_threads - 1; ++iw) {
+            workers[iw].join();
         }
     }
+
+    return *std::max_element(maxes.begin(), maxes.end());
+#endif
 }
 
-bool log_mel_spectrogram(const float* samples, int n_samples,
-                         const MelFilters& filters, MelSpectrogram& mel,
-                         int n_threads) {
+static inline float sample_value(float x) { return x; }
+static inline float sample_value(int16_t x) { return x / 32768.0f; }
+
+// Log mel of samples copied (and converted to float) into a reflect-padded
+// buffer, the only copy of the input
+template <typename T>
+static bool log_mel_spectrogram_impl(const T* samples, int n_samples,
+                                     const MelFilters& filters, MelSpectrogram& mel,
+                                     int n_threads) {
     const int frame_size = QWEN_N_FFT;
     const int frame_step = QWEN_HOP_LENGTH;
 
@@ -494,12 +745,14 @@ bool log_mel_spectrogram(const float* samples, int n_samples,
     std::vector<float> samples_padded;
     samples_padded.resize(n_samples + 2 * pad_amount);
 
-    std::copy(samples, samples + n_samples, samples_padded.begin() + pad_amount);
+    for (int i = 0; i < n_samples; i++) {
+        samples_padded[pad_amount + i] = sample_value(samples[i]);
+    }
 
     for (int i = 0; i < pad_amount; i++) {
         int src_idx = pad_amount - i;
         if (src_idx < n_samples) {
-            samples_padded[i] = samples[src_idx];
+            samples_padded[i] = sample_value(samples[src_idx]);
         } else {
             samples_padded[i] = 0.0f;
         }
@@ -508,7 +761,7 @@ bool log_mel_spectrogram(const float* samples, int n_samples,
     for (int i = 0; i < pad_amount; i++) {
         int src_idx = n_samples - 2 - i;
         if (src_idx >= 0) {
-            samples_padded[n_samples + pad_amount + i] = samples[src_idx];
+            samples_padded[n_samples + pad_amount + i] = sample_value(samples[src_idx]);
         } else {
             samples_padded[n_samples + pad_amount + i] = 0.0f;
         }
@@ -521,109 +774,150 @@ bool log_mel_spectrogram(const float* samples, int n_samples,
     mel.n_len_org = mel.n_len;
     mel.data.resize(mel.n_mel * mel.n_len);
 
-    int compute_frames = total_frames;
-    int n_fft = filters.n_fft;
-
-#ifdef __APPLE__
-    const float* hann_f = global_cache.hann_window_f;
+    // The last frame is dropped, so it is not computed at all. The floor
+    // depends on the maximum over all frames, so clamping and normalization
+    // is one in-place pass once the kernel has produced them.
+    const float mmax = compute_log_mel_frames(samples_padded.data(), mel.n_len, filters,
+                                              mel.data.data(), mel.n_len, 1, n_threads);
 
-    std::vector<float> W_cos(n_fft * frame_size);
-    std::vector<float> W_sin(n_fft * frame_size);
-    for (int k = 0; k < n_fft; k++) {
-        for (int n = 0; n < frame_size; n++) {
-            float angle = static_cast<float>(2.0 * M_PI * k * n / frame_size);
-            W_cos[k * frame_size + n] = cosf(angle);
-            W_sin[k * frame_size + n] = sinf(angle);
-        }
+    const float floor_val = mmax - 8.0f;
+    for (float & val : mel.data) {
+        val = (std::max(val, floor_val) + 4.0f) / 4.0f;
     }
 
-    std::vector<float> windowed(frame_size);
-    std::vector<float> dft_re(n_fft);
-    std::vector<float> dft_im(n_fft);
-    std::vector<float> power(n_fft);
+    return true;
+}
 
-    std::vector<double> temp_data(mel.n_mel * compute_frames);
+bool log_mel_spectrogram(const float* samples, int n_samples,
+                         const MelFilters& filters, MelSpectrogram& mel,
+                         int n_threads) {
+    return log_mel_spectrogram_impl(samples, n_samples, filters, mel, n_threads);
+}
 
-    for (int i = 0; i < compute_frames; i++) {
-        const int offset = i * frame_step;
+bool log_mel_spectrogram(const int16_t* samples, int n_samples,
+                         const MelFilters& filters, MelSpectrogram& mel,
+                         int n_threads) {
+    return log_mel_spectrogram_impl(samples, n_samples, filters, mel, n_threads);
+}
 
-        vDSP_vmul(hann_f, 1, &samples_padded[offset], 1, windowed.data(), 1, frame_size);
+// ============================================================================
+// Streaming mel spectrogram
+// ============================================================================
 
-        cblas_sgemv(CblasRowMajor, CblasNoTrans, n_fft, frame_size,
-                    1.0f, W_cos.data(), frame_size, windowed.data(), 1,
-                    0.0f, dft_re.data(), 1);
-        cblas_sgemv(CblasRowMajor, CblasNoTrans, n_fft, frame_size,
-                    -1.0f, W_sin.data(), frame_size, windowed.data(), 1,
-                    0.0f, dft_im.data(), 1);
+MelStream::MelStream(const MelFilters& filters, int n_threads)
+    : filters_(filters), n_threads_(std::max(1, n_threads)), n_mel_(filters.n_mel) {
+}
 
-        DSPSplitComplex split = { dft_re.data(), dft_im.data() };
-        vDSP_zvmags(&split, 1, power.data(), 1, n_fft);
+void MelStream::reset() {
+    pending_.clear();
+    padded_.clear();
+    ready_.clear();
+    n_samples_ = 0;
+    next_frame_ = 0;
+    mmax_ = -1e20f;
+    started_ = false;
+    finished_ = false;
+}
 
-        for (int j = 0; j < mel.n_mel; j++) {
-            float dot;
-            vDSP_dotpr(power.data(), 1, &filters.data[j * n_fft], 1, &dot, n_fft);
-            temp_data[j * compute_frames + i] = log10(std::max(static_cast<double>(dot), 1e-10));
-        }
+// Build the leading reflect padding once enough samples are buffered. At the
+// end of short inputs, missing reflection sources are zero as in
+// log_mel_spectrogram().
+void MelStream::start() {
+    const int pad_amount = QWEN_N_FFT / 2;
+    const int n = static_cast<int>(pending_.size());
+
+    padded_.resize(pad_amount);
+    for (int i = 0; i < pad_amount; i++) {
+        int src_idx = pad_amount - i;
+        padded_[i] = src_idx < n ? pending_[src_idx] : 0.0f;
     }
+    padded_.insert(padded_.end(), pending_.begin(), pending_.end());
+    pending_.clear();
+    started_ = true;
+}
 
-#else
-    const double* hann = global_cache.hann_window;
+void MelStream::compute(int n_frames) {
+    if (n_frames <= 0) {
+        return;
+    }
 
-    std::vector<double> temp_data(mel.n_mel * compute_frames);
+    // Frames are written frame-major straight into ready_
+    const size_t base = ready_.size();
+    ready_.resize(base + (size_t)n_frames * n_mel_);
+    float * frames = ready_.data() + base;
+    mmax_ = std::max(mmax_, compute_log_mel_frames(padded_.data(), n_frames, filters_,
+                                                   frames, 1, n_mel_, n_threads_));
 
-    for (int i = 0; i < compute_frames; i++) {
-        const int offset = i * frame_step;
+    const float floor_val = mmax_ - 8.0f;
+    for (size_t k = 0; k < (size_t)n_frames * n_mel_; k++) {
+        frames[k] = (std::max(frames[k], floor_val) + 4.0f) / 4.0f;
+    }
 
-        std::vector<double> fft_in_d(frame_size, 0.0);
-        for (int j = 0; j < frame_size; j++) {
-            fft_in_d[j] = hann[j] * static_cast<double>(samples_padded[offset + j]);
-        }
+    padded_.erase(padded_.begin(), padded_.begin() + (size_t)n_frames * QWEN_HOP_LENGTH);
+    next_frame_ += n_frames;
+}
 
-        std::vector<double> power(n_fft);
-        for (int k = 0; k < n_fft; k++) {
-            double re = 0.0, im = 0.0;
-            for (int n = 0; n < frame_size; n++) {
-                double angle = 2.0 * M_PI * k * n / frame_size;
-                re += fft_in_d[n] * cos(angle);
-                im -= fft_in_d[n] * sin(angle);
-            }
-            power[k] = re * re + im * im;
-        }
+void MelStream::push(const float* samples, int n_samples) {
+    if (finished_ || n_samples <= 0) {
+        return;
+    }
+    n_samples_ += n_samples;
 
-        for (int j = 0; j < mel.n_mel; j++) {
-            double sum = 0.0;
-            for (int k = 0; k < n_fft; k++) {
-                sum += power[k] * static_cast<double>(filters.data[j * n_fft + k]);
-            }
-            temp_data[j * compute_frames + i] = log10(std::max(sum, 1e-10));
+    if (!started_) {
+        pending_.insert(pending_.end(), samples, samples + n_samples);
+        if ((int)pending_.size() <= QWEN_N_FFT / 2) {
+            return;
         }
+        start();
+    } else {
+        padded_.insert(padded_.end(), samples, samples + n_samples);
     }
-#endif
 
-    // Clamping and normalization in double precision
-    double mmax = -1e20;
-    for (int j = 0; j < mel.n_mel; j++) {
-        for (int i = 0; i < mel.n_len; i++) {
-            double val = temp_data[j * compute_frames + i];
-            if (val > mmax) {
-                mmax = val;
-            }
-        }
+    const int n_padded = static_cast<int>(padded_.size());
+    if (n_padded >= QWEN_N_FFT) {
+        compute((n_padded - QWEN_N_FFT) / QWEN_HOP_LENGTH + 1);
     }
+}
 
-    mmax -= 8.0;
+void MelStream::finish() {
+    if (finished_) {
+        return;
+    }
+    if (!started_) {
+        start();
+    }
 
-    for (int j = 0; j < mel.n_mel; j++) {
-        for (int i = 0; i < mel.n_len; i++) {
-            double val = temp_data[j * compute_frames + i];
-            if (val < mmax) {
-                val = mmax;
-            }
-            val = (val + 4.0) / 4.0;
-            mel.data[j * mel.n_len + i] = static_cast<float>(val);
+    // Trailing reflect padding: sample n - 2 - i of the input lands at
+    // padded_[n - 2 - i + pad - next_frame_ * hop]
+    const int pad_amount = QWEN_N_FFT / 2;
+    const int64_t base = next_frame_ * QWEN_HOP_LENGTH - pad_amount;
+    std::vector<float> tail(pad_amount, 0.0f);
+    for (int i = 0; i < pad_amount; i++) {
+        int64_t src_idx = n_samples_ - 2 - i;
+        int64_t rel = src_idx - base;
+        if (src_idx >= 0 && rel >= 0 && rel < (int64_t)padded_.size()) {
+            tail[i] = padded_[rel];
         }
     }
+    padded_.insert(padded_.end(), tail.begin(), tail.end());
+
+    // log_mel_spectrogram() drops the last frame: n_len = n_samples / hop
+    compute(static_cast<int>(n_samples_ / QWEN_HOP_LENGTH - next_frame_));
+    finished_ = true;
+}
+
+bool MelStream::read(int n_frames, std::vector<float>& out) {
+    if (n_frames < 0 || n_frames > n_available()) {
+        return false;
+    }
 
+    out.resize((size_t)n_mel_ * n_frames);
+    for (int i = 0; i < n_frames; i++) {
+        for (int j = 0; j < n_mel_; j++) {
+            out[(size_t)j * n_frames + i] = ready_[(size_t)i * n_mel_ + j];
+        }
+    }
+    ready_.erase(ready_.begin(), ready_.begin() + (size_t)n_frames * n_mel_);
     return true;
 }
 
@@ -22,21 +22,44 @@ struct MelSpectrogram {
     std::vector<float> data;  // [n_mel x n_len] in mel-major order
 };
 
+// Non-zero span of one mel filter: bins [start, start + len), weights at
+// MelFilters::band_weights[offset ...]
+struct MelBand {
+    int32_t start;
+    int32_t len;
+    int32_t offset;
+};
+
 // Mel filterbank structure
 struct MelFilters {
     int32_t n_mel;  // 128
     int32_t n_fft;  // 201
     std::vector<float> data;  // [n_mel x n_fft]
+
+    // Compact form of data used by the mel kernels; each triangular filter
+    // covers only a few bins. Filled by build_mel_bands().
+    std::vector<MelBand> bands;     // [n_mel]
+    std::vector<float> band_weights;
 };
 
-// Load audio from WAV file (16-bit PCM, mono, 16kHz)
-// Returns samples normalized to [-1, 1]
+// Load audio from WAV file (PCM 8/16/24/32-bit or float, any channel count)
+// Returns mono samples normalized to [-1, 1] at the file's own sample rate;
+// see load_audio_file() in audio_reader.h for 16 kHz output
 bool load_wav(const std::string& path, std::vector<float>& samples, int& sample_rate);
 
 // Load mel filterbank from numpy .npy file
 // Expected shape: (201, 128) - will be transposed to (128, 201)
 bool load_mel_filters_npy(const std::string& path, MelFilters& filters);
 
+// Rebuild filters.bands/band_weights from filters.data; generate_mel_filters()
+// and load_mel_filters_npy() call it, callers filling data themselves must too
+void build_mel_bands(MelFilters& filters);
+
+// Periodic-Hann-windowed real DFT basis for one QWEN_N_FFT frame, row-major
+// [QWEN_N_FFT_BINS x QWEN_N_FFT]: the power spectrum of a frame x is
+// (cos_basis * x)^2 + (sin_basis * x)^2. Used by the GPU mel front end.
+void windowed_dft_basis(std::vector<float>& cos_basis, std::vector<float>& sin_basis);
+
 // Generate mel filterbank programmatically
 // Uses HTK mel scale: mel = 2595 * log10(1 + f/700)
 void generate_mel_filters(MelFilters& filters, int n_mels = QWEN_N_MELS, 
@@ -54,6 +77,52 @@ bool log_mel_spectrogram(const float* samples, int n_samples,
                          const MelFilters& filters, MelSpectrogram& mel,
                          int n_threads = 1);
 
+// Same for 16-bit PCM (scaled by 1/32768), converted while it is padded
+bool log_mel_spectrogram(const int16_t* samples, int n_samples,
+                         const MelFilters& filters, MelSpectrogram& mel,
+                         int n_threads = 1);
+
+// Incremental log mel spectrogram for streaming input.
+// push() appends samples and computes every frame whose window is complete;
+// finish() applies the trailing reflect padding, so the total frame count
+// matches log_mel_spectrogram() on the concatenated input. Frames are read
+// out in order with read() and are not kept afterwards.
+// The -8 floor is taken from the running maximum instead of the utterance
+// maximum, so values near the floor may differ from the offline result
+// until the loudest part of the input has been seen.
+class MelStream {
+public:
+    explicit MelStream(const MelFilters& filters, int n_threads = 1);
+
+    void push(const float* samples, int n_samples);
+    void finish();
+    void reset();
+
+    // Number of normalized frames ready to be read
+    int n_available() const { return (int)(ready_.size() / n_mel_); }
+    bool finished() const { return finished_; }
+
+    // Read and remove the next n_frames frames as [n_mel x n_frames] mel-major
+    bool read(int n_frames, std::vector<float>& out);
+
+private:
+    void start();
+    void compute(int n_frames);
+
+    const MelFilters& filters_;
+    int n_threads_;
+    int n_mel_;
+
+    std::vector<float> pending_;  // samples received before the leading pad can be built
+    std::vector<float> padded_;   // centre-padded samples from frame next_frame_ onwards
+    std::vector<float> ready_;    // normalized frames, frame-major [n x n_mel]
+    int64_t n_samples_ = 0;       // total samples pushed
+    int64_t next_frame_ = 0;      // index of the next frame to compute
+    float mmax_ = -1e20f;
+    bool started_ = false;
+    bool finished_ = false;
+};
+
 // Save mel spectrogram to numpy .npy file
 bool save_mel_npy(const std::string& path, const MelSpectrogram& mel);
 
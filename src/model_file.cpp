@@ -0,0 +1,115 @@
+#include "model_file.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace qwen3_asr {
+
+ModelFile::~ModelFile() {
+    stop_ = true;
+    if (prefault_thread_.joinable()) {
+        prefault_thread_.join();
+    }
+    release_metadata();
+    if (mmap_addr_) {
+        if (locked_) {
+            munlock(mmap_addr_, mmap_size_);
+        }
+        munmap(mmap_addr_, mmap_size_);
+        mmap_addr_ = nullptr;
+    }
+}
+
+bool ModelFile::open(const std::string & path, const model_file_params & params) {
+    path_ = path;
+
+    struct gguf_init_params gguf_params = {
+        /*.no_alloc =*/ true,
+        /*.ctx      =*/ &meta_ctx_,
+    };
+    gguf_ = gguf_init_from_file(path.c_str(), gguf_params);
+    if (!gguf_) {
+        error_msg_ = "Failed to open GGUF file: " + path;
+        return false;
+    }
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error_msg_ = "Failed to open file for mmap: " + path;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        error_msg_ = "Failed to stat file: " + path;
+        close(fd);
+        return false;
+    }
+
+    void * addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        error_msg_ = "Failed to mmap file: " + path;
+        return false;
+    }
+    mmap_addr_ = addr;
+    mmap_size_ = st.st_size;
+
+    const size_t data_offset = gguf_get_data_offset(gguf_);
+    data_ = (uint8_t *)mmap_addr_ + data_offset;
+    data_size_ = mmap_size_ - data_offset;
+
+    const int64_t n_tensors = gguf_get_n_tensors(gguf_);
+    for (int64_t i = 0; i < n_tensors; ++i) {
+        max_tensor_size_ = std::max(max_tensor_size_, gguf_get_tensor_size(gguf_, i));
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (params.hugepages) {
+        madvise(mmap_addr_, mmap_size_, MADV_HUGEPAGE);
+    }
+#endif
+    if (params.willneed) {
+        madvise(mmap_addr_, mmap_size_, MADV_WILLNEED);
+    }
+    if (params.lock) {
+        locked_ = mlock(mmap_addr_, mmap_size_) == 0;
+        if (!locked_) {
+            fprintf(stderr, "Warning: failed to lock %s in memory: %s\n", path.c_str(), strerror(errno));
+        }
+    }
+    if (params.prefault && !locked_) {
+        prefault_thread_ = std::thread(&ModelFile::prefault, this);
+    }
+
+    return true;
+}
+
+void ModelFile::release_metadata() {
+    if (gguf_) {
+        gguf_free(gguf_);
+        gguf_ = nullptr;
+    }
+    if (meta_ctx_) {
+        ggml_free(meta_ctx_);
+        meta_ctx_ = nullptr;
+    }
+}
+
+void ModelFile::prefault() {
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const volatile uint8_t * p = (const volatile uint8_t *)mmap_addr_;
+    uint8_t sum = 0;
+    for (size_t off = 0; off < mmap_size_ && !stop_; off += page) {
+        sum += p[off];
+    }
+    (void)sum;
+}
+
+} // namespace qwen3_asr
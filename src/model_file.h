@@ -0,0 +1,85 @@
+#pragma once
+
+#include "ggml.h"
+#include "gguf.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+namespace qwen3_asr {
+
+// How the weights of a ModelFile are brought into memory. All default to
+// off: pages are then faulted in by the first graphs that read them.
+struct model_file_params {
+    // madvise(MADV_WILLNEED) the tensor data, so the kernel starts reading
+    // the whole file ahead in the background
+    bool willneed = false;
+
+    // madvise(MADV_HUGEPAGE), for kernels with transparent hugepages for
+    // read-only file mappings; fewer TLB misses in the weight-bound decoder
+    bool hugepages = false;
+
+    // mlock the tensor data, so weights are never paged out under memory
+    // pressure (needs a large enough RLIMIT_MEMLOCK; failure is a warning)
+    bool lock = false;
+
+    // Touch every page of the tensor data from a background thread after
+    // load, so the first request does not pay the page faults
+    bool prefault = false;
+};
+
+// A GGUF file opened once: parsed metadata and one read-only MAP_SHARED
+// mapping of the whole file, shared by all components loaded from it
+// (they keep a reference while their tensors point into it). Processes
+// mapping the same file share its page cache.
+class ModelFile {
+public:
+    ModelFile() = default;
+    ~ModelFile();
+
+    ModelFile(const ModelFile &) = delete;
+    ModelFile & operator=(const ModelFile &) = delete;
+
+    bool open(const std::string & path, const model_file_params & params = model_file_params());
+
+    const std::string & get_path() const { return path_; }
+    const std::string & get_error() const { return error_msg_; }
+
+    // Parsed metadata, nullptr after release_metadata()
+    struct gguf_context * get_gguf() const { return gguf_; }
+
+    // Free the metadata (the vocabulary strings are most of it) once every
+    // component has loaded; the mapping stays
+    void release_metadata();
+
+    // Start of the tensor data in the mapping and its size
+    uint8_t * get_data() const { return data_; }
+    size_t get_data_size() const { return data_size_; }
+
+    // Size of the largest tensor, the hint map_weights passes to devices
+    size_t get_max_tensor_size() const { return max_tensor_size_; }
+
+private:
+    void prefault();
+
+    std::string path_;
+    std::string error_msg_;
+
+    struct gguf_context * gguf_ = nullptr;
+    struct ggml_context * meta_ctx_ = nullptr;
+
+    void * mmap_addr_ = nullptr;
+    size_t mmap_size_ = 0;
+    uint8_t * data_ = nullptr;
+    size_t data_size_ = 0;
+    size_t max_tensor_size_ = 0;
+    bool locked_ = false;
+
+    std::thread prefault_thread_;
+    std::atomic<bool> stop_{false};
+};
+
+} // namespace qwen3_asr
@@ -1,27 +1,51 @@
 #include "ggml.h"
 #include "gguf.h"
+#include "imatrix.h"
 #include <cstdio>
+#include <cstdlib>
 #include <vector>
 #include <string>
 #include <cstring>
 #include <algorithm>
+#include <fstream>
+#include <regex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 
+// F32 rows converted and quantized per step, so memory use is bounded by
+// this (plus its quantized copy) rather than by the largest tensor
+#define QUANTIZE_SLAB_BYTES (64ull * 1024 * 1024)
+
+// Rows per parallel task within a slab
+#define QUANTIZE_TASK_ROWS 16
+
+// Per-layer projections that --fuse concatenates: prefix, part, weight/bias
+#define QUANTIZE_FUSE_PATTERN "^(.*blk\\.[0-9]+\\.)(attn_q|attn_k|attn_v|ffn_gate|ffn_up)\\.(weight|bias)$"
+
 
 ggml_type ggml_parse_type(const std::string & str) {
     std::string s = str;
     std::transform(s.begin(), s.end(), s.begin(), ::toupper);
     if (s == "F32")    return GGML_TYPE_F32;
     if (s == "F16")    return GGML_TYPE_F16;
+    if (s == "BF16")   return GGML_TYPE_BF16;
     if (s == "Q4_0")   return GGML_TYPE_Q4_0;
     if (s == "Q4_1")   return GGML_TYPE_Q4_1;
+    if (s == "Q2_K")   return GGML_TYPE_Q2_K;
+    if (s == "Q3_K" || s == "Q3_K_M" || s == "Q3_K_S") return GGML_TYPE_Q3_K;
     if (s == "Q4_K" || s == "Q4_K_M" || s == "Q4_K_S") return GGML_TYPE_Q4_K;
     if (s == "Q5_0")   return GGML_TYPE_Q5_0;
     if (s == "Q5_1")   return GGML_TYPE_Q5_1;
     if (s == "Q5_K" || s == "Q5_K_M" || s == "Q5_K_S") return GGML_TYPE_Q5_K;
+    if (s == "Q6_K")   return GGML_TYPE_Q6_K;
     if (s == "Q8_0")   return GGML_TYPE_Q8_0;
+    if (s == "IQ4_NL") return GGML_TYPE_IQ4_NL;
+    if (s == "IQ4_XS") return GGML_TYPE_IQ4_XS;
     return GGML_TYPE_COUNT;
 }
 
@@ -37,7 +61,7 @@ bool is_aligned(struct ggml_tensor * tensor, ggml_type type) {
 
 bool should_quantize(const std::string & name, struct ggml_tensor * tensor, ggml_type type) {
     // 1. Skip by name (standard heuristic)
-    if (name.find("bias") != std::string::npos || 
+    if (name.find("bias") != std::string::npos ||
         name.find("norm") != std::string::npos ||
         name.find("token_embd") != std::string::npos ||
         name.find("ln_post") !=  std::string::npos) {
@@ -53,132 +77,531 @@ bool should_quantize(const std::string & name, struct ggml_tensor * tensor, ggml
 }
 
 
+// Per-tensor type override: tensors whose name matches pattern (regex,
+// searched anywhere in the name) get type; the first matching rule wins
+struct quant_rule {
+    std::string pattern;
+    std::regex re;
+    ggml_type type = GGML_TYPE_COUNT;
+    bool keep = false;  // leave the tensor as stored
+};
+
+
+bool parse_rule(const std::string & pattern, const std::string & type_str, quant_rule & rule) {
+    std::string t = type_str;
+    std::transform(t.begin(), t.end(), t.begin(), ::toupper);
+    rule.pattern = pattern;
+    rule.keep = t == "KEEP";
+    rule.type = rule.keep ? GGML_TYPE_COUNT : ggml_parse_type(t);
+    if (!rule.keep && rule.type == GGML_TYPE_COUNT) {
+        fprintf(stderr, "Error: Unknown type '%s' in rule for '%s'\n", type_str.c_str(), pattern.c_str());
+        return false;
+    }
+    try {
+        rule.re = std::regex(pattern, std::regex::ECMAScript | std::regex::optimize);
+    } catch (const std::regex_error & e) {
+        fprintf(stderr, "Error: Invalid rule pattern '%s': %s\n", pattern.c_str(), e.what());
+        return false;
+    }
+    return true;
+}
+
+
+// Recipe file: one "PATTERN TYPE" (or PATTERN=TYPE) rule per line, '#' starts a comment
+bool load_recipe(const std::string & path, std::vector<quant_rule> & rules) {
+    std::ifstream file(path);
+    if (!file) {
+        fprintf(stderr, "Error: Cannot open recipe file: %s\n", path.c_str());
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        std::replace(line.begin(), line.end(), '=', ' ');
+        char pattern[512];
+        char type[32];
+        if (sscanf(line.c_str(), "%511s %31s", pattern, type) != 2) {
+            continue;
+        }
+        quant_rule rule;
+        if (!parse_rule(pattern, type, rule)) {
+            return false;
+        }
+        rules.push_back(rule);
+    }
+    return true;
+}
+
+
+// Q8_0 if aligned (better than F16 or F32), otherwise F32
+ggml_type fallback_type(struct ggml_tensor * tensor) {
+    return is_aligned(tensor, GGML_TYPE_Q8_0) ? GGML_TYPE_Q8_0 : GGML_TYPE_F32;
+}
+
+
+ggml_type choose_type(const std::string & name, struct ggml_tensor * tensor, ggml_type target_type,
+                      const std::vector<quant_rule> & rules, std::string & reason) {
+    // Already quantized tensors are copied; 1-D tensors (norms, biases)
+    // are consumed by element-wise ops and stay as they are
+    if ((tensor->type != GGML_TYPE_F32 && tensor->type != GGML_TYPE_F16) || ggml_n_dims(tensor) == 1) {
+        reason = "keep";
+        return tensor->type;
+    }
+
+    ggml_type type = GGML_TYPE_COUNT;
+    for (const auto & rule : rules) {
+        if (std::regex_search(name, rule.re)) {
+            reason = "rule " + rule.pattern;
+            type = rule.keep ? tensor->type : rule.type;
+            break;
+        }
+    }
+
+    if (type == GGML_TYPE_COUNT) {
+        if (should_quantize(name, tensor, target_type)) {
+            reason = "target";
+            return target_type;
+        }
+        if (tensor->type == GGML_TYPE_F16) {
+            reason = "fallback";
+            return fallback_type(tensor);
+        }
+        reason = "keep";
+        return tensor->type;
+    }
+
+    if (!is_aligned(tensor, type)) {
+        reason += ", unaligned";
+        return fallback_type(tensor);
+    }
+    return type;
+}
+
+
+static bool write_zeros(FILE * out, size_t n) {
+    static const char zeros[64] = {0};
+    while (n > 0) {
+        const size_t k = std::min(n, sizeof(zeros));
+        if (fwrite(zeros, 1, k, out) != k) {
+            return false;
+        }
+        n -= k;
+    }
+    return true;
+}
+
+
+// One tensor of the output. Its rows are those of the input tensors in
+// parts, in order: a single part, or with --fuse the Q/K/V (gate/up)
+// projections of a layer. A part without an input (index -1) is n_zero
+// zero elements, the bias of a projection that has none.
+struct output_part {
+    int index = -1;
+    int64_t n_zero = 0;
+};
+
+struct output_tensor {
+    std::string name;
+    std::vector<output_part> parts;
+    struct ggml_tensor * shape = nullptr;  // input type, output shape
+    ggml_type type = GGML_TYPE_COUNT;
+};
+
+
+// Fused tensor for one group of the layer at prefix, or false when the
+// group cannot be fused: all weights must exist with the same type and row
+// length (the encoder FFN has no gate, so its up projection stays alone)
+static bool plan_fused(struct gguf_context * ctx_inp, struct ggml_context * ctx_data, struct ggml_context * ctx_meta,
+                       const std::string & prefix, const std::string & fused, const std::vector<std::string> & part_names,
+                       const std::string & kind, output_tensor & out) {
+    std::vector<struct ggml_tensor *> weights;
+    for (const auto & part : part_names) {
+        struct ggml_tensor * w = ggml_get_tensor(ctx_data, (prefix + part + ".weight").c_str());
+        if (!w || ggml_n_dims(w) != 2 || w->type != (weights.empty() ? w->type : weights[0]->type) ||
+            w->ne[0] != (weights.empty() ? w->ne[0] : weights[0]->ne[0])) {
+            return false;
+        }
+        weights.push_back(w);
+    }
+
+    out.name = prefix + fused + "." + kind;
+    out.parts.clear();
+    struct ggml_tensor * first = nullptr;
+    int64_t n_out = 0;
+    for (size_t p = 0; p < part_names.size(); ++p) {
+        output_part part;
+        part.index = (int)gguf_find_tensor(ctx_inp, (prefix + part_names[p] + "." + kind).c_str());
+        if (part.index < 0) {
+            part.n_zero = weights[p]->ne[1];
+        } else {
+            struct ggml_tensor * t = ggml_get_tensor(ctx_data, gguf_get_tensor_name(ctx_inp, part.index));
+            if (first && t->type != first->type) {
+                return false;
+            }
+            first = first ? first : t;
+        }
+        n_out += weights[p]->ne[1];
+        out.parts.push_back(part);
+    }
+    if (!first) {
+        return false;
+    }
+
+    out.shape = kind == "weight" ? ggml_new_tensor_2d(ctx_meta, first->type, first->ne[0], n_out)
+                                 : ggml_new_tensor_1d(ctx_meta, first->type, n_out);
+    return true;
+}
+
+
+// Output tensors in input order; with fuse each fused tensor takes the
+// place of its first part
+static std::vector<output_tensor> plan_outputs(struct gguf_context * ctx_inp, struct ggml_context * ctx_data,
+                                               struct ggml_context * ctx_meta, bool fuse) {
+    static const std::vector<std::pair<std::string, std::vector<std::string>>> groups = {
+        {"attn_qkv",    {"attn_q", "attn_k", "attn_v"}},
+        {"ffn_gate_up", {"ffn_gate", "ffn_up"}},
+    };
+    const std::regex fuse_re(QUANTIZE_FUSE_PATTERN);
+
+    const int n_tensors = gguf_get_n_tensors(ctx_inp);
+    std::vector<bool> used(n_tensors, false);
+    std::vector<output_tensor> outputs;
+    for (int i = 0; i < n_tensors; ++i) {
+        if (used[i]) {
+            continue;
+        }
+        const std::string name = gguf_get_tensor_name(ctx_inp, i);
+
+        std::smatch m;
+        if (fuse && std::regex_match(name, m, fuse_re)) {
+            for (const auto & group : groups) {
+                output_tensor out;
+                if (std::find(group.second.begin(), group.second.end(), m[2].str()) == group.second.end() ||
+                    !plan_fused(ctx_inp, ctx_data, ctx_meta, m[1].str(), group.first, group.second, m[3].str(), out)) {
+                    continue;
+                }
+                for (const auto & part : out.parts) {
+                    if (part.index >= 0) {
+                        used[part.index] = true;
+                    }
+                }
+                outputs.push_back(out);
+                break;
+            }
+            if (used[i]) {
+                continue;
+            }
+        }
+
+        output_tensor out;
+        out.name = name;
+        out.parts.push_back({i, 0});
+        out.shape = ggml_get_tensor(ctx_data, name.c_str());
+        outputs.push_back(out);
+    }
+    return outputs;
+}
+
+
+// Importance matrix of one part: its own entry, or the fused tensor's when
+// the matrix was collected on a fused model (all parts share the input)
+static const float * find_imatrix(const qwen3_asr::imatrix_data & imatrix, const std::string & name,
+                                  const std::string & fused_name, int64_t n_per_row) {
+    for (const std::string * key : {&name, &fused_name}) {
+        auto it = imatrix.find(*key);
+        if (it != imatrix.end() && (int64_t)it->second.size() == n_per_row) {
+            return it->second.data();
+        }
+    }
+    return nullptr;
+}
+
+
+// Converts the rows of src to type and writes them, one slab at a time
+static bool write_quantized(FILE * out, const uint8_t * src, ggml_type src_type, int64_t n_rows, int64_t n_per_row,
+                            ggml_type type, const float * imat, std::vector<uint8_t> & slab_out, size_t & nbytes_out) {
+    const size_t row_inp = ggml_row_size(src_type, n_per_row);
+    const size_t row_out = ggml_row_size(type, n_per_row);
+    const int64_t slab_rows = std::max<int64_t>(1, QUANTIZE_SLAB_BYTES / (n_per_row * sizeof(float)));
+
+    for (int64_t r0 = 0; r0 < n_rows; r0 += slab_rows) {
+        const int64_t r1 = std::min(n_rows, r0 + slab_rows);
+        slab_out.resize((size_t)(r1 - r0) * row_out);
+
+        #pragma omp parallel
+        {
+            std::vector<float> f32_buf;
+
+            #pragma omp for schedule(dynamic)
+            for (int64_t r = r0; r < r1; r += QUANTIZE_TASK_ROWS) {
+                const int64_t nr = std::min<int64_t>(QUANTIZE_TASK_ROWS, r1 - r);
+                const uint8_t * row_src = src + (size_t)r * row_inp;
+
+                // Bridge to F32
+                const float * src_ptr = (const float *)row_src;
+                if (src_type == GGML_TYPE_F16) {
+                    f32_buf.resize((size_t)nr * n_per_row);
+                    ggml_fp16_to_fp32_row((const ggml_fp16_t *)row_src, f32_buf.data(), nr * n_per_row);
+                    src_ptr = f32_buf.data();
+                }
+                ggml_quantize_chunk(type, src_ptr, slab_out.data() + (size_t)(r - r0) * row_out,
+                                    0, nr, n_per_row, imat);
+            }
+        }
+
+        if (fwrite(slab_out.data(), 1, slab_out.size(), out) != slab_out.size()) {
+            return false;
+        }
+        nbytes_out += slab_out.size();
+    }
+    return true;
+}
+
+
+void print_usage(const char * prog) {
+    fprintf(stderr, "Usage: %s [options] input.gguf output.gguf type\n", prog);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Tensors are read from an mmap of the input and written out one slab of rows\n");
+    fprintf(stderr, "at a time, so memory use does not grow with the model size.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --rule PATTERN=TYPE    Type for tensors whose name matches the regex PATTERN\n");
+    fprintf(stderr, "                         (first matching rule wins; TYPE may be KEEP); repeatable\n");
+    fprintf(stderr, "  --recipe <path>        Read rules from a file, one 'PATTERN TYPE' per line\n");
+    fprintf(stderr, "  --imatrix <path>       Importance matrix (qwen3-asr-cli --imatrix-out)\n");
+    fprintf(stderr, "  --fuse                 Concatenate each layer's Q/K/V weights into attn_qkv and\n");
+    fprintf(stderr, "                         gate/up into ffn_gate_up (one matmul each at runtime)\n");
+    fprintf(stderr, "  -t, --threads <n>      Number of threads (default: all)\n");
+    fprintf(stderr, "  --dry-run              Print the per-tensor plan without writing\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Types: F32 F16 BF16 Q8_0 Q6_K Q5_K Q5_0 Q5_1 Q4_K Q4_0 Q4_1 Q3_K Q2_K IQ4_NL IQ4_XS\n");
+}
+
+
 int main(int argc, char ** argv) {
-    if (argc < 4) {
-        fprintf(stderr, "Usage: %s input.gguf output.gguf type\n", argv[0]);
+    std::vector<quant_rule> rules;
+    std::vector<std::string> positional;
+    std::string imatrix_path;
+    bool dry_run = false;
+    bool fuse = false;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--rule" && i + 1 < argc) {
+            const std::string spec = argv[++i];
+            const size_t eq = spec.rfind('=');
+            quant_rule rule;
+            if (eq == std::string::npos || eq == 0 || !parse_rule(spec.substr(0, eq), spec.substr(eq + 1), rule)) {
+                fprintf(stderr, "Error: Invalid rule '%s' (expected PATTERN=TYPE)\n", spec.c_str());
+                return 1;
+            }
+            rules.push_back(rule);
+        } else if (arg == "--recipe" && i + 1 < argc) {
+            if (!load_recipe(argv[++i], rules)) {
+                return 1;
+            }
+        } else if (arg == "--imatrix" && i + 1 < argc) {
+            imatrix_path = argv[++i];
+        } else if ((arg == "-t" || arg == "--threads") && i + 1 < argc) {
+            const int n_threads = atoi(argv[++i]);
+#ifdef _OPENMP
+            if (n_threads > 0) {
+                omp_set_num_threads(n_threads);
+            }
+#else
+            (void)n_threads;
+#endif
+        } else if (arg == "--fuse") {
+            fuse = true;
+        } else if (arg == "--dry-run") {
+            dry_run = true;
+        } else if (arg == "-h" || arg == "--help") {
+            print_usage(argv[0]);
+            return 0;
+        } else if (!arg.empty() && arg[0] == '-') {
+            fprintf(stderr, "Error: Unknown option: %s\n", arg.c_str());
+            print_usage(argv[0]);
+            return 1;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+
+    if (positional.size() != 3) {
+        print_usage(argv[0]);
         return 1;
     }
 
-    const char * fname_inp = argv[1];
-    const char * fname_out = argv[2];
-    ggml_type target_type  = ggml_parse_type(argv[3]);
+    const char * fname_inp = positional[0].c_str();
+    const char * fname_out = positional[1].c_str();
+    ggml_type target_type  = ggml_parse_type(positional[2]);
+    if (target_type == GGML_TYPE_COUNT) {
+        fprintf(stderr, "Error: Unknown type '%s'\n", positional[2].c_str());
+        return 1;
+    }
 
+    qwen3_asr::imatrix_data imatrix;
+    if (!imatrix_path.empty()) {
+        if (!qwen3_asr::load_imatrix(imatrix_path, imatrix)) {
+            return 1;
+        }
+        printf("Loaded importance matrix for %zu tensors from %s\n", imatrix.size(), imatrix_path.c_str());
+    }
+
+    // Metadata only: tensor data stays in the file and is read via mmap
     struct ggml_context * ctx_data = NULL;
-    struct gguf_init_params params = { .no_alloc = false, .ctx = &ctx_data };
+    struct gguf_init_params params = { .no_alloc = true, .ctx = &ctx_data };
     struct gguf_context * ctx_inp = gguf_init_from_file(fname_inp, params);
-    if (!ctx_inp) return 1;
+    if (!ctx_inp) {
+        fprintf(stderr, "Error: Failed to read GGUF file: %s\n", fname_inp);
+        return 1;
+    }
+
+    int fd = open(fname_inp, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: Cannot open %s\n", fname_inp);
+        return 1;
+    }
+    const size_t file_size = st.st_size;
+    void * mapped = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        fprintf(stderr, "Error: Failed to mmap %s\n", fname_inp);
+        return 1;
+    }
+    madvise(mapped, file_size, MADV_SEQUENTIAL);
+    const uint8_t * data_base = (const uint8_t *)mapped + gguf_get_data_offset(ctx_inp);
 
     struct gguf_context * ctx_out = gguf_init_empty();
     gguf_set_kv(ctx_out, ctx_inp);
 
     int n_tensors = gguf_get_n_tensors(ctx_inp);
     struct ggml_init_params meta_params = {
-        .mem_size   = ggml_tensor_overhead() * n_tensors + (2 * 1024 * 1024),
+        .mem_size   = 2 * ggml_tensor_overhead() * n_tensors + (2 * 1024 * 1024),
         .no_alloc   = true,
     };
     struct ggml_context * ctx_meta = ggml_init(meta_params);
-    
-    // Preparation for parallel results
-    std::vector<struct ggml_tensor *> new_tensors(n_tensors);
-    std::vector<void *> allocated_data(n_tensors, nullptr);
 
-#ifdef _OPENMP
-    printf("Starting quantization with %d threads...\n", omp_get_max_threads());
-#else
-    printf("Starting quantization (single-threaded)...\n");
-#endif
+    // Pass 1: decide every output type, so the header can be written first
+    std::vector<output_tensor> outputs = plan_outputs(ctx_inp, ctx_data, ctx_meta, fuse);
+    const int n_outputs = (int)outputs.size();
+    size_t size_inp = 0;
+    size_t size_out = 0;
+    for (int i = 0; i < n_outputs; ++i) {
+        output_tensor & out = outputs[i];
+        const char * name = out.name.c_str();
+        struct ggml_tensor * tensor = out.shape;
+        std::string reason;
+        ggml_type type = choose_type(name, tensor, target_type, rules, reason);
 
-    #pragma omp parallel for schedule(dynamic)
-    for (int i = 0; i < n_tensors; ++i) {
-        const char * name = gguf_get_tensor_name(ctx_inp, i);
-        struct ggml_tensor * tensor = ggml_get_tensor(ctx_data, name);
-        int64_t n_elements = ggml_nelements(tensor);
-
-        if (should_quantize(name, tensor, target_type) && (tensor->type == GGML_TYPE_F32 || tensor->type == GGML_TYPE_F16)) {
-            // Bridge to F32
-            std::vector<float> f32_buf(n_elements);
-            const float * src_ptr = nullptr;
-            if (tensor->type == GGML_TYPE_F16) {
-                ggml_fp16_to_fp32_row((const ggml_fp16_t *)tensor->data, f32_buf.data(), n_elements);
-                src_ptr = f32_buf.data();
-            } else {
-                src_ptr = (const float *)tensor->data;
+        if (type != tensor->type && ggml_quantize_requires_imatrix(type)) {
+            for (const auto & part : out.parts) {
+                if (part.index < 0) {
+                    continue;
+                }
+                const std::string part_name = gguf_get_tensor_name(ctx_inp, part.index);
+                if (!find_imatrix(imatrix, part_name, out.name, tensor->ne[0])) {
+                    fprintf(stderr, "Error: %s needs an importance matrix entry for %s (use --imatrix)\n",
+                            ggml_type_name(type), part_name.c_str());
+                    return 1;
+                }
             }
+        }
+        out.type = type;
 
-            size_t size_new = ggml_row_size(target_type, n_elements);
-            void * data_new = malloc(size_new);
-            allocated_data[i] = data_new;
+        struct ggml_tensor * q_t = ggml_new_tensor(ctx_meta, type, ggml_n_dims(tensor), tensor->ne);
+        ggml_set_name(q_t, name);
+        gguf_add_tensor(ctx_out, q_t);
 
-            ggml_quantize_chunk(target_type, src_ptr, data_new, 0, n_elements / tensor->ne[0], tensor->ne[0], nullptr);
+        size_inp += ggml_nbytes(tensor);
+        size_out += ggml_nbytes(q_t);
+        printf("[%3d/%d] %-48s %-6s -> %-6s (%s%s)\n", i+1, n_outputs, name,
+               ggml_type_name(tensor->type), ggml_type_name(type), reason.c_str(),
+               out.parts.size() > 1 ? ", fused" : "");
+    }
+    printf("Tensor data: %.1f MB -> %.1f MB\n", size_inp / 1e6, size_out / 1e6);
 
-            #pragma omp critical
-            {
-                printf("[%3d/%d] Quantizing %-40s to %s\n", i+1, n_tensors, name, ggml_type_name(target_type));
-                struct ggml_tensor * q_t = ggml_new_tensor(ctx_meta, target_type, ggml_n_dims(tensor), tensor->ne);
-                ggml_set_name(q_t, name);
-                q_t->data = data_new;
-                new_tensors[i] = q_t;
-            }
-        }
-        else if (tensor->type == GGML_TYPE_F16) {
-            // --- SMART FALLBACK SYSTEM ---
-            ggml_type fallback_type = GGML_TYPE_F32; // Default fallback
+    if (dry_run) {
+        munmap(mapped, file_size);
+        ggml_free(ctx_meta);
+        ggml_free(ctx_data);
+        gguf_free(ctx_inp);
+        gguf_free(ctx_out);
+        return 0;
+    }
 
-            // Try to use Q8_0 if it's aligned (better than F16 or F32)
-            if (is_aligned(tensor, GGML_TYPE_Q8_0)) {
-                fallback_type = GGML_TYPE_Q8_0;
-            }
+    FILE * fout = fopen(fname_out, "wb");
+    if (!fout) {
+        fprintf(stderr, "Error: Cannot open output file: %s\n", fname_out);
+        return 1;
+    }
+    std::vector<uint8_t> meta(gguf_get_meta_size(ctx_out));
+    gguf_get_meta_data(ctx_out, meta.data());
+    bool ok = fwrite(meta.data(), 1, meta.size(), fout) == meta.size();
 
-            // Prepare F32 source for the quantizer
-            std::vector<float> f32_buf(n_elements);
-            const float * src_ptr = nullptr;
-            if (tensor->type == GGML_TYPE_F16) {
-                ggml_fp16_to_fp32_row((const ggml_fp16_t *)tensor->data, f32_buf.data(), n_elements);
-                src_ptr = f32_buf.data();
-            } else {
-                src_ptr = (const float *)tensor->data;
+#ifdef _OPENMP
+    printf("Writing %s with %d threads...\n", fname_out, omp_get_max_threads());
+#else
+    printf("Writing %s (single-threaded)...\n", fname_out);
+#endif
+
+    // Pass 2: stream each tensor, part by part and slab by slab, in header order
+    const size_t alignment = gguf_get_alignment(ctx_out);
+    const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    std::vector<uint8_t> slab_out;
+    for (int i = 0; ok && i < n_outputs; ++i) {
+        const output_tensor & out = outputs[i];
+        const ggml_type type = out.type;
+        const int64_t n_per_row = out.shape->ne[0];
+        size_t nbytes_out = 0;
+
+        for (size_t p = 0; ok && p < out.parts.size(); ++p) {
+            const output_part & part = out.parts[p];
+            if (part.index < 0) {
+                const size_t n = ggml_row_size(type, part.n_zero);
+                ok = write_zeros(fout, n);
+                nbytes_out += n;
+                continue;
             }
 
-            size_t size_new = ggml_row_size(fallback_type, n_elements);
-            void * data_new = malloc(size_new);
-            allocated_data[i] = data_new;
+            const char * name = gguf_get_tensor_name(ctx_inp, part.index);
+            struct ggml_tensor * tensor = ggml_get_tensor(ctx_data, name);
+            const uint8_t * src = data_base + gguf_get_tensor_offset(ctx_inp, part.index);
+            const size_t nbytes_inp = ggml_nbytes(tensor);
 
-            if (fallback_type == GGML_TYPE_Q8_0) {
-                #pragma omp critical
-                printf("[%3d/%d] Fallback   %-40s to Q8_0\n", i+1, n_tensors, name);
-                ggml_quantize_chunk(fallback_type, src_ptr, data_new, 0, n_elements / tensor->ne[0], tensor->ne[0], nullptr);
+            if (type == tensor->type) {
+                ok = fwrite(src, 1, nbytes_inp, fout) == nbytes_inp;
+                nbytes_out += nbytes_inp;
             } else {
-                #pragma omp critical
-                printf("[%3d/%d] Fallback   %-40s to F32\n", i+1, n_tensors, name);
-                memcpy(data_new, src_ptr, size_new);
+                const float * imat = find_imatrix(imatrix, name, out.name, n_per_row);
+                ok = write_quantized(fout, src, tensor->type, ggml_nelements(tensor) / n_per_row, n_per_row,
+                                     type, imat, slab_out, nbytes_out);
             }
 
-            #pragma omp critical
-            {
-                struct ggml_tensor * f_t = ggml_new_tensor(ctx_meta, fallback_type, ggml_n_dims(tensor), tensor->ne);
-                ggml_set_name(f_t, name);
-                f_t->data = data_new;
-                new_tensors[i] = f_t;
-            }
+            // The pages of this tensor are not needed again
+            const uintptr_t begin = (uintptr_t)src & ~(page - 1);
+            madvise((void *)begin, (uintptr_t)src + nbytes_inp - begin, MADV_DONTNEED);
         }
-        else {
-            new_tensors[i] = tensor; // Keep existing (F32 or already quantized)
-        }
-    }
 
-    // Serial step to add to GGUF
-    for (int i = 0; i < n_tensors; ++i) {
-        gguf_add_tensor(ctx_out, new_tensors[i]);
+        ok = ok && write_zeros(fout, GGML_PAD(nbytes_out, alignment) - nbytes_out);
     }
 
-    gguf_write_to_file(ctx_out, fname_out, false);
+    if (fclose(fout) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Failed to write %s\n", fname_out);
+    } else {
+        printf("Done: %s\n", fname_out);
+    }
 
     // Cleanup
-    for (void * ptr : allocated_data) if(ptr) free(ptr);
+    munmap(mapped, file_size);
     ggml_free(ctx_meta);
     ggml_free(ctx_data);
     gguf_free(ctx_inp);
     gguf_free(ctx_out);
-    
-    return 0;
+
+    return ok ? 0 : 1;
 }
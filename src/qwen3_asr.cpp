@@ -1,12 +1,46 @@
 #include "qwen3_asr.h"
 #include "timing.h"
+#include "loop_detector.h"
 
 #include <cstdio>
 #include <cstring>
 #include <cmath>
+#include <cctype>
 #include <chrono>
 #include <algorithm>
 #include <fstream>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Longest n-gram matched when drafting tokens from the generated text
+#define QWEN3_ASR_DRAFT_NGRAM 3
+
+// KV rows reserved per beam on top of max_tokens, for the partial page a
+// beam copies when it first writes after a fork
+#define QWEN3_ASR_BEAM_SLACK 32
+
+// Encoder output frames per second of audio (100 mel frames -> 13)
+#define QWEN3_ASR_AUDIO_FRAMES_PER_SEC 13.0f
+
+// Tokens allowed on top of the max_tokens_per_sec budget (language header)
+#define QWEN3_ASR_BUDGET_EXTRA_TOKENS 16
+
+// Graph size of the shared compute arena (the largest of all its users)
+#define QWEN3_ASR_ARENA_NODES 16384
+
+// Compute buffers are reserved at load time for this much audio (30 s) and
+// a prompt of its encoder frames plus this many text tokens
+#define QWEN3_ASR_RESERVE_MEL_FRAMES 3000
+#define QWEN3_ASR_RESERVE_PROMPT_EXTRA 32
+
+// Language identification: header tokens decoded greedily before the name,
+// and tokens a candidate name may take to reach the "|" delimiter
+#define QWEN3_ASR_LANGUAGE_PREFIX "language "
+#define QWEN3_ASR_LID_MAX_HEADER_TOKENS 4
+#define QWEN3_ASR_LID_MAX_NAME_TOKENS 8
 
 namespace qwen3_asr {
 
@@ -15,24 +49,165 @@ static int64_t get_time_ms() {
         std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
+namespace {
+
+// Prompt-lookup drafting: find the latest earlier occurrence of the last n
+// tokens of history (longest n first, up to QWEN3_ASR_DRAFT_NGRAM) and
+// propose the up to n_draft tokens that followed it
+void draft_from_history(const std::vector<int32_t> & history, int32_t n_draft,
+                        std::vector<int32_t> & draft) {
+    draft.clear();
+    const int32_t n_hist = history.size();
+    for (int32_t n = std::min(QWEN3_ASR_DRAFT_NGRAM, n_hist - 1); n >= 1; --n) {
+        const int32_t * tail = history.data() + n_hist - n;
+        for (int32_t start = n_hist - n - 1; start >= 0; --start) {
+            if (std::equal(tail, tail + n, history.data() + start)) {
+                const int32_t from = start + n;
+                draft.assign(history.begin() + from,
+                             history.begin() + std::min(from + n_draft, n_hist));
+                return;
+            }
+        }
+    }
+}
+
+// Bounded blocking queue between the transcribe_batch stages
+template <typename T>
+class stage_queue {
+public:
+    explicit stage_queue(size_t capacity) : capacity_(capacity) {}
+    
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [&] { return items_.size() < capacity_; });
+        items_.push_back(std::move(item));
+        not_empty_.notify_one();
+    }
+    
+    // 1: got an item, 0: nothing yet (only when !wait), -1: closed and drained
+    int pop(T & item, bool wait) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (wait) {
+            not_empty_.wait(lock, [&] { return !items_.empty() || closed_; });
+        }
+        if (items_.empty()) {
+            return closed_ ? -1 : 0;
+        }
+        item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return 1;
+    }
+    
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+    }
+    
+private:
+    size_t capacity_;
+    std::deque<T> items_;
+    bool closed_ = false;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+};
+
+struct batch_mel_item {
+    size_t index = 0;
+    MelSpectrogram mel;
+    float audio_sec = 0.0f;
+    int64_t t_mel_ms = 0;
+    std::string error;
+};
+
+struct batch_enc_item {
+    size_t index = 0;
+    std::vector<float> features;
+    device_features device;      // instead of features, in encoder output slot device_slot
+    int32_t device_slot = -1;
+    int32_t n_frames = 0;
+    float audio_sec = 0.0f;
+    int64_t t_mel_ms = 0;
+    int64_t t_encode_ms = 0;
+    std::string error;
+};
+
+} // namespace
+
 Qwen3ASR::Qwen3ASR() = default;
 Qwen3ASR::~Qwen3ASR() = default;
 
-bool Qwen3ASR::load_model(const std::string & model_path) {
+bool Qwen3ASR::load_model(const std::string & model_path,
+                          const cpu_backend_params & cpu_params) {
+    return load_model(model_path, cpu_params, cpu_params);
+}
+
+bool Qwen3ASR::load_model(const std::string & model_path,
+                          const cpu_backend_params & encoder_params,
+                          const cpu_backend_params & decoder_params) {
     int64_t t_start = get_time_ms();
     
-    if (!encoder_.load_model(model_path)) {
+    if (ComputeArena::can_share(encoder_params, decoder_params)) {
+        arena_ = std::make_shared<ComputeArena>();
+        if (!arena_->init(decoder_params, QWEN3_ASR_ARENA_NODES)) {
+            error_msg_ = "Failed to create compute arena: " + arena_->get_error();
+            arena_.reset();
+            return false;
+        }
+    }
+    
+    // Separate threadpools on the same CPUs must not poll: the encoder of
+    // one request and the decoder of another compute at once in batch and
+    // server mode, and spinning workers would take each other's cores
+    cpu_backend_params enc_params = encoder_params;
+    cpu_backend_params dec_params = decoder_params;
+    if (!arena_ && threadpools_overlap(enc_params, dec_params)) {
+        enc_params.poll = 0;
+        dec_params.poll = 0;
+    }
+    
+    auto file = std::make_shared<ModelFile>();
+    if (!file->open(model_path, file_params_)) {
+        error_msg_ = file->get_error();
+        return false;
+    }
+    
+    if (!encoder_.load_model(file, enc_params, arena_)) {
         error_msg_ = "Failed to load audio encoder: " + encoder_.get_error();
         return false;
     }
     
-    if (!decoder_.load_model(model_path)) {
+    if (!decoder_.load_model(file, dec_params, arena_)) {
         error_msg_ = "Failed to load text decoder: " + decoder_.get_error();
         return false;
     }
     
+    // The components keep the mapping; the parsed metadata is done with
+    file->release_metadata();
+    
     generate_mel_filters(mel_filters_, QWEN_N_MELS, QWEN_N_FFT, QWEN_SAMPLE_RATE);
     
+    if (encoder_.has_gpu() && !encoder_.init_mel_frontend(mel_filters_)) {
+        error_msg_ = "Failed to set up GPU mel front end: " + encoder_.get_error();
+        return false;
+    }
+    
+    device_features_ = decoder_.can_read_buffer(encoder_.get_output_buffer_type());
+    
+    // Size the compute buffers once for a full 30 s window, so the first
+    // request does not grow them and the memory report is meaningful
+    const int32_t n_audio_reserve = (int32_t)(QWEN3_ASR_RESERVE_MEL_FRAMES / 100 * QWEN3_ASR_AUDIO_FRAMES_PER_SEC);
+    if (!encoder_.reserve_compute(QWEN3_ASR_RESERVE_MEL_FRAMES)) {
+        error_msg_ = "Failed to reserve encoder compute buffers: " + encoder_.get_error();
+        return false;
+    }
+    if (!decoder_.reserve_compute(n_audio_reserve + QWEN3_ASR_RESERVE_PROMPT_EXTRA, n_audio_reserve)) {
+        error_msg_ = "Failed to reserve decoder compute buffers: " + decoder_.get_error();
+        return false;
+    }
+    
     model_loaded_ = true;
     
     int64_t t_end = get_time_ms();
@@ -41,8 +216,38 @@ bool Qwen3ASR::load_model(const std::string & model_path) {
     return true;
 }
 
+asr_memory_usage Qwen3ASR::get_memory_usage() const {
+    asr_memory_usage mem;
+    mem.encoder = encoder_.get_memory_usage();
+    mem.decoder = decoder_.get_memory_usage();
+    if (arena_) {
+        mem.shared = arena_->get_memory_usage();
+    }
+    mem.shared_compute = arena_ != nullptr;
+    return mem;
+}
+
+void Qwen3ASR::print_memory_usage() const {
+    const asr_memory_usage mem = get_memory_usage();
+    const double mib = 1024.0 * 1024.0;
+    auto print_row = [&](const char * name, const memory_usage & m) {
+        fprintf(stderr, "  %-8s weights %8.1f  kv %8.1f  buffers %8.1f  compute %8.1f device / %8.1f host  = %8.1f MiB\n",
+                name, m.weights / mib, m.kv_cache / mib, m.buffers / mib,
+                m.compute_device / mib, m.compute_host / mib, m.total() / mib);
+    };
+    
+    fprintf(stderr, "Memory usage (%s compute buffers):\n", mem.shared_compute ? "shared" : "separate");
+    print_row("encoder", mem.encoder);
+    print_row("decoder", mem.decoder);
+    if (mem.shared_compute) {
+        print_row("shared", mem.shared);
+    }
+    print_row("total", mem.total());
+}
+
 transcribe_result Qwen3ASR::transcribe(const std::string & audio_path,
                                         const transcribe_params & params) {
+    QWEN3_TRACE_REQUEST();
     transcribe_result result;
     
     if (!model_loaded_) {
@@ -53,21 +258,17 @@ transcribe_result Qwen3ASR::transcribe(const std::string & audio_path,
     std::vector<float> samples;
     int sample_rate;
     
-    if (!load_wav(audio_path, samples, sample_rate)) {
+    if (!load_audio_file(audio_path, samples, sample_rate)) {
         result.error_msg = "Failed to load audio file: " + audio_path;
         return result;
     }
     
-    if (sample_rate != QWEN_SAMPLE_RATE) {
-        result.error_msg = "Audio must be 16kHz, got " + std::to_string(sample_rate) + " Hz";
-        return result;
-    }
-    
     return transcribe_internal(samples.data(), samples.size(), params);
 }
 
 transcribe_result Qwen3ASR::transcribe(const float * samples, int n_samples,
                                         const transcribe_params & params) {
+    QWEN3_TRACE_REQUEST();
     transcribe_result result;
     
     if (!model_loaded_) {
@@ -78,10 +279,97 @@ transcribe_result Qwen3ASR::transcribe(const float * samples, int n_samples,
     return transcribe_internal(samples, n_samples, params);
 }
 
+transcribe_result Qwen3ASR::transcribe(const MelSpectrogram & mel, int n_samples,
+                                        const transcribe_params & params) {
+    QWEN3_TRACE_REQUEST();
+    transcribe_result result;
+    
+    if (!model_loaded_) {
+        result.error_msg = "Model not loaded";
+        return result;
+    }
+    
+    if (feature_cache_) {
+        const uint64_t key = hash_samples(mel.data.data(), mel.data.size(), ~feature_seed());
+        if (transcribe_cached(key, n_samples, params, result)) {
+            return result;
+        }
+        return transcribe_mel(mel, n_samples, 0, params, &key);
+    }
+    
+    return transcribe_mel(mel, n_samples, 0, params);
+}
+
+void Qwen3ASR::set_feature_cache(const feature_cache_params & params) {
+    feature_cache_ = std::make_unique<FeatureCache>(params);
+}
+
+uint64_t Qwen3ASR::feature_seed() {
+    if (feature_seed_ == 0) {
+        feature_seed_ = encoder_.weight_fingerprint();
+    }
+    return feature_seed_;
+}
+
+uint64_t Qwen3ASR::feature_key(const float * samples, int n_samples) {
+    return hash_samples(samples, n_samples, feature_seed());
+}
+
+bool Qwen3ASR::transcribe_cached(uint64_t key, int n_samples, const transcribe_params & params,
+                                 transcribe_result & result) {
+    int64_t t_start = get_time_ms();
+    cached_features entry;
+    if (!feature_cache_->lookup(key, entry)) {
+        return false;
+    }
+    if (params.print_progress) {
+        fprintf(stderr, "Feature cache hit: %016llx\n", (unsigned long long)key);
+    }
+    result = transcribe_features(entry.audio_features, nullptr, entry.n_mel_frames, n_samples, 0,
+                                 get_time_ms() - t_start, params);
+    return true;
+}
+
 transcribe_result Qwen3ASR::transcribe_internal(const float * samples, int n_samples,
                                                  const transcribe_params & params) {
     transcribe_result result;
-    int64_t t_total_start = get_time_ms();
+    
+    uint64_t cache_key = 0;
+    const bool use_cache = feature_cache_ && !params.use_vad;
+    if (use_cache) {
+        cache_key = feature_key(samples, n_samples);
+        if (transcribe_cached(cache_key, n_samples, params, result)) {
+            return result;
+        }
+    }
+    
+    // Reflect padding needs more than QWEN_N_FFT / 2 samples; shorter clips
+    // take the host path
+    if (params.gpu_mel && !params.use_vad && encoder_.has_mel_frontend() && n_samples > QWEN_N_FFT) {
+        int64_t t_encode_start = get_time_ms();
+        std::vector<float> audio_features;
+        device_features device;
+        const bool on_device = use_device_features(params);
+        int32_t n_mel_frames = 0;
+        {
+            QWEN3_TIMER("audio_encoding");
+            const bool ok = on_device ?
+                encoder_.encode_pcm_to_device(samples, n_samples, 0, device, n_mel_frames) :
+                encoder_.encode_pcm(samples, n_samples, audio_features, n_mel_frames);
+            if (!ok || (on_device && use_cache && !encoder_.read_device_features(device, audio_features))) {
+                result.error_msg = "Failed to encode audio: " + encoder_.get_error();
+                return result;
+            }
+        }
+        if (use_cache) {
+            cached_features entry;
+            entry.audio_features = audio_features;
+            entry.n_mel_frames = n_mel_frames;
+            feature_cache_->insert(cache_key, entry);
+        }
+        return transcribe_features(audio_features, on_device ? &device : nullptr, n_mel_frames, n_samples, 0,
+                                   get_time_ms() - t_encode_start, params);
+    }
     
     int64_t t_mel_start = get_time_ms();
     MelSpectrogram mel;
@@ -92,25 +380,183 @@ transcribe_result Qwen3ASR::transcribe_internal(const float * samples, int n_sam
             return result;
         }
     }
-    result.t_mel_ms = get_time_ms() - t_mel_start;
     
+    if (params.use_vad) {
+        return transcribe_segmented(samples, n_samples, mel, get_time_ms() - t_mel_start, params);
+    }
+    return transcribe_mel(mel, n_samples, get_time_ms() - t_mel_start, params,
+                          use_cache ? &cache_key : nullptr);
+}
+
+transcribe_result Qwen3ASR::transcribe_segmented(const float * samples, int n_samples,
+                                                  const MelSpectrogram & mel, int64_t t_mel_ms,
+                                                  const transcribe_params & params) {
+    transcribe_result result;
+    int64_t t_total_start = get_time_ms() - t_mel_ms;
+    
+    result.t_mel_ms = t_mel_ms;
+    result.audio_sec = (float)n_samples / QWEN_SAMPLE_RATE;
+    
+    std::vector<speech_segment> speech;
+    {
+        QWEN3_TIMER("vad");
+        speech = detect_speech_segments(mel, params.vad);
+    }
+    
+    // Skip slivers (under 250 ms) left by clamping to the end of the audio
+    std::vector<audio_clip> clips;
+    std::vector<std::pair<int, int>> ranges;
+    for (const auto & seg : speech) {
+        const int s0 = std::min(n_samples, seg.start_frame * QWEN_HOP_LENGTH);
+        const int s1 = std::min(n_samples, seg.end_frame * QWEN_HOP_LENGTH);
+        if (s1 - s0 < QWEN3_ASR_CONV_CHUNK * QWEN_HOP_LENGTH / 4) {
+            continue;
+        }
+        audio_clip clip;
+        clip.samples.assign(samples + s0, samples + s1);
+        clips.push_back(std::move(clip));
+        ranges.emplace_back(s0, s1);
+    }
+    
+    if (params.print_progress) {
+        float speech_sec = 0.0f;
+        for (const auto & r : ranges) {
+            speech_sec += (float)(r.second - r.first) / QWEN_SAMPLE_RATE;
+        }
+        fprintf(stderr, "VAD: %zu speech segments, %.1f s of %.1f s\n",
+                clips.size(), speech_sec, result.audio_sec);
+    }
+    
+    transcribe_params seg_params = params;
+    seg_params.use_vad = false;
+    seg_params.print_progress = false;
+    seg_params.print_timing = false;
+    seg_params.keep_audio_features = false;
+    
+    std::vector<transcribe_result> seg_results = transcribe_batch(clips, seg_params);
+    
+    // Stitch in time order; the language with the most speech wins
+    std::vector<std::pair<std::string, float>> lang_sec;
+    for (size_t i = 0; i < seg_results.size(); ++i) {
+        transcribe_result & r = seg_results[i];
+        if (!r.success) {
+            result.error_msg = "Segment " + std::to_string(i) + " failed: " + r.error_msg;
+            return result;
+        }
+        
+        transcribe_segment seg;
+        seg.start_sec = (float)ranges[i].first / QWEN_SAMPLE_RATE;
+        seg.end_sec = (float)ranges[i].second / QWEN_SAMPLE_RATE;
+        seg.language = r.language;
+        seg.text = r.text;
+        seg.tokens = r.tokens;
+        
+        if (!result.text.empty() && !seg.text.empty()) {
+            const unsigned char last = result.text.back();
+            const unsigned char first = seg.text.front();
+            if (last < 0x80 && first < 0x80 && !isspace(last) && !isspace(first)) {
+                result.text += ' ';
+            }
+        }
+        result.text += seg.text;
+        result.tokens.insert(result.tokens.end(), seg.tokens.begin(), seg.tokens.end());
+        
+        auto it = std::find_if(lang_sec.begin(), lang_sec.end(),
+                               [&](const std::pair<std::string, float> & l) { return l.first == seg.language; });
+        if (it == lang_sec.end()) {
+            lang_sec.emplace_back(seg.language, 0.0f);
+            it = lang_sec.end() - 1;
+        }
+        it->second += seg.end_sec - seg.start_sec;
+        
+        result.t_mel_ms += r.t_mel_ms;
+        result.t_encode_ms += r.t_encode_ms;
+        result.t_decode_ms += r.t_decode_ms;
+        result.segments.push_back(std::move(seg));
+    }
+    
+    result.language = "unknown";
+    float best_sec = 0.0f;
+    for (const auto & l : lang_sec) {
+        if (l.first != "unknown" && l.second > best_sec) {
+            result.language = l.first;
+            best_sec = l.second;
+        }
+    }
+    
+    result.t_total_ms = get_time_ms() - t_total_start;
+    result.success = true;
+    
+    if (params.print_timing) {
+        fprintf(stderr, "\nTiming (stage times summed over %zu segments):\n", result.segments.size());
+        fprintf(stderr, "  Mel spectrogram: %lld ms\n", (long long)result.t_mel_ms);
+        fprintf(stderr, "  Audio encoding:  %lld ms\n", (long long)result.t_encode_ms);
+        fprintf(stderr, "  Text decoding:   %lld ms\n", (long long)result.t_decode_ms);
+        fprintf(stderr, "  Total:           %lld ms\n", (long long)result.t_total_ms);
+        fprintf(stderr, "  Language:        %s\n", result.language.c_str());
+        fprintf(stderr, "  Tokens generated: %zu\n", result.tokens.size());
+    }
+    
+    return result;
+}
+
+transcribe_result Qwen3ASR::transcribe_mel(const MelSpectrogram & mel, int n_samples,
+                                            int64_t t_mel_ms, const transcribe_params & params,
+                                            const uint64_t * cache_key) {
     if (params.print_progress) {
         fprintf(stderr, "Mel spectrogram: [%d, %d]\n", mel.n_mel, mel.n_len);
     }
     
     int64_t t_encode_start = get_time_ms();
     std::vector<float> audio_features;
+    device_features device;
+    const bool on_device = use_device_features(params);
     {
         QWEN3_TIMER("audio_encoding");
-        if (!encoder_.encode(mel.data.data(), mel.n_mel, mel.n_len, audio_features)) {
+        const bool ok = on_device ?
+            encoder_.encode_to_device(mel.data.data(), mel.n_mel, mel.n_len, 0, device) :
+            encoder_.encode(mel.data.data(), mel.n_mel, mel.n_len, audio_features);
+        
+        // The cache keeps host copies, read back once
+        if (!ok || (on_device && cache_key && !encoder_.read_device_features(device, audio_features))) {
+            transcribe_result result;
             result.error_msg = "Failed to encode audio: " + encoder_.get_error();
             return result;
         }
     }
-    result.t_encode_ms = get_time_ms() - t_encode_start;
+    
+    if (cache_key) {
+        cached_features entry;
+        entry.audio_features = audio_features;
+        entry.n_mel_frames = mel.n_len;
+        if (feature_cache_->get_params().keep_mel) {
+            entry.mel = mel.data;
+            entry.n_mel = mel.n_mel;
+        }
+        feature_cache_->insert(*cache_key, entry);
+    }
+    
+    return transcribe_features(audio_features, on_device ? &device : nullptr, mel.n_len, n_samples, t_mel_ms,
+                               get_time_ms() - t_encode_start, params);
+}
+
+bool Qwen3ASR::use_device_features(const transcribe_params & params) const {
+    return device_features_ && !params.keep_audio_features;
+}
+
+transcribe_result Qwen3ASR::transcribe_features(std::vector<float> & audio_features,
+                                                 const device_features * device, int32_t n_mel_frames,
+                                                 int n_samples, int64_t t_mel_ms, int64_t t_encode_ms,
+                                                 const transcribe_params & params) {
+    transcribe_result result;
+    int64_t t_total_start = get_time_ms() - t_mel_ms - t_encode_ms;
+    
+    result.t_mel_ms = t_mel_ms;
+    result.t_encode_ms = t_encode_ms;
+    result.audio_sec = (float)n_samples / QWEN_SAMPLE_RATE;
     
     const auto & text_hparams = encoder_.get_text_hparams();
-    int32_t n_audio_frames = audio_features.size() / text_hparams.hidden_size;
+    int32_t n_audio_frames = device ? device->n_frames : (int32_t)(audio_features.size() / text_hparams.hidden_size);
     
     if (params.print_progress) {
         fprintf(stderr, "Audio features: [%d, %d]\n", n_audio_frames, text_hparams.hidden_size);
@@ -124,34 +570,37 @@ transcribe_result Qwen3ASR::transcribe_internal(const float * samples, int n_sam
     
     int64_t t_decode_start = get_time_ms();
     std::vector<int32_t> output_tokens;
-    if (!decode_greedy(input_tokens, audio_features, n_audio_frames, params, output_tokens)) {
+    audio_input audio;
+    audio.host = device ? nullptr : audio_features.data();
+    audio.device = device ? device->tensor : nullptr;
+    audio.n_frames = n_audio_frames;
+    
+    const bool decoded = params.n_beams > 1 || params.force_beam ?
+        decode_beam(input_tokens, audio, params, output_tokens, result.t_prefill_ms) :
+        decode_greedy(input_tokens, audio, params, output_tokens, result.t_prefill_ms);
+    if (!decoded) {
         result.error_msg = "Decoding failed: " + error_msg_;
         return result;
     }
     result.t_decode_ms = get_time_ms() - t_decode_start;
+    result.n_prompt_tokens = input_tokens.size();
     
-    std::string transcript = "";
-    std::string language = "unknown";
-    std::string full_text = decoder_.decode_tokens(output_tokens);
+    std::string transcript;
+    std::string language;
+    decode_transcript(output_tokens, language, transcript);
     
     result.t_total_ms = get_time_ms() - t_total_start;
     
-    // Quick string-based split if you don't want to loop tokens
-    size_t pos = full_text.find("language ");
-    if (pos != std::string::npos) {
-        // Find where the next word ends (the language name)
-        size_t end_pos = full_text.find_first_of("|", pos + 9);
-        language = full_text.substr(pos + 9, end_pos - (pos + 9));
-        transcript = full_text.substr(end_pos + 1);
-    } else {
-        transcript = full_text;
-    }
-    
     result.language = language;
     result.tokens = output_tokens;
     result.text = transcript;
     result.success = true;
     
+    if (params.keep_audio_features) {
+        result.audio_features = std::move(audio_features);
+        result.n_mel_frames = n_mel_frames;
+    }
+    
     if (params.print_timing) {
         fprintf(stderr, "\nTiming:\n");
         fprintf(stderr, "  Mel spectrogram: %lld ms\n", (long long)result.t_mel_ms);
@@ -159,7 +608,10 @@ transcribe_result Qwen3ASR::transcribe_internal(const float * samples, int n_sam
         fprintf(stderr, "  Text decoding:   %lld ms\n", (long long)result.t_decode_ms);
         fprintf(stderr, "  Total:           %lld ms\n", (long long)result.t_total_ms);
         fprintf(stderr, "  Language:        %s\n", result.language.c_str());
-        fprintf(stderr, "  Tokens generated: %zu\n", output_tokens.size());
+        fprintf(stderr, "  Tokens generated: %zu (%.1f tokens/s)\n", output_tokens.size(),
+                result.t_decode_ms > 0 ? 1000.0 * output_tokens.size() / result.t_decode_ms : 0.0);
+        fprintf(stderr, "  KV cache:        %.1f MiB (%s)\n",
+                decoder_.get_kv_cache_bytes() / (1024.0 * 1024.0), ggml_type_name(params.kv_type));
     }
     
     return result;
@@ -175,32 +627,30 @@ std::vector<int32_t> Qwen3ASR::build_input_tokens(int32_t n_audio_frames,
     // Chat template format:
     // <|im_start|>system\n<|im_end|>\n<|im_start|>user\n<|audio_start|><|audio_pad|>...<|audio_end|><|im_end|>\n<|im_start|>assistant\n
     
-    // Token IDs from Qwen3 tokenizer:
+    // Special tokens from the Qwen3 tokenizer:
     // <|im_start|> = 151644
     // <|im_end|> = 151645
-    // system = 8948
-    // user = 872
-    // assistant = 77091
-    // \n = 198
-    
     const int32_t im_start = 151644;
     const int32_t im_end = 151645;
-    const int32_t system_token = 8948;
-    const int32_t user_token = 872;
-    const int32_t assistant_token = 77091;
-    const int32_t newline = 198;
+    
+    // Plain text goes through the decoder's BPE tokenizer; the IDs for
+    // "system" (8948), "user" (872), "assistant" (77091) and "\n" (198)
+    // are the fallback for GGUF files without a vocabulary
+    auto append_text = [&](const char * text, std::initializer_list<int32_t> fallback) {
+        if (!decoder_.encode_text(text, tokens)) {
+            tokens.insert(tokens.end(), fallback);
+        }
+    };
     
     // <|im_start|>system\n<|im_end|>\n
     tokens.push_back(im_start);
-    tokens.push_back(system_token);
-    tokens.push_back(newline);
+    append_text("system\n", {8948, 198});
     tokens.push_back(im_end);
-    tokens.push_back(newline);
+    append_text("\n", {198});
     
     // <|im_start|>user\n
     tokens.push_back(im_start);
-    tokens.push_back(user_token);
-    tokens.push_back(newline);
+    append_text("user\n", {872, 198});
     
     // <|audio_start|><|audio_pad|>...<|audio_end|>
     tokens.push_back(cfg.audio_start_token_id);
@@ -211,30 +661,45 @@ std::vector<int32_t> Qwen3ASR::build_input_tokens(int32_t n_audio_frames,
     
     // <|im_end|>\n<|im_start|>assistant\n
     tokens.push_back(im_end);
-    tokens.push_back(newline);
+    append_text("\n", {198});
     tokens.push_back(im_start);
-    tokens.push_back(assistant_token);
-    tokens.push_back(newline);
+    append_text("assistant\n", {77091, 198});
     
     (void)language;
     
     return tokens;
 }
 
+int32_t Qwen3ASR::token_budget(const transcribe_params & params, int32_t n_audio_frames) {
+    if (params.max_tokens_per_sec <= 0.0f) {
+        return params.max_tokens;
+    }
+    const float audio_sec = n_audio_frames / QWEN3_ASR_AUDIO_FRAMES_PER_SEC;
+    const int32_t budget = QWEN3_ASR_BUDGET_EXTRA_TOKENS + (int32_t)ceilf(audio_sec * params.max_tokens_per_sec);
+    return std::max(1, std::min(params.max_tokens, budget));
+}
+
 bool Qwen3ASR::decode_greedy(const std::vector<int32_t> & input_tokens,
-                              const std::vector<float> & audio_features,
-                              int32_t n_audio_frames,
+                              const audio_input & audio,
                               const transcribe_params & params,
-                              std::vector<int32_t> & output_tokens) {
+                              std::vector<int32_t> & output_tokens,
+                              int64_t & t_prefill_ms) {
     const auto & cfg = decoder_.get_config();
     
-    int32_t n_ctx_needed = input_tokens.size() + params.max_tokens;
-    if (!decoder_.init_kv_cache(n_ctx_needed)) {
+    const int32_t max_tokens = token_budget(params, audio.n_frames);
+    int32_t n_ctx_needed = input_tokens.size() + max_tokens;
+    if (!decoder_.reserve_kv_cache(n_ctx_needed, 1, params.kv_type)) {
         error_msg_ = "Failed to initialize KV cache: " + decoder_.get_error();
         return false;
     }
+    decoder_.set_audio_input_type(params.f16_audio ? GGML_TYPE_F16 : GGML_TYPE_F32);
     
-    std::vector<float> logits;
+    // The one slot of the cache reserved above
+    const int32_t seq_id = 0;
+    
+    // Only the argmax leaves the device; the full logits rows are not needed
+    decoder_output out;
+    out.want_logits = false;
     
     int32_t audio_start_pos = find_audio_start_position(
         input_tokens.data(), input_tokens.size(), cfg.audio_pad_token_id);
@@ -243,86 +708,1250 @@ bool Qwen3ASR::decode_greedy(const std::vector<int32_t> & input_tokens,
         return false;
     }
     
+    int64_t t_prefill_start = get_time_ms();
     {
         QWEN3_TIMER("decode.initial_forward");
-        if (!decoder_.forward_with_audio(
-                input_tokens.data(), input_tokens.size(),
-                audio_features.data(), n_audio_frames,
-                audio_start_pos, 0, logits)) {
+        if (!prefill_prompt(input_tokens, audio, audio_start_pos, seq_id, out)) {
             error_msg_ = "Initial forward pass failed: " + decoder_.get_error();
             return false;
         }
     }
+    t_prefill_ms = get_time_ms() - t_prefill_start;
     
-    int32_t vocab_size = cfg.vocab_size;
-    int32_t n_input = input_tokens.size();
+    return continue_greedy(out.argmax[0], input_tokens.size(), seq_id, max_tokens,
+                           params.n_draft, params.stop_loops, params.print_progress, output_tokens);
+}
+
+bool Qwen3ASR::decode_beam(const std::vector<int32_t> & input_tokens,
+                            const audio_input & audio,
+                            const transcribe_params & params,
+                            std::vector<int32_t> & output_tokens,
+                            int64_t & t_prefill_ms) {
+    const auto & cfg = decoder_.get_config();
+    const int32_t n_beams = std::max(1, params.n_beams);  // force_beam may pass 1
+    const int32_t n_prompt = input_tokens.size();
+    const int32_t max_tokens = token_budget(params, audio.n_frames);
     
-    int32_t next_token = sample_greedy(logits.data(), vocab_size);
+    // One pool for all beams: the prompt once, then each beam's own tokens
+    const int32_t n_rows = n_prompt + n_beams * (max_tokens + QWEN3_ASR_BEAM_SLACK);
+    if (!decoder_.reserve_kv_cache(n_rows, 1, params.kv_type) || !decoder_.begin_paged(n_beams)) {
+        error_msg_ = "Failed to initialize KV cache: " + decoder_.get_error();
+        return false;
+    }
+    decoder_.set_audio_input_type(params.f16_audio ? GGML_TYPE_F16 : GGML_TYPE_F32);
     
-    output_tokens.clear();
-    output_tokens.push_back(next_token);
+    int32_t audio_start_pos = find_audio_start_position(
+        input_tokens.data(), input_tokens.size(), cfg.audio_pad_token_id);
+    if (audio_start_pos < 0) {
+        error_msg_ = "Failed to find audio start position in input tokens";
+        return false;
+    }
     
-    if (progress_callback_) {
-        progress_callback_(1, params.max_tokens);
+    // Per row, the n_beams best tokens and their log-probabilities
+    decoder_output out;
+    out.want_logits = false;
+    out.n_top_k = n_beams;
+    out.want_logprobs = true;
+    
+    int64_t t_prefill_start = get_time_ms();
+    {
+        QWEN3_TIMER("decode.initial_forward");
+        if (!prefill_prompt(input_tokens, audio, audio_start_pos, 0, out)) {
+            error_msg_ = "Initial forward pass failed: " + decoder_.get_error();
+            return false;
+        }
     }
+    t_prefill_ms = get_time_ms() - t_prefill_start;
     
-    int32_t n_past = n_input;
+    struct hypothesis {
+        std::vector<int32_t> tokens;  // generated so far, EOS excluded
+        float logprob = 0.0f;
+        int32_t seq = 0;              // KV slot of an alive beam
+    };
+    struct candidate {
+        float logprob;
+        int32_t parent;
+        int32_t token;
+    };
     
-    while (next_token != cfg.eos_token_id && 
-           (int32_t)output_tokens.size() < params.max_tokens) {
-        
-        std::vector<int32_t> single_token = {next_token};
+    // Finished hypotheses count their EOS in the length
+    const float alpha = params.length_penalty;
+    auto normalized = [alpha](const hypothesis & h, size_t n_tokens) {
+        return h.logprob / powf((float)std::max<size_t>(n_tokens, 1), alpha);
+    };
+    
+    // The prefill row acts as the output of a single parent beam in slot 0
+    std::vector<hypothesis> alive(1);
+    std::vector<hypothesis> finished;
+    std::vector<float> finished_scores;
+    std::vector<candidate> candidates;
+    std::vector<int32_t> parent_of;
+    std::vector<int32_t> seq_ids, tokens, n_past;
+    
+    while (!alive.empty()) {
+        candidates.clear();
+        for (int32_t b = 0; b < (int32_t)alive.size(); ++b) {
+            for (int32_t i = 0; i < n_beams; ++i) {
+                candidates.push_back({alive[b].logprob + out.top_k_logprobs[b * n_beams + i], b,
+                                      out.top_k[b * n_beams + i]});
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [](const candidate & a, const candidate & b) {
+            return a.logprob > b.logprob;
+        });
         
-        {
-            QWEN3_TIMER("decode.token");
-            if (!decoder_.forward(single_token.data(), 1, n_past, logits)) {
-                error_msg_ = "Forward pass failed at token " + 
-                             std::to_string(output_tokens.size()) + ": " + decoder_.get_error();
-                return false;
+        // Best n_beams continuations stay alive; EOS ends a hypothesis
+        std::vector<hypothesis> next;
+        parent_of.clear();
+        for (const candidate & c : candidates) {
+            if ((int32_t)next.size() == n_beams) {
+                break;
+            }
+            hypothesis h;
+            h.tokens = alive[c.parent].tokens;
+            h.logprob = c.logprob;
+            if (c.token == cfg.eos_token_id) {
+                finished_scores.push_back(normalized(h, h.tokens.size() + 1));
+                finished.push_back(std::move(h));
+                continue;
             }
+            h.tokens.push_back(c.token);
+            next.push_back(std::move(h));
+            parent_of.push_back(c.parent);
+        }
+        
+        if (progress_callback_ && !next.empty()) {
+            progress_callback_((int)next[0].tokens.size(), max_tokens, std::string_view());
+        }
+        if (params.print_progress && !next.empty() && next[0].tokens.size() % 10 == 0) {
+            fprintf(stderr, "Generated %zu tokens...\n", next[0].tokens.size());
         }
         
-        next_token = sample_greedy(logits.data(), vocab_size);
-        output_tokens.push_back(next_token);
+        // Out of tokens: the alive beams are final as they stand
+        if (!next.empty() && (int32_t)next[0].tokens.size() >= max_tokens) {
+            for (hypothesis & h : next) {
+                finished_scores.push_back(normalized(h, h.tokens.size()));
+                finished.push_back(std::move(h));
+            }
+            break;
+        }
         
-        n_past += 1;
+        // Early termination: enough finished hypotheses and the best alive
+        // one (all alive beams have the same length) no longer beats them
+        if ((int32_t)finished.size() >= n_beams && !next.empty()) {
+            std::vector<float> sorted = finished_scores;
+            std::nth_element(sorted.begin(), sorted.begin() + n_beams - 1, sorted.end(), std::greater<float>());
+            if (normalized(next[0], next[0].tokens.size()) <= sorted[n_beams - 1]) {
+                break;
+            }
+        }
+        if (next.empty()) {
+            break;
+        }
         
-        if (progress_callback_) {
-            progress_callback_(output_tokens.size(), params.max_tokens);
+        // Slots of beams without children are freed first; a parent's first
+        // child keeps its slot and further children fork it, sharing its pages
+        std::vector<int32_t> n_children(alive.size(), 0);
+        for (int32_t p : parent_of) {
+            ++n_children[p];
+        }
+        std::vector<bool> slot_used(n_beams, false);
+        for (size_t b = 0; b < alive.size(); ++b) {
+            if (n_children[b] > 0) {
+                slot_used[alive[b].seq] = true;
+            } else {
+                decoder_.clear_seq(alive[b].seq);
+            }
+        }
+        std::vector<int32_t> free_slots;
+        for (int32_t s = n_beams - 1; s >= 0; --s) {
+            if (!slot_used[s]) {
+                free_slots.push_back(s);
+            }
+        }
+        std::vector<bool> parent_slot_taken(alive.size(), false);
+        for (size_t i = 0; i < next.size(); ++i) {
+            const int32_t p = parent_of[i];
+            if (!parent_slot_taken[p]) {
+                parent_slot_taken[p] = true;
+                next[i].seq = alive[p].seq;
+                continue;
+            }
+            next[i].seq = free_slots.back();
+            free_slots.pop_back();
+            if (!decoder_.fork_seq(next[i].seq, alive[p].seq)) {
+                error_msg_ = "Beam fork failed: " + decoder_.get_error();
+                return false;
+            }
         }
         
-        if (params.print_progress && output_tokens.size() % 10 == 0) {
-            fprintf(stderr, "Generated %zu tokens...\n", output_tokens.size());
+        // Advance every beam by its newest token in one batched pass
+        seq_ids.clear();
+        tokens.clear();
+        n_past.clear();
+        for (const hypothesis & h : next) {
+            seq_ids.push_back(h.seq);
+            tokens.push_back(h.tokens.back());
+            n_past.push_back(n_prompt + (int32_t)h.tokens.size() - 1);
+        }
+        {
+            QWEN3_TIMER("decode.beam_step");
+            if (!decoder_.forward_batch(seq_ids.data(), tokens.data(), n_past.data(),
+                                        (int32_t)next.size(), out)) {
+                error_msg_ = "Forward pass failed at token " +
+                             std::to_string(next[0].tokens.size()) + ": " + decoder_.get_error();
+                return false;
+            }
         }
+        alive = std::move(next);
     }
     
-    if (output_tokens.back() == cfg.eos_token_id) {
-        output_tokens.pop_back();
+    if (finished.empty()) {
+        error_msg_ = "Beam search produced no hypothesis";
+        return false;
+    }
+    const size_t best = std::max_element(finished_scores.begin(), finished_scores.end()) - finished_scores.begin();
+    output_tokens = std::move(finished[best].tokens);
+    
+    if (progress_callback_) {
+        StreamingDetokenizer detok(decoder_);
+        std::string text;
+        for (int32_t token : output_tokens) {
+            text += detok.push(token);
+        }
+        text += detok.finish();
+        progress_callback_((int)output_tokens.size(), max_tokens, text);
     }
     
     return true;
 }
 
-int32_t Qwen3ASR::sample_greedy(const float * logits, int32_t vocab_size) {
-    int32_t max_idx = 0;
-    float max_val = logits[0];
+bool Qwen3ASR::prefill_prompt(const std::vector<int32_t> & input_tokens,
+                              const audio_input & audio,
+                              int32_t audio_start_pos, int32_t seq_id,
+                              decoder_output & out) {
+    // The chat template before the audio is the same for every request, so
+    // its KV rows are copied from a snapshot instead of being recomputed
+    const int32_t n_past = decoder_.restore_prefix(input_tokens.data(), input_tokens.size(), seq_id);
     
-    for (int32_t i = 1; i < vocab_size; ++i) {
-        if (logits[i] > max_val) {
-            max_val = logits[i];
-            max_idx = i;
-        }
+    const bool ok = audio.device ?
+        decoder_.forward_with_audio_device(input_tokens.data() + n_past, input_tokens.size() - n_past,
+                                           audio.device, audio.n_frames,
+                                           audio_start_pos - n_past, n_past, out, seq_id) :
+        decoder_.forward_with_audio(input_tokens.data() + n_past, input_tokens.size() - n_past,
+                                    audio.host, audio.n_frames,
+                                    audio_start_pos - n_past, n_past, out, seq_id);
+    if (!ok) {
+        return false;
     }
     
-    return max_idx;
-}
-
-void Qwen3ASR::set_progress_callback(progress_callback_t callback) {
-    progress_callback_ = std::move(callback);
+    // Only text tokens go into a snapshot: audio pad rows depend on the audio
+    if (n_past < audio_start_pos) {
+        decoder_.save_prefix(input_tokens.data(), audio_start_pos, seq_id);
+    }
+    
+    return true;
 }
 
-bool load_audio_file(const std::string & path, std::vector<float> & samples, int & sample_rate) {
-    return load_wav(path, samples, sample_rate);
+bool Qwen3ASR::continue_greedy(int32_t next_token, int32_t n_past, int32_t seq_id,
+                               int32_t max_tokens, int32_t n_draft, bool stop_loops,
+                               bool print_progress, std::vector<int32_t> & output_tokens) {
+    const auto & cfg = decoder_.get_config();
+    
+    decoder_output out;
+    out.want_logits = false;
+    
+    // Draft verification needs the argmax after every input token
+    decoder_output out_verify;
+    out_verify.want_logits = false;
+    out_verify.all_rows = true;
+    
+    output_tokens.clear();
+    output_tokens.push_back(next_token);
+    
+    // Text deltas are only worked out when someone listens
+    StreamingDetokenizer detok(decoder_);
+    if (progress_callback_) {
+        progress_callback_(1, max_tokens, detok.push(next_token));
+    }
+    
+    std::vector<int32_t> draft;
+    std::vector<int32_t> batch;
+    loop_detector loops;
+    bool looped = false;
+    
+    while (!looped && next_token != cfg.eos_token_id && 
+           (int32_t)output_tokens.size() < max_tokens) {
+        
+        const size_t n_before = output_tokens.size();
+        
+        // Leave room for the token the verify pass adds after the drafts
+        const int32_t n_room = std::min<int32_t>(n_draft, max_tokens - (int32_t)output_tokens.size() - 1);
+        draft.clear();
+        if (n_room > 0) {
+            draft_from_history(output_tokens, n_room, draft);
+        }
+        
+        if (!draft.empty()) {
+            // Verify next_token plus the draft in one pass: row i holds the
+            // greedy choice after input i, so drafts are kept while they match
+            batch.assign(1, next_token);
+            batch.insert(batch.end(), draft.begin(), draft.end());
+            {
+                QWEN3_TIMER("decode.verify");
+                if (!decoder_.forward(batch.data(), batch.size(), n_past, out_verify, seq_id)) {
+                    error_msg_ = "Forward pass failed at token " + 
+                                 std::to_string(output_tokens.size()) + ": " + decoder_.get_error();
+                    return false;
+                }
+            }
+            
+            size_t n_accept = 0;
+            while (n_accept < draft.size() && out_verify.argmax[n_accept] == draft[n_accept]) {
+                ++n_accept;
+            }
+            
+            // The accepted drafts and the model's own next choice, as if
+            // they had been generated one at a time
+            for (size_t i = 0; i <= n_accept; ++i) {
+                next_token = out_verify.argmax[i];
+                output_tokens.push_back(next_token);
+                n_past += 1;
+                if (next_token == cfg.eos_token_id || (int32_t)output_tokens.size() >= max_tokens) {
+                    break;
+                }
+            }
+            decoder_.truncate_seq(seq_id, n_past);
+        } else {
+            std::vector<int32_t> single_token = {next_token};
+            
+            {
+                QWEN3_TIMER("decode.token");
+                if (!decoder_.forward(single_token.data(), 1, n_past, out, seq_id)) {
+                    error_msg_ = "Forward pass failed at token " + 
+                                 std::to_string(output_tokens.size()) + ": " + decoder_.get_error();
+                    return false;
+                }
+            }
+            
+            next_token = out.argmax[0];
+            output_tokens.push_back(next_token);
+            
+            n_past += 1;
+        }
+        
+        for (size_t n = n_before + 1; n <= output_tokens.size(); ++n) {
+            // Keep one copy of a loop and stop; the repeats already reported
+            // through the progress callback are not taken back
+            if (stop_loops && loops.push(output_tokens.data(), n)) {
+                output_tokens.resize(n - loops.n_trim());
+                looped = true;
+                if (print_progress) {
+                    fprintf(stderr, "Stopped a repetition loop at token %zu\n", n);
+                }
+                break;
+            }
+            
+            if (progress_callback_) {
+                progress_callback_(n, max_tokens, detok.push(output_tokens[n - 1]));
+            }
+            
+            if (print_progress && n % 10 == 0) {
+                fprintf(stderr, "Generated %zu tokens...\n", n);
+            }
+        }
+    }
+    
+    if (output_tokens.back() == cfg.eos_token_id) {
+        output_tokens.pop_back();
+    }
+    
+    if (progress_callback_) {
+        std::string_view rest = detok.finish();
+        if (!rest.empty()) {
+            progress_callback_((int)output_tokens.size(), max_tokens, rest);
+        }
+    }
+    
+    return true;
+}
+
+std::vector<transcribe_result> Qwen3ASR::transcribe_batch(const std::vector<audio_clip> & clips,
+                                                          const transcribe_params & params,
+                                                          batch_result_callback_t on_result) {
+    QWEN3_TRACE_REQUEST();
+    const uint64_t request_id = TimingProfiler::current_request();
+    std::vector<transcribe_result> results(clips.size());
+    
+    if (!model_loaded_) {
+        for (auto & r : results) {
+            r.error_msg = "Model not loaded";
+        }
+        return results;
+    }
+    if (clips.empty()) {
+        return results;
+    }
+    
+    const int n_workers = std::max(1, std::min(params.n_workers, (int32_t)clips.size()));
+    const int n_mel_threads = std::max(1, params.n_threads / n_workers);
+    const int n_slots = std::max(1, params.n_decode_batch);
+    const auto & cfg = decoder_.get_config();
+    const int hidden_size = encoder_.get_text_hparams().hidden_size;
+    
+    stage_queue<batch_mel_item> mel_queue(2 * n_workers);
+    stage_queue<batch_enc_item> enc_queue(n_slots + 1);
+    
+    // Encoder output slots for device-resident features: enough for the
+    // queued clips, the one waiting for a decode slot and the one being
+    // encoded. The decoder hands a slot back right after its prefill.
+    const bool on_device = use_device_features(params);
+    const int n_out_slots = n_slots + 3;
+    stage_queue<int32_t> free_out_slots(n_out_slots);
+    for (int32_t i = 0; on_device && i < n_out_slots; ++i) {
+        free_out_slots.push(i);
+    }
+    
+    // Stage 1: WAV loading + mel, any order
+    std::atomic<size_t> next_clip(0);
+    std::atomic<int> workers_left(n_workers);
+    auto mel_worker = [&]() {
+        QWEN3_TRACE_REQUEST_ID(request_id);
+        for (size_t i = next_clip++; i < clips.size(); i = next_clip++) {
+            const audio_clip & clip = clips[i];
+            batch_mel_item item;
+            item.index = i;
+            int64_t t_start = get_time_ms();
+            
+            std::vector<float> loaded;
+            const float * samples = clip.samples.data();
+            int n_samples = (int)clip.samples.size();
+            if (clip.samples.empty()) {
+                int sample_rate = 0;
+                if (!load_audio_file(clip.path, loaded, sample_rate)) {
+                    item.error = "Failed to load audio file: " + clip.path;
+                }
+                samples = loaded.data();
+                n_samples = (int)loaded.size();
+            }
+            
+            if (item.error.empty()) {
+                QWEN3_TIMER("batch.mel");
+                if (!log_mel_spectrogram(samples, n_samples, mel_filters_, item.mel, n_mel_threads)) {
+                    item.error = "Failed to compute mel spectrogram";
+                }
+            }
+            item.audio_sec = (float)n_samples / QWEN_SAMPLE_RATE;
+            item.t_mel_ms = get_time_ms() - t_start;
+            mel_queue.push(std::move(item));
+        }
+        if (--workers_left == 0) {
+            mel_queue.close();
+        }
+    };
+    
+    std::vector<std::thread> workers;
+    for (int i = 0; i < n_workers; ++i) {
+        workers.emplace_back(mel_worker);
+    }
+    
+    // Stage 2: encoder, running ahead of the decoder
+    std::thread encoder_thread([&]() {
+        QWEN3_TRACE_REQUEST_ID(request_id);
+        batch_mel_item m;
+        while (mel_queue.pop(m, true) > 0) {
+            batch_enc_item e;
+            e.index = m.index;
+            e.audio_sec = m.audio_sec;
+            e.t_mel_ms = m.t_mel_ms;
+            e.error = std::move(m.error);
+            if (e.error.empty()) {
+                QWEN3_TIMER("batch.encode");
+                int64_t t_start = get_time_ms();
+                bool ok;
+                if (on_device) {
+                    free_out_slots.pop(e.device_slot, true);
+                    ok = encoder_.encode_to_device(m.mel.data.data(), m.mel.n_mel, m.mel.n_len,
+                                                   e.device_slot, e.device);
+                    e.n_frames = e.device.n_frames;
+                    if (!ok) {
+                        free_out_slots.push(e.device_slot);
+                        e.device_slot = -1;
+                    }
+                } else {
+                    ok = encoder_.encode(m.mel.data.data(), m.mel.n_mel, m.mel.n_len, e.features);
+                    e.n_frames = (int32_t)(e.features.size() / hidden_size);
+                }
+                if (!ok) {
+                    e.error = "Failed to encode audio: " + encoder_.get_error();
+                }
+                e.t_encode_ms = get_time_ms() - t_start;
+            }
+            enc_queue.push(std::move(e));
+        }
+        enc_queue.close();
+    });
+    
+    // Stage 3: decoder on this thread, n_slots clips per batched step. Clips
+    // join free KV slots as they arrive and leave when they finish.
+    struct decode_slot {
+        bool active = false;
+        batch_enc_item item;
+        int32_t n_past = 0;
+        int32_t max_tokens = 0;
+        std::vector<int32_t> tokens;
+        loop_detector loops;
+        int64_t t_start = 0;
+    };
+    std::vector<decode_slot> slots(n_slots);
+    int32_t slot_ctx = 0;
+    int n_active = 0;
+    bool input_done = false;
+    bool has_pending = false;
+    batch_enc_item pending;
+    decoder_output out;
+    out.want_logits = false;
+    
+    auto emit = [&](const batch_enc_item & item, transcribe_result & r) {
+        r.audio_sec = item.audio_sec;
+        r.t_mel_ms = item.t_mel_ms;
+        r.t_encode_ms = item.t_encode_ms;
+        r.t_total_ms = r.t_mel_ms + r.t_encode_ms + r.t_decode_ms;
+        if (on_result) {
+            on_result(item.index, r);
+        }
+    };
+    
+    auto finish_slot = [&](int s, const std::string & error) {
+        decode_slot & slot = slots[s];
+        transcribe_result & r = results[slot.item.index];
+        r.t_decode_ms = get_time_ms() - slot.t_start;
+        if (error.empty()) {
+            if (!slot.tokens.empty() && slot.tokens.back() == cfg.eos_token_id) {
+                slot.tokens.pop_back();
+            }
+            decode_transcript(slot.tokens, r.language, r.text);
+            r.tokens = slot.tokens;
+            r.success = true;
+        } else {
+            r.error_msg = error;
+        }
+        emit(slot.item, r);
+        decoder_.clear_seq(s);
+        slot = decode_slot();
+        n_active--;
+    };
+    
+    // Also ends (and trims) a clip whose newest token completes a loop
+    auto is_done = [&](decode_slot & slot) {
+        if (params.stop_loops && slot.loops.push(slot.tokens.data(), slot.tokens.size())) {
+            slot.tokens.resize(slot.tokens.size() - slot.loops.n_trim());
+            return true;
+        }
+        return slot.tokens.back() == cfg.eos_token_id ||
+               (int32_t)slot.tokens.size() >= slot.max_tokens;
+    };
+    
+    decoder_.set_audio_input_type(params.f16_audio ? GGML_TYPE_F16 : GGML_TYPE_F32);
+    
+    while (true) {
+        // Admit new clips into free slots; block only when nothing is running
+        for (int s = 0; s < n_slots && !input_done; ++s) {
+            if (slots[s].active) {
+                continue;
+            }
+            if (!has_pending) {
+                int got = enc_queue.pop(pending, n_active == 0);
+                if (got < 0) {
+                    input_done = true;
+                }
+                if (got <= 0) {
+                    break;
+                }
+                has_pending = true;
+            }
+            if (!pending.error.empty()) {
+                transcribe_result & r = results[pending.index];
+                r.error_msg = pending.error;
+                emit(pending, r);
+                has_pending = false;
+                --s;
+                continue;
+            }
+            
+            std::vector<int32_t> input_tokens = build_input_tokens(pending.n_frames, params.language);
+            const int32_t max_tokens = token_budget(params, pending.n_frames);
+            const int32_t n_needed = (int32_t)input_tokens.size() + max_tokens;
+            if (n_needed > slot_ctx) {
+                // Grow the per-slot context once the running clips have drained
+                if (n_active > 0) {
+                    break;
+                }
+                if (!decoder_.reserve_kv_cache(n_needed, n_slots, params.kv_type)) {
+                    slot_ctx = 0;
+                    transcribe_result & r = results[pending.index];
+                    r.error_msg = "Failed to initialize KV cache: " + decoder_.get_error();
+                    if (pending.device_slot >= 0) {
+                        free_out_slots.push(pending.device_slot);
+                        pending.device_slot = -1;
+                    }
+                    emit(pending, r);
+                    has_pending = false;
+                    --s;
+                    continue;
+                }
+                slot_ctx = decoder_.get_n_ctx();
+            }
+            
+            decode_slot & slot = slots[s];
+            slot.item = std::move(pending);
+            slot.max_tokens = max_tokens;
+            slot.t_start = get_time_ms();
+            slot.active = true;
+            has_pending = false;
+            n_active++;
+            
+            int32_t audio_start_pos = find_audio_start_position(
+                input_tokens.data(), input_tokens.size(), cfg.audio_pad_token_id);
+            audio_input audio;
+            audio.host = slot.item.features.data();
+            audio.device = slot.item.device.tensor;
+            audio.n_frames = slot.item.n_frames;
+            bool prefilled;
+            {
+                QWEN3_TIMER("batch.prefill");
+                prefilled = prefill_prompt(input_tokens, audio, audio_start_pos, s, out);
+            }
+            
+            // The features are in the KV cache now
+            slot.item.features.clear();
+            if (slot.item.device_slot >= 0) {
+                free_out_slots.push(slot.item.device_slot);
+                slot.item.device_slot = -1;
+                slot.item.device = device_features();
+            }
+            if (!prefilled) {
+                finish_slot(s, "Initial forward pass failed: " + decoder_.get_error());
+                continue;
+            }
+            slot.n_past = input_tokens.size();
+            slot.tokens.push_back(out.argmax[0]);
+            if (is_done(slot)) {
+                finish_slot(s, "");
+            }
+        }
+        
+        if (n_active == 0) {
+            if (input_done && !has_pending) {
+                break;
+            }
+            continue;
+        }
+        
+        // One decode step for every running clip
+        std::vector<int32_t> seq_ids, step_tokens, step_pos;
+        for (int s = 0; s < n_slots; ++s) {
+            if (slots[s].active) {
+                seq_ids.push_back(s);
+                step_tokens.push_back(slots[s].tokens.back());
+                step_pos.push_back(slots[s].n_past);
+            }
+        }
+        
+        bool ok;
+        {
+            QWEN3_TIMER("batch.decode_step");
+            ok = decoder_.forward_batch(seq_ids.data(), step_tokens.data(), step_pos.data(),
+                                        seq_ids.size(), out);
+        }
+        for (size_t b = 0; b < seq_ids.size(); ++b) {
+            const int s = seq_ids[b];
+            if (!ok) {
+                finish_slot(s, "Forward pass failed: " + decoder_.get_error());
+                continue;
+            }
+            slots[s].n_past++;
+            slots[s].tokens.push_back(out.argmax[b]);
+            if (is_done(slots[s])) {
+                finish_slot(s, "");
+            }
+        }
+    }
+    
+    encoder_thread.join();
+    for (auto & w : workers) {
+        w.join();
+    }
+    
+    return results;
+}
+
+language_result Qwen3ASR::detect_language(const std::string & audio_path,
+                                          const language_params & params) {
+    QWEN3_TRACE_REQUEST();
+    language_result result;
+    
+    if (!model_loaded_) {
+        result.error_msg = "Model not loaded";
+        return result;
+    }
+    
+    std::vector<float> samples;
+    int sample_rate;
+    
+    if (!load_audio_file(audio_path, samples, sample_rate)) {
+        result.error_msg = "Failed to load audio file: " + audio_path;
+        return result;
+    }
+    
+    return detect_language(samples.data(), samples.size(), params);
+}
+
+language_result Qwen3ASR::detect_language(const float * samples, int n_samples,
+                                          const language_params & params) {
+    QWEN3_TRACE_REQUEST();
+    language_result result;
+    
+    if (!model_loaded_) {
+        result.error_msg = "Model not loaded";
+        return result;
+    }
+    
+    int64_t t_start = get_time_ms();
+    if (params.max_audio_sec > 0.0f) {
+        n_samples = std::min(n_samples, (int)(params.max_audio_sec * QWEN_SAMPLE_RATE));
+    }
+    result.audio_sec = (float)n_samples / QWEN_SAMPLE_RATE;
+    
+    MelSpectrogram mel;
+    {
+        QWEN3_TIMER("mel_spectrogram");
+        if (!log_mel_spectrogram(samples, n_samples, mel_filters_, mel, params.n_threads)) {
+            result.error_msg = "Failed to compute mel spectrogram";
+            return result;
+        }
+    }
+    result.t_mel_ms = get_time_ms() - t_start;
+    
+    int64_t t_encode_start = get_time_ms();
+    std::vector<float> audio_features;
+    device_features device;
+    {
+        QWEN3_TIMER("audio_encoding");
+        const bool ok = device_features_ ?
+            encoder_.encode_to_device(mel.data.data(), mel.n_mel, mel.n_len, 0, device) :
+            encoder_.encode(mel.data.data(), mel.n_mel, mel.n_len, audio_features);
+        if (!ok) {
+            result.error_msg = "Failed to encode audio: " + encoder_.get_error();
+            return result;
+        }
+    }
+    result.t_encode_ms = get_time_ms() - t_encode_start;
+    
+    int64_t t_decode_start = get_time_ms();
+    const auto & cfg = decoder_.get_config();
+    audio_input audio;
+    audio.host = device_features_ ? nullptr : audio_features.data();
+    audio.device = device_features_ ? device.tensor : nullptr;
+    audio.n_frames = device_features_ ? device.n_frames :
+        (int32_t)(audio_features.size() / encoder_.get_text_hparams().hidden_size);
+    
+    std::vector<int32_t> input_tokens = build_input_tokens(audio.n_frames, "");
+    const int32_t n_prompt = input_tokens.size();
+    const int32_t n_ctx = n_prompt + QWEN3_ASR_LID_MAX_HEADER_TOKENS + QWEN3_ASR_LID_MAX_NAME_TOKENS + 1;
+    if (!decoder_.reserve_kv_cache(n_ctx, 1, params.kv_type)) {
+        result.error_msg = "Failed to initialize KV cache: " + decoder_.get_error();
+        return result;
+    }
+    decoder_.set_audio_input_type(GGML_TYPE_F32);
+    
+    int32_t audio_start_pos = find_audio_start_position(
+        input_tokens.data(), input_tokens.size(), cfg.audio_pad_token_id);
+    if (audio_start_pos < 0) {
+        result.error_msg = "Failed to find audio start position in input tokens";
+        return result;
+    }
+    
+    decoder_output out;
+    out.want_logits = false;
+    out.n_top_k = std::max(1, params.n_candidates);
+    out.want_logprobs = true;
+    {
+        QWEN3_TIMER("decode.initial_forward");
+        if (!prefill_prompt(input_tokens, audio, audio_start_pos, 0, out)) {
+            result.error_msg = "Initial forward pass failed: " + decoder_.get_error();
+            return result;
+        }
+    }
+    
+    if (!rank_languages(out, n_prompt, result.languages)) {
+        result.error_msg = error_msg_;
+        return result;
+    }
+    result.t_decode_ms = get_time_ms() - t_decode_start;
+    result.t_total_ms = get_time_ms() - t_start;
+    result.success = true;
+    
+    return result;
+}
+
+bool rank_language_candidates(std::vector<int32_t> top_k, std::vector<float> top_k_logprobs,
+                              int32_t n_past, const std::vector<std::string> & token_bytes,
+                              int32_t eos_token_id, const language_step_fn & step,
+                              std::vector<language_score> & languages, std::string & error) {
+    const std::string prefix = QWEN3_ASR_LANGUAGE_PREFIX;
+    const int32_t n_top_k = top_k.size();
+    auto bytes_of = [&](int32_t token) {
+        return token >= 0 && token < (int32_t)token_bytes.size() ? token_bytes[token] : std::string();
+    };
+    
+    languages.clear();
+    if (top_k.empty()) {
+        error = "No language header in the model output";
+        return false;
+    }
+    
+    // "language" (and the space, if it is a token of its own) is not in
+    // doubt; follow the greedy choice while it stays inside the prefix
+    std::string header;
+    float header_logprob = 0.0f;
+    for (int32_t i = 0; ; ++i) {
+        const std::string next = header + bytes_of(top_k[0]);
+        if (next.size() > prefix.size() || prefix.compare(0, next.size(), next) != 0) {
+            break;
+        }
+        if (i == QWEN3_ASR_LID_MAX_HEADER_TOKENS) {
+            error = "No language header in the model output";
+            return false;
+        }
+        const int32_t token = top_k[0];
+        header = next;
+        header_logprob += top_k_logprobs[0];
+        if (!step(token, n_past, n_top_k, top_k, top_k_logprobs)) {
+            return false;
+        }
+        n_past += 1;
+    }
+    
+    // Each top-k token that starts a name is completed greedily up to the
+    // delimiter, from the same KV rows
+    const std::vector<int32_t> first = top_k;
+    const std::vector<float> first_logprobs = top_k_logprobs;
+    std::vector<int32_t> next_token;
+    std::vector<float> next_logprob;
+    
+    for (size_t i = 0; i < first.size(); ++i) {
+        std::string text = header + bytes_of(first[i]);
+        if (text.size() <= prefix.size() || text.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+        text.erase(0, prefix.size());
+        float logprob = header_logprob + first_logprobs[i];
+        
+        int32_t token = first[i];
+        for (int32_t n = 0; text.find('|') == std::string::npos && n < QWEN3_ASR_LID_MAX_NAME_TOKENS; ++n) {
+            if (!step(token, n_past + n, 1, next_token, next_logprob)) {
+                return false;
+            }
+            token = next_token[0];
+            if (token == eos_token_id) {
+                break;
+            }
+            logprob += next_logprob[0];
+            text += bytes_of(token);
+        }
+        
+        text = text.substr(0, text.find('|'));
+        const size_t begin = text.find_first_not_of(" \t\n");
+        if (begin == std::string::npos) {
+            continue;
+        }
+        text = text.substr(begin, text.find_last_not_of(" \t\n") + 1 - begin);
+        
+        // Different tokenizations of one name add up
+        auto it = std::find_if(languages.begin(), languages.end(),
+                               [&](const language_score & l) { return l.language == text; });
+        if (it == languages.end()) {
+            languages.push_back({text, expf(logprob)});
+        } else {
+            it->prob += expf(logprob);
+        }
+    }
+    
+    if (languages.empty()) {
+        error = "No language header in the model output";
+        return false;
+    }
+    std::sort(languages.begin(), languages.end(), [](const language_score & a, const language_score & b) {
+        return a.prob > b.prob;
+    });
+    
+    return true;
+}
+
+bool Qwen3ASR::rank_languages(decoder_output & out, int32_t n_past,
+                              std::vector<language_score> & languages) {
+    const auto & cfg = decoder_.get_config();
+    decoder_output step;
+    step.want_logits = false;
+    step.want_logprobs = true;
+    auto forward = [&](int32_t token, int32_t pos, int32_t n_top_k,
+                       std::vector<int32_t> & top_k, std::vector<float> & top_k_logprobs) {
+        decoder_.truncate_seq(0, pos);
+        step.n_top_k = n_top_k;
+        if (!decoder_.forward(&token, 1, pos, step)) {
+            error_msg_ = "Forward pass failed: " + decoder_.get_error();
+            return false;
+        }
+        top_k = step.top_k;
+        top_k_logprobs = step.top_k_logprobs;
+        return true;
+    };
+    
+    std::string error;
+    const bool ok = rank_language_candidates(out.top_k, out.top_k_logprobs, n_past, decoder_.get_token_bytes(),
+                                             cfg.eos_token_id, forward, languages, error);
+    decoder_.truncate_seq(0, n_past);
+    if (!ok && !error.empty()) {
+        error_msg_ = error;
+    }
+    return ok;
+}
+
+void Qwen3ASR::decode_transcript(const std::vector<int32_t> & tokens,
+                                 std::string & language, std::string & text) const {
+    StreamingDetokenizer detok(decoder_);
+    for (int32_t token : tokens) {
+        detok.push(token);
+    }
+    detok.finish();
+    language = detok.language();
+    text = detok.text();
+}
+
+void Qwen3ASR::set_progress_callback(progress_callback_t callback) {
+    if (!callback) {
+        progress_callback_ = nullptr;
+        return;
+    }
+    progress_callback_ = [callback](int n, int max_tokens, std::string_view) {
+        callback(n, max_tokens);
+    };
+}
+
+void Qwen3ASR::set_progress_text_callback(progress_text_callback_t callback) {
+    progress_callback_ = std::move(callback);
+}
+
+std::unique_ptr<StreamingSession> Qwen3ASR::create_session(const stream_params & params) {
+    return std::unique_ptr<StreamingSession>(new StreamingSession(*this, params));
+}
+
+// ============================================================================
+// StreamingSession
+// ============================================================================
+
+StreamingSession::StreamingSession(Qwen3ASR & asr, const stream_params & params)
+    : asr_(asr), params_(params), mel_(asr.mel_filters_, params.n_threads),
+      request_id_(TimingProfiler::instance().new_request_id()) {
+    const auto & cfg = asr_.decoder_.get_config();
+    
+    std::vector<int32_t> tokens = asr_.build_input_tokens(0, params_.language);
+    auto it = std::find(tokens.begin(), tokens.end(), cfg.audio_start_token_id);
+    if (it != tokens.end()) {
+        ++it;
+    }
+    prompt_prefix_.assign(tokens.begin(), it);
+    prompt_suffix_.assign(it, tokens.end());
+}
+
+void StreamingSession::set_partial_callback(partial_callback_t callback) {
+    partial_callback_ = std::move(callback);
+}
+
+void StreamingSession::reset() {
+    mel_.reset();
+    conv_open_.clear();
+    audio_committed_.clear();
+    n_committed_ = 0;
+    n_committed_kv_ = 0;
+    // The prompt prefix is the same for every utterance: keep it in the cache
+    n_kv_stable_ = std::min(n_kv_stable_, (int32_t)prompt_prefix_.size());
+    chunks_since_partial_ = 0;
+    n_samples_ = 0;
+    n_mel_frames_ = 0;
+    t_mel_ms_ = 0;
+    t_encode_ms_ = 0;
+    error_msg_.clear();
+    request_id_ = TimingProfiler::instance().new_request_id();
+}
+
+bool StreamingSession::push_audio(const float * samples, int n_samples) {
+    QWEN3_TRACE_REQUEST_ID(request_id_);
+    if (!asr_.model_loaded_) {
+        error_msg_ = "Model not loaded";
+        return false;
+    }
+    if (mel_.finished()) {
+        error_msg_ = "Session already finalized; call reset() first";
+        return false;
+    }
+    
+    n_samples_ += n_samples;
+    
+    int64_t t_mel_start = get_time_ms();
+    {
+        QWEN3_TIMER("stream.mel");
+        mel_.push(samples, n_samples);
+    }
+    t_mel_ms_ += get_time_ms() - t_mel_start;
+    
+    if (!encode_ready_chunks() || !commit_windows()) {
+        return false;
+    }
+    
+    if (partial_callback_ && params_.partial_interval_chunks > 0 &&
+        chunks_since_partial_ >= params_.partial_interval_chunks) {
+        chunks_since_partial_ = 0;
+        
+        transcribe_result partial;
+        if (!decode_hypothesis(partial)) {
+            return false;
+        }
+        partial_callback_(partial, (float)(n_mel_frames_ * QWEN_HOP_LENGTH) / QWEN_SAMPLE_RATE);
+    }
+    
+    return true;
+}
+
+transcribe_result StreamingSession::finalize() {
+    QWEN3_TRACE_REQUEST_ID(request_id_);
+    transcribe_result result;
+    int64_t t_total_start = get_time_ms();
+    
+    if (!asr_.model_loaded_) {
+        result.error_msg = "Model not loaded";
+        return result;
+    }
+    
+    int64_t t_mel_start = get_time_ms();
+    mel_.finish();
+    t_mel_ms_ += get_time_ms() - t_mel_start;
+    
+    if (!encode_ready_chunks() || !commit_windows()) {
+        result.error_msg = error_msg_;
+        return result;
+    }
+    
+    if (n_committed_ == 0 && conv_open_.empty()) {
+        result.error_msg = "No audio";
+        return result;
+    }
+    
+    int64_t t_decode_start = get_time_ms();
+    if (!decode_hypothesis(result)) {
+        result.error_msg = error_msg_;
+        return result;
+    }
+    
+    result.audio_sec = (float)n_samples_ / QWEN_SAMPLE_RATE;
+    result.t_mel_ms = t_mel_ms_;
+    result.t_encode_ms = t_encode_ms_;
+    result.t_decode_ms = get_time_ms() - t_decode_start;
+    result.t_total_ms = get_time_ms() - t_total_start;
+    
+    return result;
+}
+
+// Run the conv frontend on every completed mel chunk (and on the short last
+// chunk once the stream is finished).
+bool StreamingSession::encode_ready_chunks() {
+    const int chunk_size = QWEN3_ASR_CONV_CHUNK;
+    const int n_available = mel_.n_available();
+    const int n_take = mel_.finished() ? n_available : (n_available / chunk_size) * chunk_size;
+    if (n_take == 0) {
+        return true;
+    }
+    
+    int64_t t_encode_start = get_time_ms();
+    
+    std::vector<float> mel_chunk;
+    std::vector<float> conv_out;
+    mel_.read(n_take, mel_chunk);
+    {
+        QWEN3_TIMER("stream.conv");
+        if (!asr_.encoder_.encode_conv(mel_chunk.data(), QWEN_N_MELS, n_take, conv_out)) {
+            error_msg_ = "Failed to encode audio: " + asr_.encoder_.get_error();
+            return false;
+        }
+    }
+    conv_open_.insert(conv_open_.end(), conv_out.begin(), conv_out.end());
+    
+    n_mel_frames_ += n_take;
+    chunks_since_partial_ += (n_take + chunk_size - 1) / chunk_size;
+    t_encode_ms_ += get_time_ms() - t_encode_start;
+    
+    return true;
+}
+
+// Encode every complete attention window of conv_open_ and append it to the
+// committed audio, then extend the stable part of the KV cache with it.
+bool StreamingSession::commit_windows() {
+    const int window = asr_.encoder_.get_attn_window();
+    if (window <= 0) {
+        return true;
+    }
+    
+    const int d_model = asr_.encoder_.get_hparams().d_model;
+    const int n_open = (int)(conv_open_.size() / d_model);
+    const int n_full = (n_open / window) * window;
+    if (n_full == 0) {
+        return true;
+    }
+    
+    int64_t t_encode_start = get_time_ms();
+    std::vector<float> encoded;
+    {
+        QWEN3_TIMER("stream.commit_windows");
+        if (!asr_.encoder_.encode_transformer(conv_open_.data(), n_full, encoded)) {
+            error_msg_ = "Failed to encode audio: " + asr_.encoder_.get_error();
+            return false;
+        }
+    }
+    t_encode_ms_ += get_time_ms() - t_encode_start;
+    
+    audio_committed_.insert(audio_committed_.end(), encoded.begin(), encoded.end());
+    n_committed_ += n_full;
+    conv_open_.erase(conv_open_.begin(), conv_open_.begin() + (size_t)n_full * d_model);
+    
+    return sync_kv(window + (int32_t)prompt_suffix_.size());
+}
+
+bool StreamingSession::ensure_kv_capacity(int32_t n_needed) {
+    if (n_needed <= kv_capacity_) {
+        return true;
+    }
+    
+    int32_t n_ctx = std::max(n_needed, 2 * kv_capacity_);
+    if (kv_capacity_ == 0) {
+        const int32_t n_reserve = (int32_t)prompt_prefix_.size() + (int32_t)prompt_suffix_.size() +
+                                  params_.kv_reserve_sec * asr_.encoder_.get_chunk_output_length() +
+                                  params_.max_tokens;
+        n_ctx = std::max(n_needed, n_reserve);
+    }
+    
+    if (!asr_.decoder_.reserve_kv_cache(n_ctx, 1, params_.kv_type)) {
+        error_msg_ = "Failed to initialize KV cache: " + asr_.decoder_.get_error();
+        return false;
+    }
+    asr_.decoder_.set_audio_input_type(params_.f16_audio ? GGML_TYPE_F16 : GGML_TYPE_F32);
+    
+    // The cache was cleared (or reallocated): the prefix and committed audio
+    // are re-prefilled
+    kv_capacity_ = asr_.decoder_.get_n_ctx();
+    n_kv_stable_ = 0;
+    n_committed_kv_ = 0;
+    
+    return true;
+}
+
+// Make sure the KV cache holds the prompt prefix and all committed audio, with
+// room for n_tail more prompt tokens and max_tokens generated ones.
+bool StreamingSession::sync_kv(int32_t n_tail) {
+    const auto & cfg = asr_.decoder_.get_config();
+    
+    const int32_t n_needed = (int32_t)prompt_prefix_.size() + n_committed_ + n_tail + params_.max_tokens;
+    if (!ensure_kv_capacity(n_needed)) {
+        return false;
+    }
+    
+    decoder_output out;
+    out.want_logits = false;
+    
+    if (n_kv_stable_ == 0) {
+        QWEN3_TIMER("stream.prefill_prefix");
+        const int32_t n_prefix = prompt_prefix_.size();
+        const int32_t n_restored = asr_.decoder_.restore_prefix(prompt_prefix_.data(), n_prefix);
+        if (!asr_.decoder_.forward(prompt_prefix_.data() + n_restored, n_prefix - n_restored,
+                                   n_restored, out)) {
+            error_msg_ = "Prompt prefill failed: " + asr_.decoder_.get_error();
+            return false;
+        }
+        asr_.decoder_.save_prefix(prompt_prefix_.data(), n_prefix);
+        n_kv_stable_ = n_prefix;
+    }
+    
+    if (n_committed_kv_ < n_committed_) {
+        QWEN3_TIMER("stream.prefill_audio");
+        const int32_t n_new = n_committed_ - n_committed_kv_;
+        const int hidden_size = asr_.encoder_.get_text_hparams().hidden_size;
+        std::vector<int32_t> tokens(n_new, cfg.audio_pad_token_id);
+        if (!asr_.decoder_.forward_with_audio(
+                tokens.data(), n_new,
+                audio_committed_.data() + (size_t)n_committed_kv_ * hidden_size, n_new,
+                0, n_kv_stable_, out)) {
+            error_msg_ = "Audio prefill failed: " + asr_.decoder_.get_error();
+            return false;
+        }
+        n_kv_stable_ += n_new;
+        n_committed_kv_ = n_committed_;
+    }
+    
+    return true;
+}
+
+// Decode a hypothesis over everything received so far: encode the open
+// window, prefill it with the prompt suffix after the stable KV entries and
+// run greedy generation. Generated entries land past n_kv_stable_ and are
+// overwritten by the next hypothesis.
+bool StreamingSession::decode_hypothesis(transcribe_result & result) {
+    const auto & cfg = asr_.decoder_.get_config();
+    const int d_model = asr_.encoder_.get_hparams().d_model;
+    const int32_t n_open = (int32_t)(conv_open_.size() / d_model);
+    
+    std::vector<float> audio_open;
+    if (n_open > 0) {
+        int64_t t_encode_start = get_time_ms();
+        QWEN3_TIMER("stream.encode_open");
+        if (!asr_.encoder_.encode_transformer(conv_open_.data(), n_open, audio_open)) {
+            error_msg_ = "Failed to encode audio: " + asr_.encoder_.get_error();
+            return false;
+        }
+        t_encode_ms_ += get_time_ms() - t_encode_start;
+    }
+    
+    std::vector<int32_t> tokens(n_open, cfg.audio_pad_token_id);
+    tokens.insert(tokens.end(), prompt_suffix_.begin(), prompt_suffix_.end());
+    
+    if (!sync_kv((int32_t)tokens.size())) {
+        return false;
+    }
+    
+    decoder_output out;
+    out.want_logits = false;
+    {
+        QWEN3_TIMER("stream.prefill_open");
+        if (!asr_.decoder_.forward_with_audio(
+                tokens.data(), tokens.size(),
+                n_open > 0 ? audio_open.data() : nullptr, n_open,
+                0, n_kv_stable_, out)) {
+            error_msg_ = "Prefill failed: " + asr_.decoder_.get_error();
+            return false;
+        }
+    }
+    
+    std::vector<int32_t> output_tokens;
+    if (!asr_.continue_greedy(out.argmax[0], n_kv_stable_ + (int32_t)tokens.size(), 0,
+                              params_.max_tokens, 0, params_.stop_loops, false, output_tokens)) {
+        error_msg_ = "Decoding failed: " + asr_.error_msg_;
+        return false;
+    }
+    
+    asr_.decode_transcript(output_tokens, result.language, result.text);
+    result.tokens = output_tokens;
+    result.success = true;
+    
+    return true;
 }
 
 } // namespace qwen3_asr
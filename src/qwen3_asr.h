@@ -4,10 +4,15 @@
 #include "audio_encoder.h"
 #include "text_decoder.h"
 #include "audio_injection.h"
+#include "vad.h"
+#include "audio_reader.h"
+#include "feature_cache.h"
 
 #include <string>
 #include <vector>
+#include <memory>
 #include <functional>
+#include <string_view>
 
 namespace qwen3_asr {
 
@@ -16,10 +21,20 @@ struct transcribe_params {
     // Maximum number of tokens to generate
     int32_t max_tokens = 1024;
     
+    // Also cap the tokens generated for an input at this many per second of
+    // audio (plus a few for the language header), so the worst-case decode
+    // cost is bounded by the audio length; 0 uses max_tokens alone
+    float max_tokens_per_sec = 15.0f;
+    
+    // Stop generating once the output repeats a phrase over and over (as on
+    // music, noise or silence) and keep a single copy of it
+    bool stop_loops = true;
+    
     // Language code (optional, for prompting)
     std::string language = "";
     
     // Number of threads for mel computation
+    // (ggml compute threads are set at load time via cpu_backend_params)
     int32_t n_threads = 4;
     
     // Print progress during transcription
@@ -27,6 +42,62 @@ struct transcribe_params {
     
     // Print timing information
     bool print_timing = true;
+    
+    // transcribe_batch only: threads loading WAV files and computing mel
+    int32_t n_workers = 2;
+    
+    // transcribe_batch only: clips decoded together in one batched step
+    // (each holds its own KV cache slot)
+    int32_t n_decode_batch = 1;
+    
+    // Return the audio encoder output in transcribe_result::audio_features
+    bool keep_audio_features = false;
+    
+    // Decoder KV cache element type: GGML_TYPE_F16, GGML_TYPE_Q8_0 or
+    // GGML_TYPE_Q4_0 (the cache is reallocated when this changes)
+    enum ggml_type kv_type = GGML_TYPE_F16;
+    
+    // Upload the audio embeddings to the decoder as F16 instead of F32,
+    // halving the prompt's host-to-device copy; ignored when the encoder
+    // output stays on the device
+    bool f16_audio = false;
+    
+    // Speculative decoding: draft up to n_draft tokens per step by matching
+    // the latest n-gram against the text generated so far, and verify them
+    // in one decoder pass; 0 decodes one token per pass (transcribe only)
+    int32_t n_draft = 0;
+    
+    // Beam search with n_beams hypotheses when > 1 (transcribe only; n_draft
+    // is ignored). All beams share the prompt KV pages and advance in one
+    // batched decoder pass per token. Finished hypotheses are ranked by
+    // log-probability / length^length_penalty.
+    int32_t n_beams = 1;
+    float length_penalty = 1.0f;
+    
+    // Take the beam search path even with n_beams == 1, where it decodes
+    // greedily over a paged KV cache (tests check it against greedy)
+    bool force_beam = false;
+    
+    // Split the audio at silences (see vad_params) and transcribe only the
+    // speech segments, n_decode_batch at a time; max_tokens applies to each
+    // segment. Ignored by transcribe(mel, ...) and transcribe_batch.
+    bool use_vad = false;
+    vad_params vad;
+    
+    // Compute the log-mel on the encoder's GPU from the raw samples, so the
+    // mel never leaves the device (see AudioEncoder::encode_pcm). Ignored
+    // when the encoder runs on the CPU and with use_vad, which needs the mel
+    // on the host.
+    bool gpu_mel = false;
+};
+
+// One speech segment of a transcribe_params::use_vad result
+struct transcribe_segment {
+    float start_sec = 0.0f;
+    float end_sec = 0.0f;
+    std::string language;
+    std::string text;
+    std::vector<int32_t> tokens;
 };
 
 // Transcription result
@@ -37,17 +108,154 @@ struct transcribe_result {
     bool success = false;
     std::string error_msg;
     
+    // Duration of the transcribed audio in seconds
+    float audio_sec = 0.0f;
+    
+    // Audio encoder output [n_audio_frames, hidden_size] and the mel length it
+    // was computed from, set only with transcribe_params::keep_audio_features
+    std::vector<float> audio_features;
+    int32_t n_mel_frames = 0;
+    
+    // Per-segment results with transcribe_params::use_vad; text and tokens
+    // above are the segments joined in order
+    std::vector<transcribe_segment> segments;
+    
     // Timing info (in milliseconds)
     int64_t t_load_ms = 0;
     int64_t t_mel_ms = 0;
     int64_t t_encode_ms = 0;
     int64_t t_decode_ms = 0;
     int64_t t_total_ms = 0;
+    
+    // Prompt prefill (audio + chat template), included in t_decode_ms
+    int64_t t_prefill_ms = 0;
+    int32_t n_prompt_tokens = 0;
 };
 
 // Progress callback type
 using progress_callback_t = std::function<void(int tokens_generated, int max_tokens)>;
 
+// Progress callback that also receives the transcript text completed by the
+// latest token (empty while the language header is being generated)
+using progress_text_callback_t = std::function<void(int tokens_generated, int max_tokens,
+                                                    std::string_view text_delta)>;
+
+// One clip for transcribe_batch: in-memory samples, or a WAV path that is
+// loaded on a worker thread when samples is empty
+struct audio_clip {
+    std::string path;
+    std::vector<float> samples;   // 16 kHz mono in [-1, 1]
+};
+
+// Called from the decoding thread as each clip of a batch finishes
+using batch_result_callback_t = std::function<void(size_t index, const transcribe_result & result)>;
+
+// Language identification parameters (Qwen3ASR::detect_language)
+struct language_params {
+    // Only this much audio from the start is encoded; <= 0 uses all of it
+    float max_audio_sec = 15.0f;
+    
+    // Number of languages ranked: the top-k first tokens of the language
+    // name, each completed greedily up to the header delimiter
+    int32_t n_candidates = 5;
+    
+    // Number of threads for mel computation
+    int32_t n_threads = 4;
+    
+    // Decoder KV cache element type (see transcribe_params::kv_type)
+    enum ggml_type kv_type = GGML_TYPE_F16;
+};
+
+// One ranked language; prob is the model probability of the whole name
+struct language_score {
+    std::string language;
+    float prob = 0.0f;
+};
+
+// Language identification result, languages sorted by prob (best first)
+struct language_result {
+    std::vector<language_score> languages;
+    bool success = false;
+    std::string error_msg;
+    
+    // Duration of the audio that was encoded, in seconds
+    float audio_sec = 0.0f;
+    
+    // Timing info (in milliseconds)
+    int64_t t_mel_ms = 0;
+    int64_t t_encode_ms = 0;
+    int64_t t_decode_ms = 0;
+    int64_t t_total_ms = 0;
+};
+
+// One decoder step of rank_language_candidates: run token at position
+// n_past (rows from n_past on are replaced) and return the n_top_k most
+// likely next tokens with their log-probabilities; false on failure
+using language_step_fn = std::function<bool(int32_t token, int32_t n_past, int32_t n_top_k,
+                                            std::vector<int32_t> & top_k, std::vector<float> & top_k_logprobs)>;
+
+// The ranking of Qwen3ASR::detect_language, over any decoder. top_k /
+// top_k_logprobs are the candidates after the n_past-token prompt; the
+// greedy choice is followed while it stays inside QWEN3_ASR_LANGUAGE_PREFIX
+// ("language "), then every top-k token that starts a name is completed
+// greedily up to the "|" delimiter (or eos_token_id). Names reached by
+// different tokenizations are merged; languages is sorted by probability.
+// token_bytes maps token ids to their bytes. On failure error is set.
+bool rank_language_candidates(std::vector<int32_t> top_k, std::vector<float> top_k_logprobs,
+                              int32_t n_past, const std::vector<std::string> & token_bytes,
+                              int32_t eos_token_id, const language_step_fn & step,
+                              std::vector<language_score> & languages, std::string & error);
+
+// Streaming session parameters
+struct stream_params {
+    // Maximum number of tokens to generate per hypothesis
+    int32_t max_tokens = 1024;
+    
+    // Language code (optional, for prompting)
+    std::string language = "";
+    
+    // Number of threads for mel computation
+    int32_t n_threads = 4;
+    
+    // Decode a partial hypothesis every N newly completed conv chunks
+    // (1 chunk = 100 mel frames = 1 s of audio); 0 disables partials
+    int32_t partial_interval_chunks = 1;
+    
+    // Audio length the KV cache is sized for up front; longer sessions
+    // grow the cache and re-prefill the committed audio once
+    int32_t kv_reserve_sec = 60;
+    
+    // Decoder KV cache element type (see transcribe_params::kv_type)
+    enum ggml_type kv_type = GGML_TYPE_F16;
+    
+    // See transcribe_params::f16_audio
+    bool f16_audio = false;
+    
+    // See transcribe_params::stop_loops
+    bool stop_loops = true;
+};
+
+// Partial hypothesis callback: result of decoding all audio received so far.
+// audio_sec is the amount of audio covered by the hypothesis.
+using partial_callback_t = std::function<void(const transcribe_result & partial, float audio_sec)>;
+
+class StreamingSession;
+
+// Memory held by a loaded Qwen3ASR
+struct asr_memory_usage {
+    memory_usage encoder;
+    memory_usage decoder;
+    memory_usage shared;          // the shared compute arena, if any
+    bool shared_compute = false;  // encoder and decoder share one arena
+
+    memory_usage total() const {
+        memory_usage t = encoder;
+        t += decoder;
+        t += shared;
+        return t;
+    }
+};
+
 // Main ASR class that orchestrates the full pipeline
 class Qwen3ASR {
 public:
@@ -55,10 +263,28 @@ public:
     ~Qwen3ASR();
     
     // Load model from GGUF file
+    // cpu_params: thread count / threadpool / affinity used by the CPU backend
+    //             of both the audio encoder and the text decoder
     // Returns true on success, false on failure (check get_error())
-    bool load_model(const std::string & model_path);
+    bool load_model(const std::string & model_path,
+                    const cpu_backend_params & cpu_params = cpu_backend_params());
+    
+    // Load with separate backend settings for the audio encoder and the
+    // text decoder, e.g. the encoder on GPU 1 and the decoder on GPU 0, the
+    // decoder split over GPUs 0 and 1 (decoder_params.gpu_split), or the
+    // compute-bound encoder on the GPU and the bandwidth-bound decoder on
+    // the CPU (decoder_params.use_gpu = false) with its own thread count.
+    // Without a shared arena, threadpools on overlapping CPUs get poll = 0
+    bool load_model(const std::string & model_path,
+                    const cpu_backend_params & encoder_params,
+                    const cpu_backend_params & decoder_params);
     
-    // Transcribe audio file (WAV format, 16kHz mono)
+    // How the next load_model maps the weights (see model_file_params).
+    // Either way the file is opened, parsed and mapped once, shared by the
+    // encoder and the decoder.
+    void set_model_file_params(const model_file_params & params) { file_params_ = params; }
+    
+    // Transcribe audio file (WAV, any rate/channels; resampled to 16 kHz mono)
     // Returns transcription result
     transcribe_result transcribe(const std::string & audio_path, 
                                   const transcribe_params & params = transcribe_params());
@@ -69,9 +295,36 @@ public:
     transcribe_result transcribe(const float * samples, int n_samples,
                                   const transcribe_params & params = transcribe_params());
     
+    // Transcribe a mel spectrogram computed by the caller (e.g. to share it
+    // with ForcedAligner::align); n_samples sets the audio duration
+    transcribe_result transcribe(const MelSpectrogram & mel, int n_samples,
+                                  const transcribe_params & params = transcribe_params());
+    
+    // Spoken language only: encode the first params.max_audio_sec of the
+    // audio, prefill once and decode no further than the "language <Name>|"
+    // header, ranking the params.n_candidates most likely names. A few
+    // decoder steps instead of the whole transcript.
+    language_result detect_language(const std::string & audio_path,
+                                    const language_params & params = language_params());
+    language_result detect_language(const float * samples, int n_samples,
+                                    const language_params & params = language_params());
+    
+    // Transcribe many clips with the model loaded once. The stages run as a
+    // pipeline: WAV loading and mel on params.n_workers threads, the encoder
+    // on its own thread one clip ahead, and the decoder on the calling thread
+    // (params.n_decode_batch clips at a time). Results are in input order;
+    // on_result, if set, sees each one as soon as it is done.
+    std::vector<transcribe_result> transcribe_batch(const std::vector<audio_clip> & clips,
+                                                    const transcribe_params & params = transcribe_params(),
+                                                    batch_result_callback_t on_result = nullptr);
+    
     // Set progress callback
     void set_progress_callback(progress_callback_t callback);
     
+    // Set progress callback with streamed transcript text; replaces any
+    // callback set by set_progress_callback
+    void set_progress_text_callback(progress_text_callback_t callback);
+    
     // Get error message
     const std::string & get_error() const { return error_msg_; }
     
@@ -81,36 +334,213 @@ public:
     // Get model config
     const text_decoder_config & get_config() const { return decoder_.get_config(); }
     
+    // Memory held by the encoder, the decoder and the shared compute arena,
+    // with compute buffers as sized at load time (or grown since)
+    asr_memory_usage get_memory_usage() const;
+    
+    // Print get_memory_usage() to stderr in MiB
+    void print_memory_usage() const;
+    
+    // Compute arena shared by the encoder and the decoder, or null when they
+    // have separate ones; pass it to ForcedAligner::load_model to share it too
+    const std::shared_ptr<ComputeArena> & get_compute_arena() const { return arena_; }
+    
+    // Hash of the audio encoder weights (AudioEncoder::weight_fingerprint)
+    uint64_t encoder_fingerprint() const { return encoder_.weight_fingerprint(); }
+    
+    // Cache encoder outputs by audio content (see FeatureCache): transcribe()
+    // of samples or a mel seen before skips the mel and the encoder and goes
+    // straight to decoding. Not used with use_vad, by transcribe_batch or by
+    // streaming sessions.
+    void set_feature_cache(const feature_cache_params & params);
+    FeatureCache * get_feature_cache() { return feature_cache_.get(); }
+    
+    // Feature cache key of raw samples for this model
+    uint64_t feature_key(const float * samples, int n_samples);
+    
+    // Create a streaming session on this model. The session uses the
+    // decoder KV cache, so only one session (or transcribe call) may run
+    // at a time; the model must outlive the session.
+    std::unique_ptr<StreamingSession> create_session(const stream_params & params = stream_params());
+    
 private:
+    friend class StreamingSession;
+    
     // Internal transcription implementation
     transcribe_result transcribe_internal(const float * samples, int n_samples,
                                            const transcribe_params & params);
     
+    // Encoder + decoder over a computed mel; t_mel_ms is reported in the result
+    // With cache_key set, the encoder output is stored in the feature cache
+    transcribe_result transcribe_mel(const MelSpectrogram & mel, int n_samples,
+                                     int64_t t_mel_ms, const transcribe_params & params,
+                                     const uint64_t * cache_key = nullptr);
+    
+    // Model identity mixed into feature cache keys (mel keys use its
+    // complement, so they never match sample keys)
+    uint64_t feature_seed();
+    
+    // Decode a feature cache entry if there is one for key
+    bool transcribe_cached(uint64_t key, int n_samples, const transcribe_params & params,
+                           transcribe_result & result);
+    
+    // Audio embeddings of one prompt: in host memory, or left on the device
+    // by the encoder (encode_to_device) when the decoder can read them there
+    struct audio_input {
+        const float * host = nullptr;           // [n_frames, hidden_size]
+        struct ggml_tensor * device = nullptr;  // [hidden_size, >= n_frames]
+        int32_t n_frames = 0;
+    };
+    
+    // Encode into device output slot `slot` when the decoder can read it in
+    // place and the host features are not wanted; false means use the host path
+    bool use_device_features(const transcribe_params & params) const;
+    
+    // Decoder half of transcribe_mel over already encoded audio, given in
+    // audio_features or, when device is set, in device memory
+    transcribe_result transcribe_features(std::vector<float> & audio_features,
+                                          const device_features * device, int32_t n_mel_frames,
+                                          int n_samples, int64_t t_mel_ms, int64_t t_encode_ms,
+                                          const transcribe_params & params);
+    
+    // use_vad path: detect speech in mel, transcribe the segments with
+    // transcribe_batch and stitch the results
+    transcribe_result transcribe_segmented(const float * samples, int n_samples,
+                                           const MelSpectrogram & mel, int64_t t_mel_ms,
+                                           const transcribe_params & params);
+    
     // Build input token sequence for audio
     std::vector<int32_t> build_input_tokens(int32_t n_audio_frames, 
                                              const std::string & language);
     
+    // params.max_tokens, capped for n_audio_frames by params.max_tokens_per_sec
+    static int32_t token_budget(const transcribe_params & params, int32_t n_audio_frames);
+    
     // Greedy decoding loop
     bool decode_greedy(const std::vector<int32_t> & input_tokens,
-                       const std::vector<float> & audio_features,
-                       int32_t n_audio_frames,
+                       const audio_input & audio,
                        const transcribe_params & params,
-                       std::vector<int32_t> & output_tokens);
+                       std::vector<int32_t> & output_tokens,
+                       int64_t & t_prefill_ms);
+    
+    // Beam search decoding (transcribe_params::n_beams > 1) over a paged KV
+    // cache with one slot per beam
+    bool decode_beam(const std::vector<int32_t> & input_tokens,
+                     const audio_input & audio,
+                     const transcribe_params & params,
+                     std::vector<int32_t> & output_tokens,
+                     int64_t & t_prefill_ms);
+    
+    // Prefill input_tokens (audio injected at audio_start_pos) into KV slot
+    // seq_id, starting from a saved KV snapshot of the template prefix
+    bool prefill_prompt(const std::vector<int32_t> & input_tokens,
+                        const audio_input & audio,
+                        int32_t audio_start_pos, int32_t seq_id,
+                        decoder_output & out);
+    
+    // Greedy generation after the prompt has been prefilled into KV slot
+    // seq_id: next_token is the argmax of the prefill output, n_past the
+    // number of tokens in the slot
+    // n_draft > 0 enables n-gram speculative decoding with up to n_draft
+    // drafted tokens verified per forward pass (same output as plain greedy);
+    // stop_loops ends generation at a repetition loop
+    bool continue_greedy(int32_t next_token, int32_t n_past, int32_t seq_id,
+                         int32_t max_tokens, int32_t n_draft, bool stop_loops,
+                         bool print_progress, std::vector<int32_t> & output_tokens);
+    
+    // rank_language_candidates on this model's decoder (sequence 0); out
+    // holds the top-k of the prefill, n_past is the prompt length
+    bool rank_languages(decoder_output & out, int32_t n_past,
+                        std::vector<language_score> & languages);
     
-    // Sample next token (greedy: argmax)
-    int32_t sample_greedy(const float * logits, int32_t vocab_size);
+    // Split "language <Name>|<text>" model output into language and text
+    void decode_transcript(const std::vector<int32_t> & tokens,
+                           std::string & language, std::string & text) const;
     
     // Components
     AudioEncoder encoder_;
     TextDecoder decoder_;
     MelFilters mel_filters_;
     
+    // Encoder outputs can stay on the device for the decoder (same GPU)
+    bool device_features_ = false;
+    
+    model_file_params file_params_;
+    
+    // Backends and compute buffers shared by the encoder and decoder
+    // (cpu_backend_params::share_compute), null when they have their own
+    std::shared_ptr<ComputeArena> arena_;
+    
+    std::unique_ptr<FeatureCache> feature_cache_;
+    uint64_t feature_seed_ = 0;  // encoder fingerprint, computed on first use
+    
     // State
     bool model_loaded_ = false;
     std::string error_msg_;
-    progress_callback_t progress_callback_;
+    progress_text_callback_t progress_callback_;
 };
 
-bool load_audio_file(const std::string & path, std::vector<float> & samples, int & sample_rate);
+// Incremental transcription over pushed PCM.
+//
+// Audio is turned into mel frames as it arrives (MelStream); every completed
+// 100-frame mel chunk goes through the encoder conv frontend once. Encoder
+// attention is windowed (104 conv frames = 8 chunks), so a full window is
+// final as soon as it is complete: it is encoded once, prefilled into the
+// decoder KV cache after the prompt prefix and never recomputed. Each partial
+// hypothesis only re-encodes the open window and prefills it together with
+// the prompt suffix before greedy decoding, so the latency to the first
+// partial is bounded by one chunk rather than the utterance length.
+// With full attention (n_window_infer <= 0) nothing is committed and every
+// update re-encodes all conv frames.
+class StreamingSession {
+public:
+    StreamingSession(Qwen3ASR & asr, const stream_params & params);
+    
+    // Push 16 kHz mono samples in [-1, 1]; any block size works, 100-500 ms
+    // is typical. Partial hypotheses are emitted from inside this call.
+    bool push_audio(const float * samples, int n_samples);
+    
+    // Flush the remaining audio and return the final transcription
+    transcribe_result finalize();
+    
+    // Drop all audio and cached state to start a new utterance
+    void reset();
+    
+    void set_partial_callback(partial_callback_t callback);
+    
+    const std::string & get_error() const { return error_msg_; }
+    
+private:
+    bool encode_ready_chunks();
+    bool commit_windows();
+    bool ensure_kv_capacity(int32_t n_needed);
+    bool sync_kv(int32_t n_tail);
+    bool decode_hypothesis(transcribe_result & result);
+    
+    Qwen3ASR & asr_;
+    stream_params params_;
+    MelStream mel_;
+    partial_callback_t partial_callback_;
+    
+    std::vector<int32_t> prompt_prefix_;     // up to and including <|audio_start|>
+    std::vector<int32_t> prompt_suffix_;     // <|audio_end|> ... assistant\n
+    
+    std::vector<float> conv_open_;           // conv frames of the open window [n, d_model]
+    std::vector<float> audio_committed_;     // encoder output of complete windows [n, hidden]
+    int32_t n_committed_ = 0;                // frames of audio_committed_
+    int32_t n_committed_kv_ = 0;             // committed frames already in the KV cache
+    int32_t n_kv_stable_ = 0;                // KV entries that are never rewritten
+    int32_t kv_capacity_ = 0;
+    int32_t chunks_since_partial_ = 0;
+    int64_t n_samples_ = 0;
+    int64_t n_mel_frames_ = 0;
+    
+    int64_t t_mel_ms_ = 0;
+    int64_t t_encode_ms_ = 0;
+    
+    uint64_t request_id_ = 0;                // trace tag, new per utterance
+    
+    std::string error_msg_;
+};
 
 } // namespace qwen3_asr
@@ -0,0 +1,485 @@
+#include "qwen3_asr_c.h"
+#include "qwen3_asr.h"
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Samples converted per step when 16-bit input is pushed to a session
+#define QWEN3_ASR_C_PUSH_BLOCK 4096
+
+struct qwen3_asr_context {
+    qwen3_asr::Qwen3ASR asr;
+    MelFilters mel_filters;     // for 16-bit input, which is turned into a mel here
+    bool session_active = false;
+    std::string error_msg;
+};
+
+struct qwen3_asr_session {
+    qwen3_asr_context * ctx = nullptr;
+    std::unique_ptr<qwen3_asr::StreamingSession> session;
+    std::string error_msg;
+};
+
+struct qwen3_asr_result {
+    qwen3_asr::transcribe_result value;
+};
+
+namespace {
+
+qwen3_asr::cpu_backend_params to_backend_params(const qwen3_asr_backend_params & p, bool share_compute) {
+    qwen3_asr::cpu_backend_params cp;
+    cp.n_threads = p.n_threads;
+    cp.use_threadpool = p.use_threadpool;
+    if (p.cpu_ids && p.n_cpu_ids > 0) {
+        cp.cpu_ids.assign(p.cpu_ids, p.cpu_ids + p.n_cpu_ids);
+    }
+    cp.poll = p.poll;
+    cp.use_gpu = p.use_gpu;
+    cp.gpu_device = p.gpu_device;
+    cp.share_compute = share_compute;
+    return cp;
+}
+
+qwen3_asr_backend_params from_backend_params(const qwen3_asr::cpu_backend_params & cp) {
+    qwen3_asr_backend_params p;
+    p.n_threads = cp.n_threads;
+    p.use_threadpool = cp.use_threadpool;
+    p.cpu_ids = nullptr;
+    p.n_cpu_ids = 0;
+    p.poll = cp.poll;
+    p.use_gpu = cp.use_gpu;
+    p.gpu_device = cp.gpu_device;
+    return p;
+}
+
+enum ggml_type to_ggml_type(qwen3_asr_kv_type type) {
+    switch (type) {
+        case QWEN3_ASR_KV_Q8_0: return GGML_TYPE_Q8_0;
+        case QWEN3_ASR_KV_Q4_0: return GGML_TYPE_Q4_0;
+        default:                return GGML_TYPE_F16;
+    }
+}
+
+qwen3_asr::transcribe_params to_transcribe_params(const qwen3_asr_transcribe_params & p) {
+    qwen3_asr::transcribe_params tp;
+    tp.language = p.language ? p.language : "";
+    tp.max_tokens = p.max_tokens;
+    tp.max_tokens_per_sec = p.max_tokens_per_sec;
+    tp.stop_loops = p.stop_loops;
+    tp.n_threads = p.n_threads;
+    tp.kv_type = to_ggml_type(p.kv_type);
+    tp.f16_audio = p.f16_audio;
+    tp.n_draft = p.n_draft;
+    tp.n_beams = p.n_beams;
+    tp.length_penalty = p.length_penalty;
+    tp.use_vad = p.use_vad;
+    tp.gpu_mel = p.gpu_mel;
+    tp.print_progress = false;
+    tp.print_timing = p.print_timing;
+    return tp;
+}
+
+qwen3_asr::stream_params to_stream_params(const qwen3_asr_stream_params & p) {
+    qwen3_asr::stream_params sp;
+    sp.language = p.language ? p.language : "";
+    sp.max_tokens = p.max_tokens;
+    sp.n_threads = p.n_threads;
+    sp.partial_interval_chunks = p.partial_interval_chunks;
+    sp.kv_reserve_sec = p.kv_reserve_sec;
+    sp.kv_type = to_ggml_type(p.kv_type);
+    sp.f16_audio = p.f16_audio;
+    sp.stop_loops = p.stop_loops;
+    return sp;
+}
+
+// Checks shared by the transcribe calls; sets the error when it fails
+bool can_transcribe(qwen3_asr_context * ctx) {
+    if (!ctx) {
+        return false;
+    }
+    if (!ctx->asr.is_loaded()) {
+        ctx->error_msg = "Model not loaded";
+        return false;
+    }
+    if (ctx->session_active) {
+        ctx->error_msg = "A streaming session is active on this context";
+        return false;
+    }
+    return true;
+}
+
+// Run fn with the text callback of params installed, and turn its result
+// (or an exception) into a C result
+template <typename F>
+qwen3_asr_result * run_transcribe(qwen3_asr_context * ctx, const qwen3_asr_transcribe_params * params, F fn) {
+    const qwen3_asr_transcribe_params p = params ? *params : qwen3_asr_transcribe_default_params();
+    if (p.text_callback) {
+        qwen3_asr_text_callback cb = p.text_callback;
+        void * user_data = p.user_data;
+        ctx->asr.set_progress_text_callback([cb, user_data](int n, int max_tokens, std::string_view text) {
+            cb(text.data(), text.size(), n, max_tokens, user_data);
+        });
+    }
+
+    std::unique_ptr<qwen3_asr_result> result(new qwen3_asr_result());
+    try {
+        result->value = fn(to_transcribe_params(p));
+    } catch (const std::exception & e) {
+        result->value.success = false;
+        result->value.error_msg = e.what();
+    }
+    if (p.text_callback) {
+        ctx->asr.set_progress_text_callback(nullptr);
+    }
+
+    if (!result->value.success) {
+        ctx->error_msg = result->value.error_msg;
+        return nullptr;
+    }
+    ctx->error_msg.clear();
+    return result.release();
+}
+
+const qwen3_asr::transcribe_segment * get_segment(const qwen3_asr_result * result, int32_t i) {
+    if (!result || i < 0 || i >= (int32_t)result->value.segments.size()) {
+        return nullptr;
+    }
+    return &result->value.segments[i];
+}
+
+} // namespace
+
+extern "C" {
+
+int32_t qwen3_asr_api_version(void) {
+    return QWEN3_ASR_C_API_VERSION;
+}
+
+qwen3_asr_context_params qwen3_asr_context_default_params(void) {
+    const qwen3_asr::cpu_backend_params cp;
+    qwen3_asr_context_params p;
+    p.encoder = from_backend_params(cp);
+    p.decoder = from_backend_params(cp);
+    p.share_compute = cp.share_compute;
+    return p;
+}
+
+qwen3_asr_transcribe_params qwen3_asr_transcribe_default_params(void) {
+    const qwen3_asr::transcribe_params tp;
+    qwen3_asr_transcribe_params p;
+    p.language = nullptr;
+    p.max_tokens = tp.max_tokens;
+    p.max_tokens_per_sec = tp.max_tokens_per_sec;
+    p.stop_loops = tp.stop_loops;
+    p.n_threads = tp.n_threads;
+    p.kv_type = QWEN3_ASR_KV_F16;
+    p.f16_audio = tp.f16_audio;
+    p.n_draft = tp.n_draft;
+    p.n_beams = tp.n_beams;
+    p.length_penalty = tp.length_penalty;
+    p.use_vad = tp.use_vad;
+    p.gpu_mel = tp.gpu_mel;
+    p.print_timing = false;
+    p.text_callback = nullptr;
+    p.user_data = nullptr;
+    return p;
+}
+
+qwen3_asr_stream_params qwen3_asr_stream_default_params(void) {
+    const qwen3_asr::stream_params sp;
+    qwen3_asr_stream_params p;
+    p.language = nullptr;
+    p.max_tokens = sp.max_tokens;
+    p.n_threads = sp.n_threads;
+    p.partial_interval_chunks = sp.partial_interval_chunks;
+    p.kv_reserve_sec = sp.kv_reserve_sec;
+    p.kv_type = QWEN3_ASR_KV_F16;
+    p.f16_audio = sp.f16_audio;
+    p.stop_loops = sp.stop_loops;
+    p.partial_callback = nullptr;
+    p.user_data = nullptr;
+    return p;
+}
+
+qwen3_asr_context * qwen3_asr_init(void) {
+    try {
+        qwen3_asr_context * ctx = new qwen3_asr_context();
+        generate_mel_filters(ctx->mel_filters, QWEN_N_MELS, QWEN_N_FFT, QWEN_SAMPLE_RATE);
+        return ctx;
+    } catch (const std::exception &) {
+        return nullptr;
+    }
+}
+
+void qwen3_asr_free(qwen3_asr_context * ctx) {
+    delete ctx;
+}
+
+bool qwen3_asr_load_model(qwen3_asr_context * ctx, const char * model_path,
+                          const qwen3_asr_context_params * params) {
+    if (!ctx) {
+        return false;
+    }
+    if (!model_path) {
+        ctx->error_msg = "No model path";
+        return false;
+    }
+    if (ctx->asr.is_loaded()) {
+        ctx->error_msg = "A model is already loaded on this context";
+        return false;
+    }
+
+    const qwen3_asr_context_params p = params ? *params : qwen3_asr_context_default_params();
+    try {
+        if (!ctx->asr.load_model(model_path, to_backend_params(p.encoder, p.share_compute),
+                                 to_backend_params(p.decoder, p.share_compute))) {
+            ctx->error_msg = ctx->asr.get_error();
+            return false;
+        }
+    } catch (const std::exception & e) {
+        ctx->error_msg = e.what();
+        return false;
+    }
+    ctx->error_msg.clear();
+    return true;
+}
+
+const char * qwen3_asr_get_error(const qwen3_asr_context * ctx) {
+    return ctx ? ctx->error_msg.c_str() : "";
+}
+
+qwen3_asr_result * qwen3_asr_transcribe_f32(qwen3_asr_context * ctx,
+                                            const float * samples, int32_t n_samples,
+                                            const qwen3_asr_transcribe_params * params) {
+    if (!can_transcribe(ctx)) {
+        return nullptr;
+    }
+    if (!samples || n_samples <= 0) {
+        ctx->error_msg = "No samples";
+        return nullptr;
+    }
+    return run_transcribe(ctx, params, [&](const qwen3_asr::transcribe_params & tp) {
+        return ctx->asr.transcribe(samples, n_samples, tp);
+    });
+}
+
+qwen3_asr_result * qwen3_asr_transcribe_s16(qwen3_asr_context * ctx,
+                                            const int16_t * samples, int32_t n_samples,
+                                            const qwen3_asr_transcribe_params * params) {
+    if (!can_transcribe(ctx)) {
+        return nullptr;
+    }
+    if (!samples || n_samples <= 0) {
+        ctx->error_msg = "No samples";
+        return nullptr;
+    }
+    return run_transcribe(ctx, params, [&](const qwen3_asr::transcribe_params & tp) {
+        // VAD and the GPU mel front end read the samples themselves, so they
+        // get a float copy; otherwise the mel is computed from the 16-bit
+        // samples directly
+        if (tp.use_vad || tp.gpu_mel) {
+            std::vector<float> converted(n_samples);
+            for (int32_t i = 0; i < n_samples; ++i) {
+                converted[i] = samples[i] / 32768.0f;
+            }
+            return ctx->asr.transcribe(converted.data(), n_samples, tp);
+        }
+        MelSpectrogram mel;
+        if (!log_mel_spectrogram(samples, n_samples, ctx->mel_filters, mel, tp.n_threads)) {
+            qwen3_asr::transcribe_result r;
+            r.error_msg = "Failed to compute mel spectrogram";
+            return r;
+        }
+        return ctx->asr.transcribe(mel, n_samples, tp);
+    });
+}
+
+qwen3_asr_result * qwen3_asr_transcribe_file(qwen3_asr_context * ctx, const char * path,
+                                             const qwen3_asr_transcribe_params * params) {
+    if (!can_transcribe(ctx)) {
+        return nullptr;
+    }
+    if (!path) {
+        ctx->error_msg = "No audio path";
+        return nullptr;
+    }
+    return run_transcribe(ctx, params, [&](const qwen3_asr::transcribe_params & tp) {
+        return ctx->asr.transcribe(std::string(path), tp);
+    });
+}
+
+qwen3_asr_session * qwen3_asr_session_create(qwen3_asr_context * ctx,
+                                             const qwen3_asr_stream_params * params) {
+    if (!can_transcribe(ctx)) {
+        return nullptr;
+    }
+    const qwen3_asr_stream_params p = params ? *params : qwen3_asr_stream_default_params();
+    try {
+        std::unique_ptr<qwen3_asr_session> session(new qwen3_asr_session());
+        session->ctx = ctx;
+        session->session = ctx->asr.create_session(to_stream_params(p));
+        if (p.partial_callback) {
+            qwen3_asr_partial_callback cb = p.partial_callback;
+            void * user_data = p.user_data;
+            session->session->set_partial_callback(
+                [cb, user_data](const qwen3_asr::transcribe_result & partial, float audio_sec) {
+                    qwen3_asr_result r;
+                    r.value = partial;
+                    cb(&r, audio_sec, user_data);
+                });
+        }
+        ctx->session_active = true;
+        ctx->error_msg.clear();
+        return session.release();
+    } catch (const std::exception & e) {
+        ctx->error_msg = e.what();
+        return nullptr;
+    }
+}
+
+void qwen3_asr_session_free(qwen3_asr_session * session) {
+    if (!session) {
+        return;
+    }
+    session->session.reset();
+    session->ctx->session_active = false;
+    delete session;
+}
+
+bool qwen3_asr_session_push_f32(qwen3_asr_session * session, const float * samples, int32_t n_samples) {
+    if (!session) {
+        return false;
+    }
+    if (n_samples > 0 && !samples) {
+        session->error_msg = "No samples";
+        return false;
+    }
+    try {
+        if (!session->session->push_audio(samples, n_samples)) {
+            session->error_msg = session->session->get_error();
+            return false;
+        }
+    } catch (const std::exception & e) {
+        session->error_msg = e.what();
+        return false;
+    }
+    return true;
+}
+
+bool qwen3_asr_session_push_s16(qwen3_asr_session * session, const int16_t * samples, int32_t n_samples) {
+    if (!session) {
+        return false;
+    }
+    if (n_samples > 0 && !samples) {
+        session->error_msg = "No samples";
+        return false;
+    }
+    // The session buffers pushed audio anyway; convert in small blocks so no
+    // copy of the whole input is made
+    float block[QWEN3_ASR_C_PUSH_BLOCK];
+    for (int32_t i0 = 0; i0 < n_samples; i0 += QWEN3_ASR_C_PUSH_BLOCK) {
+        const int32_t n = std::min(QWEN3_ASR_C_PUSH_BLOCK, n_samples - i0);
+        for (int32_t i = 0; i < n; ++i) {
+            block[i] = samples[i0 + i] / 32768.0f;
+        }
+        if (!qwen3_asr_session_push_f32(session, block, n)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+qwen3_asr_result * qwen3_asr_session_finalize(qwen3_asr_session * session) {
+    if (!session) {
+        return nullptr;
+    }
+    try {
+        std::unique_ptr<qwen3_asr_result> result(new qwen3_asr_result());
+        result->value = session->session->finalize();
+        if (!result->value.success) {
+            session->error_msg = result->value.error_msg;
+            return nullptr;
+        }
+        return result.release();
+    } catch (const std::exception & e) {
+        session->error_msg = e.what();
+        return nullptr;
+    }
+}
+
+void qwen3_asr_session_reset(qwen3_asr_session * session) {
+    if (session) {
+        session->session->reset();
+        session->error_msg.clear();
+    }
+}
+
+const char * qwen3_asr_session_get_error(const qwen3_asr_session * session) {
+    return session ? session->error_msg.c_str() : "";
+}
+
+void qwen3_asr_result_free(qwen3_asr_result * result) {
+    delete result;
+}
+
+const char * qwen3_asr_result_text(const qwen3_asr_result * result) {
+    return result ? result->value.text.c_str() : "";
+}
+
+const char * qwen3_asr_result_language(const qwen3_asr_result * result) {
+    return result ? result->value.language.c_str() : "";
+}
+
+float qwen3_asr_result_audio_sec(const qwen3_asr_result * result) {
+    return result ? result->value.audio_sec : 0.0f;
+}
+
+int32_t qwen3_asr_result_n_tokens(const qwen3_asr_result * result) {
+    return result ? (int32_t)result->value.tokens.size() : 0;
+}
+
+const int32_t * qwen3_asr_result_tokens(const qwen3_asr_result * result) {
+    return result ? result->value.tokens.data() : nullptr;
+}
+
+qwen3_asr_timings qwen3_asr_result_timings(const qwen3_asr_result * result) {
+    qwen3_asr_timings t = {};
+    if (result) {
+        t.t_mel_ms = result->value.t_mel_ms;
+        t.t_encode_ms = result->value.t_encode_ms;
+        t.t_decode_ms = result->value.t_decode_ms;
+        t.t_prefill_ms = result->value.t_prefill_ms;
+        t.t_total_ms = result->value.t_total_ms;
+        t.n_prompt_tokens = result->value.n_prompt_tokens;
+    }
+    return t;
+}
+
+int32_t qwen3_asr_result_n_segments(const qwen3_asr_result * result) {
+    return result ? (int32_t)result->value.segments.size() : 0;
+}
+
+const char * qwen3_asr_result_segment_text(const qwen3_asr_result * result, int32_t i) {
+    const qwen3_asr::transcribe_segment * seg = get_segment(result, i);
+    return seg ? seg->text.c_str() : "";
+}
+
+const char * qwen3_asr_result_segment_language(const qwen3_asr_result * result, int32_t i) {
+    const qwen3_asr::transcribe_segment * seg = get_segment(result, i);
+    return seg ? seg->language.c_str() : "";
+}
+
+float qwen3_asr_result_segment_start(const qwen3_asr_result * result, int32_t i) {
+    const qwen3_asr::transcribe_segment * seg = get_segment(result, i);
+    return seg ? seg->start_sec : 0.0f;
+}
+
+float qwen3_asr_result_segment_end(const qwen3_asr_result * result, int32_t i) {
+    const qwen3_asr::transcribe_segment * seg = get_segment(result, i);
+    return seg ? seg->end_sec : 0.0f;
+}
+
+} // extern "C"
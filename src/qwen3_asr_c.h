@@ -0,0 +1,199 @@
+#ifndef QWEN3_ASR_C_H
+#define QWEN3_ASR_C_H
+
+// C API of qwen3-asr, built as the libqwen3asr shared library.
+//
+// All handles are opaque. Functions that can fail return false or NULL and
+// leave the reason in qwen3_asr_get_error() (or qwen3_asr_session_get_error()
+// for session calls). Sample buffers stay owned by the caller and are only
+// read during the call: float input goes straight into the pipeline, 16-bit
+// input is converted in the one copy the mel front end makes anyway.
+//
+// A context runs one transcription or streaming session at a time; calls on
+// the same context (and its sessions) must not overlap. Separate contexts
+// are independent.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef QWEN3_ASR_SHARED
+#    if defined(_WIN32)
+#        ifdef QWEN3_ASR_BUILD
+#            define QWEN3_ASR_API __declspec(dllexport)
+#        else
+#            define QWEN3_ASR_API __declspec(dllimport)
+#        endif
+#    else
+#        define QWEN3_ASR_API __attribute__((visibility("default")))
+#    endif
+#else
+#    define QWEN3_ASR_API
+#endif
+
+// Bumped on every incompatible change of the structs or functions below
+#define QWEN3_ASR_C_API_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct qwen3_asr_context qwen3_asr_context;
+typedef struct qwen3_asr_session qwen3_asr_session;
+typedef struct qwen3_asr_result qwen3_asr_result;
+
+// Decoder KV cache element type
+typedef enum qwen3_asr_kv_type {
+    QWEN3_ASR_KV_F16  = 0,
+    QWEN3_ASR_KV_Q8_0 = 1,
+    QWEN3_ASR_KV_Q4_0 = 2,
+} qwen3_asr_kv_type;
+
+// Threads and device of one component (see cpu_backend_params)
+typedef struct qwen3_asr_backend_params {
+    int32_t n_threads;          // ggml CPU compute threads, <= 0: all cores
+    bool use_threadpool;        // persistent threadpool, implied by cpu_ids
+    const int32_t * cpu_ids;    // CPUs to pin the threads to, copied at load
+    int32_t n_cpu_ids;
+    uint32_t poll;              // threadpool polling level, 0-100
+    bool use_gpu;               // false runs on the CPU only
+    int32_t gpu_device;         // GPU index among GPU devices, -1 = first
+} qwen3_asr_backend_params;
+
+typedef struct qwen3_asr_context_params {
+    qwen3_asr_backend_params encoder;
+    qwen3_asr_backend_params decoder;
+    bool share_compute;         // one compute buffer pool when the settings allow it; runs encoder and decoder one at a time
+} qwen3_asr_context_params;
+
+// Transcript text completed by the latest token (not NUL-terminated), from
+// the calling thread while qwen3_asr_transcribe_*() runs
+typedef void (*qwen3_asr_text_callback)(const char * text, size_t len,
+                                        int32_t n_tokens, int32_t max_tokens, void * user_data);
+
+typedef struct qwen3_asr_transcribe_params {
+    const char * language;      // language code, NULL or "" to detect it
+    int32_t max_tokens;
+    float max_tokens_per_sec;   // 0 = max_tokens only
+    bool stop_loops;
+    int32_t n_threads;          // mel threads
+    qwen3_asr_kv_type kv_type;
+    bool f16_audio;
+    int32_t n_draft;            // speculative decoding, 0 = off
+    int32_t n_beams;            // beam search when > 1
+    float length_penalty;
+    bool use_vad;               // split at silences, see qwen3_asr_result_n_segments()
+    bool gpu_mel;
+    bool print_timing;          // timing summary on stderr
+
+    qwen3_asr_text_callback text_callback;
+    void * user_data;
+} qwen3_asr_transcribe_params;
+
+// Partial hypothesis of a session, from inside qwen3_asr_session_push_*();
+// partial is only valid during the call
+typedef void (*qwen3_asr_partial_callback)(const qwen3_asr_result * partial, float audio_sec,
+                                           void * user_data);
+
+typedef struct qwen3_asr_stream_params {
+    const char * language;      // language code, NULL or "" to detect it
+    int32_t max_tokens;         // per hypothesis
+    int32_t n_threads;          // mel threads
+    int32_t partial_interval_chunks;  // partial every N seconds of audio, 0 = none
+    int32_t kv_reserve_sec;
+    qwen3_asr_kv_type kv_type;
+    bool f16_audio;
+    bool stop_loops;            // end a hypothesis at a repetition loop
+
+    qwen3_asr_partial_callback partial_callback;
+    void * user_data;
+} qwen3_asr_stream_params;
+
+// Timing of a result, in milliseconds
+typedef struct qwen3_asr_timings {
+    int64_t t_mel_ms;
+    int64_t t_encode_ms;
+    int64_t t_decode_ms;
+    int64_t t_prefill_ms;       // included in t_decode_ms
+    int64_t t_total_ms;
+    int32_t n_prompt_tokens;
+} qwen3_asr_timings;
+
+// QWEN3_ASR_C_API_VERSION the library was built with
+QWEN3_ASR_API int32_t qwen3_asr_api_version(void);
+
+QWEN3_ASR_API qwen3_asr_context_params qwen3_asr_context_default_params(void);
+QWEN3_ASR_API qwen3_asr_transcribe_params qwen3_asr_transcribe_default_params(void);
+QWEN3_ASR_API qwen3_asr_stream_params qwen3_asr_stream_default_params(void);
+
+// Context
+
+QWEN3_ASR_API qwen3_asr_context * qwen3_asr_init(void);
+QWEN3_ASR_API void qwen3_asr_free(qwen3_asr_context * ctx);
+
+// params may be NULL for the defaults
+QWEN3_ASR_API bool qwen3_asr_load_model(qwen3_asr_context * ctx, const char * model_path,
+                                        const qwen3_asr_context_params * params);
+
+// Last error of ctx, "" if none; valid until the next call on ctx
+QWEN3_ASR_API const char * qwen3_asr_get_error(const qwen3_asr_context * ctx);
+
+// Transcription of 16 kHz mono samples, float in [-1, 1] or 16-bit PCM.
+// params may be NULL for the defaults. The result is freed with
+// qwen3_asr_result_free().
+QWEN3_ASR_API qwen3_asr_result * qwen3_asr_transcribe_f32(qwen3_asr_context * ctx,
+                                                          const float * samples, int32_t n_samples,
+                                                          const qwen3_asr_transcribe_params * params);
+QWEN3_ASR_API qwen3_asr_result * qwen3_asr_transcribe_s16(qwen3_asr_context * ctx,
+                                                          const int16_t * samples, int32_t n_samples,
+                                                          const qwen3_asr_transcribe_params * params);
+
+// Transcription of a WAV file (any rate and channel count)
+QWEN3_ASR_API qwen3_asr_result * qwen3_asr_transcribe_file(qwen3_asr_context * ctx, const char * path,
+                                                           const qwen3_asr_transcribe_params * params);
+
+// Streaming session over pushed audio; the context must outlive it and runs
+// nothing else while the session is active. params may be NULL.
+
+QWEN3_ASR_API qwen3_asr_session * qwen3_asr_session_create(qwen3_asr_context * ctx,
+                                                           const qwen3_asr_stream_params * params);
+QWEN3_ASR_API void qwen3_asr_session_free(qwen3_asr_session * session);
+
+QWEN3_ASR_API bool qwen3_asr_session_push_f32(qwen3_asr_session * session,
+                                              const float * samples, int32_t n_samples);
+QWEN3_ASR_API bool qwen3_asr_session_push_s16(qwen3_asr_session * session,
+                                              const int16_t * samples, int32_t n_samples);
+
+// Flush the remaining audio and return the final result
+QWEN3_ASR_API qwen3_asr_result * qwen3_asr_session_finalize(qwen3_asr_session * session);
+
+// Drop all audio to start a new utterance
+QWEN3_ASR_API void qwen3_asr_session_reset(qwen3_asr_session * session);
+
+QWEN3_ASR_API const char * qwen3_asr_session_get_error(const qwen3_asr_session * session);
+
+// Results; strings stay valid until the result is freed
+
+QWEN3_ASR_API void qwen3_asr_result_free(qwen3_asr_result * result);
+
+QWEN3_ASR_API const char * qwen3_asr_result_text(const qwen3_asr_result * result);
+QWEN3_ASR_API const char * qwen3_asr_result_language(const qwen3_asr_result * result);
+QWEN3_ASR_API float qwen3_asr_result_audio_sec(const qwen3_asr_result * result);
+
+QWEN3_ASR_API int32_t qwen3_asr_result_n_tokens(const qwen3_asr_result * result);
+QWEN3_ASR_API const int32_t * qwen3_asr_result_tokens(const qwen3_asr_result * result);
+
+QWEN3_ASR_API qwen3_asr_timings qwen3_asr_result_timings(const qwen3_asr_result * result);
+
+// Speech segments of a use_vad transcription (0 otherwise)
+QWEN3_ASR_API int32_t qwen3_asr_result_n_segments(const qwen3_asr_result * result);
+QWEN3_ASR_API const char * qwen3_asr_result_segment_text(const qwen3_asr_result * result, int32_t i);
+QWEN3_ASR_API const char * qwen3_asr_result_segment_language(const qwen3_asr_result * result, int32_t i);
+QWEN3_ASR_API float qwen3_asr_result_segment_start(const qwen3_asr_result * result, int32_t i);
+QWEN3_ASR_API float qwen3_asr_result_segment_end(const qwen3_asr_result * result, int32_t i);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // QWEN3_ASR_C_H
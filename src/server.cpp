@@ -0,0 +1,845 @@
+#include "server.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string_view>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Request headers larger than this are rejected
+#define QWEN3_SERVER_MAX_HEADER 65536
+
+// Socket receive timeout, so a stalled client cannot hold an HTTP thread
+#define QWEN3_SERVER_RECV_TIMEOUT_SEC 30
+
+// Accepted connections waiting for a thread, per HTTP thread
+#define QWEN3_SERVER_CONN_BACKLOG 4
+
+// Requests kept for the latency percentiles of /metrics
+#define QWEN3_SERVER_METRICS_WINDOW 1024
+
+// A client hanging up mid-response must not raise SIGPIPE in the host
+// process; where send() has no MSG_NOSIGNAL, accept_loop sets SO_NOSIGPIPE
+// on each connection instead
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace qwen3_asr {
+
+static int64_t get_time_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string escape_json_string(std::string_view s) {
+    std::string result;
+    result.reserve(s.size() + 10);
+    for (char c : s) {
+        switch (c) {
+            case '"':  result += "\\\""; break;
+            case '\\': result += "\\\\"; break;
+            case '\b': result += "\\b"; break;
+            case '\f': result += "\\f"; break;
+            case '\n': result += "\\n"; break;
+            case '\r': result += "\\r"; break;
+            case '\t': result += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned char>(c));
+                    result += buf;
+                } else {
+                    result += c;
+                }
+        }
+    }
+    return result;
+}
+
+static std::string to_lower(std::string_view s) {
+    std::string r(s);
+    for (char & c : r) {
+        c = (char)tolower((unsigned char)c);
+    }
+    return r;
+}
+
+static std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) s.remove_suffix(1);
+    return s;
+}
+
+// Value of a "; key=value" parameter in a header such as Content-Type
+static std::string header_param(std::string_view header, std::string_view key) {
+    size_t pos = 0;
+    while ((pos = header.find(';', pos)) != std::string_view::npos) {
+        std::string_view p = trim(header.substr(pos + 1));
+        const size_t end = p.find(';');
+        std::string_view kv = trim(p.substr(0, end));
+        const size_t eq = kv.find('=');
+        if (eq != std::string_view::npos && to_lower(trim(kv.substr(0, eq))) == key) {
+            std::string_view v = trim(kv.substr(eq + 1));
+            if (v.size() >= 2 && v.front() == '"' && v.back() == '"') {
+                v = v.substr(1, v.size() - 2);
+            }
+            return std::string(v);
+        }
+        ++pos;
+    }
+    return "";
+}
+
+static std::string url_decode(std::string_view s) {
+    std::string r;
+    r.reserve(s.size());
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '+') {
+            r += ' ';
+        } else if (s[i] == '%' && i + 2 < s.size() && isxdigit((unsigned char)s[i + 1]) &&
+                   isxdigit((unsigned char)s[i + 2])) {
+            r += (char)std::stoi(std::string(s.substr(i + 1, 2)), nullptr, 16);
+            i += 2;
+        } else {
+            r += s[i];
+        }
+    }
+    return r;
+}
+
+static const char * status_text(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 408: return "Request Timeout";
+        case 411: return "Length Required";
+        case 413: return "Payload Too Large";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        default:  return "Error";
+    }
+}
+
+struct http_request {
+    std::string method;
+    std::string path;
+    std::map<std::string, std::string> query;
+    std::map<std::string, std::string> headers;   // lower-case names
+    std::string body;
+
+    std::string header(const std::string & name) const {
+        auto it = headers.find(name);
+        return it == headers.end() ? "" : it->second;
+    }
+};
+
+struct http_response {
+    int status = 200;
+    std::string content_type = "application/json";
+    std::string body;
+    std::vector<std::pair<std::string, std::string>> headers;
+};
+
+// OpenAI-style error body
+static void set_error(http_response & res, int status, const std::string & message,
+                      const char * type = "invalid_request_error") {
+    res.status = status;
+    res.content_type = "application/json";
+    res.body = "{\"error\": {\"message\": \"" + escape_json_string(message) +
+               "\", \"type\": \"" + type + "\"}}\n";
+}
+
+static bool send_all(int fd, const char * data, size_t size) {
+    while (size > 0) {
+        const ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static void send_response(int fd, const http_response & res) {
+    std::string head = "HTTP/1.1 " + std::to_string(res.status) + " " + status_text(res.status) + "\r\n";
+    head += "Content-Type: " + res.content_type + "\r\n";
+    head += "Content-Length: " + std::to_string(res.body.size()) + "\r\n";
+    head += "Connection: close\r\n";
+    for (const auto & h : res.headers) {
+        head += h.first + ": " + h.second + "\r\n";
+    }
+    head += "\r\n";
+    if (send_all(fd, head.data(), head.size())) {
+        send_all(fd, res.body.data(), res.body.size());
+    }
+}
+
+// Read one request; on failure res holds the error response (status 0 when
+// the client went away and nothing should be sent)
+static bool read_request(int fd, size_t max_body, http_request & req,
+                         http_response & res) {
+    std::string buf;
+    size_t header_end = std::string::npos;
+    char chunk[16384];
+    while (header_end == std::string::npos) {
+        if (buf.size() > QWEN3_SERVER_MAX_HEADER) {
+            set_error(res, 400, "Request header too large");
+            return false;
+        }
+        const ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            res.status = (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) ? 408 : 0;
+            if (res.status) {
+                set_error(res, 408, "Timed out reading the request");
+            }
+            return false;
+        }
+        buf.append(chunk, (size_t)n);
+        header_end = buf.find("\r\n\r\n");
+    }
+
+    std::string_view head(buf.data(), header_end);
+    size_t line_end = head.find("\r\n");
+    std::string_view request_line = head.substr(0, line_end);
+    const size_t sp1 = request_line.find(' ');
+    const size_t sp2 = request_line.find(' ', sp1 + 1);
+    if (sp1 == std::string_view::npos || sp2 == std::string_view::npos) {
+        set_error(res, 400, "Malformed request line");
+        return false;
+    }
+    req.method = std::string(request_line.substr(0, sp1));
+    std::string_view target = request_line.substr(sp1 + 1, sp2 - sp1 - 1);
+    const size_t qpos = target.find('?');
+    req.path = std::string(target.substr(0, qpos));
+    if (qpos != std::string_view::npos) {
+        std::string_view q = target.substr(qpos + 1);
+        while (!q.empty()) {
+            const size_t amp = q.find('&');
+            std::string_view kv = q.substr(0, amp);
+            const size_t eq = kv.find('=');
+            if (eq != std::string_view::npos) {
+                req.query[url_decode(kv.substr(0, eq))] = url_decode(kv.substr(eq + 1));
+            }
+            q = amp == std::string_view::npos ? std::string_view() : q.substr(amp + 1);
+        }
+    }
+
+    while (line_end != std::string_view::npos && line_end < head.size()) {
+        const size_t start = line_end + 2;
+        line_end = head.find("\r\n", start);
+        std::string_view line = head.substr(start, line_end == std::string_view::npos ? head.size() - start : line_end - start);
+        const size_t colon = line.find(':');
+        if (colon != std::string_view::npos) {
+            req.headers[to_lower(trim(line.substr(0, colon)))] = std::string(trim(line.substr(colon + 1)));
+        }
+    }
+
+    if (to_lower(req.header("transfer-encoding")).find("chunked") != std::string::npos) {
+        set_error(res, 411, "Chunked request bodies are not supported; send Content-Length");
+        return false;
+    }
+    const std::string length = req.header("content-length");
+    size_t content_length = 0;
+    if (!length.empty()) {
+        char * end = nullptr;
+        content_length = strtoull(length.c_str(), &end, 10);
+        if (end == length.c_str() || *end != '\0') {
+            set_error(res, 400, "Invalid Content-Length");
+            return false;
+        }
+    }
+    if (content_length > max_body) {
+        set_error(res, 413, "Request body exceeds " + std::to_string(max_body) + " bytes");
+        return false;
+    }
+
+    // curl waits for this before sending large uploads
+    if (to_lower(req.header("expect")) == "100-continue") {
+        static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        send_all(fd, cont, sizeof(cont) - 1);
+    }
+
+    req.body = buf.substr(header_end + 4);
+    req.body.reserve(content_length);
+    while (req.body.size() < content_length) {
+        const size_t want = std::min(sizeof(chunk), content_length - req.body.size());
+        const ssize_t n = recv(fd, chunk, want, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            res.status = 0;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                set_error(res, 408, "Timed out reading the request body");
+            }
+            return false;
+        }
+        req.body.append(chunk, (size_t)n);
+    }
+    req.body.resize(content_length);
+    return true;
+}
+
+// multipart/form-data fields as views into body
+static bool parse_multipart(const std::string & body, const std::string & boundary,
+                            std::map<std::string, std::string_view> & fields) {
+    const std::string delim = "--" + boundary;
+    size_t pos = body.find(delim);
+    if (pos == std::string::npos) {
+        return false;
+    }
+    while (true) {
+        pos += delim.size();
+        if (body.compare(pos, 2, "--") == 0) {
+            return true;
+        }
+        if (body.compare(pos, 2, "\r\n") != 0) {
+            return false;
+        }
+        pos += 2;
+        const size_t head_end = body.find("\r\n\r\n", pos);
+        if (head_end == std::string::npos) {
+            return false;
+        }
+        std::string name;
+        std::string_view heads(body.data() + pos, head_end - pos);
+        while (!heads.empty()) {
+            const size_t eol = heads.find("\r\n");
+            std::string_view line = heads.substr(0, eol);
+            const size_t colon = line.find(':');
+            if (colon != std::string_view::npos &&
+                to_lower(trim(line.substr(0, colon))) == "content-disposition") {
+                name = header_param(line.substr(colon + 1), "name");
+            }
+            heads = eol == std::string_view::npos ? std::string_view() : heads.substr(eol + 2);
+        }
+        const size_t data_start = head_end + 4;
+        const size_t next = body.find("\r\n" + delim, data_start);
+        if (next == std::string::npos) {
+            return false;
+        }
+        if (!name.empty()) {
+            fields[name] = std::string_view(body.data() + data_start, next - data_start);
+        }
+        pos = next + 2;
+    }
+}
+
+AsrServer::AsrServer(Qwen3ASR & asr, const server_params & params)
+    : asr_(asr), params_(params) {
+    params_.n_http_threads = std::max(1, params_.n_http_threads);
+    params_.max_queue = std::max(1, params_.max_queue);
+    params_.max_batch = std::max(1, params_.max_batch);
+    params_.transcribe.print_timing = false;
+    params_.transcribe.print_progress = false;
+    params_.transcribe.keep_audio_features = false;
+}
+
+AsrServer::~AsrServer() {
+    stop();
+    for (int & fd : stop_pipe_) {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+}
+
+bool AsrServer::start() {
+    if (stop_pipe_[0] < 0) {
+        if (pipe(stop_pipe_) != 0) {
+            error_msg_ = std::string("pipe() failed: ") + strerror(errno);
+            return false;
+        }
+        fcntl(stop_pipe_[0], F_SETFL, O_NONBLOCK);
+        fcntl(stop_pipe_[1], F_SETFL, O_NONBLOCK);
+    }
+
+    if (!params_.unix_socket.empty()) {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (params_.unix_socket.size() >= sizeof(addr.sun_path)) {
+            error_msg_ = "Unix socket path too long: " + params_.unix_socket;
+            return false;
+        }
+        strncpy(addr.sun_path, params_.unix_socket.c_str(), sizeof(addr.sun_path) - 1);
+        listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(params_.unix_socket.c_str());
+        if (listen_fd_ < 0 || bind(listen_fd_, (sockaddr *)&addr, sizeof(addr)) != 0) {
+            error_msg_ = "Cannot bind Unix socket " + params_.unix_socket + ": " + strerror(errno);
+            return false;
+        }
+    } else {
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        addrinfo * res = nullptr;
+        const std::string port = std::to_string(params_.port);
+        if (getaddrinfo(params_.host.c_str(), port.c_str(), &hints, &res) != 0 || !res) {
+            error_msg_ = "Cannot resolve listen address: " + params_.host;
+            return false;
+        }
+        listen_fd_ = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+        const int one = 1;
+        if (listen_fd_ >= 0) {
+            setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        }
+        const bool bound = listen_fd_ >= 0 && bind(listen_fd_, res->ai_addr, res->ai_addrlen) == 0;
+        freeaddrinfo(res);
+        if (!bound) {
+            error_msg_ = "Cannot bind " + params_.host + ":" + port + ": " + strerror(errno);
+            return false;
+        }
+    }
+    if (listen(listen_fd_, 128) != 0) {
+        error_msg_ = std::string("listen() failed: ") + strerror(errno);
+        return false;
+    }
+
+    recent_.clear();
+    recent_.reserve(QWEN3_SERVER_METRICS_WINDOW);
+    // Drop the wakeups of a previous run
+    char drain[64];
+    while (read(stop_pipe_[0], drain, sizeof(drain)) > 0) {
+    }
+    stop_requested_ = false;
+    {
+        std::lock_guard<std::mutex> lock(stop_mutex_);
+        stopped_ = false;
+    }
+    running_ = true;
+    http_running_ = true;
+    scheduler_thread_ = std::thread(&AsrServer::scheduler_loop, this);
+    for (int32_t i = 0; i < params_.n_http_threads; ++i) {
+        http_threads_.emplace_back(&AsrServer::connection_loop, this);
+    }
+    accept_thread_ = std::thread(&AsrServer::accept_loop, this);
+    return true;
+}
+
+void AsrServer::wait() {
+    std::unique_lock<std::mutex> lock(stop_mutex_);
+    stop_cv_.wait(lock, [&] { return stopped_; });
+}
+
+void AsrServer::request_stop() {
+    stop_requested_ = true;
+    if (stop_pipe_[1] >= 0) {
+        const char c = 1;
+        // A full pipe already holds a wakeup
+        const ssize_t n = write(stop_pipe_[1], &c, 1);
+        (void)n;
+    }
+}
+
+void AsrServer::stop() {
+    request_stop();
+    if (accept_thread_.joinable()) {
+        accept_thread_.join();
+    }
+    // The scheduler finishes the admitted jobs first (nothing is admitted
+    // once running_ is off), then the HTTP threads answer them and exit.
+    // Each flag is cleared under the mutex its waiters check it with, so
+    // a thread about to block cannot miss the wakeup.
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        running_ = false;
+    }
+    queue_cv_.notify_all();
+    if (scheduler_thread_.joinable()) {
+        scheduler_thread_.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(conn_mutex_);
+        http_running_ = false;
+    }
+    conn_cv_.notify_all();
+    for (auto & t : http_threads_) {
+        t.join();
+    }
+    http_threads_.clear();
+    {
+        std::lock_guard<std::mutex> lock(stop_mutex_);
+        stopped_ = true;
+    }
+    stop_cv_.notify_all();
+    if (listen_fd_ >= 0) {
+        close(listen_fd_);
+        listen_fd_ = -1;
+        if (!params_.unix_socket.empty()) {
+            unlink(params_.unix_socket.c_str());
+        }
+    }
+}
+
+void AsrServer::accept_loop() {
+    const size_t max_pending = (size_t)params_.n_http_threads * QWEN3_SERVER_CONN_BACKLOG;
+    while (!stop_requested_) {
+        // The stop pipe wakes the poll on request_stop()
+        pollfd pfds[2] = {{listen_fd_, POLLIN, 0}, {stop_pipe_[0], POLLIN, 0}};
+        if (poll(pfds, 2, -1) <= 0 || !(pfds[0].revents & POLLIN)) {
+            continue;
+        }
+        const int fd = accept(listen_fd_, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+        timeval tv = {QWEN3_SERVER_RECV_TIMEOUT_SEC, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+#ifdef SO_NOSIGPIPE
+        const int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+        std::unique_lock<std::mutex> lock(conn_mutex_);
+        if (connections_.size() >= max_pending) {
+            lock.unlock();
+            // Every HTTP thread is busy: push back right away
+            http_response res;
+            set_error(res, 503, "Server busy", "server_error");
+            res.headers.emplace_back("Retry-After", "1");
+            send_response(fd, res);
+            close(fd);
+            std::lock_guard<std::mutex> mlock(metrics_mutex_);
+            ++n_rejected_;
+            continue;
+        }
+        connections_.push_back(fd);
+        lock.unlock();
+        conn_cv_.notify_one();
+    }
+
+    // Release wait(); stop() winds down the other threads
+    {
+        std::lock_guard<std::mutex> lock(stop_mutex_);
+        stopped_ = true;
+    }
+    stop_cv_.notify_all();
+}
+
+void AsrServer::connection_loop() {
+    while (true) {
+        int fd = -1;
+        std::shared_ptr<job> j;
+        {
+            std::unique_lock<std::mutex> lock(conn_mutex_);
+            conn_cv_.wait(lock, [&] { return !finished_.empty() || !connections_.empty() || !http_running_; });
+            // Finished jobs first: their clients have waited the longest
+            if (!finished_.empty()) {
+                j = finished_.front();
+                finished_.pop_front();
+            } else if (!connections_.empty()) {
+                fd = connections_.front();
+                connections_.pop_front();
+            } else {
+                return;
+            }
+        }
+        if (j) {
+            respond(*j);
+        } else if (handle_connection(fd)) {
+            close(fd);
+        }
+    }
+}
+
+bool AsrServer::handle_connection(int fd) {
+    http_request req;
+    http_response res;
+    if (!read_request(fd, params_.max_body_bytes, req, res)) {
+        if (res.status != 0) {
+            send_response(fd, res);
+        }
+        return true;
+    }
+
+    if (req.path == "/health") {
+        res.body = "{\"status\": \"ok\"}\n";
+    } else if (req.path == "/metrics") {
+        handle_metrics(res);
+    } else if (req.path == "/v1/audio/transcriptions") {
+        if (req.method != "POST") {
+            set_error(res, 405, "Use POST for " + req.path);
+        } else {
+            QWEN3_TRACE_REQUEST();
+            if (handle_transcription(req, res, fd)) {
+                return false;
+            }
+        }
+    } else {
+        set_error(res, 404, "Unknown endpoint: " + req.path);
+    }
+    send_response(fd, res);
+    return true;
+}
+
+bool AsrServer::handle_transcription(const http_request & req, http_response & res, int fd) {
+    const int64_t t_start = get_time_ms();
+
+    // Form fields, with query parameters as the fallback (raw WAV bodies)
+    std::map<std::string, std::string_view> fields;
+    for (const auto & kv : req.query) {
+        fields[kv.first] = kv.second;
+    }
+    const std::string content_type = to_lower(req.header("content-type"));
+    std::string_view audio;
+    if (content_type.rfind("multipart/form-data", 0) == 0) {
+        const std::string boundary = header_param(req.header("content-type"), "boundary");
+        if (boundary.empty() || !parse_multipart(req.body, boundary, fields)) {
+            set_error(res, 400, "Malformed multipart/form-data body");
+            return false;
+        }
+        auto it = fields.find("file");
+        if (it == fields.end()) {
+            set_error(res, 400, "Missing form field: file");
+            return false;
+        }
+        audio = it->second;
+    } else {
+        audio = req.body;
+    }
+
+    auto field = [&](const char * name, const char * def) -> std::string {
+        auto it = fields.find(name);
+        return it == fields.end() || it->second.empty() ? def : std::string(it->second);
+    };
+    const std::string format = field("response_format", "json");
+    if (format != "json" && format != "text" && format != "verbose_json") {
+        set_error(res, 400, "Unsupported response_format: " + format + " (json, text, verbose_json)");
+        return false;
+    }
+
+    auto j = std::make_shared<job>();
+    j->language = field("language", params_.transcribe.language.c_str());
+    j->format = format;
+    j->t_start_ms = t_start;
+    j->fd = fd;
+    int sample_rate = 0;
+    std::string error;
+    {
+        QWEN3_TIMER("server.load_audio");
+        if (!load_audio_memory(audio.data(), audio.size(), j->samples, sample_rate, error)) {
+            set_error(res, 400, "Cannot decode audio: " + error);
+            return false;
+        }
+    }
+    if (j->samples.empty()) {
+        set_error(res, 400, "Audio contains no samples");
+        return false;
+    }
+
+    j->t_admit_ms = get_time_ms();
+    if (!admit(j)) {
+        set_error(res, 503, "Request queue is full", "server_error");
+        res.headers.emplace_back("Retry-After", "1");
+        std::lock_guard<std::mutex> lock(metrics_mutex_);
+        ++n_rejected_;
+        return false;
+    }
+    return true;
+}
+
+void AsrServer::respond(job & j) {
+    const transcribe_result & r = j.result;
+    request_metrics m;
+    m.t_queue_ms = j.t_queue_ms;
+    m.t_mel_ms = r.t_mel_ms;
+    m.t_encode_ms = r.t_encode_ms;
+    m.t_decode_ms = r.t_decode_ms;
+    m.t_total_ms = get_time_ms() - j.t_start_ms;
+    m.audio_sec = r.audio_sec;
+    record(m, r.success);
+
+    http_response res;
+    res.headers.emplace_back("X-Queue-Time-Ms", std::to_string(m.t_queue_ms));
+    res.headers.emplace_back("X-Processing-Time-Ms", std::to_string(m.t_total_ms));
+    const std::string & format = j.format;
+    if (!r.success) {
+        set_error(res, 500, "Transcription failed: " + r.error_msg, "server_error");
+    } else if (format == "text") {
+        res.content_type = "text/plain; charset=utf-8";
+        res.body = r.text + "\n";
+    } else if (format == "json") {
+        res.body = "{\"text\": \"" + escape_json_string(r.text) + "\"}\n";
+    } else {
+        char metrics[256];
+        snprintf(metrics, sizeof(metrics),
+                 "{\"queue_ms\": %lld, \"mel_ms\": %lld, \"encode_ms\": %lld, \"decode_ms\": %lld, \"total_ms\": %lld}",
+                 (long long)m.t_queue_ms, (long long)m.t_mel_ms, (long long)m.t_encode_ms,
+                 (long long)m.t_decode_ms, (long long)m.t_total_ms);
+        char duration[32];
+        snprintf(duration, sizeof(duration), "%.3f", r.audio_sec);
+        res.body = "{\"task\": \"transcribe\", \"language\": \"" + escape_json_string(r.language) +
+                   "\", \"duration\": " + duration + ", \"text\": \"" + escape_json_string(r.text) +
+                   "\", \"metrics\": " + metrics + "}\n";
+    }
+    send_response(j.fd, res);
+    close(j.fd);
+    j.fd = -1;
+}
+
+bool AsrServer::admit(const std::shared_ptr<job> & j) {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        if (!running_ || n_admitted_ >= params_.max_queue) {
+            return false;
+        }
+        ++n_admitted_;
+        queue_.push_back(j);
+    }
+    queue_cv_.notify_one();
+    return true;
+}
+
+void AsrServer::scheduler_loop() {
+    while (true) {
+        std::vector<std::shared_ptr<job>> batch;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            queue_cv_.wait(lock, [&] { return !queue_.empty() || !running_; });
+            if (queue_.empty()) {
+                return;
+            }
+            // Give concurrent requests a moment to join the batch
+            if ((int32_t)queue_.size() < params_.max_batch && params_.batch_wait_ms > 0) {
+                queue_cv_.wait_for(lock, std::chrono::milliseconds(params_.batch_wait_ms), [&] {
+                    return (int32_t)queue_.size() >= params_.max_batch || !running_;
+                });
+            }
+            // One transcribe_batch call runs with one language
+            const std::string language = queue_.front()->language;
+            for (auto it = queue_.begin(); it != queue_.end() && (int32_t)batch.size() < params_.max_batch;) {
+                if ((*it)->language == language) {
+                    batch.push_back(*it);
+                    it = queue_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        const int64_t t_batch = get_time_ms();
+        std::vector<audio_clip> clips(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i) {
+            clips[i].samples = std::move(batch[i]->samples);
+            batch[i]->t_queue_ms = t_batch - batch[i]->t_admit_ms;
+        }
+
+        transcribe_params tp = params_.transcribe;
+        tp.language = batch[0]->language;
+
+        // Hand each finished job to the HTTP threads to answer
+        auto finish = [&](size_t index, const transcribe_result & r) {
+            job & j = *batch[index];
+            if (j.done) {
+                return;
+            }
+            j.result = r;
+            j.done = true;
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex_);
+                --n_admitted_;
+            }
+            {
+                std::lock_guard<std::mutex> lock(conn_mutex_);
+                finished_.push_back(batch[index]);
+            }
+            conn_cv_.notify_one();
+        };
+        asr_.transcribe_batch(clips, tp, finish);
+
+        // transcribe_batch reports every clip; this only guards the clients
+        transcribe_result missing;
+        missing.error_msg = "No result for the request";
+        for (size_t i = 0; i < batch.size(); ++i) {
+            finish(i, missing);
+        }
+        std::lock_guard<std::mutex> lock(metrics_mutex_);
+        ++n_batches_;
+    }
+}
+
+void AsrServer::record(const request_metrics & m, bool ok) {
+    std::lock_guard<std::mutex> lock(metrics_mutex_);
+    if (ok) {
+        ++n_ok_;
+        audio_sec_total_ += m.audio_sec;
+    } else {
+        ++n_failed_;
+    }
+    if (recent_.size() < QWEN3_SERVER_METRICS_WINDOW) {
+        recent_.push_back(m);
+    } else {
+        recent_[recent_pos_] = m;
+        recent_pos_ = (recent_pos_ + 1) % QWEN3_SERVER_METRICS_WINDOW;
+    }
+}
+
+void AsrServer::handle_metrics(http_response & res) {
+    size_t depth = 0;
+    int32_t admitted = 0;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        depth = queue_.size();
+        admitted = n_admitted_;
+    }
+
+    std::lock_guard<std::mutex> lock(metrics_mutex_);
+    auto percentiles = [&](int64_t request_metrics::*field) {
+        std::vector<int64_t> v;
+        v.reserve(recent_.size());
+        for (const auto & m : recent_) {
+            v.push_back(m.*field);
+        }
+        std::sort(v.begin(), v.end());
+        auto at = [&](double q) -> long long {
+            return v.empty() ? 0 : (long long)v[std::min(v.size() - 1, (size_t)(q * v.size()))];
+        };
+        char buf[96];
+        snprintf(buf, sizeof(buf), "{\"p50\": %lld, \"p95\": %lld, \"max\": %lld}",
+                 at(0.50), at(0.95), v.empty() ? 0LL : (long long)v.back());
+        return std::string(buf);
+    };
+
+    char head[512];
+    snprintf(head, sizeof(head),
+             "{\"requests\": {\"ok\": %llu, \"failed\": %llu, \"rejected\": %llu}, "
+             "\"queue\": {\"depth\": %zu, \"admitted\": %d, \"max_queue\": %d}, "
+             "\"batches\": %llu, \"audio_sec\": %.3f, \"latency_window\": %zu, ",
+             (unsigned long long)n_ok_, (unsigned long long)n_failed_, (unsigned long long)n_rejected_,
+             depth, admitted, params_.max_queue, (unsigned long long)n_batches_, audio_sec_total_,
+             recent_.size());
+    res.body = std::string(head) + "\"latency_ms\": {" +
+               "\"queue\": " + percentiles(&request_metrics::t_queue_ms) +
+               ", \"mel\": " + percentiles(&request_metrics::t_mel_ms) +
+               ", \"encode\": " + percentiles(&request_metrics::t_encode_ms) +
+               ", \"decode\": " + percentiles(&request_metrics::t_decode_ms) +
+               ", \"total\": " + percentiles(&request_metrics::t_total_ms) + "}}\n";
+}
+
+} // namespace qwen3_asr
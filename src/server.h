@@ -0,0 +1,172 @@
+#pragma once
+
+#include "qwen3_asr.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace qwen3_asr {
+
+// Server parameters
+struct server_params {
+    // TCP address to listen on; ignored when unix_socket is set
+    std::string host = "127.0.0.1";
+    int32_t port = 8080;
+
+    // Listen on a Unix domain socket at this path instead of TCP
+    std::string unix_socket = "";
+
+    // Threads reading requests and decoding uploaded audio
+    int32_t n_http_threads = 4;
+
+    // Admission limit: requests queued or being transcribed. Requests above
+    // it are rejected with 503 and Retry-After instead of waiting.
+    int32_t max_queue = 64;
+
+    // Queued requests gathered into one transcribe_batch call
+    int32_t max_batch = 8;
+
+    // How long the scheduler waits for a batch to fill once a request is queued
+    int32_t batch_wait_ms = 5;
+
+    // Largest accepted request body
+    size_t max_body_bytes = 256u << 20;
+
+    // Per-batch settings (max_tokens, n_workers, n_decode_batch, kv_type,
+    // language default); language may be overridden per request
+    transcribe_params transcribe;
+};
+
+// Latency of one request, split by stage (milliseconds)
+struct request_metrics {
+    int64_t t_queue_ms = 0;     // admitted -> batch start
+    int64_t t_mel_ms = 0;
+    int64_t t_encode_ms = 0;
+    int64_t t_decode_ms = 0;
+    int64_t t_total_ms = 0;     // request read -> response ready
+    float audio_sec = 0.0f;
+};
+
+struct http_request;
+struct http_response;
+
+// Long-lived HTTP/1.1 server over one loaded Qwen3ASR model, with an
+// OpenAI-style POST /v1/audio/transcriptions endpoint (multipart form with
+// a WAV "file", or a raw audio/wav body), GET /health and GET /metrics.
+//
+// Connections are handled by a fixed pool of threads that parse requests
+// and decode audio; a single scheduler thread owns the model and runs the
+// admitted requests through transcribe_batch, grouped by language. An
+// admitted request does not hold its HTTP thread: the connection travels
+// with the job and the pool writes the response once the scheduler hands
+// the finished job back, so up to max_queue requests can be in flight.
+class AsrServer {
+public:
+    AsrServer(Qwen3ASR & asr, const server_params & params);
+    ~AsrServer();
+
+    AsrServer(const AsrServer &) = delete;
+    AsrServer & operator=(const AsrServer &) = delete;
+
+    // Bind and listen, then start the connection and scheduler threads
+    bool start();
+
+    // Block until request_stop() or stop() is called
+    void wait();
+
+    // Ask wait() to return; only stores a flag and writes to a pipe, so it
+    // is safe to call from a signal handler
+    void request_stop();
+
+    // Stop accepting connections, finish admitted requests and join threads
+    void stop();
+
+    const std::string & get_error() const { return error_msg_; }
+
+private:
+    struct job {
+        std::vector<float> samples;
+        std::string language;
+        int64_t t_admit_ms = 0;
+
+        // Connection to answer on (owned by the job once admitted), the
+        // requested response_format and when the request was read
+        int fd = -1;
+        std::string format;
+        int64_t t_start_ms = 0;
+
+        bool done = false;          // set by the scheduler thread only
+        transcribe_result result;
+        int64_t t_queue_ms = 0;
+    };
+
+    void accept_loop();
+    void connection_loop();
+    void scheduler_loop();
+
+    // false when the connection was handed to an admitted job, which then
+    // answers and closes it (respond)
+    bool handle_connection(int fd);
+    bool handle_transcription(const http_request & req, http_response & res, int fd);
+    void handle_metrics(http_response & res);
+
+    // Send a finished job's response and close its connection
+    void respond(job & j);
+
+    // Queue a job unless the admission limit is reached
+    bool admit(const std::shared_ptr<job> & j);
+    void record(const request_metrics & m, bool ok);
+
+    Qwen3ASR & asr_;
+    server_params params_;
+    int listen_fd_ = -1;
+
+    // request_stop() wakes the accept thread through this pipe; the accept
+    // thread then releases wait(). Kept open for the server's lifetime so
+    // a late signal never writes to a closed descriptor.
+    int stop_pipe_[2] = {-1, -1};
+    std::atomic<bool> stop_requested_{false};
+    std::mutex stop_mutex_;
+    std::condition_variable stop_cv_;
+    bool stopped_ = true;           // guarded by stop_mutex_
+
+    std::thread accept_thread_;
+    std::thread scheduler_thread_;
+    std::vector<std::thread> http_threads_;
+
+    // Accepted connections and finished jobs waiting for an HTTP thread
+    std::mutex conn_mutex_;
+    std::condition_variable conn_cv_;
+    std::deque<int> connections_;
+    std::deque<std::shared_ptr<job>> finished_;
+    bool http_running_ = false;     // guarded by conn_mutex_; cleared once
+                                    // the scheduler has drained
+
+    // Admitted requests waiting for the scheduler
+    std::mutex queue_mutex_;
+    std::condition_variable queue_cv_;
+    std::deque<std::shared_ptr<job>> queue_;
+    int32_t n_admitted_ = 0;    // queued + running
+    bool running_ = false;      // guarded by queue_mutex_; admits requests
+
+    // Aggregate metrics
+    std::mutex metrics_mutex_;
+    uint64_t n_ok_ = 0;
+    uint64_t n_failed_ = 0;
+    uint64_t n_rejected_ = 0;
+    uint64_t n_batches_ = 0;
+    double audio_sec_total_ = 0.0;
+    std::vector<request_metrics> recent_;   // ring of the latest requests
+    size_t recent_pos_ = 0;
+
+    std::string error_msg_;
+};
+
+} // namespace qwen3_asr
@@ -1,27 +1,54 @@
 #include "text_decoder.h"
 #include "timing.h"
+#include "weight_repack.h"
 
 #include <cmath>
 #include <cstring>
 #include <cstdio>
+#include <algorithm>
 #include <fstream>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <unistd.h>
 
 #define QWEN3_ASR_MAX_NODES 8192
 
+// Granularity of the KV length seen by the cached decode graph
+#define QWEN3_ASR_KV_BUCKET 256
+
+// Rows per page of the paged KV cache (TextDecoder::begin_paged)
+#define QWEN3_ASR_KV_PAGE 16
+
+// Prompt prefixes kept for TextDecoder::restore_prefix
+#define QWEN3_ASR_MAX_SNAPSHOTS 4
+
+// Header the model writes before the <asr_text> delimiter
+#define QWEN3_LANGUAGE_PREFIX "language "
+#define QWEN3_LANGUAGE_PREFIX_LEN 9
+
 namespace qwen3_asr {
 
 TextDecoder::TextDecoder() = default;
 
 TextDecoder::~TextDecoder() {
+    clear_prefix_snapshots();
     free_kv_cache(state_.cache);
+    if (state_.sched_decode) {
+        ggml_backend_sched_free(state_.sched_decode);
+        state_.sched_decode = nullptr;
+    }
+    if (state_.arena) {
+        // Backends and prompt scheduler belong to the arena
+        state_.sched = nullptr;
+        state_.backend_gpu = nullptr;
+        state_.backend_cpu = nullptr;
+        state_.arena.reset();
+    }
     if (state_.sched) {
         ggml_backend_sched_free(state_.sched);
         state_.sched = nullptr;
     }
+    for (ggml_backend_t backend : state_.backend_split) {
+        ggml_backend_free(backend);
+    }
+    state_.backend_split.clear();
     if (state_.backend_gpu) {
         ggml_backend_free(state_.backend_gpu);
         state_.backend_gpu = nullptr;
@@ -30,58 +57,86 @@ TextDecoder::~TextDecoder() {
         ggml_backend_free(state_.backend_cpu);
         state_.backend_cpu = nullptr;
     }
+    free_cpu_threadpool(state_.threadpool);
     free_decoder_model(model_);
 }
 
-bool TextDecoder::load_model(const std::string & model_path) {
-    struct ggml_context * meta_ctx = nullptr;
-    struct gguf_init_params params = {
-        /*.no_alloc =*/ true,
-        /*.ctx      =*/ &meta_ctx,
-    };
-    
-    struct gguf_context * ctx = gguf_init_from_file(model_path.c_str(), params);
+bool TextDecoder::load_model(const std::string & model_path,
+                             const cpu_backend_params & cpu_params,
+                             const std::shared_ptr<ComputeArena> & arena) {
+    auto file = std::make_shared<ModelFile>();
+    if (!file->open(model_path)) {
+        error_msg_ = file->get_error();
+        return false;
+    }
+    const bool ok = load_model(file, cpu_params, arena);
+    file->release_metadata();
+    return ok;
+}
+
+bool TextDecoder::load_model(const std::shared_ptr<ModelFile> & file,
+                             const cpu_backend_params & cpu_params,
+                             const std::shared_ptr<ComputeArena> & arena) {
+    struct gguf_context * ctx = file->get_gguf();
     if (!ctx) {
-        error_msg_ = "Failed to open GGUF file: " + model_path;
+        error_msg_ = "GGUF metadata already released: " + file->get_path();
         return false;
     }
     
     if (!parse_config(ctx)) {
-        gguf_free(ctx);
-        if (meta_ctx) ggml_free(meta_ctx);
+        return false;
+    }
+    
+    std::vector<ggml_backend_dev_t> gpu_devs;
+    if (!select_devices(cpu_params, gpu_devs)) {
         return false;
     }
     
     if (!create_tensors(ctx)) {
-        gguf_free(ctx);
-        if (meta_ctx) ggml_free(meta_ctx);
         return false;
     }
     
-    if (!load_tensor_data(model_path, ctx)) {
+    if (!load_tensor_data(file, ctx, gpu_devs)) {
         free_decoder_model(model_);
-        gguf_free(ctx);
-        if (meta_ctx) ggml_free(meta_ctx);
         return false;
     }
     
-    if (!load_vocab(ctx)) {
+    if (cpu_params.repack_weights && gpu_devs.empty() &&
+        !repack_weights(file->get_path(), cpu_params.repack_cache)) {
         free_decoder_model(model_);
-        gguf_free(ctx);
-        if (meta_ctx) ggml_free(meta_ctx);
         return false;
     }
     
-    gguf_free(ctx);
-    if (meta_ctx) ggml_free(meta_ctx);
-    
-    state_.backend_cpu = ggml_backend_init_by_type(GGML_BACKEND_DEVICE_TYPE_CPU, nullptr);
-    if (!state_.backend_cpu) {
-        error_msg_ = "Failed to initialize CPU backend";
+    if (!load_vocab(ctx)) {
+        free_decoder_model(model_);
         return false;
     }
-
-    state_.backend_gpu = ggml_backend_init_by_type(GGML_BACKEND_DEVICE_TYPE_GPU, nullptr);
+    
+    if (arena && arena->matches(cpu_params, QWEN3_ASR_MAX_NODES)) {
+        state_.arena = arena;
+        state_.backend_cpu = arena->get_backend_cpu();
+        state_.backend_gpu = arena->get_backend_gpu();
+        state_.sched = arena->get_sched();
+    } else {
+        if (!init_cpu_backend(cpu_params, state_.backend_cpu, state_.threadpool, error_msg_)) {
+            return false;
+        }
+        
+        // The weights may already live in device memory, so a device that
+        // cannot be initialized is an error rather than a CPU fallback
+        for (size_t d = 0; d < gpu_devs.size(); ++d) {
+            ggml_backend_t backend = ggml_backend_dev_init(gpu_devs[d], nullptr);
+            if (!backend) {
+                error_msg_ = std::string("Failed to initialize backend for ") + ggml_backend_dev_name(gpu_devs[d]);
+                return false;
+            }
+            if (d == 0) {
+                state_.backend_gpu = backend;
+            } else {
+                state_.backend_split.push_back(backend);
+            }
+        }
+    }
 
     std::vector<ggml_backend_t> backends;
     std::vector<ggml_backend_buffer_type_t> backend_bufts;
@@ -90,23 +145,34 @@ bool TextDecoder::load_model(const std::string & model_path) {
         backends.push_back(state_.backend_gpu);
         backend_bufts.push_back(ggml_backend_get_default_buffer_type(state_.backend_gpu));
     }
+    for (ggml_backend_t backend : state_.backend_split) {
+        backends.push_back(backend);
+        backend_bufts.push_back(ggml_backend_get_default_buffer_type(backend));
+    }
 
     backends.push_back(state_.backend_cpu);
     ggml_backend_buffer_type_t cpu_buft = ggml_backend_get_default_buffer_type(state_.backend_cpu);
-    if (state_.backend_gpu) {
-        ggml_backend_dev_t gpu_dev = ggml_backend_get_device(state_.backend_gpu);
-        ggml_backend_buffer_type_t host_buft = ggml_backend_dev_host_buffer_type(gpu_dev);
+    if (!gpu_devs.empty()) {
+        ggml_backend_buffer_type_t host_buft = ggml_backend_dev_host_buffer_type(gpu_devs[0]);
         if (host_buft) cpu_buft = host_buft;
     }
     backend_bufts.push_back(cpu_buft);
 
-    state_.sched = ggml_backend_sched_new(backends.data(), backend_bufts.data(), backends.size(), QWEN3_ASR_MAX_NODES, false, true);
-    if (!state_.sched) {
-        error_msg_ = "Failed to create backend scheduler";
-        return false;
+    if (!state_.arena) {
+        state_.sched = ggml_backend_sched_new(backends.data(), backend_bufts.data(), backends.size(), QWEN3_ASR_MAX_NODES, false, true);
+        if (!state_.sched) {
+            error_msg_ = "Failed to create backend scheduler";
+            return false;
+        }
+        state_.compute_meta.resize(ggml_tensor_overhead() * QWEN3_ASR_MAX_NODES + ggml_graph_overhead());
     }
     
-    state_.compute_meta.resize(ggml_tensor_overhead() * QWEN3_ASR_MAX_NODES + ggml_graph_overhead());
+    state_.sched_decode = ggml_backend_sched_new(backends.data(), backend_bufts.data(), backends.size(), QWEN3_ASR_MAX_NODES, false, true);
+    if (!state_.sched_decode) {
+        error_msg_ = "Failed to create decode scheduler";
+        return false;
+    }
+    state_.decode_meta.resize(ggml_tensor_overhead() * QWEN3_ASR_MAX_NODES + ggml_graph_overhead());
     
     return true;
 }
@@ -207,6 +273,10 @@ bool TextDecoder::create_tensors(struct gguf_context * ctx) {
             ne[0] = cfg.hidden_size;
             ne[1] = cfg.n_key_value_heads * cfg.head_dim;
             n_dims = 2;
+        } else if (strstr(name, "attn_qkv.weight")) {
+            ne[0] = cfg.hidden_size;
+            ne[1] = (cfg.n_attention_heads + 2 * cfg.n_key_value_heads) * cfg.head_dim;
+            n_dims = 2;
         } else if (strstr(name, "ffn_norm.weight")) {
             ne[0] = cfg.hidden_size;
             n_dims = 1;
@@ -218,6 +288,10 @@ bool TextDecoder::create_tensors(struct gguf_context * ctx) {
             ne[0] = cfg.hidden_size;
             ne[1] = cfg.intermediate_size;
             n_dims = 2;
+        } else if (strstr(name, "ffn_gate_up.weight")) {
+            ne[0] = cfg.hidden_size;
+            ne[1] = 2 * cfg.intermediate_size;
+            n_dims = 2;
         } else if (strstr(name, "ffn_down.weight")) {
             ne[0] = cfg.intermediate_size;
             ne[1] = cfg.hidden_size;
@@ -250,10 +324,12 @@ bool TextDecoder::create_tensors(struct gguf_context * ctx) {
                 else if (strstr(name, "attn_q.weight")) layer.attn_q = tensor;
                 else if (strstr(name, "attn_k.weight")) layer.attn_k = tensor;
                 else if (strstr(name, "attn_v.weight")) layer.attn_v = tensor;
+                else if (strstr(name, "attn_qkv.weight")) layer.attn_qkv = tensor;
                 else if (strstr(name, "attn_output.weight")) layer.attn_output = tensor;
                 else if (strstr(name, "ffn_norm.weight")) layer.ffn_norm = tensor;
                 else if (strstr(name, "ffn_gate.weight")) layer.ffn_gate = tensor;
                 else if (strstr(name, "ffn_up.weight")) layer.ffn_up = tensor;
+                else if (strstr(name, "ffn_gate_up.weight")) layer.ffn_gate_up = tensor;
                 else if (strstr(name, "ffn_down.weight")) layer.ffn_down = tensor;
             }
         }
@@ -265,80 +341,149 @@ bool TextDecoder::create_tensors(struct gguf_context * ctx) {
     return true;
 }
 
-bool TextDecoder::load_tensor_data(const std::string & path, struct gguf_context * ctx) {
-    int fd = open(path.c_str(), O_RDONLY);
-    if (fd < 0) {
-        error_msg_ = "Failed to open file for mmap: " + path;
-        return false;
+bool TextDecoder::select_devices(const cpu_backend_params & cpu_params,
+                                 std::vector<ggml_backend_dev_t> & devs) {
+    const int32_t n_layers = model_.config.n_decoder_layers;
+    
+    devs.clear();
+    state_.layer_device.assign(n_layers, 0);
+    
+    if (cpu_params.gpu_split.empty()) {
+        ggml_backend_dev_t dev = nullptr;
+        if (!select_gpu_device(cpu_params, dev, error_msg_)) {
+            return false;
+        }
+        if (dev) {
+            devs.push_back(dev);
+        }
+        return true;
     }
     
-    struct stat st;
-    if (fstat(fd, &st) != 0) {
-        error_msg_ = "Failed to stat file: " + path;
-        close(fd);
+    if (!cpu_params.use_gpu) {
+        error_msg_ = "A decoder layer split needs the GPU backend";
         return false;
     }
     
-    void * mmap_addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
-    
-    if (mmap_addr == MAP_FAILED) {
-        error_msg_ = "Failed to mmap file: " + path;
-        return false;
+    // Distinct devices in order of first use; part p of the split maps to
+    // part_device[p] in that list
+    const int32_t n_parts = (int32_t)cpu_params.gpu_split.size();
+    std::vector<int32_t> part_device(n_parts);
+    for (int32_t p = 0; p < n_parts; ++p) {
+        const int32_t index = cpu_params.gpu_split[p];
+        ggml_backend_dev_t dev = index >= 0 ? find_gpu_device(index) : nullptr;
+        if (!dev) {
+            error_msg_ = "GPU device " + std::to_string(index) + " not found";
+            return false;
+        }
+        auto it = std::find(devs.begin(), devs.end(), dev);
+        part_device[p] = (int32_t)(it - devs.begin());
+        if (it == devs.end()) {
+            devs.push_back(dev);
+        }
     }
     
-    model_.mmap_addr = mmap_addr;
-    model_.mmap_size = st.st_size;
+    for (int32_t il = 0; il < n_layers; ++il) {
+        state_.layer_device[il] = part_device[(int64_t)il * n_parts / n_layers];
+    }
     
-    const size_t data_offset = gguf_get_data_offset(ctx);
-    const size_t total_size = st.st_size - data_offset;
-    uint8_t * data_base = (uint8_t *)mmap_addr + data_offset;
+    return true;
+}
+
+bool TextDecoder::load_tensor_data(const std::shared_ptr<ModelFile> & file, struct gguf_context * ctx,
+                                   const std::vector<ggml_backend_dev_t> & devs) {
+    model_.file = file;
     
     const int64_t n_tensors = gguf_get_n_tensors(ctx);
-    size_t max_tensor_size = 0;
-    for (int64_t i = 0; i < n_tensors; ++i) {
-        size_t sz = gguf_get_tensor_size(ctx, i);
-        if (sz > max_tensor_size) max_tensor_size = sz;
-    }
-
-    // Try GPU device buffer (zero-copy on Apple Silicon unified memory)
-    ggml_backend_dev_t gpu_dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_GPU);
-    if (gpu_dev) {
-        model_.buffer = ggml_backend_dev_buffer_from_host_ptr(gpu_dev, data_base, total_size, max_tensor_size);
-    }
-    if (!model_.buffer) {
-        model_.buffer = ggml_backend_cpu_buffer_from_ptr(data_base, total_size);
-    }
-    if (!model_.buffer) {
-        error_msg_ = "Failed to create buffer from mmap";
-        munmap(mmap_addr, st.st_size);
-        model_.mmap_addr = nullptr;
-        model_.mmap_size = 0;
-        return false;
-    }
     
+    // Group the tensors by device: layer tensors follow their layer, the
+    // embeddings and output norm stay on the first device
+    const size_t n_groups = devs.empty() ? 1 : devs.size();
+    std::vector<std::vector<struct ggml_tensor *>> tensors(n_groups);
+    std::vector<std::vector<size_t>> offsets(n_groups);
     for (int64_t i = 0; i < n_tensors; ++i) {
         const char * name = gguf_get_tensor_name(ctx, i);
-        size_t offset = gguf_get_tensor_offset(ctx, i);
         
         auto it = model_.tensors.find(name);
         if (it == model_.tensors.end()) continue;
         
-        struct ggml_tensor * tensor = it->second;
-        tensor->buffer = model_.buffer;
-        tensor->data = data_base + offset;
+        int layer_idx = -1;
+        size_t group = 0;
+        if (sscanf(name, "blk.%d.", &layer_idx) == 1 &&
+            layer_idx >= 0 && layer_idx < (int)state_.layer_device.size()) {
+            group = state_.layer_device[layer_idx];
+        }
+        tensors[group].push_back(it->second);
+        offsets[group].push_back(gguf_get_tensor_offset(ctx, i));
+    }
+    
+    for (size_t g = 0; g < n_groups; ++g) {
+        ggml_backend_dev_t dev = devs.empty() ? nullptr : devs[g];
+        ggml_backend_buffer_t buffer = map_weights(dev, file->get_data(), file->get_data_size(),
+                                                   file->get_max_tensor_size(), tensors[g], offsets[g]);
+        if (!buffer) {
+            error_msg_ = "Failed to create buffer from mmap";
+            return false;
+        }
+        if (g == 0) {
+            model_.buffer = buffer;
+        } else {
+            model_.split_buffers.push_back(buffer);
+        }
+    }
+    
+    return true;
+}
+
+bool TextDecoder::repack_weights(const std::string & model_path, bool use_cache) {
+    // The embedding rows are gathered with get_rows, so a tied LM head stays
+    std::vector<struct ggml_tensor *> tensors;
+    if (model_.output != model_.token_embd) {
+        tensors.push_back(model_.output);
+    }
+    for (const auto & layer : model_.layers) {
+        for (struct ggml_tensor * t : { layer.attn_q, layer.attn_k, layer.attn_v, layer.attn_qkv, layer.attn_output,
+                                        layer.ffn_gate, layer.ffn_up, layer.ffn_gate_up, layer.ffn_down }) {
+            tensors.push_back(t);
+        }
     }
     
+    repack_stats stats;
+    const std::string cache_path = use_cache ? repack_cache_path(model_path, "decoder") : std::string();
+    if (!repack_cpu_weights(tensors, model_path, cache_path, model_.repack_buffers, stats, error_msg_)) {
+        return false;
+    }
+    if (stats.n_tensors > 0) {
+        fprintf(stderr, "Decoder: %zu weights (%.1f MiB) repacked for the CPU%s\n", stats.n_tensors,
+                stats.bytes / (1024.0 * 1024.0), stats.from_cache ? " (cached)" : "");
+    }
     return true;
 }
 
-bool TextDecoder::init_kv_cache(int32_t n_ctx) {
+bool TextDecoder::init_kv_cache(int32_t n_ctx, int32_t n_seq, enum ggml_type type) {
     const auto & cfg = model_.config;
     
+    invalidate_decode_graph();
     free_kv_cache(state_.cache);
     
+    if (n_seq < 1) {
+        n_seq = 1;
+    }
+    
+    if (type != GGML_TYPE_F16 && type != GGML_TYPE_Q8_0 && type != GGML_TYPE_Q4_0) {
+        error_msg_ = std::string("Unsupported KV cache type: ") + ggml_type_name(type);
+        return false;
+    }
+    if (cfg.head_dim % ggml_blck_size(type) != 0) {
+        error_msg_ = std::string("KV cache type ") + ggml_type_name(type) +
+                     " needs head_dim to be a multiple of " + std::to_string(ggml_blck_size(type));
+        return false;
+    }
+    
     state_.cache.n_ctx = n_ctx;
-    state_.cache.n_used = 0;
+    state_.cache.n_seq = n_seq;
+    state_.cache.n_rows = (int64_t)n_ctx * n_seq;
+    state_.cache.type = type;
+    state_.cache.seq_used.assign(n_seq, 0);
     state_.cache.head_dim = cfg.head_dim;
     state_.cache.n_kv_heads = cfg.n_key_value_heads;
     state_.cache.n_layers = cfg.n_decoder_layers;
@@ -363,321 +508,1106 @@ bool TextDecoder::init_kv_cache(int32_t n_ctx) {
     
     for (int il = 0; il < cfg.n_decoder_layers; ++il) {
         state_.cache.k_cache[il] = ggml_new_tensor_3d(
-            state_.cache.ctx, GGML_TYPE_F16,
-            cfg.head_dim, cfg.n_key_value_heads, n_ctx);
+            state_.cache.ctx, type,
+            cfg.head_dim, cfg.n_key_value_heads, (int64_t)n_ctx * n_seq);
         ggml_format_name(state_.cache.k_cache[il], "k_cache_%d", il);
         
         state_.cache.v_cache[il] = ggml_new_tensor_3d(
-            state_.cache.ctx, GGML_TYPE_F16,
-            cfg.head_dim, cfg.n_key_value_heads, n_ctx);
+            state_.cache.ctx, type,
+            cfg.head_dim, cfg.n_key_value_heads, (int64_t)n_ctx * n_seq);
         ggml_format_name(state_.cache.v_cache[il], "v_cache_%d", il);
     }
     
-    ggml_backend_t kv_backend = state_.backend_gpu ? state_.backend_gpu : state_.backend_cpu;
-    state_.cache.buffer = ggml_backend_alloc_ctx_tensors(state_.cache.ctx, kv_backend);
-    if (!state_.cache.buffer) {
-        error_msg_ = "Failed to allocate KV cache buffer";
-        return false;
+    // Each layer's cache lives on the device of its weights
+    std::vector<std::vector<struct ggml_tensor *>> groups(1 + state_.backend_split.size());
+    for (int il = 0; il < cfg.n_decoder_layers; ++il) {
+        const size_t d = il < (int)state_.layer_device.size() ? state_.layer_device[il] : 0;
+        groups[d].push_back(state_.cache.k_cache[il]);
+        groups[d].push_back(state_.cache.v_cache[il]);
+    }
+    
+    for (size_t d = 0; d < groups.size(); ++d) {
+        ggml_backend_t kv_backend = d > 0 ? state_.backend_split[d - 1] :
+                                    state_.backend_gpu ? state_.backend_gpu : state_.backend_cpu;
+        ggml_backend_buffer_t buffer = alloc_tensor_buffer(ggml_backend_get_default_buffer_type(kv_backend), groups[d]);
+        if (!buffer) {
+            error_msg_ = "Failed to allocate KV cache buffer";
+            return false;
+        }
+        // Entries past n_past are masked, but must not hold NaN bit patterns
+        ggml_backend_buffer_clear(buffer, 0);
+        if (d == 0) {
+            state_.cache.buffer = buffer;
+        } else {
+            state_.cache.split_buffers.push_back(buffer);
+        }
     }
     
     return true;
 }
 
-void TextDecoder::clear_kv_cache() {
-    state_.cache.n_used = 0;
-}
-
-struct ggml_cgraph * TextDecoder::build_graph(
-    const int32_t * tokens, int32_t n_tokens, int32_t n_past,
-    const float * audio_embd, int32_t n_audio, int32_t audio_start_pos) {
-    
-    const auto & cfg = model_.config;
-    const int n_head = cfg.n_attention_heads;
-    const int n_kv_head = cfg.n_key_value_heads;
-    const int head_dim = cfg.head_dim;
-    const int hidden_size = cfg.hidden_size;
-    const float eps = cfg.rms_norm_eps;
-    const float rope_theta = cfg.rope_theta;
-    const int n_layer = cfg.n_decoder_layers;
-    
-    struct ggml_init_params params = {
-        /*.mem_size   =*/ state_.compute_meta.size(),
-        /*.mem_buffer =*/ state_.compute_meta.data(),
-        /*.no_alloc   =*/ true,
-    };
-    
-    struct ggml_context * ctx0 = ggml_init(params);
-    struct ggml_cgraph * gf = ggml_new_graph_custom(ctx0, QWEN3_ASR_MAX_NODES, false);
-    
-    struct ggml_tensor * inp_tokens = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
-    ggml_set_name(inp_tokens, "inp_tokens");
-    ggml_set_input(inp_tokens);
-    
-    struct ggml_tensor * inp_pos = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
-    ggml_set_name(inp_pos, "inp_pos");
-    ggml_set_input(inp_pos);
+bool TextDecoder::reserve_kv_cache(int32_t n_ctx, int32_t n_seq, enum ggml_type type) {
+    auto & cache = state_.cache;
     
-    struct ggml_tensor * inp_audio = nullptr;
-    if (audio_embd && n_audio > 0) {
-        inp_audio = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, hidden_size, n_audio);
-        ggml_set_name(inp_audio, "inp_audio");
-        ggml_set_input(inp_audio);
+    if (n_seq < 1) {
+        n_seq = 1;
     }
     
-    struct ggml_tensor * cur = ggml_get_rows(ctx0, model_.token_embd, inp_tokens);
-    
-    if (inp_audio && n_audio > 0 && audio_start_pos >= 0 && audio_start_pos + n_audio <= n_tokens) {
-        struct ggml_tensor * embd_before = nullptr;
-        struct ggml_tensor * embd_after = nullptr;
-        
-        if (audio_start_pos > 0) {
-            embd_before = ggml_view_2d(ctx0, cur, hidden_size, audio_start_pos,
-                                       cur->nb[1], 0);
-        }
-        
-        if (audio_start_pos + n_audio < n_tokens) {
-            int after_start = audio_start_pos + n_audio;
-            int after_len = n_tokens - after_start;
-            embd_after = ggml_view_2d(ctx0, cur, hidden_size, after_len,
-                                      cur->nb[1], after_start * cur->nb[1]);
-        }
-        
-        if (embd_before && embd_after) {
-            struct ggml_tensor * tmp = ggml_concat(ctx0, embd_before, inp_audio, 1);
-            cur = ggml_concat(ctx0, tmp, embd_after, 1);
-        } else if (embd_before) {
-            cur = ggml_concat(ctx0, embd_before, inp_audio, 1);
-        } else if (embd_after) {
-            cur = ggml_concat(ctx0, inp_audio, embd_after, 1);
-        } else {
-            cur = inp_audio;
-        }
-        ggml_set_name(cur, "embd_with_audio");
-        ggml_set_output(cur);
+    if (cache.paged) {
+        end_paged();
     }
     
-    struct ggml_tensor * inpL = cur;
-    
-    const float KQscale = 1.0f / sqrtf(float(head_dim));
-    
-    // Flash attention causal mask: [n_kv, n_tokens], F16
-    int n_kv = n_past + n_tokens;
-    struct ggml_tensor * fa_mask = ggml_new_tensor_2d(ctx0, GGML_TYPE_F16, n_kv, n_tokens);
-    ggml_set_name(fa_mask, "fa_mask");
-    ggml_set_input(fa_mask);
+    if (!cache.buffer || type != cache.type || (int64_t)n_ctx * n_seq > cache.n_rows) {
+        return init_kv_cache(GGML_PAD(n_ctx, QWEN3_ASR_KV_BUCKET), n_seq, type);
+    }
     
-    for (int il = 0; il < n_layer; ++il) {
-        const auto & layer = model_.layers[il];
-        
-        if (!layer.attn_norm || !layer.attn_q || !layer.attn_k || !layer.attn_v || 
-            !layer.attn_output || !layer.ffn_norm || !layer.ffn_gate || 
-            !layer.ffn_up || !layer.ffn_down) {
-            return nullptr;
-        }
-        
-        cur = ggml_rms_norm(ctx0, inpL, eps);
-        cur = ggml_mul(ctx0, cur, layer.attn_norm);
-        
-        struct ggml_tensor * Qcur = ggml_mul_mat(ctx0, layer.attn_q, cur);
-        struct ggml_tensor * Kcur = ggml_mul_mat(ctx0, layer.attn_k, cur);
-        struct ggml_tensor * Vcur = ggml_mul_mat(ctx0, layer.attn_v, cur);
-        
-        Qcur = ggml_reshape_3d(ctx0, Qcur, head_dim, n_head, n_tokens);
-        Kcur = ggml_reshape_3d(ctx0, Kcur, head_dim, n_kv_head, n_tokens);
-        Vcur = ggml_reshape_3d(ctx0, Vcur, head_dim, n_kv_head, n_tokens);
-        
-        if (layer.attn_q_norm) {
-            Qcur = ggml_rms_norm(ctx0, Qcur, eps);
-            Qcur = ggml_mul(ctx0, Qcur, layer.attn_q_norm);
-        }
-        
-        if (layer.attn_k_norm) {
-            Kcur = ggml_rms_norm(ctx0, Kcur, eps);
-            Kcur = ggml_mul(ctx0, Kcur, layer.attn_k_norm);
-        }
-        
-        Qcur = ggml_rope_ext(ctx0, Qcur, inp_pos, nullptr,
-                             head_dim, GGML_ROPE_TYPE_NEOX, 0,
-                             rope_theta, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f);
-        
-        Kcur = ggml_rope_ext(ctx0, Kcur, inp_pos, nullptr,
-                             head_dim, GGML_ROPE_TYPE_NEOX, 0,
-                             rope_theta, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f);
-        
-        struct ggml_tensor * k_cache = state_.cache.k_cache[il];
-        struct ggml_tensor * v_cache = state_.cache.v_cache[il];
-        
-        struct ggml_tensor * k_cache_view = ggml_view_3d(ctx0, k_cache,
-            head_dim, n_kv_head, n_tokens,
-            k_cache->nb[1], k_cache->nb[2],
-            n_past * k_cache->nb[2]);
-        
-        struct ggml_tensor * v_cache_view = ggml_view_3d(ctx0, v_cache,
-            head_dim, n_kv_head, n_tokens,
-            v_cache->nb[1], v_cache->nb[2],
-            n_past * v_cache->nb[2]);
-        
-        ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcur, k_cache_view));
-        ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vcur, v_cache_view));
-        
-        struct ggml_tensor * K = ggml_view_3d(ctx0, k_cache,
-            head_dim, n_kv_head, n_kv,
-            k_cache->nb[1], k_cache->nb[2], 0);
-        
-        struct ggml_tensor * V = ggml_view_3d(ctx0, v_cache,
-            head_dim, n_kv_head, n_kv,
-            v_cache->nb[1], v_cache->nb[2], 0);
-        
-        // flash_attn_ext expects: Q[head_dim, n_tokens, n_head], K[head_dim, n_kv, n_kv_head], V[head_dim, n_kv, n_kv_head]
-        struct ggml_tensor * Qfa = ggml_permute(ctx0, Qcur, 0, 2, 1, 3);
-        K = ggml_permute(ctx0, K, 0, 2, 1, 3);
-        V = ggml_permute(ctx0, V, 0, 2, 1, 3);
-        
-        cur = ggml_flash_attn_ext(ctx0, Qfa, K, V, fa_mask, KQscale, 0.0f, 0.0f);
-        ggml_flash_attn_ext_set_prec(cur, GGML_PREC_F32);
-        cur = ggml_reshape_2d(ctx0, cur, n_head * head_dim, n_tokens);
-        
-        cur = ggml_mul_mat(ctx0, layer.attn_output, cur);
-        cur = ggml_add(ctx0, cur, inpL);
-        struct ggml_tensor * inpFF = cur;
-        
-        cur = ggml_rms_norm(ctx0, inpFF, eps);
-        cur = ggml_mul(ctx0, cur, layer.ffn_norm);
-        
-        struct ggml_tensor * gate = ggml_mul_mat(ctx0, layer.ffn_gate, cur);
-        struct ggml_tensor * up = ggml_mul_mat(ctx0, layer.ffn_up, cur);
-        
-        gate = ggml_silu(ctx0, gate);
-        
-        cur = ggml_mul(ctx0, gate, up);
-        
-        cur = ggml_mul_mat(ctx0, layer.ffn_down, cur);
-        ggml_format_name(cur, "ffn_out_%d", il);
-        
-        inpL = ggml_add(ctx0, cur, inpFF);
+    // Reuse the allocation; only the slot layout may change
+    const int32_t n_ctx_slot = (int32_t)(cache.n_rows / n_seq);
+    if (n_ctx_slot != cache.n_ctx || n_seq != cache.n_seq) {
+        invalidate_decode_graph();
+        cache.n_ctx = n_ctx_slot;
+        cache.n_seq = n_seq;
     }
+    cache.seq_used.assign(n_seq, 0);
     
-    cur = inpL;
+    return true;
+}
 
-    if (n_tokens > 1) {
-        cur = ggml_view_2d(ctx0, cur, hidden_size, 1, cur->nb[1], (n_tokens - 1) * cur->nb[1]);
-    }
+// Create views of n_rows KV rows (one row = all heads of one position) of
+// src and dst in ctx and copy between them; the copy stays on the device
+static void copy_kv_rows(struct ggml_context * ctx,
+                         struct ggml_tensor * dst, int64_t dst_row,
+                         struct ggml_tensor * src, int64_t src_row, int64_t n_rows) {
+    struct ggml_tensor * src_view = ggml_view_3d(ctx, src, src->ne[0], src->ne[1], n_rows,
+                                                 src->nb[1], src->nb[2], src_row * src->nb[2]);
+    struct ggml_tensor * dst_view = ggml_view_3d(ctx, dst, dst->ne[0], dst->ne[1], n_rows,
+                                                 dst->nb[1], dst->nb[2], dst_row * dst->nb[2]);
+    ggml_backend_view_init(src_view);
+    ggml_backend_view_init(dst_view);
+    ggml_backend_tensor_copy(src_view, dst_view);
+}
 
-    cur = ggml_rms_norm(ctx0, cur, eps);
-    cur = ggml_mul(ctx0, cur, model_.output_norm);
-    ggml_set_name(cur, "result_norm");
+bool TextDecoder::begin_paged(int32_t n_seq) {
+    auto & cache = state_.cache;
     
-    cur = ggml_mul_mat(ctx0, model_.output, cur);
-    // cur = ggml_scale_inplace(ctx0, cur, 1.0f / temperature_);
-    ggml_set_name(cur, "logits");
-    ggml_set_output(cur);
-    
-    ggml_build_forward_expand(gf, cur);
+    if (!cache.buffer || n_seq < 1 || cache.n_rows % QWEN3_ASR_KV_PAGE != 0) {
+        error_msg_ = "KV cache is not reserved for paging";
+        return false;
+    }
     
-    ggml_free(ctx0);
+    invalidate_decode_graph();
+    cache.paged = true;
+    cache.n_ctx = (int32_t)cache.n_rows;
+    cache.n_seq = n_seq;
+    cache.seq_used.assign(n_seq, 0);
+    cache.seq_pages.assign(n_seq, std::vector<int32_t>());
+    
+    const int32_t n_pages = (int32_t)(cache.n_rows / QWEN3_ASR_KV_PAGE);
+    cache.page_refs.assign(n_pages, 0);
+    cache.free_pages.resize(n_pages);
+    for (int32_t i = 0; i < n_pages; ++i) {
+        cache.free_pages[i] = n_pages - 1 - i;
+    }
     
-    return gf;
+    return true;
 }
 
-bool TextDecoder::forward(const int32_t * tokens, int32_t n_tokens, int32_t n_past,
-                          std::vector<float> & output) {
-    return forward_with_audio(tokens, n_tokens, nullptr, 0, -1, n_past, output);
+void TextDecoder::end_paged() {
+    auto & cache = state_.cache;
+    
+    invalidate_decode_graph();
+    cache.paged = false;
+    cache.seq_pages.clear();
+    cache.page_refs.clear();
+    cache.free_pages.clear();
+    
+    // Back to the single slot begin_paged() started from
+    cache.n_ctx = (int32_t)cache.n_rows;
+    cache.n_seq = 1;
+    cache.seq_used.assign(1, 0);
 }
 
-bool TextDecoder::forward_with_audio(
-    const int32_t * tokens, int32_t n_tokens,
-    const float * audio_embd, int32_t n_audio,
-    int32_t audio_start_pos, int32_t n_past,
-    std::vector<float> & output) {
-    QWEN3_TIMER("decoder.forward");
+bool TextDecoder::fork_seq(int32_t dst_seq, int32_t src_seq) {
+    auto & cache = state_.cache;
     
-    if (!model_.ctx) {
-        error_msg_ = "Model not loaded";
+    if (!cache.paged || dst_seq < 0 || dst_seq >= cache.n_seq || src_seq < 0 || src_seq >= cache.n_seq) {
+        error_msg_ = "fork_seq needs two slots of a paged KV cache";
         return false;
     }
-    
-    if (state_.cache.n_ctx == 0) {
-        if (!init_kv_cache(1024)) {
-            return false;
-        }
+    if (dst_seq == src_seq) {
+        return true;
     }
     
-    if (n_past + n_tokens > state_.cache.n_ctx) {
-        error_msg_ = "Context length exceeded";
-        return false;
+    release_pages(dst_seq, 0);
+    cache.seq_pages[dst_seq] = cache.seq_pages[src_seq];
+    for (int32_t page : cache.seq_pages[dst_seq]) {
+        ++cache.page_refs[page];
     }
+    cache.seq_used[dst_seq] = cache.seq_used[src_seq];
     
-    struct ggml_cgraph * gf = build_graph(tokens, n_tokens, n_past,
-                                          audio_embd, n_audio, audio_start_pos);
-    
-    if (!ggml_backend_sched_alloc_graph(state_.sched, gf)) {
-        error_msg_ = "Failed to allocate graph";
-        return false;
+    return true;
+}
+
+int32_t TextDecoder::get_n_pages_used() const {
+    const auto & cache = state_.cache;
+    return cache.paged ? (int32_t)(cache.page_refs.size() - cache.free_pages.size()) : 0;
+}
+
+int64_t TextDecoder::kv_row(int32_t seq_id, int32_t pos) const {
+    const auto & cache = state_.cache;
+    if (!cache.paged) {
+        return (int64_t)seq_id * cache.n_ctx + pos;
     }
-    
-    struct ggml_tensor * inp_tokens = ggml_graph_get_tensor(gf, "inp_tokens");
-    if (!inp_tokens) {
-        error_msg_ = "Failed to find inp_tokens tensor";
-        ggml_backend_sched_reset(state_.sched);
-        return false;
+    return (int64_t)cache.seq_pages[seq_id][pos / QWEN3_ASR_KV_PAGE] * QWEN3_ASR_KV_PAGE +
+           pos % QWEN3_ASR_KV_PAGE;
+}
+
+void TextDecoder::release_pages(int32_t seq_id, int32_t n_keep) {
+    auto & cache = state_.cache;
+    std::vector<int32_t> & pages = cache.seq_pages[seq_id];
+    const size_t n_keep_pages = (size_t)(n_keep + QWEN3_ASR_KV_PAGE - 1) / QWEN3_ASR_KV_PAGE;
+    while (pages.size() > n_keep_pages) {
+        const int32_t page = pages.back();
+        pages.pop_back();
+        if (--cache.page_refs[page] == 0) {
+            cache.free_pages.push_back(page);
+        }
     }
-    ggml_backend_tensor_set(inp_tokens, tokens, 0, n_tokens * sizeof(int32_t));
+}
+
+bool TextDecoder::prepare_rows(int32_t seq_id, int32_t pos_begin, int32_t pos_end) {
+    const auto & cfg = model_.config;
+    auto & cache = state_.cache;
     
-    struct ggml_tensor * inp_pos = ggml_graph_get_tensor(gf, "inp_pos");
-    if (inp_pos) {
-        std::vector<int32_t> positions(n_tokens);
-        for (int i = 0; i < n_tokens; ++i) {
-            positions[i] = n_past + i;
-        }
-        ggml_backend_tensor_set(inp_pos, positions.data(), 0, n_tokens * sizeof(int32_t));
+    if (!cache.paged || pos_end <= pos_begin) {
+        return true;
     }
     
+    std::vector<int32_t> & pages = cache.seq_pages[seq_id];
+    struct ggml_context * ctx_views = nullptr;
+    
+    for (int32_t idx = pos_begin / QWEN3_ASR_KV_PAGE; idx <= (pos_end - 1) / QWEN3_ASR_KV_PAGE; ++idx) {
+        const bool fresh = idx >= (int32_t)pages.size();
+        if (!fresh && cache.page_refs[pages[idx]] == 1) {
+            continue;
+        }
+        if (cache.free_pages.empty()) {
+            error_msg_ = "KV cache pages exhausted";
+            if (ctx_views) {
+                ggml_free(ctx_views);
+            }
+            return false;
+        }
+        const int32_t page = cache.free_pages.back();
+        cache.free_pages.pop_back();
+        cache.page_refs[page] = 1;
+        
+        if (fresh) {
+            pages.push_back(page);
+            continue;
+        }
+        
+        // Copy-on-write: the rows before pos_begin stay valid, the rest of
+        // the page is about to be overwritten
+        const int32_t n_valid = std::min(std::max(pos_begin - idx * QWEN3_ASR_KV_PAGE, 0), QWEN3_ASR_KV_PAGE);
+        if (n_valid > 0) {
+            if (!ctx_views) {
+                struct ggml_init_params params = {
+                    /*.mem_size   =*/ (size_t)cfg.n_decoder_layers * 4 * ggml_tensor_overhead(),
+                    /*.mem_buffer =*/ nullptr,
+                    /*.no_alloc   =*/ true,
+                };
+                ctx_views = ggml_init(params);
+            } else {
+                ggml_reset(ctx_views);
+            }
+            for (int il = 0; il < cfg.n_decoder_layers; ++il) {
+                copy_kv_rows(ctx_views, cache.k_cache[il], (int64_t)page * QWEN3_ASR_KV_PAGE,
+                             cache.k_cache[il], (int64_t)pages[idx] * QWEN3_ASR_KV_PAGE, n_valid);
+                copy_kv_rows(ctx_views, cache.v_cache[il], (int64_t)page * QWEN3_ASR_KV_PAGE,
+                             cache.v_cache[il], (int64_t)pages[idx] * QWEN3_ASR_KV_PAGE, n_valid);
+            }
+        }
+        --cache.page_refs[pages[idx]];
+        pages[idx] = page;
+    }
+    
+    if (ctx_views) {
+        ggml_free(ctx_views);
+    }
+    return true;
+}
+
+bool TextDecoder::save_prefix(const int32_t * tokens, int32_t n_tokens, int32_t seq_id) {
+    const auto & cfg = model_.config;
+    auto & cache = state_.cache;
+    
+    if (!cache.buffer || seq_id < 0 || seq_id >= cache.n_seq ||
+        n_tokens <= 0 || n_tokens > cache.seq_used[seq_id]) {
+        error_msg_ = "Prefix is not in the KV cache";
+        return false;
+    }
+    
+    for (auto & snap : state_.snapshots) {
+        if (snap.type == cache.type && (int32_t)snap.tokens.size() == n_tokens &&
+            std::equal(snap.tokens.begin(), snap.tokens.end(), tokens)) {
+            snap.last_used = ++state_.snapshot_clock;
+            return true;
+        }
+    }
+    
+    if (state_.snapshots.size() >= QWEN3_ASR_MAX_SNAPSHOTS) {
+        auto lru = std::min_element(state_.snapshots.begin(), state_.snapshots.end(),
+            [](const kv_snapshot & a, const kv_snapshot & b) { return a.last_used < b.last_used; });
+        free_kv_snapshot(*lru);
+        state_.snapshots.erase(lru);
+    }
+    
+    kv_snapshot snap;
+    snap.tokens.assign(tokens, tokens + n_tokens);
+    snap.type = cache.type;
+    
+    // Tensors for the snapshot plus views for the copy
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ (size_t)cfg.n_decoder_layers * 2 * ggml_tensor_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+    snap.ctx = ggml_init(params);
+    params.mem_size = (size_t)cfg.n_decoder_layers * 4 * ggml_tensor_overhead();
+    struct ggml_context * ctx_views = ggml_init(params);
+    if (!snap.ctx || !ctx_views) {
+        error_msg_ = "Failed to create KV snapshot context";
+        free_kv_snapshot(snap);
+        if (ctx_views) {
+            ggml_free(ctx_views);
+        }
+        return false;
+    }
+    
+    snap.k.resize(cfg.n_decoder_layers);
+    snap.v.resize(cfg.n_decoder_layers);
+    for (int il = 0; il < cfg.n_decoder_layers; ++il) {
+        snap.k[il] = ggml_new_tensor_3d(snap.ctx, cache.type, cfg.head_dim, cfg.n_key_value_heads, n_tokens);
+        snap.v[il] = ggml_new_tensor_3d(snap.ctx, cache.type, cfg.head_dim, cfg.n_key_value_heads, n_tokens);
+    }
+    
+    ggml_backend_t kv_backend = state_.backend_gpu ? state_.backend_gpu : state_.backend_cpu;
+    snap.buffer = ggml_backend_alloc_ctx_tensors(snap.ctx, kv_backend);
+    if (!snap.buffer) {
+        error_msg_ = "Failed to allocate KV snapshot buffer";
+        free_kv_snapshot(snap);
+        ggml_free(ctx_views);
+        return false;
+    }
+    
+    // Slots are contiguous; paged slots are copied a page at a time
+    const int32_t run = cache.paged ? QWEN3_ASR_KV_PAGE : n_tokens;
+    for (int32_t pos = 0; pos < n_tokens; pos += run) {
+        const int32_t n = std::min(run, n_tokens - pos);
+        const int64_t row = kv_row(seq_id, pos);
+        ggml_reset(ctx_views);
+        for (int il = 0; il < cfg.n_decoder_layers; ++il) {
+            copy_kv_rows(ctx_views, snap.k[il], pos, cache.k_cache[il], row, n);
+            copy_kv_rows(ctx_views, snap.v[il], pos, cache.v_cache[il], row, n);
+        }
+    }
+    ggml_free(ctx_views);
+    
+    snap.last_used = ++state_.snapshot_clock;
+    state_.snapshots.push_back(std::move(snap));
+    
+    return true;
+}
+
+int32_t TextDecoder::restore_prefix(const int32_t * tokens, int32_t n_tokens, int32_t seq_id) {
+    const auto & cfg = model_.config;
+    auto & cache = state_.cache;
+    
+    if (!cache.buffer || seq_id < 0 || seq_id >= cache.n_seq) {
+        return 0;
+    }
+    
+    // Any common prefix is usable: causal attention makes the KV of the first
+    // n tokens independent of what follows them
+    kv_snapshot * best = nullptr;
+    int32_t n_best = 0;
+    for (auto & snap : state_.snapshots) {
+        if (snap.type != cache.type) {
+            continue;
+        }
+        const int32_t n_max = std::min<int32_t>(n_tokens, snap.tokens.size());
+        int32_t n = 0;
+        while (n < n_max && snap.tokens[n] == tokens[n]) {
+            ++n;
+        }
+        if (n > n_best) {
+            best = &snap;
+            n_best = n;
+        }
+    }
+    
+    // Leave at least one token for the caller's prefill to produce logits
+    n_best = std::min({n_best, n_tokens - 1, cache.n_ctx});
+    if (!best || n_best <= 0) {
+        return 0;
+    }
+    
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ (size_t)cfg.n_decoder_layers * 4 * ggml_tensor_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+    struct ggml_context * ctx_views = ggml_init(params);
+    if (!ctx_views) {
+        return 0;
+    }
+    
+    if (cache.paged) {
+        release_pages(seq_id, 0);
+        if (!prepare_rows(seq_id, 0, n_best)) {
+            ggml_free(ctx_views);
+            return 0;
+        }
+    }
+    
+    const int32_t run = cache.paged ? QWEN3_ASR_KV_PAGE : n_best;
+    for (int32_t pos = 0; pos < n_best; pos += run) {
+        const int32_t n = std::min(run, n_best - pos);
+        const int64_t row = kv_row(seq_id, pos);
+        ggml_reset(ctx_views);
+        for (int il = 0; il < cfg.n_decoder_layers; ++il) {
+            copy_kv_rows(ctx_views, cache.k_cache[il], row, best->k[il], pos, n);
+            copy_kv_rows(ctx_views, cache.v_cache[il], row, best->v[il], pos, n);
+        }
+    }
+    ggml_free(ctx_views);
+    
+    cache.seq_used[seq_id] = n_best;
+    best->last_used = ++state_.snapshot_clock;
+    
+    return n_best;
+}
+
+void TextDecoder::clear_prefix_snapshots() {
+    for (auto & snap : state_.snapshots) {
+        free_kv_snapshot(snap);
+    }
+    state_.snapshots.clear();
+}
+
+size_t TextDecoder::get_kv_cache_bytes() const {
+    size_t bytes = state_.cache.buffer ? ggml_backend_buffer_get_size(state_.cache.buffer) : 0;
+    for (ggml_backend_buffer_t buffer : state_.cache.split_buffers) {
+        bytes += ggml_backend_buffer_get_size(buffer);
+    }
+    return bytes;
+}
+
+bool TextDecoder::reserve_compute(int32_t n_tokens, int32_t n_audio) {
+    if (!model_.ctx) {
+        error_msg_ = "Model not loaded";
+        return false;
+    }
+    
+    if (state_.cache.n_ctx * state_.cache.n_seq < n_tokens &&
+        !reserve_kv_cache(n_tokens, 1, state_.cache.n_ctx > 0 ? state_.cache.type : GGML_TYPE_F16)) {
+        return false;
+    }
+    
+    auto lock = lock_arena(state_.arena);
+    
+    decoder_graph_shape shape;
+    shape.n_tokens = n_tokens;
+    shape.n_kv = n_tokens;
+    if (n_audio > 0 && n_audio <= n_tokens) {
+        shape.n_audio = n_audio;
+        shape.audio_start_pos = 0;
+        shape.audio_type = audio_type_;
+    }
+    
+    struct ggml_cgraph * gf = build_graph(shape, compute_meta());
+    if (!gf || !ggml_backend_sched_reserve(state_.sched, gf)) {
+        error_msg_ = "Failed to reserve prompt graph";
+        return false;
+    }
+    
+    return true;
+}
+
+memory_usage TextDecoder::get_memory_usage() const {
+    memory_usage mem;
+    mem.weights = ctx_tensor_bytes(model_.ctx);
+    mem.kv_cache = get_kv_cache_bytes();
+    for (const kv_snapshot & snap : state_.snapshots) {
+        mem.kv_cache += buffer_bytes(snap.buffer);
+    }
+    add_sched_bytes(state_.sched_decode, mem);
+    if (!state_.arena) {
+        add_sched_bytes(state_.sched, mem);
+    }
+    return mem;
+}
+
+void TextDecoder::invalidate_decode_graph() {
+    if (state_.decode_graph) {
+        ggml_backend_sched_reset(state_.sched_decode);
+    }
+    state_.decode_graph = nullptr;
+    state_.decode_shape = decoder_graph_shape();
+}
+
+void TextDecoder::clear_kv_cache() {
+    std::fill(state_.cache.seq_used.begin(), state_.cache.seq_used.end(), 0);
+    if (state_.cache.paged) {
+        for (int32_t s = 0; s < state_.cache.n_seq; ++s) {
+            release_pages(s, 0);
+        }
+    }
+}
+
+void TextDecoder::clear_seq(int32_t seq_id) {
+    if (seq_id >= 0 && seq_id < (int32_t)state_.cache.seq_used.size()) {
+        state_.cache.seq_used[seq_id] = 0;
+        if (state_.cache.paged) {
+            release_pages(seq_id, 0);
+        }
+    }
+}
+
+void TextDecoder::truncate_seq(int32_t seq_id, int32_t n_past) {
+    if (seq_id >= 0 && seq_id < (int32_t)state_.cache.seq_used.size()) {
+        state_.cache.seq_used[seq_id] = std::min(state_.cache.seq_used[seq_id], std::max(n_past, 0));
+        if (state_.cache.paged) {
+            release_pages(seq_id, state_.cache.seq_used[seq_id]);
+        }
+    }
+}
+
+static qkv_weights decoder_qkv_weights(const decoder_layer & layer) {
+    qkv_weights w;
+    w.qkv_w = layer.attn_qkv;
+    w.q_w = layer.attn_q;
+    w.k_w = layer.attn_k;
+    w.v_w = layer.attn_v;
+    return w;
+}
+
+struct ggml_cgraph * TextDecoder::build_graph(const decoder_graph_shape & shape,
+                                              std::vector<uint8_t> & meta) {
+    
+    const auto & cfg = model_.config;
+    const int n_head = cfg.n_attention_heads;
+    const int n_kv_head = cfg.n_key_value_heads;
+    const int head_dim = cfg.head_dim;
+    const int hidden_size = cfg.hidden_size;
+    const float eps = cfg.rms_norm_eps;
+    const float rope_theta = cfg.rope_theta;
+    const int n_layer = cfg.n_decoder_layers;
+    
+    const int n_tokens = shape.n_tokens;
+    const int n_kv = shape.n_kv;
+    const int n_audio = shape.n_audio;
+    
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ meta.size(),
+        /*.mem_buffer =*/ meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+    
+    struct ggml_context * ctx0 = ggml_init(params);
+    struct ggml_cgraph * gf = ggml_new_graph_custom(ctx0, QWEN3_ASR_MAX_NODES, false);
+    
+    struct ggml_tensor * inp_pos = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
+    ggml_set_name(inp_pos, "inp_pos");
+    ggml_set_input(inp_pos);
+    
+    // KV cache rows written by this step (slot * n_ctx + position per token)
+    struct ggml_tensor * inp_kv_idx = ggml_new_tensor_1d(ctx0, GGML_TYPE_I64, n_tokens);
+    ggml_set_name(inp_kv_idx, "inp_kv_idx");
+    ggml_set_input(inp_kv_idx);
+    
+    // Prompt with audio: text and audio rows are scattered into one tensor
+    struct ggml_tensor * cur = nullptr;
+    if (n_audio > 0) {
+        struct ggml_tensor * inp_audio = nullptr;
+        if (shape.audio_device) {
+            inp_audio = ggml_view_2d(ctx0, state_.audio_src, hidden_size, n_audio, state_.audio_src->nb[1], 0);
+        } else {
+            inp_audio = ggml_new_tensor_2d(ctx0, shape.audio_type, hidden_size, n_audio);
+            ggml_set_name(inp_audio, "inp_audio");
+            ggml_set_input(inp_audio);
+        }
+        cur = build_injected_embeddings(ctx0, model_.token_embd, inp_audio, n_tokens, n_tokens - n_audio);
+        ggml_set_name(cur, "embd_with_audio");
+        ggml_set_output(cur);
+    } else {
+        struct ggml_tensor * inp_tokens = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
+        ggml_set_name(inp_tokens, "inp_tokens");
+        ggml_set_input(inp_tokens);
+        cur = ggml_get_rows(ctx0, model_.token_embd, inp_tokens);
+    }
+    
+    struct ggml_tensor * inpL = cur;
+    
+    const float KQscale = 1.0f / sqrtf(float(head_dim));
+    
+    // Per-sequence attention: the n_kv rows each sequence sees, gathered
+    // from the cache after this step's rows are written
+    const int n_gather = shape.n_gather;
+    struct ggml_tensor * inp_kv_rows = nullptr;
+    if (n_gather > 0) {
+        inp_kv_rows = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, (int64_t)n_kv * n_gather);
+        ggml_set_name(inp_kv_rows, "inp_kv_rows");
+        ggml_set_input(inp_kv_rows);
+    }
+    
+    // Flash attention causal mask: [n_kv, n_tokens], F16; one
+    // [n_kv, n_tokens / n_gather] matrix per sequence when gathering
+    struct ggml_tensor * fa_mask = n_gather > 0 ?
+        ggml_new_tensor_4d(ctx0, GGML_TYPE_F16, n_kv, n_tokens / n_gather, 1, n_gather) :
+        ggml_new_tensor_2d(ctx0, GGML_TYPE_F16, n_kv, n_tokens);
+    ggml_set_name(fa_mask, "fa_mask");
+    ggml_set_input(fa_mask);
+    
+    for (int il = 0; il < n_layer; ++il) {
+        const auto & layer = model_.layers[il];
+        
+        const qkv_weights qkv_w = decoder_qkv_weights(layer);
+        if (!layer.attn_norm || !qkv_w.complete() || !layer.attn_output || !layer.ffn_norm ||
+            !(layer.ffn_gate_up || (layer.ffn_gate && layer.ffn_up)) || !layer.ffn_down) {
+            return nullptr;
+        }
+        
+        cur = ggml_rms_norm(ctx0, inpL, eps);
+        cur = ggml_mul(ctx0, cur, layer.attn_norm);
+        
+        const qkv_proj qkv = build_qkv(ctx0, cur, qkv_w, head_dim, n_head, n_kv_head);
+        struct ggml_tensor * Qcur = qkv.q;
+        struct ggml_tensor * Kcur = qkv.k;
+        struct ggml_tensor * Vcur = qkv.v;
+        
+        if (layer.attn_q_norm) {
+            Qcur = ggml_rms_norm(ctx0, Qcur, eps);
+            Qcur = ggml_mul(ctx0, Qcur, layer.attn_q_norm);
+        }
+        
+        if (layer.attn_k_norm) {
+            Kcur = ggml_rms_norm(ctx0, Kcur, eps);
+            Kcur = ggml_mul(ctx0, Kcur, layer.attn_k_norm);
+        }
+        
+        Qcur = ggml_rope_ext(ctx0, Qcur, inp_pos, nullptr,
+                             head_dim, GGML_ROPE_TYPE_NEOX, 0,
+                             rope_theta, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f);
+        
+        Kcur = ggml_rope_ext(ctx0, Kcur, inp_pos, nullptr,
+                             head_dim, GGML_ROPE_TYPE_NEOX, 0,
+                             rope_theta, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f);
+        
+        struct ggml_tensor * k_cache = state_.cache.k_cache[il];
+        struct ggml_tensor * v_cache = state_.cache.v_cache[il];
+        
+        struct ggml_tensor * k_rows = ggml_reshape_2d(ctx0, k_cache, head_dim * n_kv_head, k_cache->ne[2]);
+        struct ggml_tensor * v_rows = ggml_reshape_2d(ctx0, v_cache, head_dim * n_kv_head, v_cache->ne[2]);
+        
+        struct ggml_tensor * k_written = ggml_set_rows(ctx0, k_rows,
+            ggml_reshape_2d(ctx0, Kcur, head_dim * n_kv_head, n_tokens), inp_kv_idx);
+        struct ggml_tensor * v_written = ggml_set_rows(ctx0, v_rows,
+            ggml_view_2d(ctx0, Vcur, head_dim * n_kv_head, n_tokens, Vcur->nb[2], 0), inp_kv_idx);
+        ggml_build_forward_expand(gf, k_written);
+        ggml_build_forward_expand(gf, v_written);
+        
+        struct ggml_tensor * K = nullptr;
+        struct ggml_tensor * V = nullptr;
+        struct ggml_tensor * Qfa = nullptr;
+        if (inp_kv_rows) {
+            // Rows of each sequence side by side in dim 3, so attention
+            // costs n_kv per sequence whatever slots or pages they live in.
+            // get_rows widens to F32; F16 is what every backend's flash
+            // attention reads.
+            K = ggml_cast(ctx0, ggml_get_rows(ctx0, k_written, inp_kv_rows), GGML_TYPE_F16);
+            V = ggml_cast(ctx0, ggml_get_rows(ctx0, v_written, inp_kv_rows), GGML_TYPE_F16);
+            K = ggml_reshape_4d(ctx0, K, head_dim, n_kv_head, n_kv, n_gather);
+            V = ggml_reshape_4d(ctx0, V, head_dim, n_kv_head, n_kv, n_gather);
+            Qfa = ggml_permute(ctx0, ggml_reshape_4d(ctx0, Qcur, head_dim, n_head, n_tokens / n_gather, n_gather),
+                               0, 2, 1, 3);
+        } else {
+            K = ggml_view_3d(ctx0, k_cache,
+                head_dim, n_kv_head, n_kv,
+                k_cache->nb[1], k_cache->nb[2], (size_t)shape.kv_start * k_cache->nb[2]);
+            V = ggml_view_3d(ctx0, v_cache,
+                head_dim, n_kv_head, n_kv,
+                v_cache->nb[1], v_cache->nb[2], (size_t)shape.kv_start * v_cache->nb[2]);
+            Qfa = ggml_permute(ctx0, Qcur, 0, 2, 1, 3);
+        }
+        
+        // flash_attn_ext expects: Q[head_dim, n_tokens, n_head], K[head_dim, n_kv, n_kv_head], V[head_dim, n_kv, n_kv_head]
+        K = ggml_permute(ctx0, K, 0, 2, 1, 3);
+        V = ggml_permute(ctx0, V, 0, 2, 1, 3);
+        
+        cur = ggml_flash_attn_ext(ctx0, Qfa, K, V, fa_mask, KQscale, 0.0f, 0.0f);
+        ggml_flash_attn_ext_set_prec(cur, GGML_PREC_F32);
+        cur = ggml_reshape_2d(ctx0, cur, n_head * head_dim, n_tokens);
+        
+        cur = ggml_mul_mat(ctx0, layer.attn_output, cur);
+        cur = ggml_add(ctx0, cur, inpL);
+        struct ggml_tensor * inpFF = cur;
+        
+        cur = ggml_rms_norm(ctx0, inpFF, eps);
+        cur = ggml_mul(ctx0, cur, layer.ffn_norm);
+        
+        cur = build_swiglu_in(ctx0, cur, layer.ffn_gate_up, layer.ffn_gate, layer.ffn_up);
+        
+        cur = ggml_mul_mat(ctx0, layer.ffn_down, cur);
+        ggml_format_name(cur, "ffn_out_%d", il);
+        
+        inpL = ggml_add(ctx0, cur, inpFF);
+    }
+    
+    cur = inpL;
+
+    if (n_tokens > 1 && !shape.all_logits) {
+        cur = ggml_view_2d(ctx0, cur, hidden_size, 1, cur->nb[1], (n_tokens - 1) * cur->nb[1]);
+    }
+
+    cur = ggml_rms_norm(ctx0, cur, eps);
+    cur = ggml_mul(ctx0, cur, model_.output_norm);
+    ggml_set_name(cur, "result_norm");
+    
+    cur = ggml_mul_mat(ctx0, model_.output, cur);
+    // cur = ggml_scale_inplace(ctx0, cur, 1.0f / temperature_);
+    ggml_set_name(cur, "logits");
+    ggml_set_output(cur);
+    
+    ggml_build_forward_expand(gf, cur);
+    
+    struct ggml_tensor * best = ggml_argmax(ctx0, cur);
+    ggml_set_name(best, "logits_argmax");
+    ggml_set_output(best);
+    ggml_build_forward_expand(gf, best);
+    
+    if (shape.n_top_k > 0) {
+        const int64_t n_rows = cur->ne[1];
+        struct ggml_tensor * top_idx = ggml_cont(ctx0, ggml_top_k(ctx0, cur, shape.n_top_k));
+        ggml_set_name(top_idx, "top_k_idx");
+        ggml_set_output(top_idx);
+        ggml_build_forward_expand(gf, top_idx);
+        
+        struct ggml_tensor * top_val = ggml_get_rows(ctx0,
+            ggml_reshape_3d(ctx0, cur, 1, cur->ne[0], n_rows), top_idx);
+        ggml_set_name(top_val, "top_k_logits");
+        ggml_set_output(top_val);
+        ggml_build_forward_expand(gf, top_val);
+        
+        // Probabilities of the same entries, for log-prob scoring (beam
+        // search); a softmax over the whole vocab, so only when asked for
+        if (shape.top_k_probs) {
+            struct ggml_tensor * probs = ggml_soft_max(ctx0, cur);
+            struct ggml_tensor * top_prob = ggml_get_rows(ctx0,
+                ggml_reshape_3d(ctx0, probs, 1, probs->ne[0], n_rows), top_idx);
+            ggml_set_name(top_prob, "top_k_probs");
+            ggml_set_output(top_prob);
+            ggml_build_forward_expand(gf, top_prob);
+        }
+    }
+    
+    ggml_free(ctx0);
+    
+    return gf;
+}
+
+void TextDecoder::set_graph_inputs(struct ggml_cgraph * gf, const decoder_graph_shape & shape,
+                                   const int32_t * tokens, const int32_t * seq_ids,
+                                   const int32_t * pos) {
+    const int n_tokens = shape.n_tokens;
+    const int n_kv = shape.n_kv;
+    const int32_t n_ctx = state_.cache.n_ctx;
+    
+    if (shape.n_audio > 0) {
+        injection_layout layout;
+        make_injection_layout(tokens, n_tokens, shape.audio_start_pos, shape.n_audio, layout);
+        set_injection_inputs(gf, layout);
+    } else {
+        struct ggml_tensor * inp_tokens = ggml_graph_get_tensor(gf, "inp_tokens");
+        ggml_backend_tensor_set(inp_tokens, tokens, 0, n_tokens * sizeof(int32_t));
+    }
+    
+    struct ggml_tensor * inp_pos = ggml_graph_get_tensor(gf, "inp_pos");
+    ggml_backend_tensor_set(inp_pos, pos, 0, n_tokens * sizeof(int32_t));
+    
+    struct ggml_tensor * inp_kv_idx = ggml_graph_get_tensor(gf, "inp_kv_idx");
+    std::vector<int64_t> kv_idx(n_tokens);
+    for (int q = 0; q < n_tokens; ++q) {
+        kv_idx[q] = kv_row(seq_ids[q], pos[q]);
+    }
+    ggml_backend_tensor_set(inp_kv_idx, kv_idx.data(), 0, n_tokens * sizeof(int64_t));
+    
+    // Token q sees the rows of its own slot up to and including its position
     struct ggml_tensor * fa_mask_t = ggml_graph_get_tensor(gf, "fa_mask");
-    if (fa_mask_t) {
-        int n_kv = n_past + n_tokens;
-        std::vector<ggml_fp16_t> mask_data((size_t)n_kv * n_tokens);
-        const ggml_fp16_t zero_f16 = ggml_fp32_to_fp16(0.0f);
-        const ggml_fp16_t neginf_f16 = ggml_fp32_to_fp16(-INFINITY);
+    std::vector<ggml_fp16_t> & mask_data = state_.mask_host;
+    const ggml_fp16_t zero_f16 = ggml_fp32_to_fp16(0.0f);
+    const ggml_fp16_t neginf_f16 = ggml_fp32_to_fp16(-INFINITY);
+    mask_data.assign((size_t)n_kv * n_tokens, neginf_f16);
+    
+    // Gathered (batches, paged slots): row j of a sequence is its position
+    // j, so the mask is positional; rows past the last position repeat it
+    // and stay masked
+    if (shape.n_gather > 0) {
+        const int n_q = n_tokens / shape.n_gather;
+        std::vector<int32_t> rows((size_t)n_kv * shape.n_gather);
+        for (int g = 0; g < shape.n_gather; ++g) {
+            const int32_t seq = seq_ids[g * n_q];
+            const int32_t last = pos[(g + 1) * n_q - 1];
+            for (int32_t j = 0; j < n_kv; ++j) {
+                rows[(size_t)g * n_kv + j] = (int32_t)kv_row(seq, std::min(j, last));
+            }
+        }
+        ggml_backend_tensor_set(ggml_graph_get_tensor(gf, "inp_kv_rows"), rows.data(), 0,
+                                rows.size() * sizeof(int32_t));
         for (int q = 0; q < n_tokens; ++q) {
-            for (int k = 0; k < n_kv; ++k) {
-                mask_data[k + q * n_kv] = (k <= n_past + q) ? zero_f16 : neginf_f16;
+            for (int32_t j = 0; j <= pos[q] && j < n_kv; ++j) {
+                mask_data[j + (size_t)q * n_kv] = zero_f16;
+            }
+        }
+        ggml_backend_tensor_set(fa_mask_t, mask_data.data(), 0, mask_data.size() * sizeof(ggml_fp16_t));
+        return;
+    }
+    
+    for (int q = 0; q < n_tokens; ++q) {
+        const int64_t first = (int64_t)seq_ids[q] * n_ctx - shape.kv_start;
+        const int64_t last = first + pos[q];
+        for (int64_t k = std::max<int64_t>(first, 0); k <= last && k < n_kv; ++k) {
+            mask_data[k + (size_t)q * n_kv] = zero_f16;
+        }
+    }
+    ggml_backend_tensor_set(fa_mask_t, mask_data.data(), 0, mask_data.size() * sizeof(ggml_fp16_t));
+}
+
+void TextDecoder::read_graph_outputs(struct ggml_cgraph * gf, decoder_output & output) {
+    struct ggml_tensor * logits = ggml_graph_get_tensor(gf, "logits");
+    const int64_t vocab_size = logits->ne[0];
+    const int64_t n_rows = logits->ne[1];
+    
+    output.argmax.resize(n_rows);
+    ggml_backend_tensor_get(ggml_graph_get_tensor(gf, "logits_argmax"), output.argmax.data(),
+                            0, n_rows * sizeof(int32_t));
+    
+    if (output.want_logits) {
+        output.logits.resize(n_rows * vocab_size);
+        ggml_backend_tensor_get(logits, output.logits.data(), 0, output.logits.size() * sizeof(float));
+    } else {
+        output.logits.clear();
+    }
+    
+    struct ggml_tensor * top_idx = output.n_top_k > 0 ? ggml_graph_get_tensor(gf, "top_k_idx") : nullptr;
+    if (!top_idx) {
+        output.top_k.clear();
+        output.top_k_logits.clear();
+        output.top_k_logprobs.clear();
+        return;
+    }
+    
+    const int k = output.n_top_k;
+    output.top_k.resize(n_rows * k);
+    output.top_k_logits.resize(n_rows * k);
+    ggml_backend_tensor_get(top_idx, output.top_k.data(), 0, output.top_k.size() * sizeof(int32_t));
+    ggml_backend_tensor_get(ggml_graph_get_tensor(gf, "top_k_logits"), output.top_k_logits.data(),
+                            0, output.top_k_logits.size() * sizeof(float));
+    struct ggml_tensor * top_prob = output.want_logprobs ? ggml_graph_get_tensor(gf, "top_k_probs") : nullptr;
+    std::vector<float> probs;
+    if (top_prob) {
+        probs.resize(n_rows * k);
+        ggml_backend_tensor_get(top_prob, probs.data(), 0, probs.size() * sizeof(float));
+        output.top_k_logprobs.resize(n_rows * k);
+    } else {
+        output.top_k_logprobs.clear();
+    }
+    
+    // ggml_top_k does not promise an order within the k entries
+    std::vector<std::pair<float, int32_t>> row(k);
+    for (int64_t r = 0; r < n_rows; ++r) {
+        for (int i = 0; i < k; ++i) {
+            row[i] = {output.top_k_logits[r * k + i], i};
+        }
+        std::sort(row.begin(), row.end(), [&](const std::pair<float, int32_t> & a,
+                                              const std::pair<float, int32_t> & b) {
+            const int32_t ta = output.top_k[r * k + a.second];
+            const int32_t tb = output.top_k[r * k + b.second];
+            return a.first > b.first || (a.first == b.first && ta < tb);
+        });
+        std::vector<int32_t> ids(output.top_k.begin() + r * k, output.top_k.begin() + (r + 1) * k);
+        for (int i = 0; i < k; ++i) {
+            output.top_k_logits[r * k + i] = row[i].first;
+            output.top_k[r * k + i] = ids[row[i].second];
+            if (top_prob) {
+                output.top_k_logprobs[r * k + i] = logf(std::max(probs[r * k + row[i].second], 1e-30f));
             }
         }
-        ggml_backend_tensor_set(fa_mask_t, mask_data.data(), 0, mask_data.size() * sizeof(ggml_fp16_t));
+    }
+}
+
+bool TextDecoder::forward(const int32_t * tokens, int32_t n_tokens, int32_t n_past,
+                          std::vector<float> & output, int32_t seq_id) {
+    return forward_with_audio(tokens, n_tokens, nullptr, 0, -1, n_past, output, seq_id);
+}
+
+bool TextDecoder::forward(const int32_t * tokens, int32_t n_tokens, int32_t n_past,
+                          decoder_output & output, int32_t seq_id) {
+    return forward_with_audio(tokens, n_tokens, nullptr, 0, -1, n_past, output, seq_id);
+}
+
+bool TextDecoder::forward_with_audio(
+    const int32_t * tokens, int32_t n_tokens,
+    const float * audio_embd, int32_t n_audio,
+    int32_t audio_start_pos, int32_t n_past,
+    std::vector<float> & output, int32_t seq_id) {
+    decoder_output out;
+    if (!forward_with_audio(tokens, n_tokens, audio_embd, n_audio, audio_start_pos,
+                            n_past, out, seq_id)) {
+        return false;
+    }
+    output.swap(out.logits);
+    return true;
+}
+
+bool TextDecoder::forward_with_audio_device(
+    const int32_t * tokens, int32_t n_tokens,
+    struct ggml_tensor * audio, int32_t n_audio,
+    int32_t audio_start_pos, int32_t n_past,
+    decoder_output & output, int32_t seq_id) {
+    if (!audio || audio->ne[0] != model_.config.hidden_size || audio->ne[1] < n_audio ||
+        !audio->buffer || !can_read_buffer(ggml_backend_buffer_get_type(audio->buffer))) {
+        error_msg_ = "Audio tensor is not readable by the decoder";
+        return false;
+    }
+    
+    state_.audio_src = audio;
+    const bool ok = forward_with_audio(tokens, n_tokens, nullptr, n_audio, audio_start_pos,
+                                       n_past, output, seq_id);
+    state_.audio_src = nullptr;
+    return ok;
+}
+
+bool TextDecoder::can_read_buffer(ggml_backend_buffer_type_t buft) const {
+    return state_.backend_gpu && buft &&
+           ggml_backend_dev_supports_buft(ggml_backend_get_device(state_.backend_gpu), buft);
+}
+
+bool TextDecoder::forward_with_audio(
+    const int32_t * tokens, int32_t n_tokens,
+    const float * audio_embd, int32_t n_audio,
+    int32_t audio_start_pos, int32_t n_past,
+    decoder_output & output, int32_t seq_id) {
+    QWEN3_TIMER("decoder.forward");
+    
+    // Host embeddings, or the device tensor of forward_with_audio_device
+    const bool has_audio = (audio_embd || state_.audio_src) && n_audio > 0;
+    
+    if (!model_.ctx) {
+        error_msg_ = "Model not loaded";
+        return false;
     }
     
-    if (audio_embd && n_audio > 0) {
-        struct ggml_tensor * inp_audio = ggml_graph_get_tensor(gf, "inp_audio");
-        if (inp_audio) {
-            ggml_backend_tensor_set(inp_audio, audio_embd, 0, 
-                                    n_audio * model_.config.hidden_size * sizeof(float));
+    auto lock = lock_arena(state_.arena);
+    
+    if (state_.cache.n_ctx == 0) {
+        if (!init_kv_cache(1024)) {
+            return false;
         }
     }
     
+    if (seq_id < 0 || seq_id >= state_.cache.n_seq) {
+        error_msg_ = "Invalid sequence id " + std::to_string(seq_id);
+        return false;
+    }
+    
+    if (n_past + n_tokens > state_.cache.n_ctx) {
+        error_msg_ = "Context length exceeded";
+        return false;
+    }
+    
+    if (has_audio && (audio_start_pos < 0 || audio_start_pos + n_audio > n_tokens)) {
+        error_msg_ = "Audio span does not fit in the prompt";
+        return false;
+    }
+    
+    if (n_tokens == 1 && !has_audio) {
+        return forward_batch(&seq_id, tokens, &n_past, 1, output);
+    }
+    
+    if (!prepare_rows(seq_id, n_past, n_past + n_tokens)) {
+        return false;
+    }
+    
+    decoder_graph_shape shape;
+    shape.n_tokens = n_tokens;
+    shape.kv_start = state_.cache.paged ? 0 : seq_id * state_.cache.n_ctx;
+    shape.n_kv = n_past + n_tokens;
+    shape.n_gather = state_.cache.paged ? 1 : 0;
+    if (has_audio) {
+        shape.n_audio = n_audio;
+        shape.audio_start_pos = audio_start_pos;
+        shape.audio_device = audio_embd == nullptr;
+        shape.audio_type = shape.audio_device ? GGML_TYPE_F32 : audio_type_;
+    }
+    shape.all_logits = output.all_rows;
+    shape.n_top_k = output.n_top_k;
+    shape.top_k_probs = output.want_logprobs;
+    
+    struct ggml_cgraph * gf = build_graph(shape, compute_meta());
+    if (!gf) {
+        error_msg_ = "Failed to build graph";
+        return false;
+    }
+    
+    if (!ggml_backend_sched_alloc_graph(state_.sched, gf)) {
+        error_msg_ = "Failed to allocate graph";
+        return false;
+    }
+    
+    std::vector<int32_t> seq_ids(n_tokens, seq_id);
+    std::vector<int32_t> positions(n_tokens);
+    for (int i = 0; i < n_tokens; ++i) {
+        positions[i] = n_past + i;
+    }
+    set_graph_inputs(gf, shape, tokens, seq_ids.data(), positions.data());
+    
+    if (shape.n_audio > 0 && !shape.audio_device) {
+        set_audio_input(ggml_graph_get_tensor(gf, "inp_audio"), audio_embd, n_audio);
+    }
+    
     {
         QWEN3_TIMER("decoder.compute");
-        if (ggml_backend_sched_graph_compute(state_.sched, gf) != GGML_STATUS_SUCCESS) {
+        if (sched_graph_compute(state_.sched, gf) != GGML_STATUS_SUCCESS) {
             error_msg_ = "Failed to compute graph";
             ggml_backend_sched_reset(state_.sched);
             return false;
         }
     }
     
-    struct ggml_tensor * logits = ggml_graph_get_tensor(gf, "logits");
-    if (!logits) {
-        error_msg_ = "Failed to find logits tensor";
-        ggml_backend_sched_reset(state_.sched);
+    read_graph_outputs(gf, output);
+    
+    state_.cache.seq_used[seq_id] = n_past + n_tokens;
+    
+    ggml_backend_sched_reset(state_.sched);
+    
+    return true;
+}
+
+bool TextDecoder::forward_batch(const int32_t * seq_ids, const int32_t * tokens,
+                                const int32_t * n_past, int32_t n_batch,
+                                std::vector<float> & output) {
+    decoder_output out;
+    if (!forward_batch(seq_ids, tokens, n_past, n_batch, out)) {
         return false;
     }
+    output.swap(out.logits);
+    return true;
+}
+
+bool TextDecoder::forward_batch(const int32_t * seq_ids, const int32_t * tokens,
+                                const int32_t * n_past, int32_t n_batch,
+                                decoder_output & output) {
+    QWEN3_TIMER("decoder.forward_batch");
     
-    int64_t vocab_size = logits->ne[0];
-    int64_t n_logit_rows = logits->ne[1];
-    output.resize(n_logit_rows * vocab_size);
-    ggml_backend_tensor_get(logits, output.data(), 0, output.size() * sizeof(float));
+    if (!model_.ctx) {
+        error_msg_ = "Model not loaded";
+        return false;
+    }
     
-    state_.cache.n_used = n_past + n_tokens;
+    auto lock = lock_arena(state_.arena);
     
-    ggml_backend_sched_reset(state_.sched);
+    if (state_.cache.n_ctx == 0) {
+        if (!init_kv_cache(1024)) {
+            return false;
+        }
+    }
+    
+    const int32_t n_ctx = state_.cache.n_ctx;
+    const int32_t n_seq = state_.cache.n_seq;
+    
+    if (n_batch <= 0 || n_batch > n_seq) {
+        error_msg_ = "Invalid batch size " + std::to_string(n_batch);
+        return false;
+    }
+    
+    // A single sequence attends the contiguous rows of its slot; in a batch
+    // each sequence attends its own rows, gathered (decoder_graph_shape::
+    // n_gather). Either way n_kv is padded to QWEN3_ASR_KV_BUCKET so the
+    // cached graph survives many steps.
+    int32_t n_kv_max = 0;
+    for (int b = 0; b < n_batch; ++b) {
+        if (seq_ids[b] < 0 || seq_ids[b] >= n_seq) {
+            error_msg_ = "Invalid sequence id " + std::to_string(seq_ids[b]);
+            return false;
+        }
+        if (n_past[b] < 0 || n_past[b] + 1 > n_ctx) {
+            error_msg_ = "Context length exceeded";
+            return false;
+        }
+        for (int c = 0; c < b; ++c) {
+            if (seq_ids[c] == seq_ids[b]) {
+                error_msg_ = "Sequence " + std::to_string(seq_ids[b]) + " appears twice in batch";
+                return false;
+            }
+        }
+        n_kv_max = std::max(n_kv_max, n_past[b] + 1);
+    }
+    
+    const bool paged = state_.cache.paged;
+    for (int b = 0; b < n_batch && paged; ++b) {
+        if (!prepare_rows(seq_ids[b], n_past[b], n_past[b] + 1)) {
+            return false;
+        }
+    }
+    
+    decoder_graph_shape shape;
+    shape.n_tokens = n_batch;
+    // Paged slots are always gathered: their pages are interleaved in the pool
+    shape.kv_start = n_batch == 1 && !paged ? seq_ids[0] * n_ctx : 0;
+    shape.n_kv = std::min(GGML_PAD(n_kv_max, QWEN3_ASR_KV_BUCKET), n_ctx);
+    shape.n_gather = n_batch > 1 || paged ? n_batch : 0;
+    shape.all_logits = true;
+    shape.n_top_k = output.n_top_k;
+    shape.top_k_probs = output.want_logprobs;
+    
+    struct ggml_cgraph * gf = state_.decode_graph;
+    
+    if (!gf || !(shape == state_.decode_shape)) {
+        invalidate_decode_graph();
+        
+        gf = build_graph(shape, state_.decode_meta);
+        if (!gf) {
+            error_msg_ = "Failed to build decode graph";
+            return false;
+        }
+        if (!ggml_backend_sched_alloc_graph(state_.sched_decode, gf)) {
+            error_msg_ = "Failed to allocate decode graph";
+            return false;
+        }
+        state_.decode_graph = gf;
+        state_.decode_shape = shape;
+    }
+    
+    // The whole mask every step: fa_mask is a graph input, so the allocator
+    // may reuse its memory for later nodes once attention has read it
+    set_graph_inputs(gf, shape, tokens, seq_ids, n_past);
+    
+    {
+        QWEN3_TIMER("decoder.compute");
+        if (sched_graph_compute(state_.sched_decode, gf) != GGML_STATUS_SUCCESS) {
+            error_msg_ = "Failed to compute decode graph";
+            invalidate_decode_graph();
+            return false;
+        }
+    }
+    
+    read_graph_outputs(gf, output);
+    
+    for (int b = 0; b < n_batch; ++b) {
+        state_.cache.seq_used[seq_ids[b]] = n_past[b] + 1;
+    }
     
     return true;
 }
@@ -690,48 +1620,33 @@ bool TextDecoder::forward_debug(const int32_t * tokens, int32_t n_tokens, int32_
         return false;
     }
     
+    auto lock = lock_arena(state_.arena);
+    
     if (state_.cache.n_ctx == 0) {
         if (!init_kv_cache(1024)) {
             return false;
         }
     }
     
-    struct ggml_cgraph * gf = build_graph(tokens, n_tokens, n_past, nullptr, 0, -1);
+    decoder_graph_shape shape;
+    shape.n_tokens = n_tokens;
+    shape.n_kv = n_past + n_tokens;
+    
+    struct ggml_cgraph * gf = build_graph(shape, compute_meta());
     
     if (!ggml_backend_sched_alloc_graph(state_.sched, gf)) {
         error_msg_ = "Failed to allocate graph";
         return false;
     }
     
-    struct ggml_tensor * inp_tokens = ggml_graph_get_tensor(gf, "inp_tokens");
-    if (inp_tokens) {
-        ggml_backend_tensor_set(inp_tokens, tokens, 0, n_tokens * sizeof(int32_t));
-    }
-    
-    struct ggml_tensor * inp_pos = ggml_graph_get_tensor(gf, "inp_pos");
-    if (inp_pos) {
-        std::vector<int32_t> positions(n_tokens);
-        for (int i = 0; i < n_tokens; ++i) {
-            positions[i] = n_past + i;
-        }
-        ggml_backend_tensor_set(inp_pos, positions.data(), 0, n_tokens * sizeof(int32_t));
-    }
-    
-    struct ggml_tensor * fa_mask_t = ggml_graph_get_tensor(gf, "fa_mask");
-    if (fa_mask_t) {
-        int n_kv = n_past + n_tokens;
-        std::vector<ggml_fp16_t> mask_data((size_t)n_kv * n_tokens);
-        const ggml_fp16_t zero_f16 = ggml_fp32_to_fp16(0.0f);
-        const ggml_fp16_t neginf_f16 = ggml_fp32_to_fp16(-INFINITY);
-        for (int q = 0; q < n_tokens; ++q) {
-            for (int k = 0; k < n_kv; ++k) {
-                mask_data[k + q * n_kv] = (k <= n_past + q) ? zero_f16 : neginf_f16;
-            }
-        }
-        ggml_backend_tensor_set(fa_mask_t, mask_data.data(), 0, mask_data.size() * sizeof(ggml_fp16_t));
+    std::vector<int32_t> seq_ids(n_tokens, 0);
+    std::vector<int32_t> positions(n_tokens);
+    for (int i = 0; i < n_tokens; ++i) {
+        positions[i] = n_past + i;
     }
+    set_graph_inputs(gf, shape, tokens, seq_ids.data(), positions.data());
     
-    if (ggml_backend_sched_graph_compute(state_.sched, gf) != GGML_STATUS_SUCCESS) {
+    if (sched_graph_compute(state_.sched, gf) != GGML_STATUS_SUCCESS) {
         error_msg_ = "Failed to compute graph";
         ggml_backend_sched_reset(state_.sched);
         return false;
@@ -756,35 +1671,107 @@ bool TextDecoder::forward_debug(const int32_t * tokens, int32_t n_tokens, int32_
         }
     }
     
-    state_.cache.n_used = n_past + n_tokens;
+    state_.cache.seq_used[0] = n_past + n_tokens;
     ggml_backend_sched_reset(state_.sched);
     
     return true;
 }
 
+struct ggml_tensor * build_injected_embeddings(struct ggml_context * ctx,
+                                               struct ggml_tensor * token_embd,
+                                               struct ggml_tensor * audio,
+                                               int32_t n_tokens, int32_t n_text) {
+    struct ggml_tensor * embd = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, token_embd->ne[0], n_tokens);
+    
+    if (n_text > 0) {
+        struct ggml_tensor * inp_text_ids = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, n_text);
+        ggml_set_name(inp_text_ids, "inp_text_ids");
+        ggml_set_input(inp_text_ids);
+        
+        struct ggml_tensor * inp_text_rows = ggml_new_tensor_1d(ctx, GGML_TYPE_I64, n_text);
+        ggml_set_name(inp_text_rows, "inp_text_rows");
+        ggml_set_input(inp_text_rows);
+        
+        embd = ggml_set_rows(ctx, embd, ggml_get_rows(ctx, token_embd, inp_text_ids), inp_text_rows);
+    }
+    
+    struct ggml_tensor * inp_audio_rows = ggml_new_tensor_1d(ctx, GGML_TYPE_I64, audio->ne[1]);
+    ggml_set_name(inp_audio_rows, "inp_audio_rows");
+    ggml_set_input(inp_audio_rows);
+    
+    if (audio->type != GGML_TYPE_F32) {
+        audio = ggml_cast(ctx, audio, GGML_TYPE_F32);
+    }
+    return ggml_set_rows(ctx, embd, audio, inp_audio_rows);
+}
+
+void set_injection_inputs(struct ggml_cgraph * gf, const injection_layout & layout) {
+    if (!layout.text_ids.empty()) {
+        ggml_backend_tensor_set(ggml_graph_get_tensor(gf, "inp_text_ids"), layout.text_ids.data(), 0,
+                                layout.text_ids.size() * sizeof(int32_t));
+        ggml_backend_tensor_set(ggml_graph_get_tensor(gf, "inp_text_rows"), layout.text_rows.data(), 0,
+                                layout.text_rows.size() * sizeof(int64_t));
+    }
+    ggml_backend_tensor_set(ggml_graph_get_tensor(gf, "inp_audio_rows"), layout.audio_rows.data(), 0,
+                            layout.audio_rows.size() * sizeof(int64_t));
+}
+
+void set_audio_input(struct ggml_tensor * inp_audio, const float * audio_embd, int32_t n_audio) {
+    const int64_t n = (int64_t)n_audio * inp_audio->ne[0];
+    if (inp_audio->type == GGML_TYPE_F16) {
+        std::vector<ggml_fp16_t> half(n);
+        ggml_fp32_to_fp16_row(audio_embd, half.data(), n);
+        ggml_backend_tensor_set(inp_audio, half.data(), 0, n * sizeof(ggml_fp16_t));
+    } else {
+        ggml_backend_tensor_set(inp_audio, audio_embd, 0, n * sizeof(float));
+    }
+}
+
 void free_decoder_model(text_decoder_model & model) {
     if (model.buffer) {
         ggml_backend_buffer_free(model.buffer);
         model.buffer = nullptr;
     }
+    for (ggml_backend_buffer_t buffer : model.split_buffers) {
+        ggml_backend_buffer_free(buffer);
+    }
+    model.split_buffers.clear();
+    for (ggml_backend_buffer_t buffer : model.repack_buffers) {
+        ggml_backend_buffer_free(buffer);
+    }
+    model.repack_buffers.clear();
     if (model.ctx) {
         ggml_free(model.ctx);
         model.ctx = nullptr;
     }
-    if (model.mmap_addr) {
-        munmap(model.mmap_addr, model.mmap_size);
-        model.mmap_addr = nullptr;
-        model.mmap_size = 0;
-    }
+    model.file.reset();
     model.tensors.clear();
     model.layers.clear();
 }
 
+void free_kv_snapshot(kv_snapshot & snap) {
+    if (snap.buffer) {
+        ggml_backend_buffer_free(snap.buffer);
+        snap.buffer = nullptr;
+    }
+    if (snap.ctx) {
+        ggml_free(snap.ctx);
+        snap.ctx = nullptr;
+    }
+    snap.k.clear();
+    snap.v.clear();
+    snap.tokens.clear();
+}
+
 void free_kv_cache(kv_cache & cache) {
     if (cache.buffer) {
         ggml_backend_buffer_free(cache.buffer);
         cache.buffer = nullptr;
     }
+    for (ggml_backend_buffer_t buffer : cache.split_buffers) {
+        ggml_backend_buffer_free(buffer);
+    }
+    cache.split_buffers.clear();
     if (cache.ctx) {
         ggml_free(cache.ctx);
         cache.ctx = nullptr;
@@ -792,28 +1779,13 @@ void free_kv_cache(kv_cache & cache) {
     cache.k_cache.clear();
     cache.v_cache.clear();
     cache.n_ctx = 0;
-    cache.n_used = 0;
-}
-
-bool TextDecoder::load_vocab(struct gguf_context * ctx) {
-    int64_t tokens_idx = gguf_find_key(ctx, "tokenizer.ggml.tokens");
-    if (tokens_idx < 0) {
-        error_msg_ = "Vocabulary not found in GGUF file";
-        return false;
-    }
-    
-    int64_t n_vocab = gguf_get_arr_n(ctx, tokens_idx);
-    if (n_vocab <= 0) {
-        error_msg_ = "Empty vocabulary in GGUF file";
-        return false;
-    }
-    
-    vocab_.resize(n_vocab);
-    for (int64_t i = 0; i < n_vocab; ++i) {
-        vocab_[i] = gguf_get_arr_str(ctx, tokens_idx, i);
-    }
-    
-    return true;
+    cache.n_seq = 1;
+    cache.n_rows = 0;
+    cache.seq_used.clear();
+    cache.paged = false;
+    cache.seq_pages.clear();
+    cache.page_refs.clear();
+    cache.free_pages.clear();
 }
 
 // GPT-2 byte-level BPE: reverse mapping from Unicode codepoints back to raw bytes.
@@ -848,12 +1820,7 @@ static std::vector<int> build_unicode_to_byte_table() {
     return cp_to_byte;
 }
 
-std::string TextDecoder::decode_token(int32_t token_id) const {
-    if (token_id < 0 || token_id >= (int32_t)vocab_.size()) {
-        return "";
-    }
-
-    std::string token = vocab_[token_id];
+static std::string token_to_bytes(const std::string & token, const std::vector<int> & cp_to_byte) {
 
     // Skip special tokens like <|...|> and [PAD...]
     if (token.size() >= 3 && token[0] == '<' && token[1] == '|' &&
@@ -870,8 +1837,6 @@ std::string TextDecoder::decode_token(int32_t token_id) const {
 
     // Byte-level BPE decode: each Unicode codepoint in the token string maps to a byte
     // via the GPT-2 bytes_to_unicode table.
-    static const std::vector<int> cp_to_byte = build_unicode_to_byte_table();
-
     std::string bytes;
     bytes.reserve(token.size());
 
@@ -936,12 +1901,142 @@ std::string TextDecoder::decode_token(int32_t token_id) const {
     return bytes;
 }
 
+bool TextDecoder::load_vocab(struct gguf_context * ctx) {
+    int64_t tokens_idx = gguf_find_key(ctx, "tokenizer.ggml.tokens");
+    if (tokens_idx < 0) {
+        error_msg_ = "Vocabulary not found in GGUF file";
+        return false;
+    }
+    
+    int64_t n_vocab = gguf_get_arr_n(ctx, tokens_idx);
+    if (n_vocab <= 0) {
+        error_msg_ = "Empty vocabulary in GGUF file";
+        return false;
+    }
+    
+    vocab_.resize(n_vocab);
+    for (int64_t i = 0; i < n_vocab; ++i) {
+        vocab_[i] = gguf_get_arr_str(ctx, tokens_idx, i);
+    }
+    
+    const std::vector<int> cp_to_byte = build_unicode_to_byte_table();
+    token_bytes_.resize(n_vocab);
+    for (int64_t i = 0; i < n_vocab; ++i) {
+        token_bytes_[i] = token_to_bytes(vocab_[i], cp_to_byte);
+    }
+    
+    std::vector<std::string> merges;
+    int64_t merges_idx = gguf_find_key(ctx, "tokenizer.ggml.merges");
+    if (merges_idx >= 0) {
+        int64_t n_merges = gguf_get_arr_n(ctx, merges_idx);
+        merges.reserve(n_merges);
+        for (int64_t i = 0; i < n_merges; ++i) {
+            merges.push_back(gguf_get_arr_str(ctx, merges_idx, i));
+        }
+    }
+    
+    if (!tokenizer_.build(vocab_, merges)) {
+        error_msg_ = "Failed to build BPE tokenizer";
+        return false;
+    }
+    
+    return true;
+}
+
+bool TextDecoder::encode_text(std::string_view text, std::vector<int32_t> & out) {
+    if (tokenizer_.empty() || tokenizer_.n_merges() == 0) {
+        return false;
+    }
+    tokenizer_.encode(text, out);
+    return true;
+}
+
+std::string TextDecoder::decode_token(int32_t token_id) const {
+    if (token_id < 0 || token_id >= (int32_t)token_bytes_.size()) {
+        return "";
+    }
+    return token_bytes_[token_id];
+}
+
 std::string TextDecoder::decode_tokens(const std::vector<int32_t> & tokens) const {
     std::string result;
     for (int32_t token : tokens) {
-        result += decode_token(token);
+        if (token >= 0 && token < (int32_t)token_bytes_.size()) {
+            result += token_bytes_[token];
+        }
     }
     return result;
 }
 
+void StreamingDetokenizer::reset() {
+    in_header_ = true;
+    header_.clear();
+    text_.clear();
+    n_emitted_ = 0;
+    language_ = "unknown";
+}
+
+std::string_view StreamingDetokenizer::append_text(std::string_view bytes) {
+    text_.append(bytes.data(), bytes.size());
+    
+    // Hold back a trailing lead byte whose continuation bytes are missing
+    size_t complete = text_.size();
+    for (size_t k = 1; k <= 3 && k <= text_.size() - n_emitted_; ++k) {
+        const unsigned char c = static_cast<unsigned char>(text_[text_.size() - k]);
+        if ((c & 0xC0) == 0x80) {
+            continue;
+        }
+        const size_t len = (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : (c & 0xF8) == 0xF0 ? 4 : 1;
+        if (len > k) {
+            complete = text_.size() - k;
+        }
+        break;
+    }
+    
+    std::string_view delta(text_.data() + n_emitted_, complete - n_emitted_);
+    n_emitted_ = complete;
+    return delta;
+}
+
+std::string_view StreamingDetokenizer::push(int32_t token_id) {
+    if (token_id < 0 || token_id >= (int32_t)token_bytes_.size()) {
+        return {};
+    }
+    const std::string & bytes = token_bytes_[token_id];
+    if (!in_header_) {
+        return append_text(bytes);
+    }
+    
+    header_ += bytes;
+    const size_t n_cmp = std::min<size_t>(header_.size(), QWEN3_LANGUAGE_PREFIX_LEN);
+    if (header_.compare(0, n_cmp, QWEN3_LANGUAGE_PREFIX, n_cmp) != 0) {
+        // No language header: everything so far is transcript
+        in_header_ = false;
+        return append_text(header_);
+    }
+    
+    const size_t end = header_.find('|', QWEN3_LANGUAGE_PREFIX_LEN);
+    if (end == std::string::npos) {
+        return {};
+    }
+    language_ = header_.substr(QWEN3_LANGUAGE_PREFIX_LEN, end - QWEN3_LANGUAGE_PREFIX_LEN);
+    in_header_ = false;
+    return append_text(std::string_view(header_).substr(end + 1));
+}
+
+std::string_view StreamingDetokenizer::finish() {
+    if (in_header_) {
+        in_header_ = false;
+        if (header_.size() > QWEN3_LANGUAGE_PREFIX_LEN) {
+            // Hypothesis ended inside the header
+            language_ = header_.substr(QWEN3_LANGUAGE_PREFIX_LEN);
+        } else {
+            text_ = header_;
+        }
+    }
+    std::string_view delta(text_.data() + n_emitted_, text_.size() - n_emitted_);
+    n_emitted_ = text_.size();
+    return delta;
+}
+
 } // namespace qwen3_asr
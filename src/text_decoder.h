@@ -3,8 +3,15 @@
 #include "ggml.h"
 #include "ggml-backend.h"
 #include "gguf.h"
+#include "cpu_backend.h"
+#include "compute_arena.h"
+#include "bpe_tokenizer.h"
+#include "audio_injection.h"
+#include "layer_ops.h"
+#include "model_file.h"
 
 #include <string>
+#include <string_view>
 #include <map>
 #include <vector>
 #include <memory>
@@ -35,6 +42,7 @@ struct decoder_layer {
     struct ggml_tensor * attn_q = nullptr;
     struct ggml_tensor * attn_k = nullptr;
     struct ggml_tensor * attn_v = nullptr;
+    struct ggml_tensor * attn_qkv = nullptr;   // fused Q/K/V rows, replaces the three
     struct ggml_tensor * attn_output = nullptr;
     struct ggml_tensor * attn_q_norm = nullptr;
     struct ggml_tensor * attn_k_norm = nullptr;
@@ -43,6 +51,7 @@ struct decoder_layer {
     
     struct ggml_tensor * ffn_gate = nullptr;
     struct ggml_tensor * ffn_up = nullptr;
+    struct ggml_tensor * ffn_gate_up = nullptr;  // fused gate/up rows, replaces the two
     struct ggml_tensor * ffn_down = nullptr;
 };
 
@@ -68,9 +77,14 @@ struct text_decoder_model {
     // Backend buffer for weights
     ggml_backend_buffer_t buffer = nullptr;
     
-    // mmap state — must outlive all tensors backed by this mapping
-    void * mmap_addr = nullptr;
-    size_t mmap_size = 0;
+    // Weights of the layers on further GPUs when the layers are split
+    std::vector<ggml_backend_buffer_t> split_buffers;
+    
+    // Weights moved into repacked CPU layouts (cpu_backend_params::repack_weights)
+    std::vector<ggml_backend_buffer_t> repack_buffers;
+    
+    // Mapped file — must outlive all tensors backed by its mapping
+    std::shared_ptr<ModelFile> file;
     
     // Tensor name to tensor mapping
     std::map<std::string, struct ggml_tensor *> tensors;
@@ -83,23 +97,120 @@ struct kv_cache {
     
     struct ggml_context * ctx = nullptr;
     ggml_backend_buffer_t buffer = nullptr;
+    std::vector<ggml_backend_buffer_t> split_buffers;  // Layers on further GPUs
+    
+    int32_t n_ctx = 0;      // Maximum context length per sequence
+    int32_t n_seq = 1;      // Sequence slots; slot s owns rows [s * n_ctx, (s + 1) * n_ctx)
+    int64_t n_rows = 0;     // Rows allocated per layer (high-water mark), >= n_ctx * n_seq
+    enum ggml_type type = GGML_TYPE_F16;  // K/V element type (F16, Q8_0 or Q4_0)
+    std::vector<int32_t> seq_used;  // Cached tokens per slot
+    
+    // Paged mode (TextDecoder::begin_paged): the rows are a pool of
+    // QWEN3_ASR_KV_PAGE-row pages and slot s maps position p to row
+    // seq_pages[s][p / page] * page + p % page. Pages are refcounted:
+    // fork_seq shares them, and a shared page is copied before a write
+    // lands in it (copy-on-write).
+    bool paged = false;
+    std::vector<std::vector<int32_t>> seq_pages;
+    std::vector<int32_t> page_refs;   // per page, 0 = free
+    std::vector<int32_t> free_pages;  // stack of free pages
     
-    int32_t n_ctx = 0;      // Maximum context length
-    int32_t n_used = 0;     // Current number of cached tokens
     int32_t head_dim = 64;
     int32_t n_kv_heads = 8;
     int32_t n_layers = 28;
 };
 
+// Shape of a decoder forward graph; inputs that only change values
+// (tokens, positions, KV rows, mask) are not part of it
+struct decoder_graph_shape {
+    int32_t n_tokens = 0;
+    int32_t kv_start = 0;         // first KV row visible to attention
+    int32_t n_kv = 0;             // KV rows visible to attention, from kv_start
+    // > 0: the tokens are n_gather sequences of n_tokens / n_gather tokens,
+    // and each attends only the n_kv rows of its own listed in "inp_kv_rows"
+    // (gathered per step) instead of one shared range from kv_start
+    int32_t n_gather = 0;
+    int32_t n_audio = 0;          // audio embeddings injected at audio_start_pos
+    int32_t audio_start_pos = -1;
+    bool audio_device = false;    // audio read from text_decoder_state::audio_src, not an input
+    enum ggml_type audio_type = GGML_TYPE_F32;  // type of the "inp_audio" input
+    bool all_logits = false;      // logits for every token instead of the last one
+    int32_t n_top_k = 0;          // also output the top-k token IDs and logits per row
+    bool top_k_probs = false;     // and their softmax probabilities
+    
+    bool operator==(const decoder_graph_shape & o) const {
+        return n_tokens == o.n_tokens && kv_start == o.kv_start && n_kv == o.n_kv && n_gather == o.n_gather &&
+               n_audio == o.n_audio && audio_start_pos == o.audio_start_pos &&
+               audio_device == o.audio_device && audio_type == o.audio_type && all_logits == o.all_logits && n_top_k == o.n_top_k &&
+               top_k_probs == o.top_k_probs;
+    }
+};
+
+// What a forward pass copies back to the host, per logits row. The argmax
+// (and top-k when n_top_k > 0) is computed in the graph, so a greedy step
+// only transfers token IDs; the full vocab row is read only if want_logits.
+struct decoder_output {
+    bool want_logits = true;
+    int32_t n_top_k = 0;
+    bool want_logprobs = false;       // top_k_logprobs too (a softmax over the vocab)
+    bool all_rows = false;            // a row for every input token, not only the last
+    
+    std::vector<float> logits;        // [n_rows, vocab_size] if want_logits
+    std::vector<int32_t> argmax;      // [n_rows]
+    std::vector<int32_t> top_k;       // [n_rows, n_top_k], best first
+    std::vector<float> top_k_logits;  // [n_rows, n_top_k]
+    std::vector<float> top_k_logprobs;  // [n_rows, n_top_k] if want_logprobs, log-softmax over the vocab
+};
+
+// KV rows of a token prefix, copied into a slot instead of re-prefilling it
+struct kv_snapshot {
+    std::vector<int32_t> tokens;
+    std::vector<struct ggml_tensor *> k;  // Per-layer [head_dim, n_kv_heads, tokens.size()]
+    std::vector<struct ggml_tensor *> v;
+    
+    struct ggml_context * ctx = nullptr;
+    ggml_backend_buffer_t buffer = nullptr;
+    
+    enum ggml_type type = GGML_TYPE_F16;
+    int64_t last_used = 0;  // restore counter value, for LRU eviction
+};
+
 // Text decoder state
 struct text_decoder_state {
     ggml_backend_t backend_cpu = nullptr;
     ggml_backend_t backend_gpu = nullptr;
+    ggml_threadpool_t threadpool = nullptr;
     ggml_backend_sched_t sched = nullptr;
     
+    // Layer split over several GPUs (cpu_backend_params::gpu_split): the
+    // further backends, and per layer the device its weights and KV cache
+    // live on (0 = backend_gpu, or the CPU without one; d = backend_split[d - 1])
+    std::vector<ggml_backend_t> backend_split;
+    std::vector<int32_t> layer_device;
+    
+    // Set when backend_cpu, backend_gpu and sched belong to a shared arena;
+    // sched_decode is always the decoder's own
+    std::shared_ptr<ComputeArena> arena;
+    
     std::vector<uint8_t> compute_meta;
     
     kv_cache cache;
+    
+    // Cached decode-step graph (see TextDecoder::forward_batch).
+    // It has its own scheduler so its allocation survives prefill calls.
+    ggml_backend_sched_t sched_decode = nullptr;
+    std::vector<uint8_t> decode_meta;
+    struct ggml_cgraph * decode_graph = nullptr;
+    decoder_graph_shape decode_shape;
+    
+    std::vector<ggml_fp16_t> mask_host;
+    
+    // Device-resident audio of the graph being built (forward_with_audio_device)
+    struct ggml_tensor * audio_src = nullptr;
+    
+    // Saved prompt prefixes (see TextDecoder::save_prefix)
+    std::vector<kv_snapshot> snapshots;
+    int64_t snapshot_clock = 0;
 };
 
 // Text decoder class
@@ -109,20 +220,95 @@ public:
     ~TextDecoder();
     
     // Load model from GGUF file
-    bool load_model(const std::string & model_path);
+    // cpu_params: thread count / threadpool / affinity for the CPU backend,
+    //             and the GPU(s) to run on (gpu_device or gpu_split)
+    // arena: run prompt graphs on its backends and scheduler when it matches
+    //        cpu_params (see ComputeArena)
+    bool load_model(const std::string & model_path,
+                    const cpu_backend_params & cpu_params = cpu_backend_params(),
+                    const std::shared_ptr<ComputeArena> & arena = nullptr);
+    
+    // Load from an opened file (see ModelFile), e.g. one shared with the encoder
+    bool load_model(const std::shared_ptr<ModelFile> & file,
+                    const cpu_backend_params & cpu_params = cpu_backend_params(),
+                    const std::shared_ptr<ComputeArena> & arena = nullptr);
+    
+    // Size the prompt compute buffers for a prefill of n_tokens with n_audio
+    // injected frames by reserving that graph, without running it. Reserves
+    // a KV cache of n_tokens first if the current one is smaller.
+    bool reserve_compute(int32_t n_tokens, int32_t n_audio);
+    
+    // Weights, KV cache and snapshots, the decode-step compute buffers, and
+    // the prompt compute buffers unless they belong to a shared arena
+    memory_usage get_memory_usage() const;
     
     // Initialize KV cache for given context length
-    bool init_kv_cache(int32_t n_ctx);
+    // n_seq: number of independent sequence slots, each of n_ctx entries
+    // type: K/V element type; GGML_TYPE_Q8_0 / GGML_TYPE_Q4_0 cut the cache
+    //       to ~53% / ~28% of F16 (head_dim must be a multiple of 32)
+    bool init_kv_cache(int32_t n_ctx, int32_t n_seq = 1,
+                       enum ggml_type type = GGML_TYPE_F16);
+    
+    // Make room for n_seq slots of at least n_ctx entries and clear them.
+    // The allocated buffer is kept across calls and shared out between the
+    // slots; it is only reallocated (rounded up to QWEN3_ASR_KV_BUCKET) when
+    // n_ctx * n_seq exceeds it or the type changes, which discards the
+    // cached entries.
+    bool reserve_kv_cache(int32_t n_ctx, int32_t n_seq = 1,
+                          enum ggml_type type = GGML_TYPE_F16);
+    
+    // Bytes held by the KV cache buffer
+    size_t get_kv_cache_bytes() const;
     
     // Clear KV cache (for new sequence)
     void clear_kv_cache();
     
+    // Release one sequence slot; the next prefill into it starts at n_past = 0
+    void clear_seq(int32_t seq_id);
+    
+    // Roll slot seq_id back to n_past entries (e.g. rejected draft tokens);
+    // the dropped rows are masked and overwritten by the next forward
+    void truncate_seq(int32_t seq_id, int32_t n_past);
+    
+    // Keep the KV rows of tokens[0, n_tokens), already prefilled in slot
+    // seq_id, for restore_prefix(). Snapshots are matched by token ID, so the
+    // range must not contain injected audio. Up to QWEN3_ASR_MAX_SNAPSHOTS
+    // prefixes are kept; the least recently restored one is dropped first.
+    bool save_prefix(const int32_t * tokens, int32_t n_tokens, int32_t seq_id = 0);
+    
+    // Copy the longest saved prefix shared with tokens[0, n_tokens) into slot
+    // seq_id, on the device. Returns the number of tokens restored: the slot's
+    // new n_past, 0 if no snapshot matches.
+    int32_t restore_prefix(const int32_t * tokens, int32_t n_tokens, int32_t seq_id = 0);
+    
+    void clear_prefix_snapshots();
+    
+    // Switch the reserved cache to paged mode with n_seq slots that share
+    // all of its rows (reserve_kv_cache(n_rows, 1, ...) first); every slot
+    // starts empty. The next reserve_kv_cache returns to fixed slots.
+    bool begin_paged(int32_t n_seq);
+    
+    // Paged mode: make slot dst_seq a copy of slot src_seq (releasing what
+    // dst_seq held) by sharing its pages; nothing is copied until one of
+    // them writes into a shared page
+    bool fork_seq(int32_t dst_seq, int32_t src_seq);
+    
+    // Pages in use out of the pool, in paged mode
+    int32_t get_n_pages_used() const;
+    
+    int32_t get_n_ctx() const { return state_.cache.n_ctx; }
+    int32_t get_n_seq() const { return state_.cache.n_seq; }
+    int32_t get_seq_used(int32_t seq_id) const { return state_.cache.seq_used[seq_id]; }
+    
     // Forward pass: compute logits for input tokens
     // tokens: input token IDs [n_tokens]
     // n_past: number of tokens already in KV cache
     // output: logits [n_tokens, vocab_size]
+    // seq_id: KV cache slot of the sequence
+    bool forward(const int32_t * tokens, int32_t n_tokens, int32_t n_past,
+                 std::vector<float> & output, int32_t seq_id = 0);
     bool forward(const int32_t * tokens, int32_t n_tokens, int32_t n_past,
-                 std::vector<float> & output);
+                 decoder_output & output, int32_t seq_id = 0);
     
     // Forward pass with audio embedding injection
     // tokens: input token IDs [n_tokens]
@@ -133,7 +319,41 @@ public:
     bool forward_with_audio(const int32_t * tokens, int32_t n_tokens,
                             const float * audio_embd, int32_t n_audio,
                             int32_t audio_start_pos, int32_t n_past,
-                            std::vector<float> & output);
+                            std::vector<float> & output, int32_t seq_id = 0);
+    bool forward_with_audio(const int32_t * tokens, int32_t n_tokens,
+                            const float * audio_embd, int32_t n_audio,
+                            int32_t audio_start_pos, int32_t n_past,
+                            decoder_output & output, int32_t seq_id = 0);
+    
+    // forward_with_audio reading the audio embeddings from a device tensor
+    // [hidden_size, >= n_audio] (an AudioEncoder::encode_to_device output)
+    // inside the graph, so they never pass through host memory. The tensor's
+    // buffer type must pass can_read_buffer().
+    bool forward_with_audio_device(const int32_t * tokens, int32_t n_tokens,
+                                   struct ggml_tensor * audio, int32_t n_audio,
+                                   int32_t audio_start_pos, int32_t n_past,
+                                   decoder_output & output, int32_t seq_id = 0);
+    
+    // Element type of the host audio embeddings input of forward_with_audio:
+    // GGML_TYPE_F32, or GGML_TYPE_F16 to halve its upload (converted on the
+    // host, widened again in the graph). Device audio is always read as is.
+    void set_audio_input_type(enum ggml_type type) { audio_type_ = type; }
+    
+    // True when the decoder graph can read tensors in buffers of type buft
+    // in place (same device as the prompt layers)
+    bool can_read_buffer(ggml_backend_buffer_type_t buft) const;
+    
+    // One decode step for n_batch sequences in distinct slots: token b of
+    // slot seq_ids[b] goes to position n_past[b]. All sequences share one
+    // graph, so each weight matrix is read once per step for the batch.
+    // Sequences may join (after a prefill into their slot) or leave between
+    // steps. output: logits [n_batch, vocab_size]
+    bool forward_batch(const int32_t * seq_ids, const int32_t * tokens,
+                       const int32_t * n_past, int32_t n_batch,
+                       std::vector<float> & output);
+    bool forward_batch(const int32_t * seq_ids, const int32_t * tokens,
+                       const int32_t * n_past, int32_t n_batch,
+                       decoder_output & output);
     
     const text_decoder_config & get_config() const { return model_.config; }
     
@@ -143,17 +363,49 @@ public:
     
     std::string decode_tokens(const std::vector<int32_t> & tokens) const;
     
+    // Raw bytes of every token ID, decoded once at load time; special tokens
+    // are empty except the <asr_text> delimiter, which reads as "|"
+    const std::vector<std::string> & get_token_bytes() const { return token_bytes_; }
+    
+    // Encode plain text (no special tokens) with the model's byte-level BPE,
+    // appending token IDs to out; false if the GGUF carries no
+    // vocabulary or merge rules
+    bool encode_text(std::string_view text, std::vector<int32_t> & out);
+    
     bool forward_debug(const int32_t * tokens, int32_t n_tokens, int32_t n_past,
                        std::vector<float> & output,
                        std::map<std::string, std::vector<float>> & debug_tensors);
     
 private:
-    // Build computation graph for forward pass
-    struct ggml_cgraph * build_graph(const int32_t * tokens, int32_t n_tokens,
-                                     int32_t n_past,
-                                     const float * audio_embd = nullptr,
-                                     int32_t n_audio = 0,
-                                     int32_t audio_start_pos = 0);
+    // Build computation graph for forward pass into the meta buffer.
+    // New K/V rows are written at the rows in the "inp_kv_idx" input, so
+    // positions only affect input values, not the graph.
+    struct ggml_cgraph * build_graph(const decoder_graph_shape & shape,
+                                     std::vector<uint8_t> & meta);
+    
+    // Upload tokens, positions, KV rows and the causal mask; token q
+    // belongs to slot seq_ids[q] at position pos[q]
+    void set_graph_inputs(struct ggml_cgraph * gf, const decoder_graph_shape & shape,
+                          const int32_t * tokens, const int32_t * seq_ids,
+                          const int32_t * pos);
+    
+    // Copy the outputs requested in output from a computed graph
+    void read_graph_outputs(struct ggml_cgraph * gf, decoder_output & output);
+    
+    void invalidate_decode_graph();
+    
+    // Graph meta buffer of prompt graphs: the arena's when shared
+    std::vector<uint8_t> & compute_meta() { return state_.arena ? state_.arena->get_meta() : state_.compute_meta; }
+    
+    // KV row of position pos of slot seq_id
+    int64_t kv_row(int32_t seq_id, int32_t pos) const;
+    
+    // Paged mode: give slot seq_id private pages for the positions
+    // [pos_begin, pos_end) about to be written, copying shared ones
+    bool prepare_rows(int32_t seq_id, int32_t pos_begin, int32_t pos_end);
+    
+    void release_pages(int32_t seq_id, int32_t n_keep);
+    void end_paged();
     
     // Parse hyperparameters from GGUF
     bool parse_config(struct gguf_context * ctx);
@@ -161,22 +413,90 @@ private:
     // Create tensor structures
     bool create_tensors(struct gguf_context * ctx);
     
-    // Load tensor data from file
-    bool load_tensor_data(const std::string & path, struct gguf_context * ctx);
+    // Pick the GPUs for cpu_params and assign each layer to one of them
+    // (state_.layer_device); devs is empty when running on the CPU
+    bool select_devices(const cpu_backend_params & cpu_params, std::vector<ggml_backend_dev_t> & devs);
+    
+    // Point the tensors at their data in the file's mapping, placing each
+    // layer on its device
+    bool load_tensor_data(const std::shared_ptr<ModelFile> & file, struct gguf_context * ctx,
+                          const std::vector<ggml_backend_dev_t> & devs);
     
     bool load_vocab(struct gguf_context * ctx);
     
+    // Move the matmul weights into repacked CPU layouts (repack_cpu_weights)
+    bool repack_weights(const std::string & model_path, bool use_cache);
+    
     text_decoder_model model_;
     text_decoder_state state_;
     std::string error_msg_;
     std::vector<std::string> vocab_;
+    std::vector<std::string> token_bytes_;
+    BpeTokenizer tokenizer_;
+    enum ggml_type audio_type_ = GGML_TYPE_F32;
     // float temperature_ = 1.0f;
 };
 
+// Incremental detokenizer for generated tokens. Model output has the form
+// "language <Name>|<transcript>"; the header is consumed as it arrives and
+// only transcript text is returned, each push costing a table lookup plus
+// the token's bytes. Bytes of an incomplete UTF-8 sequence are held back
+// until the sequence is complete, so every returned delta is valid UTF-8.
+class StreamingDetokenizer {
+public:
+    explicit StreamingDetokenizer(const TextDecoder & decoder)
+        : token_bytes_(decoder.get_token_bytes()) {}
+    explicit StreamingDetokenizer(const std::vector<std::string> & token_bytes)
+        : token_bytes_(token_bytes) {}
+    
+    void reset();
+    
+    // Feed one token; returns the transcript text it completed. The view is
+    // valid until the next call.
+    std::string_view push(int32_t token_id);
+    
+    // End of hypothesis: settle the header and release held-back bytes
+    std::string_view finish();
+    
+    const std::string & language() const { return language_; }
+    const std::string & text() const { return text_; }
+    
+private:
+    std::string_view append_text(std::string_view bytes);
+    
+    const std::vector<std::string> & token_bytes_;
+    bool in_header_ = true;
+    std::string header_;
+    std::string text_;
+    size_t n_emitted_ = 0;
+    std::string language_ = "unknown";
+};
+
+// Prompt embeddings [hidden_size, n_tokens] assembled without concat: the
+// n_text text rows (token_embd rows of "inp_text_ids") and the audio frames
+// audio [hidden_size, n_tokens - n_text] (F32 or F16) are both written with
+// set_rows at the sequence positions in "inp_text_rows" / "inp_audio_rows",
+// so audio placeholders are never looked up. Shared by TextDecoder and
+// ForcedAligner; set_injection_inputs() fills the inputs.
+struct ggml_tensor * build_injected_embeddings(struct ggml_context * ctx,
+                                               struct ggml_tensor * token_embd,
+                                               struct ggml_tensor * audio,
+                                               int32_t n_tokens, int32_t n_text);
+
+// Upload the row inputs of build_injected_embeddings() for layout
+void set_injection_inputs(struct ggml_cgraph * gf, const injection_layout & layout);
+
+// Upload n_audio rows of host audio embeddings into an "inp_audio" input,
+// converting to F16 if that is its type
+void set_audio_input(struct ggml_tensor * inp_audio, const float * audio_embd, int32_t n_audio);
+
 // Free model resources
 void free_decoder_model(text_decoder_model & model);
 
 // Free KV cache resources
 void free_kv_cache(kv_cache & cache);
 
+// Free KV snapshot resources
+void free_kv_snapshot(kv_snapshot & snap);
+
 } // namespace qwen3_asr
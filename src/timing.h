@@ -1,14 +1,66 @@
 #pragma once
 
+#include "ggml.h"
+#include "ggml-backend.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <cstdio>
+#include <cstring>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
+
+// Events kept per thread; older events are overwritten (power of two)
+#define QWEN3_ASR_TRACE_CAPACITY 32768
+
+// Distinct span names aggregated per thread for the report
+#define QWEN3_ASR_TRACE_MAX_NAMES 128
 
 namespace qwen3_asr {
 
-#ifdef QWEN3_ASR_TIMING
+// One completed span. name and cat are string literals (or other static
+// strings), so recording never allocates.
+struct trace_event {
+    const char * name;
+    const char * cat;
+    int64_t t_start_us;
+    int64_t t_dur_us;
+    uint64_t request_id;
+};
+
+// Running total for one span name on one thread
+struct trace_stat {
+    const char * name = nullptr;
+    const char * cat = nullptr;
+    int64_t total_us = 0;
+    int64_t count = 0;
+};
+
+// Per-thread ring buffer. Only the owning thread writes; readers (report,
+// export, reset) must run while no traced work is in flight.
+struct trace_buffer {
+    std::array<trace_event, QWEN3_ASR_TRACE_CAPACITY> events;
+    std::array<trace_stat, QWEN3_ASR_TRACE_MAX_NAMES> stats;
+    std::atomic<uint64_t> head{0};
+    int32_t tid = 0;
+    bool in_use = false;
+
+    void clear() {
+        head.store(0, std::memory_order_relaxed);
+        stats.fill(trace_stat());
+    }
+};
 
+// Process-wide tracer. Spans (QWEN3_TIMER) are recorded only while it is
+// enabled; disabled, a span costs one relaxed atomic load. Every thread
+// writes its own ring buffer, so recording takes no lock. Buffers of
+// finished threads are handed to the next new thread, which keeps memory
+// bounded by the number of concurrent threads.
 class TimingProfiler {
 public:
     static TimingProfiler & instance() {
@@ -16,17 +68,76 @@ public:
         return profiler;
     }
 
-    void record(const std::string & name, int64_t duration_us) {
-        auto & entry = timings_[name];
-        entry.first += duration_us;
-        entry.second += 1;
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+    static void set_enabled(bool enabled) { enabled_.store(enabled, std::memory_order_relaxed); }
+
+    // Also record one event per ggml graph node (see sched_graph_compute).
+    // Nodes are then computed one at a time, so this slows inference down.
+    static bool graph_events() { return enabled() && graph_events_.load(std::memory_order_relaxed); }
+    static void set_graph_events(bool enabled) { graph_events_.store(enabled, std::memory_order_relaxed); }
+
+    static int64_t now_us() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - epoch()).count();
+    }
+
+    // Request tag of the spans recorded on this thread (0 = none)
+    static uint64_t & current_request() {
+        thread_local uint64_t request_id = 0;
+        return request_id;
+    }
+
+    uint64_t new_request_id() { return ++next_request_id_; }
+
+    void record(const char * name, const char * cat, int64_t t_start_us, int64_t t_dur_us) {
+        trace_buffer * buf = local_buffer();
+        const uint64_t idx = buf->head.load(std::memory_order_relaxed);
+        buf->events[idx & (QWEN3_ASR_TRACE_CAPACITY - 1)] = {name, cat, t_start_us, t_dur_us, current_request()};
+        buf->head.store(idx + 1, std::memory_order_release);
+
+        // Open addressing on the name pointer; a full table drops the total
+        size_t slot = (reinterpret_cast<uintptr_t>(name) >> 3) % QWEN3_ASR_TRACE_MAX_NAMES;
+        for (int probe = 0; probe < QWEN3_ASR_TRACE_MAX_NAMES; ++probe) {
+            trace_stat & st = buf->stats[slot];
+            if (st.name == name || st.name == nullptr) {
+                st.name = name;
+                st.cat = cat;
+                st.total_us += t_dur_us;
+                st.count += 1;
+                break;
+            }
+            slot = (slot + 1) % QWEN3_ASR_TRACE_MAX_NAMES;
+        }
     }
 
     void reset() {
-        timings_.clear();
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto & buf : buffers_) {
+            buf->clear();
+        }
+    }
+
+    // Total microseconds and span count by name over all threads (equal
+    // literals from different translation units may have different
+    // addresses); graph node spans are prefixed "ggml."
+    std::map<std::string, std::pair<int64_t, int64_t>> totals() const {
+        std::map<std::string, std::pair<int64_t, int64_t>> timings;
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto & buf : buffers_) {
+            for (const auto & st : buf->stats) {
+                if (st.name) {
+                    auto & entry = timings[std::string(st.cat) == "ggml" ? std::string("ggml.") + st.name : st.name];
+                    entry.first += st.total_us;
+                    entry.second += st.count;
+                }
+            }
+        }
+        return timings;
     }
 
     void print_report() const {
+        const std::map<std::string, std::pair<int64_t, int64_t>> timings = totals(); // total_us, count
+
         fprintf(stderr, "\n");
         fprintf(stderr, "================================================================================\n");
         fprintf(stderr, "                         TIMING PROFILE REPORT\n");
@@ -34,7 +145,7 @@ public:
         fprintf(stderr, "%-45s %12s %8s %12s\n", "Section", "Total (ms)", "Calls", "Avg (ms)");
         fprintf(stderr, "--------------------------------------------------------------------------------\n");
 
-        for (const auto & entry : timings_) {
+        for (const auto & entry : timings) {
             double total_ms = entry.second.first / 1000.0;
             int64_t calls = entry.second.second;
             double avg_ms = calls > 0 ? total_ms / calls : 0.0;
@@ -45,38 +156,212 @@ public:
         fprintf(stderr, "================================================================================\n");
     }
 
+    // Write the buffered events as Chrome trace JSON (chrome://tracing,
+    // ui.perfetto.dev): one "X" event per span, the request ID in args
+    bool export_chrome_trace(const std::string & path) const {
+        FILE * out = fopen(path.c_str(), "w");
+        if (!out) {
+            return false;
+        }
+
+        fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        bool first = true;
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto & buf : buffers_) {
+            const uint64_t head = buf->head.load(std::memory_order_acquire);
+            const uint64_t begin = head > QWEN3_ASR_TRACE_CAPACITY ? head - QWEN3_ASR_TRACE_CAPACITY : 0;
+            if (begin == head) {
+                continue;
+            }
+            fprintf(out, "%s{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": %d, "
+                    "\"args\": {\"name\": \"thread %d\"}}", first ? "" : ",\n", buf->tid, buf->tid);
+            first = false;
+            for (uint64_t i = begin; i < head; ++i) {
+                const trace_event & e = buf->events[i & (QWEN3_ASR_TRACE_CAPACITY - 1)];
+                fprintf(out, ",\n{\"ph\": \"X\", \"name\": \"%s\", \"cat\": \"%s\", \"ts\": %lld, \"dur\": %lld, "
+                        "\"pid\": 1, \"tid\": %d, \"args\": {\"request\": %llu}}",
+                        e.name, e.cat, (long long)e.t_start_us, (long long)e.t_dur_us, buf->tid,
+                        (unsigned long long)e.request_id);
+            }
+        }
+        fprintf(out, "\n]}\n");
+
+        const bool ok = ferror(out) == 0;
+        fclose(out);
+        return ok;
+    }
+
+    // ggml_backend_sched eval callback: observe every node and record the
+    // time since the previous one as that node's span
+    static bool eval_callback(struct ggml_tensor * t, bool ask, void * user_data) {
+        (void)user_data;
+        if (ask) {
+            return true;
+        }
+        const int64_t now = now_us();
+        int64_t & last = last_node_us();
+        instance().record(ggml_op_desc(t), "ggml", last, now - last);
+        last = now;
+        return true;
+    }
+
+    static int64_t & last_node_us() {
+        thread_local int64_t t_us = 0;
+        return t_us;
+    }
+
 private:
     TimingProfiler() = default;
-    std::map<std::string, std::pair<int64_t, int64_t>> timings_; // total_us, count
+
+    static std::chrono::steady_clock::time_point epoch() {
+        static const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        return t0;
+    }
+
+    // Hands the thread's buffer back when the thread exits
+    struct buffer_holder {
+        trace_buffer * buf = nullptr;
+        ~buffer_holder() {
+            if (buf) {
+                instance().release_buffer(buf);
+            }
+        }
+    };
+
+    static trace_buffer * local_buffer() {
+        thread_local buffer_holder holder;
+        if (!holder.buf) {
+            holder.buf = instance().acquire_buffer();
+        }
+        return holder.buf;
+    }
+
+    trace_buffer * acquire_buffer() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto & buf : buffers_) {
+            if (!buf->in_use) {
+                buf->in_use = true;
+                return buf.get();
+            }
+        }
+        buffers_.emplace_back(new trace_buffer());
+        trace_buffer * buf = buffers_.back().get();
+        buf->tid = (int32_t)buffers_.size();
+        buf->in_use = true;
+        return buf;
+    }
+
+    void release_buffer(trace_buffer * buf) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        buf->in_use = false;
+    }
+
+    static inline std::atomic<bool> enabled_{
+#ifdef QWEN3_ASR_TIMING
+        true
+#else
+        false
+#endif
+    };
+    static inline std::atomic<bool> graph_events_{false};
+
+    std::atomic<uint64_t> next_request_id_{0};
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<trace_buffer>> buffers_;
 };
 
 class ScopedTimer {
 public:
-    ScopedTimer(const std::string & name)
+    explicit ScopedTimer(const char * name)
         : name_(name)
-        , start_(std::chrono::high_resolution_clock::now()) {}
+        , start_us_(TimingProfiler::enabled() ? TimingProfiler::now_us() : -1) {}
 
     ~ScopedTimer() {
-        auto end = std::chrono::high_resolution_clock::now();
-        auto duration_us = std::chrono::duration_cast<std::chrono::microseconds>(end - start_).count();
-        TimingProfiler::instance().record(name_, duration_us);
+        if (start_us_ >= 0) {
+            TimingProfiler::instance().record(name_, "qwen3_asr", start_us_, TimingProfiler::now_us() - start_us_);
+        }
     }
 
 private:
-    std::string name_;
-    std::chrono::high_resolution_clock::time_point start_;
+    const char * name_;
+    int64_t start_us_;
 };
 
-#define QWEN3_TIMER(name) qwen3_asr::ScopedTimer _timer_##__LINE__(name)
-#define QWEN3_TIMER_RESET() qwen3_asr::TimingProfiler::instance().reset()
-#define QWEN3_TIMER_REPORT() qwen3_asr::TimingProfiler::instance().print_report()
+// Tags the spans of this thread with a request ID for the current scope.
+// The default constructor starts a new request unless one is already set,
+// so nested API calls stay part of the outer request.
+class TraceRequestScope {
+public:
+    TraceRequestScope() : prev_(TimingProfiler::current_request()) {
+        if (prev_ == 0) {
+            TimingProfiler::current_request() = TimingProfiler::instance().new_request_id();
+        }
+    }
 
-#else
+    explicit TraceRequestScope(uint64_t request_id) : prev_(TimingProfiler::current_request()) {
+        TimingProfiler::current_request() = request_id;
+    }
 
-#define QWEN3_TIMER(name) ((void)0)
-#define QWEN3_TIMER_RESET() ((void)0)
-#define QWEN3_TIMER_REPORT() ((void)0)
+    ~TraceRequestScope() { TimingProfiler::current_request() = prev_; }
 
-#endif
+private:
+    uint64_t prev_;
+};
+
+// Process-wide observer of graph nodes, installed by sched_graph_compute
+// next to the trace events (used by ImatrixCollector). It is called with
+// ask = false also for nodes it declined while graph events are on, so it
+// must re-check its filter. Change it only while no graph is computing.
+struct graph_observer {
+    ggml_backend_sched_eval_callback callback = nullptr;
+    void * user_data = nullptr;
+
+    static graph_observer & instance() {
+        static graph_observer observer;
+        return observer;
+    }
+
+    static bool eval_callback(struct ggml_tensor * t, bool ask, void * user_data) {
+        const graph_observer & obs = instance();
+        const bool trace = TimingProfiler::graph_events();
+        if (ask) {
+            const bool want = obs.callback && obs.callback(t, true, obs.user_data);
+            return trace || want;
+        }
+        if (trace) {
+            TimingProfiler::eval_callback(t, false, user_data);
+        }
+        if (obs.callback) {
+            obs.callback(t, false, obs.user_data);
+        }
+        return true;
+    }
+};
+
+// ggml_backend_sched_graph_compute, plus one trace event per graph node
+// when TimingProfiler::graph_events() is on, and the graph_observer
+inline enum ggml_status sched_graph_compute(ggml_backend_sched_t sched, struct ggml_cgraph * graph) {
+    if (!TimingProfiler::graph_events() && !graph_observer::instance().callback) {
+        return ggml_backend_sched_graph_compute(sched, graph);
+    }
+    ggml_backend_sched_set_eval_callback(sched, graph_observer::eval_callback, nullptr);
+    TimingProfiler::last_node_us() = TimingProfiler::now_us();
+    enum ggml_status status = ggml_backend_sched_graph_compute(sched, graph);
+    ggml_backend_sched_set_eval_callback(sched, nullptr, nullptr);
+    return status;
+}
+
+#define QWEN3_TIMER_CAT_(a, b) a##b
+#define QWEN3_TIMER_CAT(a, b) QWEN3_TIMER_CAT_(a, b)
+
+// name must be a string literal
+#define QWEN3_TIMER(name) qwen3_asr::ScopedTimer QWEN3_TIMER_CAT(_timer_, __LINE__)("" name "")
+#define QWEN3_TIMER_RESET() qwen3_asr::TimingProfiler::instance().reset()
+#define QWEN3_TIMER_REPORT() qwen3_asr::TimingProfiler::instance().print_report()
+
+// Tag spans with a new request ID (kept if the caller already set one),
+// or with a given one, e.g. on worker threads of the same request
+#define QWEN3_TRACE_REQUEST() qwen3_asr::TraceRequestScope QWEN3_TIMER_CAT(_trace_request_, __LINE__)
+#define QWEN3_TRACE_REQUEST_ID(id) qwen3_asr::TraceRequestScope QWEN3_TIMER_CAT(_trace_request_, __LINE__)(id)
 
 } // namespace qwen3_asr
@@ -0,0 +1,113 @@
+#include "vad.h"
+
+#include <algorithm>
+
+// Duration of one mel frame (QWEN_HOP_LENGTH at QWEN_SAMPLE_RATE)
+#define QWEN3_ASR_VAD_FRAME_MS 10
+
+// Frame energies are averaged over this many neighbouring frames
+#define QWEN3_ASR_VAD_SMOOTH 5
+
+namespace qwen3_asr {
+
+static float percentile(std::vector<float> values, float p) {
+    const size_t k = (size_t)(p * (values.size() - 1));
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+std::vector<speech_segment> detect_speech_segments(const MelSpectrogram & mel,
+                                                   const vad_params & params) {
+    std::vector<speech_segment> segments;
+    const int32_t n = mel.n_len;
+    if (n <= 0 || mel.n_mel <= 0) {
+        return segments;
+    }
+    
+    // Mean log-mel per frame, then a centred moving average
+    std::vector<double> prefix(n + 1, 0.0);
+    {
+        std::vector<float> energy(n, 0.0f);
+        for (int32_t j = 0; j < mel.n_mel; ++j) {
+            const float * row = mel.data.data() + (size_t)j * n;
+            for (int32_t i = 0; i < n; ++i) {
+                energy[i] += row[i];
+            }
+        }
+        for (int32_t i = 0; i < n; ++i) {
+            prefix[i + 1] = prefix[i] + energy[i] / mel.n_mel;
+        }
+    }
+    std::vector<float> smooth(n);
+    const int32_t half = QWEN3_ASR_VAD_SMOOTH / 2;
+    for (int32_t i = 0; i < n; ++i) {
+        const int32_t lo = std::max(0, i - half);
+        const int32_t hi = std::min(n, i + half + 1);
+        smooth[i] = (float)((prefix[hi] - prefix[lo]) / (hi - lo));
+    }
+    
+    const float floor_e = percentile(smooth, 0.10f);
+    const float peak_e = percentile(smooth, 0.99f);
+    
+    std::vector<speech_segment> runs;
+    if (peak_e - floor_e < params.min_dynamic_range) {
+        runs.push_back({0, n});
+    } else {
+        const float threshold = floor_e + params.threshold * (peak_e - floor_e);
+        const int32_t min_speech = params.min_speech_ms / QWEN3_ASR_VAD_FRAME_MS;
+        const int32_t min_silence = params.min_silence_ms / QWEN3_ASR_VAD_FRAME_MS;
+        const int32_t pad = params.pad_ms / QWEN3_ASR_VAD_FRAME_MS;
+        
+        // Frames above the threshold, with short silences bridged
+        std::vector<speech_segment> active;
+        int32_t start = -1;
+        for (int32_t i = 0; i <= n; ++i) {
+            const bool speech = i < n && smooth[i] > threshold;
+            if (speech && start < 0) {
+                start = i;
+            } else if (!speech && start >= 0) {
+                if (!active.empty() && start - active.back().end_frame < min_silence) {
+                    active.back().end_frame = i;
+                } else {
+                    active.push_back({start, i});
+                }
+                start = -1;
+            }
+        }
+        
+        // Drop short bursts, pad the rest and merge padding overlaps
+        for (const auto & r : active) {
+            if (r.end_frame - r.start_frame < min_speech) {
+                continue;
+            }
+            speech_segment s = {std::max(0, r.start_frame - pad), std::min(n, r.end_frame + pad)};
+            if (!runs.empty() && s.start_frame <= runs.back().end_frame) {
+                runs.back().end_frame = s.end_frame;
+            } else {
+                runs.push_back(s);
+            }
+        }
+    }
+    
+    // Enforce the length limit, cutting where the audio is quietest
+    const int32_t max_frames = std::max(2, (int32_t)(params.max_segment_sec * 1000.0f / QWEN3_ASR_VAD_FRAME_MS));
+    for (speech_segment r : runs) {
+        while (r.end_frame - r.start_frame > max_frames) {
+            const int32_t lo = r.start_frame + max_frames / 2;
+            const int32_t hi = r.start_frame + max_frames;
+            int32_t cut = lo;
+            for (int32_t i = lo + 1; i < hi; ++i) {
+                if (smooth[i] < smooth[cut]) {
+                    cut = i;
+                }
+            }
+            segments.push_back({r.start_frame, cut});
+            r.start_frame = cut;
+        }
+        segments.push_back(r);
+    }
+    
+    return segments;
+}
+
+} // namespace qwen3_asr
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "mel_spectrogram.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace qwen3_asr {
+
+// Energy-based voice activity detection on log-mel frames (10 ms each).
+// A frame is speech when its mean log-mel value is above
+//   floor + threshold * (peak - floor)
+// where floor and peak are the 10th and 99th percentiles over the input.
+struct vad_params {
+    // Position of the speech threshold between the noise floor and the peak
+    float threshold = 0.3f;
+    
+    // Speech runs shorter than this are dropped
+    int32_t min_speech_ms = 250;
+    
+    // Silences shorter than this do not split speech
+    int32_t min_silence_ms = 300;
+    
+    // Audio kept on each side of a speech run
+    int32_t pad_ms = 100;
+    
+    // Longer segments are cut at the quietest frame of their second half
+    float max_segment_sec = (float)QWEN_CHUNK_SIZE;
+    
+    // Below this peak-to-floor range (normalized log-mel units) the input
+    // has no usable contrast and is returned as speech in full
+    float min_dynamic_range = 0.1f;
+};
+
+// Half-open range of mel frames [start_frame, end_frame)
+struct speech_segment {
+    int32_t start_frame = 0;
+    int32_t end_frame = 0;
+};
+
+// Speech segments of mel in time order, each at most max_segment_sec long.
+// Returns no segments when the input is empty.
+std::vector<speech_segment> detect_speech_segments(const MelSpectrogram & mel,
+                                                   const vad_params & params = vad_params());
+
+} // namespace qwen3_asr
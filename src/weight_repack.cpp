@@ -0,0 +1,300 @@
+#include "weight_repack.h"
+#include "cpu_backend.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define QWEN3_REPACK_CACHE_MAGIC "QRP1"
+
+// Activation rows of the matmul that asks a buffer type whether it takes a
+// weight; prompt-sized, as some kernels are only used for batches
+#define QWEN3_REPACK_PROBE_ROWS 512
+
+namespace qwen3_asr {
+
+namespace {
+
+// Cache file: header, one entry per tensor in repack order, then the data
+// of each entry back to back. The header and entry table are a pure
+// function of the model file, the CPU backend and the tensors, so a cache
+// is valid exactly when they are bytewise equal to the expected ones.
+struct cache_header {
+    char magic[4];
+    uint32_t header_size;
+    uint64_t model_size;
+    int64_t model_mtime;
+    uint64_t cpu_key;
+    uint64_t n_tensors;
+};
+
+struct cache_entry {
+    char name[GGML_MAX_NAME];
+    uint64_t offset;    // of the data, from the start of the file
+    uint64_t size;
+};
+
+struct repack_group {
+    ggml_backend_buffer_type_t buft = nullptr;
+    std::vector<struct ggml_tensor *> tensors;
+    std::vector<const uint8_t *> sources;   // the tensor data in the mapping
+    std::vector<ggml_backend_buffer_t> source_buffers;
+};
+
+uint64_t fnv1a(uint64_t h, const char * s) {
+    for (; s && *s; ++s) {
+        h ^= (uint8_t)*s;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// The repacked layout depends on the extra buffer types and on the CPU
+// features the backend runs with (e.g. 8x8 blocks with AVX2, 4x8 with NEON)
+uint64_t cpu_key(ggml_backend_reg_t reg, ggml_backend_buffer_type_t * bufts) {
+    uint64_t h = 14695981039346656037ULL;
+    for (ggml_backend_buffer_type_t * buft = bufts; *buft; ++buft) {
+        h = fnv1a(h, ggml_backend_buft_name(*buft));
+    }
+    auto get_features = (ggml_backend_get_features_t)ggml_backend_reg_get_proc_address(reg, "ggml_backend_get_features");
+    if (get_features) {
+        for (struct ggml_backend_feature * f = get_features(reg); f->name; ++f) {
+            h = fnv1a(h, f->name);
+            h = fnv1a(h, f->value);
+        }
+    }
+    return h;
+}
+
+// Whether buft can hold w for a matmul on dev: asks the device about a
+// matmul whose weight lives in an (empty) buffer of buft
+bool supports_matmul(ggml_backend_dev_t dev, ggml_backend_buffer_type_t buft, const struct ggml_tensor * w) {
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ 4 * ggml_tensor_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+    struct ggml_context * ctx = ggml_init(params);
+    if (!ctx) {
+        return false;
+    }
+    struct ggml_tensor * weight = ggml_new_tensor(ctx, w->type, GGML_MAX_DIMS, w->ne);
+    struct ggml_tensor * input = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, w->ne[0], QWEN3_REPACK_PROBE_ROWS);
+    struct ggml_tensor * op = ggml_mul_mat(ctx, weight, input);
+
+    bool ok = false;
+    ggml_backend_buffer_t probe = ggml_backend_buft_alloc_buffer(buft, 0);
+    if (probe) {
+        weight->buffer = probe;
+        ok = ggml_backend_dev_supports_op(dev, op);
+        ggml_backend_buffer_free(probe);
+    }
+    ggml_free(ctx);
+    return ok;
+}
+
+// Header and entry table the cache of groups must start with
+std::vector<uint8_t> cache_layout(const std::string & model_path, uint64_t key,
+                                  const std::vector<repack_group> & groups, size_t & total_size) {
+    struct stat st;
+    if (stat(model_path.c_str(), &st) != 0) {
+        return {};
+    }
+
+    size_t n_tensors = 0;
+    for (const auto & group : groups) {
+        n_tensors += group.tensors.size();
+    }
+
+    std::vector<cache_entry> entries;
+    size_t offset = sizeof(cache_header) + n_tensors * sizeof(cache_entry);
+    for (const auto & group : groups) {
+        for (const struct ggml_tensor * t : group.tensors) {
+            cache_entry entry;
+            memset(&entry, 0, sizeof(entry));
+            strncpy(entry.name, t->name, sizeof(entry.name) - 1);
+            entry.offset = offset;
+            entry.size = ggml_backend_buft_get_alloc_size(group.buft, t);
+            offset += entry.size;
+            entries.push_back(entry);
+        }
+    }
+
+    cache_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, QWEN3_REPACK_CACHE_MAGIC, 4);
+    hdr.header_size = sizeof(hdr);
+    hdr.model_size = st.st_size;
+    hdr.model_mtime = st.st_mtime;
+    hdr.cpu_key = key;
+    hdr.n_tensors = n_tensors;
+
+    std::vector<uint8_t> layout(sizeof(hdr) + entries.size() * sizeof(cache_entry));
+    memcpy(layout.data(), &hdr, sizeof(hdr));
+    memcpy(layout.data() + sizeof(hdr), entries.data(), entries.size() * sizeof(cache_entry));
+    total_size = offset;
+    return layout;
+}
+
+// Mapping of the cache file at path if it has the expected layout
+const uint8_t * map_cache(const std::string & path, const std::vector<uint8_t> & layout, size_t total_size) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != total_size) {
+        close(fd);
+        return nullptr;
+    }
+    void * addr = mmap(nullptr, total_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return nullptr;
+    }
+    if (memcmp(addr, layout.data(), layout.size()) != 0) {
+        munmap(addr, total_size);
+        return nullptr;
+    }
+    madvise(addr, total_size, MADV_SEQUENTIAL);
+    return static_cast<const uint8_t *>(addr);
+}
+
+// Written to a temporary name and renamed, so a concurrent load never
+// sees a partial file
+bool write_cache(const std::string & path, const std::vector<uint8_t> & layout,
+                 const std::vector<repack_group> & groups) {
+    const std::string tmp = path + ".tmp." + std::to_string((long)getpid());
+    FILE * f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    bool ok = fwrite(layout.data(), 1, layout.size(), f) == layout.size();
+    for (const auto & group : groups) {
+        for (const struct ggml_tensor * t : group.tensors) {
+            // Extra buffers of the CPU backend are plain host memory, even
+            // where the buffer type does not report itself as host
+            const size_t size = ggml_backend_buft_get_alloc_size(group.buft, t);
+            ok = ok && fwrite(t->data, 1, size, f) == size;
+        }
+    }
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+bool repack_cpu_weights(const std::vector<struct ggml_tensor *> & tensors,
+                        const std::string & model_path, const std::string & cache_path,
+                        std::vector<ggml_backend_buffer_t> & buffers,
+                        repack_stats & stats, std::string & error_msg) {
+    stats = repack_stats();
+
+    ggml_backend_dev_t dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+    ggml_backend_reg_t reg = dev ? ggml_backend_dev_backend_reg(dev) : nullptr;
+    auto get_extra_bufts = reg ? (ggml_backend_dev_get_extra_bufts_t)
+        ggml_backend_reg_get_proc_address(reg, "ggml_backend_dev_get_extra_bufts") : nullptr;
+    ggml_backend_buffer_type_t * extra = get_extra_bufts ? get_extra_bufts(dev) : nullptr;
+    if (!extra || !*extra) {
+        // This build of the CPU backend has no repacked layouts
+        return true;
+    }
+
+    std::vector<repack_group> groups;
+    for (ggml_backend_buffer_type_t * buft = extra; *buft; ++buft) {
+        groups.emplace_back();
+        groups.back().buft = *buft;
+    }
+
+    std::vector<const struct ggml_tensor *> seen;
+    for (struct ggml_tensor * t : tensors) {
+        if (!t || !t->buffer || !ggml_backend_buffer_is_host(t->buffer) ||
+            !ggml_is_quantized(t->type) || ggml_n_dims(t) != 2 ||
+            std::find(seen.begin(), seen.end(), t) != seen.end()) {
+            continue;
+        }
+        seen.push_back(t);
+        for (auto & group : groups) {
+            if (supports_matmul(dev, group.buft, t)) {
+                group.tensors.push_back(t);
+                group.sources.push_back(static_cast<const uint8_t *>(t->data));
+                group.source_buffers.push_back(t->buffer);
+                break;
+            }
+        }
+    }
+    groups.erase(std::remove_if(groups.begin(), groups.end(),
+                                [](const repack_group & g) { return g.tensors.empty(); }),
+                 groups.end());
+    if (groups.empty()) {
+        return true;
+    }
+
+    size_t cache_size = 0;
+    std::vector<uint8_t> layout;
+    const uint8_t * cache = nullptr;
+    if (!cache_path.empty()) {
+        layout = cache_layout(model_path, cpu_key(reg, extra), groups, cache_size);
+        cache = layout.empty() ? nullptr : map_cache(cache_path, layout, cache_size);
+    }
+
+    const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    size_t data_offset = layout.size();
+    for (auto & group : groups) {
+        for (struct ggml_tensor * t : group.tensors) {
+            t->buffer = nullptr;
+            t->data = nullptr;
+        }
+        ggml_backend_buffer_t buffer = alloc_tensor_buffer(group.buft, group.tensors);
+        if (!buffer) {
+            for (size_t i = 0; i < group.tensors.size(); ++i) {
+                group.tensors[i]->buffer = group.source_buffers[i];
+                group.tensors[i]->data = const_cast<uint8_t *>(group.sources[i]);
+            }
+            error_msg = std::string("Failed to allocate repacked weights (") + ggml_backend_buft_name(group.buft) + ")";
+            if (cache) {
+                munmap(const_cast<uint8_t *>(cache), cache_size);
+            }
+            return false;
+        }
+        ggml_backend_buffer_set_usage(buffer, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+        buffers.push_back(buffer);
+
+        for (size_t i = 0; i < group.tensors.size(); ++i) {
+            struct ggml_tensor * t = group.tensors[i];
+            const uint8_t * src = group.sources[i];
+            const size_t nbytes = ggml_nbytes(t);
+            if (cache) {
+                const size_t size = ggml_backend_buft_get_alloc_size(group.buft, t);
+                memcpy(t->data, cache + data_offset, size);
+                data_offset += size;
+            } else {
+                // set_tensor of an extra buffer converts to its layout
+                ggml_backend_tensor_set(t, src, 0, nbytes);
+            }
+            stats.n_tensors++;
+            stats.bytes += nbytes;
+
+            // The mapped original is not read again
+            const uintptr_t begin = (uintptr_t)src & ~(page - 1);
+            madvise((void *)begin, (uintptr_t)src + nbytes - begin, MADV_DONTNEED);
+        }
+    }
+    if (cache) {
+        munmap(const_cast<uint8_t *>(cache), cache_size);
+        stats.from_cache = true;
+    } else if (!layout.empty() && !write_cache(cache_path, layout, groups)) {
+        fprintf(stderr, "Warning: failed to write repacked weights to %s\n", cache_path.c_str());
+    }
+    return true;
+}
+
+} // namespace qwen3_asr
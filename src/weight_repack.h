@@ -0,0 +1,40 @@
+#pragma once
+
+#include "ggml.h"
+#include "ggml-backend.h"
+
+#include <string>
+#include <vector>
+
+namespace qwen3_asr {
+
+// Outcome of repack_cpu_weights
+struct repack_stats {
+    size_t n_tensors = 0;   // tensors moved into repacked buffers
+    size_t bytes = 0;
+    bool from_cache = false;
+};
+
+// Move quantized matmul weights that run on the CPU into the CPU backend's
+// extra buffer types (the repacked, interleaved layouts its fastest kernels
+// read, e.g. Q4_0 8x8 with AVX2/AVX-512 or 4x8 with NEON i8mm). Each tensor
+// goes to the first extra buffer type that can run a matmul with it, and
+// the scheduler then assigns those matmuls to the CPU backend by buffer
+// type; tensors no buffer type takes stay in the mapping. Only pass weights
+// consumed by ggml_mul_mat alone: repacked data cannot be read back.
+//
+// The new buffers are appended to buffers and owned by the caller.
+// With a cache_path the repacked data is read from that file when it was
+// written for the same model file, tensors and CPU features, and written
+// there otherwise (best effort: a failed write only prints a warning).
+bool repack_cpu_weights(const std::vector<struct ggml_tensor *> & tensors,
+                        const std::string & model_path, const std::string & cache_path,
+                        std::vector<ggml_backend_buffer_t> & buffers,
+                        repack_stats & stats, std::string & error_msg);
+
+// Cache file of one component's repacked weights, next to the model
+inline std::string repack_cache_path(const std::string & model_path, const char * component) {
+    return model_path + "." + component + ".repack";
+}
+
+} // namespace qwen3_asr
@@ -0,0 +1,97 @@
+#include "../src/forced_aligner.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Windowed alignment (inputs longer than one alignment window) where whole
+// windows' worth of text has nothing to align: runs of pure punctuation
+// between the words, and a text with no alignable word at all. Uses
+// synthetic encoder output through align_encoded, so only the aligner's
+// decoder runs; the check is that every kept word comes out once, in
+// order, on a monotonic timeline inside the audio.
+
+// Mel frames per second, and conv output frames per 100-frame mel chunk
+#define FRAMES_PER_SEC 100
+#define CHUNK_OUT 13
+
+int main(int argc, char ** argv) {
+    std::string model_path = "models/qwen3-forced-aligner-0.6b-f16.gguf";
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--model") == 0 && i + 1 < argc) {
+            model_path = argv[++i];
+        }
+    }
+
+    printf("=== Forced Aligner Window Test ===\n");
+
+    qwen3_asr::ForcedAligner fa;
+    if (!fa.load_model(model_path)) {
+        fprintf(stderr, "Failed to load model: %s\n", fa.get_error().c_str());
+        return 1;
+    }
+
+    // 150 s: three alignment windows
+    const float duration = 150.0f;
+    const int32_t n_mel_frames = (int32_t) duration * FRAMES_PER_SEC;
+    const int32_t n_audio_frames = n_mel_frames / 100 * CHUNK_OUT;
+    const int32_t hidden = fa.get_hparams().text_hidden_size;
+    std::vector<float> features((size_t) n_audio_frames * hidden);
+    for (size_t i = 0; i < features.size(); ++i) {
+        features[i] = 0.01f * (float) ((i * 37) % 101) - 0.5f;
+    }
+
+    bool ok = true;
+
+    // A few words, each followed by more punctuation-only words than fit
+    // in a window's text share
+    std::vector<std::string> expected;
+    std::string text;
+    const char * real_words[] = {"alpha", "bravo", "charlie", "delta"};
+    for (const char * w : real_words) {
+        text += std::string(w) + " ";
+        expected.push_back(w);
+        for (int i = 0; i < 300; ++i) {
+            text += "-- ";
+        }
+    }
+
+    qwen3_asr::alignment_result result =
+        fa.align_encoded(features.data(), n_audio_frames, n_mel_frames, duration, text, "English");
+    if (!result.success) {
+        fprintf(stderr, "FAILED: align_encoded: %s\n", result.error_msg.c_str());
+        return 1;
+    }
+    if (result.words.size() != expected.size()) {
+        fprintf(stderr, "FAILED: %zu aligned words, expected %zu\n", result.words.size(), expected.size());
+        ok = false;
+    } else {
+        float prev_end = 0.0f;
+        for (size_t i = 0; i < expected.size(); ++i) {
+            const auto & w = result.words[i];
+            printf("  %-8s %7.2f - %7.2f\n", w.word.c_str(), w.start, w.end);
+            if (w.word != expected[i] || w.start < prev_end || w.end < w.start || w.end > duration) {
+                fprintf(stderr, "FAILED: word %zu (\"%s\") out of order or outside the audio\n",
+                        i, w.word.c_str());
+                ok = false;
+            }
+            prev_end = w.end;
+        }
+    }
+
+    // Nothing alignable at all
+    result = fa.align_encoded(features.data(), n_audio_frames, n_mel_frames, duration, "-- ... ! ?", "English");
+    if (!result.success || !result.words.empty()) {
+        fprintf(stderr, "FAILED: punctuation-only text: success %d, %zu words\n",
+                (int) result.success, result.words.size());
+        ok = false;
+    }
+
+    if (!ok) {
+        printf("\nTEST FAILED!\n");
+        return 1;
+    }
+    printf("\nTEST PASSED!\n");
+    return 0;
+}
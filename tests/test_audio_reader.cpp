@@ -0,0 +1,225 @@
+#include "../src/audio_reader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Test tone: well below the 8 kHz Nyquist limit of the 16 kHz output
+#define TEST_FREQ_HZ 440.0
+#define TEST_AMPLITUDE 0.5
+#define TEST_DURATION_SEC 1.5
+
+struct wav_case {
+    const char * name;
+    int sample_rate;
+    int channels;
+    int bits;
+    bool is_float;
+    bool extensible;
+};
+
+static void put_u16(std::vector<uint8_t> & buf, uint16_t v) {
+    buf.push_back(v & 0xFF);
+    buf.push_back(v >> 8);
+}
+
+static void put_u32(std::vector<uint8_t> & buf, uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+        buf.push_back((v >> (8 * i)) & 0xFF);
+    }
+}
+
+static void put_sample(std::vector<uint8_t> & buf, double v, int bits, bool is_float) {
+    if (is_float && bits == 32) {
+        float f = (float)v;
+        uint32_t u;
+        memcpy(&u, &f, 4);
+        put_u32(buf, u);
+    } else if (is_float) {
+        uint64_t u;
+        memcpy(&u, &v, 8);
+        put_u32(buf, (uint32_t)u);
+        put_u32(buf, (uint32_t)(u >> 32));
+    } else if (bits == 8) {
+        buf.push_back((uint8_t)std::lround(v * 127.0 + 128.0));
+    } else {
+        const int64_t q = std::llround(v * ((1LL << (bits - 1)) - 1));
+        for (int i = 0; i < bits / 8; ++i) {
+            buf.push_back((uint8_t)((uint64_t)q >> (8 * i)));
+        }
+    }
+}
+
+// Channel 0 carries twice the tone, channel 1 silence and the rest the
+// tone, so the downmix of any channel count is the tone itself
+static bool write_wav(const std::string & path, const wav_case & c, int n_frames) {
+    std::vector<uint8_t> data;
+    for (int i = 0; i < n_frames; ++i) {
+        const double v = TEST_AMPLITUDE * sin(2.0 * M_PI * TEST_FREQ_HZ * i / c.sample_rate);
+        for (int ch = 0; ch < c.channels; ++ch) {
+            const double s = c.channels == 1 ? v : (ch == 0 ? 2.0 * v : (ch == 1 ? 0.0 : v));
+            put_sample(data, s, c.bits, c.is_float);
+        }
+    }
+
+    std::vector<uint8_t> buf;
+    const uint16_t block_align = (uint16_t)(c.channels * c.bits / 8);
+    const uint32_t fmt_size = c.extensible ? 40 : 16;
+    buf.insert(buf.end(), {'R', 'I', 'F', 'F'});
+    put_u32(buf, 4 + (8 + fmt_size) + (8 + 4) + (8 + (uint32_t)data.size()));
+    buf.insert(buf.end(), {'W', 'A', 'V', 'E'});
+
+    buf.insert(buf.end(), {'f', 'm', 't', ' '});
+    put_u32(buf, fmt_size);
+    put_u16(buf, c.extensible ? 0xFFFE : (c.is_float ? 3 : 1));
+    put_u16(buf, (uint16_t)c.channels);
+    put_u32(buf, (uint32_t)c.sample_rate);
+    put_u32(buf, (uint32_t)c.sample_rate * block_align);
+    put_u16(buf, block_align);
+    put_u16(buf, (uint16_t)c.bits);
+    if (c.extensible) {
+        put_u16(buf, 22);
+        put_u16(buf, (uint16_t)c.bits);
+        put_u32(buf, 0);
+        put_u16(buf, c.is_float ? 3 : 1);
+        buf.insert(buf.end(), {0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71});
+    }
+
+    // An unknown chunk before the data must be skipped
+    buf.insert(buf.end(), {'L', 'I', 'S', 'T'});
+    put_u32(buf, 4);
+    buf.insert(buf.end(), {'I', 'N', 'F', 'O'});
+
+    buf.insert(buf.end(), {'d', 'a', 't', 'a'});
+    put_u32(buf, (uint32_t)data.size());
+    buf.insert(buf.end(), data.begin(), data.end());
+
+    FILE * f = fopen(path.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    const bool ok = fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+    fclose(f);
+    return ok;
+}
+
+// Max error against the analytic 16 kHz tone, skipping the filter edges
+static double max_error(const std::vector<float> & samples) {
+    const int edge = QWEN_SAMPLE_RATE / 50;
+    double err = 0.0;
+    for (int i = edge; i < (int)samples.size() - edge; ++i) {
+        const double ref = TEST_AMPLITUDE * sin(2.0 * M_PI * TEST_FREQ_HZ * i / QWEN_SAMPLE_RATE);
+        err = std::max(err, std::abs(samples[i] - ref));
+    }
+    return err;
+}
+
+int main() {
+    printf("=== Audio Reader Test ===\n");
+
+    const wav_case cases[] = {
+        {"16 kHz mono 16-bit",          16000, 1, 16, false, false},
+        {"48 kHz stereo 24-bit",        48000, 2, 24, false, false},
+        {"44.1 kHz mono 32-bit",        44100, 1, 32, false, false},
+        {"8 kHz mono float",             8000, 1, 32, true,  false},
+        {"22.05 kHz 3-ch double (ext)", 22050, 3, 64, true,  true },
+        {"16 kHz mono 8-bit",           16000, 1,  8, false, false},
+    };
+    const std::string path = "test_audio_reader_tmp.wav";
+
+    bool ok = true;
+    for (const auto & c : cases) {
+        const int n_frames = (int)(TEST_DURATION_SEC * c.sample_rate);
+        if (!write_wav(path, c, n_frames)) {
+            fprintf(stderr, "FAILED: Could not write %s\n", path.c_str());
+            return 1;
+        }
+
+        std::vector<float> samples;
+        int sample_rate = 0;
+        if (!qwen3_asr::load_audio_file(path, samples, sample_rate)) {
+            fprintf(stderr, "FAILED: Could not load %s\n", c.name);
+            ok = false;
+            continue;
+        }
+
+        const size_t expected = (size_t)(((int64_t)n_frames * QWEN_SAMPLE_RATE + c.sample_rate - 1) / c.sample_rate);
+        const double err = max_error(samples);
+        const double tol = c.bits == 8 ? 2e-2 : 2e-3;
+        printf("  %-28s %zu samples, max error %.2e\n", c.name, samples.size(), err);
+        if (sample_rate != c.sample_rate) {
+            fprintf(stderr, "FAILED: %s: reported rate %d\n", c.name, sample_rate);
+            ok = false;
+        }
+        if (samples.size() != expected) {
+            fprintf(stderr, "FAILED: %s: expected %zu samples\n", c.name, expected);
+            ok = false;
+        }
+        if (err > tol) {
+            fprintf(stderr, "FAILED: %s: error above %.0e\n", c.name, tol);
+            ok = false;
+        }
+
+        // The same bytes from memory must decode identically
+        std::vector<uint8_t> image;
+        if (FILE * f = fopen(path.c_str(), "rb")) {
+            uint8_t buf[4096];
+            size_t n;
+            while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+                image.insert(image.end(), buf, buf + n);
+            }
+            fclose(f);
+        }
+        std::vector<float> from_memory;
+        std::string error;
+        if (!qwen3_asr::load_audio_memory(image.data(), image.size(), from_memory, sample_rate, error) ||
+            from_memory != samples) {
+            fprintf(stderr, "FAILED: %s: in-memory decode differs %s\n", c.name, error.c_str());
+            ok = false;
+        }
+    }
+    remove(path.c_str());
+
+    // Output must not depend on how the input is split into blocks
+    {
+        std::vector<float> in(48000);
+        for (size_t i = 0; i < in.size(); ++i) {
+            in[i] = (float)sin(0.01 * i) * 0.3f + (float)((i * 7919) % 101) / 1000.0f;
+        }
+        qwen3_asr::Resampler whole(48000, 16000);
+        std::vector<float> ref;
+        whole.push(in.data(), (int)in.size(), ref);
+        whole.finish(ref);
+
+        qwen3_asr::Resampler split(48000, 16000);
+        std::vector<float> out;
+        const int sizes[] = {1, 7, 160, 333, 4801};
+        size_t pos = 0;
+        for (int k = 0; pos < in.size(); ++k) {
+            const int n = (int)std::min(in.size() - pos, (size_t)sizes[k % 5]);
+            split.push(in.data() + pos, n, out);
+            pos += n;
+        }
+        split.finish(out);
+
+        double diff = out.size() == ref.size() ? 0.0 : 1.0;
+        for (size_t i = 0; i < std::min(out.size(), ref.size()); ++i) {
+            diff = std::max(diff, (double)std::abs(out[i] - ref[i]));
+        }
+        printf("  block-split resampling: %zu samples, max diff %.2e\n", out.size(), diff);
+        if (diff > 1e-6) {
+            fprintf(stderr, "FAILED: block-split resampling differs from a single push\n");
+            ok = false;
+        }
+    }
+
+    if (!ok) {
+        return 1;
+    }
+    printf("\nPASSED\n");
+    return 0;
+}
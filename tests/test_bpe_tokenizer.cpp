@@ -0,0 +1,165 @@
+#include "../src/bpe_tokenizer.h"
+
+#include <climits>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace qwen3_asr;
+
+// Same byte-to-unicode mapping as the tokenizer, spelled out independently
+static std::vector<std::string> byte_table() {
+    std::vector<std::string> table(256);
+    int n = 0;
+    for (int b = 0; b < 256; ++b) {
+        const bool printable = (b >= 0x21 && b <= 0x7E) || (b >= 0xA1 && b <= 0xAC) || (b >= 0xAE && b <= 0xFF);
+        const int cp = printable ? b : 256 + n++;
+        std::string s;
+        if (cp < 0x80) {
+            s += (char)cp;
+        } else {
+            s += (char)(0xC0 | (cp >> 6));
+            s += (char)(0x80 | (cp & 0x3F));
+        }
+        table[b] = s;
+    }
+    return table;
+}
+
+// String-based reference: the textbook algorithm the tokenizer replaces
+static std::vector<int32_t> reference_bpe(const std::string & word,
+                                          const std::vector<std::string> & table,
+                                          const std::unordered_map<std::string, int> & ranks,
+                                          const std::unordered_map<std::string, int32_t> & ids) {
+    std::vector<std::string> symbols;
+    for (unsigned char c : word) {
+        symbols.push_back(table[c]);
+    }
+    while (symbols.size() > 1) {
+        int best = INT_MAX;
+        size_t pos = 0;
+        for (size_t i = 0; i + 1 < symbols.size(); ++i) {
+            auto it = ranks.find(symbols[i] + " " + symbols[i + 1]);
+            if (it != ranks.end() && it->second < best) {
+                best = it->second;
+                pos = i;
+            }
+        }
+        if (best == INT_MAX) {
+            break;
+        }
+        symbols[pos] += symbols[pos + 1];
+        symbols.erase(symbols.begin() + pos + 1);
+    }
+    std::vector<int32_t> out;
+    for (const auto & s : symbols) {
+        out.push_back(ids.at(s));
+    }
+    return out;
+}
+
+int main() {
+    printf("=== BPE Tokenizer Test ===\n");
+
+    const std::vector<std::string> table = byte_table();
+    std::vector<std::string> vocab = table;
+    std::unordered_map<std::string, int32_t> ids;
+    for (size_t i = 0; i < vocab.size(); ++i) {
+        ids[vocab[i]] = (int32_t)i;
+    }
+
+    // "Ġ" is the byte-level symbol for a space; "Ã©" is UTF-8 "é". "½ ï"
+    // and "´ ã" join the last byte of "好"/"年" to the first of "，"/"、",
+    // so they only apply if those are wrongly kept in one word
+    const std::vector<std::string> merges = {
+        "l l", "h e", "Ġ w", "o r", "he ll", "hell o", "Ġw or", "Ġwor l", "Ġworl d",
+        "Ã ©", "t h", "Ġ th", "Ġth e", "Ġ 1", "' s", "x x", "½ ï", "´ ã",
+    };
+    std::unordered_map<std::string, int> ranks;
+    for (size_t r = 0; r < merges.size(); ++r) {
+        ranks.emplace(merges[r], (int)r);
+        const size_t sp = merges[r].find(' ');
+        const std::string joined = merges[r].substr(0, sp) + merges[r].substr(sp + 1);
+        if (!ids.count(joined)) {
+            ids[joined] = (int32_t)vocab.size();
+            vocab.push_back(joined);
+        }
+    }
+
+    BpeTokenizer tok;
+    if (!tok.build(vocab, merges)) {
+        fprintf(stderr, "FAILED: build\n");
+        return 1;
+    }
+
+    bool ok = true;
+    const char * words[] = {"hello", " world", " the", "the", "café", " 1", "héllo", "xxxxx",
+                            "\xE6\x97\xA5\xE6\x9C\xAC", "a", " ", "hellohello"};
+    for (int pass = 0; pass < 2; ++pass) {
+        for (const char * w : words) {
+            std::vector<int32_t> out;
+            tok.encode_word(w, out);
+            if (out != reference_bpe(w, table, ranks, ids)) {
+                fprintf(stderr, "FAILED: '%s' differs from the reference (pass %d)\n", w, pass);
+                ok = false;
+            }
+        }
+    }
+    const size_t n_words = sizeof(words) / sizeof(words[0]);
+    printf("  %zu words x 2 passes, cache hits %zu, misses %zu\n", n_words, tok.cache_hits(), tok.cache_misses());
+    if (tok.cache_hits() != n_words || tok.cache_misses() != n_words) {
+        fprintf(stderr, "FAILED: second pass should be served from the cache\n");
+        ok = false;
+    }
+
+    // Running text is pre-split into words before BPE
+    {
+        const std::string text = "hello world's 12  the\n\nend";
+        const std::vector<std::string> pieces = {"hello", " world", "'s", " ", "1", "2", " ", " the", "\n\n", "end"};
+        std::vector<int32_t> expected;
+        for (const auto & p : pieces) {
+            std::vector<int32_t> t = reference_bpe(p, table, ranks, ids);
+            expected.insert(expected.end(), t.begin(), t.end());
+        }
+        std::vector<int32_t> out;
+        tok.encode(text, out);
+        printf("  running text: %zu tokens\n", out.size());
+        if (out != expected) {
+            fprintf(stderr, "FAILED: running text pre-tokenization\n");
+            ok = false;
+        }
+    }
+
+    // CJK text: full-width punctuation, symbols and digits are not letters,
+    // so punctuation only joins the following word as its one-character
+    // prefix, the way [^\r\n\p{L}\p{N}]?\p{L}+ splits it
+    {
+        const std::string text = "你好，世界。今天是2024年、天气很好！ 好的№1　２３……";
+        const std::vector<std::string> pieces = {"你好", "，世界", "。今天是", "2", "0", "2", "4", "年",
+                                                 "、天气很好", "！", " 好的", "№", "1", "　", "２", "３", "……"};
+        std::vector<int32_t> expected;
+        for (const auto & p : pieces) {
+            std::vector<int32_t> t = reference_bpe(p, table, ranks, ids);
+            expected.insert(expected.end(), t.begin(), t.end());
+        }
+        std::vector<int32_t> out;
+        tok.encode(text, out);
+        printf("  CJK text: %zu tokens\n", out.size());
+        if (out != expected) {
+            fprintf(stderr, "FAILED: CJK text pre-tokenization\n");
+            ok = false;
+        }
+    }
+
+    if (tok.token_id("Ġworld") != ids["Ġworld"] || tok.token_id("missing-token") != -1) {
+        fprintf(stderr, "FAILED: token_id lookup\n");
+        ok = false;
+    }
+
+    if (!ok) {
+        return 1;
+    }
+    printf("\nPASSED\n");
+    return 0;
+}
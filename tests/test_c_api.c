@@ -0,0 +1,105 @@
+// C API test; compiled as C to check that qwen3_asr_c.h is plain C.
+// Without arguments only the model-free paths run; with a model path it
+// also transcribes and streams a second of silence as float and 16-bit.
+
+#include "../src/qwen3_asr_c.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define N_SAMPLES 16000
+
+static int check_result(qwen3_asr_result * result, qwen3_asr_context * ctx, const char * what) {
+    if (!result) {
+        fprintf(stderr, "FAILED: %s: %s\n", what, qwen3_asr_get_error(ctx));
+        return 0;
+    }
+    printf("  %s: \"%s\" (%d tokens)\n", what, qwen3_asr_result_text(result), qwen3_asr_result_n_tokens(result));
+    qwen3_asr_result_free(result);
+    return 1;
+}
+
+int main(int argc, char ** argv) {
+    printf("=== C API Test ===\n");
+
+    int ok = 1;
+
+    if (qwen3_asr_api_version() != QWEN3_ASR_C_API_VERSION) {
+        fprintf(stderr, "FAILED: library API version %d, header %d\n", qwen3_asr_api_version(), QWEN3_ASR_C_API_VERSION);
+        return 1;
+    }
+
+    qwen3_asr_transcribe_params tp = qwen3_asr_transcribe_default_params();
+    qwen3_asr_stream_params sp = qwen3_asr_stream_default_params();
+    if (tp.max_tokens <= 0 || tp.n_beams != 1 || tp.text_callback || sp.max_tokens <= 0 || !sp.stop_loops) {
+        fprintf(stderr, "FAILED: unexpected default params\n");
+        ok = 0;
+    }
+
+    qwen3_asr_context * ctx = qwen3_asr_init();
+    if (!ctx) {
+        fprintf(stderr, "FAILED: qwen3_asr_init\n");
+        return 1;
+    }
+
+    // Calls on an unloaded context fail with an error instead of crashing
+    static float samples[N_SAMPLES];
+    static int16_t pcm[N_SAMPLES];
+    if (qwen3_asr_transcribe_f32(ctx, samples, N_SAMPLES, NULL) || qwen3_asr_get_error(ctx)[0] == '\0' ||
+        qwen3_asr_session_create(ctx, NULL)) {
+        fprintf(stderr, "FAILED: unloaded context accepted a transcription\n");
+        ok = 0;
+    }
+    if (qwen3_asr_load_model(ctx, "/nonexistent/model.gguf", NULL) || qwen3_asr_get_error(ctx)[0] == '\0') {
+        fprintf(stderr, "FAILED: loading a missing model succeeded\n");
+        ok = 0;
+    }
+    qwen3_asr_free(ctx);
+
+    // NULL handles are ignored
+    qwen3_asr_free(NULL);
+    qwen3_asr_session_free(NULL);
+    qwen3_asr_result_free(NULL);
+    if (strcmp(qwen3_asr_result_text(NULL), "") != 0 || qwen3_asr_result_n_segments(NULL) != 0) {
+        fprintf(stderr, "FAILED: NULL result accessors\n");
+        ok = 0;
+    }
+
+    if (argc > 1) {
+        ctx = qwen3_asr_init();
+        if (!qwen3_asr_load_model(ctx, argv[1], NULL)) {
+            fprintf(stderr, "FAILED: %s\n", qwen3_asr_get_error(ctx));
+            qwen3_asr_free(ctx);
+            return 1;
+        }
+        tp.max_tokens = 32;
+        ok &= check_result(qwen3_asr_transcribe_f32(ctx, samples, N_SAMPLES, &tp), ctx, "f32");
+        ok &= check_result(qwen3_asr_transcribe_s16(ctx, pcm, N_SAMPLES, &tp), ctx, "s16");
+
+        qwen3_asr_session * session = qwen3_asr_session_create(ctx, NULL);
+        if (!session || !qwen3_asr_session_push_s16(session, pcm, N_SAMPLES)) {
+            fprintf(stderr, "FAILED: session push: %s\n", session ? qwen3_asr_session_get_error(session) : qwen3_asr_get_error(ctx));
+            ok = 0;
+        } else if (qwen3_asr_transcribe_f32(ctx, samples, N_SAMPLES, &tp)) {
+            fprintf(stderr, "FAILED: transcription ran during a session\n");
+            ok = 0;
+        } else {
+            qwen3_asr_result * result = qwen3_asr_session_finalize(session);
+            if (!result) {
+                fprintf(stderr, "FAILED: session finalize: %s\n", qwen3_asr_session_get_error(session));
+                ok = 0;
+            } else {
+                printf("  session: \"%s\"\n", qwen3_asr_result_text(result));
+                qwen3_asr_result_free(result);
+            }
+        }
+        qwen3_asr_session_free(session);
+        qwen3_asr_free(ctx);
+    }
+
+    if (!ok) {
+        return 1;
+    }
+    printf("\nPASSED\n");
+    return 0;
+}
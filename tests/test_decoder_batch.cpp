@@ -0,0 +1,114 @@
+#include "text_decoder.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+
+// Greedy-decodes two prompts one at a time, then again together through
+// forward_batch in separate KV slots, and checks the tokens match.
+
+static int32_t argmax(const float * logits, int32_t n) {
+    return (int32_t)(std::max_element(logits, logits + n) - logits);
+}
+
+int main() {
+    printf("=== Batched Decoder Test ===\n\n");
+    
+    qwen3_asr::TextDecoder decoder;
+    
+    printf("Loading model...\n");
+    if (!decoder.load_model("models/qwen3-asr-0.6b-f16.gguf")) {
+        fprintf(stderr, "Failed to load model: %s\n", decoder.get_error().c_str());
+        return 1;
+    }
+    
+    const int32_t vocab_size = decoder.get_config().vocab_size;
+    const int n_steps = 8;
+    
+    // "The capital of France is" / "The capital of Japan is"
+    std::vector<std::vector<int32_t>> prompts = {
+        {785, 6722, 315, 9625, 374},
+        {785, 6722, 315, 6323, 374},
+    };
+    const int n_seq = (int)prompts.size();
+    
+    std::vector<std::vector<int32_t>> expected(n_seq);
+    std::vector<float> logits;
+    
+    if (!decoder.init_kv_cache(64)) {
+        fprintf(stderr, "Failed to init KV cache: %s\n", decoder.get_error().c_str());
+        return 1;
+    }
+    for (int s = 0; s < n_seq; ++s) {
+        if (!decoder.forward(prompts[s].data(), prompts[s].size(), 0, logits)) {
+            fprintf(stderr, "Forward failed: %s\n", decoder.get_error().c_str());
+            return 1;
+        }
+        int32_t n_past = prompts[s].size();
+        int32_t token = argmax(logits.data(), vocab_size);
+        for (int i = 0; i < n_steps; ++i) {
+            expected[s].push_back(token);
+            if (!decoder.forward(&token, 1, n_past++, logits)) {
+                fprintf(stderr, "Forward failed: %s\n", decoder.get_error().c_str());
+                return 1;
+            }
+            token = argmax(logits.data(), vocab_size);
+        }
+    }
+    
+    // Splits the existing 64-row buffer into two slots without reallocating,
+    // so the slots start over stale (masked) entries
+    if (!decoder.reserve_kv_cache(32, n_seq) || decoder.get_n_ctx() != 64 / n_seq) {
+        fprintf(stderr, "Failed to reserve KV cache: %s\n", decoder.get_error().c_str());
+        return 1;
+    }
+    
+    std::vector<int32_t> seq_ids(n_seq), tokens(n_seq), n_past(n_seq);
+    for (int s = 0; s < n_seq; ++s) {
+        if (!decoder.forward(prompts[s].data(), prompts[s].size(), 0, logits, s)) {
+            fprintf(stderr, "Forward failed: %s\n", decoder.get_error().c_str());
+            return 1;
+        }
+        seq_ids[s] = s;
+        n_past[s] = prompts[s].size();
+        tokens[s] = argmax(logits.data(), vocab_size);
+    }
+    
+    // Batched steps take the in-graph argmax / top-k; the single-sequence
+    // reference above used the host argmax over the full logits
+    qwen3_asr::decoder_output out;
+    out.want_logits = false;
+    out.n_top_k = 4;
+    
+    int n_mismatch = 0;
+    for (int i = 0; i < n_steps; ++i) {
+        for (int s = 0; s < n_seq; ++s) {
+            printf("  step %d seq %d: batched %d, single %d\n", i, s, tokens[s], expected[s][i]);
+            if (tokens[s] != expected[s][i]) {
+                n_mismatch++;
+            }
+        }
+        if (!decoder.forward_batch(seq_ids.data(), tokens.data(), n_past.data(), n_seq, out)) {
+            fprintf(stderr, "Batched forward failed: %s\n", decoder.get_error().c_str());
+            return 1;
+        }
+        for (int s = 0; s < n_seq; ++s) {
+            n_past[s]++;
+            tokens[s] = out.argmax[s];
+            if (out.top_k[s * out.n_top_k] != tokens[s]) {
+                printf("  step %d seq %d: top-k best %d != argmax %d\n", i, s,
+                       out.top_k[s * out.n_top_k], tokens[s]);
+                n_mismatch++;
+            }
+        }
+    }
+    
+    if (n_mismatch == 0) {
+        printf("\nTEST PASSED!\n");
+        return 0;
+    } else {
+        printf("\nTEST FAILED! %d mismatching tokens\n", n_mismatch);
+        return 1;
+    }
+}
@@ -0,0 +1,56 @@
+#include "../src/text_decoder.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace qwen3_asr;
+
+// Feed tokens one by one; the concatenated deltas must equal the final text
+// and every delta must end on a UTF-8 character boundary
+static bool run_case(const char * name, const std::vector<std::string> & table,
+                     const std::vector<int32_t> & tokens,
+                     const std::string & want_language, const std::string & want_text) {
+    StreamingDetokenizer detok(table);
+    std::string streamed;
+    bool boundaries_ok = true;
+    for (int32_t t : tokens) {
+        std::string_view d = detok.push(t);
+        if (!d.empty() && (static_cast<unsigned char>(d.back()) & 0x80) &&
+            (static_cast<unsigned char>(d.back()) & 0xC0) == 0xC0) {
+            boundaries_ok = false;
+        }
+        streamed.append(d.data(), d.size());
+    }
+    std::string_view rest = detok.finish();
+    streamed.append(rest.data(), rest.size());
+
+    const bool ok = boundaries_ok && streamed == detok.text() &&
+                    detok.language() == want_language && detok.text() == want_text;
+    printf("  %-24s language '%s', text '%s' %s\n", name, detok.language().c_str(),
+           detok.text().c_str(), ok ? "ok" : "MISMATCH");
+    return ok;
+}
+
+int main() {
+    printf("=== Streaming Detokenizer Test ===\n");
+
+    // Token bytes as TextDecoder builds them; 5 is the <asr_text> delimiter,
+    // 6 a special token, and 7/8 split the two bytes of "é"
+    const std::vector<std::string> table = {
+        "language", " Eng", "lish", " hello", " wor", "|", "", "\xC3", "\xA9", "ld", "caf",
+    };
+
+    bool ok = true;
+    ok &= run_case("header + text", table, {0, 1, 2, 5, 3, 4, 9, 6}, "English", " hello world");
+    ok &= run_case("split multi-byte char", table, {0, 1, 2, 5, 10, 7, 8}, "English", "caf\xC3\xA9");
+    ok &= run_case("no header", table, {3, 4, 9}, "unknown", " hello world");
+    ok &= run_case("ends in header", table, {0, 1, 2}, "English", "");
+    ok &= run_case("empty", table, {}, "unknown", "");
+
+    if (!ok) {
+        return 1;
+    }
+    printf("\nPASSED\n");
+    return 0;
+}
@@ -155,6 +155,7 @@ int main(int argc, char ** argv) {
     std::string mel_path = "tests/reference/mel.npy";
     std::string ref_path = "tests/reference/audio_features.npy";
     float tolerance = 2e-2f;
+    int n_workers = 1;
     
     for (int i = 1; i < argc; ++i) {
         if (strcmp(argv[i], "--model") == 0 && i + 1 < argc) {
@@ -165,6 +166,8 @@ int main(int argc, char ** argv) {
             ref_path = argv[++i];
         } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
             tolerance = std::atof(argv[++i]);
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            n_workers = std::atoi(argv[++i]);
         } else if (strcmp(argv[i], "--help") == 0) {
             printf("Usage: %s [options]\n", argv[0]);
             printf("Options:\n");
@@ -172,6 +175,7 @@ int main(int argc, char ** argv) {
             printf("  --mel <path>       Path to mel spectrogram NPY (default: tests/reference/mel.npy)\n");
             printf("  --ref <path>       Path to reference output NPY (default: tests/reference/audio_features.npy)\n");
             printf("  --tolerance <val>  Max allowed difference (default: 1e-3)\n");
+            printf("  --workers <n>      Run the transformer on n window-parallel CPU workers\n");
             return 0;
         }
     }
@@ -211,7 +215,12 @@ int main(int argc, char ** argv) {
     
     printf("Loading model from: %s\n", model_path.c_str());
     qwen3_asr::AudioEncoder encoder;
-    if (!encoder.load_model(model_path)) {
+    qwen3_asr::cpu_backend_params cpu_params;
+    if (n_workers > 1) {
+        cpu_params.use_gpu = false;
+        cpu_params.encoder_workers = n_workers;
+    }
+    if (!encoder.load_model(model_path, cpu_params)) {
         fprintf(stderr, "Failed to load model: %s\n", encoder.get_error().c_str());
         return 1;
     }
@@ -0,0 +1,113 @@
+#include "../src/feature_cache.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace qwen3_asr;
+
+static cached_features make_entry(int n_frames, float base) {
+    cached_features e;
+    e.audio_features.resize((size_t)n_frames * 16);
+    for (size_t i = 0; i < e.audio_features.size(); ++i) {
+        e.audio_features[i] = base + 0.001f * (float)i;
+    }
+    e.n_mel_frames = n_frames * 8;
+    e.n_mel = 4;
+    e.mel.assign((size_t)e.n_mel * e.n_mel_frames, base);
+    return e;
+}
+
+int main() {
+    printf("=== Feature Cache Test ===\n");
+
+    bool ok = true;
+
+    // Keys depend on every sample, the length and the seed
+    {
+        std::vector<float> a(16003);
+        for (size_t i = 0; i < a.size(); ++i) {
+            a[i] = (float)((i * 7919) % 1013) / 1013.0f - 0.5f;
+        }
+        std::vector<float> b = a;
+        b[12345] += 1e-6f;
+        const uint64_t ka = hash_samples(a.data(), a.size(), 1);
+        if (ka != hash_samples(a.data(), a.size(), 1) ||
+            ka == hash_samples(b.data(), b.size(), 1) ||
+            ka == hash_samples(a.data(), a.size() - 1, 1) ||
+            ka == hash_samples(a.data(), a.size(), 2)) {
+            fprintf(stderr, "FAILED: hash_samples does not separate inputs\n");
+            ok = false;
+        }
+    }
+
+    // In-memory LRU evicts the least recently used entry over budget
+    {
+        const cached_features e = make_entry(10, 1.0f);
+        feature_cache_params params;
+        params.max_memory_bytes = 2 * (e.audio_features.size() * sizeof(float) + sizeof(cached_features)) + 64;
+        FeatureCache cache(params);
+        cache.insert(1, e);
+        cache.insert(2, make_entry(10, 2.0f));
+        cached_features out;
+        cache.lookup(1, out);  // 1 becomes most recent
+        cache.insert(3, make_entry(10, 3.0f));
+        const bool has1 = cache.lookup(1, out);
+        const bool has2 = cache.lookup(2, out);
+        const bool has3 = cache.lookup(3, out);
+        printf("  LRU: %zu bytes, hits %zu, misses %zu\n", cache.memory_bytes(), cache.hits(), cache.misses());
+        if (!has1 || has2 || !has3 || !out.mel.empty()) {
+            fprintf(stderr, "FAILED: LRU eviction order or mel storage\n");
+            ok = false;
+        }
+    }
+
+    // Disk store round trip through a fresh cache, with the mel kept
+    {
+        char dir[] = "/tmp/qwen3_feature_cache_XXXXXX";
+        if (!mkdtemp(dir)) {
+            fprintf(stderr, "FAILED: could not create %s\n", dir);
+            return 1;
+        }
+        feature_cache_params params;
+        params.dir = dir;
+        params.keep_mel = true;
+        const cached_features e = make_entry(7, 0.5f);
+        {
+            FeatureCache writer(params);
+            writer.insert(0xabcdef, e);
+        }
+
+        params.max_memory_bytes = 0;
+        FeatureCache reader(params);
+        cached_features out;
+        if (!reader.lookup(0xabcdef, out) || out.audio_features != e.audio_features ||
+            out.mel != e.mel || out.n_mel_frames != e.n_mel_frames || out.n_mel != e.n_mel) {
+            fprintf(stderr, "FAILED: disk entry does not round trip\n");
+            ok = false;
+        }
+        if (reader.lookup(0x123, out)) {
+            fprintf(stderr, "FAILED: lookup of a missing key\n");
+            ok = false;
+        }
+
+        // A truncated file is a miss, not a bad entry
+        const std::string path = std::string(dir) + "/0000000000abcdef.qfc";
+        if (truncate(path.c_str(), 100) != 0 || reader.lookup(0xabcdef, out)) {
+            fprintf(stderr, "FAILED: truncated entry was accepted\n");
+            ok = false;
+        }
+        remove(path.c_str());
+        rmdir(dir);
+    }
+
+    if (!ok) {
+        return 1;
+    }
+    printf("\nPASSED\n");
+    return 0;
+}
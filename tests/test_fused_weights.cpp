@@ -0,0 +1,264 @@
+#include "audio_encoder.h"
+#include "text_decoder.h"
+#include "forced_aligner.h"
+#include "mel_spectrogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+// Fused projections (--fuse): general-quantize --fuse with every tensor
+// kept as stored writes the same weights as attn_qkv / ffn_gate_up, so the
+// encoder, the decoder (whose K/V rows reach the cache through the strided
+// views of the fused output) and the forced aligner must give the outputs
+// of the unfused model. Also checks the fused file itself: every layer
+// fused, and zeros in the k slice of the encoder's qkv bias (k_proj has no
+// bias).
+
+// Largest allowed difference, relative to the largest unfused magnitude
+#define MAX_REL_DIFF 1e-3f
+
+static int n_failed = 0;
+
+static void check(bool ok, const char * what) {
+    printf("  %-56s %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) {
+        n_failed++;
+    }
+}
+
+// Max |a - b| over max |a|, 1 for different sizes
+static float rel_diff(const std::vector<float> & a, const std::vector<float> & b) {
+    if (a.size() != b.size() || a.empty()) {
+        return 1.0f;
+    }
+    float max_abs = 0.0f;
+    float max_diff = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i) {
+        max_abs = std::max(max_abs, fabsf(a[i]));
+        max_diff = std::max(max_diff, fabsf(a[i] - b[i]));
+    }
+    return max_abs > 0.0f ? max_diff / max_abs : max_diff;
+}
+
+// 5 s of a tone with some noise at 16 kHz
+static std::vector<float> make_audio() {
+    std::vector<float> samples(5 * QWEN_SAMPLE_RATE);
+    uint32_t noise = 12345;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        noise = noise * 1664525u + 1013904223u;
+        samples[i] = 0.3f * sinf(2.0f * 3.14159265f * 220.0f * i / QWEN_SAMPLE_RATE) +
+                     0.05f * ((float)(noise >> 16) / 32768.0f - 1.0f);
+    }
+    return samples;
+}
+
+static bool fuse_model(const std::string & quantize, const std::string & input, const std::string & output) {
+    const std::string cmd = "\"" + quantize + "\" --fuse --rule '.*=KEEP' \"" + input + "\" \"" + output +
+                            "\" F16 > /dev/null";
+    if (system(cmd.c_str()) != 0) {
+        fprintf(stderr, "Failed: %s\n", cmd.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Fused tensors of output against the parts in input: every Q/K/V (gate/up)
+// group fused, and the bias slice of a part without a bias all zeros
+static bool check_fused_file(const std::string & input, const std::string & output, const char * what) {
+    struct ggml_context * ctx_inp_data = nullptr;
+    struct ggml_context * ctx_out_data = nullptr;
+    struct gguf_init_params params_inp = { .no_alloc = true, .ctx = &ctx_inp_data };
+    struct gguf_init_params params_out = { .no_alloc = true, .ctx = &ctx_out_data };
+    struct gguf_context * ctx_inp = gguf_init_from_file(input.c_str(), params_inp);
+    struct gguf_context * ctx_out = gguf_init_from_file(output.c_str(), params_out);
+    FILE * f = fopen(output.c_str(), "rb");
+    if (!ctx_inp || !ctx_out || !f) {
+        fprintf(stderr, "Failed to read %s or %s\n", input.c_str(), output.c_str());
+        if (f) {
+            fclose(f);
+        }
+        return false;
+    }
+
+    int n_q = 0, n_qkv = 0, n_gate = 0, n_gate_up = 0, n_zero_checked = 0;
+    bool zeros_ok = true;
+    for (int64_t i = 0; i < gguf_get_n_tensors(ctx_inp); ++i) {
+        const std::string name = gguf_get_tensor_name(ctx_inp, i);
+        n_q += name.find("attn_q.weight") != std::string::npos;
+        n_gate += name.find("ffn_gate.weight") != std::string::npos;
+    }
+    for (int64_t i = 0; i < gguf_get_n_tensors(ctx_out); ++i) {
+        const std::string name = gguf_get_tensor_name(ctx_out, i);
+        n_gate_up += name.find("ffn_gate_up.weight") != std::string::npos;
+        const size_t pos = name.find("attn_qkv.");
+        if (pos == std::string::npos) {
+            continue;
+        }
+        n_qkv += name.compare(pos, std::string::npos, "attn_qkv.weight") == 0;
+        if (name.compare(pos, std::string::npos, "attn_qkv.bias") != 0) {
+            continue;
+        }
+
+        // Rows of Q, then K, then V: the k slice starts after Q's rows
+        const std::string prefix = name.substr(0, pos);
+        struct ggml_tensor * q_w = ggml_get_tensor(ctx_inp_data, (prefix + "attn_q.weight").c_str());
+        struct ggml_tensor * k_w = ggml_get_tensor(ctx_inp_data, (prefix + "attn_k.weight").c_str());
+        if (!q_w || !k_w || gguf_find_tensor(ctx_inp, (prefix + "attn_k.bias").c_str()) >= 0) {
+            continue;
+        }
+        const enum ggml_type type = gguf_get_tensor_type(ctx_out, i);
+        std::vector<uint8_t> k_b(ggml_row_size(type, k_w->ne[1]));
+        const size_t offset = gguf_get_data_offset(ctx_out) + gguf_get_tensor_offset(ctx_out, i) +
+                              ggml_row_size(type, q_w->ne[1]);
+        if (fseek(f, (long)offset, SEEK_SET) != 0 || fread(k_b.data(), 1, k_b.size(), f) != k_b.size() ||
+            std::any_of(k_b.begin(), k_b.end(), [](uint8_t b) { return b != 0; })) {
+            zeros_ok = false;
+        }
+        n_zero_checked++;
+    }
+    fclose(f);
+
+    printf("  %s: %d attn_qkv (of %d), %d ffn_gate_up (of %d), %d zero k biases\n",
+           what, n_qkv, n_q, n_gate_up, n_gate, n_zero_checked);
+    check(n_q > 0 && n_qkv == n_q && n_gate_up == n_gate, "every Q/K/V and gate/up group is fused");
+    check(n_zero_checked > 0 && zeros_ok, "a missing k bias is stored as zeros");
+
+    gguf_free(ctx_inp);
+    gguf_free(ctx_out);
+    ggml_free(ctx_inp_data);
+    ggml_free(ctx_out_data);
+    return true;
+}
+
+static bool compare_encoders(const std::string & model_path, const std::string & fused_path,
+                             const MelSpectrogram & mel) {
+    qwen3_asr::AudioEncoder encoder;
+    qwen3_asr::AudioEncoder fused;
+    if (!encoder.load_model(model_path) || !fused.load_model(fused_path)) {
+        fprintf(stderr, "Failed to load encoder: %s%s\n", encoder.get_error().c_str(), fused.get_error().c_str());
+        return false;
+    }
+    std::vector<float> out, out_fused;
+    if (!encoder.encode(mel.data.data(), mel.n_mel, mel.n_len, out) ||
+        !fused.encode(mel.data.data(), mel.n_mel, mel.n_len, out_fused)) {
+        fprintf(stderr, "Encode failed: %s%s\n", encoder.get_error().c_str(), fused.get_error().c_str());
+        return false;
+    }
+    const float diff = rel_diff(out, out_fused);
+    printf("  encoder output, relative max diff: %g\n", diff);
+    check(diff < MAX_REL_DIFF, "fused encoder output matches");
+    return true;
+}
+
+static bool compare_decoders(const std::string & model_path, const std::string & fused_path) {
+    qwen3_asr::TextDecoder decoder;
+    qwen3_asr::TextDecoder fused;
+    if (!decoder.load_model(model_path) || !fused.load_model(fused_path) ||
+        !decoder.init_kv_cache(64) || !fused.init_kv_cache(64)) {
+        fprintf(stderr, "Failed to load decoder: %s%s\n", decoder.get_error().c_str(), fused.get_error().c_str());
+        return false;
+    }
+    const int32_t vocab_size = decoder.get_config().vocab_size;
+
+    // "The capital of France is", then greedy steps on both from the
+    // unfused tokens: every step reads the K/V rows the fused views wrote
+    const std::vector<int32_t> prompt = {785, 6722, 315, 9625, 374};
+    const int n_steps = 8;
+    std::vector<float> logits, logits_fused;
+    int32_t n_past = 0;
+    std::vector<int32_t> tokens = prompt;
+    float max_diff = 0.0f;
+    for (int step = 0; step <= n_steps; ++step) {
+        if (!decoder.forward(tokens.data(), (int32_t)tokens.size(), n_past, logits) ||
+            !fused.forward(tokens.data(), (int32_t)tokens.size(), n_past, logits_fused)) {
+            fprintf(stderr, "Forward failed: %s%s\n", decoder.get_error().c_str(), fused.get_error().c_str());
+            return false;
+        }
+        max_diff = std::max(max_diff, rel_diff(logits, logits_fused));
+        n_past += (int32_t)tokens.size();
+        const float * last = logits.data() + logits.size() - vocab_size;
+        tokens = {(int32_t)(std::max_element(last, last + vocab_size) - last)};
+    }
+    printf("  decoder logits over %d steps, relative max diff: %g\n", n_steps + 1, max_diff);
+    check(max_diff < MAX_REL_DIFF, "fused decoder logits match");
+    return true;
+}
+
+static bool compare_aligners(const std::string & model_path, const std::string & fused_path,
+                             const std::vector<float> & samples) {
+    qwen3_asr::ForcedAligner aligner;
+    qwen3_asr::ForcedAligner fused;
+    if (!aligner.load_model(model_path) || !fused.load_model(fused_path)) {
+        fprintf(stderr, "Failed to load aligner: %s%s\n", aligner.get_error().c_str(), fused.get_error().c_str());
+        return false;
+    }
+    const std::string text = "alpha bravo charlie delta";
+    qwen3_asr::alignment_result result = aligner.align(samples.data(), (int)samples.size(), text, "English");
+    qwen3_asr::alignment_result result_fused = fused.align(samples.data(), (int)samples.size(), text, "English");
+    if (!result.success || !result_fused.success) {
+        fprintf(stderr, "Alignment failed: %s%s\n", result.error_msg.c_str(), result_fused.error_msg.c_str());
+        return false;
+    }
+    bool same = result.words.size() == result_fused.words.size();
+    for (size_t i = 0; same && i < result.words.size(); ++i) {
+        const auto & a = result.words[i];
+        const auto & b = result_fused.words[i];
+        printf("  %-8s %6.2f - %6.2f | fused %6.2f - %6.2f\n", a.word.c_str(), a.start, a.end, b.start, b.end);
+        same = a.word == b.word && fabsf(a.start - b.start) < 1e-3f && fabsf(a.end - b.end) < 1e-3f;
+    }
+    check(same, "fused aligner gives the same word timestamps");
+    return true;
+}
+
+int main(int argc, char ** argv) {
+    std::string model_path = "models/qwen3-asr-0.6b-f16.gguf";
+    std::string aligner_path = "models/qwen3-forced-aligner-0.6b-f16.gguf";
+    std::string quantize = "build/general-quantize";
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--model") == 0 && i + 1 < argc) {
+            model_path = argv[++i];
+        } else if (strcmp(argv[i], "--aligner") == 0 && i + 1 < argc) {
+            aligner_path = argv[++i];
+        } else if (strcmp(argv[i], "--quantize") == 0 && i + 1 < argc) {
+            quantize = argv[++i];
+        }
+    }
+
+    printf("=== Fused Weights Test ===\n\n");
+
+    const std::string tmp = "/tmp/qwen3_asr_test_fused_" + std::to_string(getpid());
+    const std::string fused_path = tmp + "_asr.gguf";
+    const std::string fused_aligner_path = tmp + "_aligner.gguf";
+    if (!fuse_model(quantize, model_path, fused_path) || !fuse_model(quantize, aligner_path, fused_aligner_path)) {
+        return 1;
+    }
+
+    const std::vector<float> samples = make_audio();
+    MelFilters filters;
+    generate_mel_filters(filters);
+    MelSpectrogram mel;
+    bool ok = log_mel_spectrogram(samples.data(), (int)samples.size(), filters, mel);
+
+    ok = ok && check_fused_file(model_path, fused_path, "ASR model");
+    ok = ok && compare_encoders(model_path, fused_path, mel);
+    ok = ok && compare_decoders(model_path, fused_path);
+    ok = ok && check_fused_file(aligner_path, fused_aligner_path, "aligner");
+    ok = ok && compare_aligners(aligner_path, fused_aligner_path, samples);
+
+    remove(fused_path.c_str());
+    remove(fused_aligner_path.c_str());
+
+    if (ok && n_failed == 0) {
+        printf("\nTEST PASSED!\n");
+        return 0;
+    }
+    printf("\nTEST FAILED!\n");
+    return 1;
+}
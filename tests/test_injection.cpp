@@ -3,6 +3,7 @@
 #include <cstdio>
 #include <cmath>
 #include <cassert>
+#include <vector>
 
 using namespace qwen3_asr;
 
@@ -290,6 +291,45 @@ static void test_validate_audio_injection() {
     printf("  PASS: Validation works correctly\n");
 }
 
+static void test_injection_layout() {
+    printf("Testing make_injection_layout...\n");
+    
+    int32_t input_ids[] = {100, 151669, 151676, 151676, 151676, 151670, 200};
+    int32_t n_tokens = 7;
+    injection_layout layout;
+    
+    bool ok = make_injection_layout(input_ids, n_tokens, 2, 3, layout);
+    assert(ok);
+    assert(layout.audio_rows.size() == 3);
+    assert(layout.audio_rows[0] == 2 && layout.audio_rows[2] == 4);
+    assert(layout.text_ids.size() == 4 && layout.text_rows.size() == 4);
+    assert(layout.text_ids[1] == 151669 && layout.text_rows[1] == 1);
+    assert(layout.text_ids[2] == 151670 && layout.text_rows[2] == 5);
+    
+    // Every position is covered exactly once
+    std::vector<int> covered(n_tokens, 0);
+    for (int64_t r : layout.text_rows) covered[r]++;
+    for (int64_t r : layout.audio_rows) covered[r]++;
+    for (int i = 0; i < n_tokens; ++i) {
+        assert(covered[i] == 1);
+    }
+    
+    // Scattered positions match the span form
+    injection_layout scattered;
+    ok = make_injection_layout(input_ids, n_tokens,
+                               find_audio_positions(input_ids, n_tokens, 151676), scattered);
+    assert(ok);
+    assert(scattered.text_rows == layout.text_rows && scattered.audio_rows == layout.audio_rows);
+    
+    printf("  text rows: %zu, audio rows: %zu\n", layout.text_rows.size(), layout.audio_rows.size());
+    
+    // Spans and positions outside the prompt are rejected
+    assert(!make_injection_layout(input_ids, n_tokens, 5, 3, layout));
+    assert(!make_injection_layout(input_ids, n_tokens, std::vector<int32_t>{7}, layout));
+    
+    printf("  PASS: Layout covers every position once\n");
+}
+
 int main() {
     printf("=== Audio Injection Tests ===\n\n");
     
@@ -301,6 +341,7 @@ int main() {
     test_no_audio();
     test_count_and_find();
     test_validate_audio_injection();
+    test_injection_layout();
     
     printf("\n=== All tests passed! ===\n");
     return 0;
@@ -0,0 +1,111 @@
+#include "../src/qwen3_asr.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+// rank_language_candidates over a scripted decoder: the header walk takes
+// "language" and " " and stops at "language ", every top-k token that
+// starts a name is completed up to "|", names reached by different
+// tokenizations are merged, and the result is ranked by probability.
+
+using namespace qwen3_asr;
+
+enum {
+    TOK_LANGUAGE, TOK_SPACE, TOK_ENGLISH, TOK_ENG, TOK_LISH, TOK_BAR, TOK_CHINESE, TOK_EOS, N_TOKENS
+};
+
+struct next_tokens {
+    std::vector<int32_t> tokens;
+    std::vector<float> logprobs;
+};
+
+int main() {
+    printf("=== Language Ranking Test ===\n");
+
+    std::vector<std::string> token_bytes(N_TOKENS);
+    token_bytes[TOK_LANGUAGE] = "language";
+    token_bytes[TOK_SPACE] = " ";
+    token_bytes[TOK_ENGLISH] = "English";
+    token_bytes[TOK_ENG] = "Eng";
+    token_bytes[TOK_LISH] = "lish";
+    token_bytes[TOK_BAR] = "|";
+    token_bytes[TOK_CHINESE] = "Chinese";
+
+    // What the scripted decoder predicts after each token
+    std::map<int32_t, next_tokens> script;
+    script[TOK_LANGUAGE] = {{TOK_SPACE, TOK_ENGLISH, TOK_CHINESE}, {-0.01f, -5.0f, -6.0f}};
+    script[TOK_SPACE] = {{TOK_ENGLISH, TOK_ENG, TOK_CHINESE}, {-0.5f, -1.5f, -2.0f}};
+    script[TOK_ENGLISH] = {{TOK_BAR}, {0.0f}};
+    script[TOK_ENG] = {{TOK_LISH}, {-0.1f}};
+    script[TOK_LISH] = {{TOK_BAR}, {0.0f}};
+    script[TOK_CHINESE] = {{TOK_BAR}, {0.0f}};
+
+    const int32_t n_prompt = 100;
+    std::vector<std::pair<int32_t, int32_t>> calls;  // (token, position)
+    auto step = [&](int32_t token, int32_t n_past, int32_t n_top_k,
+                    std::vector<int32_t> & top_k, std::vector<float> & top_k_logprobs) {
+        calls.push_back({token, n_past});
+        const next_tokens & next = script[token];
+        const size_t n = std::min((size_t)n_top_k, next.tokens.size());
+        top_k.assign(next.tokens.begin(), next.tokens.begin() + n);
+        top_k_logprobs.assign(next.logprobs.begin(), next.logprobs.begin() + n);
+        return true;
+    };
+
+    bool ok = true;
+
+    // The prefill predicts "language"
+    std::vector<language_score> languages;
+    std::string error;
+    if (!rank_language_candidates({TOK_LANGUAGE, TOK_ENGLISH, TOK_CHINESE}, {-0.001f, -7.0f, -8.0f}, n_prompt,
+                                  token_bytes, TOK_EOS, step, languages, error)) {
+        fprintf(stderr, "FAILED: %s\n", error.c_str());
+        return 1;
+    }
+
+    // Header: "language" at n_prompt, " " at n_prompt + 1; then every name
+    // starts from n_prompt + 2
+    if (calls.size() < 2 || calls[0] != std::make_pair((int32_t)TOK_LANGUAGE, n_prompt) ||
+        calls[1] != std::make_pair((int32_t)TOK_SPACE, n_prompt + 1)) {
+        fprintf(stderr, "FAILED: the header walk did not take \"language\" and \" \"\n");
+        ok = false;
+    }
+    for (size_t i = 2; i < calls.size(); ++i) {
+        if (calls[i].first == TOK_SPACE || calls[i].first == TOK_LANGUAGE || calls[i].second < n_prompt + 2) {
+            fprintf(stderr, "FAILED: call %zu walked past \"language \"\n", i);
+            ok = false;
+        }
+    }
+
+    const float header = -0.001f - 0.01f;
+    const float p_english = expf(header - 0.5f) + expf(header - 1.5f - 0.1f);
+    const float p_chinese = expf(header - 2.0f);
+    for (const auto & l : languages) {
+        printf("  %-10s %.4f\n", l.language.c_str(), l.prob);
+    }
+    if (languages.size() != 2 || languages[0].language != "English" || languages[1].language != "Chinese" ||
+        fabsf(languages[0].prob - p_english) > 1e-4f || fabsf(languages[1].prob - p_chinese) > 1e-4f) {
+        fprintf(stderr, "FAILED: expected English %.4f (two tokenizations merged), Chinese %.4f\n",
+                p_english, p_chinese);
+        ok = false;
+    }
+
+    // Output without a language header is an error
+    calls.clear();
+    if (rank_language_candidates({TOK_ENGLISH}, {0.0f}, n_prompt, token_bytes, TOK_EOS, step, languages, error) ||
+        error.empty()) {
+        fprintf(stderr, "FAILED: output without a header was ranked\n");
+        ok = false;
+    }
+
+    if (!ok) {
+        printf("\nTEST FAILED!\n");
+        return 1;
+    }
+    printf("\nTEST PASSED!\n");
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include "../src/loop_detector.h"
+
+#include <cstdio>
+#include <vector>
+
+// loop_detector on synthetic token streams: exact period runs are stopped
+// with one copy of the unit kept, near-loops by the trigram ratio, and
+// repetitive but legitimate output (a line sung twice, a counted list,
+// varied text) is left alone.
+
+using namespace qwen3_asr;
+
+// Feed tokens one at a time; the length at which a loop was reported (0 if
+// none) and the detector's n_trim() then
+static int32_t first_loop(const std::vector<int32_t> & tokens, int32_t & n_trim) {
+    loop_detector loops;
+    n_trim = 0;
+    for (int32_t n = 1; n <= (int32_t)tokens.size(); ++n) {
+        if (loops.push(tokens.data(), n)) {
+            n_trim = loops.n_trim();
+            return n;
+        }
+    }
+    return 0;
+}
+
+static std::vector<int32_t> prefix() {
+    std::vector<int32_t> t;
+    for (int32_t i = 0; i < 10; ++i) {
+        t.push_back(100 + i);
+    }
+    return t;
+}
+
+int main() {
+    printf("=== Loop Detector Test ===\n");
+
+    bool ok = true;
+    int32_t n_trim = 0;
+
+    // A period-4 unit: reported once the run spans QWEN3_ASR_LOOP_MIN_TOKENS,
+    // trimmed back to one copy of the unit
+    {
+        std::vector<int32_t> t = prefix();
+        for (int i = 0; i < 20; ++i) {
+            t.insert(t.end(), {1, 2, 3, 4});
+        }
+        const int32_t n = first_loop(t, n_trim);
+        if (n != 10 + QWEN3_ASR_LOOP_MIN_TOKENS || n - n_trim != 10 + 4) {
+            fprintf(stderr, "FAILED: period 4: loop at %d, %d tokens kept\n", n, n - n_trim);
+            ok = false;
+        }
+    }
+
+    // One token over and over
+    {
+        std::vector<int32_t> t = prefix();
+        t.insert(t.end(), 50, 7);
+        const int32_t n = first_loop(t, n_trim);
+        if (n != 10 + QWEN3_ASR_LOOP_MIN_TOKENS || n - n_trim != 10 + 1) {
+            fprintf(stderr, "FAILED: period 1: loop at %d, %d tokens kept\n", n, n - n_trim);
+            ok = false;
+        }
+    }
+
+    // Near loop: a fixed 7-token phrase whose last token varies over four
+    // values without any exact period, caught by the trigram ratio at the
+    // first full window
+    {
+        const int32_t vary[] = {0, 1, 2, 3, 1, 0, 3, 2, 0, 2, 1, 3, 2, 0,
+                                1, 3, 0, 3, 1, 2, 3, 0, 2, 1, 3, 1, 0, 2};
+        const int32_t n_vary = sizeof(vary) / sizeof(vary[0]);
+        std::vector<int32_t> t = prefix();
+        for (int i = 0; i < 40; ++i) {
+            t.insert(t.end(), {1, 2, 3, 4, 5, 6, 7, 50 + vary[i % n_vary]});
+        }
+        const int32_t n = first_loop(t, n_trim);
+        if (n != QWEN3_ASR_LOOP_WINDOW || n_trim != 0) {
+            fprintf(stderr, "FAILED: near loop: loop at %d, n_trim %d\n", n, n_trim);
+            ok = false;
+        }
+    }
+
+    // A 20-token line repeated once (below QWEN3_ASR_LOOP_MIN_REPEATS),
+    // then new text
+    {
+        std::vector<int32_t> t = prefix();
+        for (int r = 0; r < 2; ++r) {
+            for (int32_t i = 0; i < 20; ++i) {
+                t.push_back(200 + i);
+            }
+        }
+        for (int32_t i = 0; i < 40; ++i) {
+            t.push_back(300 + i);
+        }
+        if (first_loop(t, n_trim) != 0) {
+            fprintf(stderr, "FAILED: a line repeated twice was taken for a loop\n");
+            ok = false;
+        }
+    }
+
+    // A counted list ("item 1, item 2, ..."): the same shape every three
+    // tokens, but a different number each time
+    {
+        std::vector<int32_t> t;
+        for (int32_t i = 0; i < 150; ++i) {
+            t.insert(t.end(), {11, 500 + i, 12});
+        }
+        if (first_loop(t, n_trim) != 0) {
+            fprintf(stderr, "FAILED: a counted list was taken for a loop\n");
+            ok = false;
+        }
+    }
+
+    // Varied text
+    {
+        std::vector<int32_t> t;
+        uint32_t s = 1;
+        for (int i = 0; i < 600; ++i) {
+            s = s * 1664525u + 1013904223u;
+            t.push_back((int32_t)((s >> 8) % 1000));
+        }
+        if (first_loop(t, n_trim) != 0) {
+            fprintf(stderr, "FAILED: varied text was taken for a loop\n");
+            ok = false;
+        }
+    }
+
+    if (!ok) {
+        printf("\nTEST FAILED!\n");
+        return 1;
+    }
+    printf("\nTEST PASSED!\n");
+    return 0;
+}
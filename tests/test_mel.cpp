@@ -1,5 +1,6 @@
 #include "../src/mel_spectrogram.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
@@ -91,6 +92,23 @@ int main(int argc, char** argv) {
     }
     printf("  Loaded filters: n_mel=%d, n_fft=%d\n", filters.n_mel, filters.n_fft);
 
+    // Step 2b: The band form used by the kernels must reproduce the dense
+    // matrix exactly: the weights inside each band, zero outside
+    int n_band_bins = 0;
+    for (int j = 0; j < filters.n_mel; j++) {
+        const MelBand & band = filters.bands[j];
+        for (int k = 0; k < filters.n_fft; k++) {
+            const bool inside = k >= band.start && k < band.start + band.len;
+            const float w = inside ? filters.band_weights[band.offset + k - band.start] : 0.0f;
+            if (w != filters.data[j * filters.n_fft + k]) {
+                fprintf(stderr, "FAILED: mel band %d differs from the dense filter at bin %d\n", j, k);
+                return 1;
+            }
+        }
+        n_band_bins += band.len;
+    }
+    printf("  Mel bands: %d of %d filter bins non-zero\n", n_band_bins, filters.n_mel * filters.n_fft);
+
     // Step 3: Compute mel spectrogram
     printf("Computing mel spectrogram...\n");
     MelSpectrogram mel_computed;
@@ -102,6 +120,26 @@ int main(int argc, char** argv) {
     printf("  Computed mel: n_mel=%d, n_len=%d, n_len_org=%d\n", 
            mel_computed.n_mel, mel_computed.n_len, mel_computed.n_len_org);
 
+    // Step 3b: 16-bit input must give exactly the mel of the same values as
+    // floats
+    {
+        std::vector<int16_t> pcm(samples.size());
+        std::vector<float> pcm_float(samples.size());
+        for (size_t i = 0; i < samples.size(); i++) {
+            const float v = std::max(-1.0f, std::min(samples[i], 32767.0f / 32768.0f));
+            pcm[i] = (int16_t)lrintf(v * 32768.0f);
+            pcm_float[i] = pcm[i] / 32768.0f;
+        }
+        MelSpectrogram mel_s16, mel_f32;
+        if (!log_mel_spectrogram(pcm.data(), (int)pcm.size(), filters, mel_s16, n_threads) ||
+            !log_mel_spectrogram(pcm_float.data(), (int)pcm_float.size(), filters, mel_f32, n_threads) ||
+            mel_s16.n_len != mel_f32.n_len || mel_s16.data != mel_f32.data) {
+            fprintf(stderr, "FAILED: 16-bit input differs from the float input\n");
+            return 1;
+        }
+        printf("  16-bit input matches float input\n");
+    }
+
     // Step 4: Save computed mel spectrogram
     printf("Saving computed mel spectrogram...\n");
     // Create output directory if needed
@@ -116,6 +154,81 @@ int main(int argc, char** argv) {
         printf("  Saved to: %s\n", output_path.c_str());
     }
 
+    // Step 4b: Streaming mel in 100 ms blocks must give the same frame count,
+    // and match the offline result once the running max has settled
+    printf("Computing streaming mel spectrogram...\n");
+    MelStream stream(filters, n_threads);
+    const int block = QWEN_SAMPLE_RATE / 10;
+    for (size_t pos = 0; pos < samples.size(); pos += block) {
+        stream.push(samples.data() + pos, static_cast<int>(std::min(samples.size() - pos, (size_t)block)));
+    }
+    stream.finish();
+    const int n_stream = stream.n_available();
+    std::vector<float> mel_stream;
+    stream.read(n_stream, mel_stream);
+    if (n_stream != mel_computed.n_len) {
+        fprintf(stderr, "FAILED: streaming frame count %d vs offline %d\n", n_stream, mel_computed.n_len);
+        return 1;
+    }
+    float stream_diff = 0.0f;
+    for (int j = 0; j < mel_computed.n_mel; j++) {
+        for (int i = 0; i < n_stream; i++) {
+            stream_diff = std::max(stream_diff, std::abs(mel_stream[j * n_stream + i] -
+                                                         mel_computed.data[j * mel_computed.n_len + i]));
+        }
+    }
+    printf("  Streaming frames: %d, max difference to offline: %.6e\n", n_stream, stream_diff);
+
+    // Step 4c: The GPU front end's formulation (windowed DFT basis, dense
+    // mel matmul, log10, max-8 floor) must reproduce the FFT kernels
+    printf("Checking windowed DFT basis formulation...\n");
+    std::vector<float> cos_basis, sin_basis;
+    windowed_dft_basis(cos_basis, sin_basis);
+    {
+        const int n = static_cast<int>(samples.size());
+        const int pad = QWEN_N_FFT / 2;
+        std::vector<float> padded(n + 2 * pad);
+        for (int i = 0; i < n + 2 * pad; i++) {
+            int src = i - pad;
+            src = src < 0 ? -src : (src >= n ? 2 * (n - 1) - src : src);
+            padded[i] = samples[src];
+        }
+        const int n_len = mel_computed.n_len;
+        std::vector<float> basis_mel(static_cast<size_t>(filters.n_mel) * n_len);
+        std::vector<float> power(QWEN_N_FFT_BINS);
+        float mmax = -1e20f;
+        for (int i = 0; i < n_len; i++) {
+            const float * frame = padded.data() + i * QWEN_HOP_LENGTH;
+            for (int k = 0; k < QWEN_N_FFT_BINS; k++) {
+                float re = 0.0f, im = 0.0f;
+                for (int t = 0; t < QWEN_N_FFT; t++) {
+                    re += cos_basis[k * QWEN_N_FFT + t] * frame[t];
+                    im += sin_basis[k * QWEN_N_FFT + t] * frame[t];
+                }
+                power[k] = re * re + im * im;
+            }
+            for (int j = 0; j < filters.n_mel; j++) {
+                float sum = 0.0f;
+                for (int k = 0; k < QWEN_N_FFT_BINS; k++) {
+                    sum += filters.data[j * filters.n_fft + k] * power[k];
+                }
+                const float v = log10f(std::max(sum, 1e-10f));
+                basis_mel[static_cast<size_t>(j) * n_len + i] = v;
+                mmax = std::max(mmax, v);
+            }
+        }
+        float basis_diff = 0.0f;
+        for (size_t i = 0; i < basis_mel.size(); i++) {
+            const float v = (std::max(basis_mel[i], mmax - 8.0f) + 4.0f) / 4.0f;
+            basis_diff = std::max(basis_diff, std::abs(v - mel_computed.data[i]));
+        }
+        printf("  Basis formulation: max difference to the FFT kernels: %.6e\n", basis_diff);
+        if (basis_diff > 2e-4f) {
+            fprintf(stderr, "FAILED: windowed DFT basis differs from log_mel_spectrogram\n");
+            return 1;
+        }
+    }
+
     // Step 5: Load reference mel spectrogram
     printf("Loading reference mel spectrogram...\n");
     MelSpectrogram mel_reference;
@@ -0,0 +1,200 @@
+#include "text_decoder.h"
+#include "qwen3_asr.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+#include <algorithm>
+
+// Paged KV cache (beam search storage): a forked slot shares its pages
+// until one side writes, a shared page is copied before the write,
+// released pages go back to the pool, and decoding over pages gives the
+// tokens of the fixed-slot cache. With an audio file (default sample.wav,
+// skipped if missing) it also checks that beam search with one beam
+// transcribes exactly like greedy decoding.
+
+// Rows per page (QWEN3_ASR_KV_PAGE)
+#define PAGE 16
+
+static int32_t argmax(const float * logits, int32_t n) {
+    return (int32_t)(std::max_element(logits, logits + n) - logits);
+}
+
+static int32_t pages_for(int32_t n_rows) {
+    return (n_rows + PAGE - 1) / PAGE;
+}
+
+static int n_failed = 0;
+
+static void check(bool ok, const char * what) {
+    printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) {
+        n_failed++;
+    }
+}
+
+static int test_beam(const std::string & model_path, const std::string & audio_path) {
+    qwen3_asr::Qwen3ASR asr;
+    if (!asr.load_model(model_path)) {
+        fprintf(stderr, "Failed to load model: %s\n", asr.get_error().c_str());
+        return 1;
+    }
+
+    qwen3_asr::transcribe_params params;
+    params.max_tokens = 64;
+    params.stop_loops = false;  // beam search has no loop stop
+    qwen3_asr::transcribe_result greedy = asr.transcribe(audio_path, params);
+    params.force_beam = true;
+    qwen3_asr::transcribe_result beam = asr.transcribe(audio_path, params);
+    if (!greedy.success || !beam.success) {
+        fprintf(stderr, "Transcription failed: %s\n", (greedy.success ? beam : greedy).error_msg.c_str());
+        return 1;
+    }
+    printf("  greedy: \"%s\"\n  beam-1: \"%s\"\n", greedy.text.c_str(), beam.text.c_str());
+    check(greedy.tokens == beam.tokens, "one beam gives the greedy tokens");
+    return 0;
+}
+
+int main(int argc, char ** argv) {
+    std::string model_path = "models/qwen3-asr-0.6b-f16.gguf";
+    std::string audio_path = "sample.wav";
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--model") == 0 && i + 1 < argc) {
+            model_path = argv[++i];
+        } else if (strcmp(argv[i], "--audio") == 0 && i + 1 < argc) {
+            audio_path = argv[++i];
+        }
+    }
+
+    printf("=== Paged KV Cache Test ===\n\n");
+
+    qwen3_asr::TextDecoder decoder;
+    if (!decoder.load_model(model_path)) {
+        fprintf(stderr, "Failed to load model: %s\n", decoder.get_error().c_str());
+        return 1;
+    }
+
+    const int32_t vocab_size = decoder.get_config().vocab_size;
+    const int n_steps = 20;  // past the end of the prompt's page
+
+    // "The capital of France is"
+    const std::vector<int32_t> prompt = {785, 6722, 315, 9625, 374};
+    const int32_t n_prompt = prompt.size();
+    std::vector<float> logits;
+
+    // Reference: fixed-slot cache, host argmax
+    std::vector<int32_t> expected;
+    if (!decoder.init_kv_cache(64) || !decoder.forward(prompt.data(), n_prompt, 0, logits)) {
+        fprintf(stderr, "Forward failed: %s\n", decoder.get_error().c_str());
+        return 1;
+    }
+    int32_t token = argmax(logits.data(), vocab_size);
+    for (int i = 0; i < n_steps; ++i) {
+        expected.push_back(token);
+        if (!decoder.forward(&token, 1, n_prompt + i, logits)) {
+            fprintf(stderr, "Forward failed: %s\n", decoder.get_error().c_str());
+            return 1;
+        }
+        token = argmax(logits.data(), vocab_size);
+    }
+
+    if (!decoder.reserve_kv_cache(256, 1) || !decoder.begin_paged(2)) {
+        fprintf(stderr, "Failed to start paged mode: %s\n", decoder.get_error().c_str());
+        return 1;
+    }
+    check(decoder.get_n_pages_used() == 0, "paged slots start empty");
+
+    if (!decoder.forward(prompt.data(), n_prompt, 0, logits, 0)) {
+        fprintf(stderr, "Paged prefill failed: %s\n", decoder.get_error().c_str());
+        return 1;
+    }
+    check(argmax(logits.data(), vocab_size) == expected[0], "paged prefill gives the reference token");
+    check(decoder.get_n_pages_used() == pages_for(n_prompt), "prefill takes the pages of the prompt");
+
+    if (!decoder.fork_seq(1, 0)) {
+        fprintf(stderr, "fork_seq failed: %s\n", decoder.get_error().c_str());
+        return 1;
+    }
+    check(decoder.get_n_pages_used() == pages_for(n_prompt), "fork shares the pages");
+    check(decoder.get_seq_used(1) == n_prompt, "fork copies the length");
+
+    // Both slots write position n_prompt into their shared last page: the
+    // first writer gets a copy of the prompt rows, the second keeps the page
+    qwen3_asr::decoder_output out;
+    out.want_logits = true;
+    std::vector<int32_t> seq_ids = {0, 1};
+    std::vector<int32_t> tokens = {expected[0], expected[0]};
+    std::vector<int32_t> n_past = {n_prompt, n_prompt};
+    if (!decoder.forward_batch(seq_ids.data(), tokens.data(), n_past.data(), 2, out)) {
+        fprintf(stderr, "Paged batch failed: %s\n", decoder.get_error().c_str());
+        return 1;
+    }
+    check(decoder.get_n_pages_used() == 2 * pages_for(n_prompt + 1), "a write into a shared page copies it");
+    float max_diff = 0.0f;
+    for (int32_t i = 0; i < vocab_size; ++i) {
+        max_diff = std::max(max_diff, fabsf(out.logits[i] - out.logits[vocab_size + i]));
+    }
+    printf("  copied vs original rows, max logit diff: %g\n", max_diff);
+    check(max_diff < 1e-3f, "the copied page holds the prompt rows");
+    check(out.argmax[0] == expected[1] && out.argmax[1] == expected[1], "both slots continue like the reference");
+
+    // Slot 0 alone for the remaining steps
+    out.want_logits = false;
+    int n_mismatch = 0;
+    token = out.argmax[0];
+    for (int i = 1; i < n_steps; ++i) {
+        if (token != expected[i]) {
+            printf("  step %d: paged %d, reference %d\n", i, token, expected[i]);
+            n_mismatch++;
+        }
+        const int32_t seq = 0;
+        const int32_t pos = n_prompt + i;
+        if (!decoder.forward_batch(&seq, &token, &pos, 1, out)) {
+            fprintf(stderr, "Paged step failed: %s\n", decoder.get_error().c_str());
+            return 1;
+        }
+        token = out.argmax[0];
+    }
+    check(n_mismatch == 0, "paged decode gives the reference tokens");
+
+    const int32_t n_used0 = decoder.get_seq_used(0);
+    decoder.clear_seq(1);
+    check(decoder.get_n_pages_used() == pages_for(n_used0), "clear_seq returns the slot's pages");
+    decoder.truncate_seq(0, PAGE / 2);
+    check(decoder.get_n_pages_used() == 1, "truncate_seq returns the pages past the new end");
+
+    // A page shared by two slots is freed only by the last of them
+    decoder.fork_seq(1, 0);
+    decoder.clear_seq(0);
+    check(decoder.get_n_pages_used() == 1, "a shared page outlives one of its slots");
+    decoder.clear_seq(1);
+    check(decoder.get_n_pages_used() == 0, "all pages back in the pool");
+
+    // Released pages are handed out again
+    if (!decoder.forward(prompt.data(), n_prompt, 0, logits, 1)) {
+        fprintf(stderr, "Prefill into released pages failed: %s\n", decoder.get_error().c_str());
+        return 1;
+    }
+    check(argmax(logits.data(), vocab_size) == expected[0], "prefill into reused pages");
+
+    struct stat st;
+    if (stat(audio_path.c_str(), &st) == 0) {
+        printf("\nBeam search with one beam (%s):\n", audio_path.c_str());
+        if (test_beam(model_path, audio_path) != 0) {
+            return 1;
+        }
+    } else {
+        printf("\n%s not found, skipping the beam search check\n", audio_path.c_str());
+    }
+
+    if (n_failed == 0) {
+        printf("\nTEST PASSED!\n");
+        return 0;
+    }
+    printf("\nTEST FAILED! %d checks failed\n", n_failed);
+    return 1;
+}
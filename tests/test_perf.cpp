@@ -0,0 +1,370 @@
+// Performance regression test: times one pipeline stage at a fixed shape
+// and compares the median with a stored per-machine baseline.
+//
+//   test_perf --case <name> --baseline tests/perf/<machine>.json [--tolerance 0.15]
+//
+// Cases: mel (30 s), conv (conv frontend, 10 s), encoder_window (encoder
+// transformer over one 104-frame attention window), decode_step (one token
+// after a 256-token prompt) and aligner (10 s with 20 words).
+//
+// Exit codes: 0 within tolerance (or baseline written with --update), 1 on a
+// slowdown or error, 77 skipped (model or baseline missing).
+
+#include "../src/mel_spectrogram.h"
+#include "../src/audio_encoder.h"
+#include "../src/text_decoder.h"
+#include "../src/forced_aligner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define PERF_SKIP 77
+
+// Prompt length before the timed decode step
+#define PERF_DECODE_PROMPT 256
+
+struct perf_params {
+    std::string name;
+    std::string model_path = "models/qwen3-asr-0.6b-f16.gguf";
+    std::string aligner_model_path = "models/qwen3-forced-aligner-0.6b-f16.gguf";
+    std::string baseline_path;
+    float tolerance = 0.15f;
+    int32_t n_threads = 4;
+    int32_t n_warmup = 2;
+    int32_t n_runs = 10;
+    bool use_gpu = true;
+    bool update = false;
+};
+
+struct baseline_entry {
+    double median_ms = 0.0;
+    std::string shape;
+};
+
+static double now_ms() {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool file_exists(const std::string & path) {
+    std::ifstream f(path);
+    return f.good();
+}
+
+// Deterministic speech-like test signal: a few harmonics with a slow
+// envelope plus low-level noise
+static std::vector<float> synth_audio(float seconds) {
+    const int n = (int)(seconds * QWEN_SAMPLE_RATE);
+    std::vector<float> samples(n);
+    uint32_t state = 12345;
+    for (int i = 0; i < n; ++i) {
+        const float t = (float)i / QWEN_SAMPLE_RATE;
+        const float env = 0.5f + 0.5f * sinf(2.0f * (float)M_PI * 3.0f * t);
+        float v = 0.0f;
+        for (int h = 1; h <= 4; ++h) {
+            v += sinf(2.0f * (float)M_PI * 180.0f * h * t) / h;
+        }
+        state = state * 1664525u + 1013904223u;
+        const float noise = ((state >> 8) / 16777216.0f - 0.5f) * 0.02f;
+        samples[i] = 0.2f * env * v + noise;
+    }
+    return samples;
+}
+
+// Median of n_runs timed calls of fn after n_warmup untimed ones
+static bool measure(const perf_params & params, const std::function<bool()> & fn, double & median_ms) {
+    std::vector<double> times;
+    for (int run = 0; run < params.n_warmup + params.n_runs; ++run) {
+        const double t0 = now_ms();
+        if (!fn()) {
+            return false;
+        }
+        if (run >= params.n_warmup) {
+            times.push_back(now_ms() - t0);
+        }
+    }
+    std::sort(times.begin(), times.end());
+    median_ms = times[times.size() / 2];
+    return true;
+}
+
+// Baseline files are written by write_baselines:
+//   {"cases": {"<name>": {"median_ms": 1.234, "shape": "..."}, ...}}
+static std::map<std::string, baseline_entry> read_baselines(const std::string & path) {
+    std::map<std::string, baseline_entry> entries;
+    std::ifstream f(path);
+    if (!f) {
+        return entries;
+    }
+    std::stringstream ss;
+    ss << f.rdbuf();
+    const std::string s = ss.str();
+
+    const size_t cases = s.find("\"cases\"");
+    if (cases == std::string::npos) {
+        return entries;
+    }
+    size_t pos = s.find('{', cases);
+    while (pos != std::string::npos) {
+        const size_t k0 = s.find('"', pos + 1);
+        if (k0 == std::string::npos) {
+            break;
+        }
+        const size_t k1 = s.find('"', k0 + 1);
+        const size_t obj = s.find('{', k1);
+        const size_t end = s.find('}', k1);
+        if (k1 == std::string::npos || obj == std::string::npos || end == std::string::npos || obj > end) {
+            break;
+        }
+        baseline_entry e;
+        const std::string body = s.substr(obj, end - obj);
+        const size_t m = body.find("\"median_ms\"");
+        if (m != std::string::npos) {
+            e.median_ms = strtod(body.c_str() + body.find(':', m) + 1, nullptr);
+        }
+        const size_t sh = body.find("\"shape\"");
+        if (sh != std::string::npos) {
+            const size_t v0 = body.find('"', body.find(':', sh));
+            const size_t v1 = body.find('"', v0 + 1);
+            e.shape = body.substr(v0 + 1, v1 - v0 - 1);
+        }
+        entries[s.substr(k0 + 1, k1 - k0 - 1)] = e;
+        pos = end;
+    }
+    return entries;
+}
+
+static bool write_baselines(const std::string & path, const std::map<std::string, baseline_entry> & entries) {
+    FILE * out = fopen(path.c_str(), "w");
+    if (!out) {
+        return false;
+    }
+    fprintf(out, "{\n  \"cases\": {\n");
+    size_t i = 0;
+    for (const auto & kv : entries) {
+        fprintf(out, "    \"%s\": {\"median_ms\": %.3f, \"shape\": \"%s\"}%s\n",
+                kv.first.c_str(), kv.second.median_ms, kv.second.shape.c_str(),
+                ++i < entries.size() ? "," : "");
+    }
+    fprintf(out, "  }\n}\n");
+    return fclose(out) == 0;
+}
+
+static qwen3_asr::cpu_backend_params backend_params(const perf_params & params) {
+    qwen3_asr::cpu_backend_params cp;
+    cp.n_threads = params.n_threads;
+    cp.use_gpu = params.use_gpu;
+    return cp;
+}
+
+// Backend part of every case's shape, so a baseline recorded on another
+// backend or thread count is not compared against
+static std::string backend_shape(const perf_params & params) {
+    return std::string(params.use_gpu ? "gpu" : "cpu") + ", " + std::to_string(params.n_threads) + " threads";
+}
+
+// Run one case; returns PERF_SKIP when its model is missing, 1 on errors
+static int run_case(const perf_params & params, double & median_ms, std::string & shape) {
+    char buf[128];
+
+    // Built once, outside the timed calls
+    MelFilters filters;
+    generate_mel_filters(filters, QWEN_N_MELS, QWEN_N_FFT, QWEN_SAMPLE_RATE);
+
+    if (params.name == "mel") {
+        const std::vector<float> samples = synth_audio(30.0f);
+        shape = "30 s";
+        MelSpectrogram mel;
+        return measure(params, [&]() {
+            return log_mel_spectrogram(samples.data(), (int)samples.size(), filters, mel, params.n_threads);
+        }, median_ms) ? 0 : 1;
+    }
+
+    const bool aligner = params.name == "aligner";
+    const std::string & model_path = aligner ? params.aligner_model_path : params.model_path;
+    if (!file_exists(model_path)) {
+        printf("SKIPPED: model not found: %s\n", model_path.c_str());
+        return PERF_SKIP;
+    }
+
+    if (params.name == "conv" || params.name == "encoder_window") {
+        qwen3_asr::AudioEncoder encoder;
+        if (!encoder.load_model(model_path, backend_params(params))) {
+            fprintf(stderr, "FAILED: %s\n", encoder.get_error().c_str());
+            return 1;
+        }
+        MelSpectrogram mel;
+        const std::vector<float> samples = synth_audio(10.0f);
+        if (!log_mel_spectrogram(samples.data(), (int)samples.size(), filters, mel, params.n_threads)) {
+            fprintf(stderr, "FAILED: mel\n");
+            return 1;
+        }
+        std::vector<float> conv;
+        auto run_conv = [&]() { return encoder.encode_conv(mel.data.data(), mel.n_mel, mel.n_len, conv); };
+        if (params.name == "conv") {
+            snprintf(buf, sizeof(buf), "%d mel frames", mel.n_len);
+            shape = buf;
+            return measure(params, run_conv, median_ms) ? 0 : 1;
+        }
+
+        const int n_ctx = encoder.get_attn_window() > 0 ? encoder.get_attn_window() : 104;
+        const int d_model = encoder.get_hparams().d_model;
+        if (!run_conv() || (int)(conv.size() / d_model) < n_ctx) {
+            fprintf(stderr, "FAILED: conv frontend: %s\n", encoder.get_error().c_str());
+            return 1;
+        }
+        snprintf(buf, sizeof(buf), "%d conv frames", n_ctx);
+        shape = buf;
+        std::vector<float> out;
+        return measure(params, [&]() { return encoder.encode_transformer(conv.data(), n_ctx, out); },
+                       median_ms) ? 0 : 1;
+    }
+
+    if (params.name == "decode_step") {
+        qwen3_asr::TextDecoder decoder;
+        if (!decoder.load_model(model_path, backend_params(params)) ||
+            !decoder.reserve_kv_cache(PERF_DECODE_PROMPT + 16)) {
+            fprintf(stderr, "FAILED: %s\n", decoder.get_error().c_str());
+            return 1;
+        }
+        std::vector<int32_t> prompt(PERF_DECODE_PROMPT);
+        for (int i = 0; i < PERF_DECODE_PROMPT; ++i) {
+            prompt[i] = 100 + (i * 37) % 5000;
+        }
+        qwen3_asr::decoder_output out;
+        out.want_logits = false;
+        if (!decoder.forward(prompt.data(), PERF_DECODE_PROMPT, 0, out)) {
+            fprintf(stderr, "FAILED: prefill: %s\n", decoder.get_error().c_str());
+            return 1;
+        }
+        snprintf(buf, sizeof(buf), "1 token after %d", PERF_DECODE_PROMPT);
+        shape = buf;
+        const int32_t token = 220;
+        return measure(params, [&]() {
+            // Each step writes the same KV row, so the shape stays fixed
+            decoder.truncate_seq(0, PERF_DECODE_PROMPT);
+            return decoder.forward(&token, 1, PERF_DECODE_PROMPT, out);
+        }, median_ms) ? 0 : 1;
+    }
+
+    if (aligner) {
+        qwen3_asr::ForcedAligner fa;
+        if (!fa.load_model(model_path, backend_params(params))) {
+            fprintf(stderr, "FAILED: %s\n", fa.get_error().c_str());
+            return 1;
+        }
+        const std::vector<float> samples = synth_audio(10.0f);
+        const std::string text = "the quick brown fox jumps over the lazy dog while "
+                                 "five boxing wizards jump quickly past the old tree";
+        shape = "10 s, 20 words";
+        return measure(params, [&]() {
+            return fa.align(samples.data(), (int)samples.size(), text, "English").success;
+        }, median_ms) ? 0 : 1;
+    }
+
+    fprintf(stderr, "Unknown case: %s\n", params.name.c_str());
+    return 1;
+}
+
+static void print_usage(const char * prog) {
+    fprintf(stderr, "Usage: %s --case <name> --baseline <file.json> [options]\n", prog);
+    fprintf(stderr, "  --case <name>           mel, conv, encoder_window, decode_step or aligner\n");
+    fprintf(stderr, "  --baseline <file>       Per-machine baseline JSON\n");
+    fprintf(stderr, "  --tolerance <f>         Allowed slowdown over the baseline (default: 0.15)\n");
+    fprintf(stderr, "  --update                Store the measured median as the baseline\n");
+    fprintf(stderr, "  --model <path>          ASR model (default: models/qwen3-asr-0.6b-f16.gguf)\n");
+    fprintf(stderr, "  --aligner-model <path>  Aligner model (default: models/qwen3-forced-aligner-0.6b-f16.gguf)\n");
+    fprintf(stderr, "  --threads <n>           CPU threads (default: 4)\n");
+    fprintf(stderr, "  --runs <n>              Timed runs (default: 10)\n");
+    fprintf(stderr, "  --cpu                   Run on the CPU backend only\n");
+}
+
+int main(int argc, char ** argv) {
+    perf_params params;
+    for (int i = 1; i < argc; ++i) {
+        const char * arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (strcmp(arg, "--case") == 0 && has_value) {
+            params.name = argv[++i];
+        } else if (strcmp(arg, "--baseline") == 0 && has_value) {
+            params.baseline_path = argv[++i];
+        } else if (strcmp(arg, "--tolerance") == 0 && has_value) {
+            params.tolerance = (float)atof(argv[++i]);
+        } else if (strcmp(arg, "--update") == 0) {
+            params.update = true;
+        } else if (strcmp(arg, "--model") == 0 && has_value) {
+            params.model_path = argv[++i];
+        } else if (strcmp(arg, "--aligner-model") == 0 && has_value) {
+            params.aligner_model_path = argv[++i];
+        } else if (strcmp(arg, "--threads") == 0 && has_value) {
+            params.n_threads = atoi(argv[++i]);
+        } else if (strcmp(arg, "--runs") == 0 && has_value) {
+            params.n_runs = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(arg, "--cpu") == 0) {
+            params.use_gpu = false;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (params.name.empty() || params.baseline_path.empty()) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    printf("=== Perf: %s ===\n", params.name.c_str());
+
+    // Without a baseline there is nothing to compare with: skip before
+    // loading models and timing
+    std::map<std::string, baseline_entry> baselines = read_baselines(params.baseline_path);
+    auto it = baselines.find(params.name);
+    if (!params.update && (it == baselines.end() || it->second.median_ms <= 0.0)) {
+        printf("SKIPPED: no baseline for %s in %s (record one with --update)\n",
+               params.name.c_str(), params.baseline_path.c_str());
+        return PERF_SKIP;
+    }
+
+    double median_ms = 0.0;
+    std::string shape;
+    const int rc = run_case(params, median_ms, shape);
+    if (rc != 0) {
+        return rc;
+    }
+    shape += ", " + backend_shape(params);
+    printf("  %s: median %.3f ms over %d runs\n", shape.c_str(), median_ms, params.n_runs);
+
+    if (params.update) {
+        baselines[params.name] = baseline_entry{median_ms, shape};
+        if (!write_baselines(params.baseline_path, baselines)) {
+            fprintf(stderr, "FAILED: could not write %s\n", params.baseline_path.c_str());
+            return 1;
+        }
+        printf("  Baseline written to %s\n", params.baseline_path.c_str());
+        return 0;
+    }
+
+    if (it->second.shape != shape) {
+        printf("SKIPPED: baseline shape \"%s\" differs from \"%s\"\n", it->second.shape.c_str(), shape.c_str());
+        return PERF_SKIP;
+    }
+
+    const double limit = it->second.median_ms * (1.0 + params.tolerance);
+    printf("  Baseline %.3f ms, limit %.3f ms (+%.0f%%)\n", it->second.median_ms, limit, 100.0 * params.tolerance);
+    if (median_ms > limit) {
+        fprintf(stderr, "FAILED: %s is %.1f%% slower than its baseline\n",
+                params.name.c_str(), 100.0 * (median_ms / it->second.median_ms - 1.0));
+        return 1;
+    }
+    printf("\nPASSED\n");
+    return 0;
+}
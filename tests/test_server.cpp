@@ -0,0 +1,218 @@
+#include "../src/server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// AsrServer over a Unix socket: more concurrent transcription requests than
+// HTTP threads must all be admitted at once (an admitted request does not
+// hold its thread), be gathered into batches, and /health must answer while
+// they are in flight. Then the server is started and stopped repeatedly
+// with idle threads: stop() and wait() must return every time.
+
+// Concurrent requests, HTTP threads
+#define N_REQUESTS 6
+#define N_HTTP_THREADS 2
+
+// Start/stop cycles with idle workers
+#define N_RESTARTS 20
+
+// 2 s, 16 kHz, 16-bit mono WAV of a tone with some noise
+static std::string make_wav() {
+    const int sample_rate = 16000;
+    const int n = 2 * sample_rate;
+    std::string data((size_t)n * 2, '\0');
+    uint32_t noise = 12345;
+    for (int i = 0; i < n; ++i) {
+        noise = noise * 1664525u + 1013904223u;
+        const float v = 0.3f * sinf(2.0f * 3.14159265f * 220.0f * i / sample_rate) +
+                        0.05f * ((float)(noise >> 16) / 32768.0f - 1.0f);
+        const int16_t s = (int16_t)(v * 32767.0f);
+        memcpy(&data[(size_t)i * 2], &s, 2);
+    }
+    auto u32 = [](uint32_t v) { return std::string((const char *)&v, 4); };
+    auto u16 = [](uint16_t v) { return std::string((const char *)&v, 2); };
+    return "RIFF" + u32(36 + (uint32_t)data.size()) + "WAVE" +
+           "fmt " + u32(16) + u16(1) + u16(1) + u32(sample_rate) + u32(sample_rate * 2) + u16(2) + u16(16) +
+           "data" + u32((uint32_t)data.size()) + data;
+}
+
+// One request on a new connection; returns the status (0 on a socket
+// error) and the body
+static int http(const std::string & socket_path, const std::string & method, const std::string & path,
+                const std::string & body, std::string & response_body) {
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    if (fd < 0 || connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 0;
+    }
+    std::string req = method + " " + path + " HTTP/1.1\r\nHost: localhost\r\n";
+    if (!body.empty()) {
+        req += "Content-Type: audio/wav\r\nContent-Length: " + std::to_string(body.size()) + "\r\n";
+    }
+    req += "\r\n" + body;
+    for (size_t off = 0; off < req.size();) {
+        const ssize_t n = send(fd, req.data() + off, req.size() - off, MSG_NOSIGNAL);
+        if (n <= 0) {
+            close(fd);
+            return 0;
+        }
+        off += (size_t)n;
+    }
+    std::string resp;
+    char buf[4096];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+        resp.append(buf, (size_t)n);
+    }
+    close(fd);
+    const size_t body_start = resp.find("\r\n\r\n");
+    if (resp.rfind("HTTP/1.1 ", 0) != 0 || body_start == std::string::npos) {
+        return 0;
+    }
+    response_body = resp.substr(body_start + 4);
+    return atoi(resp.c_str() + 9);
+}
+
+// Integer after "key": in a /metrics body, -1 if absent
+static long metric(const std::string & body, const char * key) {
+    const std::string k = std::string("\"") + key + "\": ";
+    const size_t pos = body.find(k);
+    return pos == std::string::npos ? -1 : atol(body.c_str() + pos + k.size());
+}
+
+int main(int argc, char ** argv) {
+    std::string model_path = "models/qwen3-asr-0.6b-f16.gguf";
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--model") == 0 && i + 1 < argc) {
+            model_path = argv[++i];
+        }
+    }
+
+    printf("=== Server Test ===\n");
+
+    qwen3_asr::Qwen3ASR asr;
+    if (!asr.load_model(model_path)) {
+        fprintf(stderr, "Failed to load model: %s\n", asr.get_error().c_str());
+        return 1;
+    }
+
+    qwen3_asr::server_params sp;
+    sp.unix_socket = "/tmp/qwen3_asr_test_server_" + std::to_string(getpid()) + ".sock";
+    sp.n_http_threads = N_HTTP_THREADS;
+    sp.max_batch = 8;
+    sp.batch_wait_ms = 1000;  // long enough for every request to be admitted
+    sp.transcribe.max_tokens = 16;
+    sp.transcribe.language = "English";
+
+    qwen3_asr::AsrServer server(asr, sp);
+    if (!server.start()) {
+        fprintf(stderr, "Failed to start server: %s\n", server.get_error().c_str());
+        return 1;
+    }
+
+    const std::string wav = make_wav();
+    std::vector<int> status(N_REQUESTS, 0);
+    std::vector<std::thread> clients;
+    for (int i = 0; i < N_REQUESTS; ++i) {
+        clients.emplace_back([&, i]() {
+            std::string body;
+            status[i] = http(sp.unix_socket, "POST", "/v1/audio/transcriptions", wav, body);
+        });
+    }
+
+    // All requests in flight at once, and /health still answers
+    bool ok = true;
+    long max_admitted = 0;
+    bool health_ok = false;
+    const auto t_end = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (std::chrono::steady_clock::now() < t_end && (max_admitted < N_REQUESTS || !health_ok)) {
+        std::string body;
+        if (http(sp.unix_socket, "GET", "/metrics", "", body) == 200) {
+            max_admitted = std::max(max_admitted, metric(body, "admitted"));
+        }
+        if (max_admitted > N_HTTP_THREADS && !health_ok) {
+            health_ok = http(sp.unix_socket, "GET", "/health", "", body) == 200;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    for (auto & t : clients) {
+        t.join();
+    }
+
+    printf("  requests in flight at once: %ld (HTTP threads: %d)\n", max_admitted, N_HTTP_THREADS);
+    if (max_admitted != N_REQUESTS) {
+        fprintf(stderr, "FAILED: only %ld of %d requests admitted at once\n", max_admitted, N_REQUESTS);
+        ok = false;
+    }
+    if (!health_ok) {
+        fprintf(stderr, "FAILED: /health did not answer while requests were in flight\n");
+        ok = false;
+    }
+    for (int i = 0; i < N_REQUESTS; ++i) {
+        if (status[i] != 200) {
+            fprintf(stderr, "FAILED: request %d returned %d\n", i, status[i]);
+            ok = false;
+        }
+    }
+
+    std::string body;
+    http(sp.unix_socket, "GET", "/metrics", "", body);
+    const long n_batches = metric(body, "batches");
+    const long n_ok = metric(body, "ok");
+    printf("  completed: %ld, batches: %ld\n", n_ok, n_batches);
+    if (n_ok != N_REQUESTS || n_batches < 1 || n_batches >= N_REQUESTS) {
+        fprintf(stderr, "FAILED: %d requests should complete in fewer batches\n", N_REQUESTS);
+        ok = false;
+    }
+
+    server.request_stop();
+    server.stop();
+
+    // Restarts: the same server and fresh ones, stopped right away, or
+    // released from wait() by request_stop() on another thread
+    sp.n_http_threads = 4;
+    int n_restarts = 0;
+    for (int i = 0; i < N_RESTARTS && ok; ++i) {
+        qwen3_asr::AsrServer fresh(asr, sp);
+        qwen3_asr::AsrServer & s = i % 2 == 0 ? server : fresh;
+        if (!s.start()) {
+            fprintf(stderr, "FAILED: restart %d: %s\n", i, s.get_error().c_str());
+            ok = false;
+            break;
+        }
+        if (i % 4 == 1) {
+            std::thread waiter([&s]() { s.wait(); });
+            s.request_stop();
+            waiter.join();
+        } else if (i % 4 == 2 && http(sp.unix_socket, "GET", "/health", "", body) != 200) {
+            fprintf(stderr, "FAILED: /health after restart %d\n", i);
+            ok = false;
+        }
+        s.stop();
+        n_restarts++;
+    }
+    printf("  restarts: %d\n", n_restarts);
+
+    if (!ok) {
+        printf("\nTEST FAILED!\n");
+        return 1;
+    }
+    printf("\nTEST PASSED!\n");
+    return 0;
+}
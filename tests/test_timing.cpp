@@ -0,0 +1,128 @@
+#include "../src/timing.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+// QWEN3_TIMER from concurrent threads, as in the stage threads of
+// transcribe_batch: every span must be counted once in the totals and be
+// exported once, and the buffers of finished threads must be reused by
+// the next ones rather than grow with every thread started.
+
+// Threads per round, spans per thread. A reused buffer collects the
+// events of several threads, so all events of both rounds together stay
+// below QWEN3_ASR_TRACE_CAPACITY and none is overwritten.
+#define N_THREADS 8
+#define N_SPANS 2000
+
+using namespace qwen3_asr;
+
+static void run_round() {
+    // Every thread records its first span only once all have started
+    std::atomic<int> n_ready{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < N_THREADS; ++t) {
+        threads.emplace_back([t, &n_ready]() {
+            QWEN3_TRACE_REQUEST_ID((uint64_t)t + 1);
+            n_ready++;
+            while (n_ready.load() < N_THREADS) {
+                std::this_thread::yield();
+            }
+            for (int i = 0; i < N_SPANS; ++i) {
+                QWEN3_TIMER("test.span");
+                if (i % 100 == 0) {
+                    QWEN3_TIMER("test.inner");
+                }
+            }
+        });
+    }
+    for (auto & t : threads) {
+        t.join();
+    }
+}
+
+// Occurrences of needle in the file at path
+static long count_in_file(const std::string & path, const char * needle) {
+    FILE * f = fopen(path.c_str(), "rb");
+    if (!f) {
+        return -1;
+    }
+    std::string s;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        s.append(buf, n);
+    }
+    fclose(f);
+    long count = 0;
+    for (size_t pos = s.find(needle); pos != std::string::npos; pos = s.find(needle, pos + 1)) {
+        count++;
+    }
+    return count;
+}
+
+int main() {
+    printf("=== Timing Tracer Test ===\n");
+
+    TimingProfiler & profiler = TimingProfiler::instance();
+    TimingProfiler::set_enabled(true);
+    QWEN3_TIMER_RESET();
+
+    bool ok = true;
+
+    // Two rounds: the second runs on the buffers the first released
+    run_round();
+    run_round();
+
+    const auto totals = profiler.totals();
+    const auto span = totals.find("test.span");
+    const auto inner = totals.find("test.inner");
+    const long n_span = span == totals.end() ? 0 : (long)span->second.second;
+    const long n_inner = inner == totals.end() ? 0 : (long)inner->second.second;
+    printf("  test.span: %ld, test.inner: %ld\n", n_span, n_inner);
+    if (n_span != 2L * N_THREADS * N_SPANS || n_inner != 2L * N_THREADS * (N_SPANS / 100)) {
+        fprintf(stderr, "FAILED: expected %ld and %ld spans\n",
+                2L * N_THREADS * N_SPANS, 2L * N_THREADS * (N_SPANS / 100));
+        ok = false;
+    }
+
+    const std::string path = "/tmp/qwen3_asr_test_timing_" + std::to_string(getpid()) + ".json";
+    if (!profiler.export_chrome_trace(path)) {
+        fprintf(stderr, "FAILED: could not export %s\n", path.c_str());
+        ok = false;
+    } else {
+        const long n_events = count_in_file(path, "\"name\": \"test.span\"");
+        const long n_threads = count_in_file(path, "\"thread_name\"");
+        remove(path.c_str());
+        printf("  exported test.span events: %ld, thread buffers: %ld\n", n_events, n_threads);
+        if (n_events != 2L * N_THREADS * N_SPANS) {
+            fprintf(stderr, "FAILED: exported %ld test.span events\n", n_events);
+            ok = false;
+        }
+        if (n_threads > N_THREADS) {
+            fprintf(stderr, "FAILED: %ld buffers for %d concurrent threads\n", n_threads, N_THREADS);
+            ok = false;
+        }
+    }
+
+    // Disabled, nothing is recorded
+    TimingProfiler::set_enabled(false);
+    QWEN3_TIMER_RESET();
+    run_round();
+    if (!profiler.totals().empty()) {
+        fprintf(stderr, "FAILED: spans recorded while disabled\n");
+        ok = false;
+    }
+
+    if (!ok) {
+        printf("\nTEST FAILED!\n");
+        return 1;
+    }
+    printf("\nTEST PASSED!\n");
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include "../src/vad.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Synthetic input: tone bursts separated by low-level noise (seconds)
+struct region {
+    float start;
+    float end;
+    bool speech;
+};
+
+static const region REGIONS[] = {
+    { 0.0f,  4.0f, false},
+    { 4.0f,  7.0f, true },
+    { 7.0f, 10.0f, false},
+    {10.0f, 50.0f, true },   // longer than one segment: must be split
+    {50.0f, 53.0f, false},
+};
+
+int main() {
+    printf("=== VAD Segmentation Test ===\n");
+
+    const float total_sec = 53.0f;
+    std::vector<float> samples((size_t)(total_sec * QWEN_SAMPLE_RATE));
+    srand(1234);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        const float t = (float)i / QWEN_SAMPLE_RATE;
+        float v = 1e-4f * ((float)rand() / RAND_MAX - 0.5f);
+        for (const auto & r : REGIONS) {
+            if (r.speech && t >= r.start && t < r.end) {
+                v += 0.3f * sinf(2.0f * (float)M_PI * 440.0f * t) + 0.1f * sinf(2.0f * (float)M_PI * 1250.0f * t);
+            }
+        }
+        samples[i] = v;
+    }
+
+    MelFilters filters;
+    generate_mel_filters(filters);
+    MelSpectrogram mel;
+    if (!log_mel_spectrogram(samples.data(), (int)samples.size(), filters, mel, 4)) {
+        fprintf(stderr, "FAILED: Could not compute mel spectrogram\n");
+        return 1;
+    }
+
+    qwen3_asr::vad_params params;
+    std::vector<qwen3_asr::speech_segment> segments = qwen3_asr::detect_speech_segments(mel, params);
+
+    const float frame_sec = (float)QWEN_HOP_LENGTH / QWEN_SAMPLE_RATE;
+    bool ok = true;
+    float prev_end = -1.0f;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        const float s = segments[i].start_frame * frame_sec;
+        const float e = segments[i].end_frame * frame_sec;
+        printf("  segment %zu: %.2f - %.2f s\n", i, s, e);
+        if (e - s > params.max_segment_sec + 1e-3f) {
+            fprintf(stderr, "FAILED: segment %zu is longer than %.0f s\n", i, params.max_segment_sec);
+            ok = false;
+        }
+        if (s < prev_end) {
+            fprintf(stderr, "FAILED: segment %zu overlaps the previous one\n", i);
+            ok = false;
+        }
+        prev_end = e;
+        // Nothing from the middle of a silent region may be kept
+        for (const auto & r : REGIONS) {
+            if (!r.speech && s < r.end - 0.5f && e > r.start + 0.5f) {
+                fprintf(stderr, "FAILED: segment %zu covers silence %.0f - %.0f s\n", i, r.start, r.end);
+                ok = false;
+            }
+        }
+    }
+
+    // Every speech region must be covered end to end
+    for (const auto & r : REGIONS) {
+        if (!r.speech) {
+            continue;
+        }
+        for (float t = r.start + 0.1f; t < r.end - 0.1f; t += 0.05f) {
+            bool covered = false;
+            for (const auto & seg : segments) {
+                covered |= t >= seg.start_frame * frame_sec && t < seg.end_frame * frame_sec;
+            }
+            if (!covered) {
+                fprintf(stderr, "FAILED: speech at %.2f s is not in any segment\n", t);
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    if (segments.size() != 3) {
+        fprintf(stderr, "FAILED: expected 3 segments, got %zu\n", segments.size());
+        ok = false;
+    }
+
+    if (!ok) {
+        return 1;
+    }
+    printf("\nPASSED\n");
+    return 0;
+}